@@ -0,0 +1,490 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+/**
+* Unit tests for bam-load's SAM parser and the threaded SAM reader
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/rc.h>
+#include <kfs/file.h>
+
+extern "C" {
+#include "../../tools/bam-loader/sam.h"
+#include "../../tools/bam-loader/bam.h"
+}
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+using namespace std;
+
+TEST_SUITE(SamSuite);
+
+struct RefNameLookupContext
+{
+    vector < string > names;
+};
+
+static bool LookupRef ( RefNameLookupContext * p_ctx, char const p_name [], size_t p_namelen, int32_t * p_result )
+{
+    for ( size_t i = 0; i != p_ctx -> names . size (); ++ i )
+    {
+        if ( p_ctx -> names [ i ] == string ( p_name, p_namelen ) )
+        {
+            * p_result = ( int32_t ) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t U32 ( uint8_t const * p )
+{
+    return p [ 0 ] | ( p [ 1 ] << 8 ) | ( p [ 2 ] << 16 ) | ( ( uint32_t ) p [ 3 ] << 24 );
+}
+
+static int32_t I32 ( uint8_t const * p )
+{
+    return ( int32_t ) U32 ( p );
+}
+
+static uint16_t U16 ( uint8_t const * p )
+{
+    return ( uint16_t ) ( p [ 0 ] | ( p [ 1 ] << 8 ) );
+}
+
+static float F32 ( uint8_t const * p )
+{
+    uint32_t const u = U32 ( p );
+    float f;
+    memcpy ( & f, & u, 4 );
+    return f;
+}
+
+/* offsets into a BAM record without its block_size */
+enum { REF_ID = 0, POS = 4, NAME_LEN = 8, MAPQ = 9, N_CIGAR = 12, FLAG = 14, READ_LEN = 16,
+       MATE_REF_ID = 20, MATE_POS = 24, TLEN = 28, NAME = 32 };
+
+class SamParser_Fixture
+{
+public:
+    SamParser_Fixture()
+    {
+        m_refs . names . push_back ( "chr1" );
+        m_refs . names . push_back ( "chr2" );
+        m_refs . names . push_back ( "chrM" );
+        m_out . base = NULL;
+        m_out . static_buffer = NULL;
+        m_out . size = 0;
+        m_out . used = 0;
+    }
+    ~SamParser_Fixture()
+    {
+        SAM2BAM_OutputWhack ( & m_out );
+    }
+
+    rc_t Parse ( const string & p_line )
+    {
+        m_start = m_out . used;
+        return SAM2BAM_ParseLine ( & m_out, p_line . data (), p_line . size (), LookupRef, & m_refs );
+    }
+
+    uint8_t const * Rec () const { return m_out . base + m_start; }
+    size_t Size () const { return m_out . used - m_start; }
+
+    /* where the CIGAR, SEQ, QUAL and the tags start */
+    uint8_t const * Cigar () const { return Rec () + NAME + Rec () [ NAME_LEN ]; }
+    uint8_t const * Seq () const { return Cigar () + 4 * U16 ( Rec () + N_CIGAR ); }
+    uint8_t const * Qual () const { return Seq () + ( U32 ( Rec () + READ_LEN ) + 1 ) / 2; }
+    uint8_t const * Tags () const { return Qual () + U32 ( Rec () + READ_LEN ); }
+    size_t TagsSize () const { return Rec () + Size () - Tags (); }
+
+    RefNameLookupContext m_refs;
+    SAM2BAM_Output m_out;
+    size_t m_start;
+};
+
+FIXTURE_TEST_CASE ( Parse_Mandatory, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "read1\t99\tchr2\t100\t30\t3M2I5M\t=\t200\t150\tACGTNACGTA\tIIIII#####" ) );
+
+    REQUIRE_EQ ( I32 ( Rec () + REF_ID ), 1 );
+    REQUIRE_EQ ( I32 ( Rec () + POS ), 99 );
+    REQUIRE_EQ ( ( int ) Rec () [ NAME_LEN ], 6 );
+    REQUIRE_EQ ( string ( ( char const * ) Rec () + NAME ), string ( "read1" ) );
+    REQUIRE_EQ ( ( int ) Rec () [ MAPQ ], 30 );
+    REQUIRE_EQ ( ( int ) U16 ( Rec () + FLAG ), 99 );
+    REQUIRE_EQ ( I32 ( Rec () + MATE_REF_ID ), 1 ); /* '=' */
+    REQUIRE_EQ ( I32 ( Rec () + MATE_POS ), 199 );
+    REQUIRE_EQ ( I32 ( Rec () + TLEN ), 150 );
+
+    REQUIRE_EQ ( ( int ) U16 ( Rec () + N_CIGAR ), 3 );
+    REQUIRE_EQ ( U32 ( Cigar () + 0 ), ( uint32_t ) ( ( 3 << 4 ) | 0 ) );
+    REQUIRE_EQ ( U32 ( Cigar () + 4 ), ( uint32_t ) ( ( 2 << 4 ) | 1 ) );
+    REQUIRE_EQ ( U32 ( Cigar () + 8 ), ( uint32_t ) ( ( 5 << 4 ) | 0 ) );
+
+    /* =ACMGRSVTWYHKDBN, two bases a byte, high nibble first */
+    REQUIRE_EQ ( U32 ( Rec () + READ_LEN ), ( uint32_t ) 10 );
+    static uint8_t const seq [] = { 0x12, 0x48, 0xF1, 0x24, 0x81 };
+    REQUIRE_EQ ( memcmp ( Seq (), seq, sizeof seq ), 0 );
+    for ( unsigned i = 0; i != 10; ++ i )
+        REQUIRE_EQ ( ( int ) Qual () [ i ], i < 5 ? 40 : 2 );
+
+    REQUIRE_EQ ( TagsSize (), ( size_t ) 0 );
+    REQUIRE_EQ ( Size (), ( size_t ) ( NAME + 6 + 12 + 5 + 10 ) );
+}
+
+FIXTURE_TEST_CASE ( Parse_AllCigarOps_OddLength, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "r\t0\tchr1\t1\t0\t1M2I3D4N5S6H7P8=9X\t*\t0\t0\tACG\t!!~" ) );
+    REQUIRE_EQ ( ( int ) U16 ( Rec () + N_CIGAR ), 9 );
+    for ( unsigned i = 0; i != 9; ++ i )
+        REQUIRE_EQ ( U32 ( Cigar () + 4 * i ), ( uint32_t ) ( ( ( i + 1 ) << 4 ) | i ) );
+    static uint8_t const seq [] = { 0x12, 0x40 };
+    REQUIRE_EQ ( memcmp ( Seq (), seq, sizeof seq ), 0 );
+    REQUIRE_EQ ( ( int ) Qual () [ 0 ], 0 );
+    REQUIRE_EQ ( ( int ) Qual () [ 2 ], 93 );
+}
+
+FIXTURE_TEST_CASE ( Parse_StarFields, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "r2\t4\t*\t0\t0\t*\t*\t0\t0\t*\t*" ) );
+    REQUIRE_EQ ( I32 ( Rec () + REF_ID ), -1 );
+    REQUIRE_EQ ( I32 ( Rec () + POS ), -1 );
+    REQUIRE_EQ ( I32 ( Rec () + MATE_REF_ID ), -1 );
+    REQUIRE_EQ ( I32 ( Rec () + MATE_POS ), -1 );
+    REQUIRE_EQ ( ( int ) U16 ( Rec () + N_CIGAR ), 0 );
+    REQUIRE_EQ ( U32 ( Rec () + READ_LEN ), ( uint32_t ) 0 );
+    REQUIRE_EQ ( Size (), ( size_t ) ( NAME + 3 ) );
+}
+
+FIXTURE_TEST_CASE ( Parse_StarQual, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "r3\t0\tchrM\t5\t60\t4M\t*\t0\t0\tACGT\t*" ) );
+    REQUIRE_EQ ( I32 ( Rec () + REF_ID ), 2 );
+    for ( unsigned i = 0; i != 4; ++ i )
+        REQUIRE_EQ ( ( int ) Qual () [ i ], 0xFF );
+}
+
+FIXTURE_TEST_CASE ( Parse_UnknownReference, SamParser_Fixture )
+{
+    REQUIRE_RC_FAIL ( Parse ( "r4\t0\tchrX\t5\t60\t4M\t*\t0\t0\tACGT\t*" ) );
+    REQUIRE_EQ ( m_out . used, ( size_t ) 0 );
+    REQUIRE_RC_FAIL ( Parse ( "r4\t1\tchr1\t5\t60\t4M\tchrX\t9\t0\tACGT\t*" ) );
+    REQUIRE_EQ ( m_out . used, ( size_t ) 0 );
+    /* a prefix of a known name is not known */
+    REQUIRE_RC_FAIL ( Parse ( "r4\t0\tchr\t5\t60\t4M\t*\t0\t0\tACGT\t*" ) );
+    REQUIRE_RC ( Parse ( "r4\t1\tchr1\t5\t60\t4M\tchr2\t9\t0\tACGT\t*" ) );
+    REQUIRE_EQ ( I32 ( Rec () + MATE_REF_ID ), 1 );
+}
+
+FIXTURE_TEST_CASE ( Parse_Tags, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "r5\t0\tchr1\t1\t0\t2M\t*\t0\t0\tAC\tII"
+                         "\tXA:A:x\tNM:i:-7\tXF:f:1.5\tRG:Z:group 1\tXH:H:1AE3" ) );
+    uint8_t const * t = Tags ();
+    REQUIRE_EQ ( memcmp ( t, "XAAx", 4 ), 0 ); t += 4;
+    REQUIRE_EQ ( memcmp ( t, "NMi", 3 ), 0 );
+    REQUIRE_EQ ( I32 ( t + 3 ), -7 ); t += 7;
+    REQUIRE_EQ ( memcmp ( t, "XFf", 3 ), 0 );
+    REQUIRE_EQ ( F32 ( t + 3 ), 1.5f ); t += 7;
+    REQUIRE_EQ ( memcmp ( t, "RGZgroup 1", 11 ), 0 ); t += 11;
+    REQUIRE_EQ ( memcmp ( t, "XHH1AE3", 8 ), 0 ); t += 8;
+    REQUIRE_EQ ( ( size_t ) ( t - Tags () ), TagsSize () );
+}
+
+FIXTURE_TEST_CASE ( Parse_ArrayTags, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "r6\t0\tchr1\t1\t0\t2M\t*\t0\t0\tAC\tII"
+                         "\tXC:B:C,1,255\tXs:B:s,-2,3,-4\tXf:B:f,0.25,-8\tXe:B:i" ) );
+    uint8_t const * t = Tags ();
+    /* unsigned arrays come out as I, signed ones as i */
+    REQUIRE_EQ ( memcmp ( t, "XCBI", 4 ), 0 );
+    REQUIRE_EQ ( U32 ( t + 4 ), ( uint32_t ) 2 );
+    REQUIRE_EQ ( U32 ( t + 8 ), ( uint32_t ) 1 );
+    REQUIRE_EQ ( U32 ( t + 12 ), ( uint32_t ) 255 ); t += 16;
+    REQUIRE_EQ ( memcmp ( t, "XsBi", 4 ), 0 );
+    REQUIRE_EQ ( U32 ( t + 4 ), ( uint32_t ) 3 );
+    REQUIRE_EQ ( I32 ( t + 8 ), -2 );
+    REQUIRE_EQ ( I32 ( t + 12 ), 3 );
+    REQUIRE_EQ ( I32 ( t + 16 ), -4 ); t += 20;
+    REQUIRE_EQ ( memcmp ( t, "XfBf", 4 ), 0 );
+    REQUIRE_EQ ( U32 ( t + 4 ), ( uint32_t ) 2 );
+    REQUIRE_EQ ( F32 ( t + 8 ), 0.25f );
+    REQUIRE_EQ ( F32 ( t + 12 ), -8.0f ); t += 16;
+    REQUIRE_EQ ( memcmp ( t, "XeBi", 4 ), 0 ); /* no elements */
+    REQUIRE_EQ ( U32 ( t + 4 ), ( uint32_t ) 0 ); t += 8;
+    REQUIRE_EQ ( ( size_t ) ( t - Tags () ), TagsSize () );
+}
+
+FIXTURE_TEST_CASE ( Parse_BadFields, SamParser_Fixture )
+{
+    string const head = "r7\t0\tchr1\t1\t0\t2M\t*\t0\t0\tAC\tII";
+    REQUIRE_RC_FAIL ( Parse ( "r7\t0\tchr1\t1\t0\t2M\t*\t0\t0\tAC" ) ); /* too few fields */
+    REQUIRE_RC_FAIL ( Parse ( "r7\t0\tchr1\t1\t0\t2Q\t*\t0\t0\tAC\tII" ) );
+    REQUIRE_RC_FAIL ( Parse ( "r7\t0\tchr1\t1\t0\tM\t*\t0\t0\tAC\tII" ) );
+    REQUIRE_RC_FAIL ( Parse ( "r7\t0\tchr1\t1\t0\t2M\t*\t0\t0\tA!\tII" ) );
+    REQUIRE_RC_FAIL ( Parse ( "r7\t0\tchr1\t1\t0\t2M\t*\t0\t0\tAC\tI" ) ); /* QUAL too short */
+    REQUIRE_RC_FAIL ( Parse ( "r7\t70000\tchr1\t1\t0\t2M\t*\t0\t0\tAC\tII" ) );
+    REQUIRE_RC_FAIL ( Parse ( head + "\tXA:B:" ) );
+    REQUIRE_RC_FAIL ( Parse ( head + "\tXA:B:q,1" ) );
+    REQUIRE_RC_FAIL ( Parse ( head + "\tXA:B:C,-1" ) );
+    REQUIRE_RC_FAIL ( Parse ( head + "\tXA:H:ABC" ) );
+    REQUIRE_RC_FAIL ( Parse ( head + "\tXA:i:x" ) );
+    REQUIRE_RC_FAIL ( Parse ( head + "\tX:i:1" ) );
+    REQUIRE_EQ ( m_out . used, ( size_t ) 0 );
+}
+
+FIXTURE_TEST_CASE ( Parse_Appends, SamParser_Fixture )
+{
+    REQUIRE_RC ( Parse ( "a\t4\t*\t0\t0\t*\t*\t0\t0\t*\t*" ) );
+    size_t const first = m_out . used;
+    REQUIRE_RC ( Parse ( "b\t4\t*\t0\t0\t*\t*\t0\t0\t*\t*" ) );
+    REQUIRE_EQ ( m_start, first );
+    REQUIRE_EQ ( string ( ( char const * ) m_out . base + NAME ), string ( "a" ) );
+    REQUIRE_EQ ( string ( ( char const * ) Rec () + NAME ), string ( "b" ) );
+
+    /* outgrows the first buffer */
+    string const seq ( 100000, 'A' );
+    REQUIRE_RC ( Parse ( "c\t0\tchr1\t1\t0\t100000M\t*\t0\t0\t" + seq + "\t*" ) );
+    REQUIRE_EQ ( U32 ( Rec () + READ_LEN ), ( uint32_t ) 100000 );
+    REQUIRE_EQ ( string ( ( char const * ) m_out . base + NAME ), string ( "a" ) );
+}
+
+/* SAM files through BAM_File */
+
+static string const SamHeader =
+    "@HD\tVN:1.6\tSO:unsorted\n"
+    "@SQ\tSN:chr2\tLN:2000\n"
+    "@SQ\tSN:chr1\tLN:1000\n"
+    "@RG\tID:rg1\tSM:sample1\tLB:lib1\tPL:ILLUMINA\n"
+    "@RG\tID:rg2\tSM:sample2\n"
+    "@PG\tID:test\tPN:test-sam\n"
+    "@CO\tfree text\n";
+
+class SamFile_Fixture
+{
+public:
+    SamFile_Fixture() : m_file ( NULL )
+    {
+    }
+    ~SamFile_Fixture()
+    {
+        BAM_FileRelease ( m_file );
+        if ( ! m_path . empty () )
+            remove ( m_path . c_str () );
+    }
+
+    void Write ( const char * p_name, const string & p_text )
+    {
+        m_path = p_name;
+        FILE * f = fopen ( p_name, "w" );
+        if ( f == NULL || fwrite ( p_text . data (), 1, p_text . size (), f ) != p_text . size () )
+            throw logic_error ( "cannot write " + m_path );
+        fclose ( f );
+    }
+
+    void Open ( unsigned p_threads )
+    {
+        BAM_FileRelease ( m_file );
+        m_file = NULL;
+        if ( BAM_FileMake ( & m_file, NULL, NULL, "%s", m_path . c_str () ) != 0 )
+            throw logic_error ( "BAM_FileMake failed" );
+        if ( BAM_FileSetInflateThreads ( m_file, p_threads ) != 0 )
+            throw logic_error ( "BAM_FileSetInflateThreads failed" );
+    }
+
+    /* one line for every record: its name, reference and position, or the error */
+    vector < string > ReadAll ()
+    {
+        vector < string > result;
+        for ( ; ; )
+        {
+            const BAM_Alignment * rec = NULL;
+            rc_t rc = BAM_FileRead2 ( m_file, & rec );
+            if ( rc != 0 )
+            {
+                if ( GetRCObject ( rc ) == ( int ) rcRow && GetRCState ( rc ) == rcNotFound )
+                    break;
+                char buf [ 64 ];
+                snprintf ( buf, sizeof buf, "error %u", ( unsigned ) rc );
+                result . push_back ( buf );
+                continue;
+            }
+            const char * name = NULL;
+            int32_t ref = 0;
+            int64_t pos = 0;
+            uint32_t len = 0;
+            BAM_AlignmentGetReadName ( rec, & name );
+            BAM_AlignmentGetRefSeqId ( rec, & ref );
+            BAM_AlignmentGetPosition ( rec, & pos );
+            BAM_AlignmentGetReadLength ( rec, & len );
+            string seq ( len, ' ' );
+            BAM_AlignmentGetSequence ( rec, & seq [ 0 ] );
+            char buf [ 128 ];
+            snprintf ( buf, sizeof buf, "%s %d %ld ", name, ( int ) ref, ( long ) pos );
+            result . push_back ( buf + seq );
+            BAM_AlignmentRelease ( rec );
+        }
+        return result;
+    }
+
+    string m_path;
+    const BAM_File * m_file;
+};
+
+FIXTURE_TEST_CASE ( SamFile_Header, SamFile_Fixture )
+{
+    Write ( "test-sam.header.sam", SamHeader + "r1\t0\tchr1\t10\t60\t4M\t*\t0\t0\tACGT\t*\tRG:Z:rg2\n" );
+    Open ( 0 );
+
+    uint32_t count = 0;
+    REQUIRE_RC ( BAM_FileGetRefSeqCount ( m_file, & count ) );
+    REQUIRE_EQ ( count, ( uint32_t ) 2 );
+    const BAMRefSeq * ref = NULL;
+    /* in SAM, the references are numbered in alphabetical order */
+    REQUIRE_RC ( BAM_FileGetRefSeqById ( m_file, 0, & ref ) );
+    REQUIRE_EQ ( string ( ref -> name ), string ( "chr1" ) );
+    REQUIRE_EQ ( ref -> length, ( uint64_t ) 1000 );
+    REQUIRE_RC ( BAM_FileGetRefSeqById ( m_file, 1, & ref ) );
+    REQUIRE_EQ ( string ( ref -> name ), string ( "chr2" ) );
+    REQUIRE_EQ ( ref -> length, ( uint64_t ) 2000 );
+
+    REQUIRE_RC ( BAM_FileGetReadGroupCount ( m_file, & count ) );
+    REQUIRE_EQ ( count, ( uint32_t ) 2 );
+    const BAMReadGroup * rg = NULL;
+    REQUIRE_RC ( BAM_FileGetReadGroupByName ( m_file, "rg1", & rg ) );
+    REQUIRE_EQ ( string ( rg -> sample ), string ( "sample1" ) );
+    REQUIRE_EQ ( string ( rg -> library ), string ( "lib1" ) );
+    REQUIRE_EQ ( string ( rg -> platform ), string ( "ILLUMINA" ) );
+
+    const char * text = NULL;
+    size_t textLen = 0;
+    REQUIRE_RC ( BAM_FileGetHeaderText ( m_file, & text, & textLen ) );
+    REQUIRE_EQ ( string ( text, textLen ), SamHeader );
+
+    vector < string > const recs = ReadAll ();
+    REQUIRE_EQ ( recs . size (), ( size_t ) 1 );
+    REQUIRE_EQ ( recs [ 0 ], string ( "r1 0 9 ACGT" ) );
+}
+
+/* several chunks of about a MiB each, with bad lines in between */
+static string MakeSam ( unsigned p_records )
+{
+    static char const bases [] = "ACGT";
+    string text = SamHeader;
+    for ( unsigned i = 0; i != p_records; ++ i )
+    {
+        char seq [ 101 ];
+        for ( unsigned j = 0; j != 100; ++ j )
+            seq [ j ] = bases [ ( i * 7 + j * 3 + ( j * j ) % 5 ) % 4 ];
+        seq [ 100 ] = '\0';
+        char line [ 512 ];
+        char const * ref = i % 1000 == 999 ? "chrZ" : i % 3 == 0 ? "chr1" : "chr2";
+        snprintf ( line, sizeof line, "read%07u\t%u\t%s\t%u\t60\t100M\t*\t0\t0\t%s\t*\tNM:i:%u\tRG:Z:rg1%s",
+                   i, i % 7 == 0 ? 16 : 0, ref, 1 + i % 900, seq, i % 5, i % 2 == 0 ? "\r\n" : "\n" );
+        text += line;
+    }
+    return text;
+}
+
+FIXTURE_TEST_CASE ( SamFile_Threads_InOrder, SamFile_Fixture )
+{
+    unsigned const N = 40000;
+    Write ( "test-sam.threads.sam", MakeSam ( N ) );
+    REQUIRE_GT ( m_path . size (), ( size_t ) 0 );
+
+    Open ( 0 );
+    vector < string > const expected = ReadAll ();
+    REQUIRE_EQ ( expected . size (), ( size_t ) N );
+    REQUIRE_EQ ( expected [ 998 ] . substr ( 0, 11 ), string ( "read0000998" ) );
+    REQUIRE_EQ ( expected [ 999 ] . substr ( 0, 6 ), string ( "error " ) );
+
+    for ( unsigned threads = 1; threads <= 4; ++ threads )
+    {
+        Open ( threads );
+        vector < string > const actual = ReadAll ();
+        REQUIRE_EQ ( actual . size (), expected . size () );
+        for ( size_t i = 0; i != actual . size (); ++ i )
+            REQUIRE_EQ ( actual [ i ], expected [ i ] );
+    }
+}
+
+FIXTURE_TEST_CASE ( SamFile_Threads_Truncated, SamFile_Fixture )
+{
+    /* a last line without its line-feed is reported as a truncated file */
+    Write ( "test-sam.eof.sam", SamHeader
+                              + "a\t4\t*\t0\t0\t*\t*\t0\t0\tAC\t*\n"
+                              + "b\t4\t*\t0\t0\t*\t*\t0\t0\tGT\t*" );
+    Open ( 0 );
+    vector < string > const expected = ReadAll ();
+    REQUIRE_EQ ( expected . size (), ( size_t ) 2 );
+    REQUIRE_EQ ( expected [ 0 ], string ( "a -1 -1 AC" ) );
+    REQUIRE_EQ ( expected [ 1 ] . substr ( 0, 6 ), string ( "error " ) );
+    Open ( 2 );
+    vector < string > const actual = ReadAll ();
+    REQUIRE_EQ ( actual . size (), ( size_t ) 2 );
+    REQUIRE_EQ ( actual [ 0 ], expected [ 0 ] );
+    REQUIRE_EQ ( actual [ 1 ], expected [ 1 ] );
+}
+
+//////////////////////////////////////////// Main
+extern "C"
+{
+
+#include <kapp/args.h>
+#include <kfg/config.h>
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+rc_t CC UsageSummary (const char * progname)
+{
+    return 0;
+}
+
+rc_t CC Usage ( const Args * args )
+{
+    return 0;
+}
+
+const char UsageDefaultName[] = "test-sam";
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    KConfigDisableUserSettings();
+    rc_t rc=SamSuite(argc, argv);
+    return rc;
+}
+
+}
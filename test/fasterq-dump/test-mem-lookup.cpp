@@ -0,0 +1,164 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* Unit tests for the in-memory lookup-table of fasterq-dump ( mem_lookup )
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/rc.h>
+#include <klib/text.h>
+
+#include "../../tools/fasterq-dump/helper.h"
+#include "../../tools/fasterq-dump/mem_lookup.h"
+
+#include <string>
+
+using namespace std;
+
+TEST_SUITE(MemLookupSuite);
+
+class MemLookup_Fixture
+{
+public:
+    MemLookup_Fixture() : m_lookup ( NULL )
+    {
+        make_SBuffer ( & m_packed, 4096 );
+        make_SBuffer ( & m_bases, 4096 );
+    }
+    ~MemLookup_Fixture()
+    {
+        release_mem_lookup ( m_lookup );
+        release_SBuffer ( & m_packed );
+        release_SBuffer ( & m_bases );
+    }
+
+    rc_t Put ( int64_t p_spot, uint32_t p_read, const string & p_bases )
+    {
+        String S;
+        StringInit ( & S, p_bases . c_str (), p_bases . size (), ( uint32_t ) p_bases . size () );
+        rc_t rc = pack_read_2_2na ( & S, & m_packed );
+        if ( rc == 0 )
+            rc = mem_lookup_put ( m_lookup, make_key ( p_spot, p_read ), & m_packed . S );
+        return rc;
+    }
+
+    string Get ( int64_t p_spot, uint32_t p_read )
+    {
+        if ( mem_lookup_bases ( m_lookup, p_spot, p_read, & m_bases, false ) != 0 )
+            return "<not found>";
+        return string ( m_bases . S . addr, m_bases . S . len );
+    }
+
+    /* a read of p_len bases, every other one a 'N': its packed form is twice its length */
+    static string Read ( size_t p_len, int64_t p_seed )
+    {
+        static const char bases [] = "ACGT";
+        string s ( p_len, 'N' );
+        for ( size_t i = 0; i < p_len; i += 2 )
+            s [ i ] = bases [ ( i / 2 + p_seed ) & 3 ];
+        return s;
+    }
+
+    struct mem_lookup * m_lookup;
+    SBuffer m_packed;
+    SBuffer m_bases;
+};
+
+FIXTURE_TEST_CASE ( RoundTrip, MemLookup_Fixture )
+{
+    REQUIRE_RC ( make_mem_lookup ( & m_lookup, 0 ) );
+    for ( int64_t spot = 1; spot <= 5000; ++ spot )
+        REQUIRE_RC ( Put ( spot, 1, Read ( 1 + spot % 301, spot ) ) );
+    REQUIRE_EQ ( mem_lookup_count ( m_lookup ), ( uint64_t ) 5000 );
+    for ( int64_t spot = 1; spot <= 5000; ++ spot )
+        REQUIRE_EQ ( Get ( spot, 1 ), Read ( 1 + spot % 301, spot ) );
+}
+
+FIXTURE_TEST_CASE ( LongRead, MemLookup_Fixture )
+{   /* packed reads bigger than the first chunk of a shard ( 64 KiB ) */
+    REQUIRE_RC ( make_mem_lookup ( & m_lookup, 0 ) );
+    string const big = Read ( 0xFFFF, 7 );
+    string const bigger = Read ( 0xFFFE, 3 );
+
+    REQUIRE_RC ( Put ( 1, 1, big ) );
+    REQUIRE_GT ( m_packed . S . size, ( size_t ) ( 64 * 1024 ) );
+    for ( int64_t spot = 2; spot <= 2000; ++ spot )
+        REQUIRE_RC ( Put ( spot, 2, Read ( 1 + spot % 301, spot ) ) );
+    REQUIRE_RC ( Put ( 2001, 1, bigger ) );
+    for ( int64_t spot = 2002; spot <= 3000; ++ spot )
+        REQUIRE_RC ( Put ( spot, 2, Read ( 1 + spot % 301, spot ) ) );
+
+    REQUIRE_EQ ( Get ( 1, 1 ), big );
+    REQUIRE_EQ ( Get ( 2001, 1 ), bigger );
+    for ( int64_t spot = 2; spot <= 3000; ++ spot )
+    {
+        if ( spot != 2001 )
+            REQUIRE_EQ ( Get ( spot, 2 ), Read ( 1 + spot % 301, spot ) );
+    }
+}
+
+FIXTURE_TEST_CASE ( Budget, MemLookup_Fixture )
+{
+    /* room for the empty table only */
+    REQUIRE_RC ( make_mem_lookup ( & m_lookup, mem_lookup_estimate ( 0, 0 ) ) );
+    rc_t rc = Put ( 1, 1, Read ( 100, 1 ) );
+    REQUIRE_NE ( rc, ( rc_t ) 0 );
+    REQUIRE ( mem_lookup_exhausted ( rc ) );
+}
+
+//////////////////////////////////////////// Main
+extern "C"
+{
+
+#include <kapp/args.h>
+#include <kfg/config.h>
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+rc_t CC UsageSummary (const char * progname)
+{
+    return 0;
+}
+
+rc_t CC Usage ( const Args * args )
+{
+    return 0;
+}
+
+const char UsageDefaultName[] = "test-mem-lookup";
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    KConfigDisableUserSettings();
+    rc_t rc=MemLookupSuite(argc, argv);
+    return rc;
+}
+
+}
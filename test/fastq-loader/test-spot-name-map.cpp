@@ -0,0 +1,301 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+/**
+* Unit tests for the spot-name map shared by bam-load and latf-load
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/rc.h>
+
+#include "../../tools/bam-loader/spot-name-map.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+TEST_SUITE(SpotNameMapSuite);
+
+class SpotNameMap_Fixture
+{
+public:
+    SpotNameMap_Fixture() : m_self ( NULL )
+    {
+    }
+    ~SpotNameMap_Fixture()
+    {
+        SpotNameMapRelease ( m_self );
+    }
+
+    void Make ( size_t p_limit, const char * p_tmpfs = "." )
+    {
+        if ( SpotNameMapMake ( & m_self, p_limit, p_tmpfs, 1 ) != 0 )
+            throw logic_error ( "SpotNameMapMake failed" );
+    }
+
+    rc_t Entry ( unsigned p_group, const string & p_name )
+    {
+        return SpotNameMapEntry ( m_self, p_group, p_name . c_str (), p_name . size (), & m_id, & m_inserted );
+    }
+
+    static string Name ( unsigned p_i )
+    {
+        char buf [ 64 ];
+        snprintf ( buf, sizeof buf, "HWI-ST1234:8:1101:%u:%u", p_i % 7919, p_i );
+        return string ( buf );
+    }
+
+    SpotNameMap *   m_self;
+    uint32_t        m_id;
+    bool            m_inserted;
+};
+
+TEST_CASE ( Make_Release )
+{
+    SpotNameMap * self = NULL;
+    REQUIRE_RC ( SpotNameMapMake ( & self, 0, ".", 1 ) );
+    REQUIRE_NOT_NULL ( self );
+    REQUIRE_EQ ( SpotNameMapIdCount ( self, 0 ), ( uint32_t ) 0 );
+    REQUIRE_EQ ( SpotNameMapRunCount ( self ), 0u );
+    SpotNameMapRelease ( self );
+}
+
+FIXTURE_TEST_CASE ( Entry_IdsPerGroup, SpotNameMap_Fixture )
+{
+    Make ( 0 );
+    for ( unsigned i = 0; i != 100; ++i )
+    {
+        REQUIRE_RC ( Entry ( 0, Name ( i ) ) );
+        REQUIRE ( m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) i );
+    }
+    for ( unsigned i = 0; i != 10; ++i )
+    {   /* every group counts from 0 */
+        REQUIRE_RC ( Entry ( 1, Name ( 1000 + i ) ) );
+        REQUIRE ( m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) i );
+    }
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 0 ), ( uint32_t ) 100 );
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 1 ), ( uint32_t ) 10 );
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 2 ), ( uint32_t ) 0 );
+
+    for ( unsigned i = 0; i != 100; ++i )
+    {
+        REQUIRE_RC ( Entry ( 0, Name ( i ) ) );
+        REQUIRE ( ! m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) i );
+    }
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 0 ), ( uint32_t ) 100 );
+}
+
+FIXTURE_TEST_CASE ( Entry_Duplicates, SpotNameMap_Fixture )
+{
+    Make ( 0 );
+    REQUIRE_RC ( Entry ( 0, "spot" ) );
+    REQUIRE ( m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 0 );
+    REQUIRE_RC ( Entry ( 0, "spot" ) );
+    REQUIRE ( ! m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 0 );
+
+    /* the same name in another group is another spot */
+    REQUIRE_RC ( Entry ( 3, "spot" ) );
+    REQUIRE ( m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 0 );
+
+    /* a prefix of a name is another name */
+    REQUIRE_RC ( Entry ( 0, "spo" ) );
+    REQUIRE ( m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 1 );
+    REQUIRE_RC ( Entry ( 0, "" ) );
+    REQUIRE ( m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 2 );
+    REQUIRE_RC ( Entry ( 0, "" ) );
+    REQUIRE ( ! m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 2 );
+
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 0 ), ( uint32_t ) 3 );
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 3 ), ( uint32_t ) 1 );
+}
+
+FIXTURE_TEST_CASE ( Entry_BadGroup, SpotNameMap_Fixture )
+{
+    Make ( 0 );
+    REQUIRE_RC_FAIL ( Entry ( SPOT_NAME_MAP_GROUPS + 1, "spot" ) );
+}
+
+FIXTURE_TEST_CASE ( Group_Numbering, SpotNameMap_Fixture )
+{
+    Make ( 0 );
+    unsigned group = 99;
+    bool inserted = false;
+    REQUIRE_RC ( SpotNameMapGroup ( m_self, "RG-A", 2, & group, & inserted ) );
+    REQUIRE ( inserted );
+    REQUIRE_EQ ( group, 0u );
+    REQUIRE_RC ( SpotNameMapGroup ( m_self, "RG-B", 2, & group, & inserted ) );
+    REQUIRE ( inserted );
+    REQUIRE_EQ ( group, 1u );
+    REQUIRE_RC ( SpotNameMapGroup ( m_self, "RG-A", 2, & group, & inserted ) );
+    REQUIRE ( ! inserted );
+    REQUIRE_EQ ( group, 0u );
+
+    /* a third group is one too many */
+    rc_t const rc = SpotNameMapGroup ( m_self, "RG-C", 2, & group, & inserted );
+    REQUIRE_EQ ( ( int ) GetRCObject ( rc ), ( int ) rcConstraint );
+    REQUIRE_EQ ( ( int ) GetRCState ( rc ), ( int ) rcViolated );
+
+    /* the group names do not take ids from the spot groups */
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 0 ), ( uint32_t ) 0 );
+}
+
+FIXTURE_TEST_CASE ( Spill_Lookup, SpotNameMap_Fixture )
+{
+    unsigned const N = 5000;
+
+    Make ( 64 ); /* one byte a shard: spills every SPILL_MIN_COUNT names */
+    for ( unsigned i = 0; i != N; ++i )
+    {
+        REQUIRE_RC ( Entry ( i % 2, Name ( i ) ) );
+        REQUIRE ( m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) ( i / 2 ) );
+    }
+    REQUIRE_NE ( SpotNameMapRunCount ( m_self ), 0u );
+
+    /* found in the runs or in memory, never inserted again */
+    for ( unsigned i = N; i != 0; )
+    {
+        --i;
+        REQUIRE_RC ( Entry ( i % 2, Name ( i ) ) );
+        REQUIRE ( ! m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) ( i / 2 ) );
+    }
+    /* not in group 2 */
+    REQUIRE_RC ( Entry ( 2, Name ( 0 ) ) );
+    REQUIRE ( m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 0 );
+
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 0 ), ( uint32_t ) ( N / 2 ) );
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 1 ), ( uint32_t ) ( N / 2 ) );
+}
+
+FIXTURE_TEST_CASE ( Spill_ReleaseNames, SpotNameMap_Fixture )
+{
+    unsigned const N = 3000;
+
+    Make ( 64 );
+    for ( unsigned i = 0; i != N; ++i )
+        REQUIRE_RC ( Entry ( i % 3, Name ( i ) ) );
+    for ( unsigned i = 0; i < N; i += 7 )
+    {
+        REQUIRE_RC ( Entry ( i % 3, Name ( i ) ) );
+        REQUIRE ( ! m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) ( i / 3 ) );
+    }
+
+    /* what bam-load keeps of the map once the names are not needed any more */
+    vector < uint32_t > counts;
+    for ( unsigned g = 0; g != SPOT_NAME_MAP_GROUPS; ++g )
+        counts . push_back ( SpotNameMapIdCount ( m_self, g ) );
+    SpotNameMapRelease ( m_self );
+    m_self = NULL;
+
+    REQUIRE_EQ ( counts [ 0 ], ( uint32_t ) ( N / 3 ) );
+    REQUIRE_EQ ( counts [ 1 ], ( uint32_t ) ( N / 3 ) );
+    REQUIRE_EQ ( counts [ 2 ], ( uint32_t ) ( N / 3 ) );
+    REQUIRE_EQ ( counts [ 3 ], ( uint32_t ) 0 );
+
+    /* a new map starts over */
+    Make ( 64 );
+    REQUIRE_RC ( Entry ( 0, Name ( 0 ) ) );
+    REQUIRE ( m_inserted );
+    REQUIRE_EQ ( m_id, ( uint32_t ) 0 );
+}
+
+FIXTURE_TEST_CASE ( Spill_Failure, SpotNameMap_Fixture )
+{
+    Make ( 64, "./no/such/directory" );
+
+    /* fill until some shard fails to write its run */
+    rc_t rc = 0;
+    unsigned i;
+    for ( i = 0; rc == 0 && i != 100000; ++i )
+        rc = Entry ( 0, Name ( i ) );
+    REQUIRE_RC_FAIL ( rc );
+    unsigned const failed = i - 1;
+    uint32_t const count = SpotNameMapIdCount ( m_self, 0 );
+    REQUIRE_EQ ( count, ( uint32_t ) failed ); /* the failed name was not inserted */
+    unsigned const runs = SpotNameMapRunCount ( m_self );
+
+    /* the same error again, without another attempt to spill */
+    REQUIRE_EQ ( Entry ( 0, Name ( failed ) ), rc );
+    REQUIRE_EQ ( SpotNameMapIdCount ( m_self, 0 ), count );
+    REQUIRE_EQ ( SpotNameMapRunCount ( m_self ), runs );
+
+    /* the names that went in are still there */
+    for ( unsigned j = 0; j != failed; ++j )
+    {
+        REQUIRE_RC ( Entry ( 0, Name ( j ) ) );
+        REQUIRE ( ! m_inserted );
+        REQUIRE_EQ ( m_id, ( uint32_t ) j );
+    }
+}
+
+//////////////////////////////////////////// Main
+extern "C"
+{
+
+#include <kapp/args.h>
+#include <kfg/config.h>
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+rc_t CC UsageSummary (const char * progname)
+{
+    return 0;
+}
+
+rc_t CC Usage ( const Args * args )
+{
+    return 0;
+}
+
+const char UsageDefaultName[] = "test-spot-name-map";
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    KConfigDisableUserSettings();
+    rc_t rc=SpotNameMapSuite(argc, argv);
+    return rc;
+}
+
+}
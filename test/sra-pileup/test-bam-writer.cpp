@@ -0,0 +1,728 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+/**
+* Unit tests for sam-dump's BAM-writer: the BGZF-blocks, the BAM-records and the
+* BAI-index are read back the way htslib reads them
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/rc.h>
+#include <kfs/directory.h>
+#include <kfs/file.h>
+
+#include "../../tools/sra-pileup/bam_writer.h"
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+TEST_SUITE(BamWriterSuite);
+
+static uint16_t Le16 ( const uint8_t * p )
+{
+    return ( uint16_t ) ( p [ 0 ] | ( p [ 1 ] << 8 ) );
+}
+
+static uint32_t Le32 ( const uint8_t * p )
+{
+    return p [ 0 ] | ( p [ 1 ] << 8 ) | ( p [ 2 ] << 16 ) | ( ( uint32_t ) p [ 3 ] << 24 );
+}
+
+static uint64_t Le64 ( const uint8_t * p )
+{
+    return Le32 ( p ) | ( ( uint64_t ) Le32 ( p + 4 ) << 32 );
+}
+
+/* reg2bin and reg2bins from the SAM specification, [ beg, end ) is 0-based */
+static uint32_t Reg2Bin ( int64_t beg, int64_t end )
+{
+    --end;
+    if ( beg >> 14 == end >> 14 ) return ( ( 1 << 15 ) - 1 ) / 7 + ( uint32_t ) ( beg >> 14 );
+    if ( beg >> 17 == end >> 17 ) return ( ( 1 << 12 ) - 1 ) / 7 + ( uint32_t ) ( beg >> 17 );
+    if ( beg >> 20 == end >> 20 ) return ( ( 1 << 9 ) - 1 ) / 7 + ( uint32_t ) ( beg >> 20 );
+    if ( beg >> 23 == end >> 23 ) return ( ( 1 << 6 ) - 1 ) / 7 + ( uint32_t ) ( beg >> 23 );
+    if ( beg >> 26 == end >> 26 ) return ( ( 1 << 3 ) - 1 ) / 7 + ( uint32_t ) ( beg >> 26 );
+    return 0;
+}
+
+static set < uint32_t > Reg2Bins ( int64_t beg, int64_t end )
+{
+    set < uint32_t > bins;
+    --end;
+    bins . insert ( 0 );
+    for ( int64_t k =    1 + ( beg >> 26 ); k <=    1 + ( end >> 26 ); ++ k ) bins . insert ( ( uint32_t ) k );
+    for ( int64_t k =    9 + ( beg >> 23 ); k <=    9 + ( end >> 23 ); ++ k ) bins . insert ( ( uint32_t ) k );
+    for ( int64_t k =   73 + ( beg >> 20 ); k <=   73 + ( end >> 20 ); ++ k ) bins . insert ( ( uint32_t ) k );
+    for ( int64_t k =  585 + ( beg >> 17 ); k <=  585 + ( end >> 17 ); ++ k ) bins . insert ( ( uint32_t ) k );
+    for ( int64_t k = 4681 + ( beg >> 14 ); k <= 4681 + ( end >> 14 ); ++ k ) bins . insert ( ( uint32_t ) k );
+    return bins;
+}
+
+static string ReadWholeFile ( const string & p_path )
+{
+    FILE * f = fopen ( p_path . c_str (), "rb" );
+    if ( f == NULL )
+        throw logic_error ( "cannot open " + p_path );
+    string result;
+    char buf [ 65536 ];
+    size_t n;
+    while ( ( n = fread ( buf, 1, sizeof buf, f ) ) > 0 )
+        result . append ( buf, n );
+    fclose ( f );
+    return result;
+}
+
+/* a BGZF-file inflated block by block, with the checks of htslib's bgzf_read_block() */
+class Bgzf
+{
+public:
+    struct Block
+    {
+        uint64_t file_ofs;
+        uint64_t data_ofs;
+        uint32_t size;
+    };
+
+    void Load ( const string & p_bytes )
+    {
+        static uint8_t const eof_marker [ 28 ] = {
+            0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        uint8_t const * const b = ( uint8_t const * ) p_bytes . data ();
+        size_t pos = 0;
+
+        m_blocks . clear ();
+        m_data . clear ();
+        while ( pos < p_bytes . size () )
+        {
+            if ( p_bytes . size () - pos < 18 + 8 )
+                throw logic_error ( "truncated BGZF-block" );
+            uint8_t const * const h = b + pos;
+            if ( h [ 0 ] != 0x1f || h [ 1 ] != 0x8b || h [ 2 ] != 8 || ( h [ 3 ] & 4 ) == 0 )
+                throw logic_error ( "not a BGZF-block header" );
+            if ( Le16 ( h + 10 ) != 6 || h [ 12 ] != 'B' || h [ 13 ] != 'C' || Le16 ( h + 14 ) != 2 )
+                throw logic_error ( "no BC-subfield in the BGZF-block header" );
+            size_t const block_len = Le16 ( h + 16 ) + 1;
+            if ( block_len < 18 + 8 || p_bytes . size () - pos < block_len )
+                throw logic_error ( "bad BSIZE" );
+            uint32_t const crc = Le32 ( h + block_len - 8 );
+            uint32_t const isize = Le32 ( h + block_len - 4 );
+            if ( isize > 65536 )
+                throw logic_error ( "ISIZE too big" );
+
+            Block block = { pos, m_data . size (), isize };
+            m_data . resize ( m_data . size () + isize );
+            if ( isize > 0 || block_len > 28 )
+            {
+                z_stream zs;
+                memset ( & zs, 0, sizeof zs );
+                if ( inflateInit2 ( & zs, -15 ) != Z_OK )
+                    throw logic_error ( "inflateInit2 failed" );
+                zs . next_in = ( Bytef * ) h + 18;
+                zs . avail_in = ( uInt ) ( block_len - 18 - 8 );
+                zs . next_out = ( Bytef * ) & m_data [ block . data_ofs ];
+                zs . avail_out = isize;
+                int const zr = inflate ( & zs, Z_FINISH );
+                inflateEnd ( & zs );
+                if ( zr != Z_STREAM_END || zs . avail_out != 0 || zs . avail_in != 0 )
+                    throw logic_error ( "BGZF-block does not inflate to ISIZE" );
+            }
+            if ( crc32 ( crc32 ( 0, NULL, 0 ), ( Bytef const * ) m_data . data () + block . data_ofs, isize ) != crc )
+                throw logic_error ( "CRC32 mismatch" );
+            m_blocks . push_back ( block );
+            pos += block_len;
+        }
+        if ( m_blocks . empty () || m_blocks . back () . size != 0
+             || p_bytes . size () < 28 || memcmp ( b + p_bytes . size () - 28, eof_marker, 28 ) != 0 )
+            throw logic_error ( "no BGZF EOF-marker" );
+        for ( size_t i = 0; i + 1 < m_blocks . size (); ++ i )
+        {
+            if ( m_blocks [ i ] . size == 0 )
+                throw logic_error ( "empty BGZF-block before the EOF-marker" );
+        }
+    }
+
+    /* the position in the inflated data a virtual offset points to */
+    uint64_t Resolve ( uint64_t p_voffset ) const
+    {
+        uint64_t const file_ofs = p_voffset >> 16;
+        uint32_t const in_block = ( uint32_t ) ( p_voffset & 0xFFFF );
+        size_t lo = 0, hi = m_blocks . size ();
+        while ( lo < hi )
+        {
+            size_t const mid = ( lo + hi ) / 2;
+            if ( m_blocks [ mid ] . file_ofs < file_ofs )
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if ( lo == m_blocks . size () || m_blocks [ lo ] . file_ofs != file_ofs )
+            throw logic_error ( "virtual offset does not point at a BGZF-block" );
+        if ( in_block > m_blocks [ lo ] . size )
+            throw logic_error ( "virtual offset points past its BGZF-block" );
+        return m_blocks [ lo ] . data_ofs + in_block;
+    }
+
+    vector < Block > m_blocks;
+    string m_data;
+};
+
+/* a BAM-file, decoded */
+struct Bam
+{
+    struct Ref
+    {
+        string name;
+        uint32_t length;
+    };
+    struct Rec
+    {
+        uint64_t ofs, end_ofs;  /* where the record is in the inflated data */
+        int32_t ref, pos;
+        int64_t end;            /* bam_endpos() */
+        uint32_t bin;
+        uint16_t flag;
+        int32_t next_ref, next_pos;
+        string name;
+    };
+
+    void Load ( const string & p_data )
+    {
+        uint8_t const * const b = ( uint8_t const * ) p_data . data ();
+        size_t const n = p_data . size ();
+        if ( n < 12 || memcmp ( b, "BAM\1", 4 ) != 0 )
+            throw logic_error ( "no BAM magic" );
+        size_t pos = 8 + Le32 ( b + 4 );
+        text . assign ( p_data, 8, pos - 8 );
+        uint32_t const n_ref = Le32 ( b + pos );
+        pos += 4;
+        for ( uint32_t i = 0; i != n_ref; ++ i )
+        {
+            uint32_t const l_name = Le32 ( b + pos );
+            Ref ref;
+            ref . name . assign ( ( char const * ) b + pos + 4 );
+            if ( ref . name . size () + 1 != l_name )
+                throw logic_error ( "bad l_name" );
+            ref . length = Le32 ( b + pos + 4 + l_name );
+            refs . push_back ( ref );
+            pos += 4 + l_name + 4;
+        }
+        while ( pos < n )
+        {
+            uint8_t const * const r = b + pos;
+            size_t const block_size = Le32 ( r );
+            if ( block_size < 32 || n - pos < 4 + block_size )
+                throw logic_error ( "truncated BAM-record" );
+            Rec rec;
+            rec . ofs = pos;
+            rec . end_ofs = pos + 4 + block_size;
+            rec . ref = ( int32_t ) Le32 ( r + 4 );
+            rec . pos = ( int32_t ) Le32 ( r + 8 );
+            rec . bin = Le16 ( r + 14 );
+            rec . flag = Le16 ( r + 18 );
+            rec . next_ref = ( int32_t ) Le32 ( r + 24 );
+            rec . next_pos = ( int32_t ) Le32 ( r + 28 );
+            rec . name . assign ( ( char const * ) r + 36 );
+            if ( rec . name . size () + 1 != r [ 12 ] )
+                throw logic_error ( "bad l_read_name" );
+            uint16_t const n_cigar = Le16 ( r + 16 );
+            int64_t rlen = 0;
+            for ( uint16_t i = 0; i != n_cigar; ++ i )
+            {
+                uint32_t const op = Le32 ( r + 36 + r [ 12 ] + 4 * i );
+                /* M, D, N, =, X consume the reference */
+                if ( ( 0x18D >> ( op & 0xF ) ) & 1 )
+                    rlen += op >> 4;
+            }
+            rec . end = rec . pos + ( ( rec . flag & 4 ) == 0 && rlen > 0 ? rlen : 1 );
+            recs . push_back ( rec );
+            pos = rec . end_ofs;
+        }
+    }
+
+    string text;
+    vector < Ref > refs;
+    vector < Rec > recs;
+};
+
+/* a BAI-file, decoded; virtual offsets are kept as they are */
+struct Bai
+{
+    typedef pair < uint64_t, uint64_t > Chunk;
+    struct Ref
+    {
+        map < uint32_t, vector < Chunk > > bins;
+        vector < uint64_t > linear;
+        bool has_pseudo;
+        uint64_t off_beg, off_end, n_mapped, n_unmapped;
+    };
+
+    void Load ( const string & p_bytes )
+    {
+        uint8_t const * const b = ( uint8_t const * ) p_bytes . data ();
+        size_t pos = 8;
+        if ( p_bytes . size () < 8 || memcmp ( b, "BAI\1", 4 ) != 0 )
+            throw logic_error ( "no BAI magic" );
+        uint32_t const n_ref = Le32 ( b + 4 );
+        for ( uint32_t i = 0; i != n_ref; ++ i )
+        {
+            Ref ref;
+            ref . has_pseudo = false;
+            uint32_t const n_bin = Le32 ( b + pos );
+            pos += 4;
+            for ( uint32_t j = 0; j != n_bin; ++ j )
+            {
+                uint32_t const bin = Le32 ( b + pos );
+                uint32_t const n_chunk = Le32 ( b + pos + 4 );
+                pos += 8;
+                if ( bin == 37450 )
+                {
+                    if ( n_chunk != 2 || ref . has_pseudo )
+                        throw logic_error ( "bad pseudo-bin" );
+                    ref . has_pseudo = true;
+                    ref . off_beg = Le64 ( b + pos );
+                    ref . off_end = Le64 ( b + pos + 8 );
+                    ref . n_mapped = Le64 ( b + pos + 16 );
+                    ref . n_unmapped = Le64 ( b + pos + 24 );
+                }
+                else
+                {
+                    if ( ref . bins . count ( bin ) != 0 )
+                        throw logic_error ( "bin listed twice" );
+                    vector < Chunk > & chunks = ref . bins [ bin ];
+                    for ( uint32_t k = 0; k != n_chunk; ++ k )
+                        chunks . push_back ( Chunk ( Le64 ( b + pos + 16 * k ), Le64 ( b + pos + 16 * k + 8 ) ) );
+                }
+                pos += 16 * n_chunk;
+            }
+            uint32_t const n_intv = Le32 ( b + pos );
+            pos += 4;
+            for ( uint32_t j = 0; j != n_intv; ++ j )
+                ref . linear . push_back ( Le64 ( b + pos + 8 * j ) );
+            pos += 8 * n_intv;
+            refs . push_back ( ref );
+        }
+        if ( p_bytes . size () != pos + 8 )
+            throw logic_error ( "no n_no_coor at the end of the BAI" );
+        n_no_coor = Le64 ( b + pos );
+    }
+
+    vector < Ref > refs;
+    uint64_t n_no_coor;
+};
+
+/* the records that htslib's hts_itr_query() returns for [ beg, end ) on ref */
+static set < size_t > Query ( const Bam & p_bam, const Bai & p_bai, const Bgzf & p_bgzf, int32_t p_ref, int64_t p_beg, int64_t p_end )
+{
+    set < size_t > result;
+    Bai::Ref const & ref = p_bai . refs [ p_ref ];
+    uint64_t min_off = 0;
+    if ( ! ref . linear . empty () )
+    {
+        size_t const w = ( size_t ) ( p_beg >> 14 );
+        min_off = w < ref . linear . size () ? ref . linear [ w ] : ref . linear . back ();
+    }
+    set < uint32_t > const bins = Reg2Bins ( p_beg, p_end );
+    for ( set < uint32_t > :: const_iterator bin = bins . begin (); bin != bins . end (); ++ bin )
+    {
+        map < uint32_t, vector < Bai::Chunk > > :: const_iterator it = ref . bins . find ( * bin );
+        if ( it == ref . bins . end () )
+            continue;
+        for ( size_t i = 0; i != it -> second . size (); ++ i )
+        {
+            Bai::Chunk const & chunk = it -> second [ i ];
+            if ( chunk . second <= min_off )
+                continue;
+            uint64_t const beg = p_bgzf . Resolve ( chunk . first );
+            uint64_t const end = p_bgzf . Resolve ( chunk . second );
+            for ( size_t r = 0; r != p_bam . recs . size (); ++ r )
+            {
+                Bam::Rec const & rec = p_bam . recs [ r ];
+                if ( rec . ofs >= beg && rec . ofs < end
+                     && rec . ref == p_ref && rec . pos < p_end && rec . end > p_beg )
+                    result . insert ( r );
+            }
+        }
+    }
+    return result;
+}
+
+static set < size_t > Overlapping ( const Bam & p_bam, int32_t p_ref, int64_t p_beg, int64_t p_end )
+{
+    set < size_t > result;
+    for ( size_t r = 0; r != p_bam . recs . size (); ++ r )
+    {
+        Bam::Rec const & rec = p_bam . recs [ r ];
+        if ( rec . ref == p_ref && rec . pos >= 0 && rec . pos < p_end && rec . end > p_beg )
+            result . insert ( r );
+    }
+    return result;
+}
+
+static string const Header =
+    "@HD\tVN:1.6\tSO:coordinate\n"
+    "@SQ\tSN:chr1\tLN:2000000\n"
+    "@SQ\tSN:chr2\tLN:300000\n"
+    "@SQ\tSN:chr3\tLN:5000\n";
+
+/* what went into the writer */
+struct Input
+{
+    string name;
+    string rname;
+    int64_t pos;
+    string cigar;
+    uint32_t flags;
+    string rnext;
+    int64_t pnext;
+};
+
+class BamWriter_Fixture
+{
+public:
+    BamWriter_Fixture() : m_seed ( 12345 )
+    {
+    }
+    ~BamWriter_Fixture()
+    {
+        for ( size_t i = 0; i != m_files . size (); ++ i )
+            remove ( m_files [ i ] . c_str () );
+    }
+
+    unsigned Random ( unsigned p_limit )
+    {
+        m_seed = m_seed * 1103515245 + 12345;
+        return ( unsigned ) ( ( m_seed >> 16 ) % p_limit );
+    }
+
+    /* sorted by coordinate, with the unplaced records and those on unknown references at the end */
+    void MakeInput ()
+    {
+        static char const * const cigars [] = { "100M", "40M2I58M", "10S90M", "30M5000N70M", "50M150000N50M" };
+        char name [ 32 ];
+        for ( int ref = 0; ref != 2; ++ ref )
+        {
+            int64_t pos = 0;
+            unsigned const n = ref == 0 ? 6000 : 1500;
+            for ( unsigned i = 0; i != n; ++ i )
+            {
+                pos += Random ( 300 );
+                snprintf ( name, sizeof name, "r%d.%u", ref, i );
+                Input in = { name, ref == 0 ? "chr1" : "chr2", pos, "100M", 0, "*", -1 };
+                unsigned const kind = Random ( 100 );
+                if ( kind < 10 )
+                {
+                    /* an unmapped mate, placed at its partner */
+                    in . flags = 1 | 4 | 8;
+                    in . cigar = "*";
+                }
+                else
+                {
+                    in . cigar = cigars [ kind < 60 ? 0 : kind < 75 ? 1 : kind < 90 ? 2 : kind < 99 ? 3 : 4 ];
+                    if ( kind % 2 == 0 )
+                    {
+                        in . flags = 1 | 2 | 32;
+                        in . rnext = "=";
+                        in . pnext = pos + 250;
+                    }
+                    else
+                        in . flags = kind % 3 == 0 ? 16 : 0;
+                }
+                m_input . push_back ( in );
+            }
+        }
+        for ( unsigned i = 0; i != 30; ++ i )
+        {
+            snprintf ( name, sizeof name, "u%u", i );
+            Input in = { name, "*", -1, "*", 4, "*", -1 };
+            m_input . push_back ( in );
+        }
+        for ( unsigned i = 0; i != 5; ++ i )
+        {
+            snprintf ( name, sizeof name, "x%u", i );
+            Input in = { name, "chrUn", 777, "100M", 1, "chrUn", 10 };
+            m_input . push_back ( in );
+        }
+    }
+
+    /* writes m_input through two slices that take turns */
+    void Write ( const string & p_path, uint32_t p_threads, bool p_index )
+    {
+        KDirectory * dir = NULL;
+        KFile * file = NULL;
+        if ( KDirectoryNativeDir ( & dir ) != 0
+             || KDirectoryCreateFile ( dir, & file, false, 0664, kcmInit, "%s", p_path . c_str () ) != 0 )
+            throw logic_error ( "cannot create " + p_path );
+        KDirectoryRelease ( dir );
+        m_files . push_back ( p_path );
+        string const index_path = p_path + ".bai";
+        if ( p_index )
+            m_files . push_back ( index_path );
+
+        bam_writer * writer = NULL;
+        if ( make_bam_writer ( & writer, file, p_threads, p_index ? index_path . c_str () : NULL ) != 0 )
+            throw logic_error ( "make_bam_writer failed" );
+        KFileRelease ( file );
+        if ( bam_writer_add_ref ( writer, "chr4", 4, 1000 ) != 0
+             || bam_writer_header ( writer, Header . data (), Header . size () ) != 0 )
+            throw logic_error ( "cannot write the BAM-header" );
+
+        bam_slice * slices [ 2 ] = { NULL, NULL };
+        if ( make_bam_slice ( & slices [ 0 ], writer ) != 0 || make_bam_slice ( & slices [ 1 ], writer ) != 0 )
+            throw logic_error ( "make_bam_slice failed" );
+        string const seq ( 100, 'A' );
+        string const qual ( 100, 'I' );
+        for ( size_t i = 0; i != m_input . size (); ++ i )
+        {
+            Input const & in = m_input [ i ];
+            bam_slice * const slice = slices [ ( i / 700 ) % 2 ];
+            bam_record rec;
+            memset ( & rec, 0, sizeof rec );
+            rec . qname = in . name . data ();
+            rec . qname_len = in . name . size ();
+            rec . flags = in . flags;
+            rec . rname = in . rname . data ();
+            rec . rname_len = in . rname . size ();
+            rec . pos = in . pos;
+            rec . mapq = 60;
+            rec . cigar = in . cigar . data ();
+            rec . cigar_len = in . cigar . size ();
+            rec . rnext = in . rnext . data ();
+            rec . rnext_len = in . rnext . size ();
+            rec . pnext = in . pnext;
+            rec . seq = seq . data ();
+            rec . qual = i % 3 == 0 ? NULL : qual . data ();
+            rec . seq_len = seq . size ();
+            if ( bam_slice_begin ( slice, & rec ) != 0
+                 || bam_slice_tag_i ( slice, "NM", ( int64_t ) ( i % 5 ) ) != 0
+                 || bam_slice_end ( slice ) != 0 )
+                throw logic_error ( "cannot encode " + in . name );
+            if ( i % 700 == 699 || i + 1 == m_input . size () )
+            {
+                if ( bam_writer_write_slice ( writer, slice ) != 0 )
+                    throw logic_error ( "bam_writer_write_slice failed" );
+            }
+        }
+        release_bam_slice ( slices [ 0 ] );
+        release_bam_slice ( slices [ 1 ] );
+        if ( release_bam_writer ( writer ) != 0 )
+            throw logic_error ( "release_bam_writer failed" );
+    }
+
+    void Load ( const string & p_path, bool p_index )
+    {
+        m_bgzf . Load ( ReadWholeFile ( p_path ) );
+        m_bam . Load ( m_bgzf . m_data );
+        if ( p_index )
+            m_bai . Load ( ReadWholeFile ( p_path + ".bai" ) );
+    }
+
+    uint64_t m_seed;
+    vector < string > m_files;
+    vector < Input > m_input;
+    Bgzf m_bgzf;
+    Bam m_bam;
+    Bai m_bai;
+};
+
+FIXTURE_TEST_CASE ( HeaderOnly, BamWriter_Fixture )
+{
+    Write ( "test-bam-writer.empty.bam", 2, true );
+    Load ( "test-bam-writer.empty.bam", true );
+
+    REQUIRE_EQ ( m_bgzf . m_blocks . size (), ( size_t ) 2 ); /* the data and the EOF-marker */
+    REQUIRE_EQ ( m_bam . text . substr ( 0, Header . size () ), Header );
+    REQUIRE_EQ ( m_bam . refs . size (), ( size_t ) 4 );
+    REQUIRE_EQ ( m_bam . refs [ 0 ] . name, string ( "chr1" ) );
+    REQUIRE_EQ ( m_bam . refs [ 0 ] . length, ( uint32_t ) 2000000 );
+    REQUIRE_EQ ( m_bam . refs [ 2 ] . name, string ( "chr3" ) );
+    REQUIRE_EQ ( m_bam . refs [ 3 ] . name, string ( "chr4" ) );
+    REQUIRE_EQ ( m_bam . refs [ 3 ] . length, ( uint32_t ) 1000 );
+    REQUIRE_NE ( m_bam . text . find ( "@SQ\tSN:chr4\tLN:1000" ), string :: npos );
+    REQUIRE ( m_bam . recs . empty () );
+
+    REQUIRE_EQ ( m_bai . refs . size (), ( size_t ) 4 );
+    for ( size_t i = 0; i != m_bai . refs . size (); ++ i )
+    {
+        REQUIRE ( m_bai . refs [ i ] . bins . empty () );
+        REQUIRE ( ! m_bai . refs [ i ] . has_pseudo );
+        REQUIRE ( m_bai . refs [ i ] . linear . empty () );
+    }
+    REQUIRE_EQ ( m_bai . n_no_coor, ( uint64_t ) 0 );
+}
+
+FIXTURE_TEST_CASE ( Records, BamWriter_Fixture )
+{
+    MakeInput ();
+    Write ( "test-bam-writer.records.bam", 3, false );
+    Load ( "test-bam-writer.records.bam", false );
+
+    REQUIRE_GT ( m_bgzf . m_blocks . size (), ( size_t ) 10 );
+    REQUIRE_EQ ( m_bam . recs . size (), m_input . size () );
+    for ( size_t i = 0; i != m_input . size (); ++ i )
+    {
+        Input const & in = m_input [ i ];
+        Bam::Rec const & rec = m_bam . recs [ i ];
+        REQUIRE_EQ ( rec . name, in . name );
+        REQUIRE_EQ ( ( uint32_t ) rec . flag, in . flags );
+        if ( in . rname == "chr1" || in . rname == "chr2" )
+        {
+            REQUIRE_EQ ( rec . ref, in . rname == "chr1" ? 0 : 1 );
+            REQUIRE_EQ ( ( int64_t ) rec . pos, in . pos );
+            REQUIRE_EQ ( rec . bin, Reg2Bin ( rec . pos, rec . end ) );
+            REQUIRE_EQ ( rec . next_ref, in . rnext == "=" ? rec . ref : -1 );
+            REQUIRE_EQ ( ( int64_t ) rec . next_pos, in . rnext == "=" ? in . pnext : -1 );
+        }
+        else
+        {
+            /* unplaced, or on a reference the header does not have */
+            REQUIRE_EQ ( rec . ref, -1 );
+            REQUIRE_EQ ( rec . pos, -1 );
+            REQUIRE_EQ ( rec . bin, ( uint32_t ) 4680 );
+            REQUIRE_EQ ( rec . next_ref, -1 );
+            REQUIRE_EQ ( rec . next_pos, -1 );
+        }
+    }
+}
+
+FIXTURE_TEST_CASE ( Threads_SameOutput, BamWriter_Fixture )
+{
+    MakeInput ();
+    Write ( "test-bam-writer.t1.bam", 1, false );
+    Write ( "test-bam-writer.t4.bam", 4, false );
+    Load ( "test-bam-writer.t1.bam", false );
+    string const data = m_bgzf . m_data;
+    Load ( "test-bam-writer.t4.bam", false );
+    REQUIRE ( data == m_bgzf . m_data );
+    REQUIRE ( ReadWholeFile ( "test-bam-writer.t1.bam" ) == ReadWholeFile ( "test-bam-writer.t4.bam" ) );
+}
+
+FIXTURE_TEST_CASE ( Index, BamWriter_Fixture )
+{
+    MakeInput ();
+    Write ( "test-bam-writer.index.bam", 4, true );
+    Load ( "test-bam-writer.index.bam", true );
+
+    REQUIRE_EQ ( m_bai . refs . size (), m_bam . refs . size () );
+    REQUIRE_EQ ( m_bai . n_no_coor, ( uint64_t ) 35 );
+
+    for ( int32_t r = 0; r != ( int32_t ) m_bai . refs . size (); ++ r )
+    {
+        Bai::Ref const & ref = m_bai . refs [ r ];
+        set < size_t > const all = Overlapping ( m_bam, r, 0, 1 << 29 );
+        if ( all . empty () )
+        {
+            REQUIRE ( ref . bins . empty () );
+            REQUIRE ( ! ref . has_pseudo );
+            continue;
+        }
+
+        /* the pseudo-bin spans the records of the reference and counts them */
+        REQUIRE ( ref . has_pseudo );
+        REQUIRE_EQ ( m_bgzf . Resolve ( ref . off_beg ), m_bam . recs [ * all . begin () ] . ofs );
+        REQUIRE_EQ ( m_bgzf . Resolve ( ref . off_end ), m_bam . recs [ * all . rbegin () ] . end_ofs );
+        uint64_t unmapped = 0;
+        for ( set < size_t > :: const_iterator i = all . begin (); i != all . end (); ++ i )
+            unmapped += ( m_bam . recs [ * i ] . flag & 4 ) != 0;
+        REQUIRE_EQ ( ref . n_unmapped, unmapped );
+        REQUIRE_EQ ( ref . n_mapped, ( uint64_t ) all . size () - unmapped );
+
+        /* every record is in a chunk of its bin, and not before the linear index of its windows */
+        for ( set < size_t > :: const_iterator i = all . begin (); i != all . end (); ++ i )
+        {
+            Bam::Rec const & rec = m_bam . recs [ * i ];
+            map < uint32_t, vector < Bai::Chunk > > :: const_iterator bin = ref . bins . find ( rec . bin );
+            REQUIRE ( bin != ref . bins . end () );
+            size_t found = 0;
+            for ( size_t c = 0; c != bin -> second . size (); ++ c )
+            {
+                if ( rec . ofs >= m_bgzf . Resolve ( bin -> second [ c ] . first )
+                     && rec . ofs < m_bgzf . Resolve ( bin -> second [ c ] . second ) )
+                    ++ found;
+            }
+            REQUIRE_EQ ( found, ( size_t ) 1 );
+            REQUIRE_GT ( ref . linear . size (), ( size_t ) ( ( rec . end - 1 ) >> 14 ) );
+            for ( int64_t w = rec . pos >> 14; w <= ( rec . end - 1 ) >> 14; ++ w )
+                REQUIRE_LE ( m_bgzf . Resolve ( ref . linear [ w ] ), rec . ofs );
+        }
+
+        /* region queries find exactly the overlapping records */
+        int64_t const length = m_bam . refs [ r ] . length;
+        for ( unsigned q = 0; q != 300; ++ q )
+        {
+            int64_t const beg = Random ( ( unsigned ) length );
+            int64_t const end = beg + 1 + ( q % 3 == 0 ? Random ( 200000 ) : Random ( 2000 ) );
+            REQUIRE ( Query ( m_bam, m_bai, m_bgzf, r, beg, end ) == Overlapping ( m_bam, r, beg, end ) );
+        }
+        for ( int64_t w = 0; w < length; w += 1 << 14 )
+        {
+            REQUIRE ( Query ( m_bam, m_bai, m_bgzf, r, w, w + 1 ) == Overlapping ( m_bam, r, w, w + 1 ) );
+            REQUIRE ( Query ( m_bam, m_bai, m_bgzf, r, w - 1 < 0 ? 0 : w - 1, w ) == Overlapping ( m_bam, r, w - 1 < 0 ? 0 : w - 1, w ) );
+        }
+    }
+}
+
+//////////////////////////////////////////// Main
+extern "C"
+{
+
+#include <kapp/args.h>
+#include <kfg/config.h>
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+rc_t CC UsageSummary (const char * progname)
+{
+    return 0;
+}
+
+rc_t CC Usage ( const Args * args )
+{
+    return 0;
+}
+
+const char UsageDefaultName[] = "test-bam-writer";
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    KConfigDisableUserSettings();
+    rc_t rc=BamWriterSuite(argc, argv);
+    return rc;
+}
+
+}
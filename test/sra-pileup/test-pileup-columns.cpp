@@ -0,0 +1,468 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+/**
+* Unit tests for the columnar output of sra-pileup ( --columnar, --columnar-pack ):
+* files are written and decoded again from their trailing index
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/rc.h>
+
+#include "../../tools/sra-pileup/pileup_columns.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+TEST_SUITE(PileupColumnsSuite);
+
+static uint64_t const ChunkLen = 1 << PILEUP_COLUMNS_CHUNK_BITS;
+
+/* the values of one reference: position => one value per column */
+typedef map < uint64_t, vector < uint32_t > > Positions;
+
+/* a columnar file, decoded */
+struct ColumnsFile
+{
+    struct Chunk
+    {
+        pc_chunk chunk;
+        vector < pc_column > columns;
+        vector < vector < uint32_t > > values;
+    };
+    struct Ref
+    {
+        string name;
+        pc_ref ref;
+        vector < Chunk > chunks;
+    };
+
+    void Load ( const string & p_path )
+    {
+        FILE * f = fopen ( p_path . c_str (), "rb" );
+        if ( f == NULL )
+            throw logic_error ( "cannot open " + p_path );
+        char buf [ 65536 ];
+        size_t n;
+        bytes . clear ();
+        while ( ( n = fread ( buf, 1, sizeof buf, f ) ) > 0 )
+            bytes . append ( buf, n );
+        fclose ( f );
+
+        pc_file_header hdr;
+        Get ( 0, hdr );
+        if ( memcmp ( hdr . magic, PILEUP_COLUMNS_MAGIC, 8 ) != 0 || hdr . version != PILEUP_COLUMNS_VERSION
+             || hdr . byte_order != PILEUP_COLUMNS_BYTE_ORDER || hdr . chunk_bits != PILEUP_COLUMNS_CHUNK_BITS )
+            throw logic_error ( "bad file header" );
+        names . clear ();
+        for ( uint32_t i = 0; i != hdr . num_columns; ++ i )
+        {
+            string const name = bytes . substr ( sizeof hdr + i * PILEUP_COLUMNS_NAME_LEN, PILEUP_COLUMNS_NAME_LEN );
+            names . push_back ( name . substr ( 0, name . find ( '\0' ) ) );
+        }
+
+        /* the index is found from the end of the file */
+        pc_file_trailer trailer;
+        if ( bytes . size () < sizeof hdr + sizeof trailer )
+            throw logic_error ( "file too short" );
+        Get ( bytes . size () - sizeof trailer, trailer );
+        if ( memcmp ( trailer . magic, PILEUP_COLUMNS_MAGIC, 8 ) != 0 )
+            throw logic_error ( "bad trailer" );
+        if ( trailer . index_offset % 8 != 0 || trailer . index_offset + trailer . index_size != bytes . size () - sizeof trailer )
+            throw logic_error ( "the index is not right before the trailer" );
+
+        pc_index_header index;
+        uint64_t at = trailer . index_offset;
+        Get ( at, index );
+        at += sizeof index;
+        vector < pc_ref > ref_list ( index . num_refs );
+        vector < pc_chunk > chunk_list ( index . num_chunks );
+        vector < pc_column > column_list ( ( size_t ) index . num_chunks * hdr . num_columns );
+        for ( size_t i = 0; i != ref_list . size (); ++ i, at += sizeof ( pc_ref ) )
+            Get ( at, ref_list [ i ] );
+        for ( size_t i = 0; i != chunk_list . size (); ++ i, at += sizeof ( pc_chunk ) )
+            Get ( at, chunk_list [ i ] );
+        for ( size_t i = 0; i != column_list . size (); ++ i, at += sizeof ( pc_column ) )
+            Get ( at, column_list [ i ] );
+        uint64_t const names_at = at;
+
+        refs . clear ();
+        uint64_t names_len = 0;
+        for ( size_t r = 0; r != ref_list . size (); ++ r )
+        {
+            Ref ref;
+            ref . ref = ref_list [ r ];
+            ref . name = bytes . substr ( names_at + ref . ref . name_offset, ref . ref . name_len );
+            names_len += ref . ref . name_len;
+            for ( uint32_t c = ref . ref . first_chunk; c != ref . ref . first_chunk + ref . ref . num_chunks; ++ c )
+            {
+                Chunk chunk;
+                chunk . chunk = chunk_list . at ( c );
+                if ( chunk . chunk . ref_idx != r || chunk . chunk . start % ChunkLen != 0
+                     || chunk . chunk . count == 0 || chunk . chunk . count > ChunkLen )
+                    throw logic_error ( "bad chunk" );
+                for ( uint32_t col = 0; col != hdr . num_columns; ++ col )
+                {
+                    pc_column const & column = column_list [ ( size_t ) c * hdr . num_columns + col ];
+                    if ( column . offset % 8 != 0 || column . offset + column . size > trailer . index_offset )
+                        throw logic_error ( "bad column" );
+                    chunk . columns . push_back ( column );
+                    chunk . values . push_back ( Decode ( column, chunk . chunk . count ) );
+                }
+                ref . chunks . push_back ( chunk );
+            }
+            refs . push_back ( ref );
+        }
+        if ( names_at + names_len != trailer . index_offset + trailer . index_size )
+            throw logic_error ( "bad index size" );
+    }
+
+    vector < uint32_t > Decode ( pc_column const & p_column, uint32_t p_count ) const
+    {
+        vector < uint32_t > values;
+        uint8_t const * const b = ( uint8_t const * ) bytes . data () + p_column . offset;
+        switch ( p_column . encoding )
+        {
+        case PC_RAW:
+            if ( p_column . size != p_count * 4 )
+                throw logic_error ( "bad PC_RAW size" );
+            values . resize ( p_count );
+            memmove ( & values [ 0 ], b, p_column . size );
+            break;
+        case PC_RLE:
+            if ( p_column . size % 8 != 0 )
+                throw logic_error ( "bad PC_RLE size" );
+            for ( uint32_t i = 0; i != p_column . size; i += 8 )
+            {
+                uint32_t run, value;
+                memmove ( & run, b + i, 4 );
+                memmove ( & value, b + i + 4, 4 );
+                if ( run == 0 )
+                    throw logic_error ( "empty PC_RLE run" );
+                values . insert ( values . end (), run, value );
+            }
+            break;
+        case PC_DELTA:
+        {
+            uint32_t prev = 0;
+            uint32_t i = 0;
+            while ( i < p_column . size )
+            {
+                uint64_t zz = 0;
+                unsigned shift = 0;
+                do
+                {
+                    if ( i == p_column . size || shift > 63 )
+                        throw logic_error ( "truncated PC_DELTA varint" );
+                    zz |= ( uint64_t ) ( b [ i ] & 0x7F ) << shift;
+                    shift += 7;
+                }
+                while ( b [ i ++ ] & 0x80 );
+                int64_t const diff = ( zz & 1 ) ? - ( int64_t ) ( ( zz + 1 ) >> 1 ) : ( int64_t ) ( zz >> 1 );
+                prev = ( uint32_t ) ( ( int64_t ) prev + diff );
+                values . push_back ( prev );
+            }
+            break;
+        }
+        default:
+            throw logic_error ( "unknown encoding" );
+        }
+        if ( values . size () != p_count )
+            throw logic_error ( "column decodes to the wrong number of values" );
+        return values;
+    }
+
+    /* the values of a reference, only positions with a value other than 0 */
+    Positions Values ( size_t p_ref ) const
+    {
+        Positions result;
+        Ref const & ref = refs [ p_ref ];
+        for ( size_t c = 0; c != ref . chunks . size (); ++ c )
+        {
+            Chunk const & chunk = ref . chunks [ c ];
+            for ( uint32_t i = 0; i != chunk . chunk . count; ++ i )
+            {
+                vector < uint32_t > v;
+                bool any = false;
+                for ( size_t col = 0; col != chunk . values . size (); ++ col )
+                {
+                    v . push_back ( chunk . values [ col ] [ i ] );
+                    any = any || v . back () != 0;
+                }
+                if ( any )
+                    result [ chunk . chunk . start + i ] = v;
+            }
+        }
+        return result;
+    }
+
+    template < typename T > void Get ( uint64_t p_at, T & p_value ) const
+    {
+        if ( p_at + sizeof p_value > bytes . size () )
+            throw logic_error ( "read past the end of the file" );
+        memmove ( & p_value, bytes . data () + p_at, sizeof p_value );
+    }
+
+    string bytes;
+    vector < string > names;
+    vector < Ref > refs;
+};
+
+class PileupColumns_Fixture
+{
+public:
+    PileupColumns_Fixture() : m_writer ( NULL )
+    {
+    }
+    ~PileupColumns_Fixture()
+    {
+        if ( m_writer != NULL )
+            release_pileup_columns ( m_writer );
+        if ( ! m_path . empty () )
+            remove ( m_path . c_str () );
+    }
+
+    void Open ( const char * p_path, bool p_pack, uint32_t p_columns )
+    {
+        m_path = p_path;
+        if ( make_pileup_columns ( & m_writer, p_path, p_pack ) != 0 )
+            throw logic_error ( "make_pileup_columns failed" );
+        if ( p_columns > 0 )
+        {
+            static const char * names [] = { "depth", "A", "C", "G", "T", "a-name-of-16-chars", "" };
+            if ( pileup_columns_set_names ( m_writer, p_columns, names ) != 0 )
+                throw logic_error ( "pileup_columns_set_names failed" );
+        }
+    }
+
+    void Put ( const string & p_ref, uint64_t p_len, uint64_t p_pos, const vector < uint32_t > & p_values )
+    {
+        if ( pileup_columns_put ( m_writer, p_ref . c_str (), p_len, p_pos, & p_values [ 0 ] ) != 0 )
+            throw logic_error ( "pileup_columns_put failed" );
+        bool any = false;
+        for ( size_t i = 0; i != p_values . size (); ++ i )
+            any = any || p_values [ i ] != 0;
+        if ( any )
+            m_expected [ p_ref ] [ p_pos ] = p_values;
+    }
+
+    void Close ()
+    {
+        rc_t const rc = release_pileup_columns ( m_writer );
+        m_writer = NULL;
+        if ( rc != 0 )
+            throw logic_error ( "release_pileup_columns failed" );
+        m_file . Load ( m_path );
+    }
+
+    static uint32_t Mix ( uint64_t p_x )
+    {
+        p_x ^= p_x >> 33;
+        p_x *= 0xff51afd7ed558ccdull;
+        p_x ^= p_x >> 33;
+        p_x *= 0xc4ceb9fe1a85ec53ull;
+        return ( uint32_t ) ( p_x ^ ( p_x >> 33 ) );
+    }
+
+    /* the columns of one chunk choose PC_RAW, PC_RLE and PC_DELTA when packed */
+    static vector < uint32_t > Values ( uint64_t p_pos, uint32_t p_seed )
+    {
+        vector < uint32_t > v;
+        v . push_back ( 20 + ( uint32_t ) ( p_pos % 7 ) );                        /* small steps: delta */
+        v . push_back ( 3 );                                                     /* constant: RLE */
+        v . push_back ( Mix ( p_pos * 16 + p_seed ) );                           /* random: raw */
+        v . push_back ( p_pos % 1000 < 500 ? 0xFFFFFFFFu : 0 );                 /* the largest steps */
+        return v;
+    }
+
+    string m_path;
+    struct pileup_columns * m_writer;
+    map < string, Positions > m_expected;
+    ColumnsFile m_file;
+};
+
+FIXTURE_TEST_CASE ( Empty, PileupColumns_Fixture )
+{
+    Open ( "test-pileup-columns.empty", true, 0 );
+    Close ();
+    REQUIRE_EQ ( m_file . names . size (), ( size_t ) 0 );
+    REQUIRE_EQ ( m_file . refs . size (), ( size_t ) 0 );
+}
+
+FIXTURE_TEST_CASE ( Names, PileupColumns_Fixture )
+{
+    Open ( "test-pileup-columns.names", false, 7 );
+    Close ();
+    REQUIRE_EQ ( m_file . names . size (), ( size_t ) 7 );
+    REQUIRE_EQ ( m_file . names [ 0 ], string ( "depth" ) );
+    REQUIRE_EQ ( m_file . names [ 4 ], string ( "T" ) );
+    /* names are cut to PILEUP_COLUMNS_NAME_LEN bytes */
+    REQUIRE_LE ( m_file . names [ 5 ] . size (), ( size_t ) PILEUP_COLUMNS_NAME_LEN );
+    REQUIRE_EQ ( m_file . names [ 5 ], string ( "a-name-of-16-chars" ) . substr ( 0, m_file . names [ 5 ] . size () ) );
+    REQUIRE_GE ( m_file . names [ 5 ] . size (), ( size_t ) ( PILEUP_COLUMNS_NAME_LEN - 1 ) );
+    REQUIRE_EQ ( m_file . names [ 6 ], string ( "" ) );
+}
+
+/* chr1: chunk 0 up to its last position, the first position of chunk 1, a gap of two
+   chunks, then a partial chunk; chr2 starts in the middle of a chunk; chrM is a single
+   position at its end; the last reference has a single position at its start */
+static void WriteReferences ( PileupColumns_Fixture & p_fx )
+{
+    for ( uint64_t pos = 100; pos < ChunkLen; pos += ( pos < 2000 ? 1 : 3 ) )
+        p_fx . Put ( "chr1", 500000, pos, PileupColumns_Fixture :: Values ( pos, 1 ) );
+    p_fx . Put ( "chr1", 500000, ChunkLen - 1, PileupColumns_Fixture :: Values ( ChunkLen - 1, 1 ) );
+    p_fx . Put ( "chr1", 500000, ChunkLen, PileupColumns_Fixture :: Values ( ChunkLen, 1 ) );
+    for ( uint64_t pos = 4 * ChunkLen + 10; pos < 4 * ChunkLen + 5000; ++ pos )
+        p_fx . Put ( "chr1", 500000, pos, PileupColumns_Fixture :: Values ( pos, 2 ) );
+    for ( uint64_t pos = ChunkLen / 2; pos < ChunkLen + ChunkLen / 2; ++ pos )
+        p_fx . Put ( "chr2", 200000, pos, PileupColumns_Fixture :: Values ( pos, 3 ) );
+    p_fx . Put ( "chrM", 16569, 16568, PileupColumns_Fixture :: Values ( 16568, 4 ) );
+    p_fx . Put ( "chrUn", 500, 0, PileupColumns_Fixture :: Values ( 0, 5 ) );
+    p_fx . Close ();
+}
+
+/* what does not match WriteReferences(), empty if all does */
+static string CheckReferences ( PileupColumns_Fixture & p_fx )
+{
+    ColumnsFile const & file = p_fx . m_file;
+    static char const * const names [] = { "chr1", "chr2", "chrM", "chrUn" };
+    static size_t const num_chunks [] = { 3, 2, 1, 1 };
+    static uint64_t const starts [] = { 0, ChunkLen, 4 * ChunkLen, 0, ChunkLen, 0, 0 };
+    static uint32_t const counts [] = { ( uint32_t ) ChunkLen, 1, 5000, ( uint32_t ) ChunkLen, ( uint32_t ) ( ChunkLen / 2 ), 16569, 1 };
+
+    if ( file . names . size () != 4 )
+        return "number of columns";
+    if ( file . refs . size () != 4 )
+        return "number of references";
+    if ( file . refs [ 0 ] . ref . length != 500000 || file . refs [ 2 ] . ref . length != 16569 )
+        return "reference length";
+    size_t k = 0;
+    for ( size_t r = 0; r != 4; ++ r )
+    {
+        ColumnsFile::Ref const & ref = file . refs [ r ];
+        if ( ref . name != names [ r ] )
+            return "name of " + string ( names [ r ] );
+        /* chunks exist only where positions were walked, and end at the last one */
+        if ( ref . chunks . size () != num_chunks [ r ] )
+            return "number of chunks of " + ref . name;
+        for ( size_t c = 0; c != ref . chunks . size (); ++ c, ++ k )
+        {
+            if ( ref . chunks [ c ] . chunk . start != starts [ k ] || ref . chunks [ c ] . chunk . count != counts [ k ] )
+                return "a chunk of " + ref . name;
+        }
+        if ( file . Values ( r ) != p_fx . m_expected [ ref . name ] )
+            return "values of " + ref . name;
+    }
+    /* the positions before the first walked one are 0 */
+    if ( file . refs [ 0 ] . chunks [ 0 ] . values [ 1 ] [ 99 ] != 0 || file . refs [ 0 ] . chunks [ 0 ] . values [ 1 ] [ 100 ] != 3 )
+        return "start of chr1";
+    return string ();
+}
+
+FIXTURE_TEST_CASE ( RoundTrip_Raw, PileupColumns_Fixture )
+{
+    Open ( "test-pileup-columns.raw", false, 4 );
+    WriteReferences ( * this );
+    REQUIRE_EQ ( CheckReferences ( * this ), string () );
+    for ( size_t r = 0; r != m_file . refs . size (); ++ r )
+        for ( size_t c = 0; c != m_file . refs [ r ] . chunks . size (); ++ c )
+            for ( size_t col = 0; col != 4; ++ col )
+                REQUIRE_EQ ( m_file . refs [ r ] . chunks [ c ] . columns [ col ] . encoding, ( uint32_t ) PC_RAW );
+}
+
+FIXTURE_TEST_CASE ( RoundTrip_Packed, PileupColumns_Fixture )
+{
+    Open ( "test-pileup-columns.packed", true, 4 );
+    WriteReferences ( * this );
+    REQUIRE_EQ ( CheckReferences ( * this ), string () );
+
+    /* the second chunk of chr2 is walked at every position, one column of each kind */
+    ColumnsFile::Chunk const & chunk = m_file . refs [ 1 ] . chunks [ 1 ];
+    REQUIRE_EQ ( chunk . columns [ 0 ] . encoding, ( uint32_t ) PC_DELTA );
+    REQUIRE_EQ ( chunk . columns [ 1 ] . encoding, ( uint32_t ) PC_RLE );
+    REQUIRE_EQ ( chunk . columns [ 2 ] . encoding, ( uint32_t ) PC_RAW );
+    REQUIRE_EQ ( chunk . columns [ 3 ] . encoding, ( uint32_t ) PC_RLE );
+    /* the single position of chrM: runs of zeros, then one value */
+    REQUIRE_NE ( m_file . refs [ 2 ] . chunks [ 0 ] . columns [ 1 ] . encoding, ( uint32_t ) PC_RAW );
+}
+
+FIXTURE_TEST_CASE ( Put_Backwards, PileupColumns_Fixture )
+{
+    Open ( "test-pileup-columns.backwards", true, 2 );
+    uint32_t const values [] = { 1, 2 };
+    REQUIRE_RC ( pileup_columns_put ( m_writer, "chr1", 1000000, 3 * ChunkLen + 5, values ) );
+    REQUIRE_RC_FAIL ( pileup_columns_put ( m_writer, "chr1", 1000000, 3 * ChunkLen + 4, values ) );
+    REQUIRE_RC_FAIL ( pileup_columns_put ( m_writer, "chr1", 1000000, 2 * ChunkLen, values ) );
+    REQUIRE_RC ( pileup_columns_put ( m_writer, "chr1", 1000000, 3 * ChunkLen + 5, values ) ); /* the same position again */
+    REQUIRE_RC ( pileup_columns_put ( m_writer, "chr1", 1000000, 3 * ChunkLen + 6, values ) );
+}
+
+FIXTURE_TEST_CASE ( Put_WithoutNames, PileupColumns_Fixture )
+{
+    Open ( "test-pileup-columns.nonames", true, 0 );
+    uint32_t const values [] = { 1 };
+    REQUIRE_RC_FAIL ( pileup_columns_put ( m_writer, "chr1", 1000, 5, values ) );
+}
+
+//////////////////////////////////////////// Main
+extern "C"
+{
+
+#include <kapp/args.h>
+#include <kfg/config.h>
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+rc_t CC UsageSummary (const char * progname)
+{
+    return 0;
+}
+
+rc_t CC Usage ( const Args * args )
+{
+    return 0;
+}
+
+const char UsageDefaultName[] = "test-pileup-columns";
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    KConfigDisableUserSettings();
+    rc_t rc=PileupColumnsSuite(argc, argv);
+    return rc;
+}
+
+}
@@ -0,0 +1,295 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+/**
+* Unit tests for the radix sort shared by sra-sort and vdb-validate ( tools/util/radix_sort ):
+* every sort is compared to ksort, ties broken by the original position of the records
+*/
+
+#include <ktst/unit_test.hpp>
+
+#include <klib/rc.h>
+#include <klib/sort.h>
+
+#include "../../tools/util/radix_sort.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+TEST_SUITE(RadixSortSuite);
+
+static radix_key const Unsigned = { 0, false };
+static radix_key const Signed = { 0, true };
+
+class RadixSort_Fixture
+{
+public:
+    RadixSort_Fixture() : m_words ( 1 ), m_num_keys ( 0 ), m_tie ( -1 ), m_passes ( 0 )
+    {
+    }
+
+    /* count records of p_words words, the keys are filled in by the test */
+    void Make ( size_t p_count, uint32_t p_words, const radix_key * p_keys, uint32_t p_num_keys, int p_tie = -1 )
+    {
+        m_words = p_words;
+        m_keys = p_keys;
+        m_num_keys = p_num_keys;
+        m_tie = p_tie;
+        m_records . assign ( p_count * p_words, 0 );
+        if ( m_tie >= 0 )
+        {
+            for ( size_t i = 0; i != p_count; ++ i )
+                Word ( i, m_tie ) = i;
+        }
+    }
+
+    size_t Count () const { return m_records . size () / m_words; }
+    uint64_t & Word ( size_t p_rec, uint32_t p_word ) { return m_records [ p_rec * m_words + p_word ]; }
+
+    /* radix sorts a copy, ksorts another one */
+    bool Sort ( uint32_t p_threads, bool p_scratch = false )
+    {
+        m_sorted = m_records;
+        vector < uint64_t > scratch ( p_scratch ? m_records . size () : 0 );
+        bool const done = radix_sort ( & m_sorted [ 0 ], p_scratch ? & scratch [ 0 ] : NULL,
+                                       Count (), m_words * sizeof m_records [ 0 ],
+                                       m_keys, m_num_keys, p_threads, & m_passes );
+
+        m_expected = m_records;
+        if ( done )
+            ksort ( & m_expected [ 0 ], Count (), m_words * sizeof m_records [ 0 ], Compare, this );
+        return done;
+    }
+
+    static uint64_t Mix ( uint64_t p_x )
+    {
+        p_x ^= p_x >> 33;
+        p_x *= 0xff51afd7ed558ccdull;
+        p_x ^= p_x >> 33;
+        p_x *= 0xc4ceb9fe1a85ec53ull;
+        return p_x ^ ( p_x >> 33 );
+    }
+
+    vector < uint64_t > m_records;
+    vector < uint64_t > m_sorted;
+    vector < uint64_t > m_expected;
+    uint32_t m_words;
+    const radix_key * m_keys;
+    uint32_t m_num_keys;
+    int m_tie;
+    uint32_t m_passes;
+
+private:
+    static int64_t CC Compare ( const void * p_a, const void * p_b, void * p_data )
+    {
+        const RadixSort_Fixture * self = static_cast < const RadixSort_Fixture * > ( p_data );
+        const uint64_t * a = static_cast < const uint64_t * > ( p_a );
+        const uint64_t * b = static_cast < const uint64_t * > ( p_b );
+
+        for ( uint32_t k = 0; k != self -> m_num_keys; ++ k )
+        {
+            uint32_t const w = self -> m_keys [ k ] . offset / sizeof a [ 0 ];
+            if ( self -> m_keys [ k ] . is_signed )
+            {
+                if ( ( int64_t ) a [ w ] != ( int64_t ) b [ w ] )
+                    return ( int64_t ) a [ w ] < ( int64_t ) b [ w ] ? -1 : 1;
+            }
+            else if ( a [ w ] != b [ w ] )
+                return a [ w ] < b [ w ] ? -1 : 1;
+        }
+        if ( self -> m_tie >= 0 && a [ self -> m_tie ] != b [ self -> m_tie ] )
+            return a [ self -> m_tie ] < b [ self -> m_tie ] ? -1 : 1;
+        return 0;
+    }
+};
+
+FIXTURE_TEST_CASE ( TooFew, RadixSort_Fixture )
+{
+    Make ( RADIX_SORT_MIN_COUNT - 1, 1, & Unsigned, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = Mix ( i );
+    REQUIRE ( ! Sort ( 4 ) );
+    REQUIRE ( m_sorted == m_records );
+}
+
+FIXTURE_TEST_CASE ( Threads, RadixSort_Fixture )
+{
+    REQUIRE_EQ ( radix_sort_threads ( RADIX_SORT_MIN_COUNT, 4 ), 1u );
+    REQUIRE_EQ ( radix_sort_threads ( RADIX_SORT_MIN_SLICE - 1, 4 ), 1u );
+    REQUIRE_EQ ( radix_sort_threads ( RADIX_SORT_MIN_SLICE, 4 ), 1u );
+    REQUIRE_EQ ( radix_sort_threads ( 2 * RADIX_SORT_MIN_SLICE - 1, 4 ), 1u );
+    REQUIRE_EQ ( radix_sort_threads ( 2 * RADIX_SORT_MIN_SLICE, 4 ), 2u );
+    REQUIRE_EQ ( radix_sort_threads ( 4 * RADIX_SORT_MIN_SLICE + 3, 4 ), 4u );
+    REQUIRE_EQ ( radix_sort_threads ( 4 * RADIX_SORT_MIN_SLICE + 3, 0 ), 1u );
+    REQUIRE_EQ ( radix_sort_threads ( ( size_t ) 1 << 40, 1000 ), ( uint32_t ) RADIX_SORT_MAX_THREADS );
+}
+
+FIXTURE_TEST_CASE ( Counts, RadixSort_Fixture )
+{
+    static size_t const counts [] =
+    {
+        RADIX_SORT_MIN_COUNT, RADIX_SORT_MIN_COUNT + 1,
+        RADIX_SORT_MIN_SLICE - 1, RADIX_SORT_MIN_SLICE, RADIX_SORT_MIN_SLICE + 1,
+        2 * RADIX_SORT_MIN_SLICE - 1, 2 * RADIX_SORT_MIN_SLICE, 4 * RADIX_SORT_MIN_SLICE + 3
+    };
+    for ( size_t c = 0; c != sizeof counts / sizeof counts [ 0 ]; ++ c )
+    {
+        Make ( counts [ c ], 1, & Unsigned, 1 );
+        for ( size_t i = 0; i != Count (); ++ i )
+            Word ( i, 0 ) = Mix ( i + c );
+        for ( uint32_t threads = 1; threads <= 4; threads += 3 )
+        {
+            REQUIRE ( Sort ( threads ) );
+            REQUIRE_EQ ( m_passes, 8u );
+            REQUIRE ( m_sorted == m_expected );
+        }
+    }
+}
+
+FIXTURE_TEST_CASE ( Negative, RadixSort_Fixture )
+{
+    Make ( 3 * RADIX_SORT_MIN_SLICE, 1, & Signed, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = Mix ( i );
+    Word ( 0, 0 ) = ( uint64_t ) INT64_MIN;
+    Word ( 1, 0 ) = ( uint64_t ) INT64_MAX;
+    Word ( 2, 0 ) = ( uint64_t ) ( int64_t ) -1;
+    Word ( 3, 0 ) = 0;
+    Word ( 4, 0 ) = 1;
+    REQUIRE ( Sort ( 3 ) );
+    REQUIRE ( m_sorted == m_expected );
+    REQUIRE_EQ ( ( int64_t ) m_sorted [ 0 ], ( int64_t ) INT64_MIN );
+    REQUIRE_EQ ( ( int64_t ) m_sorted . back (), ( int64_t ) INT64_MAX );
+}
+
+FIXTURE_TEST_CASE ( Negative_Small, RadixSort_Fixture )
+{   /* all bytes but the lowest differ only by the sign */
+    Make ( RADIX_SORT_MIN_SLICE + 7, 1, & Signed, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = ( uint64_t ) ( ( int64_t ) ( Mix ( i ) % 601 ) - 300 );
+    REQUIRE ( Sort ( 2 ) );
+    REQUIRE ( m_sorted == m_expected );
+}
+
+FIXTURE_TEST_CASE ( AllEqual, RadixSort_Fixture )
+{
+    Make ( RADIX_SORT_MIN_SLICE * 2, 1, & Signed, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = ( uint64_t ) ( int64_t ) -42;
+    REQUIRE ( Sort ( 2 ) );
+    REQUIRE_EQ ( m_passes, 0u );
+    REQUIRE ( m_sorted == m_records );
+}
+
+FIXTURE_TEST_CASE ( AllEqual_Stable, RadixSort_Fixture )
+{
+    Make ( RADIX_SORT_MIN_COUNT, 2, & Unsigned, 1, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = 7;
+    REQUIRE ( Sort ( 1 ) );
+    REQUIRE_EQ ( m_passes, 0u );
+    REQUIRE ( m_sorted == m_records );
+}
+
+FIXTURE_TEST_CASE ( Stable_TwoWords, RadixSort_Fixture )
+{   /* sorted on the first word only, the second is the original position */
+    Make ( 3 * RADIX_SORT_MIN_SLICE + 1, 2, & Signed, 1, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = ( uint64_t ) ( ( int64_t ) ( Mix ( i ) % 17 ) - 8 ) << 20;
+    REQUIRE ( Sort ( 3 ) );
+    REQUIRE ( m_sorted == m_expected );
+}
+
+FIXTURE_TEST_CASE ( TwoKeys, RadixSort_Fixture )
+{   /* the ( foreign key, row ) pairs of vdb-validate */
+    static radix_key const keys [] = { { 0, true }, { 8, true } };
+    Make ( 2 * RADIX_SORT_MIN_SLICE + 5, 2, keys, 2 );
+    for ( size_t i = 0; i != Count (); ++ i )
+    {
+        Word ( i, 0 ) = ( uint64_t ) ( ( int64_t ) ( Mix ( i ) % 1000 ) - 10 );
+        Word ( i, 1 ) = Mix ( i + Count () );
+    }
+    REQUIRE ( Sort ( 2 ) );
+    REQUIRE ( m_sorted == m_expected );
+}
+
+FIXTURE_TEST_CASE ( ThreeWords_Stable, RadixSort_Fixture )
+{   /* key in the middle, a payload before, the original position after */
+    static radix_key const key = { 8, false };
+    Make ( RADIX_SORT_MIN_COUNT * 5, 3, & key, 1, 2 );
+    for ( size_t i = 0; i != Count (); ++ i )
+    {
+        Word ( i, 0 ) = Mix ( i );
+        Word ( i, 1 ) = Mix ( i + Count () ) % 100;
+    }
+    REQUIRE ( Sort ( 1 ) );
+    REQUIRE ( m_sorted == m_expected );
+}
+
+FIXTURE_TEST_CASE ( Scratch, RadixSort_Fixture )
+{
+    Make ( RADIX_SORT_MIN_COUNT * 3, 1, & Unsigned, 1 );
+    for ( size_t i = 0; i != Count (); ++ i )
+        Word ( i, 0 ) = Mix ( i ) & 0xFFFF00;
+    REQUIRE ( Sort ( 1, true ) );
+    REQUIRE_EQ ( m_passes, 2u );
+    REQUIRE ( m_sorted == m_expected );
+}
+
+//////////////////////////////////////////// Main
+extern "C"
+{
+
+#include <kapp/args.h>
+#include <kfg/config.h>
+
+ver_t CC KAppVersion ( void )
+{
+    return 0x1000000;
+}
+rc_t CC UsageSummary (const char * progname)
+{
+    return 0;
+}
+
+rc_t CC Usage ( const Args * args )
+{
+    return 0;
+}
+
+const char UsageDefaultName[] = "test-radix-sort";
+
+rc_t CC KMain ( int argc, char *argv [] )
+{
+    KConfigDisableUserSettings();
+    rc_t rc=RadixSortSuite(argc, argv);
+    return rc;
+}
+
+}
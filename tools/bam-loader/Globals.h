@@ -60,6 +60,8 @@ typedef struct globals
     unsigned maxWarnCount_NoMatch;
     unsigned maxWarnCount_DupConflict;
     unsigned pid;
+    unsigned inflateThreads; /* BGZF blocks inflated or SAM lines parsed in parallel, 0: on the reading thread */
+    unsigned decodeThreads; /* records decoded in parallel, 0: on the main thread */
     unsigned minMatchCount; /* minimum number of matches to count as an alignment */
     int minMapQual;
     enum LoaderModes mode;
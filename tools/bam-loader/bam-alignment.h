@@ -138,6 +138,7 @@ struct BAM_Alignment {
 
 	uint64_t keyId;
 	bool wasInserted;
+	struct DecodedRecord const *decoded; /* set by the loader, see loader-imp.c */
 
     unsigned datasize;
     unsigned cigar;
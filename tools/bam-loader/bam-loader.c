@@ -66,6 +66,8 @@ Global Options:
 * options effecting performance optimisation
   tmpfs <directory>                 where to store temparary files, default: '/tmp'
   cache-size <mbytes>               the limit in MB for temparary files
+  inflate-threads <count>           the number of threads inflating the BAM file or parsing the SAM file, default: 4
+  decode-threads <count>            the number of threads decoding records, default: 2
 
 * options effecting error limits
   max-err-count <number>            the maximum number of errors to ignore
@@ -123,6 +125,8 @@ static char const option_config[] = "config";
 static char const option_min_mapq[] = "min-mapq";
 static char const option_qual_compress[] = "qual-quant";
 static char const option_cache_size[] = "cache-size";
+static char const option_inflate_threads[] = "inflate-threads";
+static char const option_decode_threads[] = "decode-threads";
 static char const option_unsorted[] = "unsorted";
 static char const option_sorted[] = "sorted";
 static char const option_max_err_count[] = "max-err-count";
@@ -157,6 +161,8 @@ static char const option_defer_secondary[] = "defer-secondary";
 #define OPTION_MINMAPQ option_min_mapq
 #define OPTION_QCOMP option_qual_compress
 #define OPTION_CACHE_SIZE option_cache_size
+#define OPTION_INFLATE_THREADS option_inflate_threads
+#define OPTION_DECODE_THREADS option_decode_threads
 #define OPTION_MAX_ERR_COUNT option_max_err_count
 #define OPTION_MAX_REC_COUNT option_max_rec_count
 #define OPTION_UNALIGNED option_unaligned
@@ -254,6 +260,20 @@ char const * cache_size_usage[] =
     NULL
 };
 
+static
+char const * inflate_threads_usage[] = 
+{
+    "Set the number of threads inflating the BAM file or parsing the SAM file, 0 to do it on the reading thread",
+    NULL
+};
+
+static
+char const * decode_threads_usage[] = 
+{
+    "Set the number of threads unpacking bases and qualities of records, 0 to unpack on the main thread",
+    NULL
+};
+
 static
 char const * mrc_usage[] = 
 {
@@ -438,6 +458,8 @@ OptDef Options[] =
     { OPTION_QCOMP, ALIAS_QCOMP, NULL, qcomp_usage, 1, true,  false },
     { OPTION_MINMAPQ, ALIAS_MINMAPQ, NULL, min_mapq_usage, 1, true,  false },
     { OPTION_CACHE_SIZE, NULL, NULL, cache_size_usage, 1, true,  false },
+    { OPTION_INFLATE_THREADS, NULL, NULL, inflate_threads_usage, 1, true,  false },
+    { OPTION_DECODE_THREADS, NULL, NULL, decode_threads_usage, 1, true,  false },
     { OPTION_NO_CS, NULL, NULL, use_no_cs, 1, false,  false },
     { OPTION_MIN_MATCH, NULL, NULL, use_min_match, 1, true, false },
     { OPTION_NO_SECONDARY, ALIAS_NO_SECONDARY, NULL, use_no_secondary, 1, false, false },
@@ -476,6 +498,8 @@ const char* OptHelpParam[] =
     "level",			/* quality compression */
     "phred-score",		/* min. mapq */
     "mbytes",			/* cache size */
+    "count",			/* inflate threads */
+    "count",			/* decode threads */
     NULL,				/* no colorspace */
     "count",			/* min. match count */
     NULL,				/* no secondary */
@@ -879,6 +903,28 @@ static rc_t main_1(int argc, char *argv[], bool const continuing, unsigned const
             }
         }
         
+        rc = ArgsOptionCount (args, OPTION_INFLATE_THREADS, &pcount);
+        if (rc)
+            break;
+        if (pcount == 1)
+        {
+            rc = ArgsOptionValue (args, OPTION_INFLATE_THREADS, 0, (const void **)&value);
+            if (rc)
+                break;
+            G.inflateThreads = strtoul(value, &dummy, 0);
+        }
+        
+        rc = ArgsOptionCount (args, OPTION_DECODE_THREADS, &pcount);
+        if (rc)
+            break;
+        if (pcount == 1)
+        {
+            rc = ArgsOptionValue (args, OPTION_DECODE_THREADS, 0, (const void **)&value);
+            if (rc)
+                break;
+            G.decodeThreads = strtoul(value, &dummy, 0);
+        }
+        
         rc = ArgsOptionCount (args, OPTION_MAX_WARN_DUP_FLAG, &pcount);
         if (rc)
             break;
@@ -1246,6 +1292,8 @@ rc_t CC KMain(int argc, char *argv[])
     G.minMapQual = 0; /* accept all */
     G.tmpfs = strdup("/tmp");
     G.cache_size = ((size_t)16) << 30;
+    G.inflateThreads = 4;
+    G.decodeThreads = 2;
     G.maxErrCount = 1000;
     G.minMatchCount = 10;
     
@@ -63,11 +63,15 @@ struct SAMFile {
     BufferedFile file;
     int putback;
     rc_t last;
+    char *line;                 /* holds a record that crosses the end of the read buffer */
+    size_t lineSize;
+    struct SAMFileMT *mt;       /* if not NULL: the records are parsed by a pool of threads */
 };
 
 struct BGZFile {
     BufferedFile file;
     z_stream zs;
+    struct BGZFileMT *mt;       /* if not NULL: the blocks are inflated by a pool of threads */
 };
 
 struct BAM_File {
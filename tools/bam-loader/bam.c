@@ -36,6 +36,9 @@
 #include <klib/text.h>
 #include <klib/refcount.h>
 #include <klib/data-buffer.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
+#include <kproc/thread.h>
 #include <sysalloc.h>
 
 #include <atomic32.h>
@@ -183,6 +186,87 @@ static void SAMFilePutBack(SAMFile *const self, int ch)
         self->putback = ch;
 }
 
+static rc_t SAMFileLineAppend(SAMFile *const self, size_t *const used, char const *const data, size_t const len)
+{
+    if (*used + len > self->lineSize) {
+        size_t size = self->lineSize > 0 ? self->lineSize : 64u * 1024u;
+        void *tmp;
+        
+        while (size < *used + len)
+            size *= 2;
+        tmp = realloc(self->line, size);
+        if (tmp == NULL)
+            return RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
+        self->line = tmp;
+        self->lineSize = size;
+    }
+    memmove(&self->line[*used], data, len);
+    *used += len;
+    return 0;
+}
+
+/* the next line, without its line-feed
+ * it points into the read buffer unless it crosses the end of it;
+ * either way it is good until the next read
+ */
+static rc_t SAMFileReadLine(SAMFile *const self, char const **const line, size_t *const length)
+{
+    BufferedFile *const file = &self->file;
+    size_t used = 0;
+    
+    if (self->putback >= 0) {
+        char const ch = (char)self->putback;
+        rc_t const rc = SAMFileLineAppend(self, &used, &ch, 1);
+        if (rc) return rc;
+        self->putback = -1;
+    }
+    for ( ; ; ) {
+        char const *start;
+        char const *endp;
+        char const *eol;
+        
+        if (file->bpos == file->bmax) {
+            rc_t const rc = BufferedFileRead(file);
+            
+            self->last = rc;
+            if (rc) return rc;
+            if (file->bmax == 0)
+                return used == 0 ? SILENT_RC(rcAlign, rcFile, rcReading, rcRow, rcNotFound)  /* EOF at start of line is OK */
+                                 : RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+        }
+        start = (char const *)file->buf + file->bpos;
+        endp = (char const *)file->buf + file->bmax;
+        eol = SAM_FindByte(start, endp, '\n');
+        if (eol == endp) {
+            rc_t const rc = SAMFileLineAppend(self, &used, start, endp - start);
+            if (rc) return rc;
+            file->bpos = file->bmax;
+            continue;
+        }
+        if (used == 0) {
+            *line = start;
+            *length = eol - start;
+        }
+        else {
+            rc_t const rc = SAMFileLineAppend(self, &used, start, eol - start);
+            if (rc) return rc;
+            *line = self->line;
+            *length = used;
+        }
+        file->bpos += (eol - start) + 1;
+        if (*length > 0 && (*line)[*length - 1] == '\r')
+            *length -= 1;
+        return 0;
+    }
+}
+
+static void SAMFileWhack(SAMFile *const self)
+{
+    free(self->line);
+    self->line = NULL;
+    self->lineSize = 0;
+}
+
 static rc_t SAMFileInit(SAMFile *self, RawFile_vt *vt)
 {
     static RawFile_vt const my_vt = {
@@ -191,11 +275,14 @@ static rc_t SAMFileInit(SAMFile *self, RawFile_vt *vt)
         (float (*)(void const *))BufferedFileProPos,
         (uint64_t (*)(void const *))BufferedFileGetSize,
         (rc_t (*)(void *, uint64_t))BufferedFileSetPos,
-        (void (*)(void *))NULL
+        (void (*)(void *))SAMFileWhack
     };
     
     self->putback = -1;
     self->last = 0;
+    self->line = NULL;
+    self->lineSize = 0;
+    self->mt = NULL;
     *vt = my_vt;
     
     return 0;
@@ -359,6 +446,839 @@ static rc_t BGZFileInit(BGZFile *const self, RawFile_vt *const vt)
     return 0;
 }
 
+/* MARK: BGZFile multi-threaded inflation
+ * BGZF blocks are independent gzip members, each carrying its own compressed
+ * size in the BC extra field. A reader thread cuts the file into blocks and
+ * puts them into a ring of slots, a pool of workers inflates the slots out of
+ * order, and BGZFileMTRead hands them out in file order.
+ */
+
+enum BGZBlockState {
+    bgzb_free,      /* may be filled by the reader */
+    bgzb_read,      /* holds a compressed block, waiting for a worker */
+    bgzb_busy,      /* a worker is inflating it */
+    bgzb_done       /* inflated ( or holds the error / end-of-file ) */
+};
+
+typedef struct BGZBlock {
+    uint8_t *compressed;        /* the whole gzip member, header and trailer included */
+    uint8_t *inflated;          /* ZLIB_BLOCK_SIZE bytes */
+    uint64_t endPos;            /* file position of the next block */
+    unsigned csize;             /* valid bytes in compressed */
+    unsigned usize;             /* valid bytes in inflated */
+    rc_t rc;
+    enum BGZBlockState state;
+} BGZBlock;
+
+typedef struct BGZWorker {
+    struct BGZFileMT *mt;
+    KThread *th;
+    z_stream zs;
+    bool zsInit;
+} BGZWorker;
+
+struct BGZFileMT {
+    BGZFile *file;
+    KLock *lock;
+    KCondition *changed;        /* broadcast whenever a slot changes its state */
+    KThread *reader;
+    BGZWorker *worker;
+    BGZBlock *block;
+    uint64_t nextRead;          /* sequence number of the next block to read */
+    uint64_t nextInflate;       /* sequence number of the next block to inflate */
+    uint64_t nextDeliver;       /* sequence number of the next block to hand out */
+    uint64_t pos;               /* file position after the last block handed out */
+    unsigned workers;
+    unsigned blocks;
+    bool quit;
+};
+
+#define BGZF_BLOCKS_PER_WORKER (4)
+#define BGZF_HEADER_SIZE (12)   /* the fixed part of the gzip header, up to XLEN */
+#define BGZF_TRAILER_SIZE (8)   /* CRC32 and ISIZE */
+
+static rc_t BufferedFileReadExactly(BufferedFile *const self, void *const dst, size_t const len, size_t *const got)
+{
+    *got = 0;
+    while (*got < len) {
+        size_t n;
+        
+        if (self->bpos == self->bmax) {
+            rc_t const rc = BufferedFileRead(self);
+            if (rc)
+                return rc;
+            if (self->bmax == 0)
+                break;
+        }
+        n = self->bmax - self->bpos;
+        if (n > len - *got)
+            n = len - *got;
+        memmove((uint8_t *)dst + *got, (uint8_t const *)self->buf + self->bpos, n);
+        self->bpos += n;
+        *got += n;
+    }
+    return 0;
+}
+
+/* a gzip member without the BC extra field, the serial inflater can still read it */
+static bool BGZBlockIsNotBGZF(rc_t const rc)
+{
+    return rc != 0 && (int)GetRCObject(rc) == rcFormat && GetRCState(rc) == rcInvalid;
+}
+
+/* reads one gzip member from the file, returns (rcData, rcInsufficient) at eof */
+static rc_t BGZBlockRead(BGZBlock *const self, BufferedFile *const file)
+{
+    uint8_t *const hdr = self->compressed;
+    unsigned bsize = 0;
+    unsigned xlen;
+    unsigned i;
+    size_t got;
+    rc_t rc;
+    
+    self->csize = 0;
+    rc = BufferedFileReadExactly(file, hdr, BGZF_HEADER_SIZE, &got);
+    if (rc)
+        return rc;
+    if (got == 0)
+        return RC(rcAlign, rcFile, rcReading, rcData, rcInsufficient);
+    if (got != BGZF_HEADER_SIZE)
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+    if (hdr[0] != 31 || hdr[1] != 139 || hdr[2] != 8) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("GZIP Header not found\n"));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    }
+    if ((hdr[3] & 4) == 0) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("GZIP Header has no extra fields\n"));
+        return RC(rcAlign, rcFile, rcReading, rcFormat, rcInvalid); /* not BGZF */
+    }
+    xlen = LE2HUI16(&hdr[10]);
+    if (xlen > ZLIB_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_TRAILER_SIZE) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("GZIP Header extra length %u is too big\n", xlen));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    }
+    rc = BufferedFileReadExactly(file, &hdr[BGZF_HEADER_SIZE], xlen, &got);
+    if (rc)
+        return rc;
+    if (got != xlen)
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+    
+    for (i = 0; i + 4 <= xlen; ) {
+        uint8_t const *const extra = &hdr[BGZF_HEADER_SIZE + i];
+        unsigned const slen = LE2HUI16(&extra[2]);
+        
+        if (extra[0] == 'B' && extra[1] == 'C' && slen == 2 && i + 6 <= xlen) {
+            bsize = 1 + LE2HUI16(&extra[4]);
+            break;
+        }
+        i += slen + 4;
+    }
+    if (bsize < BGZF_HEADER_SIZE + xlen + BGZF_TRAILER_SIZE) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("BGZF Header extra field BC not found\n"));
+        return RC(rcAlign, rcFile, rcReading, rcFormat, rcInvalid); /* not BGZF */
+    }
+    /* bsize is at most 64k by the definition of BC */
+    rc = BufferedFileReadExactly(file, &hdr[BGZF_HEADER_SIZE + xlen], bsize - BGZF_HEADER_SIZE - xlen, &got);
+    if (rc)
+        return rc;
+    if (got != bsize - BGZF_HEADER_SIZE - xlen) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("EOF in Zlib block after %lu bytes\n", BufferedFileGetPos(file)));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
+    }
+    self->csize = bsize;
+    return 0;
+}
+
+static rc_t BGZBlockInflate(BGZBlock *const self, z_stream *const zs)
+{
+    unsigned const xlen = LE2HUI16(&self->compressed[10]);
+    unsigned const start = BGZF_HEADER_SIZE + xlen;
+    uint8_t const *const trailer = &self->compressed[self->csize - BGZF_TRAILER_SIZE];
+    uint32_t const crc = LE2HUI32(&trailer[0]);
+    uint32_t const isize = LE2HUI32(&trailer[4]);
+    int zr;
+    
+    self->usize = 0;
+    if (isize > ZLIB_BLOCK_SIZE)
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    
+    zr = inflateReset(zs);
+    assert(zr == Z_OK);
+    zs->next_in = (Bytef *)&self->compressed[start];
+    zs->avail_in = (uInt)(self->csize - start - BGZF_TRAILER_SIZE);
+    zs->next_out = (Bytef *)self->inflated;
+    zs->avail_out = ZLIB_BLOCK_SIZE;
+    
+    zr = inflate(zs, Z_FINISH);
+    if (zr != Z_STREAM_END) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("Unexpected Zlib result %i: %s\n", zr, zs->msg ? zs->msg : "unknown"));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    }
+    if (zs->total_out != isize || crc32(crc32(0L, Z_NULL, 0), self->inflated, (uInt)isize) != crc) {
+        DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("BGZF block failed CRC or size check\n"));
+        return RC(rcAlign, rcFile, rcReading, rcFile, rcCorrupt);
+    }
+    self->usize = isize;
+    return 0;
+}
+
+static rc_t BGZFileMTReaderMain(KThread const *const th, void *const vp)
+{
+    struct BGZFileMT *const self = (struct BGZFileMT *)vp;
+    bool done = false;
+    
+    KLockAcquire(self->lock);
+    while (!done) {
+        BGZBlock *const block = &self->block[self->nextRead % self->blocks];
+        uint64_t startPos;
+        rc_t rc;
+        
+        while (!self->quit && block->state != bgzb_free)
+            KConditionWait(self->changed, self->lock);
+        if (self->quit)
+            break;
+        KLockUnlock(self->lock);
+        
+        startPos = BufferedFileGetPos(&self->file->file);
+        rc = BGZBlockRead(block, &self->file->file);
+        block->endPos = BufferedFileGetPos(&self->file->file);
+        if (BGZBlockIsNotBGZF(rc))
+            block->endPos = startPos; /* where the serial inflater has to start */
+        
+        KLockAcquire(self->lock);
+        if (rc == 0)
+            block->state = bgzb_read;
+        else {
+            /* eof, an error, or not BGZF: this block ends the stream */
+            block->rc = rc;
+            block->usize = 0;
+            block->state = bgzb_done;
+            done = true;
+        }
+        ++self->nextRead;
+        KConditionBroadcast(self->changed);
+    }
+    KLockUnlock(self->lock);
+    return 0;
+}
+
+static rc_t BGZFileMTWorkerMain(KThread const *const th, void *const vp)
+{
+    BGZWorker *const worker = (BGZWorker *)vp;
+    struct BGZFileMT *const self = worker->mt;
+    
+    KLockAcquire(self->lock);
+    for ( ; ; ) {
+        BGZBlock *block;
+        rc_t rc;
+        
+        while (!self->quit && self->nextInflate == self->nextRead)
+            KConditionWait(self->changed, self->lock);
+        if (self->quit)
+            break;
+        block = &self->block[self->nextInflate % self->blocks];
+        if (block->state != bgzb_read)
+            break; /* the block that ends the stream */
+        ++self->nextInflate;
+        block->state = bgzb_busy;
+        KLockUnlock(self->lock);
+        
+        rc = BGZBlockInflate(block, &worker->zs);
+        
+        KLockAcquire(self->lock);
+        block->rc = rc;
+        block->state = bgzb_done;
+        KConditionBroadcast(self->changed);
+    }
+    KLockUnlock(self->lock);
+    return 0;
+}
+
+static void BGZFileMTStop(BGZFile *const file);
+
+/* the pool stopped at a gzip member that is not BGZF, the rest of the file is inflated on the calling thread */
+static rc_t BGZFileMTFallBack(BGZFile *const file, uint64_t const pos)
+{
+    rc_t rc;
+    
+    BGZFileMTStop(file);
+    rc = BufferedFileSetPos(&file->file, pos);
+    if (rc)
+        return rc;
+    file->zs.next_in = (Bytef *)file->file.buf + file->file.bpos;
+    file->zs.avail_in = (uInt)(file->file.bmax - file->file.bpos);
+    DBGMSG(DBG_ALIGN, DBG_FLAG(DBG_ALIGN_BGZF), ("Not BGZF at %lu, inflating on one thread\n", pos));
+    return 0;
+}
+
+static rc_t BGZFileMTRead(BGZFile *const file, zlib_block_t dst, unsigned *const pNumRead)
+{
+    struct BGZFileMT *const self = file->mt;
+    BGZBlock *block;
+    rc_t rc;
+    
+    if (self == NULL)
+        return BGZFileRead(file, dst, pNumRead);
+    
+    *pNumRead = 0;
+    KLockAcquire(self->lock);
+    block = &self->block[self->nextDeliver % self->blocks];
+    while (block->state != bgzb_done)
+        KConditionWait(self->changed, self->lock);
+    
+    rc = block->rc;
+    if (BGZBlockIsNotBGZF(rc)) {
+        uint64_t const pos = block->endPos;
+        
+        KLockUnlock(self->lock);
+        rc = BGZFileMTFallBack(file, pos);
+        return rc == 0 ? BGZFileRead(file, dst, pNumRead) : rc;
+    }
+    if (rc == 0) {
+        memmove(dst, block->inflated, block->usize);
+        *pNumRead = block->usize;
+        self->pos = block->endPos;
+        block->state = bgzb_free;
+        ++self->nextDeliver;
+        KConditionBroadcast(self->changed);
+    }
+    /* else the block stays: every further read returns the same rc */
+    KLockUnlock(self->lock);
+    return rc;
+}
+
+static uint64_t BGZFileMTGetPos(BGZFile const *const file)
+{
+    return file->mt != NULL ? file->mt->pos : BufferedFileGetPos(&file->file);
+}
+
+static float BGZFileMTProPos(BGZFile const *const file)
+{
+    uint64_t const fmax = file->file.fmax;
+    return fmax == 0 ? -1.0 : (BGZFileMTGetPos(file) / (double)fmax);
+}
+
+static rc_t BGZFileMTSetPos(BGZFile *const file, uint64_t const pos)
+{
+    if (file->mt == NULL)
+        return BufferedFileSetPos(&file->file, pos);
+    /* the reader thread owns the file position */
+    return RC(rcAlign, rcFile, rcPositioning, rcFunction, rcUnsupported);
+}
+
+/* stops the threads and frees everything, the file is single-threaded again */
+static void BGZFileMTStop(BGZFile *const file)
+{
+    struct BGZFileMT *const self = file->mt;
+    unsigned i;
+    
+    if (self->lock != NULL && self->changed != NULL) {
+        KLockAcquire(self->lock);
+        self->quit = true;
+        KConditionBroadcast(self->changed);
+        KLockUnlock(self->lock);
+    }
+    if (self->reader) {
+        KThreadWait(self->reader, NULL);
+        KThreadRelease(self->reader);
+    }
+    for (i = 0; self->worker != NULL && i < self->workers; ++i) {
+        if (self->worker[i].th) {
+            KThreadWait(self->worker[i].th, NULL);
+            KThreadRelease(self->worker[i].th);
+        }
+        if (self->worker[i].zsInit)
+            inflateEnd(&self->worker[i].zs);
+    }
+    for (i = 0; self->block != NULL && i < self->blocks; ++i) {
+        free(self->block[i].compressed);
+        free(self->block[i].inflated);
+    }
+    free(self->block);
+    free(self->worker);
+    KConditionRelease(self->changed);
+    KLockRelease(self->lock);
+    free(self);
+    file->mt = NULL;
+}
+
+static void BGZFileMTWhack(BGZFile *const file)
+{
+    if (file->mt != NULL)
+        BGZFileMTStop(file);
+    BGZFileWhack(file);
+}
+
+static rc_t BGZFileMTAlloc(struct BGZFileMT *const self, unsigned const workers)
+{
+    unsigned i;
+    
+    self->workers = workers;
+    self->blocks = workers * BGZF_BLOCKS_PER_WORKER;
+    self->worker = calloc(self->workers, sizeof(self->worker[0]));
+    self->block = calloc(self->blocks, sizeof(self->block[0]));
+    if (self->worker == NULL || self->block == NULL)
+        return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+    
+    for (i = 0; i < self->blocks; ++i) {
+        self->block[i].compressed = malloc(ZLIB_BLOCK_SIZE);
+        self->block[i].inflated = malloc(ZLIB_BLOCK_SIZE);
+        if (self->block[i].compressed == NULL || self->block[i].inflated == NULL)
+            return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+    }
+    for (i = 0; i < self->workers; ++i) {
+        self->worker[i].mt = self;
+        if (inflateInit2(&self->worker[i].zs, -MAX_WBITS) != Z_OK) /* raw deflate, the gzip framing is parsed by BGZBlockRead */
+            return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+        self->worker[i].zsInit = true;
+    }
+    return 0;
+}
+
+/* the file has to be positioned at the start of a block */
+static rc_t BGZFileMTInit(BGZFile *const file, RawFile_vt *const vt, unsigned const workers)
+{
+    static RawFile_vt const my_vt = {
+        (rc_t (*)(void *, zlib_block_t, unsigned *))BGZFileMTRead,
+        (uint64_t (*)(void const *))BGZFileMTGetPos,
+        (float (*)(void const *))BGZFileMTProPos,
+        (uint64_t (*)(void const *))BufferedFileGetSize,
+        (rc_t (*)(void *, uint64_t))BGZFileMTSetPos,
+        (void (*)(void *))BGZFileMTWhack
+    };
+    struct BGZFileMT *const self = calloc(1, sizeof(*self));
+    rc_t rc;
+    unsigned i;
+    
+    if (self == NULL)
+        return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+    
+    self->file = file;
+    self->pos = BufferedFileGetPos(&file->file);
+    file->mt = self;
+    
+    rc = KLockMake(&self->lock);
+    if (rc == 0)
+        rc = KConditionMake(&self->changed);
+    if (rc == 0)
+        rc = BGZFileMTAlloc(self, workers);
+    /* the workers first: once the reader runs, the file cannot go back to BGZFileRead */
+    for (i = 0; rc == 0 && i < self->workers; ++i)
+        rc = KThreadMake(&self->worker[i].th, BGZFileMTWorkerMain, &self->worker[i]);
+    if (rc == 0)
+        rc = KThreadMake(&self->reader, BGZFileMTReaderMain, self);
+    
+    if (rc == 0)
+        *vt = my_vt;
+    else
+        BGZFileMTStop(file);
+    return rc;
+}
+
+/* MARK: SAMFile multi-threaded parsing
+ * SAM records are lines, so the text can be cut anywhere after a line-feed.
+ * A reader thread cuts it into chunks, a pool of workers converts every line
+ * of a chunk to a BAM record, and SAMFileMTNextRecord hands the records out
+ * in file order.
+ */
+
+struct RefNameLookupContext {
+    BAMRefSeq const *refSeq;    /* sorted by name */
+    unsigned refSeqs;
+};
+
+static bool BAM_FileRefNameLookup(RefNameLookupContext *const self, char const name[], size_t const namelen, int32_t *const result)
+{
+    unsigned f = 0;
+    unsigned e = self->refSeqs;
+    
+    while (f < e) {
+        unsigned const m = f + ((e - f) >> 1);
+        char const *const ref = self->refSeq[m].name;
+        int cmp = ref == NULL ? -1 : strncmp(name, ref, namelen);
+        
+        if (cmp == 0 && ref[namelen] != '\0')
+            cmp = -1; /* name is a prefix of ref */
+        if (cmp < 0)
+            e = m;
+        else if (cmp > 0)
+            f = m + 1;
+        else {
+            *result = (int32_t)m;
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct SAMChunk {
+    char *text;                 /* whole lines, the last one ends with a line-feed unless it is the end of the file */
+    size_t textSize;
+    size_t textUsed;
+    SAM2BAM_Output out;         /* for every line: its block_size and BAM record, or SAM_RECORD_FAILED and its rc */
+    uint64_t endPos;            /* file position of the next chunk */
+    rc_t rc;
+    enum BGZBlockState state;   /* the same life-cycle as a BGZBlock; read: holds text, waiting for a worker */
+} SAMChunk;
+
+typedef struct SAMWorker {
+    struct SAMFileMT *mt;
+    KThread *th;
+} SAMWorker;
+
+struct SAMFileMT {
+    SAMFile *file;
+    KLock *lock;
+    KCondition *changed;        /* broadcast whenever a chunk changes its state */
+    KThread *reader;
+    SAMWorker *worker;
+    SAMChunk *chunk;
+    RefNameLookupContext refs;
+    uint64_t nextRead;          /* sequence number of the next chunk to read */
+    uint64_t nextParse;         /* sequence number of the next chunk to parse */
+    uint64_t nextDeliver;       /* sequence number of the chunk being handed out */
+    uint64_t pos;               /* file position after the chunk being handed out */
+    size_t cursor;              /* the next record in the chunk being handed out */
+    unsigned workers;
+    unsigned chunks;
+    bool quit;
+};
+
+#define SAM_CHUNK_SIZE (1024u * 1024u)
+#define SAM_CHUNKS_PER_WORKER (4)
+#define SAM_RECORD_FAILED (-1)
+
+static rc_t SAMChunkAppend(SAMChunk *const self, char const *const data, size_t const len)
+{
+    if (self->textUsed + len > self->textSize) {
+        size_t size = self->textSize * 2;
+        void *tmp;
+        
+        while (size < self->textUsed + len)
+            size *= 2;
+        tmp = realloc(self->text, size);
+        if (tmp == NULL)
+            return RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
+        self->text = tmp;
+        self->textSize = size;
+    }
+    memmove(&self->text[self->textUsed], data, len);
+    self->textUsed += len;
+    return 0;
+}
+
+/* reads lines until there are at least SAM_CHUNK_SIZE bytes; returns (rcRow, rcNotFound) at eof */
+static rc_t SAMChunkRead(SAMChunk *const self, SAMFile *const file)
+{
+    BufferedFile *const bf = &file->file;
+    
+    self->textUsed = 0;
+    if (file->putback >= 0) {
+        char const ch = (char)file->putback;
+        rc_t const rc = SAMChunkAppend(self, &ch, 1);
+        if (rc) return rc;
+        file->putback = -1;
+    }
+    for ( ; ; ) {
+        char const *start;
+        char const *endp;
+        char const *cut;
+        bool full = false;
+        rc_t rc;
+        
+        if (bf->bpos == bf->bmax) {
+            rc = BufferedFileRead(bf);
+            if (rc) return rc;
+            if (bf->bmax == 0)
+                break;
+        }
+        start = (char const *)bf->buf + bf->bpos;
+        endp = (char const *)bf->buf + bf->bmax;
+        cut = endp;
+        if (self->textUsed + (endp - start) >= SAM_CHUNK_SIZE) {
+            char const *const from = self->textUsed < SAM_CHUNK_SIZE ? start + (SAM_CHUNK_SIZE - self->textUsed) - 1 : start;
+            char const *const eol = SAM_FindByte(from, endp, '\n');
+            
+            if (eol < endp) {
+                cut = eol + 1;
+                full = true;
+            }
+        }
+        rc = SAMChunkAppend(self, start, cut - start);
+        if (rc) return rc;
+        bf->bpos += cut - start;
+        if (full)
+            return 0;
+    }
+    return self->textUsed > 0 ? 0 : SILENT_RC(rcAlign, rcFile, rcReading, rcRow, rcNotFound);
+}
+
+static rc_t SAMChunkParse(SAMChunk *const self, RefNameLookupContext *const refs)
+{
+    char const *line = self->text;
+    char const *const endp = self->text + self->textUsed;
+    
+    self->out.used = 0;
+    while (line < endp) {
+        char const *const eol = SAM_FindByte(line, endp, '\n');
+        size_t const at = self->out.used;
+        size_t length = eol - line;
+        rc_t rc = SAM2BAM_OutputReserve(&self->out, 8);
+        
+        if (rc) return rc;
+        if (length > 0 && line[length - 1] == '\r')
+            length -= 1;
+        self->out.used += 4;
+        if (eol == endp)
+            rc = RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort); /* the last line has no line-feed */
+        else
+            rc = SAM2BAM_ParseLine(&self->out, line, length, BAM_FileRefNameLookup, refs);
+        if (rc == 0) {
+            int32_t const block_size = (int32_t)(self->out.used - at - 4);
+            memmove(&self->out.base[at], &block_size, 4);
+        }
+        else {
+            int32_t const failed = SAM_RECORD_FAILED;
+            memmove(&self->out.base[at], &failed, 4);
+            memmove(&self->out.base[at + 4], &rc, 4);
+            self->out.used = at + 8;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+static rc_t SAMFileMTReaderMain(KThread const *const th, void *const vp)
+{
+    struct SAMFileMT *const self = (struct SAMFileMT *)vp;
+    bool done = false;
+    
+    KLockAcquire(self->lock);
+    while (!done) {
+        SAMChunk *const chunk = &self->chunk[self->nextRead % self->chunks];
+        rc_t rc;
+        
+        while (!self->quit && chunk->state != bgzb_free)
+            KConditionWait(self->changed, self->lock);
+        if (self->quit)
+            break;
+        KLockUnlock(self->lock);
+        
+        rc = SAMChunkRead(chunk, self->file);
+        chunk->endPos = BufferedFileGetPos(&self->file->file);
+        
+        KLockAcquire(self->lock);
+        if (rc == 0)
+            chunk->state = bgzb_read;
+        else {
+            /* eof or an error: this chunk ends the stream */
+            chunk->rc = rc;
+            chunk->out.used = 0;
+            chunk->state = bgzb_done;
+            done = true;
+        }
+        ++self->nextRead;
+        KConditionBroadcast(self->changed);
+    }
+    KLockUnlock(self->lock);
+    return 0;
+}
+
+static rc_t SAMFileMTWorkerMain(KThread const *const th, void *const vp)
+{
+    SAMWorker *const worker = (SAMWorker *)vp;
+    struct SAMFileMT *const self = worker->mt;
+    
+    KLockAcquire(self->lock);
+    for ( ; ; ) {
+        SAMChunk *chunk;
+        rc_t rc;
+        
+        while (!self->quit && self->nextParse == self->nextRead)
+            KConditionWait(self->changed, self->lock);
+        if (self->quit)
+            break;
+        chunk = &self->chunk[self->nextParse % self->chunks];
+        if (chunk->state != bgzb_read)
+            break; /* the chunk that ends the stream */
+        ++self->nextParse;
+        chunk->state = bgzb_busy;
+        KLockUnlock(self->lock);
+        
+        rc = SAMChunkParse(chunk, &self->refs);
+        
+        KLockAcquire(self->lock);
+        chunk->rc = rc;
+        chunk->state = bgzb_done;
+        KConditionBroadcast(self->changed);
+    }
+    KLockUnlock(self->lock);
+    return 0;
+}
+
+/* the next BAM record, good until the next call */
+static rc_t SAMFileMTNextRecord(SAMFile *const file, uint8_t const **const data, size_t *const size)
+{
+    struct SAMFileMT *const self = file->mt;
+    SAMChunk *chunk;
+    int32_t block_size;
+    rc_t rc;
+    
+    KLockAcquire(self->lock);
+    for ( ; ; ) {
+        chunk = &self->chunk[self->nextDeliver % self->chunks];
+        while (chunk->state != bgzb_done)
+            KConditionWait(self->changed, self->lock);
+        if (chunk->rc != 0 || self->cursor < chunk->out.used)
+            break;
+        chunk->state = bgzb_free;
+        ++self->nextDeliver;
+        self->cursor = 0;
+        KConditionBroadcast(self->changed);
+    }
+    rc = chunk->rc;
+    self->pos = chunk->endPos;
+    KLockUnlock(self->lock);
+    if (rc)
+        return rc; /* the chunk stays: every further read returns the same rc */
+    
+    memmove(&block_size, &chunk->out.base[self->cursor], 4);
+    if (block_size == SAM_RECORD_FAILED) {
+        memmove(&rc, &chunk->out.base[self->cursor + 4], 4);
+        self->cursor += 8;
+        return rc;
+    }
+    *data = &chunk->out.base[self->cursor + 4];
+    *size = (size_t)block_size;
+    self->cursor += 4 + (size_t)block_size;
+    return 0;
+}
+
+static uint64_t SAMFileMTGetPos(SAMFile const *const file)
+{
+    return file->mt->pos;
+}
+
+static float SAMFileMTProPos(SAMFile const *const file)
+{
+    uint64_t const fmax = file->file.fmax;
+    return fmax == 0 ? -1.0 : (file->mt->pos / (double)fmax);
+}
+
+static rc_t SAMFileMTSetPos(SAMFile *const file, uint64_t const pos)
+{
+    /* the reader thread owns the file position */
+    return RC(rcAlign, rcFile, rcPositioning, rcFunction, rcUnsupported);
+}
+
+/* stops the threads and frees everything, the file is single-threaded again */
+static void SAMFileMTStop(SAMFile *const file)
+{
+    struct SAMFileMT *const self = file->mt;
+    unsigned i;
+    
+    if (self->lock != NULL && self->changed != NULL) {
+        KLockAcquire(self->lock);
+        self->quit = true;
+        KConditionBroadcast(self->changed);
+        KLockUnlock(self->lock);
+    }
+    if (self->reader) {
+        KThreadWait(self->reader, NULL);
+        KThreadRelease(self->reader);
+    }
+    for (i = 0; self->worker != NULL && i < self->workers; ++i) {
+        if (self->worker[i].th) {
+            KThreadWait(self->worker[i].th, NULL);
+            KThreadRelease(self->worker[i].th);
+        }
+    }
+    for (i = 0; self->chunk != NULL && i < self->chunks; ++i) {
+        free(self->chunk[i].text);
+        SAM2BAM_OutputWhack(&self->chunk[i].out);
+    }
+    free(self->chunk);
+    free(self->worker);
+    KConditionRelease(self->changed);
+    KLockRelease(self->lock);
+    free(self);
+    file->mt = NULL;
+}
+
+static void SAMFileMTWhack(SAMFile *const file)
+{
+    SAMFileMTStop(file);
+    SAMFileWhack(file);
+}
+
+static rc_t SAMFileMTAlloc(struct SAMFileMT *const self, unsigned const workers)
+{
+    unsigned i;
+    
+    self->workers = workers;
+    self->chunks = workers * SAM_CHUNKS_PER_WORKER;
+    self->worker = calloc(self->workers, sizeof(self->worker[0]));
+    self->chunk = calloc(self->chunks, sizeof(self->chunk[0]));
+    if (self->worker == NULL || self->chunk == NULL)
+        return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+    
+    for (i = 0; i < self->chunks; ++i) {
+        SAMChunk *const chunk = &self->chunk[i];
+        rc_t rc;
+        
+        chunk->textSize = SAM_CHUNK_SIZE + SAM_CHUNK_SIZE / 4;
+        chunk->text = malloc(chunk->textSize);
+        if (chunk->text == NULL)
+            return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+        /* BAM is about the same size as SAM */
+        rc = SAM2BAM_OutputReserve(&chunk->out, chunk->textSize);
+        if (rc) return rc;
+    }
+    for (i = 0; i < self->workers; ++i)
+        self->worker[i].mt = self;
+    return 0;
+}
+
+/* the file has to be positioned at the start of a line */
+static rc_t SAMFileMTInit(SAMFile *const file, RawFile_vt *const vt, unsigned const workers, RefNameLookupContext const *const refs)
+{
+    static RawFile_vt const my_vt = {
+        (rc_t (*)(void *, zlib_block_t, unsigned *))NULL,
+        (uint64_t (*)(void const *))SAMFileMTGetPos,
+        (float (*)(void const *))SAMFileMTProPos,
+        (uint64_t (*)(void const *))BufferedFileGetSize,
+        (rc_t (*)(void *, uint64_t))SAMFileMTSetPos,
+        (void (*)(void *))SAMFileMTWhack
+    };
+    struct SAMFileMT *const self = calloc(1, sizeof(*self));
+    rc_t rc;
+    unsigned i;
+    
+    if (self == NULL)
+        return RC(rcAlign, rcFile, rcConstructing, rcMemory, rcExhausted);
+    
+    self->file = file;
+    self->refs = *refs;
+    self->pos = BufferedFileGetPos(&file->file);
+    file->mt = self;
+    
+    rc = KLockMake(&self->lock);
+    if (rc == 0)
+        rc = KConditionMake(&self->changed);
+    if (rc == 0)
+        rc = SAMFileMTAlloc(self, workers);
+    for (i = 0; rc == 0 && i < self->workers; ++i)
+        rc = KThreadMake(&self->worker[i].th, SAMFileMTWorkerMain, &self->worker[i]);
+    if (rc == 0)
+        rc = KThreadMake(&self->reader, SAMFileMTReaderMain, self);
+    
+    if (rc == 0)
+        *vt = my_vt;
+    else
+        SAMFileMTStop(file);
+    return rc;
+}
+
 static const char cigarChars[] = {
     ct_Match,
     ct_Insert,
@@ -1491,6 +2411,28 @@ rc_t BAM_FileMake(const BAM_File **cself,
     return rc;
 }
 
+rc_t BAM_FileSetInflateThreads(const BAM_File *cself, unsigned threads)
+{
+    BAM_File *const self = (BAM_File *)cself;
+    
+    if (self == NULL)
+        return RC(rcAlign, rcFile, rcInitializing, rcSelf, rcNull);
+    if (threads == 0)
+        return 0;
+    if (self->isSAM) {
+        RefNameLookupContext refs;
+        
+        if (self->file.sam.mt != NULL)
+            return 0;
+        refs.refSeq = self->refSeq;
+        refs.refSeqs = self->refSeqs;
+        return SAMFileMTInit(&self->file.sam, &self->vt, threads, &refs);
+    }
+    if (self->file.bam.mt != NULL)
+        return 0;
+    return BGZFileMTInit(&self->file.bam, &self->vt, threads);
+}
+
 /* MARK: BAM File ref-counting */
 
 rc_t BAM_FileAddRef(const BAM_File *cself) {
@@ -1901,152 +2843,50 @@ rc_t BAM_FileReadCopy(BAM_File *const self, BAM_Alignment **const rslt, bool con
 
 /* MARK: SAM code */
 
-struct RefNameLookupContext {
-    BAMRefSeq *refSeq;
-    unsigned refSeqs;
-    unsigned first;
-    unsigned last;
-    unsigned depth;
-};
-
-static bool BAM_FileRefNameIncrementalLookup(RefNameLookupContext *const self, int const ch, int32_t *const result, rc_t *const rc)
-{
-    if (ch < 0) {
-        *result = self->first;
-        if (self->depth == 0 || self->last <= self->first) {
-            *rc = RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid);
-            return false;
-        }
-        self->depth = 0;
-    }
-    else {
-        unsigned const depth = self->depth++;
-        unsigned f = depth == 0 ? 0 : self->first;
-        unsigned e = depth == 0 ? self->refSeqs : self->last;
-        unsigned const save = e;
-        
-        while (f < e) {
-            unsigned const m = ((e - f) >> 1) + f;
-            int const fnd = self->refSeq[m].name[depth];
-            if (fnd < ch) {
-                f = m + 1;
-            }
-            else {
-                e = m;
-            }
-        }
-        if (f >= self->refSeqs || self->refSeq[f].name[depth] != ch)
-            goto NOT_FOUND;
-        
-        e = save;
-        self->first = f;
-        while (f < e) {
-            unsigned const m = ((e - f) >> 1) + f;
-            int const fnd = self->refSeq[m].name[depth];
-            if (fnd <= ch) {
-                f = m + 1;
-            }
-            else {
-                e = m;
-            }
-        }
-        self->last = e;
-        if (self->first == self->last) {
-        NOT_FOUND:
-            *rc = RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid);
-            return false;
-        }
-    }
-    return true;
-}
-
-static void BAM_FileReadSAM_SplitLine(char const *const line, unsigned const fields, unsigned *const start)
-{
-    unsigned fld = 0;
-    unsigned i = 0;
-    
-    while (fld < fields) {
-        if (line[i++] == '\0')
-            start[fld++] = i;
-    }
-}
-
-static rc_t BAM_FileReadSAM_1(BAM_File *const self, KDataBuffer *data, KDataBuffer *starts)
-{
-    rc_t rc = 0;
-    int ch;
-    unsigned nread = 0;
-    unsigned fields = 0;
-
-    while ((ch = SAMFileRead1(&self->file.sam)) >= 0) {
-        if (nread == data->elem_count) {
-            rc = KDataBufferResize(data, ((size_t)nread) * 2);
-            if (rc) return rc;
-        }
-        ((char *)data->base)[nread] = ch;
-        nread += 1;
-        if (ch != '\t' && ch != '\n')
-            continue;
-        
-        ++fields;
-        ((char *)data->base)[nread - 1] = '\0';
-        if (ch == '\t')
-            continue;
-        
-        KDataBufferResize(data, nread);
-        rc = KDataBufferResize(starts, fields);
-        if (rc) return rc;
-        
-        BAM_FileReadSAM_SplitLine(data->base, fields, starts->base);
-        return 0;
-    }
-    /* error but probably EOF */
-    rc = SAMFileLastError(&self->file.sam);
-    if (GetRCState(rc) == (int)rcInsufficient)
-        rc = nread == 0 ? SILENT_RC(rcAlign, rcFile, rcReading, rcRow, rcNotFound)  /* EOF at start of line is OK */
-                        : RC(rcAlign, rcFile, rcReading, rcFile, rcTooShort);
-    return rc;
-}
-
 static rc_t BAM_FileReadSAM(BAM_File *const self, BAM_Alignment **const rslt)
 {
-    KDataBuffer data;
-    KDataBuffer offsets;
-    SAM2BAM_Parser *parser = NULL;
-    rc_t rc = 0;
-
-    memset(&data, 0, sizeof(data));
-    memset(&offsets, 0, sizeof(offsets));
+    SAM2BAM_Output out;
+    rc_t rc;
     
-    rc = KDataBufferMakeBytes(&data, 65536);
-    if (rc) return rc;
+    out.base = out.static_buffer = self->buffer;
+    out.size = sizeof(self->buffer);
+    out.used = 0;
     
-    rc = KDataBufferMake(&offsets, sizeof(unsigned) * 8, 4080 / sizeof(unsigned));
-    if (rc == 0) {
-        rc = BAM_FileReadSAM_1(self, &data, &offsets);
+    if (self->file.sam.mt != NULL) {
+        uint8_t const *data = NULL;
+        size_t size = 0;
+        
+        rc = SAMFileMTNextRecord(&self->file.sam, &data, &size);
+        if (rc == 0)
+            rc = SAM2BAM_OutputReserve(&out, size);
         if (rc == 0) {
-            RefNameLookupContext ctx;
-
-            ctx.refSeq = self->refSeq;
-            ctx.refSeqs = self->refSeqs;
-            ctx.depth = 0;
-            
-            parser = SAM2BAM_Parser_parse(data.base, offsets.elem_count, offsets.base, self->buffer, sizeof(self->buffer), BAM_FileRefNameIncrementalLookup, &ctx, &rc);
+            memmove(out.base, data, size);
+            out.used = size;
         }
     }
-    if (parser) {
-        if (rc == 0) {
-            assert(parser->field >= 11);
-            *rslt = BAM_FileMakeAlignment(self, parser->rslt_size, parser->rslt, parser->field - 11, &rc);
-            if ((**rslt).storage == (void *)parser->rslt)
-                parser->rslt = NULL; /* ownership was transfered */
+    else {
+        char const *line = NULL;
+        size_t length = 0;
+        RefNameLookupContext refs;
+        
+        refs.refSeq = self->refSeq;
+        refs.refSeqs = self->refSeqs;
+        rc = SAMFileReadLine(&self->file.sam, &line, &length);
+        if (rc == 0)
+            rc = SAM2BAM_ParseLine(&out, line, length, BAM_FileRefNameLookup, &refs);
+    }
+    if (rc == 0) {
+        int const numExtra = BAM_AlignmentNumExtraFromData((unsigned)out.used, out.base);
+        
+        if (numExtra >= 0) {
+            *rslt = BAM_FileMakeAlignment(self, out.used, out.base, numExtra, &rc);
+            if (*rslt != NULL && (**rslt).storage == (void *)out.base)
+                out.base = out.static_buffer; /* ownership was transfered */
         }
-        if (parser->rslt != NULL && (void *)parser->rslt != (void *)self->buffer)
-            free(parser->rslt);
-        free(parser);
+        else
+            rc = RC(rcAlign, rcFile, rcReading, rcRow, rcInvalid);
     }
-    KDataBufferWhack(&offsets);
-    KDataBufferWhack(&data);
+    SAM2BAM_OutputWhack(&out);
     return rc;
 }
 
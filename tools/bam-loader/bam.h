@@ -520,6 +520,16 @@ rc_t BAM_FileMake(const BAM_File **result,
                   char const headerText[],
                   char const path[], ... );
 
+/* SetInflateThreads
+ *  inflate the BGZF blocks, or parse the lines of a SAM file, on a pool of
+ *  threads, read ahead of the caller; the records are still handed out in
+ *  file order; does nothing if threads is 0; the file cannot be repositioned
+ *  afterwards
+ *
+ *  "threads" [ IN ] - the number of inflating or parsing threads
+ */
+rc_t BAM_FileSetInflateThreads(const BAM_File *self, unsigned threads);
+
 /* AddRef
  * Release
  */
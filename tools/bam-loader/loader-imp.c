@@ -38,7 +38,6 @@
 
 #include <kfs/directory.h>
 #include <kfs/file.h>
-#include <kdb/btree.h>
 #include <kdb/manager.h>
 #include <kdb/database.h>
 #include <kdb/table.h>
@@ -64,6 +63,8 @@
 #include <kapp/progressbar.h>
 
 #include <kproc/queue.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
 #include <kproc/thread.h>
 #include <kproc/timeout.h>
 #include <os-native.h>
@@ -90,6 +91,7 @@
 #include "alignment-writer.h"
 #include "mem-bank.h"
 #include "low-match-count.h"
+#include "spot-name-map.h"
 
 #define NUM_ID_SPACES (256u)
 
@@ -146,21 +148,12 @@ typedef struct FragmentInfo {
 } FragmentInfo;
 
 typedef struct KeyToID {
-    KBTree *key2id[NUM_ID_SPACES];
-    char *key2id_names;
+    SpotNameMap *key2id;
 
+    /* kept from key2id once it is released */
     uint32_t idCount[NUM_ID_SPACES];
-    uint32_t key2id_hash[NUM_ID_SPACES];
 
     unsigned key2id_max;
-    unsigned key2id_name_max;
-    unsigned key2id_name_alloc;
-    unsigned key2id_count;
-
-    unsigned key2id_name[NUM_ID_SPACES];
-    /* this array is kept in name order */
-    /* this maps the names to key2id and idCount */
-    unsigned key2id_oid[NUM_ID_SPACES];
 } KeyToID;
 
 typedef struct context_t {
@@ -338,56 +331,42 @@ static void MMArrayWhack(MMArray *self)
     free(self);
 }
 
-static rc_t OpenKBTree(KBTree **const rslt, unsigned n, unsigned max)
+static rc_t KeyToIDMake(KeyToID *const self)
 {
-    size_t const cacheSize = (((G.cache_size - (G.cache_size / 2) - (G.cache_size / 8)) / max)
-                            + 0xFFFFF) & ~((size_t)0xFFFFF);
-    KFile *file = NULL;
-    KDirectory *dir;
-    char fname[4096];
-    rc_t rc;
+    size_t const limit = G.cache_size - (G.cache_size / 2) - (G.cache_size / 8);
 
-    rc = KDirectoryNativeDir(&dir);
-    if (rc)
-        return rc;
+    if (self->key2id != NULL)
+        return 0;
+    return SpotNameMapMake(&self->key2id, limit, G.tmpfs, G.pid);
+}
 
-    rc = string_printf(fname, sizeof(fname), NULL, "%s/key2id.%u.%u", G.tmpfs, G.pid, n); if (rc) return rc;
-    rc = KDirectoryCreateFile(dir, &file, true, 0600, kcmInit, "%s", fname);
-    KDirectoryRemove(dir, 0, "%s", fname);
-    KDirectoryRelease(dir);
-    if (rc == 0) {
-        rc = KBTreeMakeUpdate(rslt, file, cacheSize,
-                              false, kbtOpaqueKey,
-                              1, 255, sizeof ( uint32_t ),
-                              NULL
-                              );
-        KFileRelease(file);
-#if PERF
-        if (rc == 0) {
-            static unsigned treecount = 0;
+static uint32_t KeyToIDCount(KeyToID const *const self, unsigned const group)
+{
+    return self->key2id ? SpotNameMapIdCount(self->key2id, group) : self->idCount[group];
+}
 
-            (void)PLOGMSG(klogInfo, (klogInfo, "Number of trees: $(cnt)", "cnt=%u", ++treecount));
-        }
-#endif
-    }
-    return rc;
+static void KeyToIDReleaseNames(KeyToID *const self)
+{
+    unsigned i;
+
+    if (self->key2id == NULL)
+        return;
+    for (i = 0; i != NUM_ID_SPACES; ++i)
+        self->idCount[i] = SpotNameMapIdCount(self->key2id, i);
+    (void)PLOGMSG(klogInfo, (klogInfo, "Spot names spilled to $(runs) runs", "runs=%u", SpotNameMapRunCount(self->key2id)));
+    SpotNameMapRelease(self->key2id);
+    self->key2id = NULL;
 }
 
 static rc_t GetKeyIDOld(KeyToID *const ctx, uint64_t *const rslt, bool *const wasInserted, char const key[], char const name[], unsigned const namelen)
 {
     unsigned const keylen = strlen(key);
     rc_t rc;
-    uint64_t tmpKey;
+    uint32_t tmpKey = 0;
 
-    if (ctx->key2id_count == 0) {
-        rc = OpenKBTree(&ctx->key2id[0], 1, 1);
-        if (rc) return rc;
-        ctx->key2id_count = 1;
-    }
     if (memcmp(key, name, keylen) == 0) {
         /* qname starts with read group; no append */
-        tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, name, namelen);
+        rc = SpotNameMapEntry(ctx->key2id, 0, name, namelen, &tmpKey, wasInserted);
     }
     else {
         char sbuf[4096];
@@ -404,63 +383,15 @@ static rc_t GetKeyIDOld(KeyToID *const ctx, uint64_t *const rslt, bool *const wa
         }
         rc = string_printf(buf, bsize, &actsize, "%s\t%.*s", key, (int)namelen, name);
 
-        tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, buf, actsize);
+        rc = SpotNameMapEntry(ctx->key2id, 0, buf, actsize, &tmpKey, wasInserted);
         if (hbuf)
             free(hbuf);
     }
-    if (rc == 0) {
+    if (rc == 0)
         *rslt = tmpKey;
-        if (*wasInserted)
-            ++ctx->idCount[0];
-    }
     return rc;
 }
 
-static unsigned HashKey(void const *const key, unsigned const keylen)
-{
-#if 0
-    /* There is nothing special about this hash. It was randomly generated. */
-    static const uint8_t T1[] = {
-         64, 186,  39, 203,  54, 211,  98,  32,  26,  23, 219,  94,  77,  60,  56, 184,
-        129, 242,  10,  91,  84, 192,  19, 197, 231, 133, 125, 244,  48, 176, 160, 164,
-         17,  41,  57, 137,  44, 196, 116, 146, 105,  40, 122,  47, 220, 226, 213, 212,
-        107, 191,  52, 144,   9, 145,  81, 101, 217, 206,  85, 134, 143,  58, 128,  20,
-        236, 102,  83, 149, 148, 180, 167, 163,  12, 239,  31,   0,  73, 152,   1,  15,
-         75, 200,   4, 165,   5,  66,  25, 111, 255,  70, 174, 151,  96, 126, 147,  34,
-        112, 161, 127, 181, 237,  78,  37,  74, 222, 123,  21, 132,  95,  51, 141,  45,
-         61, 131, 193,  68,  62, 249, 178,  33,   7, 195, 228,  82,  27,  46, 254,  90,
-        185, 240, 246, 124, 205, 182,  42,  22, 198,  69, 166,  92, 169, 136, 223, 245,
-        118,  97, 115,  80, 252, 209,  49,  79, 221,  38,  28,  35,  36, 208, 187, 248,
-        158, 201, 202, 168,   2,  18, 189, 119, 216, 214,  11,   6,  89,  16, 229, 109,
-        120,  43, 162, 106, 204,   8, 199, 235, 142, 210,  86, 153, 227, 230,  24, 100,
-        224, 113, 190, 243, 218, 215, 225, 173,  99, 238, 138,  59, 183, 154, 171, 232,
-        157, 247, 233,  67,  88,  50, 253, 251, 140, 104, 156, 170, 150, 103, 117, 110,
-        155,  72, 207, 250, 159, 194, 177, 130, 135,  87,  71, 175,  14,  55, 172, 121,
-        234,  13,  30, 241,  93, 188,  53, 114,  76,  29,  65,   3, 179, 108,  63, 139
-    };
-    unsigned h = 0x55;
-    unsigned i = keylen;
-
-    do { h = T1[h ^ ((uint8_t)i)]; } while ((i >>= 8) != 0);
-
-    for (i = 0; i != keylen; ++i)
-        h = T1[h ^ ((uint8_t const *)key)[i]];
-
-    return h;
-#else
-    /* FNV-1a hash with folding */
-    uint64_t h = 0xcbf29ce484222325;
-    unsigned i;
-
-    for (i = 0; i < keylen; ++i) {
-        uint8_t const octet = ((uint8_t const *)key)[i];
-        h = (h ^ octet) * 0x100000001b3ull;
-    }
-    return ((uint32_t)(h ^ (h >> 32))) % NUM_ID_SPACES;
-#endif
-}
-
 #define USE_ILLUMINA_NAMING_CORRECTION 1
 
 static size_t GetFixedNameLength(char const name[], size_t const namelen)
@@ -522,113 +453,24 @@ rc_t GetKeyID(KeyToID *const ctx,
     if (ctx->key2id_max == 1)
         return GetKeyIDOld(ctx, rslt, wasInserted, key, name, namelen);
     else {
-        unsigned const keylen = strlen(key);
-        unsigned const h = HashKey(key, keylen);
-        unsigned f;
-        unsigned e = ctx->key2id_count;
-        uint64_t tmpKey;
+        unsigned f = 0;
+        bool newGroup = false;
+        uint32_t tmpKey = 0;
+        rc_t rc;
 
         *rslt = 0;
-        {{
-            uint32_t const bucket_value = ctx->key2id_hash[h];
-            unsigned const n  = (uint8_t) bucket_value;
-            unsigned const i1 = (uint8_t)(bucket_value >>  8);
-            unsigned const i2 = (uint8_t)(bucket_value >> 16);
-            unsigned const i3 = (uint8_t)(bucket_value >> 24);
-
-            if (n > 0 && strcmp(key, ctx->key2id_names + ctx->key2id_name[i1]) == 0) {
-                f = i1;
-                /*
-                ctx->key2id_hash[h] = (i3 << 24) | (i2 << 16) | (i1 << 8) | n;
-                 */
-                goto GET_ID;
-            }
-            if (n > 1 && strcmp(key, ctx->key2id_names + ctx->key2id_name[i2]) == 0) {
-                f = i2;
-                ctx->key2id_hash[h] = (i3 << 24) | (i1 << 16) | (i2 << 8) | n;
-                goto GET_ID;
-            }
-            if (n > 2 && strcmp(key, ctx->key2id_names + ctx->key2id_name[i3]) == 0) {
-                f = i3;
-                ctx->key2id_hash[h] = (i2 << 24) | (i1 << 16) | (i3 << 8) | n;
-                goto GET_ID;
-            }
-        }}
-        f = 0;
-        while (f < e) {
-            unsigned const m = (f + e) / 2;
-            unsigned const oid = ctx->key2id_oid[m];
-            int const diff = strcmp(key, ctx->key2id_names + ctx->key2id_name[oid]);
-
-            if (diff < 0)
-                e = m;
-            else if (diff > 0)
-                f = m + 1;
-            else {
-                f = oid;
-                goto GET_ID;
-            }
-        }
-        if (ctx->key2id_count < ctx->key2id_max) {
-            unsigned const name_max = ctx->key2id_name_max + keylen + 1;
-            KBTree *tree;
-            rc_t rc = OpenKBTree(&tree, ctx->key2id_count + 1, 1); /* ctx->key2id_max); */
-
-            if (rc) return rc;
-
-            if (ctx->key2id_name_alloc < name_max) {
-                unsigned alloc = ctx->key2id_name_alloc;
-                void *tmp;
-
-                if (alloc == 0)
-                    alloc = 4096;
-                while (alloc < name_max)
-                    alloc <<= 1;
-                tmp = realloc(ctx->key2id_names, alloc);
-                if (tmp == NULL)
-                    return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
-                ctx->key2id_names = tmp;
-                ctx->key2id_name_alloc = alloc;
-            }
-            if (f < ctx->key2id_count) {
-                memmove(&ctx->key2id_oid[f + 1], &ctx->key2id_oid[f], (ctx->key2id_count - f) * sizeof(ctx->key2id_oid[f]));
-            }
-            ctx->key2id_oid[f] = ctx->key2id_count;
-            ++ctx->key2id_count;
-            f = ctx->key2id_oid[f];
-            ctx->key2id_name[f] = ctx->key2id_name_max;
-            ctx->key2id_name_max = name_max;
-
-            memmove(&ctx->key2id_names[ctx->key2id_name[f]], key, keylen + 1);
-            ctx->key2id[f] = tree;
-            ctx->idCount[f] = 0;
-            if ((uint8_t)ctx->key2id_hash[h] < 3) {
-                unsigned const n = (uint8_t)ctx->key2id_hash[h] + 1;
-
-                ctx->key2id_hash[h] = (((ctx->key2id_hash[h] & ~(0xFFu)) | f) << 8) | n;
-            }
-            else {
-                /* the hash function isn't working too well
-                 * keep the 3 mru
-                 */
-                ctx->key2id_hash[h] = (((ctx->key2id_hash[h] & ~(0xFFu)) | f) << 8) | 3;
-            }
-        GET_ID:
-            tmpKey = ctx->idCount[f];
-            rc = KBTreeEntry(ctx->key2id[f], &tmpKey, wasInserted, name, namelen);
-            if (rc == 0) {
-                *rslt = (((uint64_t)f) << 32) | tmpKey;
-                if (*wasInserted)
-                    ++ctx->idCount[f];
-                if (!(tmpKey < ctx->idCount[f])) {
-                    (void)PLOGMSG(klogErr, (klogErr, "too many spots for read group '$(rg)'; ran out of 32-bit ids", "rg=%s", key));
-                    return RC(rcExe, rcTree, rcAllocating, rcId, rcExhausted);
-                }
-            }
+        rc = SpotNameMapGroup(ctx->key2id, key, ctx->key2id_max, &f, &newGroup);
+        if (rc) {
+            if (GetRCObject(rc) == rcConstraint && GetRCState(rc) == rcViolated)
+                (void)PLOGMSG(klogErr, (klogErr, "too many read groups: max is $(max)", "max=%d", (int)ctx->key2id_max));
             return rc;
         }
-        (void)PLOGMSG(klogErr, (klogErr, "too many read groups: max is $(max)", "max=%d", (int)ctx->key2id_max));
-        return RC(rcExe, rcTree, rcAllocating, rcConstraint, rcViolated);
+        rc = SpotNameMapEntry(ctx->key2id, f, name, namelen, &tmpKey, wasInserted);
+        if (rc == 0)
+            *rslt = (((uint64_t)f) << 32) | tmpKey;
+        else if (GetRCObject(rc) == rcId && GetRCState(rc) == rcExhausted)
+            (void)PLOGMSG(klogErr, (klogErr, "too many spots for read group '$(rg)'; ran out of 32-bit ids", "rg=%s", key));
+        return rc;
     }
 }
 
@@ -675,6 +517,8 @@ static rc_t SetupContext(context_t *ctx, unsigned numfiles)
         rc = TmpfsDirectory(&dir);
         if (rc == 0)
             rc = OpenMMapFile(ctx, dir);
+        if (rc == 0)
+            rc = KeyToIDMake(&ctx->keyToID);
         if (rc == 0)
             rc = MemBankMake(&ctx->frags, dir, G.pid, fragSize);
         KDirectoryRelease(dir);
@@ -688,7 +532,10 @@ static rc_t SetupContext(context_t *ctx, unsigned numfiles)
         ctx->keyToID = save1;
         ctx->id2value = save2;
         ctx->spotId = save3;
+        rc = KeyToIDMake(&ctx->keyToID);
     }
+    if (rc)
+        return rc;
 
     rc = KLoadProgressbar_Make(&ctx->progress[0], 0); if (rc) return rc;
     rc = KLoadProgressbar_Make(&ctx->progress[1], 0); if (rc) return rc;
@@ -816,7 +663,12 @@ static rc_t OpenBAM(const BAM_File **bam, VDatabase *db, const char bamFile[])
     if (rc) {
         (void)PLOGERR(klogErr, (klogErr, rc, "Failed to open '$(file)'", "file=%s", bamFile));
     }
-    else if (db) {
+    else {
+        rc_t const rc2 = BAM_FileSetInflateThreads(*bam, G.inflateThreads);
+        if (rc2)
+            (void)PLOGERR(klogWarn, (klogWarn, rc2, "Failed to start the inflate threads for '$(file)', reading on a single thread", "file=%s", bamFile));
+    }
+    if (rc == 0 && db) {
         KMetadata *dbmeta;
 
         rc = VDatabaseOpenMetadataUpdate(db, &dbmeta);
@@ -1404,6 +1256,276 @@ static context_t GlobalContext;
 static KQueue *bamq;
 static KThread *bamread_thread;
 
+/* MARK: decoding records ahead of ProcessBAM */
+
+/* Unpacking bases and qualities and orienting them does not depend on
+ * anything ProcessBAM keeps, so the BAM reading thread hands the records
+ * in batches to a pool of threads to do it. The records still go through
+ * bamq in file order; ProcessBAM waits for a record's batch to be decoded
+ * and copies the results instead of redoing the work.
+ */
+#define DECODE_BATCH_SIZE (256u)
+
+typedef struct DecodeBatch DecodeBatch;
+typedef struct DecodedRecord DecodedRecord;
+
+struct DecodedRecord {
+    DecodeBatch *batch;
+    char const *seq;        /* as from BAM_AlignmentGetSequence */
+    uint8_t const *qual;    /* any OQ offset has been removed */
+    char const *oseq;       /* seq, reverse complemented if reversed */
+    uint8_t const *oqual;   /* qual, reversed if reversed */
+    uint32_t readlen;
+    bool valid;             /* false for CG records and bad OQ; ProcessBAM does those */
+    bool reversed;
+    bool hadOQ;
+};
+
+struct DecodeBatch {
+    KDataBuffer buffer;
+    BAM_Alignment *rec[DECODE_BATCH_SIZE];
+    DecodedRecord decoded[DECODE_BATCH_SIZE];
+    unsigned count;
+    unsigned refs;          /* records not yet released; under decodeLock */
+    bool done;              /* under decodeLock */
+};
+
+static KQueue *decodeq;
+static KThread **decodeWorker;
+static unsigned decodeWorkers;
+static KLock *decodeLock;
+static KCondition *decodeDone;
+
+static DecodeBatch *DecodeBatchMake(void)
+{
+    DecodeBatch *const self = calloc(1, sizeof(*self));
+    if (self) {
+        if (KDataBufferMake(&self->buffer, 8, 0) == 0)
+            return self;
+        free(self);
+    }
+    return NULL;
+}
+
+static void DecodeBatchWhack(DecodeBatch *const self)
+{
+    KDataBufferWhack(&self->buffer);
+    free(self);
+}
+
+static bool DecodedRecordInit(DecodedRecord *const self, BAM_Alignment const *const rec)
+{
+    uint16_t flags = 0;
+    uint32_t readlen = 0;
+    rc_t const rc = BAM_AlignmentCGReadLength(rec, &readlen);
+
+    self->valid = false;
+    self->hadOQ = false;
+    if (rc == 0 || GetRCState(rc) != rcNotFound)
+        return false;
+    if (!G.useQUAL) {
+        uint8_t const *squal;
+        uint8_t qoffset = 0;
+
+        if (BAM_AlignmentGetQuality2(rec, &squal, &qoffset) != 0)
+            return false;
+        self->hadOQ = qoffset != 0;
+    }
+    BAM_AlignmentGetFlags(rec, &flags);
+    BAM_AlignmentGetReadLength(rec, &readlen);
+    self->readlen = readlen;
+    self->reversed = (flags & BAMFlags_SelfIsReverse) == 0 ? false : true;
+    self->valid = true;
+    return true;
+}
+
+static void DecodedRecordFill(DecodedRecord *const self, BAM_Alignment const *const rec, uint8_t *const base)
+{
+    uint32_t const readlen = self->readlen;
+    char *const seq = (char *)base;
+    uint8_t *const qual = &base[readlen];
+    uint8_t const *squal;
+
+    BAM_AlignmentGetSequence(rec, seq);
+    if (G.useQUAL) {
+        BAM_AlignmentGetQuality(rec, &squal);
+        memmove(qual, squal, readlen);
+    }
+    else {
+        uint8_t qoffset = 0;
+        unsigned i;
+
+        BAM_AlignmentGetQuality2(rec, &squal, &qoffset);
+        for (i = 0; i != readlen; ++i)
+            qual[i] = squal[i] - qoffset;
+    }
+    self->seq = seq;
+    self->qual = qual;
+    if (self->reversed) {
+        char *const oseq = (char *)&base[2 * readlen];
+        uint8_t *const oqual = &base[3 * readlen];
+
+        COPY_READ(oseq, seq, readlen, true);
+        COPY_QUAL(oqual, qual, readlen, true);
+        self->oseq = oseq;
+        self->oqual = oqual;
+    }
+    else {
+        self->oseq = seq;
+        self->oqual = qual;
+    }
+}
+
+static void DecodeBatchRun(DecodeBatch *const self)
+{
+    size_t total = 0;
+    unsigned i;
+
+    for (i = 0; i != self->count; ++i) {
+        DecodedRecord *const decoded = &self->decoded[i];
+
+        if (DecodedRecordInit(decoded, self->rec[i]))
+            total += (decoded->reversed ? 4 : 2) * (size_t)decoded->readlen;
+    }
+    if (KDataBufferResize(&self->buffer, total) != 0) {
+        /* ProcessBAM will decode them itself */
+        for (i = 0; i != self->count; ++i)
+            self->decoded[i].valid = false;
+        return;
+    }
+    total = 0;
+    for (i = 0; i != self->count; ++i) {
+        DecodedRecord *const decoded = &self->decoded[i];
+
+        if (decoded->valid) {
+            DecodedRecordFill(decoded, self->rec[i], &((uint8_t *)self->buffer.base)[total]);
+            total += (decoded->reversed ? 4 : 2) * (size_t)decoded->readlen;
+        }
+    }
+}
+
+static void DecodeBatchSetDone(DecodeBatch *const self)
+{
+    KLockAcquire(decodeLock);
+    self->done = true;
+    KConditionBroadcast(decodeDone);
+    KLockUnlock(decodeLock);
+}
+
+static void DecodeBatchWait(DecodeBatch *const self)
+{
+    KLockAcquire(decodeLock);
+    while (!self->done)
+        KConditionWait(decodeDone, decodeLock);
+    KLockUnlock(decodeLock);
+}
+
+static rc_t run_decode_thread(const KThread *self, void *const unused)
+{
+    for ( ; ; ) {
+        DecodeBatch *batch = NULL;
+        timeout_t tm;
+        rc_t rc;
+
+        TimeoutInit(&tm, 1000);
+        rc = KQueuePop(decodeq, (void **)&batch, &tm);
+        if (rc == 0) {
+            DecodeBatchRun(batch);
+            DecodeBatchSetDone(batch);
+        }
+        else if ((int)GetRCObject(rc) != rcTimeout)
+            break; /* sealed and empty */
+    }
+    return 0;
+}
+
+/* call on bamread thread only */
+static void DecodePoolStop(void)
+{
+    unsigned i;
+
+    if (decodeq == NULL)
+        return;
+    KQueueSeal(decodeq);
+    for (i = 0; i != decodeWorkers; ++i) {
+        KThreadWait(decodeWorker[i], NULL);
+        KThreadRelease(decodeWorker[i]);
+    }
+    free(decodeWorker);
+    decodeWorker = NULL;
+    decodeWorkers = 0;
+    KQueueRelease(decodeq);
+    decodeq = NULL;
+}
+
+/* call on bamread thread only; on failure records are decoded by ProcessBAM */
+static void DecodePoolStart(unsigned const threads)
+{
+    rc_t rc;
+
+    if (threads == 0 || decodeLock == NULL)
+        return;
+    decodeWorker = calloc(threads, sizeof(decodeWorker[0]));
+    if (decodeWorker == NULL)
+        return;
+    rc = KQueueMake(&decodeq, 4 * threads);
+    while (rc == 0 && decodeWorkers < threads) {
+        rc = KThreadMake(&decodeWorker[decodeWorkers], run_decode_thread, NULL);
+        if (rc == 0)
+            ++decodeWorkers;
+    }
+    if (rc) {
+        (void)LOGERR(klogWarn, rc, "failed to start record decoding threads; decoding on the main thread");
+        DecodePoolStop();
+        free(decodeWorker);
+        decodeWorker = NULL;
+    }
+}
+
+/* the lock outlives the bamread thread; ProcessBAM may still be releasing records */
+static rc_t DecodeLockMake(void)
+{
+    rc_t rc = KLockMake(&decodeLock);
+    if (rc == 0) {
+        rc = KConditionMake(&decodeDone);
+        if (rc) {
+            KLockRelease(decodeLock);
+            decodeLock = NULL;
+        }
+    }
+    return rc;
+}
+
+static void DecodeLockRelease(void)
+{
+    KConditionRelease(decodeDone);
+    decodeDone = NULL;
+    KLockRelease(decodeLock);
+    decodeLock = NULL;
+}
+
+/* waits for any decoding still running on the record */
+static void releaseRecord(BAM_Alignment const *const rec)
+{
+    DecodeBatch *const batch = rec->decoded ? rec->decoded->batch : NULL;
+
+    if (batch) {
+        bool last;
+
+        KLockAcquire(decodeLock);
+        while (!batch->done)
+            KConditionWait(decodeDone, decodeLock);
+        last = --batch->refs == 0;
+        KLockUnlock(decodeLock);
+
+        BAM_AlignmentRelease(rec);
+        if (last)
+            DecodeBatchWhack(batch);
+    }
+    else
+        BAM_AlignmentRelease(rec);
+}
+
 static rc_t BAM_FileReadDetached(BAM_File const *self, BAM_Alignment **rec)
 {
     BAM_Alignment const *crec = NULL;
@@ -1417,10 +1539,68 @@ static rc_t BAM_FileReadDetached(BAM_File const *self, BAM_Alignment **rec)
     return rc;
 }
 
+static rc_t pushRecord(BAM_Alignment *const rec)
+{
+    for ( ; ; ) {
+        timeout_t tm;
+        rc_t rc;
+
+        TimeoutInit(&tm, 1000);
+        rc = KQueuePush(bamq, rec, &tm);
+        if (rc == 0 || (int)GetRCObject(rc) != rcTimeout)
+            return rc;
+    }
+}
+
+/* hands the batch to the decoding threads and its records to bamq */
+static rc_t submitBatch(DecodeBatch *const batch)
+{
+    unsigned const count = batch->count;
+    unsigned i;
+    rc_t rc = 0;
+
+    batch->refs = count;
+    for (i = 0; i != count; ++i) {
+        batch->decoded[i].batch = batch;
+        batch->rec[i]->decoded = &batch->decoded[i];
+    }
+    for ( ; ; ) {
+        timeout_t tm;
+
+        TimeoutInit(&tm, 1000);
+        rc = KQueuePush(decodeq, batch, &tm);
+        if (rc == 0 || (int)GetRCObject(rc) != rcTimeout)
+            break;
+    }
+    if (rc) {
+        DecodeBatchRun(batch);
+        DecodeBatchSetDone(batch);
+    }
+    /* once the last record is pushed, batch belongs to ProcessBAM */
+    for (i = 0; i != count; ++i) {
+        BAM_Alignment *const rec = batch->rec[i];
+
+        rc = pushRecord(rec);
+        if (rc) {
+            /* ProcessBAM is gone; release what it will not see */
+            unsigned j;
+
+            for (j = i + 1; j < count; ++j)
+                releaseRecord(batch->rec[j]);
+            releaseRecord(rec);
+            break;
+        }
+    }
+    return rc;
+}
+
 static rc_t run_bamread_thread(const KThread *self, void *const file)
 {
     rc_t rc = 0;
     size_t NR = 0;
+    DecodeBatch *batch = NULL;
+
+    DecodePoolStart(G.decodeThreads);
 
     while (rc == 0) {
         BAM_Alignment *rec = NULL;
@@ -1451,14 +1631,35 @@ static rc_t run_bamread_thread(const KThread *self, void *const file)
             if (rc) break;
         }
 
-        for ( ; ; ) {
-            timeout_t tm;
-            TimeoutInit(&tm, 1000);
-            rc = KQueuePush(bamq, rec, &tm);
-            if (rc == 0 || (int)GetRCObject(rc) != rcTimeout)
+        rec->decoded = NULL;
+        if (decodeq == NULL) {
+            rc = pushRecord(rec);
+            if (rc)
+                BAM_AlignmentRelease(rec);
+            continue;
+        }
+        if (batch == NULL && (batch = DecodeBatchMake()) == NULL) {
+            rc = RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
+            BAM_AlignmentRelease(rec);
+            break;
+        }
+        batch->rec[batch->count++] = rec;
+        if (batch->count == DECODE_BATCH_SIZE) {
+            rc_t const rc2 = submitBatch(batch);
+            batch = NULL;
+            if (rc2) {
+                rc = rc2;
                 break;
+            }
         }
     }
+    if (batch) {
+        /* records read before EOF or an error still go to ProcessBAM */
+        rc_t const rc2 = submitBatch(batch);
+        if (rc == 0)
+            rc = rc2;
+    }
+    DecodePoolStop();
     KQueueSeal(bamq);
     if (rc) {
         (void)LOGERR(klogErr, rc, "bamread_thread done");
@@ -1473,6 +1674,8 @@ static rc_t run_bamread_thread(const KThread *self, void *const file)
 static BAM_Alignment const *getNextRecord(BAM_File const *const bam, rc_t *const rc)
 {
     if (bamq == NULL) {
+        if (G.decodeThreads > 0 && DecodeLockMake() != 0)
+            (void)LOGMSG(klogWarn, "failed to set up record decoding threads; decoding on the main thread");
         *rc = KQueueMake(&bamq, 4096);
         if (*rc) return NULL;
         *rc = KThreadMake(&bamread_thread, run_bamread_thread, (void *)bam);
@@ -1488,8 +1691,11 @@ static BAM_Alignment const *getNextRecord(BAM_File const *const bam, rc_t *const
 
         TimeoutInit(&tm, 10000);
         *rc = KQueuePop(bamq, (void **)&rec, &tm);
-        if (*rc == 0)
+        if (*rc == 0) {
+            if (rec->decoded)
+                DecodeBatchWait(rec->decoded->batch);
             return rec; /* this is the normal return */
+        }
 
         if ((int)GetRCObject(*rc) == rcTimeout)
             *rc = 0;
@@ -1510,6 +1716,7 @@ static BAM_Alignment const *getNextRecord(BAM_File const *const bam, rc_t *const
     bamread_thread = NULL;
 	KQueueRelease(bamq);
     bamq = NULL;
+    DecodeLockRelease();
     return NULL;
 }
 
@@ -1621,10 +1828,10 @@ static rc_t ProcessBAM(char const bamFile[], context_t *ctx, VDatabase *db,
         unsigned rgi;
         
         BAM_FileGetReadGroupCount(bam, &rgcount);
-        if (rgcount > (sizeof(ctx->keyToID.key2id)/sizeof(ctx->keyToID.key2id[0]) - 1))
+        if (rgcount > NUM_ID_SPACES - 1)
             ctx->keyToID.key2id_max = 1;
         else
-            ctx->keyToID.key2id_max = sizeof(ctx->keyToID.key2id)/sizeof(ctx->keyToID.key2id[0]);
+            ctx->keyToID.key2id_max = NUM_ID_SPACES;
 
         for (rgi = 0; rgi != rgcount; ++rgi) {
             BAMReadGroup const *rg;
@@ -1689,6 +1896,7 @@ static rc_t ProcessBAM(char const bamFile[], context_t *ctx, VDatabase *db,
         bool wasPromoted = false;
         char const *barCode = NULL;
         char const *linkageGroup;
+        DecodedRecord const *const decoded = (rec->decoded && rec->decoded->valid) ? rec->decoded : NULL;
 
         ++recordsRead;
         
@@ -1920,30 +2128,38 @@ MIXED_BASE_AND_COLOR:
             memset(seqDNA, 'N', (readlen | csSeqLen) + lpad + rpad);
             memset(qual, 0, (readlen | csSeqLen) + lpad + rpad);
 
-            BAM_AlignmentGetSequence(rec, seqDNA + lpad);
-            if (G.useQUAL) {
-                uint8_t const *squal;
-
-                BAM_AlignmentGetQuality(rec, &squal);
-                memmove(qual + lpad, squal, readlen);
+            if (decoded) {
+                memmove(seqDNA + lpad, decoded->seq, readlen);
+                memmove(qual + lpad, decoded->qual, readlen);
+                if (decoded->hadOQ)
+                    QUAL_CHANGED_OQ;
             }
             else {
-                uint8_t const *squal;
-                uint8_t qoffset = 0;
-                unsigned i;
+                BAM_AlignmentGetSequence(rec, seqDNA + lpad);
+                if (G.useQUAL) {
+                    uint8_t const *squal;
 
-                rc = BAM_AlignmentGetQuality2(rec, &squal, &qoffset);
-                if (rc) {
-                    (void)PLOGERR(klogErr, (klogErr, rc, "Spot '$(name)': length of original quality does not match sequence", "name=%s", name));
-                    goto LOOP_END;
+                    BAM_AlignmentGetQuality(rec, &squal);
+                    memmove(qual + lpad, squal, readlen);
                 }
-                if (qoffset) {
-                    for (i = 0; i != readlen; ++i)
-                        qual[i + lpad] = squal[i] - qoffset;
-                    QUAL_CHANGED_OQ;
+                else {
+                    uint8_t const *squal;
+                    uint8_t qoffset = 0;
+                    unsigned i;
+
+                    rc = BAM_AlignmentGetQuality2(rec, &squal, &qoffset);
+                    if (rc) {
+                        (void)PLOGERR(klogErr, (klogErr, rc, "Spot '$(name)': length of original quality does not match sequence", "name=%s", name));
+                        goto LOOP_END;
+                    }
+                    if (qoffset) {
+                        for (i = 0; i != readlen; ++i)
+                            qual[i + lpad] = squal[i] - qoffset;
+                        QUAL_CHANGED_OQ;
+                    }
+                    else
+                        memmove(qual + lpad, squal, readlen);
                 }
-                else
-                    memmove(qual + lpad, squal, readlen);
             }
             readlen = readlen + lpad + rpad;
             data.data.align_group.elements = 0;
@@ -1980,8 +2196,15 @@ MIXED_BASE_AND_COLOR:
 
         revcmp = (isColorSpace && !aligned) ? false : AR_REF_ORIENT(data);
         (void)PLOGMSG(klogDebug, (klogDebug, "Read '$(name)' is $(or) at $(ref):$(pos)", "name=%s,or=%s,ref=%s,pos=%i", name, revcmp ? "reverse" : "forward", refSeq ? refSeq->name : "(none)", rpos));
-        COPY_READ(seqBuffer.base, seqDNA, readlen, revcmp);
-        COPY_QUAL(qualBuffer.base, qual, readlen, revcmp);
+        if (decoded && decoded->readlen == readlen && decoded->reversed == revcmp) {
+            /* no clipping was added */
+            memmove(seqBuffer.base, decoded->oseq, readlen);
+            memmove(qualBuffer.base, decoded->oqual, readlen);
+        }
+        else {
+            COPY_READ(seqBuffer.base, seqDNA, readlen, revcmp);
+            COPY_QUAL(qualBuffer.base, qual, readlen, revcmp);
+        }
 
         AR_MAPQ(data) = GetMapQ(rec);
         if (!isPrimary && AR_MAPQ(data) < G.minMapQual)
@@ -2601,8 +2824,8 @@ WRITE_ALIGNMENT:
                 ++value->alignmentCount[readNo - 1];
             ++ctx->alignCount;
 
-            assert(keyId >> 32 < ctx->keyToID.key2id_count);
-            assert((uint32_t)keyId < ctx->keyToID.idCount[keyId >> 32]);
+            assert(keyId >> 32 < NUM_ID_SPACES);
+            assert((uint32_t)keyId < KeyToIDCount(&ctx->keyToID, keyId >> 32));
 
             if (linkageGroup[0] != '\0') {
                 AR_LINKAGE_GROUP(data).elements = strlen(linkageGroup);
@@ -2629,7 +2852,7 @@ WRITE_ALIGNMENT:
         /**************************************************************/
 
     LOOP_END:
-        BAM_AlignmentRelease(rec);
+        releaseRecord(rec);
         ++reccount;
         if (G.maxAlignCount > 0 && reccount >= G.maxAlignCount)
             break;
@@ -2648,12 +2871,13 @@ WRITE_ALIGNMENT:
             TimeoutInit(&tm, 1000);
             rc2 = KQueuePop(bamq, &rr, &tm);
             if (rc2) break;
-            BAM_AlignmentRelease((BAM_Alignment *)rr);
+            releaseRecord((BAM_Alignment *)rr);
         }
         KThreadWait(bamread_thread, NULL);
     }
     KThreadRelease(bamread_thread);
     KQueueRelease(bamq);
+    DecodeLockRelease();
     
     if (rc) {
         if (   (GetRCModule(rc) == rcCont && (int)GetRCObject(rc) == rcData && GetRCState(rc) == rcDone)
@@ -2714,13 +2938,15 @@ static rc_t WriteSoloFragments(context_t *ctx, Sequence *seq)
         (void)LOGERR(klogErr, rc, "KDataBufferMake failed");
         return rc;
     }
-    for (idCount = 0, j = 0; j < ctx->keyToID.key2id_count; ++j) {
-        idCount += ctx->keyToID.idCount[j];
+    for (idCount = 0, j = 0; j < NUM_ID_SPACES; ++j) {
+        idCount += KeyToIDCount(&ctx->keyToID, j);
     }
     KLoadProgressbar_Append(ctx->progress[ctx->pass - 1], idCount);
 
-    for (idCount = 0, j = 0; j < ctx->keyToID.key2id_count; ++j) {
-        for (i = 0; i != ctx->keyToID.idCount[j]; ++i, ++idCount) {
+    for (idCount = 0, j = 0; j < NUM_ID_SPACES; ++j) {
+        uint32_t const count = KeyToIDCount(&ctx->keyToID, j);
+
+        for (i = 0; i != count; ++i, ++idCount) {
             uint64_t const keyId = ((uint64_t)j << 32) | i;
             ctx_value_t *value;
             size_t rsize;
@@ -2880,8 +3106,8 @@ static rc_t AlignmentUpdateSpotInfo(context_t *ctx, Alignment *align)
                 rc = 0;
             break;
         }
-        assert(keyId >> 32 < ctx->keyToID.key2id_count);
-        assert((uint32_t)keyId < ctx->keyToID.idCount[keyId >> 32]);
+        assert(keyId >> 32 < NUM_ID_SPACES);
+        assert((uint32_t)keyId < KeyToIDCount(&ctx->keyToID, keyId >> 32));
         rc = MMArrayGet(ctx->id2value, (void **)&value, keyId);
         if (rc == 0) {
             int64_t const spotId = CTX_VALUE_GET_S_ID(*value);
@@ -2953,13 +3179,7 @@ static rc_t ArchiveBAM(VDBManager *mgr, VDatabase *db,
     }
     if (!continuing) {
 /*** No longer need memory for key2id ***/
-        for (i = 0; i != ctx->keyToID.key2id_count; ++i) {
-            KBTreeDropBacking(ctx->keyToID.key2id[i]);
-            KBTreeRelease(ctx->keyToID.key2id[i]);
-            ctx->keyToID.key2id[i] = NULL;
-        }
-        free(ctx->keyToID.key2id_names);
-        ctx->keyToID.key2id_names = NULL;
+        KeyToIDReleaseNames(&ctx->keyToID);
 /*******************/
     }
 
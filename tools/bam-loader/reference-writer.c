@@ -27,6 +27,9 @@
 #include <klib/rc.h>
 #include <klib/log.h>
 #include <kfs/file.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
+#include <kproc/thread.h>
 
 #include <kapp/main.h> /* for Quitting */
 
@@ -72,6 +75,260 @@ struct s_reference_info {
     unsigned lastOffset;
 };
 
+/* MARK: background coverage writer
+ *
+ * FlushBuffers hands every finished chunk, with copies of its per-base counts
+ * and the alignment ids collected for it, to a single writer thread that
+ * reduces the counts and writes the chunk's coverage row. VDB writes stay
+ * serial on that one thread, in the same order as before. All ReferenceMgr and
+ * ReferenceSeq calls made while the writer runs are serialized by mgrLock;
+ * everything else is only done with the writer idle (see CoverageWriterWait).
+ */
+#define COVERAGE_CHUNKS (16)    /* chunks queued ahead of the writer */
+
+typedef struct CoverageChunk {
+    ReferenceSeq const *rseq;
+    ReferenceSeqCoverage data;  /* overlaps filled in by FlushBuffers, the rest by the writer */
+    unsigned *counts;           /* coverage, mismatches, indels; count each */
+    unsigned count;
+    unsigned curPos;
+    KDataBuffer pri_align;
+    KDataBuffer sec_align;
+} CoverageChunk;
+
+struct CoverageWriter {
+    KLock *lock;
+    KCondition *changed;        /* broadcast whenever a chunk is queued or written */
+    KLock *mgrLock;
+    KThread *th;
+    CoverageChunk chunk[COVERAGE_CHUNKS];
+    uint64_t nextFill;          /* sequence number of the next chunk to queue */
+    uint64_t nextWrite;         /* sequence number of the next chunk to write */
+    bool failed;                /* a write failed, the chunks after it are dropped */
+    bool quit;
+};
+
+static void MgrLock(Reference const *const self)
+{
+    if (self->writer)
+        KLockAcquire(self->writer->mgrLock);
+}
+
+static void MgrUnlock(Reference const *const self)
+{
+    if (self->writer)
+        KLockUnlock(self->writer->mgrLock);
+}
+
+static rc_t WriteCoverage(ReferenceSeq const *const rseq, unsigned const curPos,
+                          ReferenceSeqCoverage *const data, unsigned const m,
+                          unsigned const cov[], unsigned const miss[], unsigned const indel[])
+{
+    unsigned i;
+    unsigned hi;
+    unsigned lo;
+    
+    for (hi = 0, lo = UINT_MAX, i = 0; i != m; ++i) {
+        unsigned const coverage = cov[i];
+        
+        if (hi < coverage)
+            hi = coverage;
+        if (lo > coverage)
+            lo = coverage;
+    }
+    data->low  = lo > 255 ? 255 : lo;
+    data->high = hi > 255 ? 255 : hi;
+    
+    for (i = 0; i != m; ++i)
+        data->mismatches += miss[i];
+
+    for (i = 0; i != m; ++i)
+        data->indels += indel[i];
+    
+    return ReferenceSeq_AddCoverage(rseq, curPos, data);
+}
+
+static rc_t CoverageChunkWrite(CoverageChunk *const chunk, KLock *const mgrLock)
+{
+    unsigned const m = chunk->count;
+    rc_t rc;
+    
+    chunk->data.ids[ewrefcov_primary_table].elements = chunk->pri_align.elem_count;
+    chunk->data.ids[ewrefcov_primary_table].buffer = chunk->pri_align.base;
+    chunk->data.ids[ewrefcov_secondary_table].elements = chunk->sec_align.elem_count;
+    chunk->data.ids[ewrefcov_secondary_table].buffer = chunk->sec_align.base;
+    
+    KLockAcquire(mgrLock);
+    rc = WriteCoverage(chunk->rseq, chunk->curPos, &chunk->data, m,
+                       chunk->counts, chunk->counts + m, chunk->counts + 2 * m);
+    KLockUnlock(mgrLock);
+    return rc;
+}
+
+static rc_t CoverageWriterMain(KThread const *const th, void *const vp)
+{
+    struct CoverageWriter *const self = vp;
+    
+    KLockAcquire(self->lock);
+    for ( ; ; ) {
+        CoverageChunk *chunk;
+        bool skip;
+        rc_t rc = 0;
+        
+        while (!self->quit && self->nextWrite == self->nextFill)
+            KConditionWait(self->changed, self->lock);
+        if (self->nextWrite == self->nextFill)
+            break; /* quitting and nothing is queued */
+        
+        chunk = &self->chunk[self->nextWrite % COVERAGE_CHUNKS];
+        skip = self->failed;
+        KLockUnlock(self->lock);
+        
+        if (!skip)
+            rc = CoverageChunkWrite(chunk, self->mgrLock);
+        KDataBufferResize(&chunk->pri_align, 0);
+        KDataBufferResize(&chunk->sec_align, 0);
+        
+        KLockAcquire(self->lock);
+        if (rc)
+            self->failed = true;
+        ++self->nextWrite;
+        KConditionBroadcast(self->changed);
+    }
+    KLockUnlock(self->lock);
+    return 0;
+}
+
+/* waits for every queued chunk to be written; true if any write failed */
+static bool CoverageWriterWait(Reference const *const self)
+{
+    struct CoverageWriter *const writer = self->writer;
+    bool failed = false;
+    
+    if (writer) {
+        KLockAcquire(writer->lock);
+        while (writer->nextWrite != writer->nextFill)
+            KConditionWait(writer->changed, writer->lock);
+        failed = writer->failed;
+        KLockUnlock(writer->lock);
+    }
+    return failed;
+}
+
+static bool CoverageWriterFailed(Reference const *const self)
+{
+    struct CoverageWriter *const writer = self->writer;
+    bool failed = false;
+    
+    if (writer) {
+        KLockAcquire(writer->lock);
+        failed = writer->failed;
+        KLockUnlock(writer->lock);
+    }
+    return failed;
+}
+
+/* blocks only while COVERAGE_CHUNKS chunks are already queued */
+static void CoverageWriterPush(Reference *const self, unsigned const curPos,
+                               ReferenceSeqCoverage const *const data, unsigned const m,
+                               unsigned const cov[], unsigned const miss[], unsigned const indel[])
+{
+    struct CoverageWriter *const writer = self->writer;
+    CoverageChunk *chunk;
+    
+    KLockAcquire(writer->lock);
+    while (writer->nextFill - writer->nextWrite == COVERAGE_CHUNKS)
+        KConditionWait(writer->changed, writer->lock);
+    chunk = &writer->chunk[writer->nextFill % COVERAGE_CHUNKS];
+    KLockUnlock(writer->lock);
+    
+    /* the chunk is ours until nextFill moves past it */
+    chunk->rseq = self->rseq;
+    chunk->data = *data;
+    chunk->count = m;
+    chunk->curPos = curPos;
+    memmove(chunk->counts, cov, m * sizeof(cov[0]));
+    memmove(chunk->counts + m, miss, m * sizeof(miss[0]));
+    memmove(chunk->counts + 2 * m, indel, m * sizeof(indel[0]));
+    {
+        /* trade the id lists for the chunk's empty ones */
+        KDataBuffer const pri = chunk->pri_align;
+        KDataBuffer const sec = chunk->sec_align;
+        
+        chunk->pri_align = self->pri_align;
+        chunk->sec_align = self->sec_align;
+        self->pri_align = pri;
+        self->sec_align = sec;
+    }
+    
+    KLockAcquire(writer->lock);
+    ++writer->nextFill;
+    KConditionBroadcast(writer->changed);
+    KLockUnlock(writer->lock);
+}
+
+static void CoverageWriterRelease(Reference *const self)
+{
+    struct CoverageWriter *const writer = self->writer;
+    unsigned i;
+    
+    if (writer == NULL)
+        return;
+    
+    if (writer->th) {
+        KLockAcquire(writer->lock);
+        writer->failed = true; /* anything still queued is not committed */
+        writer->quit = true;
+        KConditionBroadcast(writer->changed);
+        KLockUnlock(writer->lock);
+        
+        KThreadWait(writer->th, NULL);
+        KThreadRelease(writer->th);
+    }
+    for (i = 0; i < COVERAGE_CHUNKS; ++i) {
+        free(writer->chunk[i].counts);
+        KDataBufferWhack(&writer->chunk[i].pri_align);
+        KDataBufferWhack(&writer->chunk[i].sec_align);
+    }
+    KLockRelease(writer->mgrLock);
+    KConditionRelease(writer->changed);
+    KLockRelease(writer->lock);
+    free(writer);
+    self->writer = NULL;
+}
+
+static rc_t CoverageWriterMake(Reference *const self)
+{
+    struct CoverageWriter *const writer = calloc(1, sizeof(*writer));
+    rc_t rc;
+    unsigned i;
+    
+    if (writer == NULL)
+        return RC(rcApp, rcTable, rcConstructing, rcMemory, rcExhausted);
+    self->writer = writer;
+    
+    for (i = 0; i < COVERAGE_CHUNKS; ++i) {
+        writer->chunk[i].pri_align.elem_bits = writer->chunk[i].sec_align.elem_bits = 64;
+        writer->chunk[i].counts = malloc(3 * sizeof(writer->chunk[i].counts[0]) * G.maxSeqLen);
+        if (writer->chunk[i].counts == NULL) {
+            CoverageWriterRelease(self);
+            return RC(rcApp, rcTable, rcConstructing, rcMemory, rcExhausted);
+        }
+    }
+    rc = KLockMake(&writer->lock);
+    if (rc == 0)
+        rc = KConditionMake(&writer->changed);
+    if (rc == 0)
+        rc = KLockMake(&writer->mgrLock);
+    if (rc == 0)
+        rc = KThreadMake(&writer->th, CoverageWriterMain, writer);
+    if (rc)
+        CoverageWriterRelease(self);
+    return rc;
+}
+
+/* MARK: Reference */
+
 extern void ReferenceMgr_DumpConfig(ReferenceMgr const *const self);
 
 rc_t ReferenceInit(Reference *self, const VDBManager *mgr, VDatabase *db)
@@ -107,6 +364,8 @@ rc_t ReferenceInit(Reference *self, const VDBManager *mgr, VDatabase *db)
         }
 #endif
     }
+    if (rc == 0 && CoverageWriterMake(self) != 0)
+        (void)LOGMSG(klogWarn, "failed to start the coverage writer thread; writing coverage on the main thread");
     return rc;
 }
 
@@ -120,6 +379,7 @@ rc_t Unsorted(Reference *self) {
     /* do not ever change this message */
     (void)LOGMSG(klogWarn, "Alignments are unsorted");
 
+    CoverageWriterWait(self);
     self->out_of_order = true;
     
     ReferenceMgr_SetCache(self->mgr, UNSORTED_CACHE_SIZE, UNSORTED_OPEN_TABLE_LIMIT);
@@ -139,6 +399,8 @@ rc_t Unsorted(Reference *self) {
 
 static rc_t FlushBuffers(Reference *self, unsigned upto, bool full, bool final)
 {
+    if (!self->out_of_order && CoverageWriterFailed(self))
+        return Unsorted(self);
     if (!self->out_of_order && upto > 0) {
         unsigned offset = 0;
         unsigned *const miss = (unsigned *)self->mismatches.base;
@@ -154,51 +416,32 @@ static rc_t FlushBuffers(Reference *self, unsigned upto, bool full, bool final)
             unsigned const n = self->endPos > (curPos + G.maxSeqLen) ?
                                G.maxSeqLen : (self->endPos - curPos);
             unsigned const m = curPos + n > upto ? upto - curPos : n;
-            unsigned i;
-            unsigned hi;
-            unsigned lo;
             
             if (n == 0) break;
             
             memset(&data, 0, sizeof(data));
             
-            data.ids[ewrefcov_primary_table].elements = self->pri_align.elem_count;
-            data.ids[ewrefcov_primary_table].buffer = self->pri_align.base;
             data.overlap_ref_pos[ewrefcov_primary_table] = pri_overlap[chunk].min;
             data.overlap_ref_len[ewrefcov_primary_table] = pri_overlap[chunk].max ? pri_overlap[chunk].max - curPos : 0;
-            
-            data.ids[ewrefcov_secondary_table].elements = self->sec_align.elem_count;
-            data.ids[ewrefcov_secondary_table].buffer = self->sec_align.base;
             data.overlap_ref_pos[ewrefcov_secondary_table] = sec_overlap[chunk].min;
             data.overlap_ref_len[ewrefcov_secondary_table] = sec_overlap[chunk].max ? sec_overlap[chunk].max - curPos : 0;
             
-            for (hi = 0, lo = UINT_MAX, i = 0; i != m; ++i) {
-                unsigned const coverage = cov[offset + i];
-                
-                if (hi < coverage)
-                    hi = coverage;
-                if (lo > coverage)
-                    lo = coverage;
+            if (self->writer) {
+                /* hands the id lists over and leaves empty ones */
+                CoverageWriterPush(self, curPos, &data, m, cov + offset, miss + offset, indel + offset);
             }
-            data.low  = lo > 255 ? 255 : lo;
-            data.high = hi > 255 ? 255 : hi;
-            
-            for (i = 0; i != m; ++i)
-                data.mismatches += miss[offset + i];
-
-            for (i = 0; i != m; ++i)
-                data.indels += indel[offset + i];
-            
-            {
-                rc_t rc = ReferenceSeq_AddCoverage(self->rseq, curPos, &data);
+            else {
+                data.ids[ewrefcov_primary_table].elements = self->pri_align.elem_count;
+                data.ids[ewrefcov_primary_table].buffer = self->pri_align.base;
+                data.ids[ewrefcov_secondary_table].elements = self->sec_align.elem_count;
+                data.ids[ewrefcov_secondary_table].buffer = self->sec_align.base;
                 
-                if (rc) {
+                if (WriteCoverage(self->rseq, curPos, &data, m, cov + offset, miss + offset, indel + offset) != 0) {
                     return Unsorted(self);
                 }
+                KDataBufferResize(&self->pri_align, 0);
+                KDataBufferResize(&self->sec_align, 0);
             }
-            
-            KDataBufferResize(&self->pri_align, 0);
-            KDataBufferResize(&self->sec_align, 0);
             offset += n;
             ++chunk;
         }
@@ -337,6 +580,9 @@ rc_t ReferenceSetFile(Reference *const self, char const id[],
     }
 
     BAIL_ON_FAIL(FlushBuffers(self, self->length, true, true));
+    /* the previous reference's chunks are written before the manager is used again */
+    if (CoverageWriterWait(self) && !self->out_of_order)
+        BAIL_ON_FAIL(Unsorted(self));
     BAIL_ON_FAIL(ReferenceMgr_GetSeq(self->mgr, &rseq, id, shouldUnmap, G.allowMultiMapping, wasRenamed));
     
     self->rseq = rseq;
@@ -388,12 +634,22 @@ rc_t ReferenceVerify(Reference const *const self,
                      uint8_t const md5[16])
 {
     bool wasRenamed = false;
-    return ReferenceMgr_Verify(self->mgr, id, (unsigned)length, md5, G.allowMultiMapping, &wasRenamed);
+    rc_t rc;
+    
+    MgrLock(self);
+    rc = ReferenceMgr_Verify(self->mgr, id, (unsigned)length, md5, G.allowMultiMapping, &wasRenamed);
+    MgrUnlock(self);
+    return rc;
 }
 
 rc_t ReferenceGet1stRow(Reference const *self, int64_t *refID, char const refName[])
 {
-    return ReferenceMgr_Get1stRow(self->mgr, refID, refName);
+    rc_t rc;
+    
+    MgrLock(self);
+    rc = ReferenceMgr_Get1stRow(self->mgr, refID, refName);
+    MgrUnlock(self);
+    return rc;
 }
 
 static
@@ -516,16 +772,20 @@ rc_t ReferenceRead(Reference *self, AlignmentRecord *data, uint64_t const pos,
     unsigned nmis = 0;
     unsigned nmatch = 0;
     unsigned indels = 0;
+    rc_t rc;
        
     *matches = 0;
-    BAIL_ON_FAIL(ReferenceSeq_Compress(self->rseq,
-                                       (G.acceptHardClip ? ewrefmgr_co_AcceptHardClip : 0) + ewrefmgr_cmp_Binary,
-                                       (INSDC_coord_len)pos,
-                                       seqDNA, seqLen,
-                                       rawCigar, cigCount,
-                                       0, NULL, 0, 0, NULL, 0,
-                                       rna_orient,
-                                       &data->data));
+    MgrLock(self);
+    rc = ReferenceSeq_Compress(self->rseq,
+                               (G.acceptHardClip ? ewrefmgr_co_AcceptHardClip : 0) + ewrefmgr_cmp_Binary,
+                               (INSDC_coord_len)pos,
+                               seqDNA, seqLen,
+                               rawCigar, cigCount,
+                               0, NULL, 0, 0, NULL, 0,
+                               rna_orient,
+                               &data->data);
+    MgrUnlock(self);
+    BAIL_ON_FAIL(rc);
 
     GetCounts(data, seqLen, &nmatch, &nmis, &indels);
     *matches = nmatch;
@@ -580,9 +840,12 @@ rc_t ReferenceWhack(Reference *self, bool commit)
 #endif
         if (commit) {
             rc = FlushBuffers(self, self->length, true, true);
+            if (rc == 0 && CoverageWriterWait(self) && !self->out_of_order)
+                rc = Unsorted(self);
             if (rc != 0)
                 commit = false;
         }
+        CoverageWriterRelease(self);
         KDataBufferWhack(&self->sec_align);
         KDataBufferWhack(&self->pri_align);
         KDataBufferWhack(&self->mismatches);
@@ -42,6 +42,7 @@ typedef struct s_reference {
     unsigned endPos;
     unsigned length;
     unsigned last_id;            /* == ref_info.elem_count if no last id */
+    struct CoverageWriter *writer; /* NULL: coverage is written on the calling thread */
 
     KDataBuffer coverage;
     KDataBuffer mismatches;
@@ -30,10 +30,13 @@
 #include <klib/log.h>
 #include <sysalloc.h>
 
+#include <assert.h>
 #include <math.h>
-#include <ctype.h>
-#if _DEBUGGING
-#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define SAM_USE_SSE2 1
 #endif
 
 #include "bam-alignment.h"
@@ -67,87 +70,17 @@ static inline void bam_alignment_set_f32(uint8_t *const value, double newvalue)
     bam_alignment_set_u32(value, y.u);
 }
 
-static inline void bam_alignment_inc_u32(uint8_t *const value) {
-    bam_alignment_set_u32(value, bam_alignment_get_u32(value) + 1);
-}
-
-static inline void bam_alignment_inc_i32(uint8_t *const value) {
-    bam_alignment_set_i32(value, bam_alignment_get_i32(value) + 1);
-}
-
-static bool number_parser_is_unsigned(number_parser const *const self)
-{
-    return self->sgn >= 0;
-}
-
-static bool number_parser_is_integer(number_parser const *const self)
-{
-    return self->exponent - self->shift == 0;
-}
+/* MARK: numbers */
 
-static bool number_parser_is_u16(number_parser const *const self)
-{
-    return number_parser_is_integer(self)
-        && number_parser_is_unsigned(self)
-        && self->mantissa <= UINT16_MAX;
-}
-
-static bool number_parser_is_u32(number_parser const *const self)
-{
-    return number_parser_is_integer(self)
-        && number_parser_is_unsigned(self)
-        && self->mantissa <= UINT32_MAX;
-}
-
-static bool number_parser_get_exact_u16(number_parser const *const self, uint16_t *rslt)
-{
-    if (number_parser_is_u16(self)) {
-        *rslt = (uint16_t)self->mantissa;
-        return true;
-    }
-    return false;
-}
-
-#if 0
-static bool number_parser_get_exact_i16(number_parser const *const self, int16_t *rslt)
-{
-    if (number_parser_is_integer(self)) {
-        if (self->sgn < 0 && self->mantissa <= (uint64_t)(-INT16_MIN)) {
-            *rslt = -(int16_t)self->mantissa;
-            return true;
-        }
-        else if (self->mantissa <= INT16_MAX) {
-            *rslt = (int16_t)self->mantissa;
-            return true;
-        }
-    }
-    return false;
-}
-#endif
-
-static bool number_parser_get_exact_u32(number_parser const *const self, uint32_t *rslt)
-{
-    if (number_parser_is_u32(self)) {
-        *rslt = (uint32_t)self->mantissa;
-        return true;
-    }
-    return false;
-}
-
-static bool number_parser_get_exact_i32(number_parser const *const self, int32_t *rslt)
-{
-    if (self->exponent - self->shift == 0) {
-        if (self->sgn < 0 && self->mantissa <= (uint64_t)(-(int64_t)INT32_MIN)) {
-            *rslt = -(uint32_t)self->mantissa;
-            return true;
-        }
-        else if (self->mantissa <= INT32_MAX) {
-            *rslt = (uint32_t)self->mantissa;
-            return true;
-        }
-    }
-    return false;
-}
+typedef struct number_parser number_parser;
+struct number_parser {
+    uint64_t mantissa;
+    int32_t exponent;
+    signed sgn:2;
+    unsigned shift:6; /**< [0 - 19] **/
+    unsigned state:23;
+    unsigned ok:1;
+};
 
 static double number_parser_get(number_parser const *const self)
 {
@@ -156,50 +89,6 @@ static double number_parser_get(number_parser const *const self)
     return scale * self->mantissa;
 }
 
-static bool number_parser_set_exact_u16(number_parser const *const self, uint8_t *const dst)
-{
-    uint16_t value;
-    if (number_parser_get_exact_u16(self, &value)) {
-        bam_alignment_set_u16(dst, value);
-        return true;
-    }
-    return false;
-}
-
-#if 0
-static bool number_parser_set_exact_i16(number_parser const *const self, uint8_t *const dst)
-{
-    int16_t value;
-    if (number_parser_get_exact_i16(self, &value)) {
-        bam_alignment_set_i16(dst, value);
-        return true;
-    }
-    return false;
-}
-#endif
-
-#if 0
-static bool number_parser_set_exact_u32(number_parser const *const self, uint8_t *const dst)
-{
-    uint32_t value;
-    if (number_parser_get_exact_u32(self, &value)) {
-        bam_alignment_set_u32(dst, value);
-        return true;
-    }
-    return false;
-}
-#endif
-
-static bool number_parser_set_exact_i32(number_parser const *const self, uint8_t *const dst)
-{
-    int32_t value;
-    if (number_parser_get_exact_i32(self, &value)) {
-        bam_alignment_set_i32(dst, value);
-        return true;
-    }
-    return false;
-}
-
 static bool parse_integer(uint64_t *const value, int ch)
 {
     if (ch >= '1' && ch <= '9' && *value < (uint64_t)(UINT64_MAX / 10)) {
@@ -213,68 +102,6 @@ static bool parse_integer(uint64_t *const value, int ch)
     return false;
 }
 
-static int64_t packCIGAR(uint64_t length, int const opchar)
-{
-    if (length <= UINT32_MAX >> 4)
-        switch (opchar) {
-        case 'M': return (length << 4) | 0;
-        case 'I': return (length << 4) | 1;
-        case 'D': return (length << 4) | 2;
-        case 'N': return (length << 4) | 3;
-        case 'S': return (length << 4) | 4;
-        case 'H': return (length << 4) | 5;
-        case 'P': return (length << 4) | 6;
-        case '=': return (length << 4) | 7;
-        case 'X': return (length << 4) | 8;
-        }
-    return -1;
-}
-
-/* SAM spec says any unrecognized-but-otherwise-valid character gets mapped to N */
-static uint8_t translate_to_4nabin(int const ch)
-{
-    static uint8_t tr[] = {
-        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
-        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
-        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
-        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 0, 15, 15,
-        15, 1, 14, 2, 13, 15, 15, 4, 11, 15, 15, 12, 15, 3, 15, 15,
-        15, 15, 5, 6, 8, 15, 7, 9, 15, 10, 15, 15, 15, 15, 15, 15,
-        15, 1, 14, 2, 13, 15, 15, 4, 11, 15, 15, 12, 15, 3, 15, 15,
-        15, 15, 5, 6, 8, 15, 7, 9, 15, 10, 15, 15, 15, 15, 15, 15,
-    };
-    return (0 <= ch && ch < 128) ? tr[ch] : 15;
-}
-
-static bool parse_pos(SAM2BAM_Parser *const self, uint8_t *const fld, int ch, rc_t *rc)
-{
-    uint64_t value = bam_alignment_get_u32(fld);
-    if (ch >= 0) {
-        if (parse_integer(&value, ch)) {
-            if (value <= ((uint64_t)INT32_MAX) + 1) {
-                bam_alignment_set_u32(fld, value);
-                return true;
-            }
-            *rc = RC(rcAlign, rcFile, rcReading, rcData, rcTooBig);
-        }
-        else
-            *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-        return false;
-    }
-    bam_alignment_set_i32(fld, ((int32_t)value) - 1);
-    return true;
-}
-
-static bool parse_refname(SAM2BAM_Parser *const self, uint8_t *const fld, int ch, rc_t *rc)
-{
-    int32_t result;
-    if (!self->lookup(self->lookup_ctx, ch, &result, rc))
-        return false;
-    if (ch < 0)
-        bam_alignment_set_i32(fld, result);
-    return true;
-}
-
 static bool parse_numeric(number_parser *const self, int const ch)
 {
     switch (self->state) {
@@ -366,1059 +193,566 @@ static bool parse_numeric(number_parser *const self, int const ch)
     return false;
 }
 
-#define RESULT_FIELD(NAME) self->rslt->cooked.NAME
-
-#define PARSER_FUNCTION(NAME) parse_ ## NAME
-#define DEF_PARSER_FUNCTION_INLINE(NAME)                                        \
-static inline bool parse_ ## NAME ## _inline (  SAM2BAM_Parser *const self      \
-                                              , int ch, rc_t *const rc)
-#define DECL_PARSER_FUNCTION(NAME)                                              \
-static bool parse_ ## NAME (  SAM2BAM_Parser *const self, int const ch          \
-                            , rc_t *const rc, char const *data                  \
-                            , char const *const endp)
-
-#define DEF_PARSER_FUNCTION(NAME, NEXT)                                         \
-DECL_PARSER_FUNCTION(NAME)                                                      \
-{                                                                               \
-    char const *const value = data;                                             \
-    while ((void)(self->field_in_size = data < endp ? (data - value) + 1 : (endp - value)), parse_ ## NAME ## _inline (self, data < endp ? *data : ch, rc)) {    \
-        if (data < endp) { ++data; } else { return true; }                      \
-    }                                                                           \
-    (void)PLOGERR(klogErr, (klogErr, *rc, "Parsing SAM " # NAME ": $(value)",   \
-                                "value=%s", value));                            \
-    self->parser = PARSER_FUNCTION(NEXT);                                       \
-    return false;                                                               \
-}
-
-DECL_PARSER_FUNCTION(QNAME);
-DECL_PARSER_FUNCTION(FLAG);
-DECL_PARSER_FUNCTION(RNAME);
-DECL_PARSER_FUNCTION(POS);
-DECL_PARSER_FUNCTION(MAPQ);
-DECL_PARSER_FUNCTION(CIGAR);
-DECL_PARSER_FUNCTION(RNEXT);
-DECL_PARSER_FUNCTION(PNEXT);
-DECL_PARSER_FUNCTION(TLEN);
-DECL_PARSER_FUNCTION(SEQ);
-DECL_PARSER_FUNCTION(QUAL);
-DECL_PARSER_FUNCTION(EXTRA);
-DECL_PARSER_FUNCTION(EXTRA_A);
-DECL_PARSER_FUNCTION(EXTRA_i);
-DECL_PARSER_FUNCTION(EXTRA_f);
-DECL_PARSER_FUNCTION(EXTRA_H);
-DECL_PARSER_FUNCTION(EXTRA_Z);
-DECL_PARSER_FUNCTION(EXTRA_B);
-DECL_PARSER_FUNCTION(EXTRA_B_u);
-DECL_PARSER_FUNCTION(EXTRA_B_i);
-DECL_PARSER_FUNCTION(EXTRA_B_f);
-
-static bool parse_refname(SAM2BAM_Parser *const self, uint8_t *const fld, int ch, rc_t *rc);
-static bool parse_pos(SAM2BAM_Parser *const self, uint8_t *const fld, int ch, rc_t *rc);
-
-static bool SAM2BAM_Parser_grow(SAM2BAM_Parser *const self, rc_t *rc);
-
-static size_t check_size(SAM2BAM_Parser *const self, size_t const more, rc_t *const rc)
-{
-    size_t const current = self->rslt_size;
-    size_t const need = current + more;
-    if (need > self->max_size && !SAM2BAM_Parser_grow(self, rc))
-        return 0;
-    self->field_out_size += more;
-    self->rslt_size = need;
-    return current;
-}
-
-DEF_PARSER_FUNCTION_INLINE(QNAME)
-{
-    switch (self->state) {
-    case -1:
-        if (ch < 0)
-            goto DONE;
-        else {
-            self->state = 1;
-            if (!parse_QNAME(self, '*', rc, 0, 0))
-                return false;
-            return parse_QNAME(self, ch, rc, 0, 0);
-        }
-        break;
-    case 0:
-        if (ch == '*') {
-            self->state = -1;
-            return true;
-        }
-        self->state += 1;
-        /* fallthrough */
-    case 1:
-        if (ch < 0 || (ch >= '!' && ch <= '~' && ch != '@')) {
-            if (self->field_out_size < 255) {
-                size_t current;
-                if ((current = check_size(self, 1, rc)) > 0) {
-                    if (ch >= 0) {
-                        self->rslt->raw[current] = ch;
-                        return true;
-                    }
-                    self->rslt->raw[current] = '\0';
-                DONE:
-                    RESULT_FIELD(read_name_len) = self->field_out_size;
-                    self->parser = PARSER_FUNCTION(FLAG);
-                    return true;
-                }
-                return false;
-            }
-            *rc = RC(rcAlign, rcFile, rcReading, rcData, rcTooBig);
-            return false;
-        }
-        break;
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
-
-DEF_PARSER_FUNCTION(QNAME, FLAG)
-
-DEF_PARSER_FUNCTION_INLINE(FLAG)
+/* [-+]?[0-9]+ in the range [min, max] */
+static bool decode_integer(char const *cur, char const *const endp, int64_t const min, int64_t const max, int64_t *const rslt)
 {
-    switch (self->state) {
-    case 0:
-        self->state += 1;
-        self->numeric.state = 0;
-        /* fallthrough */
-    case 1:
-        if (ch >= 0) {
-            if (parse_numeric(&self->numeric, ch))
-                return true;
-            break;
-        }
-        if (self->numeric.ok && number_parser_set_exact_u16(&self->numeric, RESULT_FIELD(flags))) {
-            self->parser = PARSER_FUNCTION(RNAME);
-            return true;
-        }
-        break;
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
-
-DEF_PARSER_FUNCTION(FLAG, RNAME)
+    uint64_t value = 0;
+    bool negative = false;
 
-DEF_PARSER_FUNCTION_INLINE(RNAME)
-{
-    switch (self->state) {
-    case -1:
-        if (ch < 0)
-            goto DONE;
-        *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
+    if (cur < endp && (*cur == '-' || *cur == '+'))
+        negative = *cur++ == '-';
+    if (cur == endp)
         return false;
-    case 0:
-        if (ch == '*') {
-            /* set to -1 */
-            bam_alignment_set_i32(RESULT_FIELD(rID), -1);
-            self->state = -1;
-            return true;
-        }
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (!parse_refname(self, RESULT_FIELD(rID), ch, rc))
+    do {
+        unsigned const digit = (unsigned)(*cur - '0');
+        if (digit > 9 || value >= (uint64_t)(INT64_MAX / 10))
             return false;
-        if (ch < 0) {
-        DONE:
-            self->parser = PARSER_FUNCTION(POS);
-        }
-        return true;
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+        value = value * 10 + digit;
+    } while (++cur < endp);
+    *rslt = negative ? -(int64_t)value : (int64_t)value;
+    return min <= *rslt && *rslt <= max;
 }
 
-DEF_PARSER_FUNCTION(RNAME, POS)
-
-DEF_PARSER_FUNCTION_INLINE(POS)
+/* anything parse_numeric accepts */
+static bool decode_float(char const *cur, char const *const endp, double *const rslt)
 {
-    switch (self->state) {
-    case 0:
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (!parse_pos(self, RESULT_FIELD(pos), ch, rc))
+    number_parser numeric;
+
+    numeric.state = 0;
+    numeric.ok = 0;
+    for ( ; cur < endp; ++cur) {
+        if (!parse_numeric(&numeric, *cur))
             return false;
-        if (ch < 0)
-            self->parser = PARSER_FUNCTION(MAPQ);
-        return true;
     }
-    abort();
+    if (!numeric.ok)
+        return false;
+    *rslt = number_parser_get(&numeric);
+    return true;
 }
 
-DEF_PARSER_FUNCTION(POS, MAPQ)
-
-DEF_PARSER_FUNCTION_INLINE(MAPQ)
+static int64_t packCIGAR(uint64_t length, int const opchar)
 {
-    switch (self->state) {
-    case 0:
-        RESULT_FIELD(mapQual) = 0;
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (ch >= 0) {
-            uint64_t value = RESULT_FIELD(mapQual);
-            if (parse_integer(&value, ch)) {
-                if (value <= UINT8_MAX) {
-                    RESULT_FIELD(mapQual) = (uint8_t)value;
-                    return true;
-                }
-            }
-        }
-        else {
-            self->parser = PARSER_FUNCTION(CIGAR);
-            return true;
+    if (length <= UINT32_MAX >> 4)
+        switch (opchar) {
+        case 'M': return (length << 4) | 0;
+        case 'I': return (length << 4) | 1;
+        case 'D': return (length << 4) | 2;
+        case 'N': return (length << 4) | 3;
+        case 'S': return (length << 4) | 4;
+        case 'H': return (length << 4) | 5;
+        case 'P': return (length << 4) | 6;
+        case '=': return (length << 4) | 7;
+        case 'X': return (length << 4) | 8;
         }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    return -1;
 }
 
-DEF_PARSER_FUNCTION(MAPQ, CIGAR)
-
-DEF_PARSER_FUNCTION_INLINE(CIGAR)
-{
-    /* parse \*|([0-9]+[MIDNSHP=X])+ */
-    switch (self->state) {
-    case -1:
-        if (ch < 0)
-            goto DONE;
-        break;
-    case 0:
-        if (ch == '*') {
-            self->state = -1;
-            return true;
-        }
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (ch < 0)
-        DONE:
-        {
-            size_t const n_cigars = self->field_out_size / 4;
-            assert(self->field_out_size % 4 == 0);
-            if (n_cigars < UINT16_MAX) {
-                bam_alignment_set_u16(RESULT_FIELD(n_cigars), (uint16_t)n_cigars);
-                self->parser = PARSER_FUNCTION(RNEXT);
-                return true;
-            }
-            break;
-        }
-        self->numeric.state = 0;
-        self->state += 1;
-        /* fallthrough */
-    case 2:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        else {
-            int64_t value;
-            if (   self->numeric.ok
-                && number_parser_is_integer(&self->numeric)
-                && number_parser_is_unsigned(&self->numeric)
-                && ((value = packCIGAR(self->numeric.mantissa, ch)) >= 0)
-                )
-            {
-                size_t offset = check_size(self, 4, rc);
-                if (offset > 0) {
-                    bam_alignment_set_u32(&self->rslt->raw[offset], (uint32_t)value);
-                    self->state = 1;
-                    return true;
-                }
-                return false;
-            }
-        }
+/* SAM spec says any unrecognized-but-otherwise-valid character gets mapped to N;
+ * characters that are not valid in SEQ map to 16
+ */
+static uint8_t const seq_to_4nabin[256] = {
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 15, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,  0, 16, 16,
+    16,  1, 14,  2, 13, 15, 15,  4, 11, 15, 15, 12, 15,  3, 15, 15,
+    15, 15,  5,  6,  8, 15,  7,  9, 15, 10, 15, 16, 16, 16, 16, 16,
+    16,  1, 14,  2, 13, 15, 15,  4, 11, 15, 15, 12, 15,  3, 15, 15,
+    15, 15,  5,  6,  8, 15,  7,  9, 15, 10, 15, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+};
+
+/* MARK: tokenizer */
+
+char const *SAM_FindByte(char const *data, char const *const endp, int const ch)
+{
+#if SAM_USE_SSE2
+    __m128i const pattern = _mm_set1_epi8((char)ch);
+
+    while (endp - data >= 16) {
+        __m128i const chunk = _mm_loadu_si128((__m128i const *)data);
+        int const mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern));
+
+        if (mask != 0)
+            return data + __builtin_ctz(mask);
+        data += 16;
     }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
-
-DEF_PARSER_FUNCTION(CIGAR, RNEXT)
-
-DEF_PARSER_FUNCTION_INLINE(RNEXT)
-{
-    switch (self->state) {
-    case -1:
-        if (ch < 0)
-            goto DONE;
-        *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-        return false;
-    case 0:
-        if (ch == '*') {
-            /* set to -1 */
-            bam_alignment_set_i32(RESULT_FIELD(mate_rID), -1);
-            self->state = -1;
-            return true;
-        }
-        if (ch == '=') {
-            /* copy the value from RNAME */
-            bam_alignment_set_i32(RESULT_FIELD(mate_rID), bam_alignment_get_i32(RESULT_FIELD(rID)));
-            self->state = -1;
-            return true;
-        }
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (!parse_refname(self, RESULT_FIELD(mate_rID), ch, rc))
-            return false;
-        if (ch < 0) {
-        DONE:
-            self->parser = PARSER_FUNCTION(PNEXT);
-        }
-        return true;
+#endif
+    {
+        void const *const fnd = memchr(data, ch, endp - data);
+        return fnd != NULL ? (char const *)fnd : endp;
     }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
 }
 
-DEF_PARSER_FUNCTION(RNEXT, PNEXT)
+typedef struct SAMField {
+    char const *value;
+    char const *endp;
+} SAMField;
 
-DEF_PARSER_FUNCTION_INLINE(PNEXT)
+static bool SAMField_Is(SAMField const *const self, int const ch)
 {
-    switch (self->state) {
-    case 0:
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (!parse_pos(self, RESULT_FIELD(mate_pos), ch, rc))
-            return false;
-        if (ch < 0)
-            self->parser = PARSER_FUNCTION(TLEN);
-        return true;
-    }
-    abort(); /**< unreachable **/
+    return self->endp - self->value == 1 && self->value[0] == ch;
 }
 
-DEF_PARSER_FUNCTION(PNEXT, TLEN)
-
-DEF_PARSER_FUNCTION_INLINE(TLEN)
+static rc_t SAMFieldError(SAMField const *const fld, char const name[], rc_t const rc)
 {
-    switch (self->state) {
-    case 0:
-        self->numeric.state = 0;
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        if (ch < 0 && self->numeric.ok && number_parser_set_exact_i32(&self->numeric, RESULT_FIELD(ins_size))) {
-            self->parser = PARSER_FUNCTION(SEQ);
-            return true;
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    (void)PLOGERR(klogErr, (klogErr, rc, "Parsing SAM $(field): $(value)", "field=%s,value=%.*s",
+                            name, (int)(fld->endp - fld->value), fld->value));
+    return rc;
 }
 
-DEF_PARSER_FUNCTION(TLEN, SEQ)
+#define FIELD_INVALID(FLD, NAME) SAMFieldError(FLD, NAME, RC(rcAlign, rcFile, rcReading, rcData, rcInvalid))
+#define FIELD_TOO_BIG(FLD, NAME) SAMFieldError(FLD, NAME, RC(rcAlign, rcFile, rcReading, rcData, rcTooBig))
+
+/* MARK: output buffer */
 
-DEF_PARSER_FUNCTION_INLINE(SEQ)
+rc_t SAM2BAM_OutputReserve(SAM2BAM_Output *const self, size_t const more)
 {
-    switch (self->state) {
-    case -1:
-        if (ch < 0) {
-            assert(self->field_out_size == 0);
-            goto DONE;
-        }
-        break;
-    case 0:
-        if (ch == '*') {
-            self->state = -1;
-            return true;
-        }
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (ch >= 0) {
-            if (   (ch >= 'A' && ch <= 'Z')
-                || (ch >= 'a' && ch <= 'z')
-                ||  ch == '=' || ch == '.')
-            {
-                int const basebin = translate_to_4nabin(ch);
-                if (self->field_in_size % 2 == 0) {
-                    size_t const current = check_size(self, 0, rc);
-                    self->rslt->raw[current - 1] |= (uint8_t)(basebin);
-                    return true;
-                }
-                else {
-                    size_t const current = check_size(self, 1, rc);
-                    if (current > 0) {
-                        self->rslt->raw[current] = (uint8_t)(basebin << 4);
-                        return true;
-                    }
-                    return false;
-                }
-            }
-        }
-        else if (self->field_in_size <= UINT32_MAX)
-    DONE:
-        {
-            assert(self->field_out_size == 0 || (self->field_in_size + 1) >> 1 == self->field_out_size);
-            bam_alignment_set_u32(RESULT_FIELD(read_len), self->field_out_size == 0 ? 0 : (uint32_t)self->field_in_size);
-            self->parser = PARSER_FUNCTION(QUAL);
-            return true;
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
+    size_t const need = self->used + more;
+    size_t size = self->size > 0 ? self->size : 64 * 1024;
+    void *tmp;
 
-DEF_PARSER_FUNCTION(SEQ, QUAL)
+    if (need <= self->size)
+        return 0;
+    while (size < need)
+        size *= 2;
+    if (self->base == NULL || (void *)self->base != self->static_buffer)
+        tmp = realloc(self->base, size);
+    else if ((tmp = malloc(size)) != NULL)
+        memmove(tmp, self->base, self->used);
+    if (tmp == NULL)
+        return RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
+    self->base = tmp;
+    self->size = size;
+    return 0;
+}
 
-DEF_PARSER_FUNCTION_INLINE(QUAL)
+void SAM2BAM_OutputWhack(SAM2BAM_Output *const self)
 {
-    size_t const readlen = bam_alignment_get_u32(RESULT_FIELD(read_len));
-    switch (self->state) {
-    case -1:
-        if (ch < 0) {
-            size_t const current = check_size(self, readlen, rc);
-            if (current == 0)
-                return false;
-            if (readlen > 0)
-                memset(&self->rslt->raw[current], -1, readlen);
-            goto DONE;
-        }
-        else {
-            self->state = 1;
-            if (!parse_QUAL(self, '*', rc, 0, 0))
-                return false;
-            return parse_QUAL(self, ch, rc, 0, 0);
-        }
-        break;
-    case 0:
-        if (ch == '*') {
-            self->state = -1;
-            return true;
-        }
-        self->state = 1;
-        /* fallthrough */
-    case 1:
-        if (ch >= '!' && ch <= '~' && self->field_in_size <= readlen) {
-            size_t const current = check_size(self, 1, rc);
-            if (current > 0) {
-                self->rslt->raw[current] = (uint32_t)(ch - 33);
-                return true;
-            }
-            return false;
-        }
-        if (ch < 0) {
-        DONE:
-            if (self->field_out_size == readlen) {
-                self->parser = PARSER_FUNCTION(EXTRA);
-                return true;
-            }
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    if ((void *)self->base != self->static_buffer)
+        free(self->base);
+    self->base = NULL;
+    self->size = self->used = 0;
 }
 
-DEF_PARSER_FUNCTION(QUAL, EXTRA)
+/* MARK: SAM to BAM conversion */
 
-DEF_PARSER_FUNCTION_INLINE(EXTRA)
+static rc_t parse_QNAME(uint8_t *const dst, size_t *const used, SAMField const *const fld)
 {
-    size_t current;
-    switch (self->state) {
-    case 0:
-        if (ch < 0) return true;
-        if (((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z')))
-            goto COPY_IN;
-        break;
-    case 1:
-        if (((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' || ch <= '9'))) {
-        COPY_IN:
-            if ((current = check_size(self, 1, rc)) > 0) {
-                self->rslt->raw[current] = ch;
-                ++self->state;
-                return true;
-            }
-            return false;
-        }
-        break;
-    case 2:
-        if (ch == ':') {
-            ++self->state;
-            return true;
-        }
-        break;
-    case 3:
-        if ((current = check_size(self, 1, rc)) > 0) {
-            self->state = 1;
-            self->rslt->raw[current] = ch;
-            switch (ch) {
-            case 'A':
-                self->parser = PARSER_FUNCTION(EXTRA_A);
-                return true;
-            case 'i':
-                self->parser = PARSER_FUNCTION(EXTRA_i);
-                return true;
-            case 'f':
-                self->parser = PARSER_FUNCTION(EXTRA_f);
-                return true;
-            case 'Z':
-                self->parser = PARSER_FUNCTION(EXTRA_Z);
-                return true;
-            case 'H':
-                self->parser = PARSER_FUNCTION(EXTRA_H);
-                return true;
-            case 'B':
-                self->parser = PARSER_FUNCTION(EXTRA_B);
-                return true;
-            }
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
+    size_t const len = fld->endp - fld->value;
+    unsigned bad = 0;
+    size_t i;
 
-DECL_PARSER_FUNCTION(EXTRA)
-{
-    if (data == NULL)
-        return parse_EXTRA_inline(self, ch, rc);
-    while (data < endp) {
-        char const *const value = data;
-        if (parse_EXTRA_inline(self, *data, rc)) {
-            ++data;
-            if (self->parser == PARSER_FUNCTION(EXTRA))
-                continue;
-            return self->parser(self, ch, rc, data, endp);
-        }
-        (void)PLOGERR(klogErr, (klogErr, *rc, "Parsing SAM EXTRA: $(value)", "value=%s", value));
-        self->parser = PARSER_FUNCTION(EXTRA);
-        return false;
+    if (len >= 255)
+        return FIELD_TOO_BIG(fld, "QNAME");
+    for (i = 0; i < len; ++i) {
+        int const ch = fld->value[i];
+        bad |= (ch < '!') | (ch > '~') | (ch == '@');
+        dst[i] = ch;
     }
-    return true;
+    if (bad)
+        return FIELD_INVALID(fld, "QNAME");
+    dst[len] = '\0';
+    *used = len + 1;
+    return 0;
 }
 
-DEF_PARSER_FUNCTION_INLINE(EXTRA_A)
+static rc_t parse_REF(uint8_t *const dst, SAMField const *const fld, char const name[],
+                      RefNameLookupFunction lookup, RefNameLookupContext *lookup_ctx)
 {
-    switch (self->state) {
-    case 1:
-        if (ch == ':') {
-            ++self->state;
-            return true;
-        }
-        break;
-    case 2:
-        if (ch >= '!' && ch <= '~') {
-            size_t current;
-            if ((current = check_size(self, 1, rc)) > 0) {
-                self->rslt->raw[current] = ch;
-                ++self->state;
-                return true;
-            }
-            return false;
-        }
-        break;
-    case 3:
-        if (ch < 0) {
-            self->parser = PARSER_FUNCTION(EXTRA);
-            return true;
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
-
-DEF_PARSER_FUNCTION(EXTRA_A, EXTRA)
+    int32_t result = -1;
 
-DEF_PARSER_FUNCTION_INLINE(EXTRA_i)
-{
-    switch (self->state) {
-    case 1:
-        if (ch == ':') {
-            ++self->state;
-            self->numeric.state = 0;
-            return true;
-        }
-        break;
-    case 2:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        else if (ch < 0 && self->numeric.ok) {
-            int32_t value;
-            if (number_parser_get_exact_i32(&self->numeric, &value)) {
-                size_t const cp = check_size(self, 4, rc);
-                if (cp > 0) {
-                    bam_alignment_set_i32(&self->rslt->raw[cp], value);
-                    self->parser = PARSER_FUNCTION(EXTRA);
-                    return true;
-                }
-                return false;
-            }
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    if (!SAMField_Is(fld, '*') && !lookup(lookup_ctx, fld->value, fld->endp - fld->value, &result))
+        return FIELD_INVALID(fld, name);
+    bam_alignment_set_i32(dst, result);
+    return 0;
 }
 
-DEF_PARSER_FUNCTION(EXTRA_i, EXTRA)
-
-DEF_PARSER_FUNCTION_INLINE(EXTRA_f)
+/* an empty POS reads as 0 */
+static rc_t parse_POS(uint8_t *const dst, SAMField const *const fld, char const name[])
 {
-    switch (self->state) {
-    case 1:
-        if (ch == ':') {
-            ++self->state;
-            self->numeric.state = 0;
-            return true;
-        }
-        break;
-    case 2:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        else if (ch < 0 && self->numeric.ok) {
-            size_t const cp = check_size(self, 4, rc);
-            if (cp > 0) {
-                bam_alignment_set_f32(&self->rslt->raw[cp], number_parser_get(&self->numeric));
-                self->parser = PARSER_FUNCTION(EXTRA);
-                return true;
-            }
-            return false;
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
-
-DEF_PARSER_FUNCTION(EXTRA_f, EXTRA)
+    int64_t value = 0;
 
-DEF_PARSER_FUNCTION_INLINE(EXTRA_H)
-{
-    switch (self->state) {
-    case 1:
-        if (ch == ':') {
-            self->state = 2;
-            return true;
-        }
-        break;
-    case 2: /**< an even number of chars **/
-        if (ch < 0) {
-            size_t const cp = check_size(self, 1, rc);
-            if (cp > 0) {
-                self->rslt->raw[cp] = '\0';
-                self->parser = PARSER_FUNCTION(EXTRA);
-                return true;
-            }
-            return false;
-        }
-        /* fallthrough */
-    case 3:
-        if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'F')) {
-            size_t const cp = check_size(self, 1, rc);
-            if (cp > 0) {
-                self->rslt->raw[cp] = ch;
-                self->state = 3 - (self->state - 2); /* state toggles between 2 and 3 */
-                return true;
-            }
-            return false;
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    if (fld->value != fld->endp && !decode_integer(fld->value, fld->endp, 0, ((int64_t)INT32_MAX) + 1, &value))
+        return FIELD_INVALID(fld, name);
+    bam_alignment_set_i32(dst, (int32_t)(value - 1));
+    return 0;
 }
 
-DEF_PARSER_FUNCTION(EXTRA_H, EXTRA)
-
-DEF_PARSER_FUNCTION_INLINE(EXTRA_Z)
+static rc_t parse_CIGAR(uint8_t *const dst, size_t *const used, unsigned *const n_cigars, SAMField const *const fld)
 {
-    switch (self->state) {
-    case 1:
-        if (ch == ':') {
-            ++self->state;
-            return true;
-        }
-        break;
-    case 2:
-        if ((ch >= '!' && ch <= '~') || ch == ' ') {
-            size_t const cp = check_size(self, 1, rc);
-            if (cp > 0) {
-                self->rslt->raw[cp] = ch;
-                return true;
-            }
-            return false;
-        }
-        if (ch < 0) {
-            size_t const cp = check_size(self, 1, rc);
-            if (cp > 0) {
-                self->rslt->raw[cp] = '\0';
-                self->parser = PARSER_FUNCTION(EXTRA);
-                return true;
-            }
-            return false;
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
+    char const *cur = fld->value;
+    unsigned n = 0;
 
-DEF_PARSER_FUNCTION(EXTRA_Z, EXTRA)
+    if (!SAMField_Is(fld, '*')) {
+        while (cur < fld->endp) {
+            uint64_t length = 0;
+            int64_t op;
+            char const *const start = cur;
 
-DEF_PARSER_FUNCTION_INLINE(EXTRA_B)
-{
-    switch (self->state) {
-    case 1:
-        if (ch == ':') {
-            ++self->state;
-            return true;
-        }
-        break;
-    case 2:
-        {
-            size_t const cp = check_size(self, 5, rc);
-            if (cp == 0)
-                return false;
-            self->extraArrayCountPos = cp + 1;
-            bam_alignment_set_i32(&self->rslt->raw[self->extraArrayCountPos], 0);
-            self->state = 1;
-            switch (ch) {
-            case 'C':
-            case 'I':
-            case 'S':
-                self->rslt->raw[cp] = 'I';
-                self->parser = PARSER_FUNCTION(EXTRA_B_u);
-                return true;
-            case 'c':
-            case 'i':
-            case 's':
-                self->rslt->raw[cp] = 'i';
-                self->parser = PARSER_FUNCTION(EXTRA_B_i);
-                return true;
-            case 'f':
-                self->rslt->raw[cp] = 'f';
-                self->parser = PARSER_FUNCTION(EXTRA_B_f);
-                return true;
-            }
+            while (cur < fld->endp && parse_integer(&length, *cur))
+                ++cur;
+            if (cur == start || cur == fld->endp || (op = packCIGAR(length, *cur)) < 0)
+                return FIELD_INVALID(fld, "CIGAR");
+            ++cur;
+            if (n + 1 >= UINT16_MAX)
+                return FIELD_TOO_BIG(fld, "CIGAR");
+            bam_alignment_set_u32(&dst[4 * n], (uint32_t)op);
+            ++n;
         }
     }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    *n_cigars = n;
+    *used = 4 * n;
+    return 0;
 }
 
-DECL_PARSER_FUNCTION(EXTRA_B)
+static rc_t parse_SEQ(uint8_t *const dst, size_t *const used, uint32_t *const readlen, SAMField const *const fld)
 {
-    if (data == NULL)
-        return parse_EXTRA_B_inline(self, ch, rc);
-    while (data < endp) {
-        char const *const value = data;
-        if (parse_EXTRA_B_inline(self, *data, rc)) {
-            ++data;
-            if (self->parser == PARSER_FUNCTION(EXTRA_B))
-                continue;
-            return self->parser(self, ch, rc, data, endp);
-        }
-        (void)PLOGERR(klogErr, (klogErr, *rc, "Parsing SAM EXTRA_B: $(value)", "value=%s", value));
-        self->parser = PARSER_FUNCTION(EXTRA);
-        return false;
-    }
-    return true;
-}
+    uint8_t const *const seq = (uint8_t const *)fld->value;
+    size_t const len = fld->endp - fld->value;
+    unsigned bad = 0;
+    size_t i;
 
-DEF_PARSER_FUNCTION_INLINE(EXTRA_B_u)
-{
-    switch (self->state) {
-    case 1:
-        if (ch < 0)
-            goto DONE;
-        if (ch == ',') {
-            self->state = 2;
-            return true;
-        }
-        break;
-    case 2:
-        self->numeric.state = 0;
-        if (parse_numeric(&self->numeric, ch)) {
-            self->state = 3;
-            return true;
-        }
-        break;
-    case 3:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        if ((ch < 0 || ch == ',') && self->numeric.ok) {
-            uint32_t value;
-            if (number_parser_get_exact_u32(&self->numeric, &value)) {
-                size_t const cp = check_size(self, 4, rc);
-                if (cp > 0) {
-                    bam_alignment_set_u32(&self->rslt->raw[cp], value);
-                    bam_alignment_inc_i32(&self->rslt->raw[self->extraArrayCountPos]);
-
-                    if (ch == ',')
-                        self->state = 2;
-                    else {
-                    DONE:
-                        self->parser = PARSER_FUNCTION(EXTRA);
-                    }
-                    return true;
-                }
-                return false;
-            }
-        }
+    if (SAMField_Is(fld, '*')) {
+        *readlen = 0;
+        *used = 0;
+        return 0;
     }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    if (len == 0)
+        return FIELD_INVALID(fld, "SEQ");
+    if (len > UINT32_MAX)
+        return FIELD_TOO_BIG(fld, "SEQ");
+    /* two bases per output byte */
+    for (i = 0; i + 1 < len; i += 2) {
+        unsigned const hi = seq_to_4nabin[seq[i + 0]];
+        unsigned const lo = seq_to_4nabin[seq[i + 1]];
+        bad |= hi | lo;
+        dst[i >> 1] = (uint8_t)((hi << 4) | (lo & 15));
+    }
+    if (i < len) {
+        unsigned const hi = seq_to_4nabin[seq[i]];
+        bad |= hi;
+        dst[i >> 1] = (uint8_t)(hi << 4);
+    }
+    if (bad & 16)
+        return FIELD_INVALID(fld, "SEQ");
+    *readlen = (uint32_t)len;
+    *used = (len + 1) >> 1;
+    return 0;
+}
+
+static rc_t parse_QUAL(uint8_t *const dst, uint32_t const readlen, SAMField const *const fld)
+{
+    uint8_t const *const qual = (uint8_t const *)fld->value;
+    size_t const len = fld->endp - fld->value;
+    unsigned bad = 0;
+    size_t i;
+
+    if (SAMField_Is(fld, '*')) {
+        memset(dst, -1, readlen);
+        return 0;
+    }
+    if (len != readlen)
+        return FIELD_INVALID(fld, "QUAL");
+    /* written so that the compiler can vectorize it */
+    for (i = 0; i < len; ++i) {
+        uint8_t const q = (uint8_t)(qual[i] - '!');
+        bad |= q > ('~' - '!');
+        dst[i] = q;
+    }
+    if (bad)
+        return FIELD_INVALID(fld, "QUAL");
+    return 0;
 }
 
-DEF_PARSER_FUNCTION(EXTRA_B_u, EXTRA)
-
-DEF_PARSER_FUNCTION_INLINE(EXTRA_B_i)
+static rc_t parse_EXTRA_B(uint8_t *const dst, size_t *const used, SAMField const *const fld)
 {
-    switch (self->state) {
-    case 1:
-        if (ch < 0)
-            goto DONE;
-        if (ch == ',') {
-            self->state = 2;
-            return true;
-        }
+    char const *cur = &fld->value[6];
+    int const subtype = fld->value[5];
+    uint32_t count = 0;
+
+    switch (subtype) {
+    case 'C':
+    case 'I':
+    case 'S':
+        dst[0] = 'I';
         break;
-    case 2:
-        self->numeric.state = 0;
-        if (parse_numeric(&self->numeric, ch)) {
-            self->state = 3;
-            return true;
-        }
+    case 'c':
+    case 'i':
+    case 's':
+        dst[0] = 'i';
         break;
-    case 3:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        if ((ch < 0 || ch == ',') && self->numeric.ok) {
-            int32_t value;
-            if (number_parser_get_exact_i32(&self->numeric, &value)) {
-                size_t const cp = check_size(self, 4, rc);
-                if (cp > 0) {
-                    bam_alignment_set_i32(&self->rslt->raw[cp], value);
-                    bam_alignment_inc_i32(&self->rslt->raw[self->extraArrayCountPos]);
-
-                    if (ch == ',')
-                        self->state = 2;
-                    else {
-                    DONE:
-                        self->parser = PARSER_FUNCTION(EXTRA);
-                    }
-                    return true;
-                }
-                return false;
-            }
-        }
-    }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
-}
-
-DEF_PARSER_FUNCTION(EXTRA_B_i, EXTRA)
-
-DEF_PARSER_FUNCTION_INLINE(EXTRA_B_f)
-{
-    switch (self->state) {
-    case 1:
-        if (ch < 0)
-            goto DONE;
-        if (ch == ',') {
-            self->state = 2;
-            return true;
-        }
+    case 'f':
+        dst[0] = 'f';
         break;
-    case 2:
-        self->numeric.state = 0;
-        if (parse_numeric(&self->numeric, ch)) {
-            self->state = 3;
-            return true;
+    default:
+        return FIELD_INVALID(fld, "EXTRA_B");
+    }
+    while (cur < fld->endp) {
+        char const *const value = cur + 1;
+        char const *const endp = SAM_FindByte(value, fld->endp, ',');
+        uint8_t *const out = &dst[5 + 4 * count];
+
+        if (*cur != ',')
+            return FIELD_INVALID(fld, "EXTRA_B");
+        if (dst[0] == 'f') {
+            double number;
+            if (!decode_float(value, endp, &number))
+                return FIELD_INVALID(fld, "EXTRA_B");
+            bam_alignment_set_f32(out, number);
         }
-        break;
-    case 3:
-        if (parse_numeric(&self->numeric, ch))
-            return true;
-        if ((ch < 0 || ch == ',') && self->numeric.ok) {
-            size_t const cp = check_size(self, 4, rc);
-            if (cp > 0) {
-                bam_alignment_set_f32(&self->rslt->raw[cp], number_parser_get(&self->numeric));
-                bam_alignment_inc_i32(&self->rslt->raw[self->extraArrayCountPos]);
-                
-                if (ch == ',')
-                    self->state = 2;
-                else {
-                DONE:
-                    self->parser = PARSER_FUNCTION(EXTRA);
-                }
-                return true;
-            }
-            return false;
+        else {
+            int64_t number;
+            bool const ok = dst[0] == 'I' ? decode_integer(value, endp, 0, UINT32_MAX, &number)
+                                          : decode_integer(value, endp, INT32_MIN, INT32_MAX, &number);
+            if (!ok)
+                return FIELD_INVALID(fld, "EXTRA_B");
+            bam_alignment_set_u32(out, (uint32_t)number);
         }
+        ++count;
+        cur = endp;
     }
-    *rc = RC(rcAlign, rcFile, rcReading, rcData, rcInvalid);
-    return false;
+    bam_alignment_set_u32(&dst[1], count);
+    *used = 5 + 4 * count;
+    return 0;
 }
 
-DEF_PARSER_FUNCTION(EXTRA_B_f, EXTRA)
-
-static bool SAM2BAM_Parser_grow(SAM2BAM_Parser *const self, rc_t *rc)
+/* TAG:TYPE:VALUE; an empty field is skipped */
+static rc_t parse_EXTRA(uint8_t *const dst, size_t *const used, SAMField const *const fld)
 {
-    size_t const size = self->max_size * 2;
-    void *tmp;
-    if ((void *)self->rslt == self->static_buffer) {
-        tmp = malloc(size);
-        if (tmp)
-            memmove(tmp, self->rslt, self->max_size);
-    }
-    else
-        tmp = realloc(self->rslt, size);
+    char const *const value = &fld->value[5];
+    size_t const len = fld->endp - fld->value;
+    size_t const vlen = len - 5;
+    unsigned bad = 0;
+    size_t i;
 
-    if (tmp == NULL) {
-        *rc = RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
-        return false;
+    *used = 0;
+    if (len == 0)
+        return 0;
+    if (   len < 5
+        || !((fld->value[0] >= 'A' && fld->value[0] <= 'Z') || (fld->value[0] >= 'a' && fld->value[0] <= 'z'))
+        || fld->value[2] != ':' || fld->value[4] != ':')
+    {
+        return FIELD_INVALID(fld, "EXTRA");
+    }
+    dst[0] = fld->value[0];
+    dst[1] = fld->value[1];
+    dst[2] = fld->value[3];
+    switch (fld->value[3]) {
+    case 'A':
+        if (vlen != 1 || value[0] < '!' || value[0] > '~')
+            return FIELD_INVALID(fld, "EXTRA_A");
+        dst[3] = value[0];
+        *used = 4;
+        return 0;
+    case 'i':
+    {
+        int64_t number;
+        if (!decode_integer(value, fld->endp, INT32_MIN, INT32_MAX, &number))
+            return FIELD_INVALID(fld, "EXTRA_i");
+        bam_alignment_set_i32(&dst[3], (int32_t)number);
+        *used = 7;
+        return 0;
     }
-    self->rslt = tmp;
-    self->max_size = size;
-    return true;
-}
-
-#if 0
-static void DebugPrintSAM(  char const *const data
-                          , unsigned const fields
-                          , unsigned const *const offsets
-                          )
-{
-#if _DEBUGGING
-    static char const *fieldNames[] = {
-        "QNAME", "FLAG", "RNAME", "POS", "MAPQ", "CIGAR",
-        "RNEXT", "PNEXT", "TLEN", "SEQ", "QUAL" };
-    unsigned i;
-    for (i = 0; i < fields; ++i) {
-        char const *const value = data + ((i == 0) ? 0 : offsets[i - 1]);
-        char const *const endp = data + offsets[i] - 1;
-        size_t const length = endp - value;
-        if (i < 11)
-            fprintf(stderr, "%s:\t%.*s\n", fieldNames[i], (int)length, value);
-        else
-            fprintf(stderr, "EXTRA_%u:\t%.*s\n", i - 10, (int)length, value);
+    case 'f':
+    {
+        double number;
+        if (!decode_float(value, fld->endp, &number))
+            return FIELD_INVALID(fld, "EXTRA_f");
+        bam_alignment_set_f32(&dst[3], number);
+        *used = 7;
+        return 0;
     }
-#endif
+    case 'Z':
+        for (i = 0; i < vlen; ++i) {
+            int const ch = value[i];
+            bad |= (ch < ' ') | (ch > '~');
+            dst[3 + i] = ch;
+        }
+        if (bad)
+            return FIELD_INVALID(fld, "EXTRA_Z");
+        dst[3 + vlen] = '\0';
+        *used = 4 + vlen;
+        return 0;
+    case 'H':
+        for (i = 0; i < vlen; ++i) {
+            int const ch = value[i];
+            bad |= !((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'F'));
+            dst[3 + i] = ch;
+        }
+        if (bad || (vlen & 1) != 0)
+            return FIELD_INVALID(fld, "EXTRA_H");
+        dst[3 + vlen] = '\0';
+        *used = 4 + vlen;
+        return 0;
+    case 'B':
+        if (vlen == 0)
+            break;
+        {
+            size_t size = 0;
+            rc_t const rc = parse_EXTRA_B(&dst[3], &size, fld);
+            *used = 3 + size;
+            return rc;
+        }
+    }
+    return FIELD_INVALID(fld, "EXTRA");
 }
-#endif
 
-static void LogSAM(  int level
-                   , char const *const data
-                   , unsigned const fields
-                   , unsigned const *const offsets
-                   )
+static void LogSAM(int level, char const *const line, size_t const length)
 {
     static char const *fieldNames[] = {
         "QNAME", "FLAG", "RNAME", "POS", "MAPQ", "CIGAR",
         "RNEXT", "PNEXT", "TLEN", "SEQ", "QUAL" };
+    char const *const endp = line + length;
+    char const *value = line;
     unsigned i;
-    for (i = 0; i < fields; ++i) {
-        char const *const value = data + ((i == 0) ? 0 : offsets[i - 1]);
-        char const *const endp = data + offsets[i] - 1;
-        size_t const length = endp - value;
+
+    for (i = 0; value <= endp; ++i) {
+        char const *const fend = SAM_FindByte(value, endp, '\t');
         if (i < 11)
-            (void)PLOGMSG(level, (level, "$(field): $(value)", "field=%s,value=%.*s", fieldNames[i], (int)length, value));
+            (void)PLOGMSG(level, (level, "$(field): $(value)", "field=%s,value=%.*s", fieldNames[i], (int)(fend - value), value));
         else
-            (void)PLOGMSG(level, (level, "$(field): $(value)", "field=EXTRA_%u,value=%.*s", i - 10, (int)length, value));
-    }
-}
-
-static SAM2BAM_Parser *init(  SAM2BAM_Parser *const self
-                            , void *const static_buffer
-                            , size_t const buffer_size
-                            , RefNameLookupFunction lookup
-                            , RefNameLookupContext *lookup_ctx
-                            )
-{
-    memset(self, 0, sizeof(*self));
-    if (static_buffer && buffer_size) {
-        self->rslt = self->static_buffer = static_buffer;
-        self->max_size = buffer_size;
-    }
+            (void)PLOGMSG(level, (level, "$(field): $(value)", "field=EXTRA_%u,value=%.*s", i - 10, (int)(fend - value), value));
+        value = fend + 1;
+    }
+}
+
+enum {
+    fld_QNAME,
+    fld_FLAG,
+    fld_RNAME,
+    fld_POS,
+    fld_MAPQ,
+    fld_CIGAR,
+    fld_RNEXT,
+    fld_PNEXT,
+    fld_TLEN,
+    fld_SEQ,
+    fld_QUAL,
+    fld_EXTRA
+};
+
+static rc_t SAM2BAM_ParseFields(bam_alignment *const rslt, size_t *const rslt_size,
+                                SAMField const fld[], char const *const line, size_t const length,
+                                RefNameLookupFunction lookup, RefNameLookupContext *lookup_ctx)
+{
+    uint8_t *const raw = rslt->raw;
+    size_t size = BAM_ALIGNMENT_MIN_SIZE;
+    size_t used = 0;
+    unsigned n_cigars = 0;
+    uint32_t readlen = 0;
+    int64_t value = 0;
+    rc_t rc;
+
+    memset(raw, 0, BAM_ALIGNMENT_MIN_SIZE);
+
+    rc = parse_QNAME(&raw[size], &used, &fld[fld_QNAME]);
+    if (rc) return rc;
+    rslt->cooked.read_name_len = (uint8_t)used;
+    size += used;
+
+    if (!decode_integer(fld[fld_FLAG].value, fld[fld_FLAG].endp, 0, UINT16_MAX, &value))
+        return FIELD_INVALID(&fld[fld_FLAG], "FLAG");
+    bam_alignment_set_u16(rslt->cooked.flags, (uint16_t)value);
+
+    rc = parse_REF(rslt->cooked.rID, &fld[fld_RNAME], "RNAME", lookup, lookup_ctx);
+    if (rc) return rc;
+
+    rc = parse_POS(rslt->cooked.pos, &fld[fld_POS], "POS");
+    if (rc) return rc;
+
+    value = 0;
+    if (fld[fld_MAPQ].value != fld[fld_MAPQ].endp && !decode_integer(fld[fld_MAPQ].value, fld[fld_MAPQ].endp, 0, UINT8_MAX, &value))
+        return FIELD_INVALID(&fld[fld_MAPQ], "MAPQ");
+    rslt->cooked.mapQual = (uint8_t)value;
+
+    rc = parse_CIGAR(&raw[size], &used, &n_cigars, &fld[fld_CIGAR]);
+    if (rc) return rc;
+    bam_alignment_set_u16(rslt->cooked.n_cigars, (uint16_t)n_cigars);
+    size += used;
+
+    if (SAMField_Is(&fld[fld_RNEXT], '='))
+        memmove(rslt->cooked.mate_rID, rslt->cooked.rID, 4);
     else {
-        self->rslt = malloc(self->max_size = 64 * 1024);
-        if (self->rslt == NULL) return NULL;
+        rc = parse_REF(rslt->cooked.mate_rID, &fld[fld_RNEXT], "RNEXT", lookup, lookup_ctx);
+        if (rc) return rc;
     }
-    self->lookup = lookup;
-    self->lookup_ctx = lookup_ctx;
-    self->parser = parse_QNAME;
-    self->rslt_size = offsetof(bam_alignment, cooked.read_name[0]);
-    memset(self->rslt, 0, self->rslt_size);
-    return self;
-}
 
-static SAM2BAM_Parser *parse(  char const *const data
-                             , unsigned const fields
-                             , unsigned const *const offsets
-                             , void *const static_buffer
-                             , size_t const buffer_size
-                             , RefNameLookupFunction lookup
-                             , RefNameLookupContext *lookup_ctx
-                             , rc_t *rc
-                             )
-{
-    SAM2BAM_Parser *const self = malloc(sizeof(*self));
-    
-    if (self == NULL)
-        goto OUT_OF_MEMORY;
-
-    if (init(self, static_buffer, buffer_size, lookup, lookup_ctx) == NULL)
-        goto OUT_OF_MEMORY;
-    
-    // LogSAM(klogErr, data, fields, offsets);
-    self->record_chars = offsets[fields - 1] - 1;
-    *rc = 0;
-    for (self->field = 0; self->field != fields; ) {
-        unsigned const i = self->field;
-        char const *const field = data + ((i == 0) ? 0 : offsets[i - 1]);
-        char const *const endp = data + offsets[i] - 1;
-        rc_t lrc = 0;
-        
-        self->field += 1;
-        self->state = 0;
-        self->field_out_size = 0;
-        self->field_in_size = 0;
-        self->numeric.state = 0;
-        if (self->parser(self, -1, &lrc, field, endp))
-            continue;
-        if (*rc == 0)
-            *rc = lrc;
-    }
-    if (self->parser == PARSER_FUNCTION(EXTRA) && *rc == 0)
-        return self;
-    
-    if (*rc == 0) {
-        *rc = RC(rcAlign, rcFile, rcReading, rcData, rcTooShort);
-        (void)LOGERR(klogErr, *rc, "Parsing SAM:");
-        LogSAM(klogInfo, data, fields, offsets);
-    }
-    if (self->rslt != static_buffer)
-        free(self->rslt);
-    free(self);
-    return NULL;
-
-OUT_OF_MEMORY:
-    free(self);
-    *rc = RC(rcAlign, rcFile, rcReading, rcMemory, rcExhausted);
-    return NULL;
-}
+    rc = parse_POS(rslt->cooked.mate_pos, &fld[fld_PNEXT], "PNEXT");
+    if (rc) return rc;
 
-SAM2BAM_Parser *SAM2BAM_Parser_parse(  char const *const data
-                                     , unsigned const fields
-                                     , unsigned const *const offsets
-                                     , void *const static_buffer
-                                     , size_t const buffer_size
-                                     , RefNameLookupFunction lookup
-                                     , RefNameLookupContext *lookup_ctx
-                                     , rc_t *rc
-                                     )
-{
-    return parse(data, fields, offsets, static_buffer, buffer_size, lookup, lookup_ctx, rc);
+    if (!decode_integer(fld[fld_TLEN].value, fld[fld_TLEN].endp, INT32_MIN, INT32_MAX, &value))
+        return FIELD_INVALID(&fld[fld_TLEN], "TLEN");
+    bam_alignment_set_i32(rslt->cooked.ins_size, (int32_t)value);
+
+    rc = parse_SEQ(&raw[size], &used, &readlen, &fld[fld_SEQ]);
+    if (rc) return rc;
+    bam_alignment_set_u32(rslt->cooked.read_len, readlen);
+    size += used;
+
+    rc = parse_QUAL(&raw[size], readlen, &fld[fld_QUAL]);
+    if (rc) return rc;
+    size += readlen;
+
+    /* the optional fields follow the last mandatory one */
+    {
+        char const *const endp = line + length;
+        SAMField extra;
+
+        extra.value = fld[fld_QUAL].endp;
+        while (extra.value < endp) {
+            extra.value += 1;
+            extra.endp = SAM_FindByte(extra.value, endp, '\t');
+            rc = parse_EXTRA(&raw[size], &used, &extra);
+            if (rc) return rc;
+            size += used;
+            extra.value = extra.endp;
+        }
+    }
+    *rslt_size = size;
+    return 0;
 }
 
-SAM2BAM_Parser *SAM2BAM_Parser_initialize(  SAM2BAM_Parser *const self
-                                          , void *const static_buffer
-                                          , size_t const buffer_size
-                                          , RefNameLookupFunction lookup
-                                          , RefNameLookupContext *lookup_ctx
-                                          )
+rc_t SAM2BAM_ParseLine(SAM2BAM_Output *const out,
+                       char const *const line,
+                       size_t const length,
+                       RefNameLookupFunction lookup,
+                       RefNameLookupContext *lookup_ctx)
 {
-    return init(self, static_buffer, buffer_size, lookup, lookup_ctx);
+    char const *const endp = line + length;
+    SAMField fld[fld_EXTRA];
+    char const *cur = line;
+    size_t size = 0;
+    unsigned i;
+    rc_t rc;
+
+    for (i = 0; i < fld_EXTRA; ++i) {
+        if (cur > endp) {
+            rc = RC(rcAlign, rcFile, rcReading, rcData, rcTooShort);
+            (void)LOGERR(klogErr, rc, "Parsing SAM:");
+            LogSAM(klogInfo, line, length);
+            return rc;
+        }
+        fld[i].value = cur;
+        fld[i].endp = SAM_FindByte(cur, endp, '\t');
+        cur = fld[i].endp + 1;
+    }
+
+    /* no field grows by more than twice its length, the extra 8 covers
+     * the nul terminating QNAME and the shortest tags
+     */
+    rc = SAM2BAM_OutputReserve(out, BAM_ALIGNMENT_MIN_SIZE + 2 * length + 8);
+    if (rc) return rc;
+
+    rc = SAM2BAM_ParseFields((bam_alignment *)&out->base[out->used], &size, fld, line, length, lookup, lookup_ctx);
+    if (rc == 0)
+        out->used += size;
+    return rc;
 }
@@ -29,53 +29,38 @@
 #include <stdint.h>
 #include "bam-alignment.h"
 
-typedef struct SAM2BAM_Parser SAM2BAM_Parser;
-
 typedef struct RefNameLookupContext RefNameLookupContext; /**< caller defined **/
-typedef bool (*RefNameLookupFunction)(RefNameLookupContext *ctx, int ch, int32_t *result, rc_t *rc);
 
-/** implementation details **/
-typedef bool (*SAM_parser_f)(SAM2BAM_Parser *, int, rc_t *, char const *, char const *);
-typedef struct number_parser number_parser;
-struct number_parser {
-    uint64_t mantissa;
-    int32_t exponent;
-    signed sgn:2;
-    unsigned shift:6; /**< [0 - 19] **/
-    unsigned state:23;
-    unsigned ok:1;
-};
+/** \brief finds a reference by its name, which is not nul-terminated **/
+typedef bool (*RefNameLookupFunction)(RefNameLookupContext *ctx, char const name[], size_t namelen, int32_t *result);
 
-/** \brief parser state **/
-struct SAM2BAM_Parser {
+/** \brief where SAM2BAM_ParseLine puts its result
+ * it starts out as static_buffer, which is never freed, and moves to the heap when it needs to grow
+ **/
+typedef struct SAM2BAM_Output SAM2BAM_Output;
+struct SAM2BAM_Output {
+    uint8_t *base;
     void *static_buffer;
-    size_t max_size;
-    bam_alignment *rslt; /**< on successful parse this is the result **/
-    size_t rslt_size;    /**< on successful parse this is the size of the result **/
+    size_t size;    /**< bytes allocated at base **/
+    size_t used;    /**< bytes in use at base **/
+};
 
-    /* implementation details follow */
-    SAM_parser_f parser;
-    size_t field_out_size;  /**< parsed size; only makes sense for some fields **/
-    size_t field_in_size;   /**< input byte count for the current field (excluding delimters) **/
-    size_t record_chars;    /**< input byte count for the whole record (including delimters but not line-feed) **/
-    int field;
-    int state;  /**< each parser has its own idea of state; state is always 0 at start of field **/
-    bool cr;
+/** \brief makes room for more bytes after used **/
+rc_t SAM2BAM_OutputReserve(SAM2BAM_Output *self, size_t more);
 
-    size_t extraArrayCountPos;
-    number_parser numeric;
-    RefNameLookupFunction lookup;
-    RefNameLookupContext *lookup_ctx;
-};
+/** \brief frees base unless it is static_buffer **/
+void SAM2BAM_OutputWhack(SAM2BAM_Output *self);
 
-SAM2BAM_Parser *SAM2BAM_Parser_initialize(SAM2BAM_Parser *const self, void *const static_buffer, size_t const buffer_size, RefNameLookupFunction lookup, RefNameLookupContext *lookup_ctx);
+/** \brief the first ch in [data, endp), or endp; 16 bytes at a time where SSE2 is available **/
+char const *SAM_FindByte(char const *data, char const *endp, int ch);
 
-SAM2BAM_Parser *SAM2BAM_Parser_parse(  char const *const data
-                                     , unsigned const fields
-                                     , unsigned const *const offsets
-                                     , void *const static_buffer
-                                     , size_t const buffer_size
-                                     , RefNameLookupFunction lookup
-                                     , RefNameLookupContext *lookup_ctx
-                                     , rc_t *rc
-                                     );
+/** \brief converts one SAM record to BAM and appends it to out
+ * line is not modified and need not be nul-terminated; length excludes the line-feed
+ * out->used grows by the size of the BAM record, which does not include the block_size
+ **/
+rc_t SAM2BAM_ParseLine(  SAM2BAM_Output *out
+                       , char const *line
+                       , size_t length
+                       , RefNameLookupFunction lookup
+                       , RefNameLookupContext *lookup_ctx
+                       );
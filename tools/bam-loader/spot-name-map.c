@@ -0,0 +1,644 @@
+/*===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#include <klib/rc.h>
+#include <klib/sort.h>
+#include <klib/printf.h>
+#include <kfs/directory.h>
+#include <kfs/file.h>
+#include <kproc/lock.h>
+#include <sysalloc.h>
+#include <atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spot-name-map.h"
+
+#define SHARD_BITS (6u)
+#define SHARD_COUNT (1u << SHARD_BITS)
+#ifndef SHARD_MIN_LIMIT
+#define SHARD_MIN_LIMIT (((size_t)1) << 22)
+#endif
+#define TABLE_INITIAL_SIZE (4096u)
+#ifndef SPILL_MIN_COUNT
+#define SPILL_MIN_COUNT (1024u)
+#endif
+#define ARENA_CHUNK_SIZE (((size_t)1) << 20)
+#define RUN_BLOCK_RECORDS (128u)
+#define RUN_RECORD_HEADER (8u)
+#define RUN_WRITE_BUFFER (((size_t)1) << 20)
+#define BLOOM_BITS_PER_NAME (16u)
+#define BLOOM_PROBES (6u)
+#define GROUP_NAMES SPOT_NAME_MAP_GROUPS /* where the group names themselves go */
+#define MAX_ID ((uint64_t)UINT32_MAX)
+
+typedef struct Arena Arena;
+struct Arena {
+    Arena *next;
+    size_t used;
+    size_t size;
+};
+
+typedef struct Entry {
+    uint64_t hash;
+    char const *name; /* in the arena; NULL: empty slot */
+    uint32_t id;
+    uint16_t group;
+    uint16_t namelen;
+} Entry;
+
+/* the first name of every block of a run */
+typedef struct Mark {
+    char const *name;
+    uint64_t offset;
+    uint16_t group;
+    uint16_t namelen;
+} Mark;
+
+/* a run is a file of records sorted by group and name;
+ * a record is { uint16_t group, uint16_t namelen, uint32_t id, char name[namelen] }
+ */
+typedef struct Run {
+    KFile *file;
+    uint64_t *bloom;
+    uint64_t bloomMask;
+    Mark *mark;
+    char *markNames;
+    uint64_t size;
+    size_t marks;
+} Run;
+
+typedef struct Shard {
+    KLock *lock;
+    Entry *table;
+    size_t tableSize; /* a power of 2 */
+    size_t count;
+    Arena *arena;
+    size_t arenaBytes;
+    Run *run;
+    unsigned runs;
+    uint8_t *scratch; /* a block read back from a run */
+    size_t scratchSize;
+    rc_t spillRc; /* a spill failed: no more names go into this shard */
+} Shard;
+
+struct SpotNameMap {
+    Shard shard[SHARD_COUNT];
+    atomic64_t idCount[SPOT_NAME_MAP_GROUPS + 1];
+    atomic32_t runCount;
+    KDirectory *dir;
+    char *tmpfs;
+    uint64_t pid;
+    size_t shardLimit;
+};
+
+static uint64_t HashName(unsigned const group, char const name[], size_t const namelen)
+{
+    /* FNV-1a, then the murmur3 finalizer for the shard bits */
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i;
+
+    h = (h ^ (uint8_t)group) * 0x100000001b3ull;
+    h = (h ^ (uint8_t)(group >> 8)) * 0x100000001b3ull;
+    for (i = 0; i < namelen; ++i)
+        h = (h ^ ((uint8_t const *)name)[i]) * 0x100000001b3ull;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static int KeyCompare(unsigned const agroup, char const aname[], size_t const alen,
+                      unsigned const bgroup, char const bname[], size_t const blen)
+{
+    if (agroup != bgroup)
+        return agroup < bgroup ? -1 : 1;
+    {
+        int const diff = memcmp(aname, bname, alen < blen ? alen : blen);
+        if (diff != 0)
+            return diff;
+    }
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+}
+
+static int64_t CC EntryCompare(void const *A, void const *B, void *ignored)
+{
+    Entry const *const a = A;
+    Entry const *const b = B;
+
+    return KeyCompare(a->group, a->name, a->namelen, b->group, b->name, b->namelen);
+}
+
+/* MARK: Bloom filter of a run */
+
+static uint64_t BloomStep(uint64_t const hash)
+{
+    return ((hash >> 32) | (hash << 32)) | 1;
+}
+
+static void BloomSet(Run *const self, uint64_t const hash)
+{
+    uint64_t const step = BloomStep(hash);
+    uint64_t bit = hash;
+    unsigned i;
+
+    for (i = 0; i != BLOOM_PROBES; ++i, bit += step) {
+        uint64_t const k = bit & self->bloomMask;
+        self->bloom[k >> 6] |= ((uint64_t)1) << (k & 63);
+    }
+}
+
+static bool BloomTest(Run const *const self, uint64_t const hash)
+{
+    uint64_t const step = BloomStep(hash);
+    uint64_t bit = hash;
+    unsigned i;
+
+    for (i = 0; i != BLOOM_PROBES; ++i, bit += step) {
+        uint64_t const k = bit & self->bloomMask;
+        if ((self->bloom[k >> 6] & (((uint64_t)1) << (k & 63))) == 0)
+            return false;
+    }
+    return true;
+}
+
+/* MARK: Run */
+
+static void RunWhack(Run *const self)
+{
+    KFileRelease(self->file);
+    free(self->bloom);
+    free(self->mark);
+    free(self->markNames);
+}
+
+static rc_t RunAppend(Run *const self, void const *const buffer, size_t const size)
+{
+    size_t num_writ = 0;
+    rc_t const rc = KFileWriteAll(self->file, self->size, buffer, size, &num_writ);
+
+    self->size += num_writ;
+    if (rc == 0 && num_writ != size)
+        return RC(rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete);
+    return rc;
+}
+
+static rc_t RunFind(Run const *const self, Shard *const shard,
+                    uint64_t const hash, unsigned const group, char const name[], size_t const namelen,
+                    uint32_t *const id, bool *const found)
+{
+    size_t f = 0;
+    size_t e = self->marks;
+    uint64_t start;
+    uint64_t end;
+    size_t num_read = 0;
+    size_t pos;
+    rc_t rc;
+
+    *found = false;
+    if (!BloomTest(self, hash))
+        return 0;
+
+    /* the last block starting at or before the name */
+    while (f < e) {
+        size_t const m = (f + e) / 2;
+        Mark const *const mark = &self->mark[m];
+
+        if (KeyCompare(mark->group, mark->name, mark->namelen, group, name, namelen) <= 0)
+            f = m + 1;
+        else
+            e = m;
+    }
+    if (f == 0)
+        return 0;
+    start = self->mark[f - 1].offset;
+    end = f < self->marks ? self->mark[f].offset : self->size;
+
+    if (shard->scratchSize < end - start) {
+        void *const tmp = realloc(shard->scratch, end - start);
+        if (tmp == NULL)
+            return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+        shard->scratch = tmp;
+        shard->scratchSize = end - start;
+    }
+    rc = KFileReadAll(self->file, start, shard->scratch, end - start, &num_read);
+    if (rc)
+        return rc;
+    if (num_read != end - start)
+        return RC(rcExe, rcFile, rcReading, rcData, rcInsufficient);
+
+    for (pos = 0; pos + RUN_RECORD_HEADER <= num_read; ) {
+        uint8_t const *const rec = &shard->scratch[pos];
+        uint16_t rgroup;
+        uint16_t rlen;
+        int diff;
+
+        memmove(&rgroup, &rec[0], 2);
+        memmove(&rlen, &rec[2], 2);
+        if (pos + RUN_RECORD_HEADER + rlen > num_read)
+            return RC(rcExe, rcFile, rcReading, rcData, rcCorrupt);
+
+        diff = KeyCompare(rgroup, (char const *)&rec[RUN_RECORD_HEADER], rlen, group, name, namelen);
+        if (diff == 0) {
+            memmove(id, &rec[4], 4);
+            *found = true;
+            return 0;
+        }
+        if (diff > 0)
+            break;
+        pos += RUN_RECORD_HEADER + rlen;
+    }
+    return 0;
+}
+
+/* MARK: Shard */
+
+static void ShardFreeArena(Shard *const self)
+{
+    while (self->arena) {
+        Arena *const next = self->arena->next;
+        free(self->arena);
+        self->arena = next;
+    }
+    self->arenaBytes = 0;
+}
+
+static void ShardWhack(Shard *const self)
+{
+    unsigned i;
+
+    for (i = 0; i != self->runs; ++i)
+        RunWhack(&self->run[i]);
+    free(self->run);
+    ShardFreeArena(self);
+    free(self->table);
+    free(self->scratch);
+    KLockRelease(self->lock);
+}
+
+static char const *ShardCopyName(Shard *const self, char const name[], size_t const namelen)
+{
+    Arena *arena = self->arena;
+    char *dst;
+
+    if (arena == NULL || arena->size - arena->used < namelen) {
+        size_t const size = namelen > ARENA_CHUNK_SIZE ? namelen : ARENA_CHUNK_SIZE;
+
+        arena = malloc(sizeof(*arena) + size);
+        if (arena == NULL)
+            return NULL;
+        arena->next = self->arena;
+        arena->used = 0;
+        arena->size = size;
+        self->arena = arena;
+        self->arenaBytes += sizeof(*arena) + size;
+    }
+    dst = (char *)(arena + 1) + arena->used;
+    memmove(dst, name, namelen);
+    arena->used += namelen;
+    return dst;
+}
+
+/* rehashes every entry in the table, which need not be a valid hash table */
+static rc_t ShardRebuild(Shard *const self, size_t const newSize)
+{
+    Entry *const table = calloc(newSize, sizeof(table[0]));
+    size_t const mask = newSize - 1;
+    size_t i;
+
+    if (table == NULL)
+        return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+
+    for (i = 0; i != self->tableSize; ++i) {
+        Entry const *const entry = &self->table[i];
+
+        if (entry->name) {
+            size_t j = entry->hash & mask;
+
+            while (table[j].name)
+                j = (j + 1) & mask;
+            table[j] = *entry;
+        }
+    }
+    free(self->table);
+    self->table = table;
+    self->tableSize = newSize;
+    return 0;
+}
+
+static rc_t ShardWriteRun(SpotNameMap *const map, Shard *const self, Run *const run)
+{
+    unsigned const runNo = atomic32_read_and_add(&map->runCount, 1);
+    size_t const count = self->count;
+    size_t markNamesSize = 0;
+    uint64_t bloomBits = 64;
+    uint8_t *buffer;
+    size_t buffered = 0;
+    size_t i;
+    rc_t rc;
+
+    memset(run, 0, sizeof(*run));
+
+    rc = KDirectoryCreateFile(map->dir, &run->file, true, 0600, kcmInit, "%s/key2id.%lu.%u", map->tmpfs, map->pid, runNo);
+    KDirectoryRemove(map->dir, 0, "%s/key2id.%lu.%u", map->tmpfs, map->pid, runNo);
+    if (rc)
+        return rc;
+
+    while (bloomBits < (uint64_t)count * BLOOM_BITS_PER_NAME)
+        bloomBits <<= 1;
+    for (i = 0; i < count; i += RUN_BLOCK_RECORDS)
+        markNamesSize += self->table[i].namelen;
+
+    run->bloomMask = bloomBits - 1;
+    run->bloom = calloc(bloomBits / 64, sizeof(run->bloom[0]));
+    run->mark = malloc(((count + RUN_BLOCK_RECORDS - 1) / RUN_BLOCK_RECORDS) * sizeof(run->mark[0]));
+    run->markNames = malloc(markNamesSize + 1);
+    buffer = malloc(RUN_WRITE_BUFFER);
+    if (run->bloom == NULL || run->mark == NULL || run->markNames == NULL || buffer == NULL) {
+        free(buffer);
+        return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+    }
+
+    markNamesSize = 0;
+    for (i = 0; i != count && rc == 0; ++i) {
+        Entry const *const entry = &self->table[i];
+        size_t const recsize = RUN_RECORD_HEADER + entry->namelen;
+
+        if (buffered + recsize > RUN_WRITE_BUFFER) {
+            rc = RunAppend(run, buffer, buffered);
+            buffered = 0;
+            if (rc)
+                break;
+        }
+        if (i % RUN_BLOCK_RECORDS == 0) {
+            Mark *const mark = &run->mark[run->marks++];
+
+            memmove(&run->markNames[markNamesSize], entry->name, entry->namelen);
+            mark->name = &run->markNames[markNamesSize];
+            mark->offset = run->size + buffered;
+            mark->group = entry->group;
+            mark->namelen = entry->namelen;
+            markNamesSize += entry->namelen;
+        }
+        BloomSet(run, entry->hash);
+
+        memmove(&buffer[buffered + 0], &entry->group, 2);
+        memmove(&buffer[buffered + 2], &entry->namelen, 2);
+        memmove(&buffer[buffered + 4], &entry->id, 4);
+        memmove(&buffer[buffered + RUN_RECORD_HEADER], entry->name, entry->namelen);
+        buffered += recsize;
+    }
+    if (rc == 0 && buffered > 0)
+        rc = RunAppend(run, buffer, buffered);
+    free(buffer);
+    return rc;
+}
+
+/* writes the names in memory to a new run and empties the shard;
+ * if that fails, the shard is left as it was
+ */
+static rc_t ShardSpill(SpotNameMap *const map, Shard *const self)
+{
+    size_t j = 0;
+    size_t i;
+    Run run;
+    void *tmp;
+    rc_t rc;
+
+    for (i = 0; i != self->tableSize; ++i) {
+        if (self->table[i].name)
+            self->table[j++] = self->table[i];
+    }
+    assert(j == self->count);
+    memset(&self->table[j], 0, (self->tableSize - j) * sizeof(self->table[0]));
+    ksort(self->table, j, sizeof(self->table[0]), EntryCompare, NULL);
+
+    tmp = realloc(self->run, (self->runs + 1) * sizeof(self->run[0]));
+    if (tmp == NULL)
+        rc = RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+    else {
+        self->run = tmp;
+        rc = ShardWriteRun(map, self, &run);
+    }
+    if (rc) {
+        /* the names stay in memory and can still be found */
+        rc_t const rc2 = ShardRebuild(self, self->tableSize);
+        if (tmp != NULL)
+            RunWhack(&run);
+        return rc2 ? rc2 : rc;
+    }
+    self->run[self->runs++] = run;
+
+    tmp = calloc(TABLE_INITIAL_SIZE, sizeof(self->table[0]));
+    if (tmp == NULL)
+        memset(self->table, 0, self->tableSize * sizeof(self->table[0]));
+    else {
+        free(self->table);
+        self->table = tmp;
+        self->tableSize = TABLE_INITIAL_SIZE;
+    }
+    self->count = 0;
+    ShardFreeArena(self);
+    return 0;
+}
+
+static rc_t ShardEntry(SpotNameMap *const map, Shard *const self,
+                       uint64_t const hash, unsigned const group, char const name[], size_t const namelen,
+                       uint32_t *const id, bool *const wasInserted)
+{
+    size_t mask = self->tableSize - 1;
+    size_t i = hash & mask;
+    unsigned r;
+    rc_t rc;
+
+    *wasInserted = false;
+    for ( ; self->table[i].name; i = (i + 1) & mask) {
+        Entry const *const entry = &self->table[i];
+
+        if (entry->hash == hash && entry->group == group && entry->namelen == namelen
+            && memcmp(entry->name, name, namelen) == 0)
+        {
+            *id = entry->id;
+            return 0;
+        }
+    }
+    /* newest runs first; the names in them are the most likely to come back */
+    for (r = self->runs; r > 0; ) {
+        bool found = false;
+
+        rc = RunFind(&self->run[--r], self, hash, group, name, namelen, id, &found);
+        if (rc || found)
+            return rc;
+    }
+
+    if (self->spillRc)
+        return self->spillRc;
+    if (map->shardLimit > 0 && self->count >= SPILL_MIN_COUNT
+        && self->tableSize * sizeof(self->table[0]) + self->arenaBytes > map->shardLimit)
+    {
+        rc = ShardSpill(map, self);
+        if (rc) {
+            self->spillRc = rc;
+            return rc;
+        }
+        mask = self->tableSize - 1;
+        for (i = hash & mask; self->table[i].name; i = (i + 1) & mask)
+            ;
+    }
+    if ((self->count + 1) * 4 > self->tableSize * 3) {
+        rc = ShardRebuild(self, self->tableSize * 2);
+        if (rc)
+            return rc;
+        mask = self->tableSize - 1;
+        for (i = hash & mask; self->table[i].name; i = (i + 1) & mask)
+            ;
+    }
+    {
+        Entry *const entry = &self->table[i];
+        char const *const copy = ShardCopyName(self, name, namelen);
+        uint64_t newId;
+
+        if (copy == NULL)
+            return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+        newId = atomic64_read_and_add(&map->idCount[group], 1);
+        if (newId >= MAX_ID)
+            return RC(rcExe, rcTree, rcAllocating, rcId, rcExhausted);
+
+        entry->name = copy;
+        entry->hash = hash;
+        entry->id = (uint32_t)newId;
+        entry->group = (uint16_t)group;
+        entry->namelen = (uint16_t)namelen;
+        ++self->count;
+
+        *id = entry->id;
+        *wasInserted = true;
+    }
+    return 0;
+}
+
+/* MARK: SpotNameMap */
+
+void SpotNameMapRelease(SpotNameMap *const self)
+{
+    if (self) {
+        unsigned i;
+
+        for (i = 0; i != SHARD_COUNT; ++i)
+            ShardWhack(&self->shard[i]);
+        KDirectoryRelease(self->dir);
+        free(self->tmpfs);
+        free(self);
+    }
+}
+
+rc_t SpotNameMapMake(SpotNameMap **const rslt, size_t const memory_limit, char const tmpfs[], uint64_t const pid)
+{
+    SpotNameMap *const self = calloc(1, sizeof(*self));
+    rc_t rc;
+    unsigned i;
+
+    *rslt = NULL;
+    if (self == NULL)
+        return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+
+    self->pid = pid;
+    self->shardLimit = memory_limit / SHARD_COUNT;
+    if (memory_limit > 0 && self->shardLimit < SHARD_MIN_LIMIT)
+        self->shardLimit = SHARD_MIN_LIMIT;
+
+    rc = KDirectoryNativeDir(&self->dir);
+    if (rc == 0) {
+        self->tmpfs = strdup(tmpfs);
+        if (self->tmpfs == NULL)
+            rc = RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+    }
+    for (i = 0; i != SHARD_COUNT && rc == 0; ++i) {
+        Shard *const shard = &self->shard[i];
+
+        rc = KLockMake(&shard->lock);
+        if (rc == 0) {
+            shard->table = calloc(TABLE_INITIAL_SIZE, sizeof(shard->table[0]));
+            if (shard->table == NULL)
+                rc = RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
+            shard->tableSize = TABLE_INITIAL_SIZE;
+        }
+    }
+    if (rc == 0)
+        *rslt = self;
+    else
+        SpotNameMapRelease(self);
+    return rc;
+}
+
+rc_t SpotNameMapEntry(SpotNameMap *const self, unsigned const group,
+                      char const name[], size_t const namelen,
+                      uint32_t *const id, bool *const wasInserted)
+{
+    uint64_t const hash = HashName(group, name, namelen);
+    Shard *const shard = &self->shard[hash >> (64 - SHARD_BITS)];
+    rc_t rc;
+
+    if (group > GROUP_NAMES)
+        return RC(rcExe, rcName, rcInserting, rcParam, rcOutofrange);
+    if (namelen > UINT16_MAX)
+        return RC(rcExe, rcName, rcInserting, rcName, rcExcessive);
+
+    KLockAcquire(shard->lock);
+    rc = ShardEntry(self, shard, hash, group, name, namelen, id, wasInserted);
+    KLockUnlock(shard->lock);
+    return rc;
+}
+
+rc_t SpotNameMapGroup(SpotNameMap *const self, char const name[], unsigned const max_groups,
+                      unsigned *const group, bool *const wasInserted)
+{
+    uint32_t id = 0;
+    rc_t rc = SpotNameMapEntry(self, GROUP_NAMES, name, strlen(name), &id, wasInserted);
+
+    if (rc == 0) {
+        *group = id;
+        if (id >= max_groups || id >= SPOT_NAME_MAP_GROUPS)
+            rc = RC(rcExe, rcTree, rcAllocating, rcConstraint, rcViolated);
+    }
+    return rc;
+}
+
+uint32_t SpotNameMapIdCount(SpotNameMap const *const self, unsigned const group)
+{
+    uint64_t const count = atomic64_read(&self->idCount[group]);
+    return count < MAX_ID ? (uint32_t)count : (uint32_t)MAX_ID;
+}
+
+unsigned SpotNameMapRunCount(SpotNameMap const *const self)
+{
+    return atomic32_read(&self->runCount);
+}
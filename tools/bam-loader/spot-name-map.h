@@ -0,0 +1,83 @@
+/*===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#ifndef _h_spot_name_map_
+#define _h_spot_name_map_
+
+#include <klib/rc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--------------------------------------------------------------------------
+ * SpotNameMap
+ *  maps spot names to ids, per spot group
+ *
+ *  The names live in memory in hash tables, sharded by the hash of the name
+ *  so that several threads can insert at once. When a shard outgrows its
+ *  part of the memory limit, its names are sorted and written to a run file
+ *  in the scratch directory; lookups check the runs through a Bloom filter.
+ *
+ *  Ids are handed out in order of first insertion, starting at 0, for each
+ *  spot group separately. The groups themselves are numbered in the order
+ *  their names are first seen.
+ */
+#define SPOT_NAME_MAP_GROUPS (256u)
+
+typedef struct SpotNameMap SpotNameMap;
+
+/* memory_limit: bytes of names and tables kept in memory before spilling
+ * tmpfs, pid: where the run files go and how they are named; the files are
+ *  unlinked as they are created
+ */
+rc_t SpotNameMapMake(SpotNameMap **rslt, size_t memory_limit, char const tmpfs[], uint64_t pid);
+
+void SpotNameMapRelease(SpotNameMap *self);
+
+/* the number of a spot group; returns rcConstraint, rcViolated
+ * once there are more than max_groups groups
+ */
+rc_t SpotNameMapGroup(SpotNameMap *self, char const name[], unsigned max_groups, unsigned *group, bool *wasInserted);
+
+/* the id of a spot name in a group, inserting it if it is new;
+ * returns rcId, rcExhausted if the group runs out of 32-bit ids.
+ * Once a run could not be written, new names hashed to the same shard
+ * get that error and are not inserted; known names are still found
+ */
+rc_t SpotNameMapEntry(SpotNameMap *self, unsigned group, char const name[], size_t namelen, uint32_t *id, bool *wasInserted);
+
+/* the number of ids handed out in a group */
+uint32_t SpotNameMapIdCount(SpotNameMap const *self, unsigned group);
+
+/* the number of runs written so far, for the logs */
+unsigned SpotNameMapRunCount(SpotNameMap const *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _h_spot_name_map_ */
@@ -0,0 +1,524 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "chunk_writer.h"
+#include "concatenator.h"
+
+#include <klib/vector.h>
+#include <kfs/file.h>
+#include <kfs/buffile.h>
+#include <kproc/thread.h>
+#include <kproc/queue.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#define CHUNK_PART_MIN_SIZE ( 64 * 1024 )
+
+typedef struct chunk_part
+{
+    char * data;
+    size_t used;
+    size_t size;
+} chunk_part;
+
+typedef struct out_chunk
+{
+    Vector parts;       /* chunk_part, indexed by dst_id */
+    uint64_t seq;       /* position of this chunk in the output */
+    rc_t rc;            /* result of the join-thread that filled this chunk */
+    bool one_stream;    /* all dst_id's go into part #0 ( stdout: keeps the order of the reads ) */
+} out_chunk;
+
+typedef struct out_file
+{
+    struct KFile * f;
+    uint64_t pos;
+    SBuffer name;       /* helper.h ( without the .gz/.bz2 suffix ) */
+} out_file;
+
+typedef struct chunk_writer
+{
+    KDirectory * dir;
+    const char * output_filename;   /* NULL: write to stdout */
+    size_t buf_size;
+    compress_t compress;
+    bool force;
+    uint32_t num_threads;
+
+    KThread * writer;
+    KQueue * empty_q;       /* chunks ready to be filled by the join-threads */
+    KQueue * done_q;        /* filled chunks, in the order the join-threads finished them */
+    out_chunk * chunks;
+    out_chunk ** pending;   /* reorder-window, indexed by seq % num_chunks */
+    uint32_t num_chunks;
+    uint64_t next_write;
+    Vector files;           /* out_file, indexed by dst_id */
+} chunk_writer;
+
+/* ----------------------------------------------------------------------------------- */
+
+static void CC release_chunk_part( void * item, void * data )
+{
+    chunk_part * part = item;
+    if ( part != NULL )
+    {
+        if ( part -> data != NULL )
+            free( ( void * ) part -> data );
+        free( ( void * ) part );
+    }
+}
+
+static void CC clear_chunk_part( void * item, void * data )
+{
+    chunk_part * part = item;
+    if ( part != NULL )
+        part -> used = 0;
+}
+
+rc_t out_chunk_write( struct out_chunk * self, uint32_t dst_id, const char * src, size_t len )
+{
+    rc_t rc = 0;
+    chunk_part * part;
+    if ( self -> one_stream )
+        dst_id = 0;
+    part = VectorGet( &( self -> parts ), dst_id );
+    if ( part == NULL )
+    {
+        part = calloc( 1, sizeof * part );
+        if ( part == NULL )
+        {
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "chunk_writer.c out_chunk_write().calloc( %d ) -> %R", ( sizeof * part ), rc );
+        }
+        else
+        {
+            rc = VectorSet( &( self -> parts ), dst_id, part );
+            if ( rc != 0 )
+            {
+                ErrMsg( "chunk_writer.c out_chunk_write().VectorSet( %u ) -> %R", dst_id, rc );
+                free( ( void * ) part );
+                part = NULL;
+            }
+        }
+    }
+    if ( rc == 0 && part -> used + len > part -> size )
+    {
+        /* the chunks are recycled, after a few rounds they have reached their working size */
+        size_t new_size = part -> size > 0 ? part -> size * 2 : CHUNK_PART_MIN_SIZE;
+        char * tmp;
+        while ( new_size < part -> used + len )
+            new_size *= 2;
+        tmp = realloc( part -> data, new_size );
+        if ( tmp == NULL )
+        {
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "chunk_writer.c out_chunk_write().realloc( %lu ) -> %R", new_size, rc );
+        }
+        else
+        {
+            part -> data = tmp;
+            part -> size = new_size;
+        }
+    }
+    if ( rc == 0 )
+    {
+        memmove( &( part -> data[ part -> used ] ), src, len );
+        part -> used += len;
+    }
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+static void CC release_out_file( void * item, void * data )
+{
+    out_file * of = item;
+    if ( of != NULL )
+    {
+        if ( of -> f != NULL )
+            KFileRelease( of -> f );
+        release_SBuffer( &( of -> name ) ); /* helper.c */
+        free( ( void * ) of );
+    }
+}
+
+static rc_t make_stdout_file( chunk_writer * self, struct KFile ** f )
+{
+    rc_t rc = KFileMakeStdOut( f );
+    if ( rc != 0 )
+        ErrMsg( "chunk_writer.c make_stdout_file().KFileMakeStdOut() -> %R", rc );
+    else if ( self -> buf_size > 0 )
+    {
+        struct KFile * tmp;
+        rc = KBufFileMakeWrite( &tmp, *f, false, self -> buf_size );
+        if ( rc != 0 )
+            ErrMsg( "chunk_writer.c make_stdout_file().KBufFileMakeWrite() -> %R", rc );
+        else
+        {
+            KFileRelease( *f );
+            *f = tmp;
+        }
+    }
+    if ( rc != 0 && *f != NULL )
+    {
+        KFileRelease( *f );
+        *f = NULL;
+    }
+    return rc;
+}
+
+static rc_t get_out_file( chunk_writer * self, uint32_t dst_id, out_file ** res )
+{
+    rc_t rc = 0;
+    out_file * of = VectorGet( &( self -> files ), dst_id );
+    if ( of == NULL )
+    {
+        of = calloc( 1, sizeof * of );
+        if ( of == NULL )
+        {
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "chunk_writer.c get_out_file().calloc( %d ) -> %R", ( sizeof * of ), rc );
+        }
+        else if ( self -> output_filename == NULL )
+            rc = make_stdout_file( self, &( of -> f ) ); /* above */
+        else
+        {
+            rc = split_filename_insert_idx( &( of -> name ), 4096, self -> output_filename, dst_id ); /* helper.c */
+            if ( rc != 0 )
+                of -> name . S . addr = NULL; /* has been released by split_filename_insert_idx() */
+            else
+                rc = make_compressed( self -> dir, of -> name . S . addr, self -> buf_size,
+                                      self -> compress, self -> force, self -> num_threads, &( of -> f ) ); /* concatenator.c */
+        }
+        if ( of != NULL )
+        {
+            if ( rc == 0 )
+            {
+                rc = VectorSet( &( self -> files ), dst_id, of );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c get_out_file().VectorSet( %u ) -> %R", dst_id, rc );
+            }
+            if ( rc != 0 )
+            {
+                release_out_file( of, NULL );
+                of = NULL;
+            }
+        }
+    }
+    *res = of;
+    return rc;
+}
+
+static rc_t write_chunk( chunk_writer * self, out_chunk * chunk )
+{
+    rc_t rc = 0;
+    uint32_t dst_id, n = VectorLength( &( chunk -> parts ) );
+    for ( dst_id = VectorStart( &( chunk -> parts ) ); rc == 0 && dst_id < n; ++dst_id )
+    {
+        chunk_part * part = VectorGet( &( chunk -> parts ), dst_id );
+        if ( part != NULL && part -> used > 0 )
+        {
+            out_file * of;
+            rc = get_out_file( self, dst_id, &of ); /* above */
+            if ( rc == 0 )
+            {
+                size_t num_writ;
+                rc = KFileWriteAll( of -> f, of -> pos, part -> data, part -> used, &num_writ );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c write_chunk().KFileWriteAll( at %lu ) -> %R", of -> pos, rc );
+                else if ( num_writ != part -> used )
+                {
+                    rc = RC( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+                    ErrMsg( "chunk_writer.c write_chunk().KFileWriteAll( at %lu ) -> %R", of -> pos, rc );
+                }
+                else
+                    of -> pos += num_writ;
+            }
+        }
+    }
+    return rc;
+}
+
+static rc_t write_pending_chunks( chunk_writer * self )
+{
+    rc_t rc = 0;
+    bool ready = true;
+    while ( rc == 0 && ready )
+    {
+        uint32_t slot = self -> next_write % self -> num_chunks;
+        out_chunk * chunk = self -> pending[ slot ];
+        ready = ( chunk != NULL && chunk -> seq == self -> next_write );
+        if ( ready )
+        {
+            rc = write_chunk( self, chunk ); /* above */
+            self -> pending[ slot ] = NULL;
+            self -> next_write++;
+            if ( rc == 0 )
+            {
+                VectorForEach( &( chunk -> parts ), false, clear_chunk_part, NULL );
+                rc = KQueuePush( self -> empty_q, chunk, NULL );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c write_pending_chunks().KQueuePush( empty_q ) -> %R", rc );
+            }
+        }
+    }
+    return rc;
+}
+
+static bool q_sealed( rc_t rc )
+{
+    return ( GetRCState( rc ) == rcDone && GetRCObject( rc ) == ( enum RCObject )rcData );
+}
+
+static rc_t CC chunk_writer_thread( const KThread * thread, void * data )
+{
+    chunk_writer * self = data;
+    rc_t rc = 0;
+    bool done = false;
+    while ( rc == 0 && !done )
+    {
+        out_chunk * chunk;
+        rc = KQueuePop( self -> done_q, ( void ** )&chunk, NULL );
+        if ( rc == 0 )
+        {
+            /* a failed join-thread: do not wait until it is this chunks turn */
+            rc = chunk -> rc;
+            if ( rc == 0 )
+            {
+                /* a join-thread can only take a number after it got a chunk, and a chunk only comes
+                   back after it has been written: all numbers in flight fit into the reorder-window */
+                self -> pending[ chunk -> seq % self -> num_chunks ] = chunk;
+                rc = write_pending_chunks( self ); /* above */
+            }
+        }
+        else if ( q_sealed( rc ) )
+        {
+            done = true;
+            rc = 0;
+        }
+        else
+            ErrMsg( "chunk_writer.c chunk_writer_thread().KQueuePop( done_q ) -> %R", rc );
+    }
+
+    /* the join-threads have to stop: they get an error as soon as they wait for an empty chunk */
+    if ( rc != 0 )
+        KQueueSeal( self -> empty_q );
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+rc_t chunk_writer_get( struct chunk_writer * self, struct out_chunk ** chunk )
+{
+    rc_t rc = KQueuePop( self -> empty_q, ( void ** )chunk, NULL );
+    if ( q_sealed( rc ) )
+    {
+        /* the empty_q has been sealed, this can only happen if the writer is in trouble! */
+        rc = RC( rcExe, rcFile, rcWriting, rcConstraint, rcViolated );
+        ErrMsg( "chunk_writer.c chunk_writer_get() : writer-thread failed -> %R", rc );
+    }
+    else if ( rc != 0 )
+        ErrMsg( "chunk_writer.c chunk_writer_get().KQueuePop( empty_q ) -> %R", rc );
+    return rc;
+}
+
+rc_t chunk_writer_put( struct chunk_writer * self, struct out_chunk * chunk, uint64_t seq, rc_t rc )
+{
+    rc_t rc1;
+    chunk -> seq = seq;
+    chunk -> rc = rc;
+    /* the done_q can hold all chunks, this never blocks */
+    rc1 = KQueuePush( self -> done_q, chunk, NULL );
+    if ( rc1 != 0 )
+        ErrMsg( "chunk_writer.c chunk_writer_put().KQueuePush( done_q ) -> %R", rc1 );
+    return rc1;
+}
+
+rc_t chunk_writer_return( struct chunk_writer * self, struct out_chunk * chunk )
+{
+    /* this fails only if the writer has sealed the empty_q, because it failed: the writer reports that */
+    KQueuePush( self -> empty_q, chunk, NULL );
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+typedef struct on_file_ctx
+{
+    uint32_t count;
+    out_file * single;
+    rc_t rc;
+} on_file_ctx;
+
+static void CC on_close_file( void * item, void * data )
+{
+    out_file * of = item;
+    if ( of != NULL )
+    {
+        on_file_ctx * ctx = data;
+        /* releasing the file flushes the buffers and finishes the compression */
+        rc_t rc = KFileRelease( of -> f );
+        of -> f = NULL;
+        if ( rc != 0 )
+        {
+            ErrMsg( "chunk_writer.c on_close_file().KFileRelease( '%s' ) -> %R",
+                    of -> name . S . addr != NULL ? of -> name . S . addr : "stdout", rc );
+            if ( ctx -> rc == 0 )
+                ctx -> rc = rc;
+        }
+        ctx -> count++;
+        ctx -> single = of;
+    }
+}
+
+rc_t release_chunk_writer( struct chunk_writer * self )
+{
+    rc_t rc = 0;
+    if ( self != NULL )
+    {
+        on_file_ctx ctx = { 0, NULL, 0 };
+
+        if ( self -> done_q != NULL )
+            KQueueSeal( self -> done_q );
+        if ( self -> writer != NULL )
+        {
+            KThreadWait( self -> writer, &rc );
+            KThreadRelease( self -> writer );
+        }
+
+        VectorForEach( &( self -> files ), false, on_close_file, &ctx );
+        if ( rc == 0 )
+            rc = ctx . rc;
+        if ( rc == 0 && ctx . count == 1 && self -> output_filename != NULL )
+        {
+            /* like the concatenator: only one file has been produced, it gets the name the user asked for */
+            if ( 0 != strcmp( ctx . single -> name . S . addr, self -> output_filename ) )
+                rc = rename_compressed( self -> dir, ctx . single -> name . S . addr, self -> output_filename,
+                                        self -> compress, self -> force ); /* concatenator.c */
+        }
+        VectorWhack( &( self -> files ), release_out_file, NULL );
+
+        if ( self -> empty_q != NULL )
+            KQueueRelease( self -> empty_q );
+        if ( self -> done_q != NULL )
+            KQueueRelease( self -> done_q );
+        if ( self -> chunks != NULL )
+        {
+            uint32_t i;
+            for ( i = 0; i < self -> num_chunks; ++i )
+                VectorWhack( &( self -> chunks[ i ] . parts ), release_chunk_part, NULL );
+            free( ( void * ) self -> chunks );
+        }
+        if ( self -> pending != NULL )
+            free( ( void * ) self -> pending );
+        free( ( void * ) self );
+    }
+    return rc;
+}
+
+rc_t make_chunk_writer( struct chunk_writer ** writer,
+                        KDirectory * dir,
+                        const char * output_filename,
+                        size_t buf_size,
+                        compress_t compress,
+                        bool force,
+                        uint32_t num_chunks,
+                        uint32_t num_threads )
+{
+    rc_t rc = 0;
+    if ( writer == NULL || dir == NULL || num_chunks == 0 )
+        rc = RC( rcExe, rcFile, rcConstructing, rcParam, rcNull );
+    else
+    {
+        chunk_writer * self = calloc( 1, sizeof * self );
+        *writer = NULL;
+        if ( self == NULL )
+        {
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "chunk_writer.c make_chunk_writer().calloc( %d ) -> %R", ( sizeof * self ), rc );
+        }
+        else
+        {
+            uint32_t i;
+
+            self -> dir = dir;
+            self -> output_filename = output_filename;
+            self -> buf_size = buf_size;
+            self -> compress = ( output_filename != NULL ) ? compress : ct_none;
+            self -> force = force;
+            self -> num_threads = num_threads;
+            self -> num_chunks = num_chunks;
+            VectorInit( &( self -> files ), 0, 4 );
+
+            self -> chunks = calloc( num_chunks, sizeof self -> chunks[ 0 ] );
+            self -> pending = calloc( num_chunks, sizeof self -> pending[ 0 ] );
+            if ( self -> chunks == NULL || self -> pending == NULL )
+            {
+                rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+                ErrMsg( "chunk_writer.c make_chunk_writer().calloc( %u chunks ) -> %R", num_chunks, rc );
+            }
+            else
+            {
+                for ( i = 0; i < num_chunks; ++i )
+                {
+                    VectorInit( &( self -> chunks[ i ] . parts ), 0, 4 );
+                    self -> chunks[ i ] . one_stream = ( output_filename == NULL );
+                }
+            }
+            if ( rc == 0 )
+            {
+                rc = KQueueMake( &( self -> empty_q ), num_chunks );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c make_chunk_writer().KQueueMake( empty_q ) -> %R", rc );
+            }
+            if ( rc == 0 )
+            {
+                rc = KQueueMake( &( self -> done_q ), num_chunks );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c make_chunk_writer().KQueueMake( done_q ) -> %R", rc );
+            }
+            for ( i = 0; rc == 0 && i < num_chunks; ++i )
+            {
+                rc = KQueuePush( self -> empty_q, &( self -> chunks[ i ] ), NULL );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c make_chunk_writer().KQueuePush( empty_q ) -> %R", rc );
+            }
+            if ( rc == 0 )
+            {
+                rc = helper_make_thread( &( self -> writer ), chunk_writer_thread, self, THREAD_DFLT_STACK_SIZE );
+                if ( rc != 0 )
+                    ErrMsg( "chunk_writer.c make_chunk_writer().helper_make_thread() -> %R", rc );
+            }
+
+            if ( rc == 0 )
+                *writer = self;
+            else
+                release_chunk_writer( self ); /* above */
+        }
+    }
+    return rc;
+}
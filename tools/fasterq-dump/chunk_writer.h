@@ -0,0 +1,94 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_chunk_writer_
+#define _h_chunk_writer_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_kfs_directory_
+#include <kfs/directory.h>
+#endif
+
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
+/* --------------------------------------------------------------------------------------
+    writes the output of the join-threads in row-order directly into the final files
+
+    - the SEQUENCE-table is cut into num_chunks small slices ( numbered 0...num_chunks-1 )
+    - a join-thread takes an empty chunk, prints into it, and puts it back with its number
+    - a writer-thread puts the chunks in order into the output-files ( one per dst_id )
+    - the number of chunks in flight is limited, a join-thread that runs too far ahead
+      waits in chunk_writer_get() until the writer has caught up
+
+    the output-file for a dst_id is created when the first bytes for it arrive
+    ( named by split_filename_insert_idx(), with .gz/.bz2 if compressed ),
+    if only one dst_id produced output, its file is renamed to output_filename
+
+    if output_filename is NULL, all dst_id's go to stdout ( uncompressed ), the chunks
+    are emitted in spot-order and memory is capped by the number of chunks
+-------------------------------------------------------------------------------------- */
+
+struct chunk_writer;
+struct out_chunk;
+
+rc_t make_chunk_writer( struct chunk_writer ** writer,
+                        KDirectory * dir,
+                        const char * output_filename,
+                        size_t buf_size,
+                        compress_t compress,
+                        bool force,
+                        uint32_t num_chunks,
+                        uint32_t num_threads );
+
+/* waits for the writer and returns its result */
+rc_t release_chunk_writer( struct chunk_writer * self );
+
+/* blocks until a chunk is available, fails if the writer had to stop */
+rc_t chunk_writer_get( struct chunk_writer * self, struct out_chunk ** chunk );
+
+/* hand a filled chunk to the writer, seq is its position in the output,
+   rc != 0 tells the writer that the chunk is incomplete ( the writer stops ) */
+rc_t chunk_writer_put( struct chunk_writer * self, struct out_chunk * chunk, uint64_t seq, rc_t rc );
+
+/* hand back a chunk that has not been used */
+rc_t chunk_writer_return( struct chunk_writer * self, struct out_chunk * chunk );
+
+rc_t out_chunk_write( struct out_chunk * self, uint32_t dst_id, const char * src, size_t len );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
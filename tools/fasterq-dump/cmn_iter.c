@@ -49,6 +49,7 @@ typedef struct cmn_iter
     struct num_gen * ranges;
     const struct num_gen_iter * row_iter;
     uint64_t row_count;
+    uint64_t bytes_read;    /* how many bytes we got from the cursor */
     int64_t first_row, row_id;
 } cmn_iter;
 
@@ -224,6 +225,14 @@ uint64_t cmn_iter_row_count( struct cmn_iter * self )
 }
 
 
+uint64_t cmn_iter_bytes_read( const struct cmn_iter * self )
+{
+    if ( self == NULL )
+        return 0;
+    return self -> bytes_read;
+}
+
+
 bool cmn_iter_next( struct cmn_iter * self, rc_t * rc )
 {
     if ( self == NULL )
@@ -296,12 +305,66 @@ rc_t cmn_iter_range( struct cmn_iter * self, uint32_t col_id )
 }
 
 
+/* restrict an already opened iterator to a new slice of rows, the cursor stays open:
+   this lets a join-thread process many small slices with only one cursor */
+rc_t cmn_iter_set_range( struct cmn_iter * self, int64_t first_row, uint64_t row_count )
+{
+    rc_t rc;
+    if ( self == NULL || self -> ranges == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcParam, rcInvalid );
+        ErrMsg( "cmn_iter.c cmn_iter_set_range() -> %R", rc );
+    }
+    else
+    {
+        if ( self -> row_iter != NULL )
+        {
+            num_gen_iterator_destroy( self -> row_iter );
+            self -> row_iter = NULL;
+        }
+        num_gen_destroy( self -> ranges );
+        self -> ranges = NULL;
+
+        rc = num_gen_make_sorted( &self -> ranges, true );
+        if ( rc != 0 )
+            ErrMsg( "cmn_iter.c cmn_iter_set_range().num_gen_make_sorted() -> %R\n", rc );
+        else
+        {
+            rc = num_gen_add( self -> ranges, first_row, row_count );
+            if ( rc != 0 )
+                ErrMsg( "cmn_iter.c cmn_iter_set_range().num_gen_add( %ld.%lu ) -> %R\n",
+                        first_row, row_count, rc );
+        }
+        if ( rc == 0 )
+        {
+            /* first_row / row_count are the range of the whole table ( set by cmn_iter_range() ) */
+            rc = make_row_iter( self -> ranges, self -> first_row, self -> row_count, &self -> row_iter );
+            if ( rc != 0 )
+                ErrMsg( "cmn_iter.c cmn_iter_set_range().make_row_iter( %ld.%lu ) -> %R\n", first_row, row_count, rc );
+        }
+    }
+    return rc;
+}
+
+
+/* all cmn_read_xxx() go through here, to count the bytes read */
+static rc_t cell_data( struct cmn_iter * self, uint32_t col_id, uint32_t * elem_bits,
+                       const void ** base, uint32_t * boff, uint32_t * row_len )
+{
+    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, elem_bits,
+                                     base, boff, row_len );
+    if ( rc == 0 )
+        self -> bytes_read += ( ( ( uint64_t )( *elem_bits ) * ( *row_len ) ) + 7 ) / 8;
+    return rc;
+}
+
+
 rc_t cmn_read_uint64( struct cmn_iter * self, uint32_t col_id, uint64_t *value )
 {
     uint32_t elem_bits, boff, row_len;
     const uint64_t * value_ptr;
-    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, &elem_bits,
-                                 (const void **)&value_ptr, &boff, &row_len );
+    rc_t rc = cell_data( self, col_id, &elem_bits,
+                           (const void **)&value_ptr, &boff, &row_len );
     if ( rc != 0 )
         ErrMsg( "cmn_iter.c cmn_read_uint64( #%ld ).VCursorCellDataDirect() -> %R\n", self -> row_id, rc );
     else if ( elem_bits != 64 || boff != 0 )
@@ -325,8 +388,8 @@ rc_t cmn_read_uint64_array( struct cmn_iter * self, uint32_t col_id, uint64_t *v
 {
     uint32_t elem_bits, boff, row_len;
     const uint64_t * value_ptr;
-    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, &elem_bits,
-                                 (const void **)&value_ptr, &boff, &row_len );
+    rc_t rc = cell_data( self, col_id, &elem_bits,
+                           (const void **)&value_ptr, &boff, &row_len );
     if ( rc != 0 )
         ErrMsg( "cmn_iter.c cmn_read_uint64_array( #%ld ).VCursorCellDataDirect() -> %R\n", self -> row_id, rc );
     else if ( elem_bits != 64 || boff != 0 )
@@ -352,8 +415,8 @@ rc_t cmn_read_uint32( struct cmn_iter * self, uint32_t col_id, uint32_t *value )
 {
     uint32_t elem_bits, boff, row_len;
     const uint32_t * value_ptr;
-    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, &elem_bits,
-                                 (const void **)&value_ptr, &boff, &row_len );
+    rc_t rc = cell_data( self, col_id, &elem_bits,
+                           (const void **)&value_ptr, &boff, &row_len );
     if ( rc != 0 )
         ErrMsg( "cmn_iter.c cmn_read_uint32( #%ld ).VCursorCellDataDirect() -> %R\n", self -> row_id, rc );
     else if ( elem_bits != 32 || boff != 0 )
@@ -375,8 +438,8 @@ rc_t cmn_read_uint32_array( struct cmn_iter * self, uint32_t col_id, uint32_t **
                             uint32_t * values_read )
 {
     uint32_t elem_bits, boff, row_len;
-    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, &elem_bits,
-                                 (const void **)values, &boff, &row_len );
+    rc_t rc = cell_data( self, col_id, &elem_bits,
+                           (const void **)values, &boff, &row_len );
     if ( rc != 0 )
         ErrMsg( "cmn_iter.c cmn_read_uint32_array( #%ld ).VCursorCellDataDirect() -> %R\n", self -> row_id, rc );
     else if ( elem_bits != 32 || boff != 0 || row_len < 1 )
@@ -396,8 +459,8 @@ rc_t cmn_read_uint8_array( struct cmn_iter * self, uint32_t col_id, uint8_t ** v
                             uint32_t * values_read )
 {
     uint32_t elem_bits, boff, row_len;
-    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, &elem_bits,
-                                 (const void **)values, &boff, &row_len );
+    rc_t rc = cell_data( self, col_id, &elem_bits,
+                           (const void **)values, &boff, &row_len );
     if ( rc != 0 )
         ErrMsg( "cmn_iter.c cmn_read_uint8_array( #%ld ).VCursorCellDataDirect() -> %R\n", self -> row_id, rc );
     else if ( elem_bits != 8 || boff != 0 )
@@ -416,8 +479,8 @@ rc_t cmn_read_uint8_array( struct cmn_iter * self, uint32_t col_id, uint8_t ** v
 rc_t cmn_read_String( struct cmn_iter * self, uint32_t col_id, String * value )
 {
     uint32_t elem_bits, boff;
-    rc_t rc = VCursorCellDataDirect( self -> cursor, self -> row_id, col_id, &elem_bits,
-                                 (const void **)&value->addr, &boff, &value -> len );
+    rc_t rc = cell_data( self, col_id, &elem_bits,
+                           (const void **)&value->addr, &boff, &value -> len );
     if ( rc != 0 )
         ErrMsg( "cmn_iter.c cmn_read_String( #%ld ).VCursorCellDataDirect() -> %R\n", self -> row_id, rc );
     else if ( elem_bits != 8 || boff != 0 )
@@ -51,11 +51,13 @@ rc_t make_cmn_iter( const cmn_params * cp, const char * tblname, struct cmn_iter
 
 rc_t cmn_iter_add_column( struct cmn_iter * self, const char * name, uint32_t * id );
 rc_t cmn_iter_range( struct cmn_iter * selfr, uint32_t col_id );
+rc_t cmn_iter_set_range( struct cmn_iter * self, int64_t first_row, uint64_t row_count );
 
 bool cmn_iter_next( struct cmn_iter * self, rc_t * rc );
 int64_t cmn_iter_row_id( const struct cmn_iter * self );
 
 uint64_t cmn_iter_row_count( struct cmn_iter * self );
+uint64_t cmn_iter_bytes_read( const struct cmn_iter * self );
 
 rc_t cmn_read_uint64( struct cmn_iter * self, uint32_t col_id, uint64_t *value );
 rc_t cmn_read_uint64_array( struct cmn_iter * self, uint32_t col_id, uint64_t *value,
@@ -27,6 +27,7 @@
 #include "concatenator.h"
 #include "helper.h"
 #include "copy_machine.h"
+#include "../util/bgzf_writer.h" /* shared with sam-dump */
 
 #include <klib/out.h>
 #include <klib/printf.h>
@@ -45,12 +46,23 @@ static const char * ct_none_fmt  = "%s";
 static const char * ct_gzip_fmt  = "%s.gz";
 static const char * ct_bzip2_fmt = "%s.bz2";
 
-static rc_t make_compressed( KDirectory * dir,
-                             const char * output_filename,
-                             size_t buf_size,
-                             compress_t compress,
-                             bool force,
-                             struct KFile ** dst )
+static const char * compressed_fmt( compress_t compress )
+{
+    switch( compress )
+    {
+        case ct_gzip  : return ct_gzip_fmt;
+        case ct_bzip2 : return ct_bzip2_fmt;
+        default       : return ct_none_fmt;
+    }
+}
+
+rc_t make_compressed( KDirectory * dir,
+                      const char * output_filename,
+                      size_t buf_size,
+                      compress_t compress,
+                      bool force,
+                      uint32_t num_threads,
+                      struct KFile ** dst )
 {
     rc_t rc = 0;
     if ( dst != NULL )
@@ -60,15 +72,9 @@ static rc_t make_compressed( KDirectory * dir,
     else
     {
         struct KFile * f;
-        const char * fmt;
+        const char * fmt = compressed_fmt( compress ); /* above */
         KCreateMode create_mode = force ? kcmInit : kcmCreate;
         
-        switch( compress )
-        {
-            case ct_none  : fmt = ct_none_fmt; break;
-            case ct_gzip  : fmt = ct_gzip_fmt; break;
-            case ct_bzip2 : fmt = ct_bzip2_fmt; break;
-        }
         rc = KDirectoryCreateFile( dir, &f, false, 0664, create_mode | kcmParents, fmt, output_filename );
         if ( rc != 0 )
             ErrMsg( "concatenator.c make_compressed().KDirectoryCreateFile( '%s' ) -> %R", output_filename, rc );
@@ -91,9 +97,10 @@ static rc_t make_compressed( KDirectory * dir,
                 struct KFile * tmp;
                 if ( compress == ct_gzip )
                 {
-                    rc = KFileMakeGzipForWrite ( &tmp, f );
+                    /* blocks are deflated in parallel, the output is BGZF ( still a valid .gz ) */
+                    rc = make_bgzf_writer( &tmp, f, num_threads, NULL ); /* bgzf_writer.c */
                     if ( rc != 0 )
-                        ErrMsg( "concatenator.c make_compressed().KFileMakeGzipForWrite( '%s' ) -> %R", output_filename, rc );
+                        ErrMsg( "concatenator.c make_compressed().make_bgzf_writer( '%s' ) -> %R", output_filename, rc );
                 }
                 else if ( compress == ct_bzip2 )
                 {
@@ -120,6 +127,41 @@ static rc_t make_compressed( KDirectory * dir,
     return rc;
 }
 
+rc_t rename_compressed( KDirectory * dir,
+                        const char * from,
+                        const char * to,
+                        compress_t compress,
+                        bool force )
+{
+    rc_t rc = 0;
+    if ( dir == NULL || from == NULL || to == NULL )
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcParam, rcNull );
+    else
+    {
+        char from_name[ 4096 ];
+        char to_name[ 4096 ];
+        size_t num_writ;
+        const char * fmt = compressed_fmt( compress ); /* above */
+        rc = string_printf( from_name, sizeof from_name, &num_writ, fmt, from );
+        if ( rc == 0 )
+            rc = string_printf( to_name, sizeof to_name, &num_writ, fmt, to );
+        if ( rc != 0 )
+            ErrMsg( "concatenator.c rename_compressed().string_printf() -> %R", rc );
+        else if ( !force && file_exists( dir, "%s", to_name ) )
+        {
+            rc = RC( rcExe, rcFile, rcPacking, rcName, rcExists );
+            ErrMsg( "concatenator.c rename_compressed( '%s' ) -> %R", to_name, rc );
+        }
+        else
+        {
+            rc = KDirectoryRename ( dir, true, from_name, to_name );
+            if ( rc != 0 )
+                ErrMsg( "concatenator.c rename_compressed().KDirectoryRename( '%s', '%s' ) -> %R", from_name, to_name, rc );
+        }
+    }
+    return rc;
+}
+
 /* ---------------------------------------------------------------------------------- */
 
 rc_t execute_concat_compressed( KDirectory * dir,
@@ -130,15 +172,24 @@ rc_t execute_concat_compressed( KDirectory * dir,
                     bool force,
                     bool append,
                     compress_t compress,
+                    uint32_t num_threads,
                     uint32_t count,
                     uint32_t q_wait_time )
 {
     struct KFile * dst;
-    rc_t rc =  make_compressed( dir, output_filename, buf_size, compress, force, &dst ); /* above */
+    rc_t rc =  make_compressed( dir, output_filename, buf_size, compress, force, num_threads, &dst ); /* above */
     if ( rc == 0 )
     {
+        rc_t rc2;
         rc = make_a_copy( dir, dst, files, progress, 0, buf_size, 0, q_wait_time ); /* copy_machine.c */
-        KFileRelease( dst );
+        /* releasing the file flushes the buffers and finishes the compression */
+        rc2 = KFileRelease( dst );
+        if ( rc2 != 0 )
+        {
+            ErrMsg( "concatenator.c execute_concat_compressed().KFileRelease( '%s' ) -> %R", output_filename, rc2 );
+            if ( rc == 0 )
+                rc = rc2;
+        }
     }
     return rc;
 }
@@ -295,7 +346,8 @@ rc_t execute_concat( KDirectory * dir,
                     struct bg_progress * progress,
                     bool force,
                     bool append,
-                    compress_t compress )
+                    compress_t compress,
+                    uint32_t num_threads )
 {
     uint32_t count;
     rc_t rc = VNameListCount( files, &count );
@@ -307,7 +359,7 @@ rc_t execute_concat( KDirectory * dir,
         if ( compress != ct_none )
         {
             rc = execute_concat_compressed( dir, output_filename, files, buf_size,
-                        progress, force, append, compress, count, q_wait_time ); /* above */
+                        progress, force, append, compress, num_threads, count, q_wait_time ); /* above */
         }
         else
         {
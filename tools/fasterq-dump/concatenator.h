@@ -51,6 +51,23 @@ extern "C" {
 #include "progress_thread.h"
 #endif
 
+/* create output_filename ( with .gz/.bz2 appended, according to compress ),
+   buffered by buf_size, gzip is produced as BGZF by num_threads threads ( bgzf_writer.c ) */
+rc_t make_compressed( KDirectory * dir,
+                      const char * output_filename,
+                      size_t buf_size,
+                      compress_t compress,
+                      bool force,
+                      uint32_t num_threads,
+                      struct KFile ** dst );
+
+/* rename a file made by make_compressed(), the names are given without the .gz/.bz2 suffix */
+rc_t rename_compressed( KDirectory * dir,
+                        const char * from,
+                        const char * to,
+                        compress_t compress,
+                        bool force );
+
 rc_t execute_concat( KDirectory * dir,
                     const char * output_filename,
                     const struct VNamelist * files,
@@ -58,7 +75,8 @@ rc_t execute_concat( KDirectory * dir,
                     struct bg_progress * progress,
                     bool force,
                     bool append,
-                    compress_t compress );
+                    compress_t compress,
+                    uint32_t num_threads );
 
 #ifdef __cplusplus
 }
@@ -27,6 +27,7 @@
 #include "cmn_iter.h"
 #include "sorter.h"
 #include "merge_sorter.h"
+#include "mem_lookup.h"
 #include "join.h"
 #include "tbl_join.h"
 #include "concatenator.h"
@@ -34,6 +35,8 @@
 #include "lookup_reader.h"
 #include "raw_read_iter.h"
 #include "temp_dir.h"
+#include "planner.h"
+#include "phase_report.h"
 
 #include <kapp/main.h>
 #include <kapp/args.h>
@@ -75,15 +78,18 @@ static const char * curcache_usage[] = { "size of cursor-cache dflt=10MB", NULL
 #define OPTION_CURCACHE "curcache"
 #define ALIAS_CURCACHE  "c"
 
-static const char * mem_usage[] = { "memory limit for sorting dflt=100MB", NULL };
+static const char * mem_usage[] = { "memory limit for sorting dflt=50MB or more if RAM allows", NULL };
 #define OPTION_MEM      "mem"
 #define ALIAS_MEM       "m"
 
+static const char * mem_lookup_usage[] = { "memory-budget for in-memory lookup, 0...use lookup-file dflt=1/4 of RAM", NULL };
+#define OPTION_MEM_LOOKUP "mem-lookup"
+
 static const char * temp_usage[] = { "where to put temp. files dflt=curr dir", NULL };
 #define OPTION_TEMP     "temp"
 #define ALIAS_TEMP      "t"
 
-static const char * threads_usage[] = { "how many thread dflt=6", NULL };
+static const char * threads_usage[] = { "how many thread dflt=cpu-cores ( 2...16 )", NULL };
 #define OPTION_THREADS  "threads"
 #define ALIAS_THREADS   "e"
 
@@ -110,8 +116,7 @@ static const char * stdout_usage[] = { "print output to stdout", NULL };
 #define OPTION_STDOUT    "stdout"
 #define ALIAS_STDOUT     "Z"
 
-/*
-static const char * gzip_usage[] = { "compress output using gzip", NULL };
+static const char * gzip_usage[] = { "compress output using gzip ( multithreaded, BGZF-blocks )", NULL };
 #define OPTION_GZIP      "gzip"
 #define ALIAS_GZIP       "g"
 
@@ -119,6 +124,7 @@ static const char * bzip2_usage[] = { "compress output using bzip2", NULL };
 #define OPTION_BZIP2     "bzip2"
 #define ALIAS_BZIP2      "z"
 
+/*
 static const char * maxfd_usage[] = { "maximal number of file-descriptors", NULL };
 #define OPTION_MAXFD     "maxfd"
 #define ALIAS_MAXFD      "a"
@@ -163,6 +169,9 @@ static const char * append_usage[] = { "append to output-file", NULL };
 static const char * ngc_usage[] = { "PATH to ngc file", NULL };
 #define OPTION_NGC   "ngc"
 
+static const char * report_usage[] = { "write a JSON-report about the time spent in each phase into this file", NULL };
+#define OPTION_REPORT   "report"
+
 OptDef ToolOptions[] =
 {
     { OPTION_FORMAT,    ALIAS_FORMAT,    NULL, format_usage,     1, true,   false },
@@ -171,6 +180,7 @@ OptDef ToolOptions[] =
     { OPTION_BUFSIZE,   ALIAS_BUFSIZE,   NULL, bufsize_usage,    1, true,   false },
     { OPTION_CURCACHE,  ALIAS_CURCACHE,  NULL, curcache_usage,   1, true,   false },
     { OPTION_MEM,       ALIAS_MEM,       NULL, mem_usage,        1, true,   false },
+    { OPTION_MEM_LOOKUP,NULL,            NULL, mem_lookup_usage, 1, true,   false },
     { OPTION_TEMP,      ALIAS_TEMP,      NULL, temp_usage,       1, true,   false },
     { OPTION_THREADS,   ALIAS_THREADS,   NULL, threads_usage,    1, true,   false },
     { OPTION_PROGRESS,  ALIAS_PROGRESS,  NULL, progress_usage,   1, false,  false },
@@ -180,8 +190,8 @@ OptDef ToolOptions[] =
     { OPTION_SPLIT_3,   ALIAS_SPLIT_3,   NULL, split_3_usage,    1, false,  false },
     { OPTION_WHOLE_SPOT,    NULL,        NULL, whole_spot_usage, 1, false,  false },    
     { OPTION_STDOUT,    ALIAS_STDOUT,    NULL, stdout_usage,     1, false,  false },
-/*    { OPTION_GZIP,      ALIAS_GZIP,      NULL, gzip_usage,       1, false,  false }, */
-/*    { OPTION_BZIP2,     ALIAS_BZIP2,     NULL, bzip2_usage,      1, false,  false }, */
+    { OPTION_GZIP,      ALIAS_GZIP,      NULL, gzip_usage,       1, false,  false },
+    { OPTION_BZIP2,     ALIAS_BZIP2,     NULL, bzip2_usage,      1, false,  false },
 /*    { OPTION_MAXFD,     ALIAS_MAXFD,     NULL, maxfd_usage,      1, true,   false }, */
     { OPTION_FORCE,     ALIAS_FORCE,     NULL, force_usage,      1, false,  false },
     { OPTION_RIDN,      ALIAS_RIDN,      NULL, ridn_usage,       1, false,  false },
@@ -194,6 +204,7 @@ OptDef ToolOptions[] =
     { OPTION_BASE_FLT,  ALIAS_BASE_FLT,  NULL, base_flt_usage,   10, true,  false },
     { OPTION_APPEND,    ALIAS_APPEND,    NULL, append_usage,     1, false,  false },
     { OPTION_NGC,       NULL,            NULL, ngc_usage, 1, true,  false },
+    { OPTION_REPORT,    NULL,            NULL, report_usage,     1, true,   false },
 };
 
 const char UsageDefaultName[] = "fasterq-dump";
@@ -233,6 +244,8 @@ rc_t CC Usage ( const Args * args )
         assert(opt);
         if (strcmp(opt->name, OPTION_NGC) == 0)
             param = "PATH";
+        else if (strcmp(opt->name, OPTION_REPORT) == 0)
+            param = "PATH";
 
         HelpOptionLine(opt->aliases, opt->name, param, opt->help);
     }
@@ -258,6 +271,7 @@ typedef struct tool_ctx_t
     const char * output_filename;
     const char * output_dirname;
     const char * seq_tbl_name;
+    const char * report_filename;
     
     struct temp_dir * temp_dir; /* temp_dir.h */
     
@@ -267,7 +281,11 @@ typedef struct tool_ctx_t
     
     struct KFastDumpCleanupTask * cleanup_task; /* cleanup_task.h */
     
-    size_t cursor_cache, buf_size, mem_limit;
+    struct mem_lookup * mem_lookup; /* mem_lookup.h ( NULL if the lookup-file is used ) */
+
+    struct phase_report * report; /* phase_report.h ( NULL if no report was asked for ) */
+    
+    size_t cursor_cache, buf_size, mem_limit, mem_lookup_budget;
 
     uint32_t num_threads /*, max_fds */;
     uint64_t total_ram;
@@ -277,6 +295,9 @@ typedef struct tool_ctx_t
     compress_t compress; /* helper.h */ 
 
     bool force, show_progress, show_details, append, stdout;
+
+    /* no option given for these: the planner picks them ( planner.c ) */
+    bool auto_threads, auto_mem_limit, auto_mem_lookup;
     
     join_options join_options; /* helper.h */
 } tool_ctx_t;
@@ -284,11 +305,19 @@ typedef struct tool_ctx_t
 /* taken form libs/kapp/main-priv.h */
 rc_t KAppGetTotalRam ( uint64_t * totalRam );
 
+/* no mem-lookup option given: the budget is derived from the total RAM */
+#define DFLT_MEM_LOOKUP_AUTO ( ( size_t ) -1 )
+
 static rc_t get_environment( tool_ctx_t * tool_ctx )
 {
     rc_t rc = KAppGetTotalRam ( &( tool_ctx -> total_ram ) );
     if ( rc != 0 )
         ErrMsg( "KAppGetTotalRam() -> %R", rc );
+    if ( tool_ctx -> mem_lookup_budget == DFLT_MEM_LOOKUP_AUTO )
+    {
+        /* if not given: use up to a quarter of the RAM for the in-memory lookup */
+        tool_ctx -> mem_lookup_budget = ( rc == 0 ) ? ( size_t )( tool_ctx -> total_ram / 4 ) : 0;
+    }
     if ( rc == 0 )
     {
         rc = KDirectoryNativeDir( &( tool_ctx -> dir ) );
@@ -305,6 +334,8 @@ static rc_t show_details( tool_ctx_t * tool_ctx )
         rc = KOutMsg( "buf-size     : %,ld bytes\n", tool_ctx -> buf_size );
     if ( rc == 0 )
         rc = KOutMsg( "mem-limit    : %,ld bytes\n", tool_ctx -> mem_limit );
+    if ( rc == 0 )
+        rc = KOutMsg( "mem-lookup   : %,ld bytes\n", tool_ctx -> mem_lookup_budget );
     if ( rc == 0 )
         rc = KOutMsg( "threads      : %d\n", tool_ctx -> num_threads );
     if ( rc == 0 )
@@ -323,6 +354,15 @@ static rc_t show_details( tool_ctx_t * tool_ctx )
             default                     : rc = KOutMsg( "unknow format\n" ); break;
         }
     }
+    if ( rc == 0 )
+    {
+        switch ( tool_ctx -> compress )
+        {
+            case ct_none                : rc = KOutMsg( "compression  : none\n" ); break;
+            case ct_gzip                : rc = KOutMsg( "compression  : gzip ( BGZF )\n" ); break;
+            case ct_bzip2               : rc = KOutMsg( "compression  : bzip2\n" ); break;
+        }
+    }
     if ( rc == 0 )
         rc = KOutMsg( "output-file  : '%s'\n", tool_ctx -> output_filename );
     if ( rc == 0 )    
@@ -344,10 +384,8 @@ static void get_user_input( tool_ctx_t * tool_ctx, const Args * args )
 {
     bool split_spot, split_file, split_3, whole_spot;
     
-    /*
     tool_ctx -> compress = get_compress_t( get_bool_option( args, OPTION_GZIP ),
-                                            get_bool_option( args, OPTION_BZIP2 ) ); helper.c */
-    tool_ctx -> compress = ct_none;
+                                            get_bool_option( args, OPTION_BZIP2 ) ); /* helper.c */
     
     tool_ctx -> cursor_cache = get_size_t_option( args, OPTION_CURCACHE, DFLT_CUR_CACHE );            
     tool_ctx -> show_progress = get_bool_option( args, OPTION_PROGRESS );
@@ -358,7 +396,11 @@ static void get_user_input( tool_ctx_t * tool_ctx, const Args * args )
     tool_ctx -> output_dirname = get_str_option( args, OPTION_OUTPUT_D, NULL );
     tool_ctx -> buf_size = get_size_t_option( args, OPTION_BUFSIZE, DFLT_BUF_SIZE );
     tool_ctx -> mem_limit = get_size_t_option( args, OPTION_MEM, DFLT_MEM_LIMIT );
+    tool_ctx -> mem_lookup_budget = get_size_t_option( args, OPTION_MEM_LOOKUP, DFLT_MEM_LOOKUP_AUTO );
     tool_ctx -> num_threads = get_uint32_t_option( args, OPTION_THREADS, DFLT_NUM_THREADS );
+    tool_ctx -> auto_threads = !get_bool_option( args, OPTION_THREADS );
+    tool_ctx -> auto_mem_limit = !get_bool_option( args, OPTION_MEM );
+    tool_ctx -> auto_mem_lookup = ( tool_ctx -> mem_lookup_budget == DFLT_MEM_LOOKUP_AUTO );
 
     tool_ctx -> join_options . rowid_as_name = get_bool_option( args, OPTION_RIDN );
     tool_ctx -> join_options . skip_tech = !( get_bool_option( args, OPTION_INCL_TECH ) );
@@ -381,6 +423,7 @@ static void get_user_input( tool_ctx_t * tool_ctx, const Args * args )
     tool_ctx -> seq_tbl_name = get_str_option( args, OPTION_TABLE, dflt_seq_tabl_name );
     tool_ctx -> append = get_bool_option( args, OPTION_APPEND );
     tool_ctx -> stdout = get_bool_option( args, OPTION_STDOUT );
+    tool_ctx -> report_filename = get_str_option( args, OPTION_REPORT, NULL );
 
     {
         const char * ngc = get_str_option(args, OPTION_NGC, NULL);
@@ -553,6 +596,8 @@ static rc_t populate_tool_ctx( tool_ctx_t * tool_ctx, const Args * args )
         tool_ctx -> lookup_filename[ 0 ] = 0;
         tool_ctx -> index_filename[ 0 ] = 0;
         tool_ctx -> dflt_output[ 0 ] = 0;
+        tool_ctx -> mem_lookup = NULL;
+        tool_ctx -> report = NULL;
     
         get_user_input( tool_ctx, args );
         encforce_constrains( tool_ctx );
@@ -565,6 +610,9 @@ static rc_t populate_tool_ctx( tool_ctx_t * tool_ctx, const Args * args )
     
     if ( rc == 0 )
         rc = handle_accession( tool_ctx );
+
+    if ( rc == 0 && tool_ctx -> report_filename != NULL )
+        rc = make_phase_report( &( tool_ctx -> report ) ); /* phase_report.c */
     
     if ( rc == 0 )
         rc = handle_lookup_path( tool_ctx );
@@ -661,7 +709,8 @@ static rc_t produce_lookup_files( tool_ctx_t * tool_ctx )
                                 tool_ctx -> num_threads,
                                 queue_timeout,
                                 tool_ctx -> buf_size,
-                                gap ); /* merge_sorter.c */
+                                gap,
+                                tool_ctx -> report ); /* merge_sorter.c */
 
     /* the background-vector-merger catches the KVectors produced by
        the lookup-produceer */
@@ -674,7 +723,8 @@ static rc_t produce_lookup_files( tool_ctx_t * tool_ctx )
                  tool_ctx -> num_threads,
                  queue_timeout,
                  tool_ctx -> buf_size,
-                 gap ); /* merge_sorter.c */
+                 gap,
+                 tool_ctx -> report ); /* merge_sorter.c */
         
 /* --------------------------------------------------------------------------------------------
     produce the lookup-table by iterating over the PRIMARY_ALIGNMENT - table:
@@ -695,6 +745,8 @@ static rc_t produce_lookup_files( tool_ctx_t * tool_ctx )
                                         tool_ctx -> vdb_mgr,
                                         tool_ctx -> accession_short,
                                         bg_vec_merger, /* drives the bg_file_merger */
+                                        NULL, /* no in-memory lookup */
+                                        tool_ctx -> report,
                                         tool_ctx -> cursor_cache,
                                         tool_ctx -> buf_size,
                                         tool_ctx -> mem_limit,
@@ -718,6 +770,62 @@ static rc_t produce_lookup_files( tool_ctx_t * tool_ctx )
 }
 
 
+/* --------------------------------------------------------------------------------------------
+    produce the lookup-table in memory:
+   -------------------------------------------------------------------------------------------- 
+    the same producers as above, but the packed reads go into a sharded hash-table
+    instead of KVectors, which would have to be merged into the lookup-file and its index.
+    If the memory-budget is exceeded, the table is dropped and we fall back to the
+    lookup-file ( produce_lookup_files() )
+-------------------------------------------------------------------------------------------- */
+
+static rc_t produce_lookup( tool_ctx_t * tool_ctx )
+{
+    rc_t rc = 0;
+    if ( tool_ctx -> mem_lookup_budget == 0 )
+        return produce_lookup_files( tool_ctx ); /* above */
+        
+    rc = make_mem_lookup( &( tool_ctx -> mem_lookup ), tool_ctx -> mem_lookup_budget ); /* mem_lookup.c */
+    if ( rc == 0 )
+        rc = execute_lookup_production( tool_ctx -> dir,
+                                        tool_ctx -> vdb_mgr,
+                                        tool_ctx -> accession_short,
+                                        NULL, /* no vector-merger */
+                                        tool_ctx -> mem_lookup,
+                                        tool_ctx -> report,
+                                        tool_ctx -> cursor_cache,
+                                        tool_ctx -> buf_size,
+                                        tool_ctx -> mem_limit,
+                                        tool_ctx -> num_threads,
+                                        tool_ctx -> show_progress ); /* sorter.c */
+    if ( rc != 0 )
+    {
+        release_mem_lookup( tool_ctx -> mem_lookup ); /* mem_lookup.c ( ignores NULL ) */
+        tool_ctx -> mem_lookup = NULL;
+        if ( mem_lookup_exhausted( rc ) ) /* mem_lookup.c */
+        {
+            if ( tool_ctx -> show_details )
+            {
+                KOutHandlerSetStdErr();
+                KOutMsg( "in-memory lookup exceeds %,lu bytes, falling back to lookup-file\n",
+                         tool_ctx -> mem_lookup_budget );
+                KOutHandlerSetStdOut();
+            }
+            rc = produce_lookup_files( tool_ctx ); /* above */
+        }
+        else
+            ErrMsg( "fasterq-dump.c produce_lookup() -> %R", rc );
+    }
+    else if ( tool_ctx -> show_details )
+    {
+        KOutHandlerSetStdErr();
+        KOutMsg( "in-memory lookup: %,lu reads in %,lu bytes\n",
+                 mem_lookup_count( tool_ctx -> mem_lookup ), mem_lookup_bytes( tool_ctx -> mem_lookup ) );
+        KOutHandlerSetStdOut();
+    }
+    return rc;
+}
+
 /* -------------------------------------------------------------------------------------------- */
 
 
@@ -725,6 +833,9 @@ static rc_t produce_final_db_output( tool_ctx_t * tool_ctx )
 {
     struct temp_registry * registry = NULL;
     join_stats stats;
+    /* the join-threads write directly into the output-file(s) or to stdout, unless we have
+       to append to an existing file: then they go through temp-files + concatenation */
+    bool direct_output = !( tool_ctx -> append );
     
     rc_t rc = make_temp_registry( &registry, tool_ctx -> cleanup_task ); /* temp_registry.c */
     
@@ -748,6 +859,7 @@ static rc_t produce_final_db_output( tool_ctx_t * tool_ctx )
                            &stats,
                            &tool_ctx -> lookup_filename[ 0 ],
                            &tool_ctx -> index_filename[ 0 ],
+                           tool_ctx -> mem_lookup,
                            tool_ctx -> temp_dir,
                            registry,
                            tool_ctx -> cursor_cache,
@@ -755,9 +867,17 @@ static rc_t produce_final_db_output( tool_ctx_t * tool_ctx )
                            tool_ctx -> num_threads,
                            tool_ctx -> show_progress,
                            tool_ctx -> fmt,
-                           & tool_ctx -> join_options ); /* join.c */
+                           & tool_ctx -> join_options,
+                           direct_output && tool_ctx -> stdout,
+                           direct_output ? tool_ctx -> output_filename : NULL,
+                           tool_ctx -> compress,
+                           tool_ctx -> force,
+                           tool_ctx -> report ); /* join.c */
+
+    /* from now on we do not need the lookup-table, the lookup-file and it's index any more... */
+    release_mem_lookup( tool_ctx -> mem_lookup ); /* mem_lookup.c ( ignores NULL ) */
+    tool_ctx -> mem_lookup = NULL;
 
-    /* from now on we do not need the lookup-file and it's index any more... */
     if ( tool_ctx -> lookup_filename[ 0 ] != 0 )
         KDirectoryRemove( tool_ctx -> dir, true, "%s", &tool_ctx -> lookup_filename[ 0 ] );
 
@@ -765,13 +885,17 @@ static rc_t produce_final_db_output( tool_ctx_t * tool_ctx )
         KDirectoryRemove( tool_ctx -> dir, true, "%s", &tool_ctx -> index_filename[ 0 ] );
 
     /* STEP 4 : concatenate output-chunks */
-    if ( rc == 0 )
+    if ( rc == 0 && !direct_output )
     {
         if ( tool_ctx -> stdout )
             rc = temp_registry_to_stdout( registry,
                                           tool_ctx -> dir,
                                           tool_ctx -> buf_size ); /* temp_registry.c */
         else
+        {
+            struct phase_timer * timer = phase_timer_start_process( tool_ctx -> report, ph_concat ); /* phase_report.c */
+            /* only the size of the temp-files is known here, the concatenator may compress */
+            phase_timer_add( timer, 0, temp_registry_total_size( registry, tool_ctx -> dir ), 0 ); /* temp_registry.c */
             rc = temp_registry_merge( registry,
                               tool_ctx -> dir,
                               tool_ctx -> output_filename,
@@ -779,7 +903,10 @@ static rc_t produce_final_db_output( tool_ctx_t * tool_ctx )
                               tool_ctx -> show_progress,
                               tool_ctx -> force,
                               tool_ctx -> compress,
-                              tool_ctx -> append ); /* temp_registry.c */
+                              tool_ctx -> append,
+                              tool_ctx -> num_threads ); /* temp_registry.c */
+            phase_timer_stop( timer ); /* phase_report.c */
+        }
     }
 
     /* in case some of the partial results have not been deleted be the concatenator */
@@ -847,18 +974,58 @@ static rc_t check_output_exits( tool_ctx_t * tool_ctx )
     return rc;
 }
 
+/* estimate what we need before we start, pick the values not given by the user,
+   refuse to start if there is not enough space for the temp-files or the output */
+static rc_t plan_resources( tool_ctx_t * tool_ctx, resource_plan * plan )
+{
+    plan_params params; /* planner.h */
+    rc_t rc;
+
+    params . dir                = tool_ctx -> dir;
+    params . vdb_mgr            = tool_ctx -> vdb_mgr;
+    params . accession_path     = tool_ctx -> accession_path;
+    params . accession_short    = tool_ctx -> accession_short;
+    params . temp_path          = get_temp_dir( tool_ctx -> temp_dir ); /* temp_dir.c */
+    params . output_filename    = tool_ctx -> stdout ? NULL : tool_ctx -> output_filename;
+    params . cursor_cache       = tool_ctx -> cursor_cache;
+    params . total_ram          = tool_ctx -> total_ram;
+    params . fmt                = tool_ctx -> fmt;
+    params . compress           = tool_ctx -> compress;
+    params . append             = tool_ctx -> append;
+    params . num_threads        = tool_ctx -> num_threads;
+    params . mem_limit          = tool_ctx -> mem_limit;
+    params . mem_lookup_budget  = tool_ctx -> mem_lookup_budget;
+    params . auto_threads       = tool_ctx -> auto_threads;
+    params . auto_mem_limit     = tool_ctx -> auto_mem_limit;
+    params . auto_mem_lookup    = tool_ctx -> auto_mem_lookup;
+
+    rc = make_resource_plan( &params, plan ); /* planner.c */
+    if ( rc == 0 )
+    {
+        tool_ctx -> num_threads         = plan -> num_threads;
+        tool_ctx -> mem_limit           = plan -> mem_limit;
+        tool_ctx -> mem_lookup_budget   = plan -> mem_lookup_budget;
+    }
+    return rc;
+}
+
 static rc_t fastdump_csra( tool_ctx_t * tool_ctx )
 {
-    rc_t rc = 0;
+    resource_plan plan; /* planner.h */
+    rc_t rc = plan_resources( tool_ctx, &plan ); /* above */
     
-    if ( tool_ctx -> show_details )
+    if ( rc == 0 && tool_ctx -> show_details )
+    {
         rc = show_details( tool_ctx ); /* above */
+        if ( rc == 0 )
+            rc = print_resource_plan( &plan ); /* planner.c */
+    }
 
     if ( rc == 0 )
         rc = check_output_exits( tool_ctx ); /* above */
     
     if ( rc == 0 )
-        rc = produce_lookup_files( tool_ctx ); /* above */
+        rc = produce_lookup( tool_ctx ); /* above */
 
     if ( rc == 0 )
         rc = produce_final_db_output( tool_ctx ); /* above */
@@ -900,7 +1067,8 @@ static rc_t fastdump_table( tool_ctx_t * tool_ctx, const char * tbl_name )
                            tool_ctx -> num_threads,
                            tool_ctx -> show_progress,
                            tool_ctx -> fmt,
-                           & tool_ctx -> join_options ); /* tbl_join.c */
+                           & tool_ctx -> join_options,
+                           tool_ctx -> report ); /* tbl_join.c */
 
     if ( rc == 0 )
     {
@@ -909,6 +1077,10 @@ static rc_t fastdump_table( tool_ctx_t * tool_ctx, const char * tbl_name )
                                           tool_ctx -> dir,
                                           tool_ctx -> buf_size ); /* temp_registry.c */
         else
+        {
+            struct phase_timer * timer = phase_timer_start_process( tool_ctx -> report, ph_concat ); /* phase_report.c */
+            /* only the size of the temp-files is known here, the concatenator may compress */
+            phase_timer_add( timer, 0, temp_registry_total_size( registry, tool_ctx -> dir ), 0 ); /* temp_registry.c */
             rc = temp_registry_merge( registry,
                               tool_ctx -> dir,
                               tool_ctx -> output_filename,
@@ -916,7 +1088,10 @@ static rc_t fastdump_table( tool_ctx_t * tool_ctx, const char * tbl_name )
                               tool_ctx -> show_progress,
                               tool_ctx -> force,
                               tool_ctx -> compress,
-                              tool_ctx -> append ); /* temp_registry.c */
+                              tool_ctx -> append,
+                              tool_ctx -> num_threads ); /* temp_registry.c */
+            phase_timer_stop( timer ); /* phase_report.c */
+        }
     }
     
     if ( registry != NULL )
@@ -999,6 +1174,16 @@ rc_t CC KMain ( int argc, char *argv [] )
                 {
                     rc = perform_tool( &tool_ctx );     /* above */
 
+                    if ( tool_ctx . report != NULL )
+                    {
+                        rc_t rc1 = write_phase_report( tool_ctx . report, tool_ctx . dir,
+                                                       tool_ctx . accession_short, rc,
+                                                       tool_ctx . report_filename ); /* phase_report.c */
+                        if ( rc == 0 )
+                            rc = rc1;
+                        release_phase_report( tool_ctx . report ); /* phase_report.c */
+                    }
+
                     KDirectoryRelease( tool_ctx . dir );
                     destroy_temp_dir( tool_ctx . temp_dir ); /* temp_dir.c */
                     VDBManagerRelease( tool_ctx . vdb_mgr );
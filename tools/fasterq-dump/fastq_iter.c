@@ -256,6 +256,16 @@ uint64_t get_row_count_of_fastq_csra_iter( struct fastq_csra_iter * self )
     return cmn_iter_row_count( self -> cmn );
 }
 
+uint64_t get_bytes_read_of_fastq_csra_iter( struct fastq_csra_iter * self )
+{
+    return cmn_iter_bytes_read( self -> cmn );
+}
+
+rc_t fastq_csra_iter_set_range( struct fastq_csra_iter * self, int64_t first_row, uint64_t row_count )
+{
+    return cmn_iter_set_range( self -> cmn, first_row, row_count ); /* cmn_iter.c */
+}
+
 /* ------------------------------------------------------------------------------------------------------------- */
 
 typedef struct fastq_sra_iter
@@ -400,3 +410,8 @@ uint64_t get_row_count_of_fastq_sra_iter( struct fastq_sra_iter * self )
 {
     return cmn_iter_row_count( self -> cmn );
 }
+
+uint64_t get_bytes_read_of_fastq_sra_iter( struct fastq_sra_iter * self )
+{
+    return cmn_iter_bytes_read( self -> cmn );
+}
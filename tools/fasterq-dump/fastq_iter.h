@@ -74,6 +74,8 @@ rc_t make_fastq_csra_iter( const cmn_params * params,
                          
 bool get_from_fastq_csra_iter( struct fastq_csra_iter * self, fastq_rec * rec, rc_t * rc );
 uint64_t get_row_count_of_fastq_csra_iter( struct fastq_csra_iter * self );
+uint64_t get_bytes_read_of_fastq_csra_iter( struct fastq_csra_iter * self );
+rc_t fastq_csra_iter_set_range( struct fastq_csra_iter * self, int64_t first_row, uint64_t row_count );
 
 struct fastq_sra_iter;
 
@@ -85,6 +87,7 @@ rc_t make_fastq_sra_iter( const cmn_params * params,
 
 bool get_from_fastq_sra_iter( struct fastq_sra_iter * self, fastq_rec * rec, rc_t * rc );
 uint64_t get_row_count_of_fastq_sra_iter( struct fastq_sra_iter * self );
+uint64_t get_bytes_read_of_fastq_sra_iter( struct fastq_sra_iter * self );
 
 #ifdef __cplusplus
 }
@@ -37,6 +37,12 @@
 #include <kdb/manager.h>
 #include <vdb/manager.h>
 
+#include <string.h>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
 rc_t ErrMsg( const char * fmt, ... )
 {
     rc_t rc;
@@ -398,193 +404,366 @@ uint64_t make_key( int64_t seq_spot_id, uint32_t seq_read_id )
     return key;
 }
 
-rc_t pack_4na( const String * unpacked, SBuffer * packed )
+/* ------------------------------------------------------------------------------------------
+
+    packed bases, as stored in the lookup-file / lookup-table:
+
+    [ dna-len : 16 bit BE ][ N-run-count : 16 bit BE ][ 2na : 4 bases per byte ][ N-runs ]
+
+    every base is 2 bits ( A=0, C=1, G=2, T=3 ), the first base in the high bits of a byte.
+    the only other base we can emit is 'N' ( the 4na-codes of the IUPAC-ambiguities are
+    printed as 'N' too ), its positions are stored as runs of ( start : 16 bit BE, len : 16 bit BE )
+    after the 2na-bytes, in the 2na they are 'A'. this takes a little more than half of
+    the space of 4na for typical reads.
+
+   ------------------------------------------------------------------------------------------ */
+
+#define PACKED_2NA_RUN 4
+
+static size_t packed_2na_data_size( uint32_t dna_len )
 {
-    rc_t rc = 0;
-    if ( unpacked -> len < 1 )
-        rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcNull );
+    return ( dna_len + 3 ) >> 2;
+}
+
+size_t packed_2na_size( const uint8_t * hdr )
+{
+    uint32_t dna_len = ( ( uint32_t )hdr[ 0 ] << 8 ) | hdr[ 1 ];
+    uint32_t n_runs = ( ( uint32_t )hdr[ 2 ] << 8 ) | hdr[ 3 ];
+    return PACKED_2NA_HDR + packed_2na_data_size( dna_len ) + ( n_runs * PACKED_2NA_RUN );
+}
+
+static void put_u16( uint8_t * dst, uint32_t value )
+{
+    dst[ 0 ] = ( value >> 8 ) & 0xFF;
+    dst[ 1 ] = value & 0xFF;
+}
+
+typedef struct n_runs
+{
+    uint8_t * dst;      /* points behind the 2na-bytes */
+    uint32_t count;
+    uint32_t start;     /* of the current run */
+    uint32_t end;       /* 1 behind the current run */
+} n_runs;
+
+static void add_N( n_runs * runs, uint32_t pos )
+{
+    if ( runs -> count > 0 && runs -> end == pos )
+        runs -> end++;
     else
     {
-        if ( unpacked -> len > 0xFFFF )
-            rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcExcessive );
-        else
-        {
-            uint32_t i;
-            uint8_t * src = ( uint8_t * )unpacked -> addr;
-            uint8_t * dst = ( uint8_t * )packed -> S . addr;
-            uint16_t dna_len = ( unpacked -> len & 0xFFFF );
-            uint32_t len = 0;
-            dst[ len++ ] = ( dna_len >> 8 );
-            dst[ len++ ] = ( dna_len & 0xFF );
-            for ( i = 0; i < unpacked -> len; ++i )
-            {
-                if ( len < packed -> buffer_size )
-                {
-                    uint8_t base = ( src[ i ] & 0x0F );
-                    if ( 0 == ( i & 0x01 ) )
-                        dst[ len ] = ( base << 4 );
-                    else
-                        dst[ len++ ] |= base;
-                }
-            }
-            if ( unpacked -> len & 0x01 )
-                len++;
-            packed -> S . size = packed -> S . len = len;
-        }
+        if ( runs -> count > 0 )
+            put_u16( runs -> dst + ( ( runs -> count - 1 ) * PACKED_2NA_RUN ) + 2, runs -> end - runs -> start );
+        put_u16( runs -> dst + ( runs -> count * PACKED_2NA_RUN ), pos );
+        runs -> count++;
+        runs -> start = pos;
+        runs -> end = pos + 1;
     }
-    return rc;
 }
 
-static const char xASCII_to_4na[ 256 ] =
+static void finish_N( n_runs * runs )
+{
+    if ( runs -> count > 0 )
+        put_u16( runs -> dst + ( ( runs -> count - 1 ) * PACKED_2NA_RUN ) + 2, runs -> end - runs -> start );
+}
+
+/* 0..3 for the bases, 4 for anything that has to be printed as 'N' */
+static const uint8_t xASCII_to_2na[ 256 ] =
 {
     /* 0x00 0x01 0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0A 0x0B 0x0C 0x0D 0x0E 0x0F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x10 0x11 0x12 0x13 0x14 0x15 0x16 0x17 0x18 0x19 0x1A 0x1B 0x1C 0x1D 0x1E 0x1F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x20 0x21 0x22 0x23 0x24 0x25 0x26 0x27 0x28 0x29 0x2A 0x2B 0x2C 0x2D 0x2E 0x2F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x30 0x31 0x32 0x33 0x34 0x35 0x36 0x37 0x38 0x39 0x3A 0x3B 0x3C 0x3D 0x3E 0x3F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x40 0x41 0x42 0x43 0x44 0x45 0x46 0x47 0x48 0x49 0x4A 0x4B 0x4C 0x4D 0x4E 0x4F */
     /* @    A    B    C    D    E    F    G    H    I    J    K    L    M    N    O */
-       0,   1,   0,   2,   0,   0,   0,   4,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   0,   4,   1,   4,   4,   4,   2,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x50 0x51 0x52 0x53 0x54 0x55 0x56 0x57 0x58 0x59 0x5A 0x5B 0x5C 0x5D 0x5E 0x5F */
     /* P    Q    R    S    T    U    V    W    X    Y    Z    [    \    ]    ^    _ */
-       0,   0,   0,   0,   8,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   3,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x60 0x61 0x62 0x63 0x64 0x65 0x66 0x67 0x68 0x69 0x6A 0x6B 0x6C 0x6D 0x6E 0x6F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
 
     /* 0x70 0x71 0x72 0x73 0x74 0x75 0x76 0x77 0x78 0x79 0x7A 0x7B 0x7C 0x7D 0x7E 0x7F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-
-    /* 0x80 0x81 0x82 0x83 0x84 0x85 0x86 0x87 0x88 0x89 0x8A 0x8B 0x8C 0x8D 0x8E 0x8F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-
-    /* 0x90 0x91 0x92 0x93 0x94 0x95 0x96 0x97 0x98 0x99 0x9A 0x9B 0x9C 0x9D 0x9E 0x9F */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+
+    /* 0x80 .. 0xFF */
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,
+       4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4,   4
+};
 
-    /* 0xA0 0xA1 0xA2 0xA3 0xA4 0xA5 0xA6 0xA7 0xA8 0xA9 0xAA 0xAB 0xAC 0xAD 0xAE 0xAF */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+static const uint8_t x4na_to_2na[ 16 ] =
+{
+    /* 0x00 0x01 0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0A 0x0B 0x0C 0x0D 0x0E 0x0F */
+       4,   0,   1,   4,   2,   4,   4,   4,   3,   4,   4,   4,   4,   4,   4,   4
+};
 
-    /* 0xB0 0xB1 0xB2 0xB3 0xB4 0xB5 0xB6 0xB7 0xB8 0xB9 0xBA 0xBB 0xBC 0xBD 0xBE 0xBF */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+static void pack_2na_scalar( const uint8_t * src, uint32_t from, uint32_t to,
+                             const uint8_t * table, uint8_t mask,
+                             uint8_t * dst, n_runs * runs )
+{
+    uint32_t i;
+    for ( i = from; i < to; ++i )
+    {
+        uint8_t code = table[ src[ i ] & mask ];
+        if ( code > 3 )
+            add_N( runs, i );
+        else
+            dst[ i >> 2 ] |= ( code << ( 6 - ( ( i & 3 ) << 1 ) ) );
+    }
+}
 
-    /* 0xC0 0xC1 0xC2 0xC3 0xC4 0xC5 0xC6 0xC7 0xC8 0xC9 0xCA 0xCB 0xCC 0xCD 0xCE 0xCF */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+#if defined( __SSE2__ )
 
-    /* 0xD0 0xD1 0xD2 0xD3 0xD4 0xD5 0xD6 0xD7 0xD8 0xD9 0xDA 0xDB 0xDC 0xDD 0xDE 0xDF */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+/* spreads 4 bits into the 4 even bit-positions of a 2na-byte, first base in the high bits */
+static const uint8_t spread_4_bits[ 16 ] =
+{
+    0x00, 0x40, 0x10, 0x50, 0x04, 0x44, 0x14, 0x54,
+    0x01, 0x41, 0x11, 0x51, 0x05, 0x45, 0x15, 0x55
+};
 
-    /* 0xE0 0xE1 0xE2 0xE3 0xE4 0xE5 0xE6 0xE7 0xE8 0xE9 0xEA 0xEB 0xEC 0xED 0xEE 0xEF */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+/* packs 16 ASCII-bases per round: low bit = C|T, high bit = G|T, N where none of ACGT matches */
+static uint32_t pack_ASCII_2na_sse2( const uint8_t * src, uint32_t len, uint8_t * dst, n_runs * runs )
+{
+    const __m128i vA = _mm_set1_epi8( 'A' );
+    const __m128i vC = _mm_set1_epi8( 'C' );
+    const __m128i vG = _mm_set1_epi8( 'G' );
+    const __m128i vT = _mm_set1_epi8( 'T' );
+    uint32_t i;
+    for ( i = 0; ( i + 16 ) <= len; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128( ( const __m128i * )( src + i ) );
+        __m128i c = _mm_cmpeq_epi8( v, vC );
+        __m128i g = _mm_cmpeq_epi8( v, vG );
+        __m128i t = _mm_cmpeq_epi8( v, vT );
+        uint32_t lo = _mm_movemask_epi8( _mm_or_si128( c, t ) );
+        uint32_t hi = _mm_movemask_epi8( _mm_or_si128( g, t ) );
+        uint32_t acgt = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( v, vA ),
+                                           _mm_or_si128( c, _mm_or_si128( g, t ) ) ) );
+        uint8_t * d = dst + ( i >> 2 );
+        d[ 0 ] = spread_4_bits[ lo & 0x0F ] | ( spread_4_bits[ hi & 0x0F ] << 1 );
+        d[ 1 ] = spread_4_bits[ ( lo >> 4 ) & 0x0F ] | ( spread_4_bits[ ( hi >> 4 ) & 0x0F ] << 1 );
+        d[ 2 ] = spread_4_bits[ ( lo >> 8 ) & 0x0F ] | ( spread_4_bits[ ( hi >> 8 ) & 0x0F ] << 1 );
+        d[ 3 ] = spread_4_bits[ ( lo >> 12 ) & 0x0F ] | ( spread_4_bits[ ( hi >> 12 ) & 0x0F ] << 1 );
+        if ( acgt != 0xFFFF )
+        {
+            uint32_t j, n = ~acgt & 0xFFFF;
+            for ( j = 0; j < 16; ++j )
+            {
+                if ( n & ( 1 << j ) )
+                    add_N( runs, i + j );
+            }
+        }
+    }
+    return i;
+}
 
-    /* 0xF0 0xF1 0xF2 0xF3 0xF4 0xF5 0xF6 0xF7 0xF8 0xF9 0xFA 0xFB 0xFC 0xFD 0xFE 0xFF */
-       0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0
-};
+#endif
 
-rc_t pack_read_2_4na( const String * read, SBuffer * packed )
+static rc_t pack_2na( const String * bases, bool ascii, SBuffer * packed )
 {
     rc_t rc = 0;
-    if ( read -> len < 1 )
+    if ( bases -> len < 1 )
         rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcNull );
+    else if ( bases -> len > 0xFFFF )
+        rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcExcessive );
     else
     {
-        if ( read -> len > 0xFFFF )
-            rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcExcessive );
-        else
+        uint32_t dna_len = bases -> len;
+        size_t data_size = packed_2na_data_size( dna_len );
+        /* worst case: every other base is a 'N' */
+        size_t needed = PACKED_2NA_HDR + data_size + ( ( ( dna_len + 1 ) >> 1 ) * PACKED_2NA_RUN );
+        if ( packed -> buffer_size < needed )
+            rc = increase_SBuffer( packed, needed - packed -> buffer_size );
+        if ( rc == 0 )
         {
-            uint32_t i;
-            uint8_t * src = ( uint8_t * )read -> addr;
+            const uint8_t * src = ( const uint8_t * )bases -> addr;
             uint8_t * dst = ( uint8_t * )packed -> S . addr;
-            uint16_t dna_len = ( read -> len & 0xFFFF );
-            uint32_t len = 0;
-            dst[ len++ ] = ( dna_len >> 8 );
-            dst[ len++ ] = ( dna_len & 0xFF );
-            for ( i = 0; i < read -> len; ++i )
+            uint8_t * data = dst + PACKED_2NA_HDR;
+            uint32_t done = 0;
+            n_runs runs;
+
+            runs . dst = data + data_size;
+            runs . count = 0;
+            memset( data, 0, data_size );
+            if ( ascii )
             {
-                if ( len < packed -> buffer_size )
-                {
-                    uint8_t base = ( xASCII_to_4na[ src[ i ] ] & 0x0F );
-                    if ( 0 == ( i & 0x01 ) )
-                        dst[ len ] = ( base << 4 );
-                    else
-                        dst[ len++ ] |= base;
-                }
+#if defined( __SSE2__ )
+                done = pack_ASCII_2na_sse2( src, dna_len, data, &runs );
+#endif
+                pack_2na_scalar( src, done, dna_len, xASCII_to_2na, 0xFF, data, &runs );
             }
-            if ( read -> len & 0x01 )
-                len++;
-            packed -> S . size = packed -> S . len = len;
+            else
+                pack_2na_scalar( src, 0, dna_len, x4na_to_2na, 0x0F, data, &runs );
+            finish_N( &runs );
+
+            put_u16( dst, dna_len );
+            put_u16( dst + 2, runs . count );
+            packed -> S . size = PACKED_2NA_HDR + data_size + ( runs . count * PACKED_2NA_RUN );
+            packed -> S . len = ( uint32_t )packed -> S . size;
         }
     }
     return rc;
 }
 
-static const char x4na_to_ASCII_fwd[ 16 ] =
+rc_t pack_4na_2_2na( const String * unpacked, SBuffer * packed )
 {
-    /* 0x00 0x01 0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0A 0x0B 0x0C 0x0D 0x0E 0x0F */
-       'N', 'A', 'C', 'N', 'G', 'N', 'N', 'N', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N'
+    return pack_2na( unpacked, false, packed );
+}
+
+rc_t pack_read_2_2na( const String * read, SBuffer * packed )
+{
+    return pack_2na( read, true, packed );
+}
+
+/* 4 ASCII-bases for every 2na-byte, in reverse: complemented and in reverse order */
+static const char x2na_to_ASCII_fwd[ 1024 ] =
+{
+    "AAAA" "AAAC" "AAAG" "AAAT" "AACA" "AACC" "AACG" "AACT"
+    "AAGA" "AAGC" "AAGG" "AAGT" "AATA" "AATC" "AATG" "AATT"
+    "ACAA" "ACAC" "ACAG" "ACAT" "ACCA" "ACCC" "ACCG" "ACCT"
+    "ACGA" "ACGC" "ACGG" "ACGT" "ACTA" "ACTC" "ACTG" "ACTT"
+    "AGAA" "AGAC" "AGAG" "AGAT" "AGCA" "AGCC" "AGCG" "AGCT"
+    "AGGA" "AGGC" "AGGG" "AGGT" "AGTA" "AGTC" "AGTG" "AGTT"
+    "ATAA" "ATAC" "ATAG" "ATAT" "ATCA" "ATCC" "ATCG" "ATCT"
+    "ATGA" "ATGC" "ATGG" "ATGT" "ATTA" "ATTC" "ATTG" "ATTT"
+    "CAAA" "CAAC" "CAAG" "CAAT" "CACA" "CACC" "CACG" "CACT"
+    "CAGA" "CAGC" "CAGG" "CAGT" "CATA" "CATC" "CATG" "CATT"
+    "CCAA" "CCAC" "CCAG" "CCAT" "CCCA" "CCCC" "CCCG" "CCCT"
+    "CCGA" "CCGC" "CCGG" "CCGT" "CCTA" "CCTC" "CCTG" "CCTT"
+    "CGAA" "CGAC" "CGAG" "CGAT" "CGCA" "CGCC" "CGCG" "CGCT"
+    "CGGA" "CGGC" "CGGG" "CGGT" "CGTA" "CGTC" "CGTG" "CGTT"
+    "CTAA" "CTAC" "CTAG" "CTAT" "CTCA" "CTCC" "CTCG" "CTCT"
+    "CTGA" "CTGC" "CTGG" "CTGT" "CTTA" "CTTC" "CTTG" "CTTT"
+    "GAAA" "GAAC" "GAAG" "GAAT" "GACA" "GACC" "GACG" "GACT"
+    "GAGA" "GAGC" "GAGG" "GAGT" "GATA" "GATC" "GATG" "GATT"
+    "GCAA" "GCAC" "GCAG" "GCAT" "GCCA" "GCCC" "GCCG" "GCCT"
+    "GCGA" "GCGC" "GCGG" "GCGT" "GCTA" "GCTC" "GCTG" "GCTT"
+    "GGAA" "GGAC" "GGAG" "GGAT" "GGCA" "GGCC" "GGCG" "GGCT"
+    "GGGA" "GGGC" "GGGG" "GGGT" "GGTA" "GGTC" "GGTG" "GGTT"
+    "GTAA" "GTAC" "GTAG" "GTAT" "GTCA" "GTCC" "GTCG" "GTCT"
+    "GTGA" "GTGC" "GTGG" "GTGT" "GTTA" "GTTC" "GTTG" "GTTT"
+    "TAAA" "TAAC" "TAAG" "TAAT" "TACA" "TACC" "TACG" "TACT"
+    "TAGA" "TAGC" "TAGG" "TAGT" "TATA" "TATC" "TATG" "TATT"
+    "TCAA" "TCAC" "TCAG" "TCAT" "TCCA" "TCCC" "TCCG" "TCCT"
+    "TCGA" "TCGC" "TCGG" "TCGT" "TCTA" "TCTC" "TCTG" "TCTT"
+    "TGAA" "TGAC" "TGAG" "TGAT" "TGCA" "TGCC" "TGCG" "TGCT"
+    "TGGA" "TGGC" "TGGG" "TGGT" "TGTA" "TGTC" "TGTG" "TGTT"
+    "TTAA" "TTAC" "TTAG" "TTAT" "TTCA" "TTCC" "TTCG" "TTCT"
+    "TTGA" "TTGC" "TTGG" "TTGT" "TTTA" "TTTC" "TTTG" "TTTT"
 };
 
-static const char x4na_to_ASCII_rev[ 16 ] =
+static const char x2na_to_ASCII_rev[ 1024 ] =
 {
-    /* 0x00 0x01 0x02 0x03 0x04 0x05 0x06 0x07 0x08 0x09 0x0A 0x0B 0x0C 0x0D 0x0E 0x0F */
-       'N', 'T', 'G', 'N', 'C', 'N', 'N', 'N', 'A', 'N', 'N', 'N', 'N', 'N', 'N', 'N'
+    "TTTT" "GTTT" "CTTT" "ATTT" "TGTT" "GGTT" "CGTT" "AGTT"
+    "TCTT" "GCTT" "CCTT" "ACTT" "TATT" "GATT" "CATT" "AATT"
+    "TTGT" "GTGT" "CTGT" "ATGT" "TGGT" "GGGT" "CGGT" "AGGT"
+    "TCGT" "GCGT" "CCGT" "ACGT" "TAGT" "GAGT" "CAGT" "AAGT"
+    "TTCT" "GTCT" "CTCT" "ATCT" "TGCT" "GGCT" "CGCT" "AGCT"
+    "TCCT" "GCCT" "CCCT" "ACCT" "TACT" "GACT" "CACT" "AACT"
+    "TTAT" "GTAT" "CTAT" "ATAT" "TGAT" "GGAT" "CGAT" "AGAT"
+    "TCAT" "GCAT" "CCAT" "ACAT" "TAAT" "GAAT" "CAAT" "AAAT"
+    "TTTG" "GTTG" "CTTG" "ATTG" "TGTG" "GGTG" "CGTG" "AGTG"
+    "TCTG" "GCTG" "CCTG" "ACTG" "TATG" "GATG" "CATG" "AATG"
+    "TTGG" "GTGG" "CTGG" "ATGG" "TGGG" "GGGG" "CGGG" "AGGG"
+    "TCGG" "GCGG" "CCGG" "ACGG" "TAGG" "GAGG" "CAGG" "AAGG"
+    "TTCG" "GTCG" "CTCG" "ATCG" "TGCG" "GGCG" "CGCG" "AGCG"
+    "TCCG" "GCCG" "CCCG" "ACCG" "TACG" "GACG" "CACG" "AACG"
+    "TTAG" "GTAG" "CTAG" "ATAG" "TGAG" "GGAG" "CGAG" "AGAG"
+    "TCAG" "GCAG" "CCAG" "ACAG" "TAAG" "GAAG" "CAAG" "AAAG"
+    "TTTC" "GTTC" "CTTC" "ATTC" "TGTC" "GGTC" "CGTC" "AGTC"
+    "TCTC" "GCTC" "CCTC" "ACTC" "TATC" "GATC" "CATC" "AATC"
+    "TTGC" "GTGC" "CTGC" "ATGC" "TGGC" "GGGC" "CGGC" "AGGC"
+    "TCGC" "GCGC" "CCGC" "ACGC" "TAGC" "GAGC" "CAGC" "AAGC"
+    "TTCC" "GTCC" "CTCC" "ATCC" "TGCC" "GGCC" "CGCC" "AGCC"
+    "TCCC" "GCCC" "CCCC" "ACCC" "TACC" "GACC" "CACC" "AACC"
+    "TTAC" "GTAC" "CTAC" "ATAC" "TGAC" "GGAC" "CGAC" "AGAC"
+    "TCAC" "GCAC" "CCAC" "ACAC" "TAAC" "GAAC" "CAAC" "AAAC"
+    "TTTA" "GTTA" "CTTA" "ATTA" "TGTA" "GGTA" "CGTA" "AGTA"
+    "TCTA" "GCTA" "CCTA" "ACTA" "TATA" "GATA" "CATA" "AATA"
+    "TTGA" "GTGA" "CTGA" "ATGA" "TGGA" "GGGA" "CGGA" "AGGA"
+    "TCGA" "GCGA" "CCGA" "ACGA" "TAGA" "GAGA" "CAGA" "AAGA"
+    "TTCA" "GTCA" "CTCA" "ATCA" "TGCA" "GGCA" "CGCA" "AGCA"
+    "TCCA" "GCCA" "CCCA" "ACCA" "TACA" "GACA" "CACA" "AACA"
+    "TTAA" "GTAA" "CTAA" "ATAA" "TGAA" "GGAA" "CGAA" "AGAA"
+    "TCAA" "GCAA" "CCAA" "ACAA" "TAAA" "GAAA" "CAAA" "AAAA"
 };
 
-rc_t unpack_4na( const String * packed, SBuffer * unpacked, bool reverse )
+rc_t unpack_2na( const String * packed, SBuffer * unpacked, bool reverse )
 {
     rc_t rc = 0;
-    uint8_t * src = ( uint8_t * )packed -> addr;
-    uint16_t dna_len;
-
-    /* the first 2 bytes are the 16-bit dna-length */
-    dna_len = src[ 0 ];
-    dna_len <<= 8;
-    dna_len |= src[ 1 ];
-
-    if ( dna_len > unpacked -> buffer_size )
-        rc = increase_SBuffer( unpacked, dna_len - unpacked -> buffer_size );
+    const uint8_t * src = ( const uint8_t * )packed -> addr;
+    uint32_t dna_len, n_runs, i;
+    size_t data_size;
+
+    if ( packed -> size < PACKED_2NA_HDR )
+        return RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+
+    dna_len = ( ( uint32_t )src[ 0 ] << 8 ) | src[ 1 ];
+    n_runs = ( ( uint32_t )src[ 2 ] << 8 ) | src[ 3 ];
+    data_size = packed_2na_data_size( dna_len );
+    if ( packed -> size < PACKED_2NA_HDR + data_size + ( n_runs * PACKED_2NA_RUN ) )
+        return RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+
+    /* +1 for the terminating zero */
+    if ( dna_len >= unpacked -> buffer_size )
+        rc = increase_SBuffer( unpacked, ( dna_len + 1 ) - unpacked -> buffer_size );
     if ( rc == 0 )
     {
-        uint8_t * dst = ( uint8_t * )unpacked -> S . addr;
-        uint32_t dst_idx;
-        uint32_t i;
-        
-        /* use the complement-lookup-table in case of reverse */
-        const char * lookup = reverse ? x4na_to_ASCII_rev : x4na_to_ASCII_fwd;
-        
-        dst_idx = reverse ? dna_len - 1 : 0;
-            
-        for ( i = 2; i < packed -> len; ++i )
+        const uint8_t * data = src + PACKED_2NA_HDR;
+        const uint8_t * runs = data + data_size;
+        char * dst = ( char * )unpacked -> S . addr;
+        uint32_t full = dna_len >> 2;
+        uint32_t rest = dna_len & 3;
+
+        if ( !reverse )
         {
-            /* get the packed byte out of the packed input */
-            uint8_t packed_byte = src[ i ];
-            
-            /* write the first unpacked byte */
-            if ( dst_idx < unpacked -> buffer_size )
-            {
-                dst[ dst_idx ] = lookup[ ( packed_byte >> 4 ) & 0x0F ];
-                dst_idx += reverse ? -1 : 1;
-            }
-            
-            /* write the second unpacked byte */
-            if ( dst_idx < unpacked -> buffer_size )
-            {
-                dst[ dst_idx ] = lookup[ packed_byte & 0x0F ];
-                dst_idx += reverse ? -1 : 1;
-            }
+            for ( i = 0; i < full; ++i )
+                memmove( dst + ( i << 2 ), x2na_to_ASCII_fwd + ( data[ i ] << 2 ), 4 );
+            if ( rest > 0 )
+                memmove( dst + ( full << 2 ), x2na_to_ASCII_fwd + ( data[ full ] << 2 ), rest );
         }
-        
+        else
+        {
+            for ( i = 0; i < full; ++i )
+                memmove( dst + dna_len - ( ( i + 1 ) << 2 ), x2na_to_ASCII_rev + ( data[ i ] << 2 ), 4 );
+            /* the last ( partial ) byte ends up at the start, its valid bases are at the end of the 4 */
+            if ( rest > 0 )
+                memmove( dst, x2na_to_ASCII_rev + ( data[ full ] << 2 ) + ( 4 - rest ), rest );
+        }
+
+        for ( i = 0; rc == 0 && i < n_runs; ++i )
+        {
+            const uint8_t * run = runs + ( i * PACKED_2NA_RUN );
+            uint32_t start = ( ( uint32_t )run[ 0 ] << 8 ) | run[ 1 ];
+            uint32_t len = ( ( uint32_t )run[ 2 ] << 8 ) | run[ 3 ];
+            if ( start + len > dna_len )
+                rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+            else if ( reverse )
+                memset( dst + ( dna_len - ( start + len ) ), 'N', len );
+            else
+                memset( dst + start, 'N', len );
+        }
+
         /* set the dna-length in the output-string */
         unpacked -> S . size = dna_len;
         unpacked -> S . len = ( uint32_t )unpacked -> S . size;
-        
+
         /* terminated the output-string, just in case */
         dst[ dna_len ] = 0;
     }
@@ -159,9 +159,12 @@ uint32_t get_uint32_t_option( const struct Args * args, const char *name, uint32
 
 uint64_t make_key( int64_t seq_spot_id, uint32_t seq_read_id );
 
-rc_t pack_4na( const String * unpacked, SBuffer * packed );
-rc_t pack_read_2_4na( const String * read, SBuffer * packed );
-rc_t unpack_4na( const String * packed, SBuffer * unpacked, bool reverse );
+/* packed bases: 2 bits per base, plus a list of N-runs ( see helper.c ) */
+#define PACKED_2NA_HDR 4
+size_t packed_2na_size( const uint8_t * hdr );
+rc_t pack_4na_2_2na( const String * unpacked, SBuffer * packed );
+rc_t pack_read_2_2na( const String * read, SBuffer * packed );
+rc_t unpack_2na( const String * packed, SBuffer * unpacked, bool reverse );
 
 bool ends_in_slash( const char * s );
 bool extract_path( const char * s, String * path );
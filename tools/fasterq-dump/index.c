@@ -28,11 +28,27 @@
 
 #include <kfs/file.h>
 #include <kfs/buffile.h>
+#include <kfs/mmap.h>
+
+/*
+    layout of the index-file:
+
+    [ INDEX_MAGIC ][ entry for key #0 ][ entry for key #1 ] ... [ entry for max_key ]
+
+    every entry is a uint64_t, addressed directly by the key ( seq_spot_id << 1 | read-bit ),
+    it contains ( offset + 1 ) of the record in the lookup-file or 0 if there is no record
+    for this key. because the seq_spot_id's are dense, this costs 8 bytes per read, but a
+    lookup is a single array-access instead of a scan...
+*/
+
+#define INDEX_MAGIC 0x31584449514446ULL /* "FDQIDX1" */
+#define INDEX_HDR_SIZE ( sizeof( uint64_t ) )
+#define INDEX_ZERO_BLOCK 512
 
 typedef struct index_writer
 {
     struct KFile * f;
-    uint64_t frequency, pos, last_key;
+    uint64_t pos, next_key;
 } index_writer;
 
 
@@ -57,11 +73,27 @@ static rc_t write_value( index_writer * writer, uint64_t value )
 }
 
 
-static rc_t write_key_and_offset( index_writer * writer, uint64_t key, uint64_t offset )
+/* fill the entries of keys we have no record for with zeros */
+static rc_t write_gap( index_writer * writer, uint64_t key )
 {
-    rc_t rc = write_value( writer, key );
-    if ( rc == 0 )
-        rc = write_value( writer, offset );
+    static const uint64_t zeros[ INDEX_ZERO_BLOCK ] = { 0 };
+    rc_t rc = 0;
+    while ( rc == 0 && writer -> next_key < key )
+    {
+        uint64_t count = key - writer -> next_key;
+        size_t to_write;
+        if ( count > INDEX_ZERO_BLOCK )
+            count = INDEX_ZERO_BLOCK;
+        to_write = count * ( sizeof zeros[ 0 ] );
+        rc = KFileWriteExactly( writer -> f, writer -> pos, zeros, to_write );
+        if ( rc != 0 )
+            ErrMsg( "index.c write_gap().KFileWriteExactly( %lu ) -> %R", to_write, rc );
+        else
+        {
+            writer -> pos += to_write;
+            writer -> next_key += count;
+        }
+    }
     return rc;
 }
 
@@ -71,23 +103,27 @@ rc_t write_key( struct index_writer * writer, uint64_t key, uint64_t offset )
     rc_t rc = 0;
     if ( writer == NULL )
     {
-        rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
+        rc = RC( rcVDB, rcNoTarg, rcWriting, rcParam, rcInvalid );
         ErrMsg( "index.c write_key() -> %R", rc );
     }
+    else if ( key < writer -> next_key )
+    {
+        /* the keys have to arrive in ascending order ( the output of the merge-sort ) */
+        rc = RC( rcVDB, rcNoTarg, rcWriting, rcId, rcInvalid );
+        ErrMsg( "index.c write_key( %lu after %lu ) -> %R", key, writer -> next_key, rc );
+    }
     else
     {
-        if ( key > ( writer -> last_key + writer -> frequency ) )
-        {
-            rc = write_key_and_offset( writer, key, offset );
-            if ( rc == 0 )
-                writer -> last_key = key;
-        }
+        rc = write_gap( writer, key );
+        if ( rc == 0 )
+            rc = write_value( writer, offset + 1 );
+        if ( rc == 0 )
+            writer -> next_key = key + 1;
     }
     return rc;
 }
 
 static rc_t make_index_writer_obj( struct index_writer ** writer,
-                                   uint64_t frequency,
                                    struct KFile * f )
 {
     rc_t rc = 0;
@@ -100,11 +136,7 @@ static rc_t make_index_writer_obj( struct index_writer ** writer,
     else
     {
         w -> f = f;
-        w -> frequency = frequency;
-        rc = write_value( w, frequency );
-        if ( rc == 0 )
-            rc = write_key_and_offset( w, 1, 0 );
-
+        rc = write_value( w, INDEX_MAGIC );
         if ( rc == 0 )
             *writer = w;
         else
@@ -114,7 +146,7 @@ static rc_t make_index_writer_obj( struct index_writer ** writer,
 }
 
 rc_t make_index_writer( KDirectory * dir, struct index_writer ** writer,
-                        size_t buf_size, uint64_t frequency, const char * fmt, ... )
+                        size_t buf_size, const char * fmt, ... )
 {
     rc_t rc;
     struct KFile * f;
@@ -142,7 +174,7 @@ rc_t make_index_writer( KDirectory * dir, struct index_writer ** writer,
 
         if ( rc == 0 )
         {
-            rc = make_index_writer_obj( writer, frequency, f );
+            rc = make_index_writer_obj( writer, f );
             if ( rc != 0 )
                 KFileRelease( f );
         }
@@ -158,7 +190,10 @@ rc_t make_index_writer( KDirectory * dir, struct index_writer ** writer,
 typedef struct index_reader
 {
     const struct KFile * f;
-    uint64_t frequency, file_size, max_key;
+    const KMMap * mm;           /* NULL if the file could not be mapped */
+    const uint64_t * entries;   /* points into the mapped region, after the magic */
+    uint64_t max_key;
+    bool empty;
 } index_reader;
 
 
@@ -166,12 +201,13 @@ void release_index_reader( index_reader * reader )
 {
     if ( reader != NULL )
     {
+        if ( reader -> mm != NULL ) KMMapRelease( reader -> mm );
         if ( reader -> f != NULL ) KFileRelease( reader -> f );
         free( ( void * ) reader );
     }
 }
 
-static rc_t read_value( index_reader * reader, uint64_t pos, uint64_t * value )
+static rc_t read_value( const index_reader * reader, uint64_t pos, uint64_t * value )
 {
     rc_t rc = KFileReadExactly( reader -> f, pos, ( void * )value, sizeof *value );
     if ( rc != 0 )
@@ -179,6 +215,30 @@ static rc_t read_value( index_reader * reader, uint64_t pos, uint64_t * value )
     return rc;
 }
 
+static rc_t map_index( index_reader * r, uint64_t file_size )
+{
+    /* if mapping fails ( address-space, filesystem ) we fall back to reading the entries */
+    rc_t rc = KMMapMakeRead( &r -> mm, r -> f );
+    if ( rc == 0 )
+    {
+        size_t mm_size;
+        const void * addr;
+        rc = KMMapSize( r -> mm, &mm_size );
+        if ( rc == 0 && mm_size != file_size )
+            rc = RC( rcVDB, rcNoTarg, rcConstructing, rcSize, rcInvalid );
+        if ( rc == 0 )
+            rc = KMMapAddrRead( r -> mm, &addr );
+        if ( rc == 0 )
+            r -> entries = ( const uint64_t * )( ( const uint8_t * )addr + INDEX_HDR_SIZE );
+        else
+        {
+            KMMapRelease( r -> mm );
+            r -> mm = NULL;
+        }
+    }
+    return rc;
+}
+
 static rc_t make_index_reader_obj( index_reader ** reader,
                                    const struct KFile * f )
 {
@@ -191,16 +251,33 @@ static rc_t make_index_reader_obj( index_reader ** reader,
     }
     else
     {
+        uint64_t file_size, magic;
+
         r -> f = f;
-        rc = read_value( r, 0, &r -> frequency );
-        if ( rc == 0 )
-            rc = KFileSize( f, &r -> file_size );
+        rc = KFileSize( f, &file_size );
+        if ( rc != 0 )
+            ErrMsg( "index.c make_index_reader_obj().KFileSize() -> %R", rc );
+        else
+            rc = read_value( r, 0, &magic );
 
         if ( rc == 0 )
         {
-            get_max_key( r, &r -> max_key );
-            *reader = r;
+            if ( magic != INDEX_MAGIC || ( ( file_size - INDEX_HDR_SIZE ) % ( sizeof magic ) ) != 0 )
+            {
+                rc = RC( rcVDB, rcNoTarg, rcConstructing, rcFormat, rcInvalid );
+                ErrMsg( "index.c make_index_reader_obj() - index file has invalid format / size of %lu", file_size );
+            }
+            else if ( file_size == INDEX_HDR_SIZE )
+                r -> empty = true;
+            else
+            {
+                r -> max_key = ( ( file_size - INDEX_HDR_SIZE ) / ( sizeof magic ) ) - 1;
+                map_index( r, file_size );
+            }
         }
+
+        if ( rc == 0 )
+            *reader = r;
         else
             release_index_reader( r );
     }
@@ -221,123 +298,43 @@ rc_t make_index_reader( const KDirectory * dir, index_reader ** reader,
         ErrMsg( "index.c make_index_reader() KDirectoryVOpenFileRead() -> %R", rc );
     else
     {
-        if ( buf_size > 0 )
-        {
-            const struct KFile * temp_file;
-            rc = KBufFileMakeRead( &temp_file, f, buf_size );
-            if ( rc != 0 )
-                ErrMsg( "index.c make_index_reader() KBufFileMakeRead() -> %R", rc );
-            else
-            {
-                KFileRelease( f );
-                f = temp_file;
-            }
-        }
-        if ( rc == 0 )
-            rc = make_index_reader_obj( reader, f );
+        /* no buffered file here: the index is mapped, or read with random access */
+        rc = make_index_reader_obj( reader, f );
+        if ( rc != 0 )
+            KFileRelease( f );
     }
     va_end ( args );
     return rc;
 }
 
 
-static uint64_t key_to_pos_guess( const index_reader * self, uint64_t key )
-{
-    uint64_t chunk_id = ( key / self -> frequency );
-    return ( ( sizeof self -> frequency ) + ( chunk_id * ( 2 * ( sizeof self -> frequency ) ) ) );
-}
-
-rc_t get_nearest_offset( const index_reader * self,
-                         uint64_t key_to_find,
-                         uint64_t * key_found,
-                         uint64_t * offset )
+rc_t get_offset( const index_reader * self, uint64_t key_to_find, uint64_t * offset )
 {
     rc_t rc = 0;
-    if ( self == NULL || key_found == NULL || offset == NULL )
+    if ( self == NULL || offset == NULL )
     {
         rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
-        ErrMsg( "index.c get_nearest_offset() -> %R", rc );
+        ErrMsg( "index.c get_offset() -> %R", rc );
     }
-    else if ( self -> file_size <= 24 )
-    {
+    else if ( self -> empty )
         rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-    }
+    else if ( key_to_find > self -> max_key )
+        rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcTooBig );
     else
     {
-        uint64_t data[ 6 ];
-        /*
-            data[ 0 ] ... key0      data[ 1 ] ... offset0
-            data[ 2 ] ... key1      data[ 3 ] ... offset1
-            data[ 4 ] ... key2      data[ 5 ] ... offset2
-        */
-        uint64_t pos = key_to_pos_guess( self, key_to_find );
-        size_t to_read = sizeof data;
-        bool found = false;
-        uint64_t rounds = 0;
-        while ( rc == 0 && !found && pos < self -> file_size )
+        uint64_t entry;
+        if ( self -> entries != NULL )
+            entry = self -> entries[ key_to_find ];
+        else
+            rc = read_value( self, INDEX_HDR_SIZE + ( key_to_find * ( sizeof entry ) ), &entry );
+
+        if ( rc == 0 )
         {
-            rounds++;
-            if ( rounds > 100 )
-            {
-                rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcExhausted );
-                ErrMsg( "index.c get_nearest_offset() -> too many rounds pos = %lu of %lu", pos, self -> file_size );
-            }
+            if ( entry == 0 )
+                rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
             else
-            {
-                if ( ( ( pos + to_read ) - 1 ) > self -> file_size )
-                    to_read = ( self -> file_size - pos );
-                rc = KFileReadExactly( self -> f, pos, ( void * )&( data[ 0 ] ), to_read );
-                if ( rc != 0 )
-                    ErrMsg( "index.c get_nearest_offset().KFileReadExactly( %lu of %lu, to_read = %lu ) failed %R",
-                            pos, self -> file_size, to_read, rc );
-                else
-                {
-                    if ( to_read >= ( ( sizeof data[ 0 ] ) * 4 ) &&
-                         key_to_find >= data[ 0 ] &&
-                         key_to_find < data[ 2 ] )
-                    {
-                        /* key_to_find is between key0 and key1 */
-                        found = true;
-                        *key_found = data[ 0 ];
-                        *offset = data[ 1 ];
-                    }
-                    else if ( to_read >= ( ( sizeof data[ 0 ] ) * 6 ) &&
-                              key_to_find >= data[ 2 ] &&
-                              key_to_find < data[ 4 ] )
-                    {
-                        /* key_to_find is between key1 and key2 */
-                        found = true;
-                        *key_found = data[ 2 ];
-                        *offset = data[ 3 ];
-                    }
-                    
-                    if ( !found )
-                    {
-                        if ( to_read >= ( ( sizeof data[ 0 ] ) * 2 ) &&
-                             key_to_find < data[ 0 ] )
-                        {
-                            /* key_to_find is smaller than our guess */
-                            if ( pos > sizeof self -> frequency )
-                                pos -= ( 2 * ( sizeof self -> frequency ) );
-                            else
-                            {
-                                found = true;
-                                *key_found = data[ 0 ];
-                                *offset = data[ 1 ];
-                            }
-                        }
-                        else if ( to_read >= ( ( sizeof data[ 0 ] ) * 6 ) &&
-                                  key_to_find > data[ 4 ] )
-                        {
-                            /* key_to_find is bigger than our guess */
-                            pos += ( 2 * ( sizeof self -> frequency ) );
-                        }
-                    }
-                }
-            }
+                *offset = entry - 1;
         }
-        if ( !found )
-            rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
     }
     return rc;
 }
@@ -350,36 +347,7 @@ rc_t get_max_key( const index_reader * self, uint64_t * max_key )
         rc = RC( rcVDB, rcNoTarg, rcReading, rcParam, rcInvalid );
         ErrMsg( "index.c get_max_key() -> %R", rc );
     }
-    else if ( self -> max_key > 0 )
-    {
-        *max_key = self -> max_key;
-    }
     else
-    {
-        uint64_t data[ 6 ];
-        size_t to_read = sizeof data;
-        uint64_t pos = 0;
-        
-        if ( self -> file_size >= to_read )
-            pos = self -> file_size - to_read;
-        else
-            to_read = self -> file_size;
-        
-        rc = KFileReadExactly( self -> f, pos, ( void * )&data[ 0 ], to_read );
-        if ( rc != 0 )
-            ErrMsg( "index.c get_max_key().KFileReadExactly( at %lu ) failed %R", pos, rc );
-        else
-        {
-            if ( self -> file_size >= to_read )
-                *max_key = data[ 4 ];
-            else if ( self -> file_size == ( sizeof data[ 0 ] * 3 ) )
-                *max_key = data[ 2 ];
-            else
-            {
-                rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
-                ErrMsg( "index.c get_max_key() - index file has invalid size of %lu", self -> file_size );    
-            }
-        }
-    }
+        *max_key = self -> max_key;
     return rc;
 }
@@ -27,23 +27,32 @@
 #include "join.h"
 #include "index.h"
 #include "lookup_reader.h"
+#include "mem_lookup.h"
 #include "special_iter.h"
 #include "raw_read_iter.h"
 #include "fastq_iter.h"
 #include "cleanup_task.h"
 #include "join_results.h"
+#include "chunk_writer.h"
 #include "progress_thread.h"
 
 #include <klib/out.h>
 #include <kproc/thread.h>
+#include <atomic64.h>
 #include <insdc/insdc.h> /* for READ_TYPE_BIOLOGICAL, READ_TYPE_REVERSE */
 
+/* how many rows of the SEQUENCE-table a join-thread processes at once, if the output is
+   written in order ( chunk_writer.c ), and how many of these chunks can be in flight per thread */
+#define JOIN_CHUNK_ROWS 2048
+#define JOIN_CHUNKS_PER_THREAD 4
+
 typedef struct join
 {
     const char * accession_path;
     const char * accession_short;
     struct lookup_reader * lookup;  /* lookup_reader.h */
     struct index_reader * index;    /* index.h */
+    const struct mem_lookup * mem_lookup; /* mem_lookup.h ( replaces lookup and index if not NULL ) */
     struct join_results * results;  /* join_results.h */
     SBuffer B1, B2;                 /* helper.h */
     uint64_t loop_nr;               /* in which loop of this partial join are we? */
@@ -67,30 +76,35 @@ static rc_t init_join( cmn_params * cp,
                        struct join_results * results,
                        const char * lookup_filename,
                        const char * index_filename,
+                       const struct mem_lookup * mem_lookup,
                        size_t buf_size,
                        bool cmp_read_present,
                        struct join * j )
 {
-    rc_t rc;
+    rc_t rc = 0;
     
     j -> accession_path = cp -> accession;
     j -> lookup = NULL;
+    j -> index = NULL;
+    j -> mem_lookup = mem_lookup;
     j -> results = results;
     j -> B1 . S . addr = NULL;
     j -> B2 . S . addr = NULL;
     j -> loop_nr = 0;
     j -> cmp_read_present = cmp_read_present;
     
-    if ( index_filename != NULL )
+    /* with the in-memory lookup we do not need the lookup-file and its index */
+    if ( mem_lookup == NULL )
     {
-        if ( file_exists( cp -> dir, "%s", index_filename ) )
-            rc = make_index_reader( cp -> dir, &j -> index, buf_size, "%s", index_filename ); /* index.c */
+        if ( index_filename != NULL )
+        {
+            if ( file_exists( cp -> dir, "%s", index_filename ) )
+                rc = make_index_reader( cp -> dir, &j -> index, buf_size, "%s", index_filename ); /* index.c */
+        }
+
+        rc = make_lookup_reader( cp -> dir, j -> index, &( j -> lookup ), buf_size,
+                                 "%s", lookup_filename ); /* lookup_reader.c */
     }
-    else
-        j -> index = NULL;
-    
-    rc = make_lookup_reader( cp -> dir, j -> index, &( j -> lookup ), buf_size,
-                             "%s", lookup_filename ); /* lookup_reader.c */
     if ( rc == 0 )
     {
         rc = make_SBuffer( &( j -> B1 ), 4096 );  /* helper.c */
@@ -105,8 +119,8 @@ static rc_t init_join( cmn_params * cp,
     }
 
     /* we do not seek any more at the beginning of the begin of a join-slice
-       the call to lookup_bases will perform an internal seek now if it is not pointed
-       to the right location */
+       with an index, lookup_bases finds the record directly by the row-id,
+       without one it performs an internal seek if it is not pointed to the right location */
 
     if ( rc != 0 )
         release_join_ctx( j ); /* above! */
@@ -115,6 +129,13 @@ static rc_t init_join( cmn_params * cp,
 
 /* ------------------------------------------------------------------------------------------ */
 
+static rc_t join_lookup_bases( join * j, int64_t row_id, uint32_t read_id, SBuffer * B, bool reverse )
+{
+    if ( j -> mem_lookup != NULL )
+        return mem_lookup_bases( j -> mem_lookup, row_id, read_id, B, reverse ); /* mem_lookup.c */
+    return lookup_bases( j -> lookup, row_id, read_id, B, reverse ); /* lookup_reader.c */
+}
+
 static rc_t print_special_1_read( special_rec * rec, join * j )
 {
     rc_t rc = 0;
@@ -130,7 +151,7 @@ static rc_t print_special_1_read( special_rec * rec, join * j )
     {
         /* read is aligned ( 1 lookup ) */
         bool reverse = false;
-        rc = lookup_bases( j -> lookup, row_id, 1, &( j -> B1 ), reverse ); /* lookup_reader.c */
+        rc = join_lookup_bases( j, row_id, 1, &( j -> B1 ), reverse ); /* above */
         if ( rc == 0 )
             rc = join_results_print( j -> results, 0, "%ld\t%S\t%S\n",
                              row_id, &( j -> B1.S ), &( rec -> spot_group ) ); /* join_results.c */
@@ -156,7 +177,7 @@ static rc_t print_special_2_reads( special_rec * rec, join * j )
         {
             /* A0 is unaligned / A1 is aligned (lookup) */
             bool reverse = false;
-            rc = lookup_bases( j -> lookup, row_id, 2, &( j -> B2 ), reverse ); /* lookup_reader.c */
+            rc = join_lookup_bases( j, row_id, 2, &( j -> B2 ), reverse ); /* above */
             if ( rc == 0 )
                 rc = join_results_print( j -> results, 0, "%ld\t%S%S\t%S\n",
                                  row_id, &( rec -> cmp_read ), &( j -> B2 . S ), &( rec -> spot_group ) ); /* join_results.c */
@@ -168,7 +189,7 @@ static rc_t print_special_2_reads( special_rec * rec, join * j )
         {
             /* A0 is aligned (lookup) / A1 is unaligned */
             bool reverse = false;
-            rc = lookup_bases( j -> lookup, row_id, 1, &( j -> B1 ), reverse ); /* lookup_reader.c */
+            rc = join_lookup_bases( j, row_id, 1, &( j -> B1 ), reverse ); /* above */
             if ( rc == 0 )
                 rc = join_results_print( j -> results, 0, "%ld\t%S%S\t%S\n",
                                  row_id, &j->B1.S, &rec->cmp_read, &rec->spot_group ); /* join_results.c */
@@ -178,9 +199,9 @@ static rc_t print_special_2_reads( special_rec * rec, join * j )
             /* A0 and A1 are aligned (2 lookups)*/
             bool reverse1 = false;
             bool reverse2 = false;
-            rc = lookup_bases( j -> lookup, row_id, 1, &( j -> B1 ), reverse1 ); /* lookup_reader.c */
+            rc = join_lookup_bases( j, row_id, 1, &( j -> B1 ), reverse1 ); /* above */
             if ( rc == 0 )
-                rc = lookup_bases( j -> lookup, row_id, 2, &( j -> B2 ), reverse2 ); /* lookup_reader.c */
+                rc = join_lookup_bases( j, row_id, 2, &( j -> B2 ), reverse2 ); /* above */
             if ( rc == 0 )
                 rc = join_results_print( j -> results, 0, "%ld\t%S%S\t%S\n",
                                  row_id, &( j -> B1 . S ), &( j -> B2 . S ), &( rec -> spot_group ) ); /* join_results.c */
@@ -262,7 +283,7 @@ static rc_t print_fastq_1_read( join_stats * stats,
     {
         /* read is aligned, ( 1 lookup ) */    
         bool reverse = is_reverse( rec, 0 );
-        rc = lookup_bases( j -> lookup, row_id, 1, &( j -> B1 ), reverse ); /* lookup_reader.c */
+        rc = join_lookup_bases( j, row_id, 1, &( j -> B1 ), reverse ); /* above */
         if ( rc == 0 )
         {
             if ( join_results_match( j -> results, &( j -> B1 . S ) ) ) /* join-results.c */
@@ -336,7 +357,7 @@ static rc_t print_fastq_2_reads( join_stats * stats,
         {
             /* A0 is unaligned / A1 is aligned (lookup) */
             bool reverse = is_reverse( rec, 1 );
-            rc = lookup_bases( j -> lookup, row_id, 2, &( j -> B2 ), reverse ); /* lookup_reader.c */
+            rc = join_lookup_bases( j, row_id, 2, &( j -> B2 ), reverse ); /* above */
             if ( rc == 0 )
             {
                 if ( join_results_match2( j -> results, &( rec -> read ), &( j -> B2 . S ) ) ) /* join-results.c */
@@ -370,7 +391,7 @@ static rc_t print_fastq_2_reads( join_stats * stats,
         {
             /* A0 is aligned (lookup) / A1 is unaligned */
             bool reverse = is_reverse( rec, 0 );
-            rc = lookup_bases( j -> lookup, row_id, 1, &( j -> B1 ), reverse ); /* lookup_reader.c */
+            rc = join_lookup_bases( j, row_id, 1, &( j -> B1 ), reverse ); /* above */
             if ( rc == 0 )
             {
                 if ( join_results_match2( j -> results, &( j -> B1 . S ), &( rec -> read ) ) ) /* join-results.c */
@@ -403,9 +424,9 @@ static rc_t print_fastq_2_reads( join_stats * stats,
             /* A0 and A1 are aligned (2 lookups)*/
             bool reverse1 = is_reverse( rec, 0 );
             bool reverse2 = is_reverse( rec, 1 );
-            rc = lookup_bases( j -> lookup, row_id, 1, &( j -> B1 ), reverse1 ); /* lookup_reader.c */
+            rc = join_lookup_bases( j, row_id, 1, &( j -> B1 ), reverse1 ); /* above */
             if ( rc == 0 )
-                rc = lookup_bases( j -> lookup, row_id, 2, &( j -> B2 ), reverse2 ); /* lookup_reader.c */
+                rc = join_lookup_bases( j, row_id, 2, &( j -> B2 ), reverse2 ); /* above */
             if ( rc == 0 )
             {
                 if ( join_results_match2( j -> results, &( j -> B1 . S ), &( j -> B2 . S ) ) ) /* join-results.c */
@@ -570,7 +591,7 @@ static rc_t print_fastq_2_reads_splitted( join_stats * stats,
             if ( process_1 )
             {
                 bool reverse = is_reverse( rec, 1 );
-                rc = lookup_bases( j -> lookup, row_id, 2, &j -> B2, reverse ); /* lookup_reader.c */
+                rc = join_lookup_bases( j, row_id, 2, &j -> B2, reverse ); /* above */
                 if ( rc == 0 )
                 {
                     READ2 = &( j -> B2 . S );
@@ -632,7 +653,7 @@ static rc_t print_fastq_2_reads_splitted( join_stats * stats,
             if ( process_0 )
             {
                 bool reverse = is_reverse( rec, 0 );
-                rc = lookup_bases( j -> lookup, row_id, 1, &j -> B1, reverse ); /* lookup_reader.c */
+                rc = join_lookup_bases( j, row_id, 1, &j -> B1, reverse ); /* above */
                 if ( rc == 0 )
                 {
                     READ1 = &j -> B1 . S;
@@ -705,7 +726,7 @@ static rc_t print_fastq_2_reads_splitted( join_stats * stats,
             if ( process_0 )
             {
                 bool reverse = is_reverse( rec, 0 );
-                rc = lookup_bases( j -> lookup, row_id, 1, &j -> B1, reverse ); /* lookup_reader.c */
+                rc = join_lookup_bases( j, row_id, 1, &j -> B1, reverse ); /* above */
                 if ( rc == 0 )
                 {
                     READ1 = &j -> B1 . S;
@@ -725,7 +746,7 @@ static rc_t print_fastq_2_reads_splitted( join_stats * stats,
             if ( rc == 0 && process_1 )
             {
                 bool reverse = is_reverse( rec, 1 );
-                rc = lookup_bases( j -> lookup, row_id, 2, &j -> B2, reverse ); /* lookup_reader.c */
+                rc = join_lookup_bases( j, row_id, 2, &j -> B2, reverse ); /* above */
                 if ( rc == 0 )
                 {
                     READ2 = &j -> B2 . S;
@@ -798,258 +819,255 @@ static rc_t extract_csra_row_count( KDirectory * dir,
     return rc;
 }
 
-static rc_t perform_special_join( cmn_params * cp,
+static rc_t perform_special_join( struct special_iter * iter,
                                   join * j,
                                   struct bg_progress * progress )
 {
-    struct special_iter * iter;
-    rc_t rc = make_special_iter( cp, &iter ); /* special_iter.c */
-    if ( rc == 0 )
+    rc_t rc = 0;
+    special_rec rec;
+    while ( rc == 0 && get_from_special_iter( iter, &rec, &rc ) ) /* special_iter.c */
     {
-        special_rec rec;
-        while ( rc == 0 && get_from_special_iter( iter, &rec, &rc ) )
+        rc = Quitting();
+        if ( rc == 0 )
         {
-            rc = Quitting();
-            if ( rc == 0 )
-            {
-                if ( rec . num_reads == 1 )
-                    rc = print_special_1_read( &rec, j ); /* above */
-                else
-                    rc = print_special_2_reads( &rec, j ); /* above */
+            if ( rec . num_reads == 1 )
+                rc = print_special_1_read( &rec, j ); /* above */
+            else
+                rc = print_special_2_reads( &rec, j ); /* above */
 
-                j -> loop_nr ++;
+            j -> loop_nr ++;
 
-                bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
-            }
+            bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
         }
-        destroy_special_iter( iter ); /* special_iter.c */
     }
-    else
-        ErrMsg( "make_special_iter() -> %R", rc );
     return rc;
 }
 
 
-static rc_t perform_whole_spot_join( cmn_params * cp,
+static rc_t perform_whole_spot_join( struct fastq_csra_iter * iter,
                                      join_stats * stats,
                                      join * j,
                                      struct bg_progress * progress,
                                      const join_options * jo )
 {
-    rc_t rc;
-    struct fastq_csra_iter * iter;
-    fastq_iter_opt opt;
-    opt . with_read_len = false;
-    opt . with_name = !( jo -> rowid_as_name );
-    opt . with_read_type = true;
-    opt . with_cmp_read = j -> cmp_read_present;
-    
-    rc = make_fastq_csra_iter( cp, opt, &iter ); /* fastq-iter.c */
-    if ( rc != 0 )
-        ErrMsg( "perform_fastq_join().make_fastq_csra_iter() -> %R", rc );
-    else
+    rc_t rc = 0;
+    fastq_rec rec; /* fastq_iter.h */
+    join_options local_opt = { jo -> rowid_as_name,
+                               false, 
+                               jo -> print_read_nr,
+                               jo -> print_name,
+                               jo -> terminate_on_invalid,
+                               jo -> min_read_len,
+                               jo -> filter_bases };
+    while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq-iter.c */
     {
-        fastq_rec rec; /* fastq_iter.h */
-        join_options local_opt = { jo -> rowid_as_name,
-                                   false, 
-                                   jo -> print_read_nr,
-                                   jo -> print_name,
-                                   jo -> terminate_on_invalid,
-                                   jo -> min_read_len,
-                                   jo -> filter_bases };
-        while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq-iter.c */
+        rc = Quitting();
+        if ( rc == 0 )
         {
-            rc = Quitting();
-            if ( rc == 0 )
-            {
-                stats -> spots_read++;
-                stats -> reads_read += rec . num_alig_id;
-            
-                if ( rec . num_alig_id == 1 )
-                    rc = print_fastq_1_read( stats, &rec, j, &local_opt ); /* above */
-                else
-                    rc = print_fastq_2_reads( stats, &rec, j, &local_opt ); /* above */
+            stats -> spots_read++;
+            stats -> reads_read += rec . num_alig_id;
+        
+            if ( rec . num_alig_id == 1 )
+                rc = print_fastq_1_read( stats, &rec, j, &local_opt ); /* above */
+            else
+                rc = print_fastq_2_reads( stats, &rec, j, &local_opt ); /* above */
 
-                if ( rc == 0 )
-                    j -> loop_nr ++;
-                else
-                    ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
-                    
-                bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
-            }
+            if ( rc == 0 )
+                j -> loop_nr ++;
+            else
+                ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
+                
+            bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
         }
-        destroy_fastq_csra_iter( iter ); /* fastq-iter.c */
     }
     return rc;
 }
 
-static rc_t perform_fastq_split_spot_join( cmn_params * cp,
+static rc_t perform_fastq_split_spot_join( struct fastq_csra_iter * iter,
                                       join_stats * stats,
                                       join * j,
                                       struct bg_progress * progress,
                                       const join_options * jo )
 {
-    rc_t rc;
-    struct fastq_csra_iter * iter;
-    fastq_iter_opt opt;
-    opt . with_read_len = true;
-    opt . with_name = !( jo -> rowid_as_name );
-    opt . with_read_type = true;
-    opt . with_cmp_read = j -> cmp_read_present;
-    
-    rc = make_fastq_csra_iter( cp, opt, &iter ); /* fastq-iter.c */
-    if ( rc != 0 )
-        ErrMsg( "perform_fastq_split_spot_join().make_fastq_csra_iter() -> %R", rc );
-    else
+    rc_t rc = 0;
+    fastq_rec rec; /* fastq_iter.h */
+    while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq-iter.c */
     {
-        fastq_rec rec; /* fastq_iter.h */
-        while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq-iter.c */
+        rc = Quitting();
+        if ( rc == 0 )
         {
-            rc = Quitting();
-            if ( rc == 0 )
-            {
-                stats -> spots_read++;
-                stats -> reads_read += rec . num_alig_id;
-            
-                if ( rec . num_alig_id == 1 )
-                    rc = print_fastq_1_read( stats, &rec, j, jo ); /* above */
-                else
-                    rc = print_fastq_2_reads_splitted( stats, &rec, j, false, jo ); /* above */
+            stats -> spots_read++;
+            stats -> reads_read += rec . num_alig_id;
+        
+            if ( rec . num_alig_id == 1 )
+                rc = print_fastq_1_read( stats, &rec, j, jo ); /* above */
+            else
+                rc = print_fastq_2_reads_splitted( stats, &rec, j, false, jo ); /* above */
 
-                if ( rc == 0 )
-                    j -> loop_nr ++;
-                else
-                    ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
-                    
-                bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
-            }
+            if ( rc == 0 )
+                j -> loop_nr ++;
+            else
+                ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
+                
+            bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
         }
-        destroy_fastq_csra_iter( iter ); /* fastq-iter.c */
     }
     return rc;
 }
 
-static rc_t perform_fastq_split_file_join( cmn_params * cp,
+static rc_t perform_fastq_split_file_join( struct fastq_csra_iter * iter,
                                       join_stats * stats,
                                       join * j,
                                       struct bg_progress * progress,
                                       const join_options * jo )
 {
-    rc_t rc;
-    struct fastq_csra_iter * iter;
-    fastq_iter_opt opt;
-    opt . with_read_len = true;
-    opt . with_name = !( jo -> rowid_as_name );
-    opt . with_read_type = true;
-    opt . with_cmp_read = j -> cmp_read_present;
-    
-    rc = make_fastq_csra_iter( cp, opt, &iter ); /* fastq-iter.c */
-    if ( rc != 0 )
-        ErrMsg( "perform_fastq_split_file_join().make_fastq_csra_iter() -> %R", rc );
-    else
+    rc_t rc = 0;
+    fastq_rec rec; /* fastq_iter.h */
+    join_options local_opt =
+        { 
+            jo -> rowid_as_name,
+            false,
+            jo -> print_read_nr,
+            jo -> print_name,
+            jo -> terminate_on_invalid,
+            jo -> min_read_len,
+            jo -> filter_bases
+        };
+        
+    while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq-iter.c */
     {
-        fastq_rec rec; /* fastq_iter.h */
-        join_options local_opt =
-            { 
-                jo -> rowid_as_name,
-                false,
-                jo -> print_read_nr,
-                jo -> print_name,
-                jo -> terminate_on_invalid,
-                jo -> min_read_len,
-                jo -> filter_bases
-            };
-            
-        while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq-iter.c */
+        rc = Quitting();
+        if ( rc == 0 )
         {
-            rc = Quitting();
-            if ( rc == 0 )
-            {
-                stats -> spots_read++;
-                stats -> reads_read += rec . num_alig_id;
-            
-                if ( rec . num_alig_id == 1 )
-                    rc = print_fastq_1_read( stats, &rec, j, &local_opt );
-                else
-                    rc = print_fastq_2_reads_splitted( stats, &rec, j, true, &local_opt );
+            stats -> spots_read++;
+            stats -> reads_read += rec . num_alig_id;
+        
+            if ( rec . num_alig_id == 1 )
+                rc = print_fastq_1_read( stats, &rec, j, &local_opt );
+            else
+                rc = print_fastq_2_reads_splitted( stats, &rec, j, true, &local_opt );
 
-                if ( rc == 0 )
-                    j -> loop_nr ++;
-                else
-                    ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
+            if ( rc == 0 )
+                j -> loop_nr ++;
+            else
+                ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
 
-                bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
-            }
+            bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
         }
-        destroy_fastq_csra_iter( iter );
     }
     return rc;
 }
 
-static rc_t perform_fastq_split_3_join( cmn_params * cp,
+static rc_t perform_fastq_split_3_join( struct fastq_csra_iter * iter,
                                       join_stats * stats,
                                       join * j,
                                       struct bg_progress * progress,
                                       const join_options * jo )
 {
-    rc_t rc;
-    struct fastq_csra_iter * iter;
-    fastq_iter_opt opt;
-    opt . with_read_len = true;
-    opt . with_name = !( jo -> rowid_as_name );
-    opt . with_read_type = true;
-    opt . with_cmp_read = j -> cmp_read_present;
+    rc_t rc = 0;
+    fastq_rec rec; /* fastq_iter.h */
+    rc_t rc_iter = 0;
     
-    rc = make_fastq_csra_iter( cp, opt, &iter ); /* fastq-iter.c */
-    if ( rc != 0 )
-        ErrMsg( "perform_fastq_split_3_join().make_fastq_csra_iter() -> %R", rc );
-    else
+    join_options local_opt =
+        {
+            jo -> rowid_as_name,
+            false,
+            jo -> print_read_nr,
+            jo -> print_name,
+            jo -> terminate_on_invalid,
+            jo -> min_read_len,
+            jo -> filter_bases
+        };
+
+    while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc_iter ) && rc_iter == 0 ) /* fastq-iter.c */
     {
-        fastq_rec rec; /* fastq_iter.h */
-        rc_t rc_iter = 0;
-        
-        join_options local_opt =
-            {
-                jo -> rowid_as_name,
-                false,
-                jo -> print_read_nr,
-                jo -> print_name,
-                jo -> terminate_on_invalid,
-                jo -> min_read_len,
-                jo -> filter_bases
-            };
-
-        while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc_iter ) && rc_iter == 0 ) /* fastq-iter.c */
+        rc = Quitting();
+        if ( rc == 0 )
         {
-            rc = Quitting();
-            if ( rc == 0 )
-            {
-                stats -> spots_read++;
-                stats -> reads_read += rec . num_alig_id;
+            stats -> spots_read++;
+            stats -> reads_read += rec . num_alig_id;
 
-                if ( rec . num_alig_id == 1 )
-                    rc = print_fastq_1_read( stats, &rec, j, &local_opt );
-                else
-                    rc = print_fastq_2_reads_splitted( stats, &rec, j, true, &local_opt );
+            if ( rec . num_alig_id == 1 )
+                rc = print_fastq_1_read( stats, &rec, j, &local_opt );
+            else
+                rc = print_fastq_2_reads_splitted( stats, &rec, j, true, &local_opt );
 
-                if ( rc == 0 )
-                    j -> loop_nr ++;
-                else
-                    ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
-                
-                bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
-            }
+            if ( rc == 0 )
+                j -> loop_nr ++;
+            else
+                ErrMsg( "terminated in loop_nr #%u.%lu for SEQ-ROWID #%ld", j -> thread_id, j -> loop_nr, rec . row_id );
+            
+            bg_progress_inc( progress ); /* progress_thread.c (ignores NULL) */
         }
-        destroy_fastq_csra_iter( iter );
-        
-        if ( rc == 0 && rc_iter != 0 )
-            rc = rc_iter;
     }
+    
+    if ( rc == 0 && rc_iter != 0 )
+        rc = rc_iter;
     return rc;
 }
 
 /* ------------------------------------------------------------------------------------------ */
 
+typedef struct join_iter
+{
+    struct special_iter * special;  /* special_iter.h ( for ft_special ) */
+    struct fastq_csra_iter * fastq; /* fastq_iter.h ( for all fastq-formats ) */
+} join_iter;
+
+static void release_join_iter( join_iter * iter )
+{
+    if ( iter -> special != NULL )
+        destroy_special_iter( iter -> special ); /* special_iter.c */
+    if ( iter -> fastq != NULL )
+        destroy_fastq_csra_iter( iter -> fastq ); /* fastq_iter.c */
+}
+
+static rc_t make_join_iter( cmn_params * cp,
+                            format_t fmt,
+                            const join_options * jo,
+                            bool cmp_read_present,
+                            join_iter * iter )
+{
+    rc_t rc;
+    iter -> special = NULL;
+    iter -> fastq = NULL;
+    if ( fmt == ft_special )
+    {
+        rc = make_special_iter( cp, &( iter -> special ) ); /* special_iter.c */
+        if ( rc != 0 )
+            ErrMsg( "make_special_iter() -> %R", rc );
+    }
+    else
+    {
+        fastq_iter_opt opt;
+        opt . with_read_len = ( fmt != ft_whole_spot );
+        opt . with_name = !( jo -> rowid_as_name );
+        opt . with_read_type = true;
+        opt . with_cmp_read = cmp_read_present;
+
+        rc = make_fastq_csra_iter( cp, opt, &( iter -> fastq ) ); /* fastq-iter.c */
+        if ( rc != 0 )
+            ErrMsg( "make_join_iter().make_fastq_csra_iter() -> %R", rc );
+    }
+    return rc;
+}
+
+static uint64_t join_iter_bytes_read( const join_iter * iter )
+{
+    if ( iter -> special != NULL )
+        return get_bytes_read_of_special_iter( iter -> special ); /* special_iter.c */
+    return get_bytes_read_of_fastq_csra_iter( iter -> fastq ); /* fastq_iter.c */
+}
+
+static rc_t join_iter_set_range( join_iter * iter, int64_t first_row, uint64_t row_count )
+{
+    if ( iter -> special != NULL )
+        return special_iter_set_range( iter -> special, first_row, row_count ); /* special_iter.c */
+    return fastq_csra_iter_set_range( iter -> fastq, first_row, row_count ); /* fastq_iter.c */
+}
+
+/* ------------------------------------------------------------------------------------------ */
+
 typedef struct join_thread_data
 {
     char part_file[ 4096 ];
@@ -1063,12 +1081,17 @@ typedef struct join_thread_data
     const char * accession_short;
     const char * lookup_filename;
     const char * index_filename;
+    const struct mem_lookup * mem_lookup;
     struct bg_progress * progress;
     struct temp_registry * registry;
+    struct chunk_writer * writer;   /* chunk_writer.h ( NULL: write into temp-files ) */
+    struct phase_report * report;   /* phase_report.h ( can be NULL ) */
+    atomic64_t * next_chunk;        /* shared by all threads: the next chunk to be taken */
     KThread * thread;
     
     int64_t first_row;
     uint64_t row_count;
+    uint64_t num_chunks;
     size_t cur_cache;
     size_t buf_size;
     format_t fmt;
@@ -1079,11 +1102,93 @@ typedef struct join_thread_data
     
 } join_thread_data;
 
+static rc_t perform_join( join_thread_data * jtd, join * j, join_iter * iter )
+{
+    rc_t rc = 0;
+    switch ( jtd -> fmt )
+    {
+        case ft_special             : rc = perform_special_join( iter -> special,
+                                                j,
+                                                jtd -> progress ); break;
+
+        case ft_whole_spot          : rc = perform_whole_spot_join( iter -> fastq,
+                                                &jtd -> stats,
+                                                j,
+                                                jtd -> progress,
+                                                jtd -> join_options ); break;
+
+        case ft_fastq_split_spot    : rc = perform_fastq_split_spot_join( iter -> fastq,
+                                                &jtd -> stats,
+                                                j,
+                                                jtd -> progress,
+                                                jtd -> join_options ); break;
+
+        case ft_fastq_split_file    : rc = perform_fastq_split_file_join( iter -> fastq,
+                                                &jtd -> stats,
+                                                j,
+                                                jtd -> progress,
+                                                jtd -> join_options ); break;
+
+        case ft_fastq_split_3       : rc = perform_fastq_split_3_join( iter -> fastq,
+                                                &jtd -> stats,
+                                                j,
+                                                jtd -> progress,
+                                                jtd -> join_options ); break;
+
+        default : break;
+    }
+    return rc;
+}
+
+/* the threads take chunks of JOIN_CHUNK_ROWS rows in order, until all are gone:
+   a thread that hits a slow part of the table does not hold up the others */
+static rc_t perform_chunked_join( join_thread_data * jtd, join * j, join_iter * iter )
+{
+    rc_t rc = 0;
+    bool done = false;
+    while ( rc == 0 && !done )
+    {
+        struct out_chunk * chunk;
+        rc = chunk_writer_get( jtd -> writer, &chunk ); /* chunk_writer.c */
+        if ( rc == 0 )
+        {
+            /* take the number after we have a chunk: the writer relies on that */
+            uint64_t seq = atomic64_read_and_add( jtd -> next_chunk, 1 );
+            done = ( seq >= jtd -> num_chunks );
+            if ( done )
+                rc = chunk_writer_return( jtd -> writer, chunk ); /* chunk_writer.c */
+            else
+            {
+                rc_t rc1;
+                uint64_t offset = seq * JOIN_CHUNK_ROWS;
+                uint64_t count = jtd -> row_count - offset;
+                if ( count > JOIN_CHUNK_ROWS )
+                    count = JOIN_CHUNK_ROWS;
+
+                rc = join_iter_set_range( iter, jtd -> first_row + offset, count ); /* above */
+                if ( rc == 0 )
+                {
+                    join_results_set_chunk( j -> results, chunk ); /* join_results.c */
+                    rc = perform_join( jtd, j, iter ); /* above */
+                    join_results_set_chunk( j -> results, NULL ); /* join_results.c */
+                }
+
+                /* the chunk goes back even if we failed, the writer has to know about it */
+                rc1 = chunk_writer_put( jtd -> writer, chunk, seq, rc ); /* chunk_writer.c */
+                if ( rc == 0 )
+                    rc = rc1;
+            }
+        }
+    }
+    return rc;
+}
+
 static rc_t CC cmn_thread_func( const KThread * self, void * data )
 {
     rc_t rc = 0;
     join_thread_data * jtd = data;
     struct join_results * results = NULL;
+    struct phase_timer * timer = phase_timer_start( jtd -> report, ph_join, jtd -> thread_id ); /* phase_report.c */
     
     if ( rc == 0 )
         rc = make_join_results( jtd -> dir,
@@ -1107,49 +1212,33 @@ static rc_t CC cmn_thread_func( const KThread * self, void * data )
                         results,
                         jtd -> lookup_filename,
                         jtd -> index_filename,
+                        jtd -> mem_lookup,
                         jtd -> buf_size,
                         jtd -> cmp_read_present,
                         &j ); /* above */
         if ( rc == 0 )
         {
+            join_iter iter;
             j . thread_id = jtd -> thread_id;
 
-            switch ( jtd -> fmt )
+            rc = make_join_iter( &cp, jtd -> fmt, jtd -> join_options, jtd -> cmp_read_present, &iter ); /* above */
+            if ( rc == 0 )
             {
-                case ft_special             : rc = perform_special_join( &cp,
-                                                        &j,
-                                                        jtd -> progress ); break;
-
-                case ft_whole_spot          : rc = perform_whole_spot_join( &cp,
-                                                        &jtd -> stats,
-                                                        &j,
-                                                        jtd -> progress,
-                                                        jtd -> join_options ); break;
-
-                case ft_fastq_split_spot    : rc = perform_fastq_split_spot_join( &cp,
-                                                        &jtd -> stats,
-                                                        &j,
-                                                        jtd -> progress,
-                                                        jtd -> join_options ); break;
-
-                case ft_fastq_split_file    : rc = perform_fastq_split_file_join( &cp,
-                                                        &jtd -> stats,
-                                                        &j,
-                                                        jtd -> progress,
-                                                        jtd -> join_options ); break;
-
-                case ft_fastq_split_3       : rc = perform_fastq_split_3_join( &cp,
-                                                        &jtd -> stats,
-                                                        &j,
-                                                        jtd -> progress,
-                                                        jtd -> join_options ); break;
-
-                default : break;
+                if ( jtd -> writer != NULL )
+                    rc = perform_chunked_join( jtd, &j, &iter ); /* above */
+                else
+                    rc = perform_join( jtd, &j, &iter ); /* above */
+                phase_timer_add( timer,
+                                 j . loop_nr,
+                                 join_iter_bytes_read( &iter ),
+                                 join_results_bytes_written( results ) ); /* phase_report.c and above */
+                release_join_iter( &iter ); /* above */
             }
             release_join_ctx( &j );
         }
         destroy_join_results( results );
     }
+    phase_timer_stop( timer ); /* phase_report.c */
     return rc;
 }
 
@@ -1160,6 +1249,7 @@ rc_t execute_db_join( KDirectory * dir,
                     join_stats * stats,
                     const char * lookup_filename,
                     const char * index_filename,
+                    const struct mem_lookup * mem_lookup,
                     const struct temp_dir * temp_dir,
                     struct temp_registry * registry,
                     size_t cur_cache,
@@ -1167,7 +1257,12 @@ rc_t execute_db_join( KDirectory * dir,
                     uint32_t num_threads,
                     bool show_progress,
                     format_t fmt,
-                    const join_options * join_options )
+                    const join_options * join_options,
+                    bool to_stdout,
+                    const char * output_filename,
+                    compress_t compress,
+                    bool force,
+                    struct phase_report * report )
 {
     rc_t rc = 0;
     
@@ -1195,6 +1290,9 @@ rc_t execute_db_join( KDirectory * dir,
             uint32_t thread_id;
             uint64_t rows_per_thread;
             struct bg_progress * progress = NULL;
+            struct chunk_writer * writer = NULL;
+            atomic64_t next_chunk;
+            uint64_t num_chunks = 0;
             struct join_options corrected_join_options;
             
             VectorInit( &threads, 0, num_threads );
@@ -1219,6 +1317,15 @@ rc_t execute_db_join( KDirectory * dir,
 
             if ( show_progress )
                 rc = bg_progress_make( &progress, row_count, 0, 0 ); /* progress_thread.c */
+
+            if ( rc == 0 && ( to_stdout || output_filename != NULL ) )
+            {
+                /* on stdout the memory is capped by the number of chunks in flight */
+                num_chunks = ( row_count + JOIN_CHUNK_ROWS - 1 ) / JOIN_CHUNK_ROWS;
+                atomic64_set( &next_chunk, 0 );
+                rc = make_chunk_writer( &writer, dir, to_stdout ? NULL : output_filename, buf_size, compress, force,
+                                        num_threads * JOIN_CHUNKS_PER_THREAD, num_threads ); /* chunk_writer.c */
+            }
             
             for ( thread_id = 0; rc == 0 && thread_id < num_threads; ++thread_id )
             {
@@ -1233,8 +1340,22 @@ rc_t execute_db_join( KDirectory * dir,
                     jtd -> accession_short  = accession_short;
                     jtd -> lookup_filename  = lookup_filename;
                     jtd -> index_filename   = index_filename;
-                    jtd -> first_row        = row;
-                    jtd -> row_count        = rows_per_thread;
+                    jtd -> mem_lookup       = mem_lookup;
+                    if ( writer != NULL )
+                    {
+                        /* every thread can reach every row, the chunks are handed out by next_chunk */
+                        jtd -> first_row    = 1;
+                        jtd -> row_count    = row_count;
+                    }
+                    else
+                    {
+                        jtd -> first_row    = row;
+                        jtd -> row_count    = rows_per_thread;
+                    }
+                    jtd -> writer           = writer;
+                    jtd -> report           = report;
+                    jtd -> next_chunk       = &next_chunk;
+                    jtd -> num_chunks       = num_chunks;
                     jtd -> cur_cache        = cur_cache;
                     jtd -> buf_size         = buf_size;
                     jtd -> progress         = progress;
@@ -1285,6 +1406,14 @@ rc_t execute_db_join( KDirectory * dir,
                 }
                 VectorWhack ( &threads, NULL, NULL );
             }
+
+            if ( writer != NULL )
+            {
+                /* wait for the writer to put the last chunks into the output-files */
+                rc_t rc1 = release_chunk_writer( writer ); /* chunk_writer.c */
+                if ( rc == 0 )
+                    rc = rc1;
+            }
             bg_progress_release( progress ); /* progress_thread.c ( ignores NULL )*/
         }
     }
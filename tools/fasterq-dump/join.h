@@ -55,6 +55,17 @@ extern "C" {
 #include "temp_registry.h"
 #endif
 
+#ifndef _h_mem_lookup_
+#include "mem_lookup.h"
+#endif
+
+#ifndef _h_phase_report_
+#include "phase_report.h"
+#endif
+
+/* if output_filename is not NULL the join-threads write in row-order directly into the
+   output-file(s) ( chunk_writer.c ), if to_stdout is set they write in row-order to stdout,
+   otherwise into temp-files registered in the registry */
 rc_t execute_db_join( KDirectory * dir,
                     const VDBManager * vdb_mgr,
                     const char * accession_path,
@@ -62,6 +73,7 @@ rc_t execute_db_join( KDirectory * dir,
                     join_stats * stats,
                     const char * lookup_filename,
                     const char * index_filename,
+                    const struct mem_lookup * mem_lookup,
                     const struct temp_dir * temp_dir,
                     struct temp_registry * registry,
                     size_t cur_cache,
@@ -69,7 +81,12 @@ rc_t execute_db_join( KDirectory * dir,
                     uint32_t num_threads,
                     bool show_progress,
                     format_t fmt,
-                    const join_options * join_options );
+                    const join_options * join_options,
+                    bool to_stdout,
+                    const char * output_filename,
+                    compress_t compress,
+                    bool force,
+                    struct phase_report * report );
 
 rc_t check_lookup( const KDirectory * dir,
                    size_t buf_size,
@@ -25,6 +25,7 @@
 */
 #include "join_results.h"
 #include "helper.h"
+#include "chunk_writer.h"
 #include <klib/vector.h>
 #include <klib/printf.h>
 #include <kfs/buffile.h>
@@ -65,7 +66,9 @@ typedef struct join_results
     print_v2 v2_print_name_not_null;    
     SBuffer print_buffer;   /* we have only one print_buffer... */
     Vector printers;
+    struct out_chunk * chunk;   /* if set: print into it instead of into the printers ( chunk_writer.h ) */
     size_t buffer_size;
+    uint64_t bytes_written;     /* how many bytes have been printed into the files / chunks */
     bool print_frag_nr, print_name;
 } join_results;
 
@@ -567,6 +570,43 @@ static rc_t make_join_printer( join_results * self, uint32_t read_id, join_print
     return rc;
 }
 
+void join_results_set_chunk( struct join_results * self, struct out_chunk * chunk )
+{
+    if ( self != NULL )
+        self -> chunk = chunk;
+}
+
+uint64_t join_results_bytes_written( const struct join_results * self )
+{
+    if ( self == NULL )
+        return 0;
+    return self -> bytes_written;
+}
+
+static rc_t print_to_chunk( struct join_results * self, uint32_t read_id, const char * fmt, va_list args )
+{
+    rc_t rc = 0;
+    bool done = false;
+    while ( rc == 0 && !done )
+    {
+        va_list args_copy;
+        va_copy( args_copy, args );
+        rc = print_to_SBufferV( & self -> print_buffer, fmt, args_copy );
+        va_end( args_copy );
+
+        done = ( rc == 0 );
+        if ( !done )
+            rc = try_to_enlarge_SBuffer( & self -> print_buffer, rc );
+    }
+    if ( rc == 0 )
+        rc = out_chunk_write( self -> chunk, read_id,
+                              self -> print_buffer . S . addr,
+                              self -> print_buffer . S . size ); /* chunk_writer.c */
+    if ( rc == 0 )
+        self -> bytes_written += self -> print_buffer . S . size;
+    return rc;
+}
+
 rc_t join_results_print( struct join_results * self, uint32_t read_id, const char * fmt, ... )
 {
     rc_t rc = 0;
@@ -574,6 +614,14 @@ rc_t join_results_print( struct join_results * self, uint32_t read_id, const cha
         rc = RC( rcVDB, rcNoTarg, rcWriting, rcSelf, rcNull );
     else if ( fmt == NULL )
         rc = RC( rcVDB, rcNoTarg, rcWriting, rcParam, rcNull );
+    else if ( self -> chunk != NULL )
+    {
+        va_list args;
+        va_start ( args, fmt );
+        rc = print_to_chunk( self, read_id, fmt, args ); /* above */
+        va_end ( args );
+    }
+    else
     {
         join_printer * p = VectorGet ( &self -> printers, read_id );
         if ( p == NULL )
@@ -617,7 +665,10 @@ rc_t join_results_print( struct join_results * self, uint32_t read_id, const cha
                     ErrMsg( "join_results_print().KFileWriteAll( at %lu ) ( %d vs %d ) -> %R", p -> file_pos, to_write, num_writ, rc );
                 }
                 else
+                {
                     p -> file_pos += num_writ;
+                    self -> bytes_written += num_writ;
+                }
             }
         }
     }
@@ -64,6 +64,13 @@ rc_t make_join_results( struct KDirectory * dir,
 bool join_results_match( struct join_results * self, const String * bases );
 bool join_results_match2( struct join_results * self, const String * bases1, const String * bases2 );
 
+/* from now on print into this chunk, instead of into the per-read_id files ( NULL switches back ) */
+struct out_chunk;
+void join_results_set_chunk( struct join_results * self, struct out_chunk * chunk );
+
+/* how many bytes have been printed so far ( into the files or the chunk ) */
+uint64_t join_results_bytes_written( const struct join_results * self );
+
 rc_t join_results_print( struct join_results * self, uint32_t read_id, const char * fmt, ... );
 
 rc_t join_results_print_fastq_v1( struct join_results * self,
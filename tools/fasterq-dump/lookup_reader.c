@@ -31,14 +31,20 @@
 #include <klib/printf.h>
 #include <kfs/file.h>
 #include <kfs/buffile.h>
+#include <kfs/mmap.h>
 
 #include <string.h>
 #include <stdio.h>
 
+/* every record: [ key : 8 bytes ][ packed 2na-header ][ 2na-bytes and N-runs ] */
+#define REC_HDR_SIZE ( 8 + PACKED_2NA_HDR )
+
 typedef struct lookup_reader
 {
     const struct KFile * f;
     const struct index_reader * index;
+    const KMMap * mm;       /* the mapped lookup-file, only used together with an index */
+    const uint8_t * data;
     SBuffer buf;
     uint64_t pos, f_size, max_key;
 } lookup_reader;
@@ -48,15 +54,40 @@ void release_lookup_reader( struct lookup_reader * self )
 {
     if ( self != NULL )
     {
+        if ( self -> mm != NULL ) KMMapRelease( self -> mm );
         if ( self -> f != NULL ) KFileRelease( self -> f );
         release_SBuffer( &self -> buf );
         free( ( void * ) self );
     }
 }
 
+/* with an index the records are accessed randomly: map the whole lookup-file,
+   if that is not possible we fall back to reading from the file */
+static void map_lookup_file( lookup_reader * r, const struct KFile * f )
+{
+    if ( r -> f_size > 0 && KMMapMakeRead( &r -> mm, f ) == 0 )
+    {
+        size_t mm_size;
+        const void * addr;
+        rc_t rc = KMMapSize( r -> mm, &mm_size );
+        if ( rc == 0 && mm_size != r -> f_size )
+            rc = RC( rcVDB, rcNoTarg, rcConstructing, rcSize, rcInvalid );
+        if ( rc == 0 )
+            rc = KMMapAddrRead( r -> mm, &addr );
+        if ( rc == 0 )
+            r -> data = addr;
+        else
+        {
+            KMMapRelease( r -> mm );
+            r -> mm = NULL;
+        }
+    }
+}
+
 static rc_t make_lookup_reader_obj( struct lookup_reader ** reader,
                                     const struct index_reader * index,
-                                    const struct KFile * f )
+                                    const struct KFile * f,
+                                    const struct KFile * to_map )
 {
     rc_t rc = 0;
     lookup_reader * r = calloc( 1, sizeof * r );
@@ -73,7 +104,11 @@ static rc_t make_lookup_reader_obj( struct lookup_reader ** reader,
         if ( rc == 0 )
             rc = make_SBuffer( &( r -> buf ), 4096 );
         if ( rc == 0 && index != NULL )
-            rc = get_max_key( index, & r -> max_key );
+        {
+            rc = get_max_key( index, & r -> max_key ); /* index.c */
+            if ( rc == 0 )
+                map_lookup_file( r, to_map );
+        }
 
         if ( rc == 0 )
             *reader = r;
@@ -97,6 +132,7 @@ rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * inde
         ErrMsg( "lookup_reader.c make_lookup_reader().KDirectoryVOpenFileRead( '?' ) -> %R",  rc );
     else
     {
+        const struct KFile * raw = f;
         if ( buf_size > 0 )
         {
             const struct KFile * temp_file = NULL;
@@ -104,14 +140,14 @@ rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * inde
             if ( rc != 0 )
                 ErrMsg( "lookup_reader.c make_lookup_reader().KBufFileMakeRead() -> %R", rc );
             else
-            {
-                KFileRelease( f );
                 f = temp_file;
-            }
         }
         
+        /* the raw file ( not the buffered one ) is needed to map it */
         if ( rc == 0 )
-            rc = make_lookup_reader_obj( reader, index, f );
+            rc = make_lookup_reader_obj( reader, index, f, raw );
+        if ( raw != f )
+            KFileRelease( raw );
     }
     va_end ( args );
     return rc;
@@ -121,7 +157,7 @@ rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * inde
 static rc_t read_key_and_len( struct lookup_reader * self, uint64_t pos, uint64_t *key, size_t *len )
 {
     size_t num_read;
-    uint8_t buffer[ 10 ];
+    uint8_t buffer[ REC_HDR_SIZE ];
     rc_t rc = KFileReadAll( self -> f, pos, buffer, sizeof buffer, &num_read );
     if ( rc != 0 )
     {
@@ -136,14 +172,8 @@ static rc_t read_key_and_len( struct lookup_reader * self, uint64_t pos, uint64_
     }
     else
     {
-        uint16_t dna_len;
-        size_t packed_len;
         memmove( key, buffer, sizeof *key );
-        dna_len = buffer[ 8 ];
-        dna_len <<= 8;
-        dna_len |= buffer[ 9 ];
-        packed_len = ( dna_len & 1 ) ? ( dna_len + 1 ) >> 1 : dna_len >> 1;
-        *len = ( ( sizeof *key ) + ( sizeof dna_len ) + packed_len );
+        *len = ( ( sizeof *key ) + packed_2na_size( &buffer[ 8 ] ) ); /* helper.c */
     }
     return rc;
 }
@@ -203,51 +233,21 @@ static rc_t full_table_seek( struct lookup_reader * self, uint64_t key_to_find,
 }
 
 
-static rc_t indexed_seek( struct lookup_reader * self, uint64_t key_to_find, uint64_t * key_found, bool exactly )
+static rc_t indexed_seek( struct lookup_reader * self, uint64_t key_to_find, uint64_t * key_found )
 {
-    /* we have a index! find set pos to the found offset */
-    rc_t rc;
-    uint64_t offset = 0;
-    if ( self -> max_key > 0 && ( key_to_find > self -> max_key ) )
-    {
-        rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcTooBig );
-        /* ErrMsg( "lookup_reader.c indexed_seek( key_to_find=%lu, max_key=%lu ) -> %R", key_to_find, self -> max_key, rc ); */
-    }
-    else
+    /* the index has an entry for every key, there is no scanning for the key */
+    uint64_t offset;
+    rc_t rc = get_offset( self -> index, key_to_find, &offset ); /* index.c */
+    if ( rc == 0 )
     {
-        rc = get_nearest_offset( self -> index, key_to_find, key_found, &offset ); /* in index.c */
-        if ( rc == 0 )
-        {
-            if ( keys_equal( key_to_find, *key_found ) )
-                self -> pos = offset;
-            else
-            {
-                if ( exactly )
-                {
-                    rc = loop_until_key_found( self, key_to_find, key_found, &offset );
-                    if ( rc == 0 )
-                    {
-                        if ( keys_equal( key_to_find, *key_found ) )
-                            self -> pos = offset;
-                        else
-                            rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-                    }
-                    else
-                        rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-                }
-                else
-                {
-                    self -> pos = offset;
-                    rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcId, rcNotFound );
-                }
-            }
-        }
+        self -> pos = offset;
+        *key_found = key_to_find;
     }
     return rc;
 }
 
 
-rc_t seek_lookup_reader( struct lookup_reader * self, uint64_t key_to_find, uint64_t * key_found, bool exactly )
+rc_t seek_lookup_reader( struct lookup_reader * self, uint64_t key_to_find, uint64_t * key_found )
 {
     rc_t rc = 0;
     if ( self == NULL || key_found == NULL )
@@ -258,11 +258,7 @@ rc_t seek_lookup_reader( struct lookup_reader * self, uint64_t key_to_find, uint
     else
     {
         if ( self -> index != NULL )
-        {
-            rc = indexed_seek( self, key_to_find, key_found, exactly );
-            if ( rc != 0 )
-                rc = full_table_seek( self, key_to_find, key_found );
-        }
+            rc = indexed_seek( self, key_to_find, key_found );
         else
             rc = full_table_seek( self, key_to_find, key_found );
     }
@@ -284,12 +280,12 @@ rc_t lookup_reader_get( struct lookup_reader * self, uint64_t * key, SBuffer * p
         else
         {
             size_t num_read;
-            uint8_t buffer1[ 10 ];
+            uint8_t buffer1[ REC_HDR_SIZE ];
             
             rc = KFileReadAll( self -> f, self -> pos, buffer1, sizeof buffer1, &num_read );
             if ( rc != 0 )
             {
-                /* we are not able to read 10 bytes from the file */
+                /* we are not able to read the record-header from the file */
                 ErrMsg( "lookup_reader.c lookup_reader_get().KFileReadAll( at %ld, to_read %u ) -> %R", self -> pos, sizeof buffer1, rc );
             }
             else
@@ -301,55 +297,48 @@ rc_t lookup_reader_get( struct lookup_reader * self, uint64_t * key, SBuffer * p
                 }
                 else
                 {
-                    uint16_t dna_len;
                     size_t to_read;
                     
-                    /* we get the key out of the 10 bytes */
+                    /* we get the key out of the record-header */
                     memmove( key, buffer1, sizeof *key );
 
-                    /* we get the dna-len out of the 10 bytes */
-                    dna_len = buffer1[ 8 ];
-                    dna_len <<= 8;
-                    dna_len |= buffer1[ 9 ];
-
-                    /* adjust the number of bytes to read to the half of the dna_len */
-                    to_read = ( dna_len & 1 ) ? ( dna_len + 1 ) >> 1 : dna_len >> 1;
+                    /* the packed-header tells us how many bytes of 2na and N-runs follow */
+                    to_read = packed_2na_size( &buffer1[ 8 ] ) - PACKED_2NA_HDR; /* helper.c */
                     if ( to_read == 0 )
                     {
                         rc = SILENT_RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
                         ErrMsg( "lookup_reader.c lookup_reader_get() to_read == 0 at %lu", self -> pos );
                         packed_bases -> S . size = 0;
                         packed_bases -> S . len = 0;
-                        self -> pos += ( 10 );
+                        self -> pos += REC_HDR_SIZE;
                     }
                     else
                     {
                         /* maybe we have to increase the size of the SBuffer, after seeing the real dna-length */
-                        if ( packed_bases -> buffer_size < ( to_read + 2 ) )
-                            rc = increase_SBuffer( packed_bases, ( to_read + 2 ) - packed_bases -> buffer_size );
+                        if ( packed_bases -> buffer_size < ( to_read + PACKED_2NA_HDR ) )
+                            rc = increase_SBuffer( packed_bases, ( to_read + PACKED_2NA_HDR ) - packed_bases -> buffer_size );
                         
                         if ( rc == 0 )
                         {
                             uint8_t * dst = ( uint8_t * )( packed_bases -> S . addr );
                             
-                            /* we write the dna-len into the first 2 bytes of the destination */
-                            dst[ 0 ] = buffer1[ 8 ];
-                            dst[ 1 ] = buffer1[ 9 ];
-                            dst += 2;
+                            /* we write the packed-header into the first bytes of the destination */
+                            memmove( dst, &buffer1[ 8 ], PACKED_2NA_HDR );
+                            dst += PACKED_2NA_HDR;
 
-                            rc = KFileReadAll( self -> f, self -> pos + 10, dst, to_read, &num_read );
+                            rc = KFileReadAll( self -> f, self -> pos + REC_HDR_SIZE, dst, to_read, &num_read );
                             if ( rc != 0 )
-                                ErrMsg( "lookup_reader.c lookup_reader_get().KFileReadAll( at %ld, to_read %u ) -> %R", self -> pos + 10, to_read, rc );
+                                ErrMsg( "lookup_reader.c lookup_reader_get().KFileReadAll( at %ld, to_read %u ) -> %R", self -> pos + REC_HDR_SIZE, to_read, rc );
                             else if ( num_read != to_read )
                             {
                                 rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
-                                ErrMsg( "lookup_reader.c lookup_reader_get().KFileReadAll( %ld ) %d vs %d -> %R", self -> pos + 10, num_read, to_read, rc );
+                                ErrMsg( "lookup_reader.c lookup_reader_get().KFileReadAll( %ld ) %d vs %d -> %R", self -> pos + REC_HDR_SIZE, num_read, to_read, rc );
                             }
                             else
                             {
-                                packed_bases -> S . size = num_read + 2;
+                                packed_bases -> S . size = num_read + PACKED_2NA_HDR;
                                 packed_bases -> S . len = ( uint32_t )packed_bases -> S . size;
-                                self -> pos += ( num_read + 10 );
+                                self -> pos += ( num_read + REC_HDR_SIZE );
                             }
                         }
                     }
@@ -360,13 +349,78 @@ rc_t lookup_reader_get( struct lookup_reader * self, uint64_t * key, SBuffer * p
     return rc;
 }
 
+/* points packed to the record at offset inside the mapped lookup-file, no copy is made */
+static rc_t mapped_get( const struct lookup_reader * self, uint64_t offset, uint64_t * key, String * packed )
+{
+    rc_t rc = 0;
+    if ( ( offset + REC_HDR_SIZE ) > self -> f_size )
+        rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+    else
+    {
+        const uint8_t * rec = self -> data + offset;
+        size_t packed_len = packed_2na_size( &rec[ 8 ] ); /* helper.c */
+
+        memmove( key, rec, sizeof *key );
+        if ( ( offset + 8 + packed_len ) > self -> f_size )
+            rc = RC( rcVDB, rcNoTarg, rcReading, rcFormat, rcInvalid );
+        else
+            StringInit( packed, ( const char * )&rec[ 8 ], packed_len, ( uint32_t )packed_len );
+    }
+    if ( rc != 0 )
+        ErrMsg( "lookup_reader.c mapped_get( at %lu of %lu ) -> %R", offset, self -> f_size, rc );
+    return rc;
+}
+
+static rc_t indexed_lookup_bases( struct lookup_reader * self, int64_t row_id, uint32_t read_id,
+                                  SBuffer * B, bool reverse )
+{
+    uint64_t key_to_find = make_key( row_id, read_id ); /* helper.c */
+    uint64_t offset;
+    rc_t rc = get_offset( self -> index, key_to_find, &offset ); /* index.c */
+    if ( rc != 0 )
+        ErrMsg( "lookup_reader.c lookup_bases( %lu.%u ) ---> not in index ---> %R", row_id, read_id, rc );
+    else
+    {
+        uint64_t key;
+        String packed;
+
+        if ( self -> data != NULL )
+            rc = mapped_get( self, offset, &key, &packed );
+        else
+        {
+            self -> pos = offset;
+            rc = lookup_reader_get( self, &key, &self -> buf );
+            if ( rc == 0 )
+                packed = self -> buf . S;
+        }
+
+        if ( rc == 0 )
+        {
+            if ( key == key_to_find )
+                rc = unpack_2na( &packed, B, reverse ); /* helper.c */
+            else
+            {
+                rc = RC( rcVDB, rcNoTarg, rcConstructing, rcTransfer, rcInvalid );
+                ErrMsg( "lookup_reader.c lookup_bases( %lu.%u ) ---> found key %lu at %lu",
+                        row_id, read_id, key, offset );
+            }
+        }
+    }
+    return rc;
+}
+
 rc_t lookup_bases( struct lookup_reader * self, int64_t row_id, uint32_t read_id, SBuffer * B, bool reverse )
 {
     int64_t found_row_id;
     uint32_t found_read_id;
     uint64_t key;
+    rc_t rc;
+
+    if ( self -> index != NULL )
+        return indexed_lookup_bases( self, row_id, read_id, B, reverse ); /* above */
 
-    rc_t rc = lookup_reader_get( self, &key, &self -> buf );
+    /* without an index: read sequentially, scan from the start if not pointed to the right position */
+    rc = lookup_reader_get( self, &key, &self -> buf );
     if ( rc == 0 )
     {
         found_row_id = key >> 1;
@@ -374,7 +428,7 @@ rc_t lookup_bases( struct lookup_reader * self, int64_t row_id, uint32_t read_id
         
         if ( found_row_id == row_id && found_read_id == read_id )
         {
-            rc = unpack_4na( &self -> buf . S, B, reverse ); /* helper.c */
+            rc = unpack_2na( &self -> buf . S, B, reverse ); /* helper.c */
         }
         else
         {
@@ -389,7 +443,7 @@ rc_t lookup_bases( struct lookup_reader * self, int64_t row_id, uint32_t read_id
             else
                 key_to_find |= 1;
                 
-            rc1 = seek_lookup_reader( self, key_to_find, &key_found, true );
+            rc1 = seek_lookup_reader( self, key_to_find, &key_found );
             if ( rc1 == 0 )
             {
                 rc = lookup_reader_get( self, &key, &self -> buf );
@@ -400,7 +454,7 @@ rc_t lookup_bases( struct lookup_reader * self, int64_t row_id, uint32_t read_id
 
                     if ( found_row_id == row_id && found_read_id == read_id )
                     {
-                        rc = unpack_4na( &self -> buf . S, B, reverse ); /* helper.c */
+                        rc = unpack_2na( &self -> buf . S, B, reverse ); /* helper.c */
                     }
                     else
                     {
@@ -55,7 +55,7 @@ void release_lookup_reader( struct lookup_reader * self );
 rc_t make_lookup_reader( const KDirectory *dir, const struct index_reader * index,
                          struct lookup_reader ** reader, size_t buf_size, const char * fmt, ... );
 
-rc_t seek_lookup_reader( struct lookup_reader * self, uint64_t key, uint64_t * key_found, bool exactly );
+rc_t seek_lookup_reader( struct lookup_reader * self, uint64_t key, uint64_t * key_found );
 
 rc_t lookup_reader_get( struct lookup_reader * self, uint64_t * key, SBuffer * packed_bases );
 rc_t lookup_bases( struct lookup_reader * self, int64_t row_id, uint32_t read_id, SBuffer * B, bool reverse );
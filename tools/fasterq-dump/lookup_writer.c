@@ -115,7 +115,7 @@ rc_t make_lookup_writer( KDirectory *dir, struct index_writer * idx,
 
 rc_t write_packed_to_lookup_writer( struct lookup_writer * writer,
                                     uint64_t key,
-                                    const String * bases_as_packed_4na )
+                                    const String * bases_as_packed_2na )
 {
     size_t num_writ;
     /* first write the key ( combination of seq-id and read-id ) */
@@ -134,15 +134,15 @@ rc_t write_packed_to_lookup_writer( struct lookup_writer * writer,
         uint64_t start_pos = writer -> pos; /* store the pos to be written later to the index... */
             
         writer -> pos += num_writ;
-        /* now write the packed 4na ( length + packed data ) */
+        /* now write the packed 2na ( header + packed data + N-runs ) */
         rc = KFileWriteAll( writer -> f,
                             writer -> pos,
-                            bases_as_packed_4na -> addr,
-                            bases_as_packed_4na -> size,
+                            bases_as_packed_2na -> addr,
+                            bases_as_packed_2na -> size,
                             &num_writ );
         if ( rc != 0 )
             ErrMsg( "KFileWriteAll( bases ) -> %R", rc );
-        else if ( num_writ != bases_as_packed_4na -> size )
+        else if ( num_writ != bases_as_packed_2na -> size )
         {
             rc = RC( rcVDB, rcNoTarg, rcWriting, rcFormat, rcInvalid );
             ErrMsg( "KFileWriteAll( bases ) -> %R", rc );
@@ -163,7 +163,7 @@ rc_t write_unpacked_to_lookup_writer( struct lookup_writer * writer,
                                       const String * bases_as_unpacked_4na )
 {
     uint64_t key = make_key( seq_spot_id, seq_read_id ); /* helper.c */
-    rc_t rc = pack_4na( bases_as_unpacked_4na, &writer -> buf ); /* helper.c */
+    rc_t rc = pack_4na_2_2na( bases_as_unpacked_4na, &writer -> buf ); /* helper.c */
     if ( rc != 0 )
         ErrMsg( "write_unpacked_to_lookup_writer() -> %R", rc );
     else
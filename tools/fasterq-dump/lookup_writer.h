@@ -58,7 +58,7 @@ rc_t write_unpacked_to_lookup_writer( struct lookup_writer * writer,
             int64_t seq_spot_id, uint32_t seq_read_id, const String * bases_as_unpacked_4na );
 
 rc_t write_packed_to_lookup_writer( struct lookup_writer * writer,
-            uint64_t key, const String * bases_as_packed_4na );
+            uint64_t key, const String * bases_as_packed_2na );
 
 #ifdef __cplusplus
 }
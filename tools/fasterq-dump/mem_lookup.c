@@ -0,0 +1,355 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "mem_lookup.h"
+
+#include <kproc/lock.h>
+#include <atomic64.h>
+
+#include <stdlib.h>
+
+#define MEM_LOOKUP_SHARDS 256              /* has to be a power of 2 */
+#define MEM_LOOKUP_INITIAL_SLOTS 1024      /* per shard, has to be a power of 2 */
+#define MEM_LOOKUP_MIN_CHUNK_SIZE ( 64 * 1024 )
+#define MEM_LOOKUP_MAX_CHUNK_SIZE ( 8 * 1024 * 1024 )
+
+/* an entry in the hash-table of a shard:
+   key 0 marks an empty slot ( make_key() never produces 0, spot-ids start at 1 )
+   ref is the chunk-index in the upper, the offset inside the chunk in the lower 32 bits */
+typedef struct mem_lookup_slot
+{
+    uint64_t key;
+    uint64_t ref;
+} mem_lookup_slot;
+
+typedef struct mem_lookup_shard
+{
+    KLock * lock;
+    mem_lookup_slot * slots;
+    uint8_t ** chunks;
+    uint64_t count;             /* number of used slots */
+    uint64_t mask;              /* number of slots - 1 */
+    size_t chunk_used;          /* bytes used in the last chunk */
+    size_t chunk_size;          /* size of the last chunk, doubles with each new chunk
+                                   or is as big as a packed read that does not fit */
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;    /* entries in the chunks-array */
+} mem_lookup_shard;
+
+typedef struct mem_lookup
+{
+    mem_lookup_shard shards[ MEM_LOOKUP_SHARDS ];
+    atomic64_t bytes_used;
+    atomic64_t entries;
+    size_t mem_budget;
+} mem_lookup;
+
+/* ------------------------------------------------------------------------------------ */
+
+static uint64_t hash_key( uint64_t key )
+{
+    /* mix the bits, adjacent spot-ids should not land in adjacent slots */
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static rc_t account( mem_lookup * self, size_t bytes )
+{
+    rc_t rc = 0;
+    uint64_t used = atomic64_read_and_add( &( self -> bytes_used ), bytes ) + bytes;
+    if ( self -> mem_budget > 0 && used > self -> mem_budget )
+        rc = SILENT_RC( rcVDB, rcNoTarg, rcInserting, rcMemory, rcExhausted );
+    return rc;
+}
+
+bool mem_lookup_exhausted( rc_t rc )
+{
+    return ( GetRCContext( rc ) == rcInserting &&
+             GetRCObject( rc ) == ( enum RCObject )rcMemory &&
+             GetRCState( rc ) == rcExhausted );
+}
+
+/* ------------------------------------------------------------------------------------ */
+
+static void release_shard( mem_lookup_shard * shard )
+{
+    uint32_t i;
+    if ( shard -> lock != NULL )
+        KLockRelease( shard -> lock );
+    if ( shard -> slots != NULL )
+        free( ( void * ) shard -> slots );
+    if ( shard -> chunks != NULL )
+    {
+        for ( i = 0; i < shard -> chunk_count; ++i )
+            free( ( void * ) shard -> chunks[ i ] );
+        free( ( void * ) shard -> chunks );
+    }
+}
+
+void release_mem_lookup( struct mem_lookup * self )
+{
+    if ( self != NULL )
+    {
+        uint32_t i;
+        for ( i = 0; i < MEM_LOOKUP_SHARDS; ++i )
+            release_shard( &( self -> shards[ i ] ) ); /* above */
+        free( ( void * ) self );
+    }
+}
+
+static rc_t init_shard( mem_lookup_shard * shard )
+{
+    rc_t rc = KLockMake( &( shard -> lock ) );
+    if ( rc != 0 )
+        ErrMsg( "mem_lookup.c init_shard().KLockMake() -> %R", rc );
+    else
+    {
+        shard -> slots = calloc( MEM_LOOKUP_INITIAL_SLOTS, sizeof shard -> slots[ 0 ] );
+        if ( shard -> slots == NULL )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            ErrMsg( "mem_lookup.c init_shard().calloc( slots ) -> %R", rc );
+        }
+        else
+            shard -> mask = MEM_LOOKUP_INITIAL_SLOTS - 1;
+    }
+    return rc;
+}
+
+rc_t make_mem_lookup( struct mem_lookup ** lookup, size_t mem_budget )
+{
+    rc_t rc = 0;
+    mem_lookup * self = calloc( 1, sizeof * self );
+    if ( self == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "mem_lookup.c make_mem_lookup().calloc( %d ) -> %R", ( sizeof * self ), rc );
+    }
+    else
+    {
+        uint32_t i;
+        self -> mem_budget = mem_budget;
+        atomic64_set( &( self -> bytes_used ), sizeof * self );
+        atomic64_set( &( self -> entries ), 0 );
+        for ( i = 0; rc == 0 && i < MEM_LOOKUP_SHARDS; ++i )
+            rc = init_shard( &( self -> shards[ i ] ) ); /* above */
+        if ( rc == 0 )
+            rc = account( self, MEM_LOOKUP_SHARDS * MEM_LOOKUP_INITIAL_SLOTS * sizeof( mem_lookup_slot ) );
+        if ( rc == 0 )
+            *lookup = self;
+        else
+            release_mem_lookup( self ); /* above */
+    }
+    return rc;
+}
+
+/* ------------------------------------------------------------------------------------ */
+
+static mem_lookup_slot * find_slot( mem_lookup_slot * slots, uint64_t mask, uint64_t key )
+{
+    uint64_t idx = ( hash_key( key ) >> 8 ) & mask; /* the lower bits select the shard */
+    while ( slots[ idx ] . key != 0 && slots[ idx ] . key != key )
+        idx = ( idx + 1 ) & mask;
+    return &( slots[ idx ] );
+}
+
+static rc_t grow_slots( mem_lookup * self, mem_lookup_shard * shard )
+{
+    uint64_t new_count = ( shard -> mask + 1 ) * 2;
+    rc_t rc = account( self, ( shard -> mask + 1 ) * sizeof( mem_lookup_slot ) ); /* above */
+    if ( rc == 0 )
+    {
+        mem_lookup_slot * new_slots = calloc( new_count, sizeof new_slots[ 0 ] );
+        if ( new_slots == NULL )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcInserting, rcMemory, rcExhausted );
+            ErrMsg( "mem_lookup.c grow_slots().calloc( %lu ) -> %R", new_count, rc );
+        }
+        else
+        {
+            uint64_t i;
+            for ( i = 0; i <= shard -> mask; ++i )
+            {
+                const mem_lookup_slot * src = &( shard -> slots[ i ] );
+                if ( src -> key != 0 )
+                    *( find_slot( new_slots, new_count - 1, src -> key ) ) = *src;
+            }
+            free( ( void * ) shard -> slots );
+            shard -> slots = new_slots;
+            shard -> mask = new_count - 1;
+        }
+    }
+    return rc;
+}
+
+/* a chunk for at least needed bytes, long reads ( ONT/PacBio ) can be bigger than any chunk */
+static rc_t new_chunk( mem_lookup * self, mem_lookup_shard * shard, size_t needed )
+{
+    rc_t rc = 0;
+    size_t chunk_size = shard -> chunk_size * 2;
+    if ( chunk_size < MEM_LOOKUP_MIN_CHUNK_SIZE )
+        chunk_size = MEM_LOOKUP_MIN_CHUNK_SIZE;
+    else if ( chunk_size > MEM_LOOKUP_MAX_CHUNK_SIZE )
+        chunk_size = MEM_LOOKUP_MAX_CHUNK_SIZE;
+    if ( chunk_size < needed )
+        chunk_size = needed;
+    if ( ( uint64_t )chunk_size > 0xFFFFFFFF )
+    {
+        /* the offset inside a chunk has to fit into the lower 32 bits of a slot-ref */
+        rc = RC( rcVDB, rcNoTarg, rcInserting, rcSize, rcExcessive );
+        ErrMsg( "mem_lookup.c new_chunk( %lu ) -> %R", needed, rc );
+    }
+
+    if ( rc == 0 && shard -> chunk_count == shard -> chunk_capacity )
+    {
+        uint32_t new_capacity = shard -> chunk_capacity == 0 ? 16 : shard -> chunk_capacity * 2;
+        uint8_t ** tmp = realloc( shard -> chunks, new_capacity * sizeof tmp[ 0 ] );
+        if ( tmp == NULL )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcInserting, rcMemory, rcExhausted );
+            ErrMsg( "mem_lookup.c new_chunk().realloc( %u ) -> %R", new_capacity, rc );
+        }
+        else
+        {
+            shard -> chunks = tmp;
+            shard -> chunk_capacity = new_capacity;
+        }
+    }
+    if ( rc == 0 )
+        rc = account( self, chunk_size ); /* above */
+    if ( rc == 0 )
+    {
+        uint8_t * chunk = malloc( chunk_size );
+        if ( chunk == NULL )
+        {
+            rc = RC( rcVDB, rcNoTarg, rcInserting, rcMemory, rcExhausted );
+            ErrMsg( "mem_lookup.c new_chunk().malloc( %lu ) -> %R", chunk_size, rc );
+        }
+        else
+        {
+            shard -> chunks[ shard -> chunk_count++ ] = chunk;
+            shard -> chunk_used = 0;
+            shard -> chunk_size = chunk_size;
+        }
+    }
+    return rc;
+}
+
+static rc_t put_into_shard( mem_lookup * self, mem_lookup_shard * shard, uint64_t key, const String * packed )
+{
+    rc_t rc = 0;
+    /* keep the load-factor below 3/4 */
+    if ( ( shard -> count + 1 ) * 4 > ( shard -> mask + 1 ) * 3 )
+        rc = grow_slots( self, shard ); /* above */
+    if ( rc == 0 && ( shard -> chunk_count == 0 ||
+                      shard -> chunk_used + packed -> size > shard -> chunk_size ) )
+        rc = new_chunk( self, shard, packed -> size ); /* above */
+    if ( rc == 0 )
+    {
+        mem_lookup_slot * slot = find_slot( shard -> slots, shard -> mask, key ); /* above */
+        uint32_t chunk_idx = shard -> chunk_count - 1;
+        memmove( shard -> chunks[ chunk_idx ] + shard -> chunk_used, packed -> addr, packed -> size );
+        if ( slot -> key == 0 )
+        {
+            shard -> count++;
+            atomic64_inc( &( self -> entries ) );
+        }
+        slot -> key = key;
+        slot -> ref = ( ( uint64_t )chunk_idx << 32 ) | shard -> chunk_used;
+        shard -> chunk_used += packed -> size;
+    }
+    return rc;
+}
+
+rc_t mem_lookup_put( struct mem_lookup * self, uint64_t key, const String * packed )
+{
+    rc_t rc = 0;
+    if ( self == NULL )
+        rc = RC( rcVDB, rcNoTarg, rcInserting, rcSelf, rcNull );
+    else if ( packed == NULL || packed -> size < PACKED_2NA_HDR || key == 0 )
+        rc = RC( rcVDB, rcNoTarg, rcInserting, rcParam, rcInvalid );
+    else
+    {
+        mem_lookup_shard * shard = &( self -> shards[ hash_key( key ) & ( MEM_LOOKUP_SHARDS - 1 ) ] );
+        rc = KLockAcquire( shard -> lock );
+        if ( rc != 0 )
+            ErrMsg( "mem_lookup.c mem_lookup_put().KLockAcquire() -> %R", rc );
+        else
+        {
+            rc = put_into_shard( self, shard, key, packed ); /* above */
+            KLockUnlock( shard -> lock );
+        }
+    }
+    return rc;
+}
+
+/* ------------------------------------------------------------------------------------ */
+
+rc_t mem_lookup_bases( const struct mem_lookup * self, int64_t row_id, uint32_t read_id,
+                       SBuffer * B, bool reverse )
+{
+    rc_t rc = 0;
+    uint64_t key = make_key( row_id, read_id ); /* helper.c */
+    const mem_lookup_shard * shard = &( self -> shards[ hash_key( key ) & ( MEM_LOOKUP_SHARDS - 1 ) ] );
+    const mem_lookup_slot * slot = find_slot( shard -> slots, shard -> mask, key ); /* above */
+    if ( slot -> key != key )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcReading, rcItem, rcNotFound );
+        ErrMsg( "mem_lookup.c mem_lookup_bases( %lu.%u ) -> %R", row_id, read_id, rc );
+    }
+    else
+    {
+        const uint8_t * src = shard -> chunks[ slot -> ref >> 32 ] + ( slot -> ref & 0xFFFFFFFF );
+        String packed;
+        size_t size = packed_2na_size( src ); /* helper.c */
+        StringInit( &packed, ( const char * )src, size, ( uint32_t )size );
+        rc = unpack_2na( &packed, B, reverse ); /* helper.c */
+    }
+    return rc;
+}
+
+uint64_t mem_lookup_count( const struct mem_lookup * self )
+{
+    return self != NULL ? atomic64_read( &( self -> entries ) ) : 0;
+}
+
+uint64_t mem_lookup_bytes( const struct mem_lookup * self )
+{
+    return self != NULL ? atomic64_read( &( self -> bytes_used ) ) : 0;
+}
+
+uint64_t mem_lookup_estimate( uint64_t entries, uint64_t avg_bases )
+{
+    /* the load-factor of the slots is between 3/8 and 3/4: count 2 slots per entry */
+    uint64_t per_entry = 2 * sizeof( mem_lookup_slot ) + PACKED_2NA_HDR + ( ( avg_bases + 3 ) / 4 );
+    return sizeof( mem_lookup ) +
+           MEM_LOOKUP_SHARDS * MEM_LOOKUP_INITIAL_SLOTS * sizeof( mem_lookup_slot ) +
+           entries * per_entry;
+}
@@ -0,0 +1,78 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_mem_lookup_
+#define _h_mem_lookup_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
+/* --------------------------------------------------------------------------------------
+    in-memory replacement for the lookup-file ( lookup_writer/lookup_reader + index )
+
+    the table is split into shards, each shard has its own lock, so many producer-threads
+    can put entries at the same time. the entries are keyed by make_key( spot-id, read-id )
+    and contain the packed 2na as produced by pack_read_2_2na().
+
+    put is thread-safe, get is lock-free and can only be used after all producers are done.
+
+    the total memory used is limited by mem_budget, if it would be exceeded put() returns
+    an rc for which mem_lookup_exhausted() is true - the caller should fall back to the
+    lookup-file then.
+-------------------------------------------------------------------------------------- */
+struct mem_lookup;
+
+rc_t make_mem_lookup( struct mem_lookup ** lookup, size_t mem_budget );
+
+void release_mem_lookup( struct mem_lookup * self );
+
+rc_t mem_lookup_put( struct mem_lookup * self, uint64_t key, const String * packed );
+
+rc_t mem_lookup_bases( const struct mem_lookup * self, int64_t row_id, uint32_t read_id,
+                       SBuffer * B, bool reverse );
+
+uint64_t mem_lookup_count( const struct mem_lookup * self );
+uint64_t mem_lookup_bytes( const struct mem_lookup * self );
+
+/* rough size of a table with that many entries of avg_bases each, used to plan ahead */
+uint64_t mem_lookup_estimate( uint64_t entries, uint64_t avg_bases );
+
+bool mem_lookup_exhausted( rc_t rc );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
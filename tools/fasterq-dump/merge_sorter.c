@@ -100,8 +100,7 @@ static rc_t init_merge_sorter( merge_sorter * self,
     uint32_t i;
     
     if ( index != NULL )
-        rc = make_index_writer( dir, &( self -> idx ), buf_size,
-                        DFLT_INDEX_FREQUENCY, "%s", index ); /* index.h */
+        rc = make_index_writer( dir, &( self -> idx ), buf_size, "%s", index ); /* index.h */
     else
         self -> idx = NULL;
 
@@ -185,6 +184,7 @@ static rc_t run_merge_sorter( merge_sorter * self )
                 rc = write_packed_to_lookup_writer( self -> dst,
                                                     to_write -> key,
                                                     &to_write -> packed_bases . S ); /* lookup_writer.h */
+                self -> total_size += ( sizeof to_write -> key ) + to_write -> packed_bases . S . size;
                                                     
                 if ( rc == 0 )
                     to_write -> rc = lookup_reader_get( to_write -> reader,
@@ -208,7 +208,7 @@ static rc_t run_merge_sorter( merge_sorter * self )
     a batch of jobs. It then processes this batch by merge-sorting the content of
     the KVector's into a temporary file. The entries are key-value pairs with a 64-bit
     key which is composed from the SEQID and one bit: first or second read in a spot.
-    The value is the packed READ ( pack_4na() in helper.c ).
+    The value is the packed READ ( pack_read_2_2na() in helper.c ).
     The background-merger terminates when it's input-queue is sealed in perform_fastdump()
     in fastdump.c after all sorter-threads ( producers ) have been joined.
     The final output of the background-merger is a list of temporary files produced
@@ -228,7 +228,9 @@ typedef struct background_vector_merger
     uint32_t q_wait_time;           /* timeout in milliseconds to get something out of in_q */
     size_t buf_size;                /* needed to perform the merge-sort */
     struct bg_update * gap;         /* visualize the gap after the producer finished */
+    struct phase_report * report;   /* phase_report.h ( can be NULL ) */
     uint64_t total;                 /* how many entries have been merged... */
+    uint64_t bytes_written;         /* how many bytes have been written into the batch-files */
     uint64_t total_rowcount_prod;   /* updated by the producer, informs the vector-merger about the
                                        rowcount to be processed */
 } background_vector_merger;
@@ -438,10 +440,12 @@ static rc_t background_vector_merger_process_batch( background_vector_merger * s
                     rc = Quitting();
                     if ( rc == 0 )
                     {
+                        size_t item_size = ( sizeof to_write -> key ) + to_write -> bases -> size;
                         rc = write_bg_vec_merge_src( to_write, writer ); /* above */
                         if ( rc == 0 )
                         {
                             self -> total++;
+                            self -> bytes_written += item_size;
                             to_write = get_min_bg_vec_merge_src( batch, count ); /* above */
                         }
                         else
@@ -469,6 +473,7 @@ static rc_t CC background_vector_merger_thread_func( const KThread * thread, voi
     rc_t rc = 0;
     background_vector_merger * self = data;
     bool done = false;
+    struct phase_timer * timer = phase_timer_start( self -> report, ph_vector_merge, 0 ); /* phase_report.c */
 
     STATUS ( STAT_USR, "starting background thread loop" );
     while( rc == 0 && !done )
@@ -508,6 +513,8 @@ static rc_t CC background_vector_merger_thread_func( const KThread * thread, voi
         }
     }
     STATUS ( STAT_USR, "exiting background thread loop" );
+    phase_timer_add( timer, self -> total, 0, self -> bytes_written ); /* phase_report.c */
+    phase_timer_stop( timer ); /* phase_report.c */
     return rc;
 }
 
@@ -519,7 +526,8 @@ rc_t make_background_vector_merger( struct background_vector_merger ** merger,
                              uint32_t batch_size,
                              uint32_t q_wait_time,
                              size_t buf_size,
-                             struct bg_update * gap )
+                             struct bg_update * gap,
+                             struct phase_report * report )
 {
     rc_t rc = 0;
     background_vector_merger * b = calloc( 1, sizeof * b );
@@ -536,7 +544,9 @@ rc_t make_background_vector_merger( struct background_vector_merger ** merger,
         b -> file_merger = file_merger;
         b -> cleanup_task = cleanup_task;
         b -> gap = gap;
+        b -> report = report;
         b -> total = 0;
+        b -> bytes_written = 0;
         b -> total_rowcount_prod = 0;
         
         rc = KQueueMake ( &( b -> job_q ), batch_size );
@@ -614,7 +624,7 @@ rc_t push_to_background_vector_merger( background_vector_merger * self, KVector
     a batch of jobs. It then processes this batch by merge-sorting the content of
     the the files into a temporary file. The file-entries are key-value pairs with a 64-bit
     key which is composed from the SEQID and one bit: first or second read in a spot.
-    The value is the packed READ ( pack_4na() in helper.c ).
+    The value is the packed READ ( pack_read_2_2na() in helper.c ).
     The background-merger terminates when it's input-queue is sealed in perform_fastdump()
     in fastdump.c after all background-vector-merger-threads ( producers ) have been joined.
     The final output of the background-merger is a list of temporary files produced
@@ -635,7 +645,10 @@ typedef struct background_file_merger
     uint32_t wait_time;             /* time in milliseconds to sleep if waiting for files to process */
     size_t buf_size;                /* needed to perform the merge-sort */
     struct bg_update * gap;         /* visualize the gap after the producer finished */
+    struct phase_report * report;   /* phase_report.h ( can be NULL ) */
     uint64_t total_rows;            /* how many rows have we processed */
+    uint64_t merged_rows;           /* how many rows have been merged, including the batches */
+    uint64_t merged_bytes;          /* how many bytes have been merged, including the batches */
     uint64_t total_rowcount_prod;   /* updated by the producer, informs the file-merger about the
                                        rowcount to be processed */
 } background_file_merger;
@@ -727,6 +740,8 @@ static rc_t process_background_file_merger( background_file_merger * self )
                 if ( rc == 0 )
                 {
                     rc = run_merge_sorter( &sorter );
+                    self -> merged_rows += sorter . total_entries;
+                    self -> merged_bytes += sorter . total_size;
                     release_merge_sorter( &sorter );
                 }
             }
@@ -788,7 +803,9 @@ static rc_t process_final_background_file_merger( background_file_merger * self,
             {
                 rc = run_merge_sorter( &sorter );
                 if ( rc == 0 )
-                    self -> total_rows += sorter . total_entries;                    
+                    self -> total_rows += sorter . total_entries;
+                self -> merged_rows += sorter . total_entries;
+                self -> merged_bytes += sorter . total_size;                    
                 release_merge_sorter( &sorter );
             }
         }
@@ -806,6 +823,7 @@ static rc_t CC background_file_merger_thread_func( const KThread * thread, void
     rc_t rc = 0;
     background_file_merger * self = data;
     bool done = false;
+    struct phase_timer * timer = phase_timer_start( self -> report, ph_file_merge, 0 ); /* phase_report.c */
     while( rc == 0 && !done )
     {
         uint64_t sealed;
@@ -853,6 +871,9 @@ static rc_t CC background_file_merger_thread_func( const KThread * thread, void
             }
         }
     }
+    /* the merged files are read and written once per batch */
+    phase_timer_add( timer, self -> merged_rows, self -> merged_bytes, self -> merged_bytes ); /* phase_report.c */
+    phase_timer_stop( timer ); /* phase_report.c */
     return rc;
 }
 
@@ -865,7 +886,8 @@ rc_t make_background_file_merger( background_file_merger ** merger,
                                 uint32_t batch_size,
                                 uint32_t wait_time,
                                 size_t buf_size,
-                                struct bg_update * gap )
+                                struct bg_update * gap,
+                                struct phase_report * report )
 {
     rc_t rc = 0;
     background_file_merger * b = calloc( 1, sizeof * b );
@@ -883,7 +905,10 @@ rc_t make_background_file_merger( background_file_merger ** merger,
         b -> buf_size = buf_size;
         b -> cleanup_task = cleanup_task;
         b -> gap = gap;
+        b -> report = report;
         b -> total_rows = 0;
+        b -> merged_rows = 0;
+        b -> merged_bytes = 0;
         b -> total_rowcount_prod = 0;
 
         rc = locked_file_list_init( &( b -> files ), 25  );
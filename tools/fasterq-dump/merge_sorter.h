@@ -51,6 +51,10 @@ extern "C" {
 #include "progress_thread.h"
 #endif
 
+#ifndef _h_phase_report_
+#include "phase_report.h"
+#endif
+
 struct background_vector_merger;
 struct background_file_merger;
 
@@ -64,7 +68,8 @@ rc_t make_background_vector_merger( struct background_vector_merger ** merger,
                              uint32_t batch_size,
                              uint32_t q_wait_time,
                              size_t buf_size,
-                             struct bg_update * gap );
+                             struct bg_update * gap,
+                             struct phase_report * report );
 
 void tell_total_rowcount_to_vector_merger( struct background_vector_merger * self, uint64_t value );
 
@@ -86,7 +91,8 @@ rc_t make_background_file_merger( struct background_file_merger ** merger,
                                 uint32_t batch_size,
                                 uint32_t wait_time,
                                 size_t buf_size,
-                                struct bg_update * gap );
+                                struct bg_update * gap,
+                                struct phase_report * report );
 
 void tell_total_rowcount_to_file_merger( struct background_file_merger * self, uint64_t value );
 
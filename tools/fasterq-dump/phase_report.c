@@ -0,0 +1,374 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "phase_report.h"
+#include "helper.h"
+
+#include <klib/printf.h>
+#include <klib/time.h>
+#include <klib/vector.h>
+#include <kproc/lock.h>
+#include <kfs/file.h>
+
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined( _WIN32 )
+#include <sys/resource.h> /* getrusage() */
+#endif
+
+static const char * phase_names[ ph_count ] = { "lookup", "vector-merge", "file-merge", "join", "concat" };
+
+typedef struct phase_timer
+{
+    phase_t phase;
+    uint32_t thread_id;
+    KTimeMs_t start_ms, stop_ms;
+    uint64_t cpu_start_us, cpu_us;
+    uint64_t rows, bytes_read, bytes_written;
+    bool process_cpu, running;
+} phase_timer;
+
+typedef struct phase_report
+{
+    KLock * lock;           /* the timers are started by many threads */
+    Vector timers;
+    KTimeMs_t start_ms;
+} phase_report;
+
+typedef struct process_usage
+{
+    uint64_t user_us, sys_us, peak_rss;
+} process_usage;
+
+static void get_process_usage( process_usage * usage )
+{
+    memset( usage, 0, sizeof * usage );
+#if !defined( _WIN32 )
+    {
+        struct rusage ru;
+        if ( getrusage( RUSAGE_SELF, &ru ) == 0 )
+        {
+            usage -> user_us = ( ( uint64_t )ru . ru_utime . tv_sec * 1000000 ) + ru . ru_utime . tv_usec;
+            usage -> sys_us  = ( ( uint64_t )ru . ru_stime . tv_sec * 1000000 ) + ru . ru_stime . tv_usec;
+#if defined( __APPLE__ )
+            usage -> peak_rss = ru . ru_maxrss;                  /* bytes on mac */
+#else
+            usage -> peak_rss = ( uint64_t )ru . ru_maxrss * 1024; /* KB on linux */
+#endif
+        }
+    }
+#endif
+}
+
+static uint64_t thread_cpu_us( void )
+{
+#if defined( CLOCK_THREAD_CPUTIME_ID )
+    struct timespec ts;
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) == 0 )
+        return ( ( uint64_t )ts . tv_sec * 1000000 ) + ( ts . tv_nsec / 1000 );
+#endif
+    return 0;
+}
+
+static uint64_t timer_cpu_us( const phase_timer * self )
+{
+    if ( self -> process_cpu )
+    {
+        process_usage usage;
+        get_process_usage( &usage ); /* above */
+        return usage . user_us + usage . sys_us;
+    }
+    return thread_cpu_us(); /* above */
+}
+
+/* ------------------------------------------------------------------------------------ */
+
+static void CC destroy_timer( void * item, void * data )
+{
+    free( item );
+}
+
+void release_phase_report( struct phase_report * self )
+{
+    if ( self != NULL )
+    {
+        VectorWhack( &( self -> timers ), destroy_timer, NULL );
+        if ( self -> lock != NULL )
+            KLockRelease( self -> lock );
+        free( ( void * ) self );
+    }
+}
+
+rc_t make_phase_report( struct phase_report ** report )
+{
+    rc_t rc = 0;
+    phase_report * self = calloc( 1, sizeof * self );
+    if ( self == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        ErrMsg( "phase_report.c make_phase_report().calloc( %d ) -> %R", ( sizeof * self ), rc );
+    }
+    else
+    {
+        VectorInit( &( self -> timers ), 0, 32 );
+        self -> start_ms = KTimeMsStamp();
+        rc = KLockMake( &( self -> lock ) );
+        if ( rc != 0 )
+        {
+            ErrMsg( "phase_report.c make_phase_report().KLockMake() -> %R", rc );
+            release_phase_report( self ); /* above */
+        }
+        else
+            *report = self;
+    }
+    return rc;
+}
+
+static struct phase_timer * make_timer( struct phase_report * self, phase_t phase,
+                                        uint32_t thread_id, bool process_cpu )
+{
+    phase_timer * t = NULL;
+    if ( self != NULL && phase < ph_count )
+    {
+        t = calloc( 1, sizeof * t );
+        if ( t != NULL )
+        {
+            rc_t rc;
+            t -> phase = phase;
+            t -> thread_id = thread_id;
+            t -> process_cpu = process_cpu;
+            t -> running = true;
+            t -> cpu_start_us = timer_cpu_us( t ); /* above */
+            t -> start_ms = KTimeMsStamp();
+
+            rc = KLockAcquire( self -> lock );
+            if ( rc == 0 )
+            {
+                rc = VectorAppend( &( self -> timers ), NULL, t );
+                KLockUnlock( self -> lock );
+            }
+            if ( rc != 0 )
+            {
+                /* the report misses this thread, but that is no reason to stop the tool */
+                free( ( void * ) t );
+                t = NULL;
+            }
+        }
+    }
+    return t;
+}
+
+struct phase_timer * phase_timer_start( struct phase_report * self, phase_t phase, uint32_t thread_id )
+{
+    return make_timer( self, phase, thread_id, false ); /* above */
+}
+
+struct phase_timer * phase_timer_start_process( struct phase_report * self, phase_t phase )
+{
+    return make_timer( self, phase, 0, true ); /* above */
+}
+
+void phase_timer_add( struct phase_timer * self, uint64_t rows, uint64_t bytes_read, uint64_t bytes_written )
+{
+    if ( self != NULL )
+    {
+        self -> rows += rows;
+        self -> bytes_read += bytes_read;
+        self -> bytes_written += bytes_written;
+    }
+}
+
+void phase_timer_stop( struct phase_timer * self )
+{
+    if ( self != NULL && self -> running )
+    {
+        self -> stop_ms = KTimeMsStamp();
+        self -> cpu_us = timer_cpu_us( self ) - self -> cpu_start_us; /* above */
+        self -> running = false;
+    }
+}
+
+/* ------------------------------------------------------------------------------------ */
+
+typedef struct report_writer
+{
+    KFile * f;
+    uint64_t pos;
+    rc_t rc;
+    char buffer[ 4096 ];
+} report_writer;
+
+static void report_write( report_writer * w, const char * src, size_t len )
+{
+    if ( w -> rc == 0 )
+    {
+        w -> rc = KFileWriteExactly( w -> f, w -> pos, src, len );
+        if ( w -> rc != 0 )
+            ErrMsg( "phase_report.c report_write().KFileWriteExactly( at %lu ) -> %R", w -> pos, w -> rc );
+        else
+            w -> pos += len;
+    }
+}
+
+static void report_print( report_writer * w, const char * fmt, ... )
+{
+    if ( w -> rc == 0 )
+    {
+        size_t num_writ;
+        va_list args;
+        va_start( args, fmt );
+        w -> rc = string_vprintf( w -> buffer, sizeof w -> buffer, &num_writ, fmt, args );
+        va_end( args );
+        if ( w -> rc != 0 )
+            ErrMsg( "phase_report.c report_print().string_vprintf() -> %R", w -> rc );
+        else
+            report_write( w, w -> buffer, num_writ ); /* above */
+    }
+}
+
+/* the accession can be a path: escape what JSON does not allow in a string */
+static void report_print_str( report_writer * w, const char * s )
+{
+    report_write( w, "\"", 1 ); /* above */
+    while ( s != NULL && *s != 0 )
+    {
+        if ( *s == '"' || *s == '\\' )
+            report_write( w, "\\", 1 ); /* above */
+        if ( ( unsigned char )*s >= 0x20 )
+            report_write( w, s, 1 ); /* above */
+        s++;
+    }
+    report_write( w, "\"", 1 ); /* above */
+}
+
+static uint64_t per_sec( uint64_t value, uint64_t ms )
+{
+    /* a timer that ran for less than a millisecond counts as one millisecond */
+    return ( value * 1000 ) / ( ms > 0 ? ms : 1 );
+}
+
+static void report_timer( report_writer * w, const phase_timer * t, bool first )
+{
+    KTimeMs_t stop = t -> running ? KTimeMsStamp() : t -> stop_ms;
+    uint64_t wall = stop - t -> start_ms;
+    report_print( w, "%s\n        { \"thread\": %u, \"cpu_scope\": \"%s\", \"wall_ms\": %lu, \"cpu_ms\": %lu, "
+                     "\"rows\": %lu, \"bytes_read\": %lu, \"bytes_written\": %lu, \"rows_per_sec\": %lu }",
+                  first ? "" : ",",
+                  t -> thread_id, t -> process_cpu ? "process" : "thread", wall, t -> cpu_us / 1000,
+                  t -> rows, t -> bytes_read, t -> bytes_written, per_sec( t -> rows, wall ) ); /* above */
+}
+
+static void report_phase( report_writer * w, const phase_report * self, phase_t phase, bool * first_phase )
+{
+    KTimeMs_t first_start = 0, last_stop = 0;
+    uint64_t cpu_us = 0, rows = 0, bytes_read = 0, bytes_written = 0;
+    uint32_t count = 0;
+    uint32_t i, n = VectorLength( &( self -> timers ) );
+
+    for ( i = VectorStart( &( self -> timers ) ); i < n; ++i )
+    {
+        const phase_timer * t = VectorGet( &( self -> timers ), i );
+        if ( t != NULL && t -> phase == phase )
+        {
+            KTimeMs_t stop = t -> running ? KTimeMsStamp() : t -> stop_ms;
+            if ( count == 0 || t -> start_ms < first_start )
+                first_start = t -> start_ms;
+            if ( count == 0 || stop > last_stop )
+                last_stop = stop;
+            cpu_us += t -> cpu_us;
+            rows += t -> rows;
+            bytes_read += t -> bytes_read;
+            bytes_written += t -> bytes_written;
+            count++;
+        }
+    }
+
+    if ( count > 0 )
+    {
+        uint64_t wall = last_stop - first_start;
+        bool first = true;
+        report_print( w, "%s\n    { \"phase\": \"%s\", \"wall_ms\": %lu, \"cpu_ms\": %lu, \"rows\": %lu, "
+                         "\"bytes_read\": %lu, \"bytes_written\": %lu, \"rows_per_sec\": %lu,\n      \"threads\": [",
+                      *first_phase ? "" : ",",
+                      phase_names[ phase ], wall, cpu_us / 1000, rows,
+                      bytes_read, bytes_written, per_sec( rows, wall ) ); /* above */
+        for ( i = VectorStart( &( self -> timers ) ); i < n; ++i )
+        {
+            const phase_timer * t = VectorGet( &( self -> timers ), i );
+            if ( t != NULL && t -> phase == phase )
+            {
+                report_timer( w, t, first ); /* above */
+                first = false;
+            }
+        }
+        report_print( w, " ] }" );
+        *first_phase = false;
+    }
+}
+
+rc_t write_phase_report( const struct phase_report * self, KDirectory * dir,
+                         const char * accession, rc_t result, const char * filename )
+{
+    rc_t rc = 0;
+    if ( self == NULL || dir == NULL || filename == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcWriting, rcParam, rcNull );
+        ErrMsg( "phase_report.c write_phase_report() -> %R", rc );
+    }
+    else
+    {
+        report_writer w;
+        rc = KDirectoryCreateFile( dir, &w . f, false, 0664, kcmInit | kcmParents, "%s", filename );
+        if ( rc != 0 )
+            ErrMsg( "phase_report.c write_phase_report().KDirectoryCreateFile( '%s' ) -> %R", filename, rc );
+        else
+        {
+            process_usage usage;
+            phase_t phase;
+            bool first_phase = true;
+
+            get_process_usage( &usage ); /* above */
+            w . pos = 0;
+            w . rc = 0;
+
+            report_print( &w, "{\n  \"accession\": " ); /* above */
+            report_print_str( &w, accession ); /* above */
+            report_print( &w, ",\n  \"rc\": %u,\n  \"wall_ms\": %lu,\n  \"cpu_user_ms\": %lu,\n"
+                              "  \"cpu_system_ms\": %lu,\n  \"peak_rss_bytes\": %lu,\n  \"phases\": [",
+                          result, KTimeMsStamp() - self -> start_ms,
+                          usage . user_us / 1000, usage . sys_us / 1000, usage . peak_rss ); /* above */
+            for ( phase = 0; phase < ph_count; ++phase )
+                report_phase( &w, self, phase, &first_phase ); /* above */
+            report_print( &w, " ]\n}\n" ); /* above */
+
+            rc = w . rc;
+            KFileRelease( w . f );
+        }
+    }
+    return rc;
+}
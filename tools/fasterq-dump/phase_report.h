@@ -0,0 +1,92 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_phase_report_
+#define _h_phase_report_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_kfs_directory_
+#include <kfs/directory.h>
+#endif
+
+/* --------------------------------------------------------------------------------------
+    timing-report ( option --report ):
+
+    every thread that works in one of the phases takes a phase_timer when it starts,
+    adds the rows and bytes it has processed and stops the timer before it ends.
+    the cpu-time of a timer is the cpu-time of the thread that started it - except for
+    the timers made by phase_timer_start_process(), they take the cpu-time of the whole
+    process: for phases that run alone but spread their work over helper-threads.
+
+    at the end the report is written as JSON: per phase the wall-time ( first start to
+    last stop of its timers ), the sum of the cpu-time, rows and bytes, and each timer
+    as a thread-entry, plus the cpu-time and the peak memory of the process.
+
+    all functions accept NULL for the report / the timer: the callers do not have to
+    check if a report was asked for.
+-------------------------------------------------------------------------------------- */
+
+typedef enum phase_t
+{
+    ph_lookup,          /* producing the lookup-table ( sorter.c ) */
+    ph_vector_merge,    /* merging the KVectors of the producers into files ( merge_sorter.c ) */
+    ph_file_merge,      /* merging these files into the lookup-file ( merge_sorter.c ) */
+    ph_join,            /* joining the SEQUENCE-table with the lookup ( join.c, tbl_join.c ) */
+    ph_concat,          /* concatenating the temp-files ( temp_registry.c ) */
+    ph_count
+} phase_t;
+
+struct phase_report;
+struct phase_timer;
+
+rc_t make_phase_report( struct phase_report ** report );
+
+void release_phase_report( struct phase_report * self );
+
+struct phase_timer * phase_timer_start( struct phase_report * self, phase_t phase, uint32_t thread_id );
+
+struct phase_timer * phase_timer_start_process( struct phase_report * self, phase_t phase );
+
+void phase_timer_add( struct phase_timer * self, uint64_t rows, uint64_t bytes_read, uint64_t bytes_written );
+
+void phase_timer_stop( struct phase_timer * self );
+
+/* result is the rc the tool is going to return, it ends up in the report */
+rc_t write_phase_report( const struct phase_report * self, KDirectory * dir,
+                         const char * accession, rc_t result, const char * filename );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
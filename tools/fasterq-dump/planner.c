@@ -0,0 +1,389 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "planner.h"
+#include "fastq_iter.h"
+#include "sorter.h"
+#include "mem_lookup.h"
+
+#include <klib/out.h>
+
+#include <stdarg.h>
+#include <string.h>
+
+#if !defined( _WIN32 )
+#include <unistd.h> /* sysconf() */
+#endif
+
+/* how many slices of the SEQUENCE-table are sampled, and how many rows per slice */
+#define PLAN_SAMPLE_SLICES 16
+#define PLAN_SAMPLE_ROWS 256
+
+/* more threads than that exhaust the I/O-bandwidth before they help */
+#define PLAN_MAX_THREADS 16
+#define PLAN_MIN_THREADS 2
+/* do not start threads for less than that many spots each */
+#define PLAN_MIN_SPOTS_PER_THREAD 10000
+
+/* rough ratios of the compressors on FASTQ */
+#define PLAN_GZIP_RATIO 4
+#define PLAN_BZIP2_RATIO 5
+
+typedef struct plan_sample
+{
+    uint64_t spots;
+    uint64_t reads;
+    uint64_t bases;
+    uint64_t name_len;
+    uint64_t aligned_reads;
+    uint64_t aligned_bases;
+    uint64_t out_bytes;     /* uncompressed output the sampled spots produce */
+} plan_sample;
+
+static uint64_t num_digits( uint64_t value )
+{
+    uint64_t res = 1;
+    while ( value >= 10 )
+    {
+        value /= 10;
+        res++;
+    }
+    return res;
+}
+
+/* '@' acc '.' spot-nr ' ' name ' length=' len '\n', the '+' - line repeats it */
+static uint64_t fastq_rec_size( const plan_params * params, const fastq_rec * rec, uint64_t bases )
+{
+    uint64_t hdr = 1 + string_size( params -> accession_short ) + 1 + num_digits( rec -> row_id ) +
+                   1 + rec -> name . len + 8 + num_digits( bases ) + 1;
+    return 2 * hdr + 2 * ( bases + 1 );
+}
+
+static void add_to_sample( const plan_params * params, const fastq_rec * rec, plan_sample * sample )
+{
+    uint32_t idx;
+    uint64_t bases = 0;     /* CMP_READ does not cover the aligned reads, READ_LEN does */
+
+    for ( idx = 0; idx < rec -> num_read_len; ++idx )
+        bases += rec -> read_len[ idx ];
+    sample -> spots++;
+    sample -> bases += bases;
+    sample -> name_len += rec -> name . len;
+    sample -> reads += rec -> num_read_len;
+    for ( idx = 0; idx < rec -> num_read_len && idx < rec -> num_alig_id && idx < 2; ++idx )
+    {
+        if ( rec -> prim_alig_id[ idx ] != 0 )
+        {
+            sample -> aligned_reads++;
+            sample -> aligned_bases += rec -> read_len[ idx ];
+        }
+    }
+    switch( params -> fmt )
+    {
+        case ft_unknown             : break;
+        /* SPOT_ID \t READ \t SPOT_GROUP \n */
+        case ft_special             : sample -> out_bytes += num_digits( rec -> row_id ) + bases + 3 + rec -> name . len; break;
+        case ft_whole_spot          : sample -> out_bytes += fastq_rec_size( params, rec, bases ); break;
+        case ft_fastq_split_spot    :
+        case ft_fastq_split_file    :
+        case ft_fastq_split_3       : for ( idx = 0; idx < rec -> num_read_len; ++idx )
+                                      {
+                                          if ( rec -> read_len[ idx ] > 0 )
+                                              sample -> out_bytes += fastq_rec_size( params, rec, rec -> read_len[ idx ] );
+                                      }
+                                      break;
+    }
+}
+
+static rc_t sample_seq_tbl( const plan_params * params, resource_plan * plan, plan_sample * sample )
+{
+    cmn_params cp = { params -> dir, params -> vdb_mgr, params -> accession_path, 0, 0, params -> cursor_cache };
+    struct fastq_csra_iter * iter;
+    fastq_iter_opt opt; /* fastq_iter.h */
+    rc_t rc;
+
+    opt . with_read_len = true;
+    opt . with_name = true;
+    opt . with_read_type = false;
+    opt . with_cmp_read = true; /* we only need the lengths, do not let VDB look up the aligned bases */
+
+    rc = make_fastq_csra_iter( &cp, opt, &iter ); /* fastq_iter.c */
+    if ( rc == 0 )
+    {
+        uint32_t slice;
+        uint32_t slices = PLAN_SAMPLE_SLICES;
+        plan -> spot_count = get_row_count_of_fastq_csra_iter( iter ); /* fastq_iter.c */
+        if ( plan -> spot_count <= PLAN_SAMPLE_SLICES * PLAN_SAMPLE_ROWS )
+            slices = 1;     /* small table: the iterator visits all rows anyway */
+
+        for ( slice = 0; rc == 0 && slice < slices; ++slice )
+        {
+            fastq_rec rec; /* fastq_iter.h */
+            if ( slices > 1 )
+            {
+                int64_t first = 1 + ( int64_t )( ( plan -> spot_count / slices ) * slice );
+                rc = fastq_csra_iter_set_range( iter, first, PLAN_SAMPLE_ROWS ); /* fastq_iter.c */
+            }
+            while ( rc == 0 && get_from_fastq_csra_iter( iter, &rec, &rc ) ) /* fastq_iter.c */
+            {
+                rc = Quitting();
+                if ( rc == 0 )
+                    add_to_sample( params, &rec, sample ); /* above */
+            }
+        }
+        destroy_fastq_csra_iter( iter ); /* fastq_iter.c */
+    }
+    if ( rc != 0 )
+        ErrMsg( "planner.c sample_seq_tbl() -> %R", rc );
+    return rc;
+}
+
+static uint64_t count_align_tbl( const plan_params * params )
+{
+    cmn_params cp = { params -> dir, params -> vdb_mgr, params -> accession_short, 0, 0, params -> cursor_cache };
+    return find_out_row_count( &cp ); /* sorter.c */
+}
+
+static void estimate_sizes( const plan_params * params, resource_plan * plan, const plan_sample * sample )
+{
+    uint64_t raw_output = 0;
+    if ( sample -> spots > 0 )
+    {
+        plan -> avg_spot_len = sample -> bases / sample -> spots;
+        plan -> avg_reads = ( sample -> reads + sample -> spots - 1 ) / sample -> spots;
+        plan -> avg_name_len = sample -> name_len / sample -> spots;
+        raw_output = ( sample -> out_bytes / sample -> spots ) * plan -> spot_count;
+    }
+    if ( sample -> aligned_reads > 0 )
+        plan -> avg_align_len = sample -> aligned_bases / sample -> aligned_reads;
+    else if ( plan -> avg_reads > 0 )
+        plan -> avg_align_len = plan -> avg_spot_len / plan -> avg_reads;
+
+    plan -> mem_lookup_bytes = mem_lookup_estimate( plan -> align_count, plan -> avg_align_len ); /* mem_lookup.c */
+
+    /* lookup-file: key + packed 2na per aligned read ( lookup_writer.c ),
+       index: one uint64 per key, the keys are 2 per spot ( index.c ) */
+    plan -> file_lookup_bytes = plan -> align_count * ( sizeof( uint64_t ) + PACKED_2NA_HDR + ( ( plan -> avg_align_len + 3 ) / 4 ) ) +
+                                ( plan -> spot_count + 1 ) * 2 * sizeof( uint64_t );
+
+    switch( params -> compress )
+    {
+        case ct_none  : plan -> output_bytes = raw_output; break;
+        case ct_gzip  : plan -> output_bytes = raw_output / PLAN_GZIP_RATIO; break;
+        case ct_bzip2 : plan -> output_bytes = raw_output / PLAN_BZIP2_RATIO; break;
+    }
+
+    /* in append-mode the join writes uncompressed temp-files, which are concatenated at the end */
+    if ( params -> append )
+        plan -> scratch_needed = raw_output;
+    if ( params -> output_filename != NULL )
+        plan -> output_needed = plan -> output_bytes;
+}
+
+static uint32_t get_num_cpu( void )
+{
+#if defined( _SC_NPROCESSORS_ONLN )
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? ( uint32_t )n : 0;
+#else
+    return 0;
+#endif
+}
+
+static void choose_threads( const plan_params * params, resource_plan * plan )
+{
+    plan -> num_cpu = get_num_cpu(); /* above */
+    if ( params -> auto_threads && plan -> num_cpu > 0 )
+    {
+        uint64_t by_rows = plan -> spot_count / PLAN_MIN_SPOTS_PER_THREAD;
+        uint32_t n = plan -> num_cpu;
+        if ( n > PLAN_MAX_THREADS )
+            n = PLAN_MAX_THREADS;
+        if ( n > by_rows )
+            n = ( uint32_t )by_rows;
+        if ( n < PLAN_MIN_THREADS )
+            n = PLAN_MIN_THREADS;
+        plan -> num_threads = n;
+    }
+}
+
+static void choose_lookup( const plan_params * params, resource_plan * plan )
+{
+    /* without knowing the RAM we stay with the given values */
+    if ( params -> total_ram == 0 )
+        return;
+
+    /* do not even try the in-memory lookup, if we know it will not fit */
+    if ( params -> auto_mem_lookup && plan -> mem_lookup_bytes > plan -> mem_lookup_budget )
+        plan -> mem_lookup_budget = 0;
+
+    if ( plan -> mem_lookup_budget == 0 || plan -> mem_lookup_bytes > plan -> mem_lookup_budget )
+    {
+        /* the lookup-file and its index are written into the scratch-directory,
+           the sorted chunks of the producers exist next to the merged file while merging */
+        plan -> scratch_needed += 2 * plan -> file_lookup_bytes;
+
+        if ( params -> auto_mem_limit )
+        {
+            /* give the producers a quarter of the RAM, but not more than they can fill:
+               bigger chunks mean fewer temp-files to merge */
+            uint64_t per_producer = ( params -> total_ram / 4 ) / plan -> num_threads;
+            uint64_t fill = ( plan -> file_lookup_bytes / plan -> num_threads ) + 1;
+            if ( per_producer > fill )
+                per_producer = fill;
+            if ( per_producer > plan -> mem_limit )
+                plan -> mem_limit = ( size_t )per_producer;
+        }
+    }
+}
+
+static bool get_free_space( const KDirectory * dir, uint64_t * free_bytes, uint64_t * total_bytes,
+                            const char * fmt, ... )
+{
+    const KDirectory * sub;
+    rc_t rc;
+    va_list args;
+
+    va_start( args, fmt );
+    rc = KDirectoryVOpenDirRead( dir, &sub, false, fmt, args );
+    va_end( args );
+    if ( rc == 0 )
+    {
+        rc = KDirectoryGetDiskFreeSpace( sub, free_bytes, total_bytes );
+        KDirectoryRelease( sub );
+    }
+    return ( rc == 0 );
+}
+
+static rc_t check_space( const plan_params * params, resource_plan * plan )
+{
+    rc_t rc = 0;
+    uint64_t scratch_total = 0;
+    uint64_t output_total = 0;
+    bool same_fs;
+
+    plan -> scratch_known = get_free_space( params -> dir, &plan -> scratch_free, &scratch_total,
+                                            "%s", params -> temp_path ); /* above */
+    if ( params -> output_filename != NULL )
+    {
+        String path;
+        if ( extract_path( params -> output_filename, &path ) ) /* helper.c */
+            plan -> output_known = get_free_space( params -> dir, &plan -> output_free, &output_total,
+                                                   "%S", &path ); /* above */
+        else
+            plan -> output_known = get_free_space( params -> dir, &plan -> output_free, &output_total,
+                                                   "." ); /* above */
+    }
+
+    /* we cannot ask for the device, but the same numbers mean the same file-system */
+    same_fs = plan -> scratch_known && plan -> output_known &&
+              plan -> scratch_free == plan -> output_free && scratch_total == output_total;
+
+    if ( same_fs )
+    {
+        if ( plan -> scratch_needed + plan -> output_needed > plan -> scratch_free )
+        {
+            rc = RC( rcExe, rcStorage, rcValidating, rcSize, rcInsufficient );
+            ErrMsg( "not enough space for temp-files and output in '%s': %,lu bytes needed, %,lu bytes free",
+                    params -> temp_path, plan -> scratch_needed + plan -> output_needed, plan -> scratch_free );
+        }
+    }
+    else
+    {
+        if ( plan -> scratch_known && plan -> scratch_needed > plan -> scratch_free )
+        {
+            rc = RC( rcExe, rcStorage, rcValidating, rcSize, rcInsufficient );
+            ErrMsg( "not enough space for temp-files in '%s': %,lu bytes needed, %,lu bytes free",
+                    params -> temp_path, plan -> scratch_needed, plan -> scratch_free );
+        }
+        if ( rc == 0 && plan -> output_known && plan -> output_needed > plan -> output_free )
+        {
+            rc = RC( rcExe, rcStorage, rcValidating, rcSize, rcInsufficient );
+            ErrMsg( "not enough space for output-file '%s': %,lu bytes needed, %,lu bytes free",
+                    params -> output_filename, plan -> output_needed, plan -> output_free );
+        }
+    }
+    return rc;
+}
+
+rc_t make_resource_plan( const plan_params * params, resource_plan * plan )
+{
+    rc_t rc = 0;
+    if ( params == NULL || plan == NULL )
+    {
+        rc = RC( rcVDB, rcNoTarg, rcConstructing, rcParam, rcInvalid );
+        ErrMsg( "planner.c make_resource_plan() -> %R", rc );
+    }
+    else
+    {
+        plan_sample sample;
+        memset( plan, 0, sizeof * plan );
+        memset( &sample, 0, sizeof sample );
+        plan -> num_threads = params -> num_threads;
+        plan -> mem_limit = params -> mem_limit;
+        plan -> mem_lookup_budget = params -> mem_lookup_budget;
+
+        plan -> align_count = count_align_tbl( params ); /* above */
+        rc = sample_seq_tbl( params, plan, &sample ); /* above */
+        if ( rc == 0 )
+        {
+            estimate_sizes( params, plan, &sample ); /* above */
+            choose_threads( params, plan ); /* above */
+            choose_lookup( params, plan ); /* above */
+            rc = check_space( params, plan ); /* above */
+        }
+    }
+    return rc;
+}
+
+rc_t print_resource_plan( const resource_plan * plan )
+{
+    rc_t rc = KOutMsg( "spots        : %,lu ( %lu bases, %lu reads, name %lu )\n",
+                       plan -> spot_count, plan -> avg_spot_len, plan -> avg_reads, plan -> avg_name_len );
+    if ( rc == 0 )
+        rc = KOutMsg( "aligned reads: %,lu ( %lu bases )\n", plan -> align_count, plan -> avg_align_len );
+    if ( rc == 0 )
+        rc = KOutMsg( "est. lookup  : %,lu bytes in memory, %,lu bytes as file\n",
+                      plan -> mem_lookup_bytes, plan -> file_lookup_bytes );
+    if ( rc == 0 )
+        rc = KOutMsg( "est. output  : %,lu bytes\n", plan -> output_bytes );
+    if ( rc == 0 )
+    {
+        if ( plan -> scratch_known )
+            rc = KOutMsg( "scratch      : %,lu bytes needed, %,lu bytes free\n",
+                          plan -> scratch_needed, plan -> scratch_free );
+        else
+            rc = KOutMsg( "scratch      : %,lu bytes needed, free space unknown\n", plan -> scratch_needed );
+    }
+    if ( rc == 0 && plan -> output_known )
+        rc = KOutMsg( "output-space : %,lu bytes needed, %,lu bytes free\n",
+                      plan -> output_needed, plan -> output_free );
+    if ( rc == 0 && plan -> num_cpu > 0 )
+        rc = KOutMsg( "cpu-cores    : %u\n", plan -> num_cpu );
+    if ( rc == 0 )
+        rc = KOutMsg( "lookup       : %s\n", plan -> mem_lookup_budget > 0 ? "in memory" : "file" );
+    return rc;
+}
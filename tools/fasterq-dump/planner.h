@@ -0,0 +1,112 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_planner_
+#define _h_planner_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_kfs_directory_
+#include <kfs/directory.h>
+#endif
+
+#ifndef _h_vdb_manager_
+#include <vdb/manager.h>
+#endif
+
+#ifndef _h_helper_
+#include "helper.h"
+#endif
+
+/* --------------------------------------------------------------------------------------
+    pre-flight check for accessions with aligned reads:
+
+    the row-counts of the SEQUENCE- and PRIMARY_ALIGNMENT-table and the average lengths
+    ( sampled from a few slices of the SEQUENCE-table ) give an estimate of the size of
+    the lookup-table, the temp-files and the output. From that the planner picks the
+    values the user did not give: the number of threads, the memory-limit per lookup-
+    producer and if the lookup-table should be kept in memory or written to a file.
+    If the scratch- or output-directory does not have enough free space, the plan fails.
+-------------------------------------------------------------------------------------- */
+
+typedef struct plan_params
+{
+    const KDirectory * dir;
+    const VDBManager * vdb_mgr;
+    const char * accession_path;
+    const char * accession_short;
+    const char * temp_path;         /* the scratch-directory */
+    const char * output_filename;   /* NULL: output goes to stdout */
+    size_t cursor_cache;
+    uint64_t total_ram;
+    format_t fmt;
+    compress_t compress;
+    bool append;                    /* the output goes through temp-files */
+
+    /* the values given by the user or the defaults, the planner only changes the auto ones */
+    uint32_t num_threads;
+    size_t mem_limit;
+    size_t mem_lookup_budget;
+    bool auto_threads, auto_mem_limit, auto_mem_lookup;
+} plan_params;
+
+typedef struct resource_plan
+{
+    uint64_t spot_count;            /* rows in the SEQUENCE-table */
+    uint64_t align_count;           /* rows in the PRIMARY_ALIGNMENT-table */
+    uint64_t avg_spot_len;          /* sampled: bases per spot */
+    uint64_t avg_reads;             /* sampled: reads per spot ( rounded up ) */
+    uint64_t avg_align_len;         /* sampled: bases per aligned read */
+    uint64_t avg_name_len;          /* sampled: length of the spot-name */
+    uint64_t mem_lookup_bytes;      /* estimated size of the in-memory lookup-table */
+    uint64_t file_lookup_bytes;     /* estimated size of the lookup-file + index */
+    uint64_t output_bytes;          /* estimated size of the output ( after compression ) */
+    uint64_t scratch_needed, scratch_free;
+    uint64_t output_needed, output_free;
+    bool scratch_known, output_known;   /* could we ask for the free space? */
+    uint32_t num_cpu;               /* 0...unknown */
+
+    /* the result */
+    uint32_t num_threads;
+    size_t mem_limit;
+    size_t mem_lookup_budget;
+} resource_plan;
+
+rc_t make_resource_plan( const plan_params * params, resource_plan * plan );
+
+rc_t print_resource_plan( const resource_plan * plan );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -97,6 +97,11 @@ uint64_t get_row_count_of_raw_read( struct raw_read_iter * iter )
     return cmn_iter_row_count( iter->cmn );
 }
 
+uint64_t get_bytes_read_of_raw_read( struct raw_read_iter * iter )
+{
+    return cmn_iter_bytes_read( iter->cmn );
+}
+
 rc_t write_out_prim( const KDirectory *dir, size_t buf_size, size_t cursor_cache,
                      const char * accession, const char * output_file )
 {
@@ -29,6 +29,7 @@
 #include "lookup_reader.h"
 #include "raw_read_iter.h"
 #include "merge_sorter.h"
+#include "mem_lookup.h"
 #include "progress_thread.h"
 #include "helper.h"
 
@@ -54,8 +55,11 @@ typedef struct lookup_producer
     KVector * store;
     struct bg_progress * progress; /* progress_thread.h */
     struct background_vector_merger * merger; /* merge_sorter.h */
+    struct mem_lookup * mem_lookup; /* mem_lookup.h ( if not NULL: no KVector/merger ) */
+    struct phase_report * report; /* phase_report.h ( can be NULL ) */
     SBuffer buf; /* helper.h */
     uint64_t bytes_in_store;
+    uint64_t bytes_packed;
     atomic64_t * processed_row_count;
     uint32_t chunk_id, sub_file_id;
     size_t buf_size, mem_limit;
@@ -79,6 +83,8 @@ static void release_producer( lookup_producer * self )
 static rc_t init_multi_producer( lookup_producer * self,
                                  cmn_params * cmn, /* helper.h */
                                  struct background_vector_merger * merger, /* merge_sorter.h */
+                                 struct mem_lookup * mem_lookup, /* mem_lookup.h */
+                                 struct phase_report * report, /* phase_report.h */
                                  size_t buf_size,
                                  size_t mem_limit,
                                  struct bg_progress * progress, /* progress_thread.h */
@@ -87,10 +93,15 @@ static rc_t init_multi_producer( lookup_producer * self,
                                  uint64_t row_count,
                                  atomic64_t * processed_row_count )
 {
-    rc_t rc = KVectorMake( &self -> store );
-    if ( rc != 0 )
-        ErrMsg( "sorter.c init_multi_producer().KVectorMake() -> %R", rc );
-    else
+    rc_t rc = 0;
+    /* the in-memory lookup does not need a KVector to collect the entries */
+    if ( mem_lookup == NULL )
+    {
+        rc = KVectorMake( &self -> store );
+        if ( rc != 0 )
+            ErrMsg( "sorter.c init_multi_producer().KVectorMake() -> %R", rc );
+    }
+    if ( rc == 0 )
     {
         rc = make_SBuffer( &( self -> buf ), 4096 ); /* helper.c */
         if ( rc == 0 )
@@ -100,7 +111,10 @@ static rc_t init_multi_producer( lookup_producer * self,
             self -> iter            = NULL;
             self -> progress        = progress;
             self -> merger          = merger;
+            self -> mem_lookup      = mem_lookup;
+            self -> report          = report;
             self -> bytes_in_store  = 0;
+            self -> bytes_packed    = 0;
             self -> chunk_id        = chunk_id;
             self -> sub_file_id     = 0;
             self -> buf_size        = buf_size;
@@ -147,13 +161,20 @@ static rc_t write_to_store( lookup_producer * self,
                             const String * read )
 {
     /* we write it to the store...*/
-    rc_t rc = pack_read_2_4na( read, &( self -> buf ) ); /* helper.c */
-    /* rc_t rc = pack_4na( unpacked_bases, &( self -> buf ) ); helper.c */
+    rc_t rc = pack_read_2_2na( read, &( self -> buf ) ); /* helper.c */
+    /* rc_t rc = pack_4na_2_2na( unpacked_bases, &( self -> buf ) ); helper.c */
     if ( rc != 0 )
-        ErrMsg( "sorter.c write_to_store().pack_read_2_4na() failed %R", rc );
+        ErrMsg( "sorter.c write_to_store().pack_read_2_2na() failed %R", rc );
+    else if ( self -> mem_lookup != NULL )
+    {
+        self -> bytes_packed += ( sizeof key ) + self -> buf . S . size;
+        /* the in-memory table copies the packed bases, no merging needed */
+        rc = mem_lookup_put( self -> mem_lookup, key, &( self -> buf . S ) ); /* mem_lookup.c */
+    }
     else
     {
         const String * to_store;
+        self -> bytes_packed += ( sizeof key ) + self -> buf . S . size;
         rc = StringCopy( &to_store, &( self -> buf . S ) );
         if ( rc != 0 )
             ErrMsg( "sorter.c write_to_store().StringCopy() -> %R", rc );
@@ -186,6 +207,7 @@ static rc_t CC producer_thread_func( const KThread *self, void *data )
     lookup_producer * producer = data;
     raw_read_rec rec;
     uint64_t row_count = 0;
+    struct phase_timer * timer = phase_timer_start( producer -> report, ph_lookup, producer -> chunk_id ); /* phase_report.c */
     
     while ( rc == 0 && get_from_raw_read_iter( producer -> iter, &rec, &rc1 ) ) /* raw_read_iter.c */
     {
@@ -230,6 +252,12 @@ static rc_t CC producer_thread_func( const KThread *self, void *data )
     if ( rc == 0 && producer -> processed_row_count != 0 )
         atomic64_read_and_add( producer -> processed_row_count, row_count );
 
+    phase_timer_add( timer,
+                     row_count,
+                     get_bytes_read_of_raw_read( producer -> iter ),
+                     producer -> bytes_packed ); /* phase_report.c and raw_read_iter.c */
+    phase_timer_stop( timer ); /* phase_report.c */
+
     release_producer( producer ); /* above */
 
     return rc;
@@ -237,7 +265,7 @@ static rc_t CC producer_thread_func( const KThread *self, void *data )
 
 /* -------------------------------------------------------------------------------------------- */
 
-static uint64_t find_out_row_count( cmn_params * cmn )
+uint64_t find_out_row_count( cmn_params * cmn )
 {
     rc_t rc;
     uint64_t res = 0;
@@ -262,6 +290,8 @@ static uint64_t find_out_row_count( cmn_params * cmn )
 
 static rc_t run_producer_pool( cmn_params * cmn, /* helper.h */
                                struct background_vector_merger * merger, /* merge_sorter.h */
+                               struct mem_lookup * mem_lookup, /* mem_lookup.h */
+                               struct phase_report * report, /* phase_report.h */
                                size_t buf_size,
                                size_t mem_limit,
                                uint32_t num_threads,
@@ -283,7 +313,8 @@ static rc_t run_producer_pool( cmn_params * cmn, /* helper.h */
         struct bg_progress * progress = NULL;
         atomic64_t processed_row_count;
         
-        tell_total_rowcount_to_vector_merger( merger, total_row_count ); /* merge_sorter.h */
+        if ( merger != NULL )
+            tell_total_rowcount_to_vector_merger( merger, total_row_count ); /* merge_sorter.h */
         atomic64_set( &processed_row_count, 0 );
         VectorInit( &threads, 0, num_threads );
         if ( show_progress )
@@ -297,6 +328,8 @@ static rc_t run_producer_pool( cmn_params * cmn, /* helper.h */
                 rc = init_multi_producer( producer,
                                           cmn,
                                           merger,
+                                          mem_lookup,
+                                          report,
                                           buf_size,
                                           mem_limit,
                                           progress,
@@ -330,8 +363,12 @@ static rc_t run_producer_pool( cmn_params * cmn, /* helper.h */
         }
 
         /* collect all the sorter-threads */
-        rc = join_and_release_threads( &threads ); /* helper.c */
-        if ( rc != 0 )
+        {
+            rc_t rc1 = join_and_release_threads( &threads ); /* helper.c */
+            if ( rc == 0 ) rc = rc1;
+        }
+        /* running out of the in-memory budget is not an error, the caller falls back to the lookup-file */
+        if ( rc != 0 && !mem_lookup_exhausted( rc ) )
             ErrMsg( "sorter.c run_producer_pool().join_and_release_threads -> %R", rc );
         
         /* all sorter-threads are done now, tell the progress-thread to terminate! */
@@ -355,6 +392,8 @@ rc_t execute_lookup_production( KDirectory * dir,
                                 const VDBManager * vdb_mgr,
                                 const char * accession,
                                 struct background_vector_merger * merger,
+                                struct mem_lookup * mem_lookup,
+                                struct phase_report * report,
                                 size_t cursor_cache,
                                 size_t buf_size,
                                 size_t mem_limit,
@@ -374,6 +413,8 @@ rc_t execute_lookup_production( KDirectory * dir,
         cmn_params cmn = { dir, vdb_mgr, accession, 0, 0, cursor_cache };
         rc = run_producer_pool( &cmn,
                                 merger,
+                                mem_lookup,
+                                report,
                                 buf_size,
                                 mem_limit,
                                 num_threads,
@@ -385,7 +426,7 @@ rc_t execute_lookup_production( KDirectory * dir,
     if ( rc == 0 && merger != NULL )
         rc = seal_background_vector_merger( merger ); /* merge_sorter.c */
         
-    if ( rc != 0 )
+    if ( rc != 0 && !mem_lookup_exhausted( rc ) )
         ErrMsg( "sorter.c execute_lookup_production() -> %R", rc );
 
     return rc;
@@ -43,14 +43,23 @@ extern "C" {
 #include "merge_sorter.h"
 #endif
 
+#ifndef _h_mem_lookup_
+#include "mem_lookup.h"
+#endif
+
 #ifndef _h_vdb_manager_
 #include <vdb/manager.h>
 #endif
 
+/* the number of rows in the PRIMARY_ALIGNMENT-table ( 0 if it cannot be opened ) */
+uint64_t find_out_row_count( cmn_params * cmn );
+
 rc_t execute_lookup_production( KDirectory * dir,
                                 const VDBManager * vdb_mgr,
                                 const char * accession,
                                 struct background_vector_merger * merger,
+                                struct mem_lookup * mem_lookup,
+                                struct phase_report * report,
                                 size_t cursor_cache,
                                 size_t buf_size,
                                 size_t mem_limit,
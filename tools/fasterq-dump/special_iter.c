@@ -96,3 +96,13 @@ uint64_t get_row_count_of_special_iter( struct special_iter * iter )
 {
     return cmn_iter_row_count( iter->cmn );
 }
+
+uint64_t get_bytes_read_of_special_iter( struct special_iter * iter )
+{
+    return cmn_iter_bytes_read( iter->cmn );
+}
+
+rc_t special_iter_set_range( struct special_iter * iter, int64_t first_row, uint64_t row_count )
+{
+    return cmn_iter_set_range( iter->cmn, first_row, row_count ); /* cmn_iter.c */
+}
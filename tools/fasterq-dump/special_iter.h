@@ -62,6 +62,10 @@ bool get_from_special_iter( struct special_iter * iter, special_rec * rec, rc_t
 
 uint64_t get_row_count_of_special_iter( struct special_iter * iter );
 
+uint64_t get_bytes_read_of_special_iter( struct special_iter * iter );
+
+rc_t special_iter_set_range( struct special_iter * iter, int64_t first_row, uint64_t row_count );
+
 #ifdef __cplusplus
 }
 #endif
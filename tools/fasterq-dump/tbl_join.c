@@ -365,7 +365,8 @@ static rc_t perform_whole_spot_join( cmn_params * cp,
                                 const char * tbl_name,
                                 struct join_results * results,
                                 struct bg_progress * progress,
-                                const join_options * jo )
+                                const join_options * jo,
+                                uint64_t * bytes_read )
 {
     rc_t rc;
     struct fastq_sra_iter * iter;
@@ -407,6 +408,7 @@ static rc_t perform_whole_spot_join( cmn_params * cp,
         }
         if ( rc == 0 && rc_iter != 0 )
             rc = rc_iter;
+        *bytes_read = get_bytes_read_of_fastq_sra_iter( iter ); /* fastq_iter.c */
         destroy_fastq_sra_iter( iter );
     }
     return rc;
@@ -417,7 +419,8 @@ static rc_t perform_fastq_split_spot_join( cmn_params * cp,
                                       const char * tbl_name,
                                       struct join_results * results,
                                       struct bg_progress * progress,
-                                      const join_options * jo )
+                                      const join_options * jo,
+                                      uint64_t * bytes_read )
 {
     rc_t rc;
     struct fastq_sra_iter * iter;
@@ -449,6 +452,7 @@ static rc_t perform_fastq_split_spot_join( cmn_params * cp,
         }
         if ( rc == 0 && rc_iter != 0 )
             rc = rc_iter;
+        *bytes_read = get_bytes_read_of_fastq_sra_iter( iter ); /* fastq_iter.c */
         destroy_fastq_sra_iter( iter );
     }
     else
@@ -461,7 +465,8 @@ static rc_t perform_fastq_split_file_join( cmn_params * cp,
                                       const char * tbl_name,
                                       struct join_results * results,
                                       struct bg_progress * progress,
-                                      const join_options * jo )
+                                      const join_options * jo,
+                                      uint64_t * bytes_read )
 {
     rc_t rc;
     struct fastq_sra_iter * iter;
@@ -493,6 +498,7 @@ static rc_t perform_fastq_split_file_join( cmn_params * cp,
         }
         if ( rc == 0 && rc_iter != 0 )
             rc = rc_iter;
+        *bytes_read = get_bytes_read_of_fastq_sra_iter( iter ); /* fastq_iter.c */
         destroy_fastq_sra_iter( iter );
     }
     else
@@ -505,7 +511,8 @@ static rc_t perform_fastq_split_3_join( cmn_params * cp,
                                       const char * tbl_name,
                                       struct join_results * results,
                                       struct bg_progress * progress,
-                                      const join_options * jo )
+                                      const join_options * jo,
+                                      uint64_t * bytes_read )
 {
     rc_t rc;
     struct fastq_sra_iter * iter;
@@ -548,6 +555,7 @@ static rc_t perform_fastq_split_3_join( cmn_params * cp,
         }
         if ( rc == 0 && rc_iter != 0 )
             rc = rc_iter;
+        *bytes_read = get_bytes_read_of_fastq_sra_iter( iter ); /* fastq_iter.c */
         destroy_fastq_sra_iter( iter );
     }
     else
@@ -571,6 +579,7 @@ typedef struct join_thread_data
     const char * tbl_name;
     struct bg_progress * progress;
     struct temp_registry * registry;
+    struct phase_report * report;   /* phase_report.h ( can be NULL ) */
     KThread * thread;
 
     int64_t first_row;
@@ -578,6 +587,7 @@ typedef struct join_thread_data
     size_t cur_cache;
     size_t buf_size;
     format_t fmt;
+    uint32_t thread_id;
     const join_options * join_options;
     
 } join_thread_data;
@@ -587,6 +597,7 @@ static rc_t CC cmn_thread_func( const KThread *self, void *data )
     rc_t rc = 0;
     join_thread_data * jtd = data;
     struct join_results * results = NULL;
+    struct phase_timer * timer = phase_timer_start( jtd -> report, ph_join, jtd -> thread_id ); /* phase_report.c */
     
     if ( rc == 0 )
         rc = make_join_results( jtd -> dir,
@@ -604,6 +615,7 @@ static rc_t CC cmn_thread_func( const KThread *self, void *data )
     {
         cmn_params cp = { jtd -> dir, jtd -> vdb_mgr, 
                           jtd -> accession_path, jtd -> first_row, jtd -> row_count, jtd -> cur_cache };
+        uint64_t bytes_read = 0;
         switch( jtd -> fmt )
         {
             case ft_whole_spot       : rc = perform_whole_spot_join( &cp,
@@ -611,33 +623,42 @@ static rc_t CC cmn_thread_func( const KThread *self, void *data )
                                             jtd -> tbl_name,
                                             results,
                                             jtd -> progress,
-                                            jtd -> join_options ); break; /* above */
+                                            jtd -> join_options,
+                                            &bytes_read ); break; /* above */
                                             
             case ft_fastq_split_spot : rc = perform_fastq_split_spot_join( &cp,
                                             &jtd -> stats,
                                             jtd -> tbl_name,
                                             results,
                                             jtd -> progress,
-                                            jtd -> join_options ); break; /* above */
+                                            jtd -> join_options,
+                                            &bytes_read ); break; /* above */
 
             case ft_fastq_split_file : rc = perform_fastq_split_file_join( &cp,
                                             &jtd -> stats,
                                             jtd -> tbl_name,
                                             results,
                                             jtd -> progress,
-                                            jtd -> join_options ); break; /* above */
+                                            jtd -> join_options,
+                                            &bytes_read ); break; /* above */
 
             case ft_fastq_split_3   : rc = perform_fastq_split_3_join( &cp,
                                             &jtd -> stats,
                                             jtd -> tbl_name,
                                             results,
                                             jtd -> progress,
-                                            jtd -> join_options ); break; /* above */
+                                            jtd -> join_options,
+                                            &bytes_read ); break; /* above */
 
             default : break;
         }
+        phase_timer_add( timer,
+                         jtd -> stats . spots_read,
+                         bytes_read,
+                         join_results_bytes_written( results ) ); /* phase_report.c and join_results.c */
         destroy_join_results( results );
     }
+    phase_timer_stop( timer ); /* phase_report.c */
     return rc;
 }
 
@@ -673,7 +694,8 @@ rc_t execute_tbl_join( KDirectory * dir,
                     uint32_t num_threads,
                     bool show_progress,
                     format_t fmt,
-                    const join_options * join_options )
+                    const join_options * join_options,
+                    struct phase_report * report )
 {
     rc_t rc = 0;
     
@@ -745,7 +767,9 @@ rc_t execute_tbl_join( KDirectory * dir,
                         jtd -> buf_size         = buf_size;
                         jtd -> progress         = progress;
                         jtd -> registry         = registry;
+                        jtd -> report           = report;
                         jtd -> fmt              = fmt;
+                        jtd -> thread_id        = thread_id;
                         jtd -> join_options     = &corrected_join_options;
 
                         rc = make_joined_filename( temp_dir, jtd -> part_file, sizeof jtd -> part_file,
@@ -55,6 +55,10 @@ extern "C" {
 #include "temp_registry.h"
 #endif
 
+#ifndef _h_phase_report_
+#include "phase_report.h"
+#endif
+
 rc_t execute_tbl_join( KDirectory * dir,
                     const VDBManager * vdb_mgr,
                     const char * accession_path,
@@ -68,7 +72,8 @@ rc_t execute_tbl_join( KDirectory * dir,
                     uint32_t num_threads,
                     bool show_progress,
                     format_t fmt,
-                    const join_options * join_options );
+                    const join_options * join_options,
+                    struct phase_report * report );
 
 #ifdef __cplusplus
 }
@@ -140,6 +140,13 @@ static uint64_t total_size( KDirectory * dir, Vector * v )
     return olc . res;
 }
 
+uint64_t temp_registry_total_size( const temp_registry * self, KDirectory * dir )
+{
+    if ( self == NULL || dir == NULL )
+        return 0;
+    return total_size( dir, ( Vector * )&( self -> lists ) ); /* above */
+}
+
 /* -------------------------------------------------------------------- */
 typedef struct on_count_ctx
 {
@@ -178,6 +185,7 @@ typedef struct cmn_merge
     bool force;
     bool append;
     compress_t compress;
+    uint32_t num_threads;
 } cmn_merge;
 
 typedef struct merge_data
@@ -203,7 +211,8 @@ static rc_t CC merge_thread_func( const KThread *self, void *data )
             md -> cmn -> progress,
             md -> cmn -> force,
             md -> cmn -> append,
-            md -> cmn -> compress ); /* concatenator.c */
+            md -> cmn -> compress,
+            md -> cmn -> num_threads ); /* concatenator.c */
         release_SBuffer( &s_filename ); /* helper.c */
     }
     free( ( void * ) md );
@@ -254,7 +263,8 @@ rc_t temp_registry_merge( temp_registry * self,
                           bool show_progress,
                           bool force,
                           compress_t compress,
-                          bool append )
+                          bool append,
+                          uint32_t num_threads )
 {
     rc_t rc = 0;
     if ( self == NULL )
@@ -290,12 +300,15 @@ rc_t temp_registry_merge( temp_registry * self,
                     buf_size,
                     progress,
                     force, append,
-                    compress ); /* concatenator.c */
+                    compress,
+                    num_threads ); /* concatenator.c */
             }
             else if ( count > 1 )
             {
                 /* we have MULTIPLE sets of files... */
-                cmn_merge cmn = { dir, output_filename, buf_size, progress, force, append, compress };
+                /* the merge-threads run in parallel, let them share the compression-threads */
+                uint32_t threads_per_merge = ( num_threads > count ) ? num_threads / count : 1;
+                cmn_merge cmn = { dir, output_filename, buf_size, progress, force, append, compress, threads_per_merge };
                 on_merge_ctx omc = { &cmn, 0 };
                 VectorInit( &omc . threads, 0, count );
                 VectorForEach ( &self -> lists, false, on_merge, &omc );
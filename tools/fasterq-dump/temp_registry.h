@@ -54,6 +54,9 @@ rc_t make_temp_registry( struct temp_registry ** registry, struct KFastDumpClean
 
 rc_t register_temp_file( struct temp_registry * self, uint32_t read_id, const char * filename );
 
+/* the sum of the sizes of all registered files ( 0 if self or dir is NULL ) */
+uint64_t temp_registry_total_size( const struct temp_registry * self, KDirectory * dir );
+
 rc_t temp_registry_merge( struct temp_registry * self,
                           KDirectory * dir,
                           const char * output_filename,
@@ -61,7 +64,8 @@ rc_t temp_registry_merge( struct temp_registry * self,
                           bool show_progress,
                           bool force,
                           compress_t compress,
-                          bool append );
+                          bool append,
+                          uint32_t num_threads );
 
 rc_t temp_registry_to_stdout( struct temp_registry * self,
                               KDirectory * dir,
@@ -32,11 +32,10 @@
 #include <kfs/file.h>
 #include <kfs/directory.h>
 
-#include <kdb/btree.h>
-
 #include <kapp/progressbar.h>
 
 #include "sequence-writer.h"
+#include "../bam-loader/spot-name-map.h" /* shared with bam-load */
 
 #define MMA_ELEM_T ctx_value_t
 #include "mmarray.c"
@@ -47,50 +46,15 @@ ctx_value_t * SpotAssemblerGetCtxValue(SpotAssembler * self, rc_t *const prc, ui
     return MMArrayGet(self->id2value, prc, keyId);
 }
 
-rc_t OpenKBTree(size_t cache_size, const char * tmpfs, uint64_t pid, struct KBTree **const rslt, size_t const n, size_t const max)
-{
-    size_t const cacheSize = (((cache_size - (cache_size / 2) - (cache_size / 8)) / max)
-                            + 0xFFFFF) & ~((size_t)0xFFFFF);
-    KFile *file = NULL;
-    KDirectory *dir;
-    char fname[4096];
-    rc_t rc;
-
-    rc = KDirectoryNativeDir(&dir);
-    if (rc)
-        return rc;
-
-    rc = string_printf(fname, sizeof(fname), NULL, "%s/key2id.%u.%u", tmpfs, pid, n); if (rc) return rc;
-    STSMSG(1, ("Path for scratch files: %s\n", fname));
-    rc = KDirectoryCreateFile(dir, &file, true, 0600, kcmInit, "%s", fname);
-    KDirectoryRemove(dir, 0, "%s", fname);
-    KDirectoryRelease(dir);
-    if (rc == 0) {
-        rc = KBTreeMakeUpdate(rslt, file, cacheSize,
-                              false, kbtOpaqueKey,
-                              1, 255, sizeof ( uint32_t ),
-                              NULL
-                              );
-        KFileRelease(file);
-    }
-    return rc;
-}
-
 rc_t GetKeyIDOld(SpotAssembler* const ctx, uint64_t *const rslt, bool *const wasInserted, char const key[], char const name[], size_t const namelen)
 {
     size_t const keylen = strlen(key);
     rc_t rc;
-    uint64_t tmpKey;
+    uint32_t tmpKey = 0;
 
-    if (ctx->key2id_count == 0) {
-        rc = OpenKBTree(ctx->cache_size, ctx->tmpfs, ctx->pid, &ctx->key2id[0], 1, 1);
-        if (rc) return rc;
-        ctx->key2id_count = 1;
-    }
     if (keylen == 0 || memcmp(key, name, keylen) == 0) {
         /* qname starts with read group; no append */
-        tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, name, namelen);
+        rc = SpotNameMapEntry(ctx->key2id, 0, name, namelen, &tmpKey, wasInserted);
     }
     else {
         char sbuf[4096];
@@ -107,16 +71,12 @@ rc_t GetKeyIDOld(SpotAssembler* const ctx, uint64_t *const rslt, bool *const was
         }
         rc = string_printf(buf, bsize, &actsize, "%s\t%.*s", key, (int)namelen, name);
 
-        tmpKey = ctx->idCount[0];
-        rc = KBTreeEntry(ctx->key2id[0], &tmpKey, wasInserted, buf, actsize);
+        rc = SpotNameMapEntry(ctx->key2id, 0, buf, actsize, &tmpKey, wasInserted);
         if (hbuf)
             free(hbuf);
     }
-    if (rc == 0) {
+    if (rc == 0)
         *rslt = tmpKey;
-        if (*wasInserted)
-            ++ctx->idCount[0];
-    }
 
     return rc;
 }
@@ -134,11 +94,6 @@ static unsigned HashValue(unsigned const len, unsigned char const value[])
     return (unsigned)(h ^ (h >> 32));
 }
 
-static unsigned HashKey(void const *const key, size_t const keylen)
-{
-    return HashValue(keylen, key) % NUM_ID_SPACES;
-}
-
 unsigned SeqHashKey(void const *const key, size_t const keylen)
 {
     return HashValue(keylen, key) % 0x10000;
@@ -174,113 +129,16 @@ rc_t SpotAssemblerGetKeyID(SpotAssembler *const ctx,
     }
     else
     {
-        size_t const keylen = strlen(key);
-        unsigned const h = HashKey(key, keylen);
-        size_t f;
-        size_t e = ctx->key2id_count;
-        uint64_t tmpKey;
+        unsigned f = 0;
+        bool newGroup = false;
+        uint32_t tmpKey = 0;
 
         *rslt = 0;
-        {{
-            uint32_t const bucket_value = ctx->key2id_hash[h];
-            unsigned const n  = (uint8_t) bucket_value;
-            unsigned const i1 = (uint8_t)(bucket_value >>  8);
-            unsigned const i2 = (uint8_t)(bucket_value >> 16);
-            unsigned const i3 = (uint8_t)(bucket_value >> 24);
-
-            if (n > 0 && strcmp(key, ctx->key2id_names + ctx->key2id_name[i1]) == 0) {
-                f = i1;
-                /*
-                ctx->key2id_hash[h] = (i3 << 24) | (i2 << 16) | (i1 << 8) | n;
-                 */
-                goto GET_ID;
-            }
-            if (n > 1 && strcmp(key, ctx->key2id_names + ctx->key2id_name[i2]) == 0) {
-                f = i2;
-                ctx->key2id_hash[h] = (i3 << 24) | (i1 << 16) | (i2 << 8) | n;
-                goto GET_ID;
-            }
-            if (n > 2 && strcmp(key, ctx->key2id_names + ctx->key2id_name[i3]) == 0) {
-                f = i3;
-                ctx->key2id_hash[h] = (i2 << 24) | (i1 << 16) | (i3 << 8) | n;
-                goto GET_ID;
-            }
-        }}
-        f = 0;
-        while (f < e) {
-            size_t const m = (f + e) / 2;
-            size_t const oid = ctx->key2id_oid[m];
-            int const diff = strcmp(key, ctx->key2id_names + ctx->key2id_name[oid]);
-
-            if (diff < 0)
-                e = m;
-            else if (diff > 0)
-                f = m + 1;
-            else {
-                f = oid;
-                goto GET_ID;
-            }
-        }
-        if (ctx->key2id_count < ctx->key2id_max) {
-            size_t const name_max = ctx->key2id_name_max + keylen + 1;
-            KBTree *tree;
-            rc = OpenKBTree(ctx->cache_size, ctx->tmpfs, ctx->pid, &tree, ctx->key2id_count + 1, 1); /* ctx->key2id_max); */
-
-            if (rc) return rc;
-
-            if (ctx->key2id_name_alloc < name_max) {
-                size_t alloc = ctx->key2id_name_alloc;
-                void *tmp;
-
-                if (alloc == 0)
-                    alloc = 4096;
-                while (alloc < name_max)
-                    alloc <<= 1;
-                tmp = realloc(ctx->key2id_names, alloc);
-                if (tmp == NULL)
-                    return RC(rcExe, rcName, rcAllocating, rcMemory, rcExhausted);
-                ctx->key2id_names = tmp;
-                ctx->key2id_name_alloc = alloc;
-            }
-            if (f < ctx->key2id_count) {
-                memmove(&ctx->key2id_oid[f + 1], &ctx->key2id_oid[f], (ctx->key2id_count - f) * sizeof(ctx->key2id_oid[f]));
-            }
-            ctx->key2id_oid[f] = ctx->key2id_count;
-            ++ctx->key2id_count;
-            f = ctx->key2id_oid[f];
-            ctx->key2id_name[f] = ctx->key2id_name_max;
-            ctx->key2id_name_max = name_max;
-
-            memmove(&ctx->key2id_names[ctx->key2id_name[f]], key, keylen + 1);
-            ctx->key2id[f] = tree;
-            ctx->idCount[f] = 0;
-            if ((uint8_t)ctx->key2id_hash[h] < 3) {
-                unsigned const n = (uint8_t)ctx->key2id_hash[h] + 1;
-
-                ctx->key2id_hash[h] = (uint32_t)((((ctx->key2id_hash[h] & ~(0xFFu)) | f) << 8) | n);
-            }
-            else {
-                /* the hash function isn't working too well
-                 * keep the 3 mru
-                 */
-                ctx->key2id_hash[h] = (uint32_t)((((ctx->key2id_hash[h] & ~(0xFFu)) | f) << 8) | 3);
-            }
-        GET_ID:
-            tmpKey = ctx->idCount[f];
-            rc = KBTreeEntry(ctx->key2id[f], &tmpKey, wasInserted, name, namelen);
-            if (rc == 0) {
-                *rslt = (((uint64_t)f) << 32) | tmpKey;
-                if (*wasInserted)
-                {
-                    ++ctx->idCount[f];
-                }
-                assert(tmpKey < ctx->idCount[f]);
-            }
-        }
-        else
-        {
-            rc = RC(rcExe, rcTree, rcAllocating, rcConstraint, rcViolated);
-        }
+        rc = SpotNameMapGroup(ctx->key2id, key, (unsigned)ctx->key2id_max, &f, &newGroup);
+        if (rc == 0)
+            rc = SpotNameMapEntry(ctx->key2id, f, name, namelen, &tmpKey, wasInserted);
+        if (rc == 0)
+            *rslt = (((uint64_t)f) << 32) | tmpKey;
     }
 
     if ( rc == 0 && *wasInserted )
@@ -352,6 +210,16 @@ rc_t SpotAssemblerMake(SpotAssembler **p_self, size_t cache_size, const char * t
     self -> pid = pid;
     self -> key2id_max = 1; /* make sure to use GetKeyIDOld() */
 
+    rc = SpotNameMapMake ( & self -> key2id,
+                           cache_size - ( cache_size / 2 ) - ( cache_size / 8 ),
+                           tmpfs, pid );
+    if ( rc != 0 )
+    {
+        free ( self -> fragment );
+        free ( self );
+        return rc;
+    }
+
     STSMSG(1, ("Cache size: %uM\n", cache_size / 1024 / 1024));
 
     {
@@ -394,15 +262,8 @@ void SpotAssemblerReleaseMemBank(SpotAssembler *self)
 
 void SpotAssemblerRelease(SpotAssembler * self)
 {
-    size_t i;
-    for (i = 0; i != self->key2id_count; ++i)
-    {
-        KBTreeDropBacking ( self->key2id[i] );
-        KBTreeRelease ( self->key2id[i]) ;
-        self->key2id[i] = NULL;
-    }
-    free ( self->key2id_names );
-    self->key2id_names = NULL;
+    SpotNameMapRelease ( self->key2id );
+    self->key2id = NULL;
 
     MMArrayWhack ( self->id2value );
     Id2Name_Whack ( & self->id2name );
@@ -435,13 +296,15 @@ rc_t SpotAssemblerWriteSoloFragments(SpotAssembler* ctx,
         (void)LOGERR(klogErr, rc, "KDataBufferMake failed");
         return rc;
     }
-    for (idCount = 0, j = 0; j < ctx->key2id_count; ++j) {
-        idCount += ctx->idCount[j];
+    for (idCount = 0, j = 0; j < NUM_ID_SPACES; ++j) {
+        idCount += SpotNameMapIdCount(ctx->key2id, j);
     }
     KLoadProgressbar_Append(progress, idCount);
 
-    for (idCount = 0, j = 0; j < ctx->key2id_count; ++j) {
-        for (i = 0; i != ctx->idCount[j]; ++i, ++idCount) {
+    for (idCount = 0, j = 0; j < NUM_ID_SPACES; ++j) {
+        uint32_t const count = SpotNameMapIdCount(ctx->key2id, j);
+
+        for (i = 0; i != count; ++i, ++idCount) {
             uint64_t const keyId = ((uint64_t)j << 32) | i;
             ctx_value_t *value;
             unsigned readLen[2];
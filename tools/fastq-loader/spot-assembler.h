@@ -79,8 +79,7 @@ typedef struct SpotAssembler
     const char * tmpfs;
     uint64_t pid;
 
-    struct KBTree *key2id[NUM_ID_SPACES];
-    char *key2id_names;
+    struct SpotNameMap *key2id;
 
     struct MMArray *id2value;
     int64_t spotId;
@@ -90,18 +89,7 @@ typedef struct SpotAssembler
 
     Id2name id2name; /* idKey -> readname */
 
-    uint32_t idCount[NUM_ID_SPACES];
-    uint32_t key2id_hash[NUM_ID_SPACES];
-
     size_t key2id_max;
-    size_t key2id_name_max;
-    size_t key2id_name_alloc;
-    size_t key2id_count;
-
-    size_t key2id_name[NUM_ID_SPACES];
-    /* this array is kept in name order */
-    /* this maps the names to key2id and idCount */
-    size_t key2id_oid[NUM_ID_SPACES];
 
     int fragmentFd;
 } SpotAssembler;
@@ -0,0 +1,1373 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bam_writer.h"
+#include "../util/bgzf_writer.h" /* shared with fasterq-dump */
+
+#include <klib/log.h>
+#include <klib/printf.h>
+#include <klib/data-buffer.h>
+#include <klib/sort.h>
+#include <kfs/directory.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/* the BAI-index: 16k linear windows, 6 levels of bins, positions below 2^29 */
+#define BAI_MIN_SHIFT 14
+#define BAI_MAX_POS ( ( uint64_t )1 << 29 )
+#define BAI_PSEUDO_BIN 37450
+#define BAI_NO_BIN 0xFFFFFFFF
+#define BAI_NO_OFFSET ( ( uint64_t )-1 )
+
+/* the bin of an unplaced record */
+#define BAM_UNPLACED_BIN 4680
+/* the most CIGAR-operations that fit into the 16-bit n_cigar_op */
+#define BAM_MAX_CIGAR_OPS 0xFFFF
+
+typedef struct bam_ref
+{
+    char * name;
+    uint64_t length;
+} bam_ref;
+
+typedef struct bai_chunk
+{
+    uint32_t bin;
+    uint64_t beg, end;  /* unresolved virtual offsets */
+} bai_chunk;
+
+typedef struct bai_ref
+{
+    bai_chunk * chunks;
+    size_t num_chunks, max_chunks;
+    uint64_t * linear;  /* first record per 16k-window */
+    size_t num_linear;
+    uint64_t off_beg, off_end, n_mapped, n_unmapped;
+    bool used;
+} bai_ref;
+
+typedef struct bai_index
+{
+    bai_ref * refs;
+    int64_t cur_ref;    /* -2 before the first record, -1 within the unplaced records at the end */
+    int64_t last_pos;
+    uint32_t save_bin;
+    uint64_t save_off;
+    uint64_t last_off;
+    uint64_t n_no_coor;
+} bai_index;
+
+struct bam_writer
+{
+    KFile * bgzf;
+    uint64_t pos;           /* uncompressed bytes written into bgzf */
+    KDataBuffer offsets;    /* file-offset of every BGZF-block, filled by the bgzf-writer */
+    bam_ref * refs;
+    uint32_t num_refs;
+    size_t max_refs;
+    uint32_t * by_name;     /* indices into refs, sorted by name */
+
+    char * index_path;
+    bai_index * index;      /* NULL if no index requested or given up */
+    bool header_written;
+    bool unknown_ref_warned;
+};
+
+/* what the index needs to know about a record of a slice */
+typedef struct bam_slice_rec
+{
+    size_t ofs, len;        /* where the record is in the rec-buffer of the slice */
+    int64_t beg, end;
+    int32_t ref;
+    bool mapped;
+} bam_slice_rec;
+
+struct bam_slice
+{
+    const bam_writer * writer;  /* only the references are used, they are read-only after the header */
+    uint32_t last_ref;      /* lookup-cache, the records come grouped by reference */
+    char * unknown_ref;     /* the first name not found in the header, warned about on writing */
+
+    uint8_t * rec;          /* the complete records, followed by the one under construction */
+    size_t rec_len, rec_max;
+    size_t rec_start;       /* where the record under construction starts */
+    bam_slice_rec * recs;
+    size_t num_recs, max_recs;
+
+    uint32_t * cigar;       /* the parsed CIGAR of the record under construction */
+    size_t cigar_max;
+    uint32_t long_cigar;    /* > 0 if the CIGAR did not fit and goes into a CG-tag */
+    int32_t rec_ref;
+    int64_t rec_beg, rec_end;
+    bool rec_mapped;
+};
+
+/* ----------------------------------------------------------------------------------- */
+
+static void put_le16( uint8_t * dst, uint16_t value )
+{
+    dst[ 0 ] = value & 0xFF;
+    dst[ 1 ] = ( value >> 8 ) & 0xFF;
+}
+
+static void put_le32( uint8_t * dst, uint32_t value )
+{
+    dst[ 0 ] = value & 0xFF;
+    dst[ 1 ] = ( value >> 8 ) & 0xFF;
+    dst[ 2 ] = ( value >> 16 ) & 0xFF;
+    dst[ 3 ] = ( value >> 24 ) & 0xFF;
+}
+
+static void put_le64( uint8_t * dst, uint64_t value )
+{
+    put_le32( dst, ( uint32_t )value );
+    put_le32( dst + 4, ( uint32_t )( value >> 32 ) );
+}
+
+static rc_t grow( void ** buffer, size_t * max, size_t needed, size_t elem_size )
+{
+    if ( needed > *max )
+    {
+        size_t new_max = ( *max == 0 ) ? 256 : *max;
+        void * tmp;
+        while ( new_max < needed )
+            new_max *= 2;
+        tmp = realloc( *buffer, new_max * elem_size );
+        if ( tmp == NULL )
+            return RC( rcExe, rcData, rcAllocating, rcMemory, rcExhausted );
+        *buffer = tmp;
+        *max = new_max;
+    }
+    return 0;
+}
+
+static rc_t rec_reserve( bam_slice * self, size_t more )
+{
+    return grow( ( void ** )&self -> rec, &self -> rec_max, self -> rec_len + more, 1 );
+}
+
+static rc_t rec_append( bam_slice * self, const void * src, size_t len )
+{
+    rc_t rc = rec_reserve( self, len );
+    if ( rc == 0 )
+    {
+        memmove( &self -> rec[ self -> rec_len ], src, len );
+        self -> rec_len += len;
+    }
+    return rc;
+}
+
+static rc_t rec_u8( bam_slice * self, uint8_t value )
+{
+    return rec_append( self, &value, 1 );
+}
+
+static rc_t rec_u16( bam_slice * self, uint16_t value )
+{
+    uint8_t b[ 2 ];
+    put_le16( b, value );
+    return rec_append( self, b, 2 );
+}
+
+static rc_t rec_u32( bam_slice * self, uint32_t value )
+{
+    uint8_t b[ 4 ];
+    put_le32( b, value );
+    return rec_append( self, b, 4 );
+}
+
+static rc_t write_bgzf( bam_writer * self, const void * src, size_t len )
+{
+    size_t num_writ;
+    rc_t rc = KFileWriteAll( self -> bgzf, self -> pos, src, len, &num_writ );
+    if ( rc == 0 && num_writ != len )
+        rc = RC( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+    if ( rc == 0 )
+        self -> pos += num_writ;
+    return rc;
+}
+
+/* the smallest bin that contains [ beg, end ), from the SAM-specification */
+static uint32_t reg2bin( int64_t beg, int64_t end )
+{
+    --end;
+    if ( beg >> 14 == end >> 14 ) return ( ( 1 << 15 ) - 1 ) / 7 + ( uint32_t )( beg >> 14 );
+    if ( beg >> 17 == end >> 17 ) return ( ( 1 << 12 ) - 1 ) / 7 + ( uint32_t )( beg >> 17 );
+    if ( beg >> 20 == end >> 20 ) return ( ( 1 << 9 ) - 1 ) / 7 + ( uint32_t )( beg >> 20 );
+    if ( beg >> 23 == end >> 23 ) return ( ( 1 << 6 ) - 1 ) / 7 + ( uint32_t )( beg >> 23 );
+    if ( beg >> 26 == end >> 26 ) return ( ( 1 << 3 ) - 1 ) / 7 + ( uint32_t )( beg >> 26 );
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------- */
+/* MARK: references */
+
+static int64_t CC cmp_ref_names( const void * a, const void * b, void * data )
+{
+    const bam_ref * refs = data;
+    uint32_t ia = *( const uint32_t * )a;
+    uint32_t ib = *( const uint32_t * )b;
+    int res = strcmp( refs[ ia ] . name, refs[ ib ] . name );
+    if ( res == 0 )
+        return ( ia < ib ) ? -1 : 1;
+    return res;
+}
+
+static rc_t index_ref_names( bam_writer * self )
+{
+    uint32_t i;
+    free( self -> by_name );
+    self -> by_name = malloc( ( self -> num_refs + 1 ) * sizeof self -> by_name[ 0 ] );
+    if ( self -> by_name == NULL )
+        return RC( rcExe, rcData, rcAllocating, rcMemory, rcExhausted );
+    for ( i = 0; i < self -> num_refs; ++i )
+        self -> by_name[ i ] = i;
+    ksort( self -> by_name, self -> num_refs, sizeof self -> by_name[ 0 ], cmp_ref_names, self -> refs );
+    return 0;
+}
+
+/* the index of the reference, or -1 */
+static int32_t find_ref( const bam_writer * self, const char * name, size_t name_len )
+{
+    uint32_t lo = 0, hi = self -> num_refs;
+    while ( lo < hi )
+    {
+        uint32_t mid = lo + ( hi - lo ) / 2;
+        const char * other = self -> refs[ self -> by_name[ mid ] ] . name;
+        int res = strncmp( name, other, name_len );
+        if ( res == 0 && other[ name_len ] != 0 )
+            res = -1;
+        if ( res == 0 )
+            return ( int32_t )self -> by_name[ mid ];
+        if ( res < 0 )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+static int32_t lookup_ref( bam_slice * self, const char * name, size_t name_len )
+{
+    const bam_writer * w = self -> writer;
+    int32_t res;
+    if ( name == NULL || name_len == 0 || ( name_len == 1 && name[ 0 ] == '*' ) )
+        return -1;
+    if ( self -> last_ref < w -> num_refs )
+    {
+        const char * last = w -> refs[ self -> last_ref ] . name;
+        if ( strncmp( last, name, name_len ) == 0 && last[ name_len ] == 0 )
+            return ( int32_t )self -> last_ref;
+    }
+    res = find_ref( w, name, name_len );
+    if ( res >= 0 )
+        self -> last_ref = ( uint32_t )res;
+    else if ( self -> unknown_ref == NULL )
+    {
+        /* the slice may be filled on another thread, the warning is given when it is written */
+        self -> unknown_ref = malloc( name_len + 1 );
+        if ( self -> unknown_ref != NULL )
+        {
+            memmove( self -> unknown_ref, name, name_len );
+            self -> unknown_ref[ name_len ] = 0;
+        }
+    }
+    return res;
+}
+
+static rc_t append_ref( bam_writer * self, const char * name, size_t name_len, uint64_t length )
+{
+    rc_t rc = grow( ( void ** )&self -> refs, &self -> max_refs, self -> num_refs + 1, sizeof self -> refs[ 0 ] );
+    if ( rc == 0 )
+    {
+        bam_ref * ref = &self -> refs[ self -> num_refs ];
+        ref -> name = malloc( name_len + 1 );
+        if ( ref -> name == NULL )
+            rc = RC( rcExe, rcData, rcAllocating, rcMemory, rcExhausted );
+        else
+        {
+            memmove( ref -> name, name, name_len );
+            ref -> name[ name_len ] = 0;
+            ref -> length = length;
+            self -> num_refs++;
+        }
+    }
+    return rc;
+}
+
+static void release_refs( bam_ref * refs, uint32_t num_refs )
+{
+    uint32_t i;
+    for ( i = 0; i < num_refs; ++i )
+        free( refs[ i ] . name );
+    free( refs );
+}
+
+rc_t bam_writer_add_ref( bam_writer * self, const char * name, size_t name_len, uint64_t length )
+{
+    if ( self == NULL || name == NULL )
+        return RC( rcExe, rcData, rcInserting, rcParam, rcNull );
+    if ( self -> header_written )
+        return RC( rcExe, rcData, rcInserting, rcData, rcReadonly );
+    return append_ref( self, name, name_len, length );
+}
+
+/* the value of a field "XX:value" in a header-line, the line is not 0-terminated */
+static const char * header_field( const char * line, size_t line_len, const char * key, size_t * value_len )
+{
+    size_t i = 0;
+    while ( i < line_len )
+    {
+        size_t end = i;
+        while ( end < line_len && line[ end ] != '\t' )
+            ++end;
+        if ( end - i >= 3 && line[ i ] == key[ 0 ] && line[ i + 1 ] == key[ 1 ] && line[ i + 2 ] == ':' )
+        {
+            *value_len = end - i - 3;
+            return &line[ i + 3 ];
+        }
+        i = end + 1;
+    }
+    return NULL;
+}
+
+static rc_t append_text( KDataBuffer * buf, const char * text, size_t len )
+{
+    uint64_t old = buf -> elem_count;
+    rc_t rc = KDataBufferResize( buf, old + len );
+    if ( rc == 0 )
+        memmove( ( char * )buf -> base + old, text, len );
+    return rc;
+}
+
+/* the references in the order of the @SQ-lines of the header, followed by the ones
+   added before that the header does not mention ( these get an @SQ-line appended ) */
+static rc_t collect_header_refs( bam_writer * self, const char * text, size_t text_len, KDataBuffer * extra )
+{
+    rc_t rc = 0;
+    bam_ref * added = self -> refs;
+    uint32_t num_added = self -> num_refs;
+    uint32_t num_in_header;
+    size_t i = 0;
+
+    self -> refs = NULL;
+    self -> num_refs = 0;
+    self -> max_refs = 0;
+
+    while ( rc == 0 && i < text_len )
+    {
+        const char * line = &text[ i ];
+        const char * eol = memchr( line, '\n', text_len - i );
+        size_t line_len = ( eol != NULL ) ? ( size_t )( eol - line ) : text_len - i;
+        if ( line_len > 4 && memcmp( line, "@SQ\t", 4 ) == 0 )
+        {
+            size_t sn_len = 0, ln_len = 0;
+            const char * sn = header_field( line + 4, line_len - 4, "SN", &sn_len );
+            const char * ln = header_field( line + 4, line_len - 4, "LN", &ln_len );
+            uint64_t length = 0;
+            if ( ln != NULL )
+            {
+                size_t j;
+                for ( j = 0; j < ln_len && ln[ j ] >= '0' && ln[ j ] <= '9'; ++j )
+                    length = length * 10 + ( ln[ j ] - '0' );
+            }
+            if ( sn != NULL && sn_len > 0 )
+                rc = append_ref( self, sn, sn_len, length );
+        }
+        i += line_len + 1;
+    }
+
+    num_in_header = self -> num_refs;
+    if ( rc == 0 )
+        rc = index_ref_names( self );
+    for ( i = 0; rc == 0 && i < num_added; ++i )
+    {
+        size_t name_len = strlen( added[ i ] . name );
+        int32_t found = find_ref( self, added[ i ] . name, name_len );
+        uint32_t k;
+        /* the ones appended here are not in by_name yet, there are few of them */
+        for ( k = num_in_header; found < 0 && k < self -> num_refs; ++k )
+        {
+            if ( strcmp( self -> refs[ k ] . name, added[ i ] . name ) == 0 )
+                found = ( int32_t )k;
+        }
+        if ( found < 0 )
+        {
+            char line[ 4096 ];
+            size_t line_len;
+            rc = string_printf( line, sizeof line, &line_len, "@SQ\tSN:%s\tLN:%lu\n",
+                                added[ i ] . name, added[ i ] . length );
+            if ( rc == 0 )
+                rc = append_text( extra, line, line_len );
+            if ( rc == 0 )
+                rc = append_ref( self, added[ i ] . name, name_len, added[ i ] . length );
+        }
+    }
+    if ( rc == 0 && self -> num_refs > num_in_header )
+        rc = index_ref_names( self );
+    release_refs( added, num_added );
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+/* MARK: BAI-index */
+
+static rc_t bai_add_chunk( bai_ref * ref, uint32_t bin, uint64_t beg, uint64_t end )
+{
+    rc_t rc = grow( ( void ** )&ref -> chunks, &ref -> max_chunks, ref -> num_chunks + 1, sizeof ref -> chunks[ 0 ] );
+    if ( rc == 0 )
+    {
+        bai_chunk * chunk = &ref -> chunks[ ref -> num_chunks++ ];
+        chunk -> bin = bin;
+        chunk -> beg = beg;
+        chunk -> end = end;
+    }
+    return rc;
+}
+
+static rc_t bai_finish_ref( bai_index * idx )
+{
+    rc_t rc = 0;
+    if ( idx -> cur_ref >= 0 && idx -> save_bin != BAI_NO_BIN )
+        rc = bai_add_chunk( &idx -> refs[ idx -> cur_ref ], idx -> save_bin, idx -> save_off, idx -> last_off );
+    idx -> save_bin = BAI_NO_BIN;
+    return rc;
+}
+
+/* returns false if the records are not sorted by coordinate */
+static bool bai_push( bai_index * idx, int32_t ref_idx, int64_t beg, int64_t end,
+                      uint64_t vo_beg, uint64_t vo_end, bool mapped, rc_t * rc )
+{
+    bai_ref * ref;
+    size_t w, w_end;
+
+    *rc = 0;
+    if ( ref_idx < 0 || beg < 0 )
+    {
+        *rc = bai_finish_ref( idx );
+        idx -> cur_ref = -1;
+        idx -> n_no_coor++;
+        return true;
+    }
+    if ( ref_idx != idx -> cur_ref )
+    {
+        if ( ref_idx < idx -> cur_ref || idx -> cur_ref == -1 )
+            return false;
+        *rc = bai_finish_ref( idx );
+        idx -> cur_ref = ref_idx;
+        idx -> last_pos = -1;
+        idx -> refs[ ref_idx ] . used = true;
+        idx -> refs[ ref_idx ] . off_beg = vo_beg;
+    }
+    else if ( beg < idx -> last_pos )
+        return false;
+    idx -> last_pos = beg;
+    ref = &idx -> refs[ ref_idx ];
+
+    /* linear index: the first record overlapping each 16k-window */
+    w_end = ( size_t )( ( end - 1 ) >> BAI_MIN_SHIFT );
+    if ( *rc == 0 && w_end >= ref -> num_linear )
+    {
+        size_t max = ref -> num_linear;
+        *rc = grow( ( void ** )&ref -> linear, &max, w_end + 1, sizeof ref -> linear[ 0 ] );
+        if ( *rc == 0 )
+        {
+            for ( w = ref -> num_linear; w < max; ++w )
+                ref -> linear[ w ] = BAI_NO_OFFSET;
+            ref -> num_linear = max;
+        }
+    }
+    if ( *rc == 0 )
+    {
+        uint32_t bin = reg2bin( beg, end );
+        for ( w = ( size_t )( beg >> BAI_MIN_SHIFT ); w <= w_end; ++w )
+        {
+            if ( ref -> linear[ w ] == BAI_NO_OFFSET )
+                ref -> linear[ w ] = vo_beg;
+        }
+        /* a chunk is a run of consecutive records in the same bin */
+        if ( bin != idx -> save_bin )
+        {
+            if ( idx -> save_bin != BAI_NO_BIN )
+                *rc = bai_add_chunk( ref, idx -> save_bin, idx -> save_off, vo_beg );
+            idx -> save_bin = bin;
+            idx -> save_off = vo_beg;
+        }
+        ref -> off_end = vo_end;
+        if ( mapped )
+            ref -> n_mapped++;
+        else
+            ref -> n_unmapped++;
+        idx -> last_off = vo_end;
+    }
+    return true;
+}
+
+static void release_bai_index( bai_index * idx, uint32_t num_refs )
+{
+    if ( idx != NULL )
+    {
+        uint32_t i;
+        for ( i = 0; i < num_refs; ++i )
+        {
+            free( idx -> refs[ i ] . chunks );
+            free( idx -> refs[ i ] . linear );
+        }
+        free( idx -> refs );
+        free( idx );
+    }
+}
+
+static rc_t make_bai_index( bam_writer * self )
+{
+    uint32_t i;
+    for ( i = 0; i < self -> num_refs; ++i )
+    {
+        if ( self -> refs[ i ] . length > BAI_MAX_POS )
+        {
+            (void)PLOGMSG( klogWarn, ( klogWarn, "reference '$(r)' is too long for a BAI-index, no index written",
+                                       "r=%s", self -> refs[ i ] . name ) );
+            return 0;
+        }
+    }
+    self -> index = calloc( 1, sizeof * self -> index );
+    if ( self -> index != NULL )
+    {
+        self -> index -> refs = calloc( self -> num_refs + 1, sizeof self -> index -> refs[ 0 ] );
+        if ( self -> index -> refs == NULL )
+        {
+            free( self -> index );
+            self -> index = NULL;
+        }
+    }
+    if ( self -> index == NULL )
+        return RC( rcExe, rcData, rcAllocating, rcMemory, rcExhausted );
+    self -> index -> cur_ref = -2;
+    self -> index -> save_bin = BAI_NO_BIN;
+    return 0;
+}
+
+/* turns ( block-seq << 16 | offset-in-block ) into ( file-offset << 16 | offset-in-block ) */
+static uint64_t resolve_vo( const KDataBuffer * offsets, uint64_t vo )
+{
+    const uint64_t * ofs = offsets -> base;
+    uint64_t seq = vo >> 16;
+    if ( seq >= offsets -> elem_count )
+        return ofs[ offsets -> elem_count - 1 ] << 16;
+    return ( ofs[ seq ] << 16 ) | ( vo & 0xFFFF );
+}
+
+static int CC cmp_chunks( const void * a, const void * b )
+{
+    const bai_chunk * ca = a;
+    const bai_chunk * cb = b;
+    if ( ca -> bin != cb -> bin )
+        return ( ca -> bin < cb -> bin ) ? -1 : 1;
+    if ( ca -> beg != cb -> beg )
+        return ( ca -> beg < cb -> beg ) ? -1 : 1;
+    return 0;
+}
+
+typedef struct bai_out
+{
+    uint8_t * data;
+    size_t len, max;
+} bai_out;
+
+static rc_t out_u32( bai_out * out, uint32_t value )
+{
+    rc_t rc = grow( ( void ** )&out -> data, &out -> max, out -> len + 4, 1 );
+    if ( rc == 0 )
+    {
+        put_le32( &out -> data[ out -> len ], value );
+        out -> len += 4;
+    }
+    return rc;
+}
+
+static rc_t out_u64( bai_out * out, uint64_t value )
+{
+    rc_t rc = grow( ( void ** )&out -> data, &out -> max, out -> len + 8, 1 );
+    if ( rc == 0 )
+    {
+        put_le64( &out -> data[ out -> len ], value );
+        out -> len += 8;
+    }
+    return rc;
+}
+
+static rc_t serialize_bai_ref( bai_out * out, bai_ref * ref, const KDataBuffer * offsets )
+{
+    rc_t rc;
+    size_t i, n_bin = 0, bin_count_at;
+    uint64_t last = 0;
+
+    /* resolve, sort by bin, merge the chunks of a bin that meet in the same BGZF-block */
+    for ( i = 0; i < ref -> num_chunks; ++i )
+    {
+        ref -> chunks[ i ] . beg = resolve_vo( offsets, ref -> chunks[ i ] . beg );
+        ref -> chunks[ i ] . end = resolve_vo( offsets, ref -> chunks[ i ] . end );
+    }
+    qsort( ref -> chunks, ref -> num_chunks, sizeof ref -> chunks[ 0 ], cmp_chunks );
+    if ( ref -> num_chunks > 0 )
+    {
+        size_t dst = 0;
+        for ( i = 1; i < ref -> num_chunks; ++i )
+        {
+            bai_chunk * prev = &ref -> chunks[ dst ];
+            const bai_chunk * cur = &ref -> chunks[ i ];
+            if ( cur -> bin == prev -> bin && ( cur -> beg >> 16 ) <= ( prev -> end >> 16 ) )
+            {
+                if ( cur -> end > prev -> end )
+                    prev -> end = cur -> end;
+            }
+            else
+                ref -> chunks[ ++dst ] = *cur;
+        }
+        ref -> num_chunks = dst + 1;
+    }
+
+    bin_count_at = out -> len;
+    rc = out_u32( out, 0 ); /* n_bin, patched below */
+    i = 0;
+    while ( rc == 0 && i < ref -> num_chunks )
+    {
+        size_t j = i;
+        while ( j < ref -> num_chunks && ref -> chunks[ j ] . bin == ref -> chunks[ i ] . bin )
+            ++j;
+        rc = out_u32( out, ref -> chunks[ i ] . bin );
+        if ( rc == 0 )
+            rc = out_u32( out, ( uint32_t )( j - i ) );
+        for ( ; rc == 0 && i < j; ++i )
+        {
+            rc = out_u64( out, ref -> chunks[ i ] . beg );
+            if ( rc == 0 )
+                rc = out_u64( out, ref -> chunks[ i ] . end );
+        }
+        ++n_bin;
+    }
+    if ( rc == 0 && ref -> used )
+    {
+        /* the pseudo-bin: extent of the reference in the file, mapped/unmapped counts */
+        rc = out_u32( out, BAI_PSEUDO_BIN );
+        if ( rc == 0 ) rc = out_u32( out, 2 );
+        if ( rc == 0 ) rc = out_u64( out, resolve_vo( offsets, ref -> off_beg ) );
+        if ( rc == 0 ) rc = out_u64( out, resolve_vo( offsets, ref -> off_end ) );
+        if ( rc == 0 ) rc = out_u64( out, ref -> n_mapped );
+        if ( rc == 0 ) rc = out_u64( out, ref -> n_unmapped );
+        ++n_bin;
+    }
+    if ( rc == 0 )
+    {
+        put_le32( &out -> data[ bin_count_at ], ( uint32_t )n_bin );
+        rc = out_u32( out, ( uint32_t )ref -> num_linear );
+    }
+    for ( i = 0; rc == 0 && i < ref -> num_linear; ++i )
+    {
+        /* an empty window gets the offset of the window before it */
+        if ( ref -> linear[ i ] != BAI_NO_OFFSET )
+            last = resolve_vo( offsets, ref -> linear[ i ] );
+        rc = out_u64( out, last );
+    }
+    return rc;
+}
+
+static rc_t write_bai_index( bam_writer * self )
+{
+    bai_out out;
+    rc_t rc;
+    uint32_t i;
+
+    memset( &out, 0, sizeof out );
+    rc = bai_finish_ref( self -> index );
+    if ( rc == 0 )
+        rc = grow( ( void ** )&out.data, &out.max, 4, 1 );
+    if ( rc == 0 )
+    {
+        memmove( out.data, "BAI\1", 4 );
+        out.len = 4;
+        rc = out_u32( &out, self -> num_refs );
+    }
+    for ( i = 0; rc == 0 && i < self -> num_refs; ++i )
+        rc = serialize_bai_ref( &out, &self -> index -> refs[ i ], &self -> offsets );
+    if ( rc == 0 )
+        rc = out_u64( &out, self -> index -> n_no_coor );
+
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot build BAI-index" );
+    else
+    {
+        KDirectory * dir;
+        rc = KDirectoryNativeDir( &dir );
+        if ( rc == 0 )
+        {
+            KFile * f;
+            rc = KDirectoryCreateFile( dir, &f, false, 0664, kcmInit, "%s", self -> index_path );
+            if ( rc == 0 )
+            {
+                size_t num_writ;
+                rc = KFileWriteAll( f, 0, out.data, out.len, &num_writ );
+                if ( rc == 0 && num_writ != out.len )
+                    rc = RC( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+                KFileRelease( f );
+            }
+            KDirectoryRelease( dir );
+        }
+        if ( rc != 0 )
+            (void)PLOGERR( klogErr, ( klogErr, rc, "cannot write BAI-index '$(p)'", "p=%s", self -> index_path ) );
+    }
+    free( out.data );
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+/* MARK: header */
+
+static rc_t write_header( bam_writer * self, const char * text, size_t text_len, const KDataBuffer * extra )
+{
+    uint8_t b[ 8 ];
+    uint32_t i;
+    rc_t rc;
+
+    memmove( b, "BAM\1", 4 );
+    put_le32( &b[ 4 ], ( uint32_t )( text_len + extra -> elem_count ) );
+    rc = write_bgzf( self, b, 8 );
+    if ( rc == 0 && text_len > 0 )
+        rc = write_bgzf( self, text, text_len );
+    if ( rc == 0 && extra -> elem_count > 0 )
+        rc = write_bgzf( self, extra -> base, extra -> elem_count );
+    if ( rc == 0 )
+    {
+        put_le32( b, self -> num_refs );
+        rc = write_bgzf( self, b, 4 );
+    }
+    for ( i = 0; rc == 0 && i < self -> num_refs; ++i )
+    {
+        const bam_ref * ref = &self -> refs[ i ];
+        uint32_t name_len = ( uint32_t )strlen( ref -> name ) + 1;
+        put_le32( b, name_len );
+        put_le32( &b[ 4 ], ( uint32_t )( ref -> length > 0x7FFFFFFF ? 0x7FFFFFFF : ref -> length ) );
+        rc = write_bgzf( self, b, 4 );
+        if ( rc == 0 )
+            rc = write_bgzf( self, ref -> name, name_len );
+        if ( rc == 0 )
+            rc = write_bgzf( self, &b[ 4 ], 4 );
+    }
+    return rc;
+}
+
+rc_t bam_writer_header( bam_writer * self, const char * text, size_t text_len )
+{
+    rc_t rc;
+    KDataBuffer extra;
+
+    if ( self == NULL )
+        return RC( rcExe, rcData, rcWriting, rcSelf, rcNull );
+    if ( self -> header_written )
+        return RC( rcExe, rcData, rcWriting, rcData, rcReadonly );
+    if ( text == NULL )
+        text_len = 0;
+
+    rc = KDataBufferMakeBytes( &extra, 0 );
+    if ( rc == 0 )
+    {
+        /* keep the header-text line-terminated, the appended @SQ-lines follow it */
+        if ( text_len > 0 && text[ text_len - 1 ] != '\n' )
+            rc = append_text( &extra, "\n", 1 );
+        if ( rc == 0 )
+            rc = collect_header_refs( self, text, text_len, &extra ); /* above */
+        if ( rc == 0 )
+            rc = write_header( self, text, text_len, &extra ); /* above */
+        KDataBufferWhack( &extra );
+    }
+    if ( rc == 0 && self -> index_path != NULL )
+        rc = make_bai_index( self ); /* above */
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot write BAM-header" );
+    else
+        self -> header_written = true;
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+/* MARK: records */
+
+/* ASCII to the 4-bit codes of "=ACMGRSVTWYHKDBN", anything else is N */
+static const uint8_t seq_nt16[ 256 ] =
+{
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15, 0,15,15,
+    15, 1,14, 2, 13,15,15, 4, 11,15,15,12, 15, 3,15,15,
+    15,15, 5, 6,  8,15, 7, 9, 15,10,15,15, 15,15,15,15,
+    15, 1,14, 2, 13,15,15, 4, 11,15,15,12, 15, 3,15,15,
+    15,15, 5, 6,  8,15, 7, 9, 15,10,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15,
+    15,15,15,15, 15,15,15,15, 15,15,15,15, 15,15,15,15
+};
+
+/* parses the text-CIGAR into self->cigar, ref_len is the length it covers on the reference */
+static rc_t parse_cigar( bam_slice * self, const char * cigar, size_t cigar_len,
+                         uint32_t * n_ops, int64_t * ref_len )
+{
+    static const char ops[] = "MIDNSHP=X";
+    rc_t rc = 0;
+    size_t i;
+    uint32_t len = 0;
+    bool have_len = false;
+
+    *n_ops = 0;
+    *ref_len = 0;
+    if ( cigar == NULL || cigar_len == 0 || ( cigar_len == 1 && cigar[ 0 ] == '*' ) )
+        return 0;
+    for ( i = 0; rc == 0 && i < cigar_len; ++i )
+    {
+        char c = cigar[ i ];
+        if ( c >= '0' && c <= '9' )
+        {
+            len = len * 10 + ( c - '0' );
+            have_len = true;
+        }
+        else
+        {
+            const char * op = ( c != 0 ) ? strchr( ops, c ) : NULL;
+            if ( op == NULL || !have_len )
+                rc = RC( rcExe, rcData, rcParsing, rcData, rcInvalid );
+            else
+            {
+                uint32_t code = ( uint32_t )( op - ops );
+                rc = grow( ( void ** )&self -> cigar, &self -> cigar_max, *n_ops + 1, sizeof self -> cigar[ 0 ] );
+                if ( rc == 0 )
+                {
+                    self -> cigar[ ( *n_ops )++ ] = ( len << 4 ) | code;
+                    /* M, D, N, =, X consume the reference */
+                    if ( code == 0 || code == 2 || code == 3 || code == 7 || code == 8 )
+                        *ref_len += len;
+                }
+            }
+            len = 0;
+            have_len = false;
+        }
+    }
+    if ( rc == 0 && have_len )
+        rc = RC( rcExe, rcData, rcParsing, rcData, rcInvalid );
+    if ( rc != 0 )
+        (void)PLOGERR( klogErr, ( klogErr, rc, "invalid CIGAR '$(c)'", "c=%.*s", ( int )cigar_len, cigar ) );
+    return rc;
+}
+
+static rc_t rec_fixed( bam_slice * self, const bam_record * rec, size_t qname_len, uint32_t n_ops, int32_t next_ref )
+{
+    rc_t rc = rec_reserve( self, 36 + qname_len + 1 );
+    if ( rc == 0 )
+    {
+        uint8_t * b = &self -> rec[ self -> rec_start ];
+        uint32_t bin = ( self -> rec_beg < 0 ) ? BAM_UNPLACED_BIN : reg2bin( self -> rec_beg, self -> rec_end );
+        int64_t pnext = ( next_ref < 0 ) ? -1 : rec -> pnext;
+        put_le32( &b[ 0 ], 0 ); /* block_size, patched in bam_slice_end() */
+        put_le32( &b[ 4 ], ( uint32_t )self -> rec_ref );
+        put_le32( &b[ 8 ], ( uint32_t )( int32_t )self -> rec_beg );
+        b[ 12 ] = ( uint8_t )( qname_len + 1 );
+        b[ 13 ] = ( uint8_t )( rec -> mapq > 255 ? 255 : rec -> mapq );
+        put_le16( &b[ 14 ], ( uint16_t )bin );
+        put_le16( &b[ 16 ], ( uint16_t )n_ops );
+        put_le16( &b[ 18 ], ( uint16_t )rec -> flags );
+        put_le32( &b[ 20 ], ( uint32_t )rec -> seq_len );
+        put_le32( &b[ 24 ], ( uint32_t )next_ref );
+        put_le32( &b[ 28 ], ( uint32_t )( int32_t )pnext );
+        put_le32( &b[ 32 ], ( uint32_t )( int32_t )rec -> tlen );
+        if ( qname_len > 0 )
+            memmove( &b[ 36 ], rec -> qname, qname_len );
+        b[ 36 + qname_len ] = 0;
+        self -> rec_len = self -> rec_start + 36 + qname_len + 1;
+    }
+    return rc;
+}
+
+static rc_t rec_seq_qual( bam_slice * self, const bam_record * rec )
+{
+    rc_t rc = rec_reserve( self, ( rec -> seq_len + 1 ) / 2 + rec -> seq_len );
+    if ( rc == 0 )
+    {
+        uint8_t * b = &self -> rec[ self -> rec_len ];
+        const uint8_t * seq = ( const uint8_t * )rec -> seq;
+        size_t i;
+        for ( i = 0; i + 1 < rec -> seq_len; i += 2 )
+            *b++ = ( seq_nt16[ seq[ i ] ] << 4 ) | seq_nt16[ seq[ i + 1 ] ];
+        if ( i < rec -> seq_len )
+            *b++ = seq_nt16[ seq[ i ] ] << 4;
+        if ( rec -> qual != NULL )
+        {
+            for ( i = 0; i < rec -> seq_len; ++i )
+                *b++ = ( uint8_t )( rec -> qual[ i ] - 33 );
+        }
+        else
+        {
+            memset( b, 0xFF, rec -> seq_len );
+            b += rec -> seq_len;
+        }
+        self -> rec_len = b - self -> rec;
+    }
+    return rc;
+}
+
+rc_t bam_slice_begin( bam_slice * self, const bam_record * rec )
+{
+    rc_t rc;
+    uint32_t n_ops, i;
+    int64_t ref_len;
+    int32_t next_ref;
+    size_t qname_len;
+
+    if ( self == NULL || rec == NULL )
+        return RC( rcExe, rcData, rcWriting, rcParam, rcNull );
+
+    /* drops what is left of a record that failed */
+    self -> rec_len = self -> rec_start;
+    qname_len = ( rec -> qname != NULL ) ? rec -> qname_len : 0;
+    if ( qname_len > 254 )
+    {
+        rc = RC( rcExe, rcData, rcWriting, rcName, rcExcessive );
+        (void)PLOGERR( klogErr, ( klogErr, rc, "QNAME '$(q)' is too long for BAM",
+                                  "q=%.*s", ( int )qname_len, rec -> qname ) );
+        return rc;
+    }
+    rc = parse_cigar( self, rec -> cigar, rec -> cigar_len, &n_ops, &ref_len ); /* above */
+    if ( rc != 0 )
+        return rc;
+
+    self -> rec_ref = lookup_ref( self, rec -> rname, rec -> rname_len );
+    if ( self -> rec_ref < 0 || rec -> pos < 0 )
+    {
+        /* unplaced, or on a reference the header does not have: pos -1, bin 4680 */
+        self -> rec_beg = -1;
+        self -> rec_end = 0;
+    }
+    else
+    {
+        self -> rec_beg = rec -> pos;
+        self -> rec_end = rec -> pos + ( ref_len > 0 ? ref_len : 1 );
+    }
+    self -> rec_mapped = ( ( rec -> flags & 0x4 ) == 0 );
+    if ( rec -> rnext != NULL && rec -> rnext_len == 1 && rec -> rnext[ 0 ] == '=' )
+        next_ref = self -> rec_ref;
+    else
+        next_ref = lookup_ref( self, rec -> rnext, rec -> rnext_len );
+
+    /* a CIGAR with too many operations goes into a CG-tag, the record gets <l_seq>S<ref_len>N */
+    self -> long_cigar = ( n_ops > BAM_MAX_CIGAR_OPS ) ? n_ops : 0;
+    rc = rec_fixed( self, rec, qname_len, self -> long_cigar > 0 ? 2 : n_ops, next_ref ); /* above */
+    if ( rc == 0 )
+    {
+        if ( self -> long_cigar > 0 )
+        {
+            rc = rec_u32( self, ( ( uint32_t )rec -> seq_len << 4 ) | 4 );
+            if ( rc == 0 )
+                rc = rec_u32( self, ( ( uint32_t )ref_len << 4 ) | 3 );
+        }
+        else
+        {
+            for ( i = 0; rc == 0 && i < n_ops; ++i )
+                rc = rec_u32( self, self -> cigar[ i ] );
+        }
+    }
+    if ( rc == 0 )
+        rc = rec_seq_qual( self, rec ); /* above */
+    return rc;
+}
+
+rc_t bam_slice_tag_Z( bam_slice * self, const char tag[ 2 ], const char * value, size_t value_len )
+{
+    rc_t rc = rec_reserve( self, 3 + value_len + 1 );
+    if ( rc == 0 )
+    {
+        uint8_t * b = &self -> rec[ self -> rec_len ];
+        b[ 0 ] = tag[ 0 ];
+        b[ 1 ] = tag[ 1 ];
+        b[ 2 ] = 'Z';
+        if ( value_len > 0 )
+            memmove( &b[ 3 ], value, value_len );
+        b[ 3 + value_len ] = 0;
+        self -> rec_len += 3 + value_len + 1;
+    }
+    return rc;
+}
+
+rc_t bam_slice_tag_i( bam_slice * self, const char tag[ 2 ], int64_t value )
+{
+    rc_t rc = rec_append( self, tag, 2 );
+    if ( rc != 0 )
+        return rc;
+    /* the smallest type that holds the value, like samtools does it */
+    if ( value < -32768 )
+    {
+        rc = rec_u8( self, 'i' );
+        if ( rc == 0 ) rc = rec_u32( self, ( uint32_t )( int32_t )value );
+    }
+    else if ( value < -128 )
+    {
+        rc = rec_u8( self, 's' );
+        if ( rc == 0 ) rc = rec_u16( self, ( uint16_t )( int16_t )value );
+    }
+    else if ( value < 0 )
+    {
+        rc = rec_u8( self, 'c' );
+        if ( rc == 0 ) rc = rec_u8( self, ( uint8_t )( int8_t )value );
+    }
+    else if ( value <= 0xFF )
+    {
+        rc = rec_u8( self, 'C' );
+        if ( rc == 0 ) rc = rec_u8( self, ( uint8_t )value );
+    }
+    else if ( value <= 0xFFFF )
+    {
+        rc = rec_u8( self, 'S' );
+        if ( rc == 0 ) rc = rec_u16( self, ( uint16_t )value );
+    }
+    else
+    {
+        rc = rec_u8( self, 'I' );
+        if ( rc == 0 ) rc = rec_u32( self, ( uint32_t )value );
+    }
+    return rc;
+}
+
+/* copies one number out of the not 0-terminated text, stops at a comma */
+static size_t number_text( char * dst, size_t dst_size, const char * src, size_t src_len )
+{
+    size_t i;
+    for ( i = 0; i < src_len && i + 1 < dst_size && src[ i ] != ','; ++i )
+        dst[ i ] = src[ i ];
+    dst[ i ] = 0;
+    return i;
+}
+
+static uint32_t float_bits( const char * num )
+{
+    float f = strtof( num, NULL );
+    uint32_t u;
+    memmove( &u, &f, sizeof u );
+    return u;
+}
+
+/* the value of a B-tag: "<subtype>,v1,v2..." */
+static rc_t tag_B_text( bam_slice * self, const char * value, size_t value_len )
+{
+    rc_t rc;
+    char sub = ( value_len > 0 ) ? value[ 0 ] : 0;
+    size_t count_at, i = 1;
+    uint32_t count = 0;
+
+    if ( sub == 0 || strchr( "cCsSiIf", sub ) == NULL )
+        return RC( rcExe, rcData, rcParsing, rcData, rcInvalid );
+    rc = rec_u8( self, ( uint8_t )sub );
+    count_at = self -> rec_len;
+    if ( rc == 0 )
+        rc = rec_u32( self, 0 ); /* patched below */
+    while ( rc == 0 && i < value_len )
+    {
+        char num[ 64 ];
+        if ( value[ i++ ] != ',' )
+            rc = RC( rcExe, rcData, rcParsing, rcData, rcInvalid );
+        else
+        {
+            i += number_text( num, sizeof num, &value[ i ], value_len - i );
+            switch ( sub )
+            {
+                case 'c' :
+                case 'C' : rc = rec_u8( self, ( uint8_t )strtol( num, NULL, 10 ) ); break;
+                case 's' :
+                case 'S' : rc = rec_u16( self, ( uint16_t )strtol( num, NULL, 10 ) ); break;
+                case 'i' :
+                case 'I' : rc = rec_u32( self, ( uint32_t )strtoll( num, NULL, 10 ) ); break;
+                case 'f' : rc = rec_u32( self, float_bits( num ) ); break;
+            }
+            ++count;
+        }
+    }
+    if ( rc == 0 )
+        put_le32( &self -> rec[ count_at ], count );
+    return rc;
+}
+
+static rc_t tag_text( bam_slice * self, const char * field, size_t len )
+{
+    rc_t rc = 0;
+    const char * value = &field[ 5 ];
+    size_t value_len = len - 5;
+    char num[ 64 ];
+
+    if ( field[ 3 ] != 'i' && field[ 3 ] != 'Z' )
+        rc = rec_append( self, field, 2 );
+    if ( rc == 0 )
+    {
+        switch ( field[ 3 ] )
+        {
+            case 'A' :  rc = rec_u8( self, 'A' );
+                        if ( rc == 0 ) rc = rec_u8( self, value_len > 0 ? value[ 0 ] : ' ' );
+                        break;
+
+            case 'i' :  number_text( num, sizeof num, value, value_len );
+                        rc = bam_slice_tag_i( self, field, strtoll( num, NULL, 10 ) );
+                        break;
+
+            case 'f' :  number_text( num, sizeof num, value, value_len );
+                        rc = rec_u8( self, 'f' );
+                        if ( rc == 0 ) rc = rec_u32( self, float_bits( num ) );
+                        break;
+
+            case 'Z' :  rc = bam_slice_tag_Z( self, field, value, value_len );
+                        break;
+
+            case 'H' :  rc = rec_u8( self, 'H' );
+                        if ( rc == 0 ) rc = rec_append( self, value, value_len );
+                        if ( rc == 0 ) rc = rec_u8( self, 0 );
+                        break;
+
+            case 'B' :  rc = rec_u8( self, 'B' );
+                        if ( rc == 0 ) rc = tag_B_text( self, value, value_len );
+                        break;
+
+            default  :  rc = RC( rcExe, rcData, rcParsing, rcData, rcInvalid );
+                        break;
+        }
+    }
+    return rc;
+}
+
+rc_t bam_slice_tags_text( bam_slice * self, const char * text, size_t text_len )
+{
+    rc_t rc = 0;
+    size_t i = 0;
+    while ( rc == 0 && i < text_len )
+    {
+        size_t len = 0;
+        const char * field;
+        while ( i < text_len && text[ i ] == '\t' )
+            ++i;
+        field = &text[ i ];
+        while ( i + len < text_len && field[ len ] != '\t' )
+            ++len;
+        i += len;
+        if ( len > 0 )
+        {
+            if ( len < 5 || field[ 2 ] != ':' || field[ 4 ] != ':' )
+                rc = RC( rcExe, rcData, rcParsing, rcData, rcInvalid );
+            else
+                rc = tag_text( self, field, len ); /* above */
+        }
+    }
+    if ( rc != 0 )
+        (void)PLOGERR( klogErr, ( klogErr, rc, "invalid SAM-tags '$(t)'", "t=%.*s", ( int )text_len, text ) );
+    return rc;
+}
+
+rc_t bam_slice_end( bam_slice * self )
+{
+    rc_t rc = 0;
+
+    if ( self -> long_cigar > 0 )
+    {
+        /* the real CIGAR as CG:B:I */
+        uint32_t i;
+        rc = rec_append( self, "CGBI", 4 );
+        if ( rc == 0 )
+            rc = rec_u32( self, self -> long_cigar );
+        for ( i = 0; rc == 0 && i < self -> long_cigar; ++i )
+            rc = rec_u32( self, self -> cigar[ i ] );
+    }
+    if ( rc == 0 )
+        rc = grow( ( void ** )&self -> recs, &self -> max_recs, self -> num_recs + 1, sizeof self -> recs[ 0 ] );
+    if ( rc == 0 )
+    {
+        bam_slice_rec * r = &self -> recs[ self -> num_recs++ ];
+        r -> ofs = self -> rec_start;
+        r -> len = self -> rec_len - self -> rec_start;
+        r -> beg = self -> rec_beg;
+        r -> end = self -> rec_end;
+        r -> ref = self -> rec_ref;
+        r -> mapped = self -> rec_mapped;
+        put_le32( &self -> rec[ r -> ofs ], ( uint32_t )( r -> len - 4 ) );
+        self -> rec_start = self -> rec_len;
+    }
+    return rc;
+}
+
+size_t bam_slice_size( const bam_slice * self )
+{
+    return ( self != NULL ) ? self -> rec_start : 0;
+}
+
+rc_t make_bam_slice( bam_slice ** self, const bam_writer * writer )
+{
+    bam_slice * o;
+
+    if ( self == NULL || writer == NULL )
+        return RC( rcExe, rcData, rcConstructing, rcParam, rcNull );
+    *self = NULL;
+    if ( !writer -> header_written )
+        return RC( rcExe, rcData, rcConstructing, rcData, rcNotFound );
+    o = calloc( 1, sizeof * o );
+    if ( o == NULL )
+        return RC( rcExe, rcData, rcConstructing, rcMemory, rcExhausted );
+    o -> writer = writer;
+    *self = o;
+    return 0;
+}
+
+void release_bam_slice( bam_slice * self )
+{
+    if ( self != NULL )
+    {
+        free( self -> unknown_ref );
+        free( self -> rec );
+        free( self -> recs );
+        free( self -> cigar );
+        free( self );
+    }
+}
+
+rc_t bam_writer_write_slice( bam_writer * self, bam_slice * slice )
+{
+    rc_t rc = 0;
+    size_t i;
+
+    if ( self == NULL || slice == NULL )
+        return RC( rcExe, rcData, rcWriting, rcParam, rcNull );
+    if ( slice -> writer != self )
+        return RC( rcExe, rcData, rcWriting, rcParam, rcInvalid );
+
+    if ( slice -> unknown_ref != NULL && !self -> unknown_ref_warned )
+    {
+        (void)PLOGMSG( klogWarn, ( klogWarn, "reference '$(r)' is not in the BAM-header, written as unplaced",
+                                   "r=%s", slice -> unknown_ref ) );
+        self -> unknown_ref_warned = true;
+    }
+    if ( self -> index == NULL )
+    {
+        /* without an index the records go out in one piece */
+        if ( slice -> rec_start > 0 )
+            rc = write_bgzf( self, slice -> rec, slice -> rec_start );
+    }
+    else
+    {
+        for ( i = 0; rc == 0 && i < slice -> num_recs; ++i )
+        {
+            const bam_slice_rec * r = &slice -> recs[ i ];
+            uint64_t vo_beg = bgzf_writer_tell( self -> bgzf );
+            rc = write_bgzf( self, &slice -> rec[ r -> ofs ], r -> len );
+            if ( rc == 0 && self -> index != NULL )
+            {
+                uint64_t vo_end = bgzf_writer_tell( self -> bgzf );
+                if ( !bai_push( self -> index, r -> ref, r -> beg, r -> end, vo_beg, vo_end, r -> mapped, &rc ) )
+                {
+                    (void)LOGMSG( klogWarn, "the output is not sorted by coordinate, no BAI-index written" );
+                    release_bai_index( self -> index, self -> num_refs );
+                    self -> index = NULL;
+                }
+            }
+        }
+    }
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot write BAM-records" );
+
+    /* the slice is empty again, ready for the next records */
+    slice -> rec_len = slice -> rec_start = 0;
+    slice -> num_recs = 0;
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+rc_t make_bam_writer( bam_writer ** self, KFile * dst, uint32_t num_threads, const char * index_path )
+{
+    rc_t rc = 0;
+    bam_writer * o;
+
+    if ( self == NULL || dst == NULL )
+        return RC( rcExe, rcFile, rcConstructing, rcParam, rcNull );
+    *self = NULL;
+    o = calloc( 1, sizeof * o );
+    if ( o == NULL )
+        return RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+
+    if ( index_path != NULL )
+    {
+        o -> index_path = strdup( index_path );
+        if ( o -> index_path == NULL )
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+    }
+    if ( rc == 0 )
+        rc = KDataBufferMake( &o -> offsets, 64, 0 );
+    if ( rc == 0 )
+    {
+        /* the block-offsets are only needed to resolve the index */
+        rc = make_bgzf_writer( &o -> bgzf, dst, num_threads, index_path != NULL ? &o -> offsets : NULL );
+        if ( rc != 0 )
+            KDataBufferWhack( &o -> offsets );
+    }
+    if ( rc == 0 )
+        *self = o;
+    else
+    {
+        (void)LOGERR( klogErr, rc, "cannot make BAM-writer" );
+        free( o -> index_path );
+        free( o );
+    }
+    return rc;
+}
+
+rc_t release_bam_writer( bam_writer * self )
+{
+    rc_t rc = 0;
+    if ( self != NULL )
+    {
+        rc_t rc1;
+        if ( !self -> header_written )
+            rc = bam_writer_header( self, NULL, 0 );
+        /* releasing the bgzf-writer waits for all blocks, the offsets are complete after that */
+        rc1 = KFileRelease( self -> bgzf );
+        if ( rc == 0 )
+            rc = rc1;
+        if ( rc == 0 && self -> index != NULL )
+            rc = write_bai_index( self ); /* above */
+        release_bai_index( self -> index, self -> num_refs );
+        release_refs( self -> refs, self -> num_refs );
+        KDataBufferWhack( &self -> offsets );
+        free( self -> by_name );
+        free( self -> index_path );
+        free( self );
+    }
+    return rc;
+}
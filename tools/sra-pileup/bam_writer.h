@@ -0,0 +1,116 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bam_writer_
+#define _h_bam_writer_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+#include <kfs/file.h>
+
+/* --------------------------------------------------------------------------------------
+    writes BAM-records ( binary SAM ) into a KFile, compressed as BGZF by a pool of threads
+
+    the order of calls is:
+        make_bam_writer()
+        bam_writer_add_ref() for every reference the header-text may not mention
+        bam_writer_header() exactly once
+        make_bam_slice() one or more slices
+        for every record: bam_slice_begin(), any number of bam_slice_tag_...(), bam_slice_end()
+        bam_writer_write_slice() puts the records of a slice into the output and empties it
+        release_bam_slice(), release_bam_writer()
+
+    a slice encodes records without touching the writer, different slices can be filled
+    on different threads; the output has the records in the order of bam_writer_write_slice()
+
+    if index_path is not NULL, a BAI-index is written there on release, this requires
+    the records to be sorted by coordinate, otherwise a warning is given and no index written
+-------------------------------------------------------------------------------------- */
+typedef struct bam_writer bam_writer;
+
+rc_t make_bam_writer( bam_writer ** self, KFile * dst, uint32_t num_threads, const char * index_path );
+
+rc_t release_bam_writer( bam_writer * self );
+
+rc_t bam_writer_add_ref( bam_writer * self, const char * name, size_t name_len, uint64_t length );
+
+/* the SAM-header-text, its @SQ-lines define the references and their order */
+rc_t bam_writer_header( bam_writer * self, const char * text, size_t text_len );
+
+/* the fields of the SAM-text-format, pos and pnext are 0-based ( -1 if not placed ),
+   cigar is the text-form ( "*" or empty if none ), rname/rnext NULL or "*" if none,
+   rnext "=" for the same reference, qual is phred+33 or NULL if not available */
+typedef struct bam_record
+{
+    const char * qname;
+    size_t qname_len;
+    uint32_t flags;
+    const char * rname;
+    size_t rname_len;
+    int64_t pos;
+    uint32_t mapq;
+    const char * cigar;
+    size_t cigar_len;
+    const char * rnext;
+    size_t rnext_len;
+    int64_t pnext;
+    int64_t tlen;
+    const char * seq;
+    const char * qual;
+    size_t seq_len;
+} bam_record;
+
+typedef struct bam_slice bam_slice;
+
+/* the header has to be written before, the slice uses the references of the writer */
+rc_t make_bam_slice( bam_slice ** self, const bam_writer * writer );
+
+void release_bam_slice( bam_slice * self );
+
+rc_t bam_slice_begin( bam_slice * self, const bam_record * rec );
+
+rc_t bam_slice_tag_Z( bam_slice * self, const char tag[ 2 ], const char * value, size_t value_len );
+
+rc_t bam_slice_tag_i( bam_slice * self, const char tag[ 2 ], int64_t value );
+
+/* tags in SAM-text-form: "\tXX:T:value..." as they are stored in some columns */
+rc_t bam_slice_tags_text( bam_slice * self, const char * text, size_t text_len );
+
+rc_t bam_slice_end( bam_slice * self );
+
+/* the bytes of the complete records in the slice */
+size_t bam_slice_size( const bam_slice * self );
+
+rc_t bam_writer_write_slice( bam_writer * self, bam_slice * slice );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
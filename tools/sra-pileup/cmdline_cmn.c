@@ -668,36 +668,51 @@ static rc_t prepare_reflist( prepare_ctx *ctx )
 }
 
 
+rc_t open_prepare_ctx( prepare_ctx *ctx,
+                       const VDBManager *vdb_mgr,
+                       VSchema *vdb_schema,
+                       const char * path )
+{
+    rc_t rc = prepare_db_table( ctx, vdb_mgr, vdb_schema, path );
+    ctx->reflist = NULL;
+    if ( rc == 0 )
+        rc = prepare_reflist( ctx );
+    return rc;
+}
+
+
+void close_prepare_ctx( prepare_ctx *ctx )
+{
+    if ( ctx->reflist != NULL )
+    {
+        ReferenceList_Release( ctx->reflist );
+    }
+    VTableRelease ( ctx->seq_tab );
+    VDatabaseRelease ( ctx->db );
+}
+
+
 rc_t prepare_ref_iter( prepare_ctx *ctx,
                        const VDBManager *vdb_mgr,
                        VSchema *vdb_schema,
                        const char * path,
                        BSTree * regions )
 {
-    rc_t rc = prepare_db_table( ctx, vdb_mgr, vdb_schema, path );
+    rc_t rc = open_prepare_ctx( ctx, vdb_mgr, vdb_schema, path );
     if ( rc == 0 )
     {
-        rc = prepare_reflist( ctx );
-        if( rc == 0 )
+        if ( ctx->reflist == NULL || count_ref_regions( regions ) == 0 )
         {
-            if ( ctx->reflist == NULL || count_ref_regions( regions ) == 0 )
-            {
-                /* the user has not specified a reference-range : use the whole file... */
-                rc = prepare_whole_file( ctx );
-            }
-            else
-            {
-                /* pick only the requested ranges... */
-                rc = foreach_ref_region( regions, prepare_region_cb, ctx ); /* ref_regions.c */
-            }
+            /* the user has not specified a reference-range : use the whole file... */
+            rc = prepare_whole_file( ctx );
         }
-        if ( ctx->reflist != NULL )
+        else
         {
-            ReferenceList_Release( ctx->reflist );
+            /* pick only the requested ranges... */
+            rc = foreach_ref_region( regions, prepare_region_cb, ctx ); /* ref_regions.c */
         }
     }
-    VTableRelease ( ctx->seq_tab );
-    VDatabaseRelease ( ctx->db );
+    close_prepare_ctx( ctx );
     return rc;
 }
 
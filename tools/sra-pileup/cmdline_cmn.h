@@ -127,6 +127,14 @@ typedef struct prepare_ctx
 
 
 
+/* opens the database and its reference-list, for calling ctx->on_section() directly */
+rc_t open_prepare_ctx( prepare_ctx *ctx,
+                       const VDBManager *vdb_mgr,
+                       VSchema *vdb_schema,
+                       const char * path );
+
+void close_prepare_ctx( prepare_ctx *ctx );
+
 rc_t prepare_ref_iter( prepare_ctx *ctx,
                        const VDBManager *vdb_mgr,
                        VSchema *vdb_schema,
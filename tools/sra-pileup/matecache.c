@@ -25,8 +25,504 @@
 */
 
 #include "matecache.h"
+
+#include <kfs/directory.h>
+#include <kfs/file.h>
+#include <klib/sort.h>
+
 #include <sysalloc.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ----------------------------------------------------------------------------------- */
+
+/* entries beyond the ring collected in memory, before they are written as a sorted run */
+#define MW_SPILL_ENTRIES ( 64 * 1024 )
+
+/* entries read at once from a run */
+#define MW_RUN_ENTRIES 256
+
+/* a spilled entry in the file: key, at, value, flags */
+#define MW_ENTRY_BYTES ( 8 + 8 + 8 + 2 )
+
+typedef struct mw_entry
+{
+    int64_t key;
+    uint64_t at;
+    uint64_t value;
+    uint16_t flags;
+} mw_entry;
+
+/* one window of the ring */
+typedef struct mw_slot
+{
+    uint64_t window;
+    KVector * values;       /* NULL if the slot is empty */
+    KVector * flags;        /* only the flags that are not 0 */
+    uint64_t count;
+} mw_slot;
+
+/* a sorted run in the spill-file */
+typedef struct mw_run
+{
+    uint64_t pos;           /* of the next entry to read from the file */
+    uint64_t left;          /* entries not read from the file yet */
+    uint32_t buffered;
+    uint32_t next;
+    mw_entry buffer[ MW_RUN_ENTRIES ];
+} mw_run;
+
+struct mate_window
+{
+    mw_slot * ring;
+    uint32_t window_bits;
+    uint32_t num_windows;
+    bool started;
+    uint64_t first;         /* the ring holds the windows first ... first + num_windows - 1 */
+
+    mw_entry * spill;       /* entries beyond the ring, not yet written */
+    uint32_t spill_count;
+    Vector runs;            /* mw_run */
+    KDirectory * dir;
+    KFile * file;           /* the spill-file, made when needed */
+    uint64_t file_pos;
+
+    mate_window_stat stat;
+};
+
+static void mw_slot_release( mw_slot * const slot )
+{
+    if ( slot -> values != NULL )
+        KVectorRelease( slot -> values );
+    if ( slot -> flags != NULL )
+        KVectorRelease( slot -> flags );
+    slot -> values = NULL;
+    slot -> flags = NULL;
+    slot -> count = 0;
+}
+
+static void CC mw_run_release( void * item, void * data )
+{
+    free( item );
+}
+
+void release_mate_window( mate_window * const self )
+{
+    if ( self != NULL )
+    {
+        if ( self -> ring != NULL )
+        {
+            uint32_t idx;
+            for ( idx = 0; idx < self -> num_windows; ++idx )
+                mw_slot_release( &self -> ring[ idx ] );
+            free( self -> ring );
+        }
+        VectorWhack( &self -> runs, mw_run_release, NULL );
+        if ( self -> file != NULL )
+            KFileRelease( self -> file );
+        if ( self -> dir != NULL )
+            KDirectoryRelease( self -> dir );
+        free( self -> spill );
+        free( self );
+    }
+}
+
+rc_t make_mate_window( mate_window **self, uint32_t window_bits, uint32_t num_windows )
+{
+    rc_t rc = 0;
+    mate_window * mw = calloc( 1, sizeof * mw );
+    *self = NULL;
+    if ( mw == NULL )
+    {
+        rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        (void)LOGERR( klogErr, rc, "cannot create mate-window" );
+    }
+    else
+    {
+        mw -> window_bits = window_bits;
+        mw -> num_windows = num_windows;
+        VectorInit( &mw -> runs, 0, 16 );
+        mw -> ring = calloc( num_windows, sizeof mw -> ring[ 0 ] );
+        mw -> spill = malloc( MW_SPILL_ENTRIES * sizeof mw -> spill[ 0 ] );
+        if ( mw -> ring == NULL || mw -> spill == NULL )
+        {
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            (void)LOGERR( klogErr, rc, "cannot create mate-window internal structure" );
+            release_mate_window( mw );
+        }
+        else
+            *self = mw;
+    }
+    return rc;
+}
+
+rc_t mate_window_clear( mate_window * const self )
+{
+    uint32_t idx;
+    for ( idx = 0; idx < self -> num_windows; ++idx )
+    {
+        self -> stat.dropped += self -> ring[ idx ].count;
+        mw_slot_release( &self -> ring[ idx ] );
+    }
+    self -> stat.dropped += self -> spill_count;
+    self -> spill_count = 0;
+    VectorWhack( &self -> runs, mw_run_release, NULL );
+    VectorInit( &self -> runs, 0, 16 );
+    /* the spill-file is kept, its runs are overwritten */
+    self -> file_pos = 0;
+    self -> stat.count = 0;
+    self -> started = false;
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+/* an entry that belongs into the ring */
+static rc_t mw_put( mate_window * const self, const mw_entry * const e )
+{
+    uint64_t const window = e -> at >> self -> window_bits;
+    mw_slot * const slot = &self -> ring[ window % self -> num_windows ];
+    rc_t rc = 0;
+    bool is_new = true;
+
+    if ( slot -> values != NULL && slot -> window != window )
+    {
+        /* a window the walk has passed but not yet dropped */
+        self -> stat.dropped += slot -> count;
+        self -> stat.count -= slot -> count;
+        mw_slot_release( slot );
+    }
+    if ( slot -> values == NULL )
+    {
+        rc = KVectorMake( &slot -> values );
+        if ( rc != 0 )
+            (void)LOGERR( klogErr, rc, "cannot create KVector (mate-window) U64" );
+        slot -> window = window;
+    }
+    if ( rc == 0 )
+    {
+        uint64_t old_value;
+        is_new = ( KVectorGetU64( slot -> values, e -> key, &old_value ) != 0 );
+        rc = KVectorSetU64( slot -> values, e -> key, e -> value );
+        if ( rc != 0 )
+            (void)LOGERR( klogErr, rc, "cannot insert into KVector (mate-window) U64" );
+    }
+    if ( rc == 0 && e -> flags == 0 && !is_new && slot -> flags != NULL )
+    {
+        /* a replaced entry does not keep the flags of the one before */
+        KVectorUnset( slot -> flags, e -> key );
+    }
+    if ( rc == 0 && e -> flags != 0 )
+    {
+        if ( slot -> flags == NULL )
+        {
+            rc = KVectorMake( &slot -> flags );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot create KVector (mate-window) U16" );
+        }
+        if ( rc == 0 )
+        {
+            rc = KVectorSetU16( slot -> flags, e -> key, e -> flags );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot insert into KVector (mate-window) U16" );
+        }
+    }
+    if ( rc == 0 && is_new )
+    {
+        slot -> count++;
+        self -> stat.count++;
+        if ( self -> stat.count > self -> stat.max_count )
+            self -> stat.max_count = self -> stat.count;
+    }
+    return rc;
+}
+
+/* an entry that comes from the spill-file or -buffer */
+static rc_t mw_load( mate_window * const self, const mw_entry * const e )
+{
+    if ( ( e -> at >> self -> window_bits ) < self -> first )
+    {
+        self -> stat.dropped++;
+        return 0;
+    }
+    return mw_put( self, e );
+}
+
+static int64_t CC mw_entry_cmp( const void * a, const void * b, void * data )
+{
+    uint64_t const a_at = ( ( const mw_entry * )a ) -> at;
+    uint64_t const b_at = ( ( const mw_entry * )b ) -> at;
+    return ( a_at < b_at ) ? -1 : ( a_at > b_at );
+}
+
+static void put_le( uint8_t * dst, uint64_t value, uint32_t bytes )
+{
+    uint32_t i;
+    for ( i = 0; i < bytes; ++i )
+        dst[ i ] = ( uint8_t )( value >> ( 8 * i ) );
+}
+
+static uint64_t get_le( const uint8_t * src, uint32_t bytes )
+{
+    uint64_t value = 0;
+    uint32_t i;
+    for ( i = bytes; i > 0; --i )
+        value = ( value << 8 ) | src[ i - 1 ];
+    return value;
+}
+
+static rc_t mw_open_spill_file( mate_window * const self )
+{
+    const char * tmpdir = getenv( "TMPDIR" );
+    rc_t rc = KDirectoryNativeDir( &self -> dir );
+    if ( tmpdir == NULL || tmpdir[ 0 ] == 0 )
+        tmpdir = "/tmp";
+    if ( rc == 0 )
+    {
+        uint64_t const id = ( uint64_t )( size_t )self;
+        rc = KDirectoryCreateFile( self -> dir, &self -> file, true, 0600, kcmInit,
+                                   "%s/sam-dump-mates.%u.%lx", tmpdir, getpid(), id );
+        /* only the open file is needed */
+        KDirectoryRemove( self -> dir, false, "%s/sam-dump-mates.%u.%lx", tmpdir, getpid(), id );
+    }
+    if ( rc != 0 )
+        (void)PLOGERR( klogErr, ( klogErr, rc, "cannot create mate-spill-file in '$(d)'", "d=%s", tmpdir ) );
+    return rc;
+}
+
+/* sorts the spill-buffer by coordinate and writes it as a run */
+static rc_t mw_write_run( mate_window * const self )
+{
+    rc_t rc = 0;
+    uint8_t * bytes = NULL;
+    mw_run * run = calloc( 1, sizeof * run );
+    if ( run == NULL )
+        rc = RC( rcApp, rcNoTarg, rcWriting, rcMemory, rcExhausted );
+    else
+    {
+        bytes = malloc( ( size_t )self -> spill_count * MW_ENTRY_BYTES );
+        if ( bytes == NULL )
+            rc = RC( rcApp, rcNoTarg, rcWriting, rcMemory, rcExhausted );
+    }
+    if ( rc == 0 && self -> file == NULL )
+        rc = mw_open_spill_file( self );
+    if ( rc == 0 )
+    {
+        uint32_t idx;
+        size_t num_writ;
+        size_t const size = ( size_t )self -> spill_count * MW_ENTRY_BYTES;
+
+        ksort( self -> spill, self -> spill_count, sizeof self -> spill[ 0 ], mw_entry_cmp, NULL );
+        for ( idx = 0; idx < self -> spill_count; ++idx )
+        {
+            uint8_t * dst = bytes + ( size_t )idx * MW_ENTRY_BYTES;
+            const mw_entry * e = &self -> spill[ idx ];
+            put_le( dst, ( uint64_t )e -> key, 8 );
+            put_le( dst + 8, e -> at, 8 );
+            put_le( dst + 16, e -> value, 8 );
+            put_le( dst + 24, e -> flags, 2 );
+        }
+        rc = KFileWriteAll( self -> file, self -> file_pos, bytes, size, &num_writ );
+        if ( rc == 0 && num_writ != size )
+            rc = RC( rcApp, rcFile, rcWriting, rcTransfer, rcIncomplete );
+        if ( rc == 0 )
+        {
+            run -> pos = self -> file_pos;
+            run -> left = self -> spill_count;
+            self -> file_pos += size;
+            self -> spill_count = 0;
+            rc = VectorAppend( &self -> runs, NULL, run );
+            if ( rc == 0 )
+                run = NULL;
+        }
+    }
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot write run into mate-spill-file" );
+    free( bytes );
+    free( run );
+    return rc;
+}
+
+static rc_t mw_fill_run( mate_window * const self, mw_run * const run )
+{
+    uint8_t bytes[ MW_RUN_ENTRIES * MW_ENTRY_BYTES ];
+    uint32_t const count = ( run -> left < MW_RUN_ENTRIES ) ? ( uint32_t )run -> left : MW_RUN_ENTRIES;
+    size_t const size = ( size_t )count * MW_ENTRY_BYTES;
+    size_t num_read;
+    rc_t rc = KFileReadAll( self -> file, run -> pos, bytes, size, &num_read );
+    if ( rc == 0 && num_read != size )
+        rc = RC( rcApp, rcFile, rcReading, rcTransfer, rcIncomplete );
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot read run from mate-spill-file" );
+    else
+    {
+        uint32_t idx;
+        for ( idx = 0; idx < count; ++idx )
+        {
+            const uint8_t * src = bytes + ( size_t )idx * MW_ENTRY_BYTES;
+            mw_entry * e = &run -> buffer[ idx ];
+            e -> key = ( int64_t )get_le( src, 8 );
+            e -> at = get_le( src + 8, 8 );
+            e -> value = get_le( src + 16, 8 );
+            e -> flags = ( uint16_t )get_le( src + 24, 2 );
+        }
+        run -> pos += size;
+        run -> left -= count;
+        run -> buffered = count;
+        run -> next = 0;
+    }
+    return rc;
+}
+
+/* moves the spilled entries below window 'limit' into the ring */
+static rc_t mw_load_spilled( mate_window * const self, uint64_t limit )
+{
+    rc_t rc = 0;
+    uint32_t idx = 0;
+
+    while ( rc == 0 && idx < self -> spill_count )
+    {
+        if ( ( self -> spill[ idx ].at >> self -> window_bits ) < limit )
+        {
+            rc = mw_load( self, &self -> spill[ idx ] );
+            self -> spill[ idx ] = self -> spill[ --self -> spill_count ];
+        }
+        else
+            idx++;
+    }
+
+    idx = 0;
+    while ( rc == 0 && idx < VectorLength( &self -> runs ) )
+    {
+        mw_run * run = VectorGet( &self -> runs, idx );
+        bool done = false;
+        while ( rc == 0 && !done )
+        {
+            if ( run -> next == run -> buffered )
+            {
+                if ( run -> left == 0 )
+                    done = true;
+                else
+                    rc = mw_fill_run( self, run );
+            }
+            else if ( ( run -> buffer[ run -> next ].at >> self -> window_bits ) < limit )
+                rc = mw_load( self, &run -> buffer[ run -> next++ ] );
+            else
+                done = true;
+        }
+        if ( rc == 0 && run -> next == run -> buffered && run -> left == 0 )
+        {
+            /* the run is used up */
+            void * removed;
+            VectorRemove( &self -> runs, idx, &removed );
+            free( run );
+        }
+        else
+            idx++;
+    }
+    return rc;
+}
+
+rc_t mate_window_advance( mate_window * const self, uint64_t at )
+{
+    rc_t rc = 0;
+    uint64_t window = at >> self -> window_bits;
+    /* one window of slack behind the walk */
+    uint64_t first = ( window > 0 ) ? window - 1 : 0;
+
+    if ( !self -> started )
+    {
+        self -> started = true;
+        self -> first = first;
+    }
+    else if ( first > self -> first )
+    {
+        uint64_t w;
+        uint64_t const end = ( first < self -> first + self -> num_windows ) ? first : self -> first + self -> num_windows;
+        for ( w = self -> first; w < end; ++w )
+        {
+            mw_slot * const slot = &self -> ring[ w % self -> num_windows ];
+            if ( slot -> values != NULL && slot -> window == w )
+            {
+                self -> stat.dropped += slot -> count;
+                self -> stat.count -= slot -> count;
+                mw_slot_release( slot );
+            }
+        }
+        self -> first = first;
+        rc = mw_load_spilled( self, first + self -> num_windows );
+    }
+    return rc;
+}
+
+rc_t mate_window_insert( mate_window * const self, int64_t key, uint64_t at, uint64_t value, uint16_t flags )
+{
+    rc_t rc = 0;
+    uint64_t const window = at >> self -> window_bits;
+    mw_entry e;
+
+    e.key = key;
+    e.at = at;
+    e.value = value;
+    e.flags = flags;
+    self -> stat.inserts++;
+    if ( !self -> started )
+        rc = mate_window_advance( self, at );
+    if ( rc != 0 )
+        return rc;
+
+    if ( window < self -> first )
+    {
+        /* the walk has passed the mate already */
+        self -> stat.dropped++;
+    }
+    else if ( window < self -> first + self -> num_windows )
+        rc = mw_put( self, &e );
+    else
+    {
+        if ( self -> spill_count == MW_SPILL_ENTRIES )
+            rc = mw_write_run( self );
+        if ( rc == 0 )
+        {
+            self -> spill[ self -> spill_count++ ] = e;
+            self -> stat.spilled++;
+        }
+    }
+    return rc;
+}
+
+rc_t mate_window_take( mate_window * const self, int64_t key, uint64_t at, uint64_t *value, uint16_t *flags )
+{
+    uint64_t const window = at >> self -> window_bits;
+    mw_slot * const slot = &self -> ring[ window % self -> num_windows ];
+    rc_t rc = RC( rcApp, rcNoTarg, rcAccessing, rcItem, rcNotFound );
+
+    self -> stat.lookups++;
+    if ( self -> started && slot -> values != NULL && slot -> window == window )
+    {
+        if ( KVectorGetU64( slot -> values, key, value ) == 0 )
+        {
+            *flags = 0;
+            KVectorUnset( slot -> values, key );
+            if ( slot -> flags != NULL && KVectorGetU16( slot -> flags, key, flags ) == 0 )
+                KVectorUnset( slot -> flags, key );
+            slot -> count--;
+            self -> stat.count--;
+            self -> stat.finds++;
+            rc = 0;
+        }
+    }
+    return rc;
+}
+
+const mate_window_stat * mate_window_get_stat( const mate_window * const self )
+{
+    return &self -> stat;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
 
 void release_matecache( matecache * const self )
 {
@@ -37,10 +533,7 @@ void release_matecache( matecache * const self )
             uint32_t idx;
             for ( idx = 0; idx < self->count; ++idx )
             {
-                if ( self->per_file[ idx ].same_ref_64 != NULL )
-                    KVectorRelease( self->per_file[ idx ].same_ref_64 );
-                if ( self->per_file[ idx ].same_ref_16 != NULL )
-                    KVectorRelease( self->per_file[ idx ].same_ref_16 );
+                release_mate_window( self->per_file[ idx ].same_ref );
 
                 if ( self->per_file[ idx ].unaligned_64_a != NULL )
                     KVectorRelease( self->per_file[ idx ].unaligned_64_a );
@@ -54,6 +547,10 @@ void release_matecache( matecache * const self )
 }
 
 
+/* windows of 64k reference-positions, 1024 of them in memory: mates up to 64M bases ahead */
+#define SAME_REF_WINDOW_BITS 16
+#define SAME_REF_NUM_WINDOWS 1024
+
 rc_t make_matecache( matecache **self, uint32_t count )
 {
     rc_t rc = 0;
@@ -79,25 +576,17 @@ rc_t make_matecache( matecache **self, uint32_t count )
             uint32_t idx;
             for ( idx = 0; idx < count && rc == 0; ++idx )
             {
-                rc = KVectorMake( &( mc->per_file[ idx ].same_ref_64 ) );
-                if ( rc != 0 )
-                    (void)LOGERR( klogErr, rc, "cannot create KVector (same-ref) U64" );
-                else
+                rc = make_mate_window( &( mc->per_file[ idx ].same_ref ), SAME_REF_WINDOW_BITS, SAME_REF_NUM_WINDOWS );
+                if ( rc == 0 )
                 {
-                    rc = KVectorMake( &( mc->per_file[ idx ].same_ref_16 ) );
+                    rc = KVectorMake( &( mc->per_file[ idx ].unaligned_64_a ) );
                     if ( rc != 0 )
-                        (void)LOGERR( klogErr, rc, "cannot create KVector (same-ref) U16" );
+                        (void)LOGERR( klogErr, rc, "cannot create KVector (unaligned a) U64" );
                     else
                     {
-                        rc = KVectorMake( &( mc->per_file[ idx ].unaligned_64_a ) );
+                        rc = KVectorMake( &( mc->per_file[ idx ].unaligned_64_b ) );
                         if ( rc != 0 )
-                            (void)LOGERR( klogErr, rc, "cannot create KVector (unaligned a) U64" );
-                        else
-                        {
-                            rc = KVectorMake( &( mc->per_file[ idx ].unaligned_64_b ) );
-                            if ( rc != 0 )
-                                (void)LOGERR( klogErr, rc, "cannot create KVector (unaligned b) U64" );
-                        }
+                            (void)LOGERR( klogErr, rc, "cannot create KVector (unaligned b) U64" );
                     }
                 }
             }
@@ -166,7 +655,8 @@ static rc_t matecache_check( const matecache * const self, uint32_t db_idx, mate
 
 
 rc_t matecache_insert_same_ref( matecache * const self,
-        uint32_t db_idx, int64_t key, INSDC_coord_zero ref_pos, uint32_t flags, INSDC_coord_len tlen )
+        uint32_t db_idx, int64_t key, INSDC_coord_zero mate_pos,
+        INSDC_coord_zero ref_pos, uint32_t flags, INSDC_coord_len tlen )
 {
     matecache_per_file * mcpf = NULL;
     rc_t rc = matecache_check( self, db_idx, &mcpf );
@@ -175,106 +665,32 @@ rc_t matecache_insert_same_ref( matecache * const self,
         uint64_t ref_pos_and_tlen = ref_pos;
         ref_pos_and_tlen <<= 32;
         ref_pos_and_tlen |= tlen;
-        rc = KVectorSetU64( mcpf->same_ref_64, key, ref_pos_and_tlen );
+        rc = mate_window_insert( mcpf->same_ref, key, ( uint32_t )mate_pos, ref_pos_and_tlen, ( uint16_t )flags );
         if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot insert into KVector (same-ref) U64" );
-        else
-        {
-            rc = KVectorSetU16( mcpf->same_ref_16, key, flags );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot insert into KVector (same-ref) U16" );
-        }
-        if ( rc == 0 )
-        {
-            mcpf->stat_same_ref.count++;
-            if ( mcpf->stat_same_ref.count > mcpf->maxcount_same_ref )
-                mcpf->maxcount_same_ref = mcpf->stat_same_ref.count;
-            mcpf->stat_same_ref.inserts++;
-        }
+            (void)LOGERR( klogErr, rc, "cannot insert into same-ref-cache" );
     }
     return rc;
 }
 
 
-rc_t matecache_lookup_same_ref( const matecache * const self, uint32_t db_idx, int64_t key,
+rc_t matecache_lookup_same_ref( matecache * const self, uint32_t db_idx, int64_t key, INSDC_coord_zero pos,
                        INSDC_coord_zero *ref_pos, uint32_t *flags, INSDC_coord_len *tlen )
 {
     matecache_per_file * mcpf = NULL;
     rc_t rc = matecache_check( self, db_idx, &mcpf );
     if ( rc == 0 )
     {
-        uint64_t value64;
-        mcpf->stat_same_ref.lookups++;
-        rc = KVectorGetU64( mcpf->same_ref_64, key, &value64 );
-        if ( rc != 0 )
-        {
-            if ( GetRCState( rc ) != rcNotFound )
-                (void)LOGERR( klogErr, rc, "cannot retrieve value (same-ref) U64" );
-        }
-        else
+        rc = mate_window_advance( mcpf->same_ref, ( uint32_t )pos );
+        if ( rc == 0 )
         {
+            uint64_t value64;
             uint16_t value16;
-            rc = KVectorGetU16( mcpf->same_ref_16, key, &value16 );
-            if ( rc != 0 )
-            {
-                if ( GetRCState( rc ) != rcNotFound )
-                    (void)LOGERR( klogErr, rc, "cannot retrieve value (same-ref) U16" );
-            }
-            else
+            rc = mate_window_take( mcpf->same_ref, key, ( uint32_t )pos, &value64, &value16 );
+            if ( rc == 0 )
             {
                 *ref_pos = ( value64 >> 32 );
                 *tlen = ( value64 & 0xFFFFFFFF );
                 *flags = value16;
-                mcpf->stat_same_ref.finds++;
-            }
-        }
-    }
-    return rc;
-}
-
-
-rc_t matecache_remove_same_ref( matecache * const self, uint32_t db_idx, int64_t key )
-{
-    matecache_per_file * mcpf = NULL;
-    rc_t rc = matecache_check( self, db_idx, &mcpf );
-    if ( rc == 0 )
-    {
-        rc = KVectorUnset( mcpf->same_ref_64, key );
-        if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot remove from same-ref-cache (64bit)" );
-        else
-        {
-            rc = KVectorUnset( mcpf->same_ref_16, key );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot remove from same-ref-cache (16bit)" );
-        }
-        if ( rc == 0 && mcpf->stat_same_ref.count > 0 )
-            mcpf->stat_same_ref.count--;
-    }
-    return rc;
-}
-
-
-static rc_t matecache_clear_same_ref_per_file( matecache_per_file * const mcpf )
-{
-    rc_t rc = KVectorRelease( mcpf->same_ref_64 );
-    if ( rc != 0 )
-        (void)LOGERR( klogErr, rc, "cannot release same-ref-cache (64bit)" );
-    else
-    {
-        rc = KVectorRelease( mcpf->same_ref_16 );
-        if ( rc != 0 )
-            (void)LOGERR( klogErr, rc, "cannot release same-ref-cache (16bit)" );
-        else
-        {
-            rc = KVectorMake( &mcpf->same_ref_64 );
-            if ( rc != 0 )
-                (void)LOGERR( klogErr, rc, "cannot make same-ref-cache (64bit)" );
-            else
-            {
-                rc = KVectorMake( &mcpf->same_ref_16 );
-                if ( rc != 0 )
-                    (void)LOGERR( klogErr, rc, "cannot make same-ref-cache (16bit)" );
             }
         }
     }
@@ -295,7 +711,7 @@ rc_t matecache_clear_same_ref( matecache * const self )
         uint32_t idx;
         for ( idx = 0; idx < self->count && rc == 0; ++idx )
         {
-            rc = matecache_clear_same_ref_per_file( &self->per_file[ idx ] );
+            rc = mate_window_clear( self->per_file[ idx ].same_ref );
         }
         self->flashes++;
    }
@@ -316,15 +732,20 @@ rc_t matecache_report( const matecache * const self )
         uint32_t idx;
         for ( idx = 0; idx < self->count && rc == 0; ++idx )
         {
+            const mate_window_stat * st = mate_window_get_stat( self->per_file[ idx ].same_ref );
             rc = KOutMsg( "on same reference:\n" );
             if ( rc == 0 )
-                rc = KOutMsg( "matecache[ %u ].maxcount = %,lu\n", idx, self->per_file[ idx ].maxcount_same_ref );
+                rc = KOutMsg( "matecache[ %u ].maxcount = %,lu\n", idx, st->max_count );
+            if ( rc == 0 )
+                rc = KOutMsg( "matecache[ %u ].inserts = %,lu\n", idx, st->inserts );
+            if ( rc == 0 )
+                rc = KOutMsg( "matecache[ %u ].lookups = %,lu\n", idx, st->lookups );
             if ( rc == 0 )
-                rc = KOutMsg( "matecache[ %u ].inserts = %,lu\n", idx, self->per_file[ idx ].stat_same_ref.inserts );
+                rc = KOutMsg( "matecache[ %u ].finds = %,lu\n", idx, st->finds );
             if ( rc == 0 )
-                rc = KOutMsg( "matecache[ %u ].lookups = %,lu\n", idx, self->per_file[ idx ].stat_same_ref.lookups );
+                rc = KOutMsg( "matecache[ %u ].spilled = %,lu\n", idx, st->spilled );
             if ( rc == 0 )
-                rc = KOutMsg( "matecache[ %u ].finds = %,lu\n", idx, self->per_file[ idx ].stat_same_ref.finds );
+                rc = KOutMsg( "matecache[ %u ].dropped = %,lu\n", idx, st->dropped );
             if ( rc == 0 )
                 rc = KOutMsg( "unaligned:\n" );
             if ( rc == 0 )
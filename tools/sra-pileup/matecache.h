@@ -50,17 +50,57 @@ typedef struct matecache_stat
 } matecache_stat;
 
 
+/* --------------------------------------------------------------------------------------
+    mate_window: keeps information about an alignment until the walk reaches its mate
+
+    every entry is placed at the coordinate where it will be looked up: the position of
+    the mate for a walk by position, the row-id of the mate for a walk by row-id
+    - the next num_windows windows of ( 1 << window_bits ) coordinates are kept in memory
+      as a ring, a window is dropped once the walk has passed it
+    - entries beyond the ring go into a spill-file ( in TMPDIR ) as sorted runs, they are
+      loaded when their window comes into the ring
+    the coordinates have to grow ( within a window of slack ), a lookup that misses is not
+    an error: the caller reads the mate from the table
+-------------------------------------------------------------------------------------- */
+typedef struct mate_window mate_window;
+
+typedef struct mate_window_stat
+{
+    uint64_t count;         /* entries in memory */
+    uint64_t max_count;
+    uint64_t inserts;
+    uint64_t lookups;
+    uint64_t finds;
+    uint64_t spilled;       /* inserted beyond the ring */
+    uint64_t dropped;       /* passed by the walk without being looked up */
+} mate_window_stat;
+
+rc_t make_mate_window( mate_window **self, uint32_t window_bits, uint32_t num_windows );
+
+void release_mate_window( mate_window * const self );
+
+/* forget all entries, e.g. when the walk moves to the next reference */
+rc_t mate_window_clear( mate_window * const self );
+
+/* the walk has reached 'at': drops the windows behind it, loads spilled entries coming into reach */
+rc_t mate_window_advance( mate_window * const self, uint64_t at );
+
+rc_t mate_window_insert( mate_window * const self, int64_t key, uint64_t at, uint64_t value, uint16_t flags );
+
+/* finds and removes the entry, rcNotFound if it is not there */
+rc_t mate_window_take( mate_window * const self, int64_t key, uint64_t at, uint64_t *value, uint16_t *flags );
+
+const mate_window_stat * mate_window_get_stat( const mate_window * const self );
+
+
 typedef struct matecache_per_file
 {
-    KVector *same_ref_64;   /* ref-pos and ref-idx */
-    KVector *same_ref_16;   /* flags */
+    mate_window *same_ref;  /* ref-pos, tlen and flags, placed at the position of the mate */
 
     KVector *unaligned_64_a;  /* ref-pos and ref-idx */
     KVector *unaligned_64_b;  /* seq_spot_id */
 
-    matecache_stat stat_same_ref;
     matecache_stat stat_unaligned;
-    uint64_t maxcount_same_ref;
 } matecache_per_file;
 
 
@@ -85,14 +125,22 @@ rc_t matecache_report( const matecache * const self );
 
 /* cache functions for aligned mates on the same reference */
 
+/*
+    key      ... row-id of the alignment
+    mate_pos ... position of its mate, where the lookup will happen
+*/
 rc_t matecache_insert_same_ref( matecache * const self,
-        uint32_t db_idx, int64_t key, INSDC_coord_zero ref_pos, uint32_t flags, INSDC_coord_len tlen );
+        uint32_t db_idx, int64_t key, INSDC_coord_zero mate_pos,
+        INSDC_coord_zero ref_pos, uint32_t flags, INSDC_coord_len tlen );
 
-rc_t matecache_lookup_same_ref( const matecache * const self, uint32_t db_idx, int64_t key,
+/*
+    key      ... row-id of the mate
+    pos      ... position of the alignment being dumped
+    a found entry is removed from the cache
+*/
+rc_t matecache_lookup_same_ref( matecache * const self, uint32_t db_idx, int64_t key, INSDC_coord_zero pos,
                        INSDC_coord_zero *ref_pos, uint32_t *flags, INSDC_coord_len *tlen );
 
-rc_t matecache_remove_same_ref( matecache * const self, uint32_t db_idx, int64_t key );
-
 
 /* cache functions for half aligned mates */
 
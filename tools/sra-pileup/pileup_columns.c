@@ -0,0 +1,433 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "pileup_columns.h"
+
+#include <klib/log.h>
+#include <klib/text.h>
+#include <kfs/directory.h>
+#include <kfs/file.h>
+
+#include <sysalloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_LEN ( 1 << PILEUP_COLUMNS_CHUNK_BITS )
+
+/* worst case of PC_DELTA: 5 bytes per value */
+#define MAX_PACKED_SIZE ( CHUNK_LEN * 5 )
+
+typedef struct pileup_columns
+{
+    KDirectory * dir;
+    KFile * f;
+    uint64_t pos;               /* where the next bytes go into the file */
+    bool pack;
+    bool header_written;
+
+    uint32_t num_columns;
+    uint32_t * values;          /* num_columns arrays of CHUNK_LEN values, the current chunk */
+    uint8_t * packed;           /* MAX_PACKED_SIZE, to encode one column */
+
+    /* the current reference and chunk */
+    char * ref_name;
+    uint64_t chunk_start;
+    uint32_t chunk_count;       /* 0 ... no open chunk */
+
+    /* the index, written on release */
+    pc_ref * refs;
+    uint32_t num_refs;
+    uint32_t refs_allocated;
+    pc_chunk * chunks;
+    uint32_t num_chunks;
+    uint32_t chunks_allocated;
+    pc_column * columns;        /* num_columns per chunk */
+    char * names;
+    uint32_t names_len;
+    uint32_t names_allocated;
+} pileup_columns;
+
+
+static rc_t grow_array( void ** array, uint32_t * allocated, uint32_t needed, size_t item_size )
+{
+    rc_t rc = 0;
+    if ( needed > *allocated )
+    {
+        uint32_t n = ( *allocated == 0 ) ? 64 : *allocated;
+        void * p;
+        while ( n < needed )
+            n *= 2;
+        p = realloc( *array, n * item_size );
+        if ( p == NULL )
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        else
+        {
+            *array = p;
+            *allocated = n;
+        }
+    }
+    return rc;
+}
+
+
+static rc_t write_columns_file( pileup_columns * self, const void * buffer, size_t size )
+{
+    size_t num_writ;
+    rc_t rc = KFileWriteAll( self->f, self->pos, buffer, size, &num_writ );
+    if ( rc == 0 && num_writ != size )
+        rc = RC( rcApp, rcFile, rcWriting, rcTransfer, rcIncomplete );
+    if ( rc != 0 )
+    {
+        LOGERR( klogErr, rc, "cannot write columnar output" );
+    }
+    else
+        self->pos += size;
+    return rc;
+}
+
+
+/* every column starts at an 8-byte boundary, for the readers mapping the file */
+static rc_t align_columns_file( pileup_columns * self )
+{
+    static const uint8_t zeros[ 8 ] = { 0 };
+    uint32_t pad = ( uint32_t )( ( 8 - ( self->pos & 7 ) ) & 7 );
+    return ( pad > 0 ) ? write_columns_file( self, zeros, pad ) : 0;
+}
+
+
+rc_t make_pileup_columns( struct pileup_columns ** self, const char * path, bool pack )
+{
+    rc_t rc = 0;
+    pileup_columns * res = calloc( 1, sizeof *res );
+    *self = NULL;
+    if ( res == NULL )
+        rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    else
+    {
+        res->pack = pack;
+        rc = KDirectoryNativeDir( &res->dir );
+        if ( rc == 0 )
+        {
+            rc = KDirectoryCreateFile( res->dir, &res->f, false, 0664, kcmInit | kcmParents, "%s", path );
+            if ( rc != 0 )
+            {
+                PLOGERR( klogErr, ( klogErr, rc, "cannot create columnar output '$(p)'", "p=%s", path ) );
+            }
+        }
+        if ( rc == 0 )
+            *self = res;
+        else
+        {
+            if ( res->dir != NULL )
+                KDirectoryRelease( res->dir );
+            free( res );
+        }
+    }
+    return rc;
+}
+
+
+static rc_t write_columns_header( pileup_columns * self, uint32_t num_columns, const char ** names )
+{
+    pc_file_header hdr;
+    uint32_t idx;
+    rc_t rc;
+
+    memset( &hdr, 0, sizeof hdr );
+    memmove( hdr.magic, PILEUP_COLUMNS_MAGIC, sizeof hdr.magic );
+    hdr.version = PILEUP_COLUMNS_VERSION;
+    hdr.byte_order = PILEUP_COLUMNS_BYTE_ORDER;
+    hdr.chunk_bits = PILEUP_COLUMNS_CHUNK_BITS;
+    hdr.num_columns = num_columns;
+    rc = write_columns_file( self, &hdr, sizeof hdr );
+    for ( idx = 0; rc == 0 && idx < num_columns; ++idx )
+    {
+        char name[ PILEUP_COLUMNS_NAME_LEN ];
+        memset( name, 0, sizeof name );
+        string_copy( name, sizeof name, names[ idx ], string_size( names[ idx ] ) );
+        rc = write_columns_file( self, name, sizeof name );
+    }
+    self->header_written = true;
+    return rc;
+}
+
+
+rc_t pileup_columns_set_names( struct pileup_columns * self, uint32_t num_columns, const char ** names )
+{
+    rc_t rc = 0;
+    if ( self == NULL || names == NULL || num_columns == 0 )
+        return RC( rcApp, rcNoTarg, rcConstructing, rcParam, rcNull );
+    if ( self->header_written )
+        return RC( rcApp, rcNoTarg, rcConstructing, rcSelf, rcExists );
+
+    self->num_columns = num_columns;
+    self->values = calloc( ( size_t )num_columns * CHUNK_LEN, sizeof self->values[ 0 ] );
+    self->packed = malloc( MAX_PACKED_SIZE );
+    if ( self->values == NULL || self->packed == NULL )
+        rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    else
+        rc = write_columns_header( self, num_columns, names );
+    return rc;
+}
+
+
+static uint32_t pack_rle( const uint32_t * values, uint32_t count, uint8_t * dst )
+{
+    uint32_t * out = ( uint32_t * )dst;
+    uint32_t idx = 0, n = 0;
+    while ( idx < count )
+    {
+        uint32_t run = 1;
+        while ( idx + run < count && values[ idx + run ] == values[ idx ] )
+            run++;
+        out[ n++ ] = run;
+        out[ n++ ] = values[ idx ];
+        idx += run;
+        if ( n * sizeof out[ 0 ] >= count * sizeof values[ 0 ] )
+            return UINT32_MAX; /* not smaller than PC_RAW */
+    }
+    return n * sizeof out[ 0 ];
+}
+
+
+static uint32_t pack_delta( const uint32_t * values, uint32_t count, uint8_t * dst )
+{
+    uint32_t idx, n = 0;
+    uint32_t prev = 0;
+    for ( idx = 0; idx < count; ++idx )
+    {
+        int64_t diff = ( int64_t )values[ idx ] - prev;
+        uint64_t zz = ( diff < 0 ) ? ( ( ( uint64_t )( -diff ) ) << 1 ) - 1 : ( ( uint64_t )diff ) << 1;
+        while ( zz >= 0x80 )
+        {
+            dst[ n++ ] = ( uint8_t )( zz | 0x80 );
+            zz >>= 7;
+        }
+        dst[ n++ ] = ( uint8_t )zz;
+        prev = values[ idx ];
+    }
+    return n;
+}
+
+
+static rc_t flush_chunk( pileup_columns * self )
+{
+    rc_t rc = 0;
+    uint32_t count = self->chunk_count;
+    uint32_t col;
+
+    if ( count == 0 )
+        return 0;
+
+    rc = grow_array( ( void ** )&self->chunks, &self->chunks_allocated, self->num_chunks + 1, sizeof self->chunks[ 0 ] );
+    if ( rc == 0 )
+    {
+        /* the columns grow together with the chunks */
+        void * p = realloc( self->columns, ( size_t )self->chunks_allocated * self->num_columns * sizeof self->columns[ 0 ] );
+        if ( p == NULL )
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        else
+            self->columns = p;
+    }
+
+    for ( col = 0; rc == 0 && col < self->num_columns; ++col )
+    {
+        uint32_t * values = &self->values[ ( size_t )col * CHUNK_LEN ];
+        pc_column * c = &self->columns[ ( size_t )self->num_chunks * self->num_columns + col ];
+        const void * src = values;
+
+        c->encoding = PC_RAW;
+        c->size = count * sizeof values[ 0 ];
+        if ( self->pack )
+        {
+            uint32_t size = pack_rle( values, count, self->packed );
+            if ( size < c->size )
+            {
+                c->encoding = PC_RLE;
+                c->size = size;
+            }
+            size = pack_delta( values, count, self->packed );
+            if ( size < c->size )
+            {
+                c->encoding = PC_DELTA;
+                c->size = size;
+            }
+            else if ( c->encoding == PC_RLE )
+                pack_rle( values, count, self->packed ); /* pack_delta() has overwritten it */
+            if ( c->encoding != PC_RAW )
+                src = self->packed;
+        }
+
+        rc = align_columns_file( self );
+        if ( rc == 0 )
+        {
+            c->offset = self->pos;
+            rc = write_columns_file( self, src, c->size );
+        }
+        /* the next chunk starts with zeros */
+        memset( values, 0, count * sizeof values[ 0 ] );
+    }
+
+    if ( rc == 0 )
+    {
+        pc_chunk * chunk = &self->chunks[ self->num_chunks ];
+        chunk->start = self->chunk_start;
+        chunk->ref_idx = self->num_refs - 1;
+        chunk->count = count;
+        self->refs[ self->num_refs - 1 ].num_chunks++;
+        self->num_chunks++;
+    }
+    self->chunk_count = 0;
+    return rc;
+}
+
+
+static rc_t enter_ref( pileup_columns * self, const char * ref_name, uint64_t ref_len )
+{
+    size_t len = string_size( ref_name );
+    rc_t rc = flush_chunk( self );
+    if ( rc == 0 )
+        rc = grow_array( ( void ** )&self->refs, &self->refs_allocated, self->num_refs + 1, sizeof self->refs[ 0 ] );
+    if ( rc == 0 )
+        rc = grow_array( ( void ** )&self->names, &self->names_allocated, self->names_len + len, 1 );
+    if ( rc == 0 )
+    {
+        pc_ref * ref = &self->refs[ self->num_refs++ ];
+        ref->length = ref_len;
+        ref->first_chunk = self->num_chunks;
+        ref->num_chunks = 0;
+        ref->name_offset = self->names_len;
+        ref->name_len = len;
+        memmove( &self->names[ self->names_len ], ref_name, len );
+        self->names_len += len;
+
+        free( self->ref_name );
+        self->ref_name = string_dup( ref_name, len );
+        if ( self->ref_name == NULL )
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    }
+    return rc;
+}
+
+
+rc_t pileup_columns_put( struct pileup_columns * self, const char * ref_name, uint64_t ref_len,
+                         uint64_t ref_pos, const uint32_t * values )
+{
+    rc_t rc = 0;
+    uint64_t chunk_start = ref_pos & ~( ( uint64_t )CHUNK_LEN - 1 );
+    uint32_t at, col;
+
+    if ( self == NULL || ref_name == NULL || values == NULL )
+        return RC( rcApp, rcNoTarg, rcWriting, rcParam, rcNull );
+    if ( self->values == NULL )
+        return RC( rcApp, rcNoTarg, rcWriting, rcSelf, rcNotOpen );
+
+    if ( self->ref_name == NULL || strcmp( self->ref_name, ref_name ) != 0 )
+        rc = enter_ref( self, ref_name, ref_len );
+    else if ( self->chunk_count > 0 && chunk_start != self->chunk_start )
+    {
+        if ( chunk_start < self->chunk_start )
+            rc = RC( rcApp, rcNoTarg, rcWriting, rcParam, rcInvalid );
+        else
+            rc = flush_chunk( self );
+    }
+    if ( rc != 0 )
+        return rc;
+
+    if ( self->chunk_count == 0 )
+        self->chunk_start = chunk_start;
+    at = ( uint32_t )( ref_pos - chunk_start );
+    if ( self->chunk_count > 0 && at + 1 < self->chunk_count )
+        return RC( rcApp, rcNoTarg, rcWriting, rcParam, rcInvalid );
+
+    for ( col = 0; col < self->num_columns; ++col )
+        self->values[ ( size_t )col * CHUNK_LEN + at ] = values[ col ];
+    self->chunk_count = at + 1;
+    return rc;
+}
+
+
+static rc_t write_columns_index( pileup_columns * self )
+{
+    pc_index_header hdr;
+    pc_file_trailer trailer;
+    uint64_t index_offset;
+    rc_t rc = align_columns_file( self );
+
+    index_offset = self->pos;
+    hdr.num_refs = self->num_refs;
+    hdr.num_chunks = self->num_chunks;
+    if ( rc == 0 )
+        rc = write_columns_file( self, &hdr, sizeof hdr );
+    if ( rc == 0 && self->num_refs > 0 )
+        rc = write_columns_file( self, self->refs, self->num_refs * sizeof self->refs[ 0 ] );
+    if ( rc == 0 && self->num_chunks > 0 )
+    {
+        rc = write_columns_file( self, self->chunks, self->num_chunks * sizeof self->chunks[ 0 ] );
+        if ( rc == 0 )
+            rc = write_columns_file( self, self->columns,
+                    ( size_t )self->num_chunks * self->num_columns * sizeof self->columns[ 0 ] );
+    }
+    if ( rc == 0 && self->names_len > 0 )
+        rc = write_columns_file( self, self->names, self->names_len );
+    if ( rc == 0 )
+    {
+        memset( &trailer, 0, sizeof trailer );
+        trailer.index_offset = index_offset;
+        trailer.index_size = self->pos - index_offset;
+        memmove( trailer.magic, PILEUP_COLUMNS_MAGIC, sizeof trailer.magic );
+        rc = write_columns_file( self, &trailer, sizeof trailer );
+    }
+    return rc;
+}
+
+
+rc_t release_pileup_columns( struct pileup_columns * self )
+{
+    rc_t rc = 0;
+    if ( self != NULL )
+    {
+        /* a walk without positions still gives a valid, empty file */
+        if ( !self->header_written )
+            rc = write_columns_header( self, 0, NULL );
+        if ( rc == 0 )
+            rc = flush_chunk( self );
+        if ( rc == 0 )
+            rc = write_columns_index( self );
+
+        KFileRelease( self->f );
+        KDirectoryRelease( self->dir );
+        free( self->values );
+        free( self->packed );
+        free( self->ref_name );
+        free( self->refs );
+        free( self->chunks );
+        free( self->columns );
+        free( self->names );
+        free( self );
+    }
+    return rc;
+}
@@ -0,0 +1,137 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_pileup_columns_
+#define _h_pileup_columns_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+/* --------------------------------------------------------------------------------------
+    writes the per-position values of a pileup-function ( count, stat ) as a binary
+    columnar file instead of one text-line per position
+
+    the positions of a reference are grouped into chunks of ( 1 << PILEUP_COLUMNS_CHUNK_BITS )
+    positions, aligned to the start of the reference: chunk n covers the 0-based positions
+    n << PILEUP_COLUMNS_CHUNK_BITS and up. Every column of a chunk is an array of uint32_t,
+    one value per position, positions not walked ( no coverage ) are 0.
+
+    layout, all integers in the byte-order of the writer ( see byte_order ):
+
+        header      pc_file_header, followed by num_columns names of 16 bytes ( 0-padded )
+        data        the columns of the chunks, every column starts at an 8-byte boundary
+        index       pc_index_header
+                    pc_ref[ num_refs ]
+                    pc_chunk[ num_chunks ]
+                    pc_column[ num_chunks * num_columns ], the columns of chunk 0 first
+                    the names of the references ( not 0-terminated, see pc_ref )
+        trailer     pc_file_trailer, the last bytes of the file
+
+    encoding of a column:
+        PC_RAW      uint32_t[ count ], can be used directly from a memory-mapped file
+        PC_RLE      pairs of uint32_t { run-length, value }
+        PC_DELTA    the difference to the previous value ( 0 before the first ),
+                    zig-zag encoded, as LEB128 varints
+    without packing every column is PC_RAW, with packing the smallest of the three
+-------------------------------------------------------------------------------------- */
+
+#define PILEUP_COLUMNS_MAGIC        "PILECOLS"
+#define PILEUP_COLUMNS_VERSION      1
+#define PILEUP_COLUMNS_BYTE_ORDER   0x01020304
+#define PILEUP_COLUMNS_CHUNK_BITS   16
+#define PILEUP_COLUMNS_NAME_LEN     16
+
+enum { PC_RAW = 0, PC_RLE = 1, PC_DELTA = 2 };
+
+typedef struct pc_file_header
+{
+    char magic[ 8 ];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t chunk_bits;
+    uint32_t num_columns;
+    uint64_t reserved;
+} pc_file_header;
+
+typedef struct pc_index_header
+{
+    uint32_t num_refs;
+    uint32_t num_chunks;
+} pc_index_header;
+
+typedef struct pc_ref
+{
+    uint64_t length;        /* length of the reference */
+    uint32_t first_chunk;   /* index into pc_chunk[] */
+    uint32_t num_chunks;
+    uint32_t name_offset;   /* into the names at the end of the index */
+    uint32_t name_len;
+} pc_ref;
+
+typedef struct pc_chunk
+{
+    uint64_t start;         /* 0-based position of the first value */
+    uint32_t ref_idx;
+    uint32_t count;         /* values per column, up to the last position walked */
+} pc_chunk;
+
+typedef struct pc_column
+{
+    uint64_t offset;        /* in the file */
+    uint32_t size;          /* in bytes */
+    uint32_t encoding;      /* PC_RAW, PC_RLE, PC_DELTA */
+} pc_column;
+
+typedef struct pc_file_trailer
+{
+    uint64_t index_offset;
+    uint64_t index_size;
+    char magic[ 8 ];
+} pc_file_trailer;
+
+
+struct pileup_columns;
+
+rc_t make_pileup_columns( struct pileup_columns ** self, const char * path, bool pack );
+
+/* writes the last chunk and the index */
+rc_t release_pileup_columns( struct pileup_columns * self );
+
+/* the walk-function declares its columns once, before the first position */
+rc_t pileup_columns_set_names( struct pileup_columns * self, uint32_t num_columns, const char ** names );
+
+/* the positions of a reference have to grow, values has one entry per column */
+rc_t pileup_columns_put( struct pileup_columns * self, const char * ref_name, uint64_t ref_len,
+                         uint64_t ref_pos, const uint32_t * values );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*  _h_pileup_columns_ */
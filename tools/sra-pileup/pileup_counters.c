@@ -25,6 +25,7 @@
 */
 
 #include <klib/out.h>
+#include <klib/sort.h>
 
 #include "ref_walker_0.h"
 #include "4na_ascii.h"
@@ -38,163 +39,247 @@ static uint32_t percent( uint32_t v1, uint32_t v2 )
     return res;
 }
 
+/* the inserted/deleted fragments at one position: a hash-table with open addressing,
+   keyed by the bases packed 2 bits each ( up to 32 bases of A/C/G/T ), otherwise by
+   a FNV-hash of the bases. The bases of all fragments are in one buffer, the table is
+   emptied for the next position by walking the list of used slots. */
+
 typedef struct indel_fragment
 {
-    BSTNode node;
-    const char * bases;
+    uint64_t key;
+    uint32_t bases;     /* offset into fragment_hash.bases */
     uint32_t len;
-    uint32_t count;
+    uint32_t count;     /* 0 ... empty slot */
 } indel_fragment;
 
 
-static indel_fragment * make_indel_fragment( const char * bases, uint32_t len )
+typedef struct fragment_hash
 {
-    indel_fragment * res = malloc( sizeof * res );
-    if ( res != NULL )
-    {
-        res->bases = string_dup ( bases, len );
-        if ( res->bases == NULL )
-        {
-            free( res );
-            res = NULL;
-        }
-        else
-        {
-            res->len = len;
-            res->count = 1;
-        }
-    }
-    return res;
-}
+    indel_fragment * slots;
+    uint32_t capacity;      /* a power of 2 */
+    uint32_t * used;        /* index of the occupied slots, capacity / 2 at most */
+    uint32_t num_used;
+    char * bases;
+    uint32_t bases_len;
+    uint32_t bases_allocated;
+} fragment_hash;
+
+
+#define INIT_FRAGMENT_SLOTS 64
 
 
-static void CC free_indel_fragment( BSTNode * n, void * data )
+static rc_t init_fragment_hash( fragment_hash * h )
 {
-    indel_fragment * fragment = ( indel_fragment * ) n;
-    if ( fragment != NULL )
-    {
-        free( ( void * ) fragment->bases );
-        free( fragment );
-    }
+    h->capacity = INIT_FRAGMENT_SLOTS;
+    h->slots = calloc( h->capacity, sizeof h->slots[ 0 ] );
+    h->used = malloc( ( h->capacity / 2 ) * sizeof h->used[ 0 ] );
+    h->num_used = 0;
+    h->bases_allocated = 1024;
+    h->bases = malloc( h->bases_allocated );
+    h->bases_len = 0;
+    if ( h->slots == NULL || h->used == NULL || h->bases == NULL )
+        return RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    return 0;
 }
 
 
-static void free_fragments( BSTree * fragments )
-{    
-    BSTreeWhack ( fragments, free_indel_fragment, NULL );
+static void finish_fragment_hash( fragment_hash * h )
+{
+    free( h->slots );
+    free( h->used );
+    free( h->bases );
 }
 
 
-typedef struct find_fragment_ctx
+static void clear_fragment_hash( fragment_hash * h )
 {
-    const char * bases;
-    uint32_t len;
-} find_fragment_ctx;
+    uint32_t i;
+    for ( i = 0; i < h->num_used; ++i )
+        h->slots[ h->used[ i ] ].count = 0;
+    h->num_used = 0;
+    h->bases_len = 0;
+}
 
 
-static int64_t CC cmp_fragment_vs_find_ctx( const void *item, const BSTNode *n )
+static uint32_t fragment_slot( uint32_t capacity, uint64_t key, uint32_t len )
 {
-    const indel_fragment * fragment = ( const indel_fragment * )n;
-    const find_fragment_ctx * fctx = ( const find_fragment_ctx * )item;
-    return string_cmp ( fctx->bases, fctx->len, fragment->bases, fragment->len, -1 );
+    uint64_t x = ( key ^ len ) * 0x9E3779B97F4A7C15ull;
+    return ( uint32_t )( x >> 32 ) & ( capacity - 1 );
 }
 
 
-static int64_t CC cmp_fragment_vs_fragment( const BSTNode *item, const BSTNode *n )
+static bool grow_fragment_hash( fragment_hash * h )
 {
-    const indel_fragment * f1 = ( const indel_fragment * )item;
-    const indel_fragment * f2 = ( const indel_fragment * )n;
-    return string_cmp ( f1->bases, f1->len, f2->bases, f2->len, -1 );
+    uint32_t capacity = h->capacity * 2;
+    indel_fragment * slots = calloc( capacity, sizeof slots[ 0 ] );
+    uint32_t * used = malloc( ( capacity / 2 ) * sizeof used[ 0 ] );
+    uint32_t i;
+
+    if ( slots == NULL || used == NULL )
+    {
+        free( slots );
+        free( used );
+        return false;
+    }
+    for ( i = 0; i < h->num_used; ++i )
+    {
+        const indel_fragment * f = &h->slots[ h->used[ i ] ];
+        uint32_t slot = fragment_slot( capacity, f->key, f->len );
+        while ( slots[ slot ].count != 0 )
+            slot = ( slot + 1 ) & ( capacity - 1 );
+        slots[ slot ] = *f;
+        used[ i ] = slot;
+    }
+    free( h->slots );
+    free( h->used );
+    h->slots = slots;
+    h->used = used;
+    h->capacity = capacity;
+    return true;
 }
 
 
-static void count_indel_fragment( BSTree * fragments, const INSDC_4na_bin *bases, uint32_t len )
+static void count_indel_fragment( fragment_hash * h, const INSDC_4na_bin *bases, uint32_t len )
 {
-    find_fragment_ctx fctx;
+    uint64_t packed = 0;
+    uint64_t fnv = 0xCBF29CE484222325ull;
+    bool packable = ( len <= 32 );
+    char * dst;
+    uint32_t i, slot;
 
-    fctx.bases = malloc( len );
-    if ( fctx.bases != NULL )
+    if ( h->bases_len + len > h->bases_allocated )
     {
-        indel_fragment * fragment;
-        uint32_t i;
+        uint32_t n = h->bases_allocated;
+        void * p;
+        while ( n < h->bases_len + len )
+            n *= 2;
+        p = realloc( h->bases, n );
+        if ( p == NULL )
+            return;
+        h->bases = p;
+        h->bases_allocated = n;
+    }
+    if ( ( h->num_used + 1 ) * 2 > h->capacity && !grow_fragment_hash( h ) )
+        return;
 
-        fctx.len = len;
-        for ( i = 0; i < len; ++i )
-            ( ( char * )fctx.bases )[ i ] = _4na_to_ascii( bases[ i ], false );
+    /* the bases go to the end of the buffer, they stay there only for a new fragment */
+    dst = &h->bases[ h->bases_len ];
+    for ( i = 0; i < len; ++i )
+    {
+        char c = _4na_to_ascii( bases[ i ], false );
+        dst[ i ] = c;
+        fnv = ( fnv ^ ( uint8_t )c ) * 0x100000001B3ull;
+        packable = packable && ( c == 'A' || c == 'C' || c == 'G' || c == 'T' );
+        packed = ( packed << 2 ) | _4na_to_index( bases[ i ] );
+    }
+    if ( !packable )
+        packed = fnv;
 
-        fragment = ( indel_fragment * ) BSTreeFind ( fragments, &fctx, cmp_fragment_vs_find_ctx );
-        if ( fragment == NULL )
+    slot = fragment_slot( h->capacity, packed, len );
+    while ( h->slots[ slot ].count != 0 )
+    {
+        indel_fragment * f = &h->slots[ slot ];
+        if ( f->key == packed && f->len == len && memcmp( &h->bases[ f->bases ], dst, len ) == 0 )
         {
-            fragment = make_indel_fragment( fctx.bases, len );
-            if ( fragment != NULL )
-            {
-                rc_t rc = BSTreeInsert ( fragments, ( BSTNode * )fragment, cmp_fragment_vs_fragment );
-                if ( rc != 0 )
-                    free_indel_fragment( ( BSTNode * )fragment, NULL );
-            }
+            f->count++;
+            return;
         }
-        else
-            fragment->count++;
-
-        free( ( void * ) fctx.bases );
+        slot = ( slot + 1 ) & ( h->capacity - 1 );
     }
+
+    h->slots[ slot ].key = packed;
+    h->slots[ slot ].bases = h->bases_len;
+    h->slots[ slot ].len = len;
+    h->slots[ slot ].count = 1;
+    h->used[ h->num_used++ ] = slot;
+    h->bases_len += len;
 }
 
 
-typedef struct walk_fragment_ctx
+/* the text-output lists the fragments ordered by their bases */
+static int64_t CC cmp_fragment_slots( const void *item1, const void *item2, void *data )
 {
-    rc_t rc;
-    uint32_t n;
-} walk_fragment_ctx;
+    const fragment_hash * h = data;
+    const indel_fragment * f1 = &h->slots[ *( const uint32_t * )item1 ];
+    const indel_fragment * f2 = &h->slots[ *( const uint32_t * )item2 ];
+    return string_cmp ( &h->bases[ f1->bases ], f1->len, &h->bases[ f2->bases ], f2->len, -1 );
+}
 
 
-static void CC on_fragment( BSTNode *n, void *data )
+static rc_t print_fragments( struct pileup_out * out, fragment_hash * h )
 {
-    walk_fragment_ctx * wctx = data;
-    const indel_fragment * fragment = ( const indel_fragment * )n;
-    if ( wctx->rc == 0 )
+    rc_t rc = 0;
+    uint32_t i;
+
+    if ( h->num_used > 1 )
+        ksort( h->used, h->num_used, sizeof h->used[ 0 ], cmp_fragment_slots, h );
+    for ( i = 0; rc == 0 && i < h->num_used; ++i )
     {
-        if ( wctx->n == 0 )
-            wctx->rc = KOutMsg( "%u-%.*s", fragment->count, fragment->len, fragment->bases );
+        const indel_fragment * f = &h->slots[ h->used[ i ] ];
+        if ( i == 0 )
+            rc = pileup_out_print( out, "%u-%.*s", f->count, f->len, &h->bases[ f->bases ] );
         else
-            wctx->rc = KOutMsg( "|%u-%.*s", fragment->count, fragment->len, fragment->bases );
-        wctx->n++;
+            rc = pileup_out_print( out, "|%u-%.*s", f->count, f->len, &h->bases[ f->bases ] );
     }
-}
-
-
-static rc_t print_fragments( BSTree * fragments )
-{
-    walk_fragment_ctx wctx;
-    wctx.rc = 0;
-    wctx.n = 0;
-    BSTreeForEach ( fragments, false, on_fragment, &wctx );
-    return wctx.rc;
+    return rc;
 }
 
 /* =========================================================================================== */
 
+/* the states of the placements at a position are collected and counted at the end of
+   the position in one pass, the orientation is kept in a bit above the align_iter_... bits */
+#define STATE_REVERSE 0x40000000
+
 typedef struct pileup_counters
 {
     uint32_t matches;
-    uint32_t mismatches[ 4 ];
+    uint32_t mismatches[ 5 ];   /* A, C, G, T, other ( N... ) */
     uint32_t inserts;
     uint32_t deletes;
     uint32_t forward;
     uint32_t reverse;
     uint32_t starting;
     uint32_t ending;
-    BSTree insert_fragments;
-    BSTree delete_fragments;
+    fragment_hash insert_fragments;
+    fragment_hash delete_fragments;
+    bool fragments;             /* collect the inserted/deleted bases, for the text-output */
+    int32_t * states;
+    uint32_t num_states;
+    uint32_t states_allocated;
 } pileup_counters;
 
 
+static rc_t prepare_counters( pileup_counters * counters, bool fragments )
+{
+    rc_t rc;
+    memset( counters, 0, sizeof *counters );
+    counters->fragments = fragments;
+    counters->states_allocated = 1024;
+    counters->states = malloc( counters->states_allocated * sizeof counters->states[ 0 ] );
+    if ( counters->states == NULL )
+        rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    else
+        rc = init_fragment_hash( &counters->insert_fragments );
+    if ( rc == 0 )
+        rc = init_fragment_hash( &counters->delete_fragments );
+    return rc;
+}
+
+
+static void finish_counters( pileup_counters * counters )
+{
+    free( counters->states );
+    finish_fragment_hash( &counters->insert_fragments );
+    finish_fragment_hash( &counters->delete_fragments );
+}
+
+
 static void clear_counters( pileup_counters * counters )
 {
     uint32_t i;
 
     counters->matches = 0;
-    for ( i = 0; i < 4; ++i )
+    for ( i = 0; i < 5; ++i )
         counters->mismatches[ i ] = 0;
     counters->inserts = 0;
     counters->deletes = 0;
@@ -202,45 +287,37 @@ static void clear_counters( pileup_counters * counters )
     counters->reverse = 0;
     counters->starting = 0;
     counters->ending = 0;
-    BSTreeInit( &(counters->insert_fragments) );
-    BSTreeInit( &(counters->delete_fragments) );
+    counters->num_states = 0;
+    clear_fragment_hash( &counters->insert_fragments );
+    clear_fragment_hash( &counters->delete_fragments );
 }
 
 
-static void walk_counter_state( ReferenceIterator *ref_iter, int32_t state, bool reverse,
+static rc_t walk_counter_state( ReferenceIterator *ref_iter, int32_t state, bool reverse,
                                 pileup_counters * counters )
 {
     if ( ( state & align_iter_invalid ) == align_iter_invalid )
-        return;
+        return 0;
 
-    if ( ( state & align_iter_skip ) != align_iter_skip )
+    if ( counters->num_states == counters->states_allocated )
     {
-        if ( ( state & align_iter_match ) == align_iter_match )
-            (counters->matches)++;
-        else
-        {
-            char c = _4na_to_ascii( state, false );
-            switch( c )
-            {
-                case 'A' : ( counters->mismatches[ 0 ] )++; break;
-                case 'C' : ( counters->mismatches[ 1 ] )++; break;
-                case 'G' : ( counters->mismatches[ 2 ] )++; break;
-                case 'T' : ( counters->mismatches[ 3 ] )++; break;
-            }
-        }
+        uint32_t n = counters->states_allocated * 2;
+        void * p = realloc( counters->states, n * sizeof counters->states[ 0 ] );
+        if ( p == NULL )
+            return RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        counters->states = p;
+        counters->states_allocated = n;
     }
+    counters->states[ counters->num_states++ ] = reverse ? ( state | STATE_REVERSE ) : state;
 
-    if ( reverse )
-        (counters->reverse)++;
-    else
-        (counters->forward)++;
-
+    /* the bases of an indel are only available while the iterator is on the placement */
     if ( ( state & align_iter_insert ) == align_iter_insert )
     {
         const INSDC_4na_bin *bases;
         uint32_t n = ReferenceIteratorBasesInserted ( ref_iter, &bases );
         (counters->inserts) += n;
-        count_indel_fragment( &(counters->insert_fragments), bases, n );
+        if ( counters->fragments )
+            count_indel_fragment( &(counters->insert_fragments), bases, n );
     }
 
     if ( ( state & align_iter_delete ) == align_iter_delete )
@@ -251,20 +328,59 @@ static void walk_counter_state( ReferenceIterator *ref_iter, int32_t state, bool
         if ( bases != NULL )
         {
             (counters->deletes) += n;
-            count_indel_fragment( &(counters->delete_fragments), bases, n );
+            if ( counters->fragments )
+                count_indel_fragment( &(counters->delete_fragments), bases, n );
             free( (void *) bases );
         }
     }
+    return 0;
+}
+
 
-    if ( ( state & align_iter_first ) == align_iter_first )
-        ( counters->starting)++;
+/* one branch-free pass over the states of the position, the compiler can vectorize it */
+static void count_states( pileup_counters * counters )
+{
+    const int32_t * states = counters->states;
+    uint32_t i, n = counters->num_states;
+    uint32_t matches = 0, a = 0, c = 0, g = 0, t = 0, other = 0;
+    uint32_t reverse = 0, starting = 0, ending = 0;
+
+    for ( i = 0; i < n; ++i )
+    {
+        int32_t s = states[ i ];
+        uint32_t base = s & 0x0F;
+        uint32_t counted = ( ( s & align_iter_skip ) == 0 );
+        uint32_t match = counted & ( ( s & align_iter_match ) != 0 );
+        uint32_t mismatch = counted & !match;
+        uint32_t is_a = ( base == 1 ), is_c = ( base == 2 ), is_g = ( base == 4 ), is_t = ( base == 8 );
+
+        matches += match;
+        a += mismatch & is_a;
+        c += mismatch & is_c;
+        g += mismatch & is_g;
+        t += mismatch & is_t;
+        other += mismatch & !( is_a | is_c | is_g | is_t );
+        reverse += ( ( s & STATE_REVERSE ) != 0 );
+        starting += ( ( s & align_iter_first ) != 0 );
+        ending += ( ( s & align_iter_last ) != 0 );
+    }
 
-    if ( ( state & align_iter_last ) == align_iter_last )
-        ( counters->ending)++;
+    counters->matches += matches;
+    counters->mismatches[ 0 ] += a;
+    counters->mismatches[ 1 ] += c;
+    counters->mismatches[ 2 ] += g;
+    counters->mismatches[ 3 ] += t;
+    counters->mismatches[ 4 ] += other;
+    counters->forward += n - reverse;
+    counters->reverse += reverse;
+    counters->starting += starting;
+    counters->ending += ending;
+    counters->num_states = 0;
 }
 
 
-static rc_t print_counter_line( const char * ref_name,
+static rc_t print_counter_line( struct pileup_out * out,
+                                const char * ref_name,
                                 INSDC_coord_zero ref_pos,
                                 INSDC_4na_bin ref_base,
                                 uint32_t depth,
@@ -272,52 +388,100 @@ static rc_t print_counter_line( const char * ref_name,
 {
     char c = _4na_to_ascii( ref_base, false );
 
-    rc_t rc = KOutMsg( "%s\t%u\t%c\t%u\t", ref_name, ref_pos + 1, c, depth );
+    rc_t rc = pileup_out_print( out, "%s\t%u\t%c\t%u\t", ref_name, ref_pos + 1, c, depth );
 
     if ( rc == 0 && counters->matches > 0 )
-        rc = KOutMsg( "%u", counters->matches );
+        rc = pileup_out_print( out, "%u", counters->matches );
 
     if ( rc == 0 /* && counters->mismatches[ 0 ] > 0 */ )
-        rc = KOutMsg( "\t%u-A", counters->mismatches[ 0 ] );
+        rc = pileup_out_print( out, "\t%u-A", counters->mismatches[ 0 ] );
 
     if ( rc == 0 /* && counters->mismatches[ 1 ] > 0 */ )
-        rc = KOutMsg( "\t%u-C", counters->mismatches[ 1 ] );
+        rc = pileup_out_print( out, "\t%u-C", counters->mismatches[ 1 ] );
 
     if ( rc == 0 /* && counters->mismatches[ 2 ] > 0 */ )
-        rc = KOutMsg( "\t%u-G", counters->mismatches[ 2 ] );
+        rc = pileup_out_print( out, "\t%u-G", counters->mismatches[ 2 ] );
 
     if ( rc == 0 /* && counters->mismatches[ 3 ] > 0 */ )
-        rc = KOutMsg( "\t%u-T", counters->mismatches[ 3 ] );
+        rc = pileup_out_print( out, "\t%u-T", counters->mismatches[ 3 ] );
 
     if ( rc == 0 )
-        rc = KOutMsg( "\tI:" );
+        rc = pileup_out_print( out, "\tI:" );
     if ( rc == 0 )
-        rc = print_fragments( &(counters->insert_fragments) );
+        rc = print_fragments( out, &(counters->insert_fragments) );
 
     if ( rc == 0 )
-        rc = KOutMsg( "\tD:" );
+        rc = pileup_out_print( out, "\tD:" );
     if ( rc == 0 )
-        rc = print_fragments( &(counters->delete_fragments) );
+        rc = print_fragments( out, &(counters->delete_fragments) );
 
     if ( rc == 0 )
-        rc = KOutMsg( "\t%u%%", percent( counters->forward, counters->reverse ) );
+        rc = pileup_out_print( out, "\t%u%%", percent( counters->forward, counters->reverse ) );
 
     if ( rc == 0 && counters->starting > 0 )
-        rc = KOutMsg( "\tS%u", counters->starting );
+        rc = pileup_out_print( out, "\tS%u", counters->starting );
 
     if ( rc == 0 && counters->ending > 0 )
-        rc = KOutMsg( "\tE%u", counters->ending );
+        rc = pileup_out_print( out, "\tE%u", counters->ending );
 
     if ( rc == 0 )
-        rc = KOutMsg( "\n" );
-
-    free_fragments( &(counters->insert_fragments) );
-    free_fragments( &(counters->delete_fragments) );
+        rc = pileup_out_print( out, "\n" );
 
     return rc;
 }
 
 
+/* the columns of function count in the columnar output ( pileup_columns.h ):
+   the bases seen at a position ( matches counted for the reference-base ),
+   the inserted/deleted bases, the orientation and the starting/ending alignments */
+enum
+{
+    cc_depth, cc_a, cc_c, cc_g, cc_t, cc_n, cc_inserts, cc_deletes,
+    cc_forward, cc_reverse, cc_starting, cc_ending, cc_count
+};
+
+static const char * counter_column_names[ cc_count ] =
+{
+    "DEPTH", "A", "C", "G", "T", "N", "INS", "DEL",
+    "FWD", "REV", "START", "END"
+};
+
+
+static rc_t put_counter_columns( struct pileup_columns * columns,
+                                 const char * ref_name,
+                                 INSDC_coord_len ref_len,
+                                 INSDC_coord_zero ref_pos,
+                                 INSDC_4na_bin ref_base,
+                                 uint32_t depth,
+                                 pileup_counters * counters )
+{
+    uint32_t values[ cc_count ];
+
+    values[ cc_depth ] = depth;
+    values[ cc_a ] = counters->mismatches[ 0 ];
+    values[ cc_c ] = counters->mismatches[ 1 ];
+    values[ cc_g ] = counters->mismatches[ 2 ];
+    values[ cc_t ] = counters->mismatches[ 3 ];
+    values[ cc_n ] = counters->mismatches[ 4 ];
+    switch( _4na_to_ascii( ref_base, false ) )
+    {
+        case 'A' : values[ cc_a ] += counters->matches; break;
+        case 'C' : values[ cc_c ] += counters->matches; break;
+        case 'G' : values[ cc_g ] += counters->matches; break;
+        case 'T' : values[ cc_t ] += counters->matches; break;
+        default  : values[ cc_n ] += counters->matches; break;
+    }
+    values[ cc_inserts ] = counters->inserts;
+    values[ cc_deletes ] = counters->deletes;
+    values[ cc_forward ] = counters->forward;
+    values[ cc_reverse ] = counters->reverse;
+    values[ cc_starting ] = counters->starting;
+    values[ cc_ending ] = counters->ending;
+
+    return pileup_columns_put( columns, ref_name, ref_len, ref_pos, values );
+}
+
+
 /* ........................................................................................... */
 
 
@@ -329,14 +493,19 @@ static rc_t CC walk_counters_enter_ref_pos( walk_data * data )
 
 static rc_t CC walk_counters_exit_ref_pos( walk_data * data )
 {
-    rc_t rc = print_counter_line( data->ref_name, data->ref_pos, data->ref_base, data->depth, data->data );
+    rc_t rc;
+    count_states( data->data );
+    if ( data->options->columns != NULL )
+        rc = put_counter_columns( data->options->columns, data->ref_name, data->ref_len,
+                                  data->ref_pos, data->ref_base, data->depth, data->data );
+    else
+        rc = print_counter_line( data->options->out, data->ref_name, data->ref_pos, data->ref_base, data->depth, data->data );
     return rc;
 }
 
 static rc_t CC walk_counters_placement( walk_data * data )
 {
-    walk_counter_state( data->ref_iter, data->state, data->xrec->reverse, data->data );
-    return 0;
+    return walk_counter_state( data->ref_iter, data->state, data->xrec->reverse, data->data );
 }
 
 rc_t walk_counters( ReferenceIterator *ref_iter, pileup_options *options )
@@ -344,6 +513,17 @@ rc_t walk_counters( ReferenceIterator *ref_iter, pileup_options *options )
     walk_data data;
     walk_funcs funcs;
     pileup_counters counters;
+    rc_t rc = 0;
+
+    if ( options->columns != NULL )
+        rc = pileup_columns_set_names( options->columns, cc_count, counter_column_names );
+    if ( rc == 0 )
+        rc = prepare_counters( &counters, options->columns == NULL );
+    if ( rc != 0 )
+    {
+        finish_counters( &counters );
+        return rc;
+    }
 
     data.ref_iter = ref_iter;
     data.options = options;
@@ -363,7 +543,9 @@ rc_t walk_counters( ReferenceIterator *ref_iter, pileup_options *options )
 
     funcs.on_placement = walk_counters_placement;
 
-    return walk_0( &data, &funcs );
+    rc = walk_0( &data, &funcs );
+    finish_counters( &counters );
+    return rc;
 }
 
 
@@ -389,9 +571,6 @@ static rc_t print_mismatches_line( const char * ref_name,
         }
     }
     
-    free_fragments( &(counters->insert_fragments) );
-    free_fragments( &(counters->delete_fragments) );
-
     return rc;
 }
 
@@ -407,6 +586,7 @@ static rc_t CC walk_mismatches_enter_ref_pos( walk_data * data )
 
 static rc_t CC walk_mismatches_exit_ref_pos( walk_data * data )
 {
+    count_states( data->data );
     rc_t rc = print_mismatches_line( data->ref_name, data->ref_pos,
                                      data->depth, data->options->min_mismatch, data->data );
     return rc;
@@ -414,8 +594,7 @@ static rc_t CC walk_mismatches_exit_ref_pos( walk_data * data )
 
 static rc_t CC walk_mismatches_placement( walk_data * data )
 {
-    walk_counter_state( data->ref_iter, data->state, data->xrec->reverse, data->data );
-    return 0;
+    return walk_counter_state( data->ref_iter, data->state, data->xrec->reverse, data->data );
 }
 
 
@@ -425,6 +604,14 @@ rc_t walk_mismatches( ReferenceIterator *ref_iter, pileup_options * options )
     walk_funcs funcs;
     pileup_counters counters;
 
+    /* the fragments are not printed here */
+    rc_t rc = prepare_counters( &counters, false );
+    if ( rc != 0 )
+    {
+        finish_counters( &counters );
+        return rc;
+    }
+
     data.ref_iter = ref_iter;
     data.options = options;
     data.data = &counters;
@@ -443,5 +630,7 @@ rc_t walk_mismatches( ReferenceIterator *ref_iter, pileup_options * options )
 
     funcs.on_placement = walk_mismatches_placement;
 
-    return walk_0( &data, &funcs );
+    rc = walk_0( &data, &funcs );
+    finish_counters( &counters );
+    return rc;
 }
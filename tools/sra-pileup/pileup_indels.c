@@ -65,7 +65,7 @@ static rc_t CC walk_indels_exit_ref_pos( walk_data * data )
         F ... total insertes
                           A   B   C   D   E   F
 */
-			rc = KOutMsg( "%s\t%u\t%c\t%u\t%u\t%u\n", 
+			rc = pileup_out_print( data->options->out, "%s\t%u\t%c\t%u\t%u\t%u\n", 
                      data->ref_name, data->ref_pos + 1, ref_base, data->depth,
                      vc->deletes, vc->inserts );
 		}
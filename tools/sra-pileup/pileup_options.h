@@ -33,6 +33,8 @@ extern "C" {
 
 #include "ref_regions.h"
 #include "cmdline_cmn.h"
+#include "pileup_out.h"
+#include "pileup_columns.h"
 
 typedef struct pileup_options
 {
@@ -48,10 +50,15 @@ typedef struct pileup_options
     uint32_t minmapq;
     uint32_t min_mismatch;
     uint32_t merge_dist;
+    uint32_t num_threads;   /* > 1 : the references are cut into slices, walked in parallel */
     uint32_t source_table;
     uint32_t function;  /* sra_pileup_samtools, sra_pileup_counters, sra_pileup_stat, 
                            sra_pileup_report_ref, sra_pileup_report_ref_ext, sra_pileup_debug, etc */
     struct skiplist * skiplist;     /* from ref_regions.h */
+    struct pileup_out * out;        /* from pileup_out.h, NULL: print directly */
+    const char * columnar_path;     /* not NULL: count and stat write a binary columnar file */
+    bool columnar_pack;             /* the columns are RLE/delta packed */
+    struct pileup_columns * columns;    /* from pileup_columns.h, made from columnar_path */
 } pileup_options;
 
 
@@ -0,0 +1,224 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+#include "pileup_out.h"
+
+#include <klib/log.h>
+#include <klib/out.h>
+#include <klib/printf.h>
+#include <kfs/directory.h>
+#include <kfs/file.h>
+
+#include <sysalloc.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+typedef struct pileup_out
+{
+    char * data;
+    size_t allocated;
+    size_t data_len;
+    size_t mem_limit;
+
+    KDirectory * dir;
+    KFile * spill;          /* made when the text exceeds mem_limit */
+    uint64_t spill_len;
+} pileup_out;
+
+
+/* the chunks in which the spilled text is read back */
+#define SPILL_READ_SIZE ( 1024 * 1024 )
+
+
+rc_t make_pileup_out( struct pileup_out ** self, size_t mem_limit )
+{
+    rc_t rc = 0;
+    pileup_out * res = calloc( 1, sizeof *res );
+    *self = NULL;
+    if ( res == NULL )
+        rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    else
+    {
+        res->mem_limit = mem_limit;
+        res->allocated = 64 * 1024;
+        res->data = malloc( res->allocated );
+        if ( res->data == NULL )
+        {
+            rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            free( res );
+        }
+        else
+            *self = res;
+    }
+    return rc;
+}
+
+
+void release_pileup_out( struct pileup_out * self )
+{
+    if ( self != NULL )
+    {
+        if ( self->spill != NULL )
+            KFileRelease( self->spill );
+        if ( self->dir != NULL )
+            KDirectoryRelease( self->dir );
+        free( self->data );
+        free( self );
+    }
+}
+
+
+static rc_t spill_pileup_out( pileup_out * self )
+{
+    size_t num_writ;
+    rc_t rc = 0;
+    if ( self->spill == NULL )
+    {
+        const char * tmpdir = getenv( "TMPDIR" );
+        if ( tmpdir == NULL || tmpdir[ 0 ] == 0 )
+            tmpdir = "/tmp";
+        rc = KDirectoryNativeDir( &self->dir );
+        if ( rc == 0 )
+        {
+            uint64_t const id = ( uint64_t )( size_t )self;
+            rc = KDirectoryCreateFile( self->dir, &self->spill, true, 0600, kcmInit,
+                                       "%s/sra-pileup.%u.%lx", tmpdir, getpid(), id );
+            /* only the open file is needed */
+            KDirectoryRemove( self->dir, false, "%s/sra-pileup.%u.%lx", tmpdir, getpid(), id );
+        }
+        if ( rc != 0 )
+        {
+            PLOGERR( klogErr, ( klogErr, rc, "cannot create temp. file in '$(d)'", "d=%s", tmpdir ) );
+            return rc;
+        }
+    }
+    rc = KFileWriteAll( self->spill, self->spill_len, self->data, self->data_len, &num_writ );
+    if ( rc == 0 && num_writ != self->data_len )
+        rc = RC( rcApp, rcFile, rcWriting, rcTransfer, rcIncomplete );
+    if ( rc != 0 )
+        LOGERR( klogErr, rc, "cannot write into temp. file" );
+    else
+    {
+        self->spill_len += self->data_len;
+        self->data_len = 0;
+    }
+    return rc;
+}
+
+
+static rc_t vprint_pileup_out( pileup_out * self, const char * fmt, va_list args )
+{
+    rc_t rc = 0;
+    bool not_enough;
+
+    do
+    {
+        size_t num_writ;
+        va_list args_copy;
+        va_copy( args_copy, args );
+        rc = string_vprintf( &( self->data[ self->data_len ] ),
+                             self->allocated - self->data_len,
+                             &num_writ,
+                             fmt,
+                             args_copy );
+        va_end( args_copy );
+
+        not_enough = ( GetRCState( rc ) == rcInsufficient );
+        if ( rc == 0 )
+            self->data_len += num_writ;
+        else if ( not_enough )
+        {
+            size_t new_size = self->allocated + ( num_writ * 2 );
+            char * p = realloc( self->data, new_size );
+            if ( p == NULL )
+                rc = RC( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            else
+            {
+                self->data = p;
+                self->allocated = new_size;
+            }
+        }
+    } while ( not_enough && rc == 0 );
+
+    if ( rc == 0 && self->data_len > self->mem_limit )
+        rc = spill_pileup_out( self );
+    return rc;
+}
+
+
+rc_t pileup_out_print( struct pileup_out * self, const char * fmt, ... )
+{
+    rc_t rc;
+    va_list args;
+    va_start( args, fmt );
+    if ( self == NULL )
+        rc = KOutVMsg( fmt, args );
+    else
+        rc = vprint_pileup_out( self, fmt, args );
+    va_end( args );
+    return rc;
+}
+
+
+rc_t pileup_out_write( struct pileup_out * self )
+{
+    rc_t rc = 0;
+    if ( self->spill_len > 0 )
+    {
+        char * buffer = malloc( SPILL_READ_SIZE );
+        if ( buffer == NULL )
+            rc = RC( rcApp, rcNoTarg, rcReading, rcMemory, rcExhausted );
+        else
+        {
+            uint64_t pos = 0;
+            while ( rc == 0 && pos < self->spill_len )
+            {
+                size_t num_read;
+                rc = KFileReadAll( self->spill, pos, buffer, SPILL_READ_SIZE, &num_read );
+                if ( rc != 0 )
+                    LOGERR( klogErr, rc, "cannot read from temp. file" );
+                else if ( num_read == 0 )
+                    rc = RC( rcApp, rcFile, rcReading, rcTransfer, rcIncomplete );
+                else
+                {
+                    if ( num_read > self->spill_len - pos )
+                        num_read = ( size_t )( self->spill_len - pos );
+                    rc = KOutMsg( "%.*s", ( uint32_t )num_read, buffer );
+                    pos += num_read;
+                }
+            }
+            free( buffer );
+        }
+        /* the file is overwritten from the start by the next text */
+        self->spill_len = 0;
+    }
+    if ( rc == 0 && self->data_len > 0 )
+        rc = KOutMsg( "%.*s", ( uint32_t )self->data_len, self->data );
+    self->data_len = 0;
+    return rc;
+}
@@ -0,0 +1,61 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+#ifndef _h_pileup_out_
+#define _h_pileup_out_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <klib/rc.h>
+
+/* --------------------------------------------------------------------------------------
+    collects the text-output of a pileup-walk, to be written later in order
+
+    - the text is kept in memory up to mem_limit bytes, beyond that it goes into
+      a temp. file in TMPDIR, which is removed right after it is created
+    - pileup_out_write() puts everything collected into KOutMsg() and empties it
+
+    the walk-functions print via pileup_out_print(), with a NULL self the text goes
+    directly into KOutMsg()
+-------------------------------------------------------------------------------------- */
+struct pileup_out;
+
+rc_t make_pileup_out( struct pileup_out ** self, size_t mem_limit );
+
+void release_pileup_out( struct pileup_out * self );
+
+rc_t pileup_out_print( struct pileup_out * self, const char * fmt, ... );
+
+rc_t pileup_out_write( struct pileup_out * self );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*  _h_pileup_out_ */
@@ -236,7 +236,7 @@ static uint32_t percentil( tlen_array * a, uint32_t p )
 }
 
 
-static rc_t print_header_line( void )
+rc_t print_stat_header_line( void )
 {
     return KOutMsg( "\nREFNAME----\tREFPOS\tREFBASE\tDEPTH\tSTRAND%%\tTL+#0\tTL+10%%\tTL+MED\tTL+90%%\tTL-#0\tTL-10%%\tTL-MED\tTL-90%%\n\n" );
 }
@@ -272,17 +272,63 @@ static rc_t CC walk_stat_enter_ref_pos( walk_data * data )
 }
 
 
+/* the columns of function stat in the columnar output ( pileup_columns.h ),
+   the same values as the text-line */
+enum
+{
+    sc_depth, sc_strand,
+    sc_pos_zeros, sc_pos_10, sc_pos_med, sc_pos_90,
+    sc_neg_zeros, sc_neg_10, sc_neg_med, sc_neg_90,
+    sc_count
+};
+
+static const char * stat_column_names[ sc_count ] =
+{
+    "DEPTH", "STRAND%",
+    "TL+#0", "TL+10%", "TL+MED", "TL+90%",
+    "TL-#0", "TL-10%", "TL-MED", "TL-90%"
+};
+
+
+static void tlen_columns( tlen_array * a, uint32_t * values )
+{
+    if ( a->members > 1 )
+        ksort_uint32_t ( a->values, a->members );
+    values[ 0 ] = a->zeros;
+    values[ 1 ] = percentil( a, 10 );
+    values[ 2 ] = medium( a );
+    values[ 3 ] = percentil( a, 90 );
+}
+
+
+static rc_t put_stat_columns( walk_data * data )
+{
+    stat_counters * counters = data->data;
+    uint32_t values[ sc_count ];
+
+    values[ sc_depth ] = data->depth;
+    values[ sc_strand ] = percent( counters->pos.alignment_count, counters->neg.alignment_count );
+    tlen_columns( &counters->pos.tlen_w, &values[ sc_pos_zeros ] );
+    tlen_columns( &counters->neg.tlen_w, &values[ sc_neg_zeros ] );
+    return pileup_columns_put( data->options->columns, data->ref_name, data->ref_len, data->ref_pos, values );
+}
+
+
 static rc_t CC walk_stat_exit_ref_pos( walk_data * data )
 {
     char c = _4na_to_ascii( data->ref_base, false );
     stat_counters * counters = data->data;
+    rc_t rc;
+
+    if ( data->options->columns != NULL )
+        return put_stat_columns( data );
 
     /* REF-NAME, REF-POS, REF-BASE, DEPTH */
-    rc_t rc = KOutMsg( "%s\t%u\t%c\t%u\t", data->ref_name, data->ref_pos + 1, c, data->depth );
+    rc = pileup_out_print( data->options->out, "%s\t%u\t%c\t%u\t", data->ref_name, data->ref_pos + 1, c, data->depth );
 
     /* STRAND-ness */
     if ( rc == 0 )
-        rc = KOutMsg( "%u%%\t", percent( counters->pos.alignment_count, counters->neg.alignment_count ) );
+        rc = pileup_out_print( data->options->out, "%u%%\t", percent( counters->pos.alignment_count, counters->neg.alignment_count ) );
 
     /* TLEN-Statistic for sliding window, only starting/ending placements */
     if ( rc == 0 )
@@ -291,13 +337,13 @@ static rc_t CC walk_stat_exit_ref_pos( walk_data * data )
         if ( a->members > 1 )
             ksort_uint32_t ( a->values, a->members );
 
-        rc = KOutMsg( "%u\t%u\t%u\t%u\t", a->zeros, percentil( a, 10 ), medium( a ), percentil( a, 90 ) );
+        rc = pileup_out_print( data->options->out, "%u\t%u\t%u\t%u\t", a->zeros, percentil( a, 10 ), medium( a ), percentil( a, 90 ) );
         if ( rc == 0 )
         {
             a = &counters->neg.tlen_w;
             if ( a->members > 1 )
                 ksort_uint32_t ( a->values, a->members );
-            rc = KOutMsg( "%u\t%u\t%u\t%u\t", a->zeros, percentil( a, 10 ), medium( a ), percentil( a, 90 ) );
+            rc = pileup_out_print( data->options->out, "%u\t%u\t%u\t%u\t", a->zeros, percentil( a, 10 ), medium( a ), percentil( a, 90 ) );
         }
     }
 
@@ -309,7 +355,7 @@ static rc_t CC walk_stat_exit_ref_pos( walk_data * data )
 */
 
     if ( rc == 0 )
-        rc = KOutMsg( "\n" );
+        rc = pileup_out_print( data->options->out, "\n" );
 
     return rc;
 }
@@ -360,7 +406,12 @@ rc_t walk_stat( ReferenceIterator *ref_iter, pileup_options *options )
     walk_funcs funcs;
     stat_counters counters;
 
-    rc_t rc = print_header_line();
+    /* the slices of a parallel pileup leave the header to the caller */
+    rc_t rc = 0;
+    if ( options->columns != NULL )
+        rc = pileup_columns_set_names( options->columns, sc_count, stat_column_names );
+    else if ( options->out == NULL )
+        rc = print_stat_header_line();
     if ( rc == 0 )
         rc = prepare_stat_counters( &counters, 1024 );
     if ( rc == 0 )
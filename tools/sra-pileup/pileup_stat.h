@@ -33,6 +33,9 @@ extern "C" {
 
 rc_t walk_stat( ReferenceIterator *ref_iter, pileup_options *options );
 
+/* the header walk_stat() prints before the first line */
+rc_t print_stat_header_line( void );
+
 #ifdef __cplusplus
 }
 #endif
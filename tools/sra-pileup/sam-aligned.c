@@ -1495,15 +1495,15 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
         {
             if ( opts->use_mate_cache && mc != NULL )
             {
-                rc = matecache_lookup_same_ref( mc, atx->db_idx, mate_align_id, &mate_ref_pos, &sam_flags, &tlen );
+                rc = matecache_lookup_same_ref( mc, atx->db_idx, mate_align_id, pos, &mate_ref_pos, &sam_flags, &tlen );
                 if ( rc == 0 )
                 {
                     /* we found it in the the sam-ref-matecache */
                     const INSDC_read_filter * read_filter;
                     uint32_t read_filter_len;
 
-                    /* cache entry-found! (on the same reference) -> that means we have now mate_ref_pos, flags and tlen */
-                    matecache_remove_same_ref( mc, atx->db_idx, mate_align_id );
+                    /* cache entry-found! (on the same reference) -> that means we have now mate_ref_pos, flags and tlen
+                       the lookup has removed it from the cache */
                     mate_ref_name = equal_sign;
                     mate_ref_name_len = 1;
                     mate_ref_pos_len = 1;
@@ -1568,9 +1568,10 @@ static rc_t print_alignment_sam_ps( const samdump_opts * const opts,
                 {
                     if ( mate_align_id != 0 && mate_ref_name_len > 0 && cmp == 0 )
                     {
-                        /* now that we have the data, store it in sam-ref-cache it the mate is on the same ref. */
+                        /* now that we have the data, store it in sam-ref-cache it the mate is on the same ref.
+                           it is placed at the position of the mate, where the walk will look for it */
                         uint32_t mate_flags = calc_mate_flags( sam_flags );
-                        rc = matecache_insert_same_ref( mc, atx->db_idx, id, pos, mate_flags, -tlen );
+                        rc = matecache_insert_same_ref( mc, atx->db_idx, id, mate_ref_pos, pos, mate_flags, -tlen );
                     }
 
                     if ( mate_align_id == 0 && mate_ref_name_len == 0 && opts->print_half_unaligned_reads &&
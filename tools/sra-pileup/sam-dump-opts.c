@@ -802,6 +802,15 @@ static rc_t gather_flag_options( Args * args, samdump_opts * opts )
     if ( opts->force_new && opts->force_legacy )
         opts->force_new = false;
 
+    /* do we have to produce BAM, only the legacy code-path can */
+    rc = get_bool_option( args, OPT_BAM, &opts->output_bam );
+    if ( rc != 0 ) return rc;
+    if ( opts->output_bam )
+    {
+        opts->force_legacy = true;
+        opts->force_new = false;
+    }
+
     /* do we have to merge cigar ( and read/qual ) for cg-operations in cigar */
     rc = get_bool_option( args, OPT_CIGAR_CG_M, &opts->merge_cg_cigar );
     if ( rc != 0 ) return rc;
@@ -951,6 +960,17 @@ static rc_t gather_int_options( Args * args, samdump_opts * opts )
     if ( rc == 0 )
         rc = get_uint32_option( args, OPT_RNA_SPLICEL, 0, &opts->rna_splice_level, true );
 
+    /* do we dump the alignments on threads, only the legacy code-path can */
+    if ( rc == 0 )
+    {
+        rc = get_uint32_option( args, OPT_DUMP_THREADS, 1, &opts->dump_threads, true );
+        if ( rc == 0 && opts->dump_threads > 1 )
+        {
+            opts->force_legacy = true;
+            opts->force_new = false;
+        }
+    }
+
     return rc;
 }
 
@@ -1342,6 +1362,8 @@ void report_options( const samdump_opts * opts )
 
     KOutMsg( "use mate-cache        : %s\n",  opts->use_mate_cache ? "YES" : "NO" );
     KOutMsg( "force legacy code     : %s\n",  opts->force_legacy ? "YES" : "NO" );
+    KOutMsg( "output BAM            : %s\n",  opts->output_bam ? "YES" : "NO" );
+    KOutMsg( "dump-threads          : %u\n",  opts->dump_threads );
     KOutMsg( "use min-mapq          : %s\n",  opts->use_min_mapq ? "YES" : "NO" );
     KOutMsg( "min-mapq              : %i\n",  opts->min_mapq );
     KOutMsg( "rna-splicing          : %s\n",  opts->rna_splicing ? "YES" : "NO" );
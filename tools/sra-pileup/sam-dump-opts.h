@@ -76,6 +76,10 @@ extern "C" {
 #define OPT_Q_QUANT     "qual-quant"
 #define OPT_GZIP        "gzip"
 #define OPT_BZIP2       "bzip2"
+#define OPT_BAM         "bam"
+#define OPT_BAM_INDEX   "bam-index"
+#define OPT_BAM_THREADS "bam-threads"
+#define OPT_DUMP_THREADS "threads"
 #define OPT_FASTQ       "fastq"
 #define OPT_FASTA       "fasta"
 #define OPT_HDR_COMMENT "header-comment"
@@ -229,6 +233,12 @@ typedef struct samdump_opts
     bool force_legacy;
     bool force_new;
 
+    /* output BAM instead of SAM ( implemented by the legacy code-path ) */
+    bool output_bam;
+
+    /* threads dumping the alignments ( implemented by the legacy code-path ) */
+    uint32_t dump_threads;
+
     /* which tables have to be processed/dumped */
     bool dump_primary_alignments;
     bool dump_secondary_alignments;
@@ -62,12 +62,15 @@
 #include <align/quality-quantizer.h>
 
 #include <kfs/directory.h>
+#include <kproc/thread.h>
+#include <kproc/queue.h>
 #include <os-native.h>
 #include <sysalloc.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <limits.h>
 #include <string.h>
 #include <strtol.h>
@@ -75,6 +78,8 @@
 #include <assert.h>
 
 #include "debug.h"
+#include "bam_writer.h"
+#include "matecache.h"
 
 #if _ARCH_BITS == 64
 #define USE_MATE_CACHE 1
@@ -133,6 +138,10 @@ struct params_s
     
     bool output_gzip;
     bool output_bz2;
+    bool output_bam;
+    char const *bam_index;
+    uint32_t bam_threads;
+    uint32_t dump_threads;
     
     bool xi;
     int cg_style; /* 0: raw; 1: with B's; 2: without B's, fixed up SEQ/QUAL; */
@@ -199,7 +208,8 @@ typedef struct STable_struct
 
 typedef struct SCursCache_struct
 {
-    KVector* cache;
+    KVector* cache; /* the aligned halves of half-aligned spots, needed after the walk */
+    mate_window* window; /* mates far ahead of the walk, placed at the row-id of the mate */
     KVector* cache_unaligned_mate; /* keeps unaligned-mate for a half-aligned spots */
     uint32_t sam_flags;
     INSDC_coord_zero pnext;
@@ -220,6 +230,10 @@ typedef struct SCurs_struct
     SCursCache* cache;
     SCursCache cache_local;
     uint64_t col_reads_qty;
+    /* the cells of the columns missing in single-read tables, see Cursor_ReadAlign() */
+    INSDC_coord_zero read_start;
+    INSDC_coord_len read_len;
+    INSDC_coord_len cigar_len;
 } SCurs;
 
 enum eDSTableType
@@ -258,6 +272,11 @@ typedef struct SAM_dump_ctx_s
     DataSource evi;
     DataSource eva;
     DataSource seq;
+
+    /* where the records are dumped into */
+    struct SamOut *out;
+    /* the threads dumping primary/secondary alignments, NULL: dumped right away */
+    struct DumpPool *pool;
 } SAM_dump_ctx_t;
 
 
@@ -424,6 +443,11 @@ static rc_t RefSeqPrint( void )
 
 
 #if USE_MATE_CACHE
+/* windows of 64k rows, 256 of them in memory: the rows of a position-sorted alignment-table
+   are walked in order, a mate further than 16M rows ahead goes into the spill-file */
+#define CACHE_WINDOW_BITS 16
+#define CACHE_NUM_WINDOWS 256
+
 static rc_t Cache_Init( SCursCache* c )
 {
     if ( c != NULL )
@@ -434,6 +458,10 @@ static rc_t Cache_Init( SCursCache* c )
 	if(rc == 0){
 		rc=KVectorMake( &c->cache_unaligned_mate );
 	}
+        if ( rc == 0 )
+        {
+            rc = make_mate_window( &c->window, CACHE_WINDOW_BITS, CACHE_NUM_WINDOWS );
+        }
     }
     return 0;
 }
@@ -451,6 +479,15 @@ static void Cache_Close( char const *name, SCursCache* c )
                                "hits %lu of those broken %lu;\n",
                                name, c->projected, c->added, c->hit, c->bad ) );
         }
+        if ( c->window != NULL )
+        {
+#if _DEBUGGING
+            mate_window_stat const *st = mate_window_get_stat( c->window );
+            SAM_DUMP_DBG( 2, ( "%s mate-window stats: max %lu, spilled %lu, dropped %lu\n",
+                               name, st->max_count, st->spilled, st->dropped ) );
+#endif
+            release_mate_window( c->window );
+        }
     }
     memset( c, 0, sizeof( *c ) );
 }
@@ -466,6 +503,8 @@ static rc_t Cache_Add( uint64_t key, SCurs const *curs, SCol const *cols )
     uint32_t rid = 0;
     uint64_t val = 0;
     int64_t mate_id = cols[ alg_MATE_ALIGN_ID ].len > 0 ? cols[ alg_MATE_ALIGN_ID ].base.i64[ 0 ] : 0;
+    /* the row where the mate will look it up, the mate-id may be cleared below */
+    int64_t const mate_row = mate_id;
 
     rc = ReferenceList_Find( gRefList, &r, cols[ alg_REF_NAME ].base.str, cols[ alg_REF_NAME ].len );
     if ( rc == 0 )
@@ -541,7 +580,14 @@ static rc_t Cache_Add( uint64_t key, SCurs const *curs, SCol const *cols )
             if ( !( ref_proj & 0xFFFFF800 ) )
             {
                 val = ( pos_delta64 << 32 ) | ( ref_proj << 21 ) | ( cols[ alg_SAM_FLAGS ].base.u32[ 0 ] << 10 ) | rid;
-                rc = KVectorSetU64( curs->cache->cache, key, val );
+                if ( mate_row > 0 && curs->cache->window != NULL )
+                {
+                    rc = mate_window_insert( curs->cache->window, key, mate_row, val, 0 );
+                }
+                else
+                {
+                    rc = KVectorSetU64( curs->cache->cache, key, val );
+                }
             }
         }
     }
@@ -562,16 +608,33 @@ static rc_t Cache_Add( uint64_t key, SCurs const *curs, SCol const *cols )
 }
 
 
-static rc_t Cache_Get( SCurs const *curs, uint64_t key, uint64_t* val )
+/* at: the row being dumped, the walk has reached it; 0 for the half-aligned spots after the walk */
+static rc_t Cache_Get( SCurs const *curs, uint64_t key, uint64_t at, uint64_t* val )
 {
-    rc_t rc = KVectorGetU64( curs->cache->cache, key, val );
+    rc_t rc;
+    if ( at != 0 && curs->cache->window != NULL )
+    {
+        uint16_t flags;
+        rc = mate_window_advance( curs->cache->window, at );
+        if ( rc == 0 )
+        {
+            rc = mate_window_take( curs->cache->window, key, at, val, &flags );
+        }
+    }
+    else
+    {
+        rc = KVectorGetU64( curs->cache->cache, key, val );
+        if ( rc == 0 )
+        {
+            KVectorUnset( curs->cache->cache, key );
+        }
+    }
     if ( rc == 0 )
     {
         uint32_t id = ( *val & 0x3FF );
 #if _DEBUGGING
         curs->cache->hit++;
 #endif
-        KVectorUnset( curs->cache->cache, key );
         rc = ReferenceList_Get( gRefList, &curs->cache->ref, id );
         if ( rc != 0 )
         {
@@ -813,12 +876,28 @@ static rc_t Cursor_Read( DataSource *ds, int64_t row_id, int firstCol, unsigned
     return rc;
 }
 
+/* --------------------------------------------------------------------------------------
+    where the records are dumped into:
+    - the main output: the text goes directly into g_out_writer ( out.buffered == false )
+    - a slice dumped by a worker-thread: the text is collected and written later in order
+    BAM-output: the fields are collected in 'text' and encoded into 'bam'
+-------------------------------------------------------------------------------------- */
+typedef struct SamOut
+{
+    KDataBuffer text;
+    bam_slice* bam;
+    bool buffered;
+} SamOut;
+
 struct
 {
     KWrtWriter writer;
     void* data;
     KFile* kfile;
     uint64_t pos;
+    bam_writer* bam;
+    /* the main output, in BAM-mode its 'text' collects the header too */
+    SamOut out;
 } g_out_writer = {NULL};
 
 
@@ -829,6 +908,21 @@ static rc_t CC BufferedWriter( void *const self, char const buffer[], size_t con
 
     assert( buffer != NULL );
 
+    if ( g_out_writer.bam != NULL )
+    {
+        uint64_t const used = g_out_writer.out.text.elem_count;
+
+        rc = KDataBufferResize( &g_out_writer.out.text, used + bufsize );
+        if ( rc == 0 )
+        {
+            memmove( ( char * )g_out_writer.out.text.base + used, buffer, bufsize );
+            written = bufsize;
+        }
+        if ( pnum_writ != NULL )
+            *pnum_writ = written;
+        return rc;
+    }
+
     while ( written < bufsize )
     {
         size_t n;
@@ -845,7 +939,7 @@ static rc_t CC BufferedWriter( void *const self, char const buffer[], size_t con
 }
 
 
-static rc_t BufferedWriterMake( bool gzip, bool bzip2 )
+static rc_t BufferedWriterMake( bool gzip, bool bzip2, bool bam )
 {
     rc_t rc = 0;
 
@@ -896,14 +990,39 @@ static rc_t BufferedWriterMake( bool gzip, bool bzip2 )
                     rc = KOutHandlerSet( BufferedWriter, &g_out_writer );
                 }
             }
+            if ( rc == 0 && bam )
+            {
+                rc = KDataBufferMakeBytes( &g_out_writer.out.text, 0 );
+                if ( rc == 0 )
+                    rc = make_bam_writer( &g_out_writer.bam, g_out_writer.kfile,
+                                          param->bam_threads, param->bam_index );
+            }
         }
     }
     return rc;
 }
 
 
-static void BufferedWriterRelease( bool flush )
+static rc_t BufferedWriterRelease( bool flush )
 {
+    rc_t rc = 0;
+
+    if ( g_out_writer.bam != NULL )
+    {
+        rc_t rc2;
+
+        /* the records still waiting in the slice of the main output */
+        if ( flush && g_out_writer.out.bam != NULL )
+            rc = bam_writer_write_slice( g_out_writer.bam, g_out_writer.out.bam );
+        release_bam_slice( g_out_writer.out.bam );
+        /* waits for the compressor-threads, writes the index */
+        rc2 = release_bam_writer( g_out_writer.bam );
+        if ( rc == 0 )
+            rc = rc2;
+        g_out_writer.bam = NULL;
+        KDataBufferWhack( &g_out_writer.out.text );
+        memset( &g_out_writer.out, 0, sizeof( g_out_writer.out ) );
+    }
     if ( flush )
     {
         /* avoid flushing buffered data after failure */
@@ -914,6 +1033,50 @@ static void BufferedWriterRelease( bool flush )
         KOutHandlerSet( g_out_writer.writer, g_out_writer.data );
     }
     g_out_writer.writer = NULL;
+    return rc;
+}
+
+
+static rc_t SamWrite( SamOut *const out, char const buffer[], size_t const bufsize )
+{
+    if ( out->buffered || out->bam != NULL )
+    {
+        uint64_t const used = out->text.elem_count;
+        rc_t rc = KDataBufferResize( &out->text, used + bufsize );
+
+        if ( rc == 0 )
+            memmove( ( char * )out->text.base + used, buffer, bufsize );
+        return rc;
+    }
+    return BufferedWriter( NULL, buffer, bufsize, NULL );
+}
+
+
+static rc_t SamPrintf( SamOut *const out, char const fmt[], ... )
+{
+    char buffer[ 4096 ];
+    size_t num_writ;
+    va_list args;
+    rc_t rc;
+
+    va_start( args, fmt );
+    rc = string_vprintf( buffer, sizeof( buffer ), &num_writ, fmt, args );
+    va_end( args );
+    if ( rc == 0 )
+        rc = SamWrite( out, buffer, num_writ );
+    return rc;
+}
+
+
+/* the main output writes its BAM-records in batches */
+#define BAM_MAIN_SLICE_SIZE ( 4 * 1024 * 1024 )
+
+static rc_t SamOutBAMEnd( SamOut *const out )
+{
+    rc_t rc = bam_slice_end( out->bam );
+    if ( rc == 0 && !out->buffered && bam_slice_size( out->bam ) >= BAM_MAIN_SLICE_SIZE )
+        rc = bam_writer_write_slice( g_out_writer.bam, out->bam );
+    return rc;
 }
 
 
@@ -1105,7 +1268,7 @@ static rc_t Cursor_ReadAlign( SCurs const *curs, int64_t row_id, SCol* cols, uin
                 {
                     continue;
                 }
-                rc = Cache_Get( curs, mate_id->base.u64[ 0 ], &cache_val );
+                rc = Cache_Get( curs, mate_id->base.u64[ 0 ], row_id, &cache_val );
                 if ( rc == 0 )
                 {
                     continue;
@@ -1139,25 +1302,24 @@ static rc_t Cursor_ReadAlign( SCurs const *curs, int64_t row_id, SCol* cols, uin
         }
         else
         {
-            static INSDC_coord_zero readStart;
-            static INSDC_coord_len  readLen;
-            static INSDC_coord_len  cigarLen;
-            
+            /* kept in the cursor, the cursors of the worker-threads must not share them */
+            SCurs *const wcurs = ( SCurs* )curs;
+
             switch ( (int)idx )
             {
             case alg_READ_START:
-                readStart = 0;
-                c->base.coord0 = &readStart;
+                wcurs->read_start = 0;
+                c->base.coord0 = &wcurs->read_start;
                 c->len = 1;
                 break;
             case alg_READ_LEN:
-                readLen = cols[ alg_READ ].len;
-                c->base.coord_len = &readLen;
+                wcurs->read_len = cols[ alg_READ ].len;
+                c->base.coord_len = &wcurs->read_len;
                 c->len = 1;
                 break;
             case alg_CIGAR_LEN:
-                cigarLen = cols[ alg_CIGAR ].len;
-                c->base.coord_len = &cigarLen;
+                wcurs->cigar_len = cols[ alg_CIGAR ].len;
+                c->base.coord_len = &wcurs->cigar_len;
                 c->len = 1;
                 break;
             }
@@ -1198,34 +1360,34 @@ static rc_t Cursor_ReadAlign( SCurs const *curs, int64_t row_id, SCol* cols, uin
 }
 
 
-static rc_t DumpName( char const *name, size_t name_len,
+static rc_t DumpName( SamOut *const out, char const *name, size_t name_len,
                       const char spot_group_sep, char const *spot_group,
                       size_t spot_group_len, int64_t spot_id )
 {
     rc_t rc = 0;
     if ( param->cg_friendly_names )
     {
-        rc = KOutMsg( "%.*s-1:%lu", spot_group_len, spot_group, spot_id );
+        rc = SamPrintf( out, "%.*s-1:%lu", spot_group_len, spot_group, spot_id );
     }
     else
     {
         if ( param->name_prefix != NULL )
         {
-            rc = KOutMsg( "%s.", param->name_prefix );
+            rc = SamPrintf( out, "%s.", param->name_prefix );
         }
-        rc = BufferedWriter( NULL, name, name_len, NULL );
+        rc = SamWrite( out, name, name_len );
         if ( rc == 0 && param->spot_group_in_name && spot_group_len > 0 )
         {
-            rc = BufferedWriter( NULL, &spot_group_sep, 1, NULL );
+            rc = SamWrite( out, &spot_group_sep, 1 );
             if ( rc == 0 )
-                rc = BufferedWriter( NULL, spot_group, spot_group_len, NULL );
+                rc = SamWrite( out, spot_group, spot_group_len );
         }
     }
     return rc;
 }
 
 
-static rc_t DumpQuality( char const quality[], unsigned const count, bool const reverse, bool const quantize )
+static rc_t DumpQuality( SamOut *const out, char const quality[], unsigned const count, bool const reverse, bool const quantize )
 {
     rc_t rc = 0;
     if ( quality == NULL )
@@ -1235,7 +1397,7 @@ static rc_t DumpQuality( char const quality[], unsigned const count, bool const
         for ( i = 0; rc == 0 && i < count; ++i )
         {
             char const newValue = ((param->qualQuant && param->qualQuantSingle)?param->qualQuantSingle:30) + 33;
-            rc = BufferedWriter( NULL, &newValue, 1, NULL );
+            rc = SamWrite( out, &newValue, 1 );
         }
     }
     else if ( reverse || quantize )
@@ -1247,18 +1409,18 @@ static rc_t DumpQuality( char const quality[], unsigned const count, bool const
             char const qual = quality[ reverse ? ( count - i - 1 ) : i ];
             char const newValue = quantize ? param->qualQuant[ qual - 33 ] + 33 : qual;
 
-            rc = BufferedWriter( NULL, &newValue, 1, NULL );
+            rc = SamWrite( out, &newValue, 1 );
         }
     }
     else
     {
-        rc = BufferedWriter( NULL, quality, count, NULL );
+        rc = SamWrite( out, quality, count );
     }
     return rc;
 }
 
 
-static rc_t DumpUnalignedFastX( const SCol cols[], uint32_t read_id, INSDC_coord_zero readStart, INSDC_coord_len readLen, int64_t row_id )
+static rc_t DumpUnalignedFastX( SamOut *const out, const SCol cols[], uint32_t read_id, INSDC_coord_zero readStart, INSDC_coord_len readLen, int64_t row_id )
 {
     /* fast[AQ] represnted in SAM fields:
        [@|>]QNAME unaligned
@@ -1266,36 +1428,36 @@ static rc_t DumpUnalignedFastX( const SCol cols[], uint32_t read_id, INSDC_coord
        +
        QUAL
     */
-    rc_t rc = BufferedWriter( NULL, param->fastq ? "@" : ">", 1, NULL );
+    rc_t rc = SamWrite( out, param->fastq ? "@" : ">", 1 );
 
     /* QNAME: [PFX.]SEQUENCE:NAME[#SPOT_GROUP] */
     if ( rc == 0 )
-        rc = DumpName( cols[ seq_NAME ].base.str, cols[ seq_NAME ].len, '#',
+        rc = DumpName( out, cols[ seq_NAME ].base.str, cols[ seq_NAME ].len, '#',
                        cols[ seq_SPOT_GROUP ].base.str, cols[ seq_SPOT_GROUP ].len, row_id );
     if ( rc == 0 && read_id > 0 )
     {
-        rc = KOutMsg( "/%u", read_id );
+        rc = SamPrintf( out, "/%u", read_id );
     }
     if ( rc == 0 )
-        rc = BufferedWriter( NULL, " unaligned\n", 11, NULL );
+        rc = SamWrite( out, " unaligned\n", 11 );
 
     /* SEQ: SEQUENCE.READ */
     if ( rc == 0 )
-        rc = BufferedWriter( NULL, &cols[ seq_READ ].base.str[readStart], readLen, NULL );
+        rc = SamWrite( out, &cols[ seq_READ ].base.str[readStart], readLen );
     if ( rc == 0 && param->fastq )
     {
         /* QUAL: SEQUENCE.QUALITY */
-        rc = BufferedWriter( NULL, "\n+\n", 3, NULL );
+        rc = SamWrite( out, "\n+\n", 3 );
         if ( rc == 0 )
-            rc = DumpQuality( &cols[ seq_QUALITY ].base.str[ readStart ], readLen, false, param->quantizeQual );
+            rc = DumpQuality( out, &cols[ seq_QUALITY ].base.str[ readStart ], readLen, false, param->quantizeQual );
     }
     if ( rc == 0 )
-        rc = BufferedWriter( NULL, "\n", 1, NULL );
+        rc = SamWrite( out, "\n", 1 );
     return rc;
 }
 
 
-static rc_t DumpAlignedFastX( const SCol cols[], int64_t const alignId, uint32_t read_id, bool primary, bool secondary )
+static rc_t DumpAlignedFastX( SamOut *const out, const SCol cols[], int64_t const alignId, uint32_t read_id, bool primary, bool secondary )
 {
     rc_t rc = 0;
     size_t nm;
@@ -1320,7 +1482,7 @@ static rc_t DumpAlignedFastX( const SCol cols[], int64_t const alignId, uint32_t
            +
            QUAL
         */
-        rc = BufferedWriter( NULL, param->fastq ? "@" : ">", 1, NULL );
+        rc = SamWrite( out, param->fastq ? "@" : ">", 1 );
         /* QNAME: [PFX.]SEQ_NAME[#SPOT_GROUP] */
         if ( qname_len == 0 || qname == NULL )
         {
@@ -1329,72 +1491,156 @@ static rc_t DumpAlignedFastX( const SCol cols[], int64_t const alignId, uint32_t
         }
         nm = cols[ alg_SPOT_GROUP ].len ? alg_SPOT_GROUP : alg_SEQ_SPOT_GROUP;
         if ( rc == 0 )
-            rc = DumpName( qname, qname_len, '.', cols[ nm ].base.str, cols[ nm ].len, spot_id);
+            rc = DumpName( out, qname, qname_len, '.', cols[ nm ].base.str, cols[ nm ].len, spot_id);
 
         if ( rc == 0 && read_id > 0 )
-            rc = KOutMsg( "/%u", read_id );
+            rc = SamPrintf( out, "/%u", read_id );
 
         if ( rc == 0 )
         {
             if ( primary )
             {
-                rc = BufferedWriter( NULL, " primary", 8, NULL );
+                rc = SamWrite( out, " primary", 8 );
             }
             else if ( secondary )
             {
-                rc = BufferedWriter( NULL, " secondary", 10, NULL );
+                rc = SamWrite( out, " secondary", 10 );
             }
         }
 
         /* RNAME: REF_NAME or REF_SEQ_ID */
         if ( rc == 0 )
-            rc = BufferedWriter( NULL, " ref=", 5, NULL );
+            rc = SamWrite( out, " ref=", 5 );
         if ( rc == 0 )
         {
             if ( param->use_seqid )
             {
-                rc = BufferedWriter( NULL, cols[ alg_REF_SEQ_ID ].base.str, cols[ alg_REF_SEQ_ID ].len, NULL );
+                rc = SamWrite( out, cols[ alg_REF_SEQ_ID ].base.str, cols[ alg_REF_SEQ_ID ].len );
             }
             else
             {
-                rc = BufferedWriter( NULL, cols[ alg_REF_NAME ].base.str, cols[ alg_REF_NAME ].len, NULL );
+                rc = SamWrite( out, cols[ alg_REF_NAME ].base.str, cols[ alg_REF_NAME ].len );
             }
         }
 
         /* POS: REF_POS, MAPQ: MAPQ */
         if ( rc == 0 )
-            rc = KOutMsg( " pos=%u mapq=%i\n", cols[ alg_REF_POS ].base.coord0[ 0 ] + 1, cols[ alg_MAPQ ].base.i32[ 0 ] );
+            rc = SamPrintf( out, " pos=%u mapq=%i\n", cols[ alg_REF_POS ].base.coord0[ 0 ] + 1, cols[ alg_MAPQ ].base.i32[ 0 ] );
         
         /* SEQ: READ */
         if ( rc == 0 )
-            rc = BufferedWriter( NULL, read, readlen, NULL );
+            rc = SamWrite( out, read, readlen );
         if ( rc == 0 && param->fastq )
         {
             /* QUAL: SAM_QUALITY */
-            rc = BufferedWriter( NULL, "\n+\n", 3, NULL );
+            rc = SamWrite( out, "\n+\n", 3 );
             if ( rc == 0 )
-                rc = DumpQuality( qual, readlen, false, param->quantizeQual );
+                rc = DumpQuality( out, qual, readlen, false, param->quantizeQual );
         }
         if ( rc == 0 )
-            rc = BufferedWriter( NULL, "\n", 1, NULL );
+            rc = SamWrite( out, "\n", 1 );
+    }
+    return rc;
+}
+
+
+/* --------------------------------------------------------------------------------------
+    BAM-output: the fields are dumped into out->text by the same functions as for
+    SAM, and picked up from there by their offset ( the buffer may move while it grows )
+-------------------------------------------------------------------------------------- */
+static size_t BAMMark( SamOut const *const out )
+{
+    return ( size_t )out->text.elem_count;
+}
+
+
+static char const *BAMText( SamOut const *const out, size_t const mark )
+{
+    return ( char const * )out->text.base + mark;
+}
+
+
+static rc_t BAMReverseRead( SamOut *const out, char const read[], INSDC_coord_len const readLen )
+{
+    size_t const mark = BAMMark( out );
+    rc_t rc = KDataBufferResize( &out->text, mark + readLen );
+    if ( rc == 0 )
+        rc = DNAReverseCompliment( read, ( char * )out->text.base + mark, readLen );
+    return rc;
+}
+
+
+static rc_t DumpUnalignedBAM( SamOut *const out, const SCol cols[], uint32_t flags, INSDC_coord_zero readStart, INSDC_coord_len readLen,
+                              char const *rnext, uint32_t rnext_len, INSDC_coord_zero pnext, char const readGroup[], int64_t row_id )
+{
+    size_t qname_len, qual_at, seq_at = 0;
+    rc_t rc = KDataBufferResize( &out->text, 0 );
+
+    /* QNAME: [PFX.]NAME[.SPOT_GROUP] */
+    if ( rc == 0 )
+        rc = DumpName( out, cols[ seq_NAME ].base.str, cols[ seq_NAME ].len, '.',
+                       cols[ seq_SPOT_GROUP ].base.str, cols[ seq_SPOT_GROUP ].len, row_id );
+    qname_len = BAMMark( out );
+    /* SEQ: SEQUENCE.READ, only the reverse complement has to be made */
+    if ( rc == 0 && ( flags & 0x10 ) )
+    {
+        seq_at = BAMMark( out );
+        rc = BAMReverseRead( out, &cols[ seq_READ ].base.str[ readStart ], readLen );
+    }
+    /* QUAL: SEQUENCE.QUALITY */
+    qual_at = BAMMark( out );
+    if ( rc == 0 )
+        rc = DumpQuality( out, &cols[ seq_QUALITY ].base.str[ readStart ], readLen, flags & 0x10, param->quantizeQual );
+
+    if ( rc == 0 )
+    {
+        bam_record rec;
+
+        memset( &rec, 0, sizeof( rec ) );
+        rec.qname = BAMText( out, 0 );
+        rec.qname_len = qname_len;
+        rec.flags = flags;
+        rec.pos = -1;
+        rec.rnext = rnext_len ? rnext : NULL;
+        rec.rnext_len = rnext_len;
+        rec.pnext = ( int64_t )pnext - 1; /* pnext is 1-based here, 0 for none */
+        rec.seq = ( flags & 0x10 ) ? BAMText( out, seq_at ) : &cols[ seq_READ ].base.str[ readStart ];
+        rec.qual = BAMText( out, qual_at );
+        rec.seq_len = readLen;
+        rc = bam_slice_begin( out->bam, &rec );
     }
+
+    /* optional fields: */
+    if ( rc == 0 )
+    {
+        if ( readGroup )
+            rc = bam_slice_tag_Z( out->bam, "RG", readGroup, string_size( readGroup ) );
+        else if ( cols[ seq_SPOT_GROUP ].len > 0 )
+            rc = bam_slice_tag_Z( out->bam, "RG", cols[ seq_SPOT_GROUP ].base.str, cols[ seq_SPOT_GROUP ].len );
+    }
+    if ( rc == 0 )
+        rc = SamOutBAMEnd( out );
     return rc;
 }
 
 
 static
-rc_t DumpUnalignedSAM( const SCol cols[], uint32_t flags, INSDC_coord_zero readStart, INSDC_coord_len readLen,
+rc_t DumpUnalignedSAM( SamOut *const out, const SCol cols[], uint32_t flags, INSDC_coord_zero readStart, INSDC_coord_len readLen,
                        char const *rnext, uint32_t rnext_len, INSDC_coord_zero pnext, char const readGroup[], int64_t row_id )
 {
     unsigned i;
+    rc_t rc;
+
+    if ( out->bam != NULL )
+        return DumpUnalignedBAM( out, cols, flags, readStart, readLen, rnext, rnext_len, pnext, readGroup, row_id );
 
     /* QNAME: [PFX.]NAME[.SPOT_GROUP] */
-    rc_t rc = DumpName( cols[ seq_NAME ].base.str, cols[ seq_NAME ].len, '.',
+    rc = DumpName( out, cols[ seq_NAME ].base.str, cols[ seq_NAME ].len, '.',
               cols[ seq_SPOT_GROUP ].base.str, cols[ seq_SPOT_GROUP ].len, row_id );
 
     /* all these fields are const text for now */
     if ( rc == 0 )
-        rc = KOutMsg( "\t%u\t*\t0\t0\t*\t%.*s\t%u\t0\t",
+        rc = SamPrintf( out, "\t%u\t*\t0\t0\t*\t%.*s\t%u\t0\t",
              flags, rnext_len ? rnext_len : 1, rnext_len ? rnext : "*", pnext );
     /* SEQ: SEQUENCE.READ */
     if ( flags & 0x10 )
@@ -1404,68 +1650,74 @@ rc_t DumpUnalignedSAM( const SCol cols[], uint32_t flags, INSDC_coord_zero readS
             char base;
 
             DNAReverseCompliment( &cols[ seq_READ ].base.str[ readStart + readLen - 1 - i ], &base, 1 );
-            rc = BufferedWriter( NULL, &base, 1, NULL );
+            rc = SamWrite( out, &base, 1 );
         }
     }
     else
     {
-        rc = BufferedWriter( NULL, &cols[ seq_READ ].base.str[ readStart ], readLen, NULL );
+        rc = SamWrite( out, &cols[ seq_READ ].base.str[ readStart ], readLen );
     }
 
     if ( rc == 0 )
-        rc = BufferedWriter( NULL, "\t", 1, NULL );
+        rc = SamWrite( out, "\t", 1 );
     /* QUAL: SEQUENCE.QUALITY */
     if ( rc == 0 )
-        rc = DumpQuality( &cols[ seq_QUALITY ].base.str[ readStart ], readLen, flags & 0x10, param->quantizeQual );
+        rc = DumpQuality( out, &cols[ seq_QUALITY ].base.str[ readStart ], readLen, flags & 0x10, param->quantizeQual );
 
     /* optional fields: */
     if ( rc == 0 )
     {
         if ( readGroup )
         {
-            rc = BufferedWriter( NULL, "\tRG:Z:", 6, NULL );
+            rc = SamWrite( out, "\tRG:Z:", 6 );
             if ( rc == 0 )
-                rc = BufferedWriter( NULL, readGroup, string_size( readGroup ), NULL );
+                rc = SamWrite( out, readGroup, string_size( readGroup ) );
         }
         else if ( cols[ seq_SPOT_GROUP ].len > 0 )
         {
             /* read group */
-            rc = BufferedWriter( NULL, "\tRG:Z:", 6, NULL );
+            rc = SamWrite( out, "\tRG:Z:", 6 );
             if ( rc == 0 )
-                rc = BufferedWriter( NULL, cols[ seq_SPOT_GROUP ].base.str, cols[ seq_SPOT_GROUP ].len, NULL );
+                rc = SamWrite( out, cols[ seq_SPOT_GROUP ].base.str, cols[ seq_SPOT_GROUP ].len );
         }
     }
     if ( rc == 0 )
-        rc = BufferedWriter( NULL, "\n", 1, NULL );
+        rc = SamWrite( out, "\n", 1 );
     return rc;
 }
 
 
-static
-rc_t DumpAlignedSAM( SAM_dump_ctx_t *const ctx,
-                     DataSource const *ds,
-                     int64_t alignId,
-                     char const readGroup[],
-                     int type)
+static INSDC_SRA_read_filter SeqReadFilter( SAM_dump_ctx_t *const ctx, SCol const *const cols,
+                                            int64_t const spot_id, INSDC_coord_one const read_id )
+{
+    INSDC_SRA_read_filter seq_filter = 0;
+
+    if ( spot_id && read_id && ctx->seq.cols )
+    {
+        rc_t rc = Cursor_Read(&ctx->seq, spot_id, seq_READ_FILTER, 1);
+        if (rc == 0 && ctx->seq.cols[seq_READ_FILTER].len >= read_id)
+            seq_filter = ctx->seq.cols[seq_READ_FILTER].base.read_filter[read_id - 1];
+    }
+    return seq_filter;
+}
+
+
+static rc_t DumpAlignedBAM( SAM_dump_ctx_t *const ctx,
+                            DataSource const *ds,
+                            int64_t alignId,
+                            char const readGroup[],
+                            int type)
 {
+    SamOut *const out = ctx->out;
     rc_t rc = 0;
     unsigned const nreads = ds->cols[ alg_READ_LEN ].len;
     SCol const *const cols = ds->cols;
     int64_t const spot_id = cols[alg_SEQ_SPOT_ID].len > 0 ? cols[alg_SEQ_SPOT_ID].base.i64[0] : 0;
     INSDC_coord_one const read_id = cols[alg_SEQ_READ_ID].len > 0 ? cols[alg_SEQ_READ_ID].base.coord1[0] : 0;
     INSDC_SRA_read_filter const *align_filter = cols[alg_READ_FILTER].len == nreads ? cols[alg_READ_FILTER].base.read_filter : NULL;
-    INSDC_SRA_read_filter seq_filter = 0;
+    INSDC_SRA_read_filter const seq_filter = align_filter == NULL ? SeqReadFilter( ctx, cols, spot_id, read_id ) : 0;
     unsigned readId;
     unsigned cigOffset = 0;
-    
-    if ( align_filter == NULL && spot_id && read_id && ctx->seq.cols )
-    {
-        rc_t rc;
-        
-        rc = Cursor_Read(&ctx->seq, spot_id, seq_READ_FILTER, 1);
-        if (rc == 0 && ctx->seq.cols[seq_READ_FILTER].len >= read_id)
-            seq_filter = ctx->seq.cols[seq_READ_FILTER].base.read_filter[read_id - 1];
-    }
 
     for ( readId = 0; readId < nreads && rc == 0 ; ++readId )
     {
@@ -1481,9 +1733,11 @@ rc_t DumpAlignedSAM( SAM_dump_ctx_t *const ctx,
         unsigned const flags = (sflags & ~((unsigned)0x200)) | ((filt == SRA_READ_FILTER_REJECT) ? 0x200 : 0);
         char const *const cigar = cols[ alg_CIGAR ].base.str + cigOffset;
         unsigned const cigLen = nreads > 1 ? cols[ alg_CIGAR_LEN ].base.coord_len[ readId ] : cols[ alg_CIGAR ].len;
-        size_t nm;
+        size_t nm, name_len = 0, rname_at = 0, cigar_at = 0, qual_at = 0;
         char synth_qname[1024];
-        
+        bam_record rec;
+
+        memset( &rec, 0, sizeof( rec ) );
         cigOffset += cigLen;
         if ( qname_len == 0 || qname == NULL )
         {
@@ -1495,152 +1749,140 @@ rc_t DumpAlignedSAM( SAM_dump_ctx_t *const ctx,
             qname = synth_qname;
         }
         nm = cols[ alg_SPOT_GROUP ].len ? alg_SPOT_GROUP : alg_SEQ_SPOT_GROUP;
-        rc = DumpName( qname, qname_len, '.', cols[ nm ].base.str, cols[ nm ].len, spot_id );
+        rc = KDataBufferResize( &out->text, 0 );
+        if ( rc == 0 )
+            rc = DumpName( out, qname, qname_len, '.', cols[ nm ].base.str, cols[ nm ].len, spot_id );
+        name_len = BAMMark( out );
 
         /* FLAG: SAM_FLAGS */
-        if ( rc == 0 )
+        if ( ds->type == edstt_EvidenceAlignment )
         {
-            if ( ds->type == edstt_EvidenceAlignment )
-            {
-                bool const cmpl = cols[alg_REVERSED].base.v && readId < cols[alg_REVERSED].len ? cols[alg_REVERSED].base.tf[readId] : false;
-                rc = KOutMsg( "\t%u\t", 1 | (cmpl ? 0x10 : 0) | (read_id == 1 ? 0x40 : 0x80) );
-            }
-            else if ( !param->unaligned      /** not going to dump unaligned **/
-                 && ( flags & 0x1 )     /** but we have sequenced multiple fragments **/
-                 && ( flags & 0x8 ) )   /** and not all of them align **/
-            {
-                /*** remove flags talking about multiple reads **/
-                /* turn off 0x001 0x008 0x040 0x080 */
-                rc = KOutMsg( "\t%u\t", flags & ~0xC9 );
-            }
-            else
-            {
-                rc = KOutMsg( "\t%u\t", flags );
-            }
+            bool const cmpl = cols[alg_REVERSED].base.v && readId < cols[alg_REVERSED].len ? cols[alg_REVERSED].base.tf[readId] : false;
+            rec.flags = 1 | (cmpl ? 0x10 : 0) | (read_id == 1 ? 0x40 : 0x80);
         }
+        else if ( !param->unaligned && ( flags & 0x1 ) && ( flags & 0x8 ) )
+            rec.flags = flags & ~0xC9; /*** remove flags talking about multiple reads **/
+        else
+            rec.flags = flags;
 
-        if ( rc == 0 )
+        /* RNAME: REF_NAME or REF_SEQ_ID */
+        rname_at = BAMMark( out );
+        if ( ds->type == edstt_EvidenceAlignment && type == 0 )
         {
-            if ( ds->type == edstt_EvidenceAlignment && type == 0 )
-            {
-                rc = KOutMsg( "ALLELE_%li.%u", cols[ alg_REF_ID ].base.i64[ readId ], cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
-            }
-            else
-            {
-                /* RNAME: REF_NAME or REF_SEQ_ID */
-                if ( param->use_seqid )
-                    rc = BufferedWriter( NULL, cols[ alg_REF_SEQ_ID ].base.str, cols[ alg_REF_SEQ_ID ].len, NULL );
-                else
-                    rc = BufferedWriter( NULL, cols[ alg_REF_NAME ].base.str, cols[ alg_REF_NAME ].len, NULL );
-            }
+            if ( rc == 0 )
+                rc = SamPrintf( out, "ALLELE_%li.%u", cols[ alg_REF_ID ].base.i64[ readId ], cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
+        }
+        else if ( param->use_seqid )
+        {
+            rec.rname = cols[ alg_REF_SEQ_ID ].base.str;
+            rec.rname_len = cols[ alg_REF_SEQ_ID ].len;
+        }
+        else
+        {
+            rec.rname = cols[ alg_REF_NAME ].base.str;
+            rec.rname_len = cols[ alg_REF_NAME ].len;
         }
 
-        if ( rc == 0 )
-            rc = BufferedWriter( NULL, "\t", 1, NULL );
-        
-        /* POS: REF_POS */
-        if ( rc == 0 )
-            rc = KOutMsg( "%i\t", cols[ alg_REF_POS ].base.coord0[ 0 ] + 1 );
-
-        /* MAPQ: MAPQ */
-        if ( rc == 0 )
-            rc = KOutMsg( "%i\t", cols[ alg_MAPQ ].base.i32[ 0 ] );
+        /* POS: REF_POS, MAPQ: MAPQ */
+        rec.pos = cols[ alg_REF_POS ].base.coord0[ 0 ];
+        rec.mapq = cols[ alg_MAPQ ].base.i32[ 0 ];
 
         /* CIGAR: CIGAR_* */
+        cigar_at = BAMMark( out );
         if ( ds->type == edstt_EvidenceInterval )
         {
             unsigned i;
-            
+
             for ( i = 0; i != cigLen && rc == 0; ++i )
             {
                 char ch = cigar[i];
                 if ( ch == 'S' ) ch = 'I';
-                rc = BufferedWriter(NULL, &ch, 1, NULL);
+                rc = SamWrite( out, &ch, 1 );
             }
         }
-	else if(ds->type == edstt_EvidenceAlignment)
-	{
-		rc = cg_canonical_print_cigar(cigar,cigLen);
-	}
-        else
+        else if ( ds->type == edstt_EvidenceAlignment )
         {
+            /* prints with KOutMsg(), the evidence is only dumped into the main output */
             if ( rc == 0 )
-                rc = BufferedWriter( NULL, cigar, cigLen, NULL );
+                rc = cg_canonical_print_cigar( cigar, cigLen );
+        }
+        else
+        {
+            rec.cigar = cigar;
+            rec.cigar_len = cigLen;
         }
 
-        if ( rc == 0 )
-            rc = BufferedWriter( NULL, "\t", 1, NULL );
-        
-        /* RNEXT: MATE_REF_NAME or '*' */
-        /* PNEXT: MATE_REF_POS or 0 */
-        if ( rc == 0 )
+        /* RNEXT: MATE_REF_NAME or none, PNEXT: MATE_REF_POS or -1 */
+        if ( cols[ alg_MATE_REF_NAME ].len )
         {
-            if ( cols[ alg_MATE_REF_NAME ].len )
+            if ( cols[ alg_MATE_REF_NAME ].len == cols[ alg_REF_NAME ].len &&
+                 memcmp( cols[ alg_MATE_REF_NAME ].base.str, cols[ alg_REF_NAME ].base.str, cols[ alg_MATE_REF_NAME ].len ) == 0 )
             {
-                if ( cols[ alg_MATE_REF_NAME ].len == cols[ alg_REF_NAME ].len &&
-                    memcmp( cols[ alg_MATE_REF_NAME ].base.str, cols[ alg_REF_NAME ].base.str, cols[ alg_MATE_REF_NAME ].len ) == 0 )
-                {
-                    rc = BufferedWriter( NULL, "=\t", 2, NULL );
-                }
-                else
-                {
-                    rc = BufferedWriter( NULL, cols[ alg_MATE_REF_NAME ].base.str, cols[ alg_MATE_REF_NAME ].len, NULL );
-                    if ( rc == 0 )
-                        rc = BufferedWriter( NULL, "\t", 1, NULL );
-                }
-                if ( rc == 0 )
-                    rc = KOutMsg( "%u\t", cols[ alg_MATE_REF_POS ].base.coord0[ 0 ] + 1 );
+                rec.rnext = "=";
+                rec.rnext_len = 1;
             }
             else
             {
-                rc = BufferedWriter( NULL, "*\t0\t", 4, NULL );
+                rec.rnext = cols[ alg_MATE_REF_NAME ].base.str;
+                rec.rnext_len = cols[ alg_MATE_REF_NAME ].len;
             }
+            rec.pnext = cols[ alg_MATE_REF_POS ].base.coord0[ 0 ];
         }
+        else
+            rec.pnext = -1;
 
         /* TLEN: TEMPLATE_LEN */
-        if ( rc == 0 )
-            rc = KOutMsg( "%i\t", cols[ alg_TEMPLATE_LEN ].base.v ? cols[ alg_TEMPLATE_LEN ].base.i32[ 0 ] : 0 );
+        rec.tlen = cols[ alg_TEMPLATE_LEN ].base.v ? cols[ alg_TEMPLATE_LEN ].base.i32[ 0 ] : 0;
 
-        /* SEQ: READ */
-        if ( rc == 0 )
-            rc = BufferedWriter( NULL, read, readlen, NULL );
+        /* QUAL: SAM_QUALITY */
+        qual_at = BAMMark( out );
         if ( rc == 0 )
-            rc = BufferedWriter( NULL, "\t", 1, NULL );
+            rc = DumpQuality( out, qual, readlen, false, param->quantizeQual );
 
-        /* QUAL: SAM_QUALITY */
         if ( rc == 0 )
-            rc = DumpQuality( qual, readlen, false, param->quantizeQual );
-    
+        {
+            rec.qname = BAMText( out, 0 );
+            rec.qname_len = name_len;
+            if ( cigar_at > rname_at )
+            {
+                rec.rname = BAMText( out, rname_at );
+                rec.rname_len = cigar_at - rname_at;
+            }
+            if ( qual_at > cigar_at )
+            {
+                rec.cigar = BAMText( out, cigar_at );
+                rec.cigar_len = qual_at - cigar_at;
+            }
+            rec.seq = read;
+            rec.qual = BAMText( out, qual_at );
+            rec.seq_len = readlen;
+            rc = bam_slice_begin( out->bam, &rec );
+        }
+
         /* optional fields: */
         if ( rc == 0 && ds->type == edstt_EvidenceInterval )
-            rc = KOutMsg( "\tRG:Z:ALLELE_%u", readId + 1 );
+        {
+            char allele[ 32 ];
+            size_t allele_len;
+
+            rc = string_printf( allele, sizeof( allele ), &allele_len, "ALLELE_%u", readId + 1 );
+            if ( rc == 0 )
+                rc = bam_slice_tag_Z( out->bam, "RG", allele, allele_len );
+        }
 
         if ( rc == 0 )
         {
             if ( readGroup )
-            {
-                rc = BufferedWriter( NULL, "\tRG:Z:", 6, NULL );
-                if ( rc == 0 )
-                    rc = BufferedWriter( NULL, readGroup, string_size( readGroup ), NULL );
-            }
+                rc = bam_slice_tag_Z( out->bam, "RG", readGroup, string_size( readGroup ) );
             else if ( cols[ alg_SPOT_GROUP ].len > 0 )
-            {
-                /* read group */
-                rc = BufferedWriter( NULL, "\tRG:Z:", 6, NULL );
-                if ( rc == 0 )
-                    rc = BufferedWriter( NULL, cols[ alg_SPOT_GROUP ].base.str, cols[ alg_SPOT_GROUP ].len, NULL );
-            }
+                rc = bam_slice_tag_Z( out->bam, "RG", cols[ alg_SPOT_GROUP ].base.str, cols[ alg_SPOT_GROUP ].len );
             else if ( cols[ alg_SEQ_SPOT_GROUP ].len > 0 )
-            {
-                /* backward compatibility */
-                rc = BufferedWriter( NULL, "\tRG:Z:", 6, NULL );
-                if ( rc == 0 )
-                    rc = BufferedWriter( NULL, cols[ alg_SEQ_SPOT_GROUP ].base.str, cols[ alg_SEQ_SPOT_GROUP ].len, NULL );
-            }
+                rc = bam_slice_tag_Z( out->bam, "RG", cols[ alg_SEQ_SPOT_GROUP ].base.str, cols[ alg_SEQ_SPOT_GROUP ].len );
         }
 
+        /* CG_TAGS_STR is already in the SAM-text-form */
         if ( rc == 0 && param->cg_style > 0 && cols[ alg_CG_TAGS_STR ].len > 0 )
-            rc = BufferedWriter( NULL, cols[ alg_CG_TAGS_STR ].base.str, cols[ alg_CG_TAGS_STR ].len, NULL );
+            rc = bam_slice_tags_text( out->bam, cols[ alg_CG_TAGS_STR ].base.str, cols[ alg_CG_TAGS_STR ].len );
 
         if ( rc == 0 )
         {
@@ -1648,52 +1890,300 @@ rc_t DumpAlignedSAM( SAM_dump_ctx_t *const ctx,
             {
                 char const *ZI = cols[ alg_ALIGN_GROUP ].base.str;
                 unsigned i;
-                
+
                 for ( i = 0; rc == 0 && i < cols[ alg_ALIGN_GROUP ].len - 1; ++i )
                 {
                     if ( ZI[ i ] == '_' )
                     {
-                        rc = KOutMsg( "\tZI:i:%.*s\tZA:i:%.1s", i, ZI, ZI + i + 1 );
+                        char tags[ 64 ];
+                        size_t tags_len;
+
+                        rc = string_printf( tags, sizeof( tags ), &tags_len, "\tZI:i:%.*s\tZA:i:%.1s", i, ZI, ZI + i + 1 );
+                        if ( rc == 0 )
+                            rc = bam_slice_tags_text( out->bam, tags, tags_len );
                         break;
                     }
                 }
             }
             else if ( ds->type == edstt_EvidenceAlignment && type == 1 )
             {
-                rc = KOutMsg( "\tZI:i:%li\tZA:i:%u", cols[ alg_REF_ID ].base.i64[ readId ], cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
+                rc = bam_slice_tag_i( out->bam, "ZI", cols[ alg_REF_ID ].base.i64[ readId ] );
+                if ( rc == 0 )
+                    rc = bam_slice_tag_i( out->bam, "ZA", cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
             }
         }
 
         /* align id */
         if ( rc == 0 && param->xi )
-            rc = KOutMsg( "\tXI:i:%li", alignId );
+            rc = bam_slice_tag_i( out->bam, "XI", alignId );
 
         /* hit count */
         if ( rc == 0 && cols[alg_ALIGNMENT_COUNT].len )
-            rc = KOutMsg( "\tNH:i:%i", (int)cols[ alg_ALIGNMENT_COUNT ].base.u8[ readId ] );
+            rc = bam_slice_tag_i( out->bam, "NH", cols[ alg_ALIGNMENT_COUNT ].base.u8[ readId ] );
 
         /* edit distance */
         if ( rc == 0 && cols[ alg_EDIT_DISTANCE ].len )
-            rc = KOutMsg( "\tNM:i:%i", cols[ alg_EDIT_DISTANCE ].base.i32[ readId ] );
+            rc = bam_slice_tag_i( out->bam, "NM", cols[ alg_EDIT_DISTANCE ].base.i32[ readId ] );
 
         if ( rc == 0 )
-            rc = KOutMsg( "\n" );
+            rc = SamOutBAMEnd( out );
     }
     return rc;
 }
 
 
-static rc_t DumpUnalignedReads( SAM_dump_ctx_t *const ctx, SCol const calg_col[], int64_t row_id, uint64_t* rcount )
+static
+rc_t DumpAlignedSAM( SAM_dump_ctx_t *const ctx,
+                     DataSource const *ds,
+                     int64_t alignId,
+                     char const readGroup[],
+                     int type)
 {
+    SamOut *const out = ctx->out;
     rc_t rc = 0;
-    uint32_t i, nreads = 0;
-
-    if ( calg_col != NULL )
-    {
-        if ( calg_col[ alg_SAM_FLAGS ].base.u32[ 0 ] & 0x02 )
-        {
-            /* skip all aligned rows by flag */
-            return rc;
+    unsigned const nreads = ds->cols[ alg_READ_LEN ].len;
+    SCol const *const cols = ds->cols;
+    int64_t const spot_id = cols[alg_SEQ_SPOT_ID].len > 0 ? cols[alg_SEQ_SPOT_ID].base.i64[0] : 0;
+    INSDC_coord_one const read_id = cols[alg_SEQ_READ_ID].len > 0 ? cols[alg_SEQ_READ_ID].base.coord1[0] : 0;
+    INSDC_SRA_read_filter const *align_filter = cols[alg_READ_FILTER].len == nreads ? cols[alg_READ_FILTER].base.read_filter : NULL;
+    INSDC_SRA_read_filter seq_filter = 0;
+    unsigned readId;
+    unsigned cigOffset = 0;
+    
+    if ( out->bam != NULL )
+        return DumpAlignedBAM( ctx, ds, alignId, readGroup, type );
+
+    if ( align_filter == NULL )
+        seq_filter = SeqReadFilter( ctx, cols, spot_id, read_id );
+
+    for ( readId = 0; readId < nreads && rc == 0 ; ++readId )
+    {
+        char const *qname = cols[ alg_SEQ_NAME ].base.str;
+        size_t qname_len = cols[ alg_SEQ_NAME ].len;
+        char const *const read = cols[ alg_READ ].base.str + cols[ alg_READ_START ].base.coord0[ readId ];
+        char const *const qual = cols[ alg_SAM_QUALITY ].base.v
+                               ? cols[ alg_SAM_QUALITY ].base.str + cols[ alg_READ_START ].base.coord0[ readId ]
+                               : NULL;
+        unsigned const readlen = nreads > 1 ? cols[ alg_READ_LEN ].base.coord_len[ readId ] : cols[ alg_READ ].len;
+        unsigned const sflags = cols[ alg_SAM_FLAGS ].base.v ? cols[ alg_SAM_FLAGS ].base.u32[ readId ] : 0;
+        INSDC_SRA_read_filter const filt = align_filter ? align_filter[readId] : seq_filter;
+        unsigned const flags = (sflags & ~((unsigned)0x200)) | ((filt == SRA_READ_FILTER_REJECT) ? 0x200 : 0);
+        char const *const cigar = cols[ alg_CIGAR ].base.str + cigOffset;
+        unsigned const cigLen = nreads > 1 ? cols[ alg_CIGAR_LEN ].base.coord_len[ readId ] : cols[ alg_CIGAR ].len;
+        size_t nm;
+        char synth_qname[1024];
+        
+        cigOffset += cigLen;
+        if ( qname_len == 0 || qname == NULL )
+        {
+            string_printf( synth_qname, sizeof( synth_qname ), &qname_len, "ALLELE_%li.%u", alignId, readId + 1 );
+            qname = synth_qname;
+        }
+        else if (ds->type == edstt_EvidenceAlignment) {
+            string_printf( synth_qname, sizeof( synth_qname ), &qname_len, "%u/ALLELE_%li.%u", spot_id, cols[ alg_REF_ID ].base.i64[ readId ], cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
+            qname = synth_qname;
+        }
+        nm = cols[ alg_SPOT_GROUP ].len ? alg_SPOT_GROUP : alg_SEQ_SPOT_GROUP;
+        rc = DumpName( out, qname, qname_len, '.', cols[ nm ].base.str, cols[ nm ].len, spot_id );
+
+        /* FLAG: SAM_FLAGS */
+        if ( rc == 0 )
+        {
+            if ( ds->type == edstt_EvidenceAlignment )
+            {
+                bool const cmpl = cols[alg_REVERSED].base.v && readId < cols[alg_REVERSED].len ? cols[alg_REVERSED].base.tf[readId] : false;
+                rc = SamPrintf( out, "\t%u\t", 1 | (cmpl ? 0x10 : 0) | (read_id == 1 ? 0x40 : 0x80) );
+            }
+            else if ( !param->unaligned      /** not going to dump unaligned **/
+                 && ( flags & 0x1 )     /** but we have sequenced multiple fragments **/
+                 && ( flags & 0x8 ) )   /** and not all of them align **/
+            {
+                /*** remove flags talking about multiple reads **/
+                /* turn off 0x001 0x008 0x040 0x080 */
+                rc = SamPrintf( out, "\t%u\t", flags & ~0xC9 );
+            }
+            else
+            {
+                rc = SamPrintf( out, "\t%u\t", flags );
+            }
+        }
+
+        if ( rc == 0 )
+        {
+            if ( ds->type == edstt_EvidenceAlignment && type == 0 )
+            {
+                rc = SamPrintf( out, "ALLELE_%li.%u", cols[ alg_REF_ID ].base.i64[ readId ], cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
+            }
+            else
+            {
+                /* RNAME: REF_NAME or REF_SEQ_ID */
+                if ( param->use_seqid )
+                    rc = SamWrite( out, cols[ alg_REF_SEQ_ID ].base.str, cols[ alg_REF_SEQ_ID ].len );
+                else
+                    rc = SamWrite( out, cols[ alg_REF_NAME ].base.str, cols[ alg_REF_NAME ].len );
+            }
+        }
+
+        if ( rc == 0 )
+            rc = SamWrite( out, "\t", 1 );
+        
+        /* POS: REF_POS */
+        if ( rc == 0 )
+            rc = SamPrintf( out, "%i\t", cols[ alg_REF_POS ].base.coord0[ 0 ] + 1 );
+
+        /* MAPQ: MAPQ */
+        if ( rc == 0 )
+            rc = SamPrintf( out, "%i\t", cols[ alg_MAPQ ].base.i32[ 0 ] );
+
+        /* CIGAR: CIGAR_* */
+        if ( ds->type == edstt_EvidenceInterval )
+        {
+            unsigned i;
+            
+            for ( i = 0; i != cigLen && rc == 0; ++i )
+            {
+                char ch = cigar[i];
+                if ( ch == 'S' ) ch = 'I';
+                rc = SamWrite( out, &ch, 1 );
+            }
+        }
+	else if(ds->type == edstt_EvidenceAlignment)
+	{
+		rc = cg_canonical_print_cigar(cigar,cigLen);
+	}
+        else
+        {
+            if ( rc == 0 )
+                rc = SamWrite( out, cigar, cigLen );
+        }
+
+        if ( rc == 0 )
+            rc = SamWrite( out, "\t", 1 );
+        
+        /* RNEXT: MATE_REF_NAME or '*' */
+        /* PNEXT: MATE_REF_POS or 0 */
+        if ( rc == 0 )
+        {
+            if ( cols[ alg_MATE_REF_NAME ].len )
+            {
+                if ( cols[ alg_MATE_REF_NAME ].len == cols[ alg_REF_NAME ].len &&
+                    memcmp( cols[ alg_MATE_REF_NAME ].base.str, cols[ alg_REF_NAME ].base.str, cols[ alg_MATE_REF_NAME ].len ) == 0 )
+                {
+                    rc = SamWrite( out, "=\t", 2 );
+                }
+                else
+                {
+                    rc = SamWrite( out, cols[ alg_MATE_REF_NAME ].base.str, cols[ alg_MATE_REF_NAME ].len );
+                    if ( rc == 0 )
+                        rc = SamWrite( out, "\t", 1 );
+                }
+                if ( rc == 0 )
+                    rc = SamPrintf( out, "%u\t", cols[ alg_MATE_REF_POS ].base.coord0[ 0 ] + 1 );
+            }
+            else
+            {
+                rc = SamWrite( out, "*\t0\t", 4 );
+            }
+        }
+
+        /* TLEN: TEMPLATE_LEN */
+        if ( rc == 0 )
+            rc = SamPrintf( out, "%i\t", cols[ alg_TEMPLATE_LEN ].base.v ? cols[ alg_TEMPLATE_LEN ].base.i32[ 0 ] : 0 );
+
+        /* SEQ: READ */
+        if ( rc == 0 )
+            rc = SamWrite( out, read, readlen );
+        if ( rc == 0 )
+            rc = SamWrite( out, "\t", 1 );
+
+        /* QUAL: SAM_QUALITY */
+        if ( rc == 0 )
+            rc = DumpQuality( out, qual, readlen, false, param->quantizeQual );
+    
+        /* optional fields: */
+        if ( rc == 0 && ds->type == edstt_EvidenceInterval )
+            rc = SamPrintf( out, "\tRG:Z:ALLELE_%u", readId + 1 );
+
+        if ( rc == 0 )
+        {
+            if ( readGroup )
+            {
+                rc = SamWrite( out, "\tRG:Z:", 6 );
+                if ( rc == 0 )
+                    rc = SamWrite( out, readGroup, string_size( readGroup ) );
+            }
+            else if ( cols[ alg_SPOT_GROUP ].len > 0 )
+            {
+                /* read group */
+                rc = SamWrite( out, "\tRG:Z:", 6 );
+                if ( rc == 0 )
+                    rc = SamWrite( out, cols[ alg_SPOT_GROUP ].base.str, cols[ alg_SPOT_GROUP ].len );
+            }
+            else if ( cols[ alg_SEQ_SPOT_GROUP ].len > 0 )
+            {
+                /* backward compatibility */
+                rc = SamWrite( out, "\tRG:Z:", 6 );
+                if ( rc == 0 )
+                    rc = SamWrite( out, cols[ alg_SEQ_SPOT_GROUP ].base.str, cols[ alg_SEQ_SPOT_GROUP ].len );
+            }
+        }
+
+        if ( rc == 0 && param->cg_style > 0 && cols[ alg_CG_TAGS_STR ].len > 0 )
+            rc = SamWrite( out, cols[ alg_CG_TAGS_STR ].base.str, cols[ alg_CG_TAGS_STR ].len );
+
+        if ( rc == 0 )
+        {
+            if ( param->cg_style > 0 && cols[ alg_ALIGN_GROUP ].len > 0 )
+            {
+                char const *ZI = cols[ alg_ALIGN_GROUP ].base.str;
+                unsigned i;
+                
+                for ( i = 0; rc == 0 && i < cols[ alg_ALIGN_GROUP ].len - 1; ++i )
+                {
+                    if ( ZI[ i ] == '_' )
+                    {
+                        rc = SamPrintf( out, "\tZI:i:%.*s\tZA:i:%.1s", i, ZI, ZI + i + 1 );
+                        break;
+                    }
+                }
+            }
+            else if ( ds->type == edstt_EvidenceAlignment && type == 1 )
+            {
+                rc = SamPrintf( out, "\tZI:i:%li\tZA:i:%u", cols[ alg_REF_ID ].base.i64[ readId ], cols[ alg_REF_PLOIDY ].base.u32[ readId ] );
+            }
+        }
+
+        /* align id */
+        if ( rc == 0 && param->xi )
+            rc = SamPrintf( out, "\tXI:i:%li", alignId );
+
+        /* hit count */
+        if ( rc == 0 && cols[alg_ALIGNMENT_COUNT].len )
+            rc = SamPrintf( out, "\tNH:i:%i", (int)cols[ alg_ALIGNMENT_COUNT ].base.u8[ readId ] );
+
+        /* edit distance */
+        if ( rc == 0 && cols[ alg_EDIT_DISTANCE ].len )
+            rc = SamPrintf( out, "\tNM:i:%i", cols[ alg_EDIT_DISTANCE ].base.i32[ readId ] );
+
+        if ( rc == 0 )
+            rc = SamPrintf( out, "\n" );
+    }
+    return rc;
+}
+
+
+static rc_t DumpUnalignedReads( SAM_dump_ctx_t *const ctx, SCol const calg_col[], int64_t row_id, uint64_t* rcount )
+{
+    SamOut *const out = ctx->out;
+    rc_t rc = 0;
+    uint32_t i, nreads = 0;
+
+    if ( calg_col != NULL )
+    {
+        if ( calg_col[ alg_SAM_FLAGS ].base.u32[ 0 ] & 0x02 )
+        {
+            /* skip all aligned rows by flag */
+            return rc;
         }
         /* get primary alignments only */
         rc = Cursor_Read( &ctx->seq, calg_col[ alg_SEQ_SPOT_ID ].base.i64[ 0 ], seq_PRIMARY_ALIGNMENT_ID, ~(unsigned)0 );
@@ -1769,7 +2259,7 @@ static rc_t DumpUnalignedReads( SAM_dump_ctx_t *const ctx, SCol const calg_col[]
                                 0;
                 if ( param->fasta || param->fastq )
                 {
-                    rc = DumpUnalignedFastX( ctx->seq.cols, nreads > 1 ? i + 1 : 0, readStart, readLen, row_id );
+                    rc = DumpUnalignedFastX( out, ctx->seq.cols, nreads > 1 ? i + 1 : 0, readStart, readLen, row_id );
                 }
                 else
                 {
@@ -1798,7 +2288,7 @@ static rc_t DumpUnalignedReads( SAM_dump_ctx_t *const ctx, SCol const calg_col[]
                     }
                     if ( calg_col == NULL )
                     {
-                        rc = DumpUnalignedSAM( ctx->seq.cols, cflags |
+                        rc = DumpUnalignedSAM( out, ctx->seq.cols, cflags |
                                           ( non_empty_reads > 1 ? ( 0x1 | 0x8 | ( i == 0 ? 0x40 : 0x00 ) | ( i == nreads - 1 ? 0x80 : 0x00 ) ) : 0x00 ),
                                           readStart, readLen, NULL, 0, 0, ctx->readGroup, row_id );
                     }
@@ -1808,7 +2298,7 @@ static rc_t DumpUnalignedReads( SAM_dump_ctx_t *const ctx, SCol const calg_col[]
                         uint16_t flags = cflags | 0x1 |
                                          ( ( calg_col[ alg_SAM_FLAGS ].base.u32[ 0 ] & 0x10 ) << 1 ) |
                                          ( ( calg_col[ alg_SAM_FLAGS ].base.u32[ 0 ] & 0x40 ) ? 0x80 : 0x40 );
-                        rc = DumpUnalignedSAM( ctx->seq.cols, flags, readStart, readLen,
+                        rc = DumpUnalignedSAM( out, ctx->seq.cols, flags, readStart, readLen,
                                           calg_col[ c ].base.str, calg_col[ c ].len,
                                           calg_col[ alg_REF_POS ].base.coord0[ 0 ] + 1, ctx->readGroup, row_id );
                     }
@@ -2408,155 +2898,698 @@ static rc_t GenerateCGData( SCol cols[], unsigned style )
 }
 
 
-static bool DumpAlignedRow( SAM_dump_ctx_t *const ctx, DataSource *const ds,
-                    int64_t row,
-                    bool const primary,
-                    int const cg_style,
-                    rc_t *prc )
+static bool DumpAlignedRow( SAM_dump_ctx_t *const ctx, DataSource *const ds,
+                    int64_t row,
+                    bool const primary,
+                    int const cg_style,
+                    rc_t *prc )
+{
+    rc_t rc = 0;
+    
+    /* if SEQ_SPOT_ID is open then skip rows with no SEQ_SPOT_ID */
+    if ( ds->cols[ alg_SEQ_SPOT_ID ].idx )
+    {
+        rc = Cursor_Read( ds, row, alg_SEQ_SPOT_ID, 1 );
+        if ( rc != 0 )
+        {
+            if ( !( GetRCObject( rc ) == rcRow && GetRCState( rc ) == rcNotFound ) )
+                *prc = rc;
+            return false;
+        }
+        if ( ds->cols[ alg_SEQ_SPOT_ID ].len == 0 ||
+             ds->cols[ alg_SEQ_SPOT_ID ].base.i64[ 0 ] == 0 )
+            return false;
+    }
+
+    /* skip rows that fail mate distance filter */
+    if ( param->mp_dist_qty != 0 || param->mp_dist_unknown )
+    {
+        rc = Cursor_Read( ds, row, alg_TEMPLATE_LEN, 1 );
+        if ( rc != 0 )
+        {
+            if ( !( GetRCObject( rc ) == rcRow && GetRCState( rc ) == rcNotFound ) )
+                *prc = rc;
+            return false;
+        }
+        if ( !AlignDistanceFilter( ds->cols ) )
+            return false;
+    }
+
+    rc = Cursor_ReadAlign( &ds->curs, row, ds->cols, 0 );
+    if ( rc != 0 )
+    {
+        if ( !( GetRCObject( rc ) == rcRow && GetRCState( rc ) == rcNotFound ) )
+            *prc = rc;
+        return false;
+    }
+
+    if ( param->fasta || param->fastq )
+    {
+        unsigned const read_id = ds->cols[ alg_SEQ_READ_ID ].base.v ? ds->cols[ alg_SEQ_READ_ID ].base.coord1[ 0 ] : 0;
+        
+        rc = DumpAlignedFastX( ctx->out, ctx->pri.cols, row, read_id, primary, false );
+    }
+    else
+    {
+        if ( cg_style != 0 )
+        {
+            rc = GenerateCGData( ds->cols, cg_style );
+            if ( rc != 0 )
+            {
+                *prc = rc;
+                return false;
+            }
+        }
+        rc = DumpAlignedSAM(ctx, ds, row, ctx->readGroup, 0 );
+    }
+    *prc = rc;
+    return true;
+}
+
+
+static rc_t DumpAlignedRowList( SAM_dump_ctx_t *const ctx, DataSource *const ds, SCol const *const ids,
+                        int64_t *rcount,
+                        bool const primary,
+                        int const cg_style,
+                        bool const noFilter )
+{
+    rc_t rc;
+    unsigned i;
+    unsigned const n = ids->len;
+
+    for ( i = 0; ( rc = Quitting() ) == 0 && i < n; ++i )
+    {
+        int64_t const row = ids->base.i64[ i ];
+
+        if ( ! noFilter )
+            rc = Cursor_Read( ds, row, alg_REGION_FILTER, ~(unsigned)0 );
+
+        if ( rc == 0 )
+        {
+            if ( noFilter || AlignRegionFilter(ds->cols) )
+            {
+                if ( DumpAlignedRow( ctx, ds, row, primary, cg_style, &rc ) )
+                    ++*rcount;
+                if ( rc != 0 )
+                    break;
+            }
+        }
+    }
+    return rc;
+}
+
+static rc_t DumpAlignedRowListIndirect( SAM_dump_ctx_t *const ctx,
+                                DataSource *const indirectSource,
+                                DataSource *const directSource,
+                                SCol const *const directIDs,
+                                int64_t *rcount,
+                                bool const primary,
+                                int const cg_style )
+{
+    unsigned i;
+
+    for ( i = 0; i < directIDs->len; ++i )
+    {
+        int64_t const row = directIDs->base.i64[ i ];
+        rc_t rc = Cursor_Read( directSource, row, alg_REGION_FILTER, ~(unsigned)0 );
+        
+        if ( rc != 0 )
+            return rc;
+        
+        if ( !AlignRegionFilter( directSource->cols ) )
+            continue;
+            
+        rc = Cursor_Read( directSource, row, alg_EVIDENCE_ALIGNMENT_IDS, 1 );
+        if ( rc != 0 )
+            return rc;
+        
+        rc = DumpAlignedRowList( ctx, indirectSource, &directSource->cols[ alg_EVIDENCE_ALIGNMENT_IDS ],
+                                 rcount, primary, cg_style, true );
+        if ( rc != 0 )
+            return rc;
+    }
+    return 0;
+}
+
+
+enum e_tables
+{
+    primary_alignment,
+    secondary_alignment,
+    evidence_interval,
+    evidence_alignment
+};
+
+enum e_IDS_opts
+{
+    primary_IDS             = ( 1 << primary_alignment ),
+    secondary_IDS           = ( 1 << secondary_alignment ),
+    evidence_interval_IDS   = ( 1 << evidence_interval ),
+    evidence_alignment_IDS  = ( 1 << evidence_alignment )
+};
+
+
+/* --------------------------------------------------------------------------------------
+    dumping the primary/secondary alignments on a pool of threads ( --threads )
+
+    the main thread walks the regions ( or the rows of the tables ) as before, but collects
+    the alignments into slices instead of dumping them; worker-threads dump the slices into
+    buffers, each with its own database and cursors; the main thread writes the buffers in
+    the order the slices were made, so the output does not depend on the number of threads
+-------------------------------------------------------------------------------------- */
+
+/* alignments collected into one slice */
+#define DUMP_SLICE_ALIGNMENTS 8192
+/* slices in flight per worker-thread */
+#define DUMP_SLICES_PER_THREAD 3
+
+typedef struct DumpSlice
+{
+    uint64_t seq;           /* the position of the slice in the output */
+    int which;              /* primary_IDS or secondary_IDS */
+    KDataBuffer ids;        /* 64-bit alignment-ids found in the regions, empty for a range of rows */
+    int64_t first;          /* the range of rows, if there are no ids */
+    uint64_t count;
+    SamOut out;             /* the dumped records */
+    int64_t rcount;         /* how many alignments were dumped */
+    rc_t rc;
+} DumpSlice;
+
+typedef struct DumpWorker
+{
+    struct DumpPool *pool;
+    VDBManager const *mgr;
+    KThread *thread;
+    SAM_dump_ctx_t ctx;
+    SCol align_cols[ ( sizeof( g_alg_col_tmpl ) / sizeof( g_alg_col_tmpl[ 0 ] ) ) * 2 ];
+    SCol seq_cols[ sizeof( gSeqCol ) / sizeof( gSeqCol[ 0 ] ) ];
+} DumpWorker;
+
+typedef struct DumpPool
+{
+    SAM_dump_ctx_t *ctx;    /* the context of the main thread */
+    KQueue *dump_q;         /* slices waiting for a worker */
+    KQueue *done_q;         /* dumped slices, in the order the workers finish them */
+    DumpWorker *workers;
+    uint32_t num_workers;
+    DumpSlice *slices;
+    DumpSlice **pending;    /* dumped slices that arrived too early, indexed by seq % num_slices */
+    DumpSlice **idle;       /* slices not in flight */
+    uint32_t num_slices;
+    uint32_t num_idle;
+    DumpSlice *current;     /* the slice the main thread collects into */
+    uint64_t next_seq;
+    uint64_t next_write;
+    int64_t rcount;         /* alignments in the slices written so far, see DumpPoolTable() */
+} DumpPool;
+
+
+static bool QueueSealed( rc_t rc )
+{
+    return ( GetRCState( rc ) == rcDone && GetRCObject( rc ) == ( enum RCObject )rcData );
+}
+
+
+/* the column-names as the main thread has set them up, without the state of its cursor */
+static void DumpWorkerColumns( SCol dst[], SCol const src[], size_t count )
+{
+    size_t i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        dst[ i ].name = src[ i ].name;
+        dst[ i ].optional = src[ i ].optional;
+    }
+}
+
+
+static rc_t DumpWorkerOpen( DumpWorker *const w )
+{
+    SAM_dump_ctx_t *const ctx = &w->ctx;
+    rc_t rc = VDBManagerMakeRead( &w->mgr, NULL );
+
+    if ( rc == 0 )
+        rc = VDBManagerOpenDBRead( w->mgr, &ctx->db, NULL, "%s", ctx->fullPath );
+    if ( rc == 0 && ctx->seq.tbl.name != NULL )
+    {
+        rc = VDatabaseOpenTableRead( ctx->db, &ctx->seq.tbl.vtbl, "%s", ctx->seq.tbl.name );
+        if ( rc == 0 )
+            rc = Cursor_Open( &ctx->seq.tbl, &ctx->seq.curs, ctx->seq.cols, NULL );
+    }
+    if ( rc == 0 && ctx->pri.tbl.name != NULL )
+    {
+        rc = VDatabaseOpenTableRead( ctx->db, &ctx->pri.tbl.vtbl, "%s", ctx->pri.tbl.name );
+        if ( rc == 0 )
+            rc = Cursor_Open( &ctx->pri.tbl, &ctx->pri.curs, ctx->pri.cols, ctx->seq.curs.cache );
+    }
+    if ( rc == 0 && ctx->sec.tbl.name != NULL )
+    {
+        rc = VDatabaseOpenTableRead( ctx->db, &ctx->sec.tbl.vtbl, "%s", ctx->sec.tbl.name );
+        if ( rc == 0 )
+            rc = Cursor_Open( &ctx->sec.tbl, &ctx->sec.curs, ctx->sec.cols, NULL );
+    }
+    if ( rc != 0 )
+        (void)PLOGERR( klogErr, ( klogErr, rc, "cannot open '$(p)' for a dump-thread", "p=%s", ctx->fullPath ) );
+    return rc;
+}
+
+
+static void DumpWorkerClose( DumpWorker *const w )
+{
+    SAM_dump_ctx_t *const ctx = &w->ctx;
+
+    Cursor_Close( &ctx->pri.curs );
+    Cursor_Close( &ctx->sec.curs );
+    Cursor_Close( &ctx->seq.curs );
+
+    VTableRelease( ctx->pri.tbl.vtbl );
+    VTableRelease( ctx->sec.tbl.vtbl );
+    VTableRelease( ctx->seq.tbl.vtbl );
+    VDatabaseRelease( ctx->db );
+    VDBManagerRelease( w->mgr );
+    ctx->db = NULL;
+    w->mgr = NULL;
+}
+
+
+/* on a worker-thread: the same as DumpAlignedRowList_cb() or DumpAlignedTable() would do */
+static rc_t DumpSliceAlignments( SAM_dump_ctx_t *const ctx, DumpSlice *const slice )
+{
+    bool const primary = ( slice->which == primary_IDS );
+    DataSource *const ds = primary ? &ctx->pri : &ctx->sec;
+    rc_t rc = KDataBufferResize( &slice->out.text, 0 );
+
+    ctx->out = &slice->out;
+    slice->rcount = 0;
+    if ( rc == 0 && slice->ids.elem_count > 0 )
+    {
+        SCol ids;
+
+        memset( &ids, 0, sizeof( ids ) );
+        ids.base.i64 = slice->ids.base;
+        ids.len = ( uint32_t )slice->ids.elem_count;
+        rc = DumpAlignedRowList( ctx, ds, &ids, &slice->rcount, primary, param->cg_style, false );
+    }
+    else if ( rc == 0 )
+    {
+        uint64_t i;
+
+        for ( i = 0; rc == 0 && i < slice->count; ++i )
+        {
+            if ( DumpAlignedRow( ctx, ds, slice->first + i, primary, param->cg_style, &rc ) )
+                ++slice->rcount;
+            if ( rc == 0 )
+                rc = Quitting();
+        }
+    }
+    return rc;
+}
+
+
+static rc_t CC DumpWorkerThread( KThread const *self, void *data )
+{
+    DumpWorker *const w = data;
+    DumpPool *const pool = w->pool;
+    rc_t const rc_open = DumpWorkerOpen( w );
+    rc_t rc = 0;
+    bool done = false;
+
+    while ( rc == 0 && !done )
+    {
+        DumpSlice *slice;
+
+        rc = KQueuePop( pool->dump_q, ( void ** )&slice, NULL );
+        if ( rc == 0 )
+        {
+            /* without a database the slices fail, the main thread stops on the first one */
+            slice->rc = ( rc_open != 0 ) ? rc_open : DumpSliceAlignments( &w->ctx, slice );
+            /* the done_q can hold all slices, this never blocks */
+            rc = KQueuePush( pool->done_q, slice, NULL );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot push dumped slice into queue" );
+        }
+        else if ( QueueSealed( rc ) )
+        {
+            done = true;
+            rc = 0;
+        }
+        else
+            (void)LOGERR( klogErr, rc, "cannot pop slice from queue" );
+    }
+    return ( rc != 0 ) ? rc : rc_open;
+}
+
+
+static rc_t DumpPoolWrite( DumpPool *const pool, DumpSlice *const slice )
+{
+    rc_t rc = slice->rc;
+
+    if ( rc == 0 )
+    {
+        if ( g_out_writer.bam != NULL )
+            rc = bam_writer_write_slice( g_out_writer.bam, slice->out.bam );
+        else
+            rc = BufferedWriter( NULL, slice->out.text.base, slice->out.text.elem_count, NULL );
+        pool->rcount += slice->rcount;
+    }
+    return rc;
+}
+
+
+/* waits for a slice to be dumped, writes the slices that are next in order */
+static rc_t DumpPoolCollect( DumpPool *const pool )
+{
+    DumpSlice *slice;
+    rc_t rc = KQueuePop( pool->done_q, ( void ** )&slice, NULL );
+
+    if ( rc != 0 )
+    {
+        (void)LOGERR( klogErr, rc, "cannot pop dumped slice from queue" );
+        return rc;
+    }
+    /* at most num_slices consecutive slices are in flight, each has its own slot */
+    pool->pending[ slice->seq % pool->num_slices ] = slice;
+    while ( rc == 0 )
+    {
+        uint32_t const slot = pool->next_write % pool->num_slices;
+
+        slice = pool->pending[ slot ];
+        if ( slice == NULL || slice->seq != pool->next_write )
+            break;
+        pool->pending[ slot ] = NULL;
+        pool->next_write++;
+        rc = DumpPoolWrite( pool, slice );
+        pool->idle[ pool->num_idle++ ] = slice;
+    }
+    return rc;
+}
+
+
+static rc_t DumpPoolSubmit( DumpPool *const pool )
 {
+    DumpSlice *const slice = pool->current;
     rc_t rc = 0;
-    
-    /* if SEQ_SPOT_ID is open then skip rows with no SEQ_SPOT_ID */
-    if ( ds->cols[ alg_SEQ_SPOT_ID ].idx )
+
+    if ( slice != NULL )
     {
-        rc = Cursor_Read( ds, row, alg_SEQ_SPOT_ID, 1 );
+        pool->current = NULL;
+        slice->seq = pool->next_seq++;
+        /* the dump_q can hold all slices, this never blocks */
+        rc = KQueuePush( pool->dump_q, slice, NULL );
         if ( rc != 0 )
-        {
-            if ( !( GetRCObject( rc ) == rcRow && GetRCState( rc ) == rcNotFound ) )
-                *prc = rc;
-            return false;
-        }
-        if ( ds->cols[ alg_SEQ_SPOT_ID ].len == 0 ||
-             ds->cols[ alg_SEQ_SPOT_ID ].base.i64[ 0 ] == 0 )
-            return false;
+            (void)LOGERR( klogErr, rc, "cannot push slice into queue" );
     }
+    return rc;
+}
 
-    /* skip rows that fail mate distance filter */
-    if ( param->mp_dist_qty != 0 || param->mp_dist_unknown )
+
+/* the slice to collect alignments of the given table into, waits for one if all are in flight */
+static rc_t DumpPoolCurrent( DumpPool *const pool, int which, DumpSlice **const slice )
+{
+    rc_t rc = 0;
+
+    if ( pool->current != NULL && pool->current->which != which )
+        rc = DumpPoolSubmit( pool );
+    while ( rc == 0 && pool->current == NULL )
     {
-        rc = Cursor_Read( ds, row, alg_TEMPLATE_LEN, 1 );
-        if ( rc != 0 )
+        if ( pool->num_idle > 0 )
         {
-            if ( !( GetRCObject( rc ) == rcRow && GetRCState( rc ) == rcNotFound ) )
-                *prc = rc;
-            return false;
+            DumpSlice *const s = pool->idle[ --pool->num_idle ];
+
+            s->which = which;
+            s->first = 0;
+            s->count = 0;
+            rc = KDataBufferResize( &s->ids, 0 );
+            pool->current = s;
         }
-        if ( !AlignDistanceFilter( ds->cols ) )
-            return false;
+        else
+            rc = DumpPoolCollect( pool );
     }
+    *slice = pool->current;
+    return rc;
+}
 
-    rc = Cursor_ReadAlign( &ds->curs, row, ds->cols, 0 );
-    if ( rc != 0 )
-    {
-        if ( !( GetRCObject( rc ) == rcRow && GetRCState( rc ) == rcNotFound ) )
-            *prc = rc;
-        return false;
-    }
 
-    if ( param->fasta || param->fastq )
+/* the ids of one row of the REFERENCE-table, called by DumpAlignedRowList_cb() */
+static rc_t DumpPoolAddIds( DumpPool *const pool, int which, SCol const *const ids )
+{
+    DumpSlice *slice;
+    rc_t rc;
+
+    if ( ids->len == 0 )
+        return 0;
+    rc = DumpPoolCurrent( pool, which, &slice );
+    if ( rc == 0 )
     {
-        unsigned const read_id = ds->cols[ alg_SEQ_READ_ID ].base.v ? ds->cols[ alg_SEQ_READ_ID ].base.coord1[ 0 ] : 0;
-        
-        rc = DumpAlignedFastX( ctx->pri.cols, row, read_id, primary, false );
+        uint64_t const used = slice->ids.elem_count;
+
+        rc = KDataBufferResize( &slice->ids, used + ids->len );
+        if ( rc == 0 )
+        {
+            memmove( ( int64_t * )slice->ids.base + used, ids->base.i64, ids->len * sizeof( int64_t ) );
+            if ( slice->ids.elem_count >= DUMP_SLICE_ALIGNMENTS )
+                rc = DumpPoolSubmit( pool );
+        }
     }
-    else
+    return rc;
+}
+
+
+/* all rows of a table, called by DumpUnsorted() */
+static rc_t DumpPoolAddTable( DumpPool *const pool, DataSource const *const ds, int which )
+{
+    int64_t start;
+    uint64_t count;
+    rc_t rc = DumpPoolSubmit( pool );
+
+    if ( rc == 0 )
+        rc = VCursorIdRange( ds->curs.vcurs, 0, &start, &count );
+    while ( rc == 0 && count > 0 )
     {
-        if ( cg_style != 0 )
+        uint64_t const n = ( count < DUMP_SLICE_ALIGNMENTS ) ? count : DUMP_SLICE_ALIGNMENTS;
+        DumpSlice *slice;
+
+        rc = DumpPoolCurrent( pool, which, &slice );
+        if ( rc == 0 )
         {
-            rc = GenerateCGData( ds->cols, cg_style );
-            if ( rc != 0 )
-            {
-                *prc = rc;
-                return false;
-            }
+            slice->first = start;
+            slice->count = n;
+            rc = DumpPoolSubmit( pool );
+            start += n;
+            count -= n;
         }
-        rc = DumpAlignedSAM(ctx, ds, row, ctx->readGroup, 0 );
     }
-    *prc = rc;
-    return true;
+    return rc;
 }
 
 
-static rc_t DumpAlignedRowList( SAM_dump_ctx_t *const ctx, DataSource *const ds, SCol const *const ids,
-                        int64_t *rcount,
-                        bool const primary,
-                        int const cg_style,
-                        bool const noFilter )
+/* waits for all slices in flight and writes them */
+static rc_t DumpPoolFlush( DumpPool *const pool )
 {
-    rc_t rc;
-    unsigned i;
-    unsigned const n = ids->len;
+    rc_t rc = DumpPoolSubmit( pool );
 
-    for ( i = 0; ( rc = Quitting() ) == 0 && i < n; ++i )
+    while ( rc == 0 && pool->next_write < pool->next_seq )
+        rc = DumpPoolCollect( pool );
+    return rc;
+}
+
+
+/* instead of DumpAlignedTable(), rcount: the alignments dumped from this table */
+static rc_t DumpPoolTable( DumpPool *const pool, DataSource const *const ds, int which, unsigned *const rcount )
+{
+    rc_t rc = DumpPoolAddTable( pool, ds, which );
+
+    if ( rc == 0 )
+        rc = DumpPoolFlush( pool );
+    *rcount += ( unsigned )pool->rcount;
+    pool->rcount = 0;
+    return rc;
+}
+
+
+#if USE_MATE_CACHE
+static rc_t CC DumpPoolMergeCache_cb( uint64_t key, uint64_t value, void *user_data )
+{
+    return KVectorSetU64( user_data, key, value );
+}
+
+
+static rc_t CC DumpPoolMergeUnalignedMate_cb( uint64_t key, bool value, void *user_data )
+{
+    return KVectorSetBool( user_data, key, value );
+}
+#endif
+
+
+/* the mates the workers have seen, needed by FlushUnaligned() and DumpUnaligned() */
+static rc_t DumpPoolMergeCache( SAM_dump_ctx_t *const ctx, SAM_dump_ctx_t const *const wctx )
+{
+    rc_t rc = 0;
+#if USE_MATE_CACHE
+    SCursCache const *const src = wctx->pri.curs.cache;
+    SCursCache *const dst = ctx->pri.curs.cache;
+
+    if ( src != NULL && dst != NULL )
     {
-        int64_t const row = ids->base.i64[ i ];
+        rc = KVectorVisitU64( src->cache, false, DumpPoolMergeCache_cb, dst->cache );
+        if ( rc == 0 )
+            rc = KVectorVisitBool( src->cache_unaligned_mate, false, DumpPoolMergeUnalignedMate_cb,
+                                   dst->cache_unaligned_mate );
+    }
+#endif /* USE_MATE_CACHE */
+    return rc;
+}
 
-        if ( ! noFilter )
-            rc = Cursor_Read( ds, row, alg_REGION_FILTER, ~(unsigned)0 );
+
+/* writes what is still in flight, stops the workers and merges their mate-caches */
+static rc_t DumpPoolRelease( DumpPool *const pool, rc_t rc )
+{
+    if ( pool != NULL )
+    {
+        uint32_t i;
 
         if ( rc == 0 )
+            rc = DumpPoolFlush( pool );
+        if ( pool->dump_q != NULL )
+            KQueueSeal( pool->dump_q );
+        for ( i = 0; i < pool->num_workers; ++i )
         {
-            if ( noFilter || AlignRegionFilter(ds->cols) )
+            DumpWorker *const w = &pool->workers[ i ];
+
+            if ( w->thread != NULL )
             {
-                if ( DumpAlignedRow( ctx, ds, row, primary, cg_style, &rc ) )
-                    ++*rcount;
-                if ( rc != 0 )
-                    break;
+                rc_t rc_thread;
+                rc_t rc1 = KThreadWait( w->thread, &rc_thread );
+
+                if ( rc1 == 0 )
+                    rc1 = rc_thread;
+                if ( rc == 0 )
+                    rc = rc1;
+                KThreadRelease( w->thread );
+                if ( rc == 0 )
+                    rc = DumpPoolMergeCache( pool->ctx, &w->ctx );
             }
+            DumpWorkerClose( w );
+        }
+        for ( i = 0; i < pool->num_slices; ++i )
+        {
+            DumpSlice *const s = &pool->slices[ i ];
+
+            KDataBufferWhack( &s->ids );
+            KDataBufferWhack( &s->out.text );
+            release_bam_slice( s->out.bam );
         }
+        KQueueRelease( pool->dump_q );
+        KQueueRelease( pool->done_q );
+        free( pool->workers );
+        free( pool->slices );
+        free( pool->pending );
+        free( pool->idle );
+        free( pool );
     }
     return rc;
 }
 
-static rc_t DumpAlignedRowListIndirect( SAM_dump_ctx_t *const ctx,
-                                DataSource *const indirectSource,
-                                DataSource *const directSource,
-                                SCol const *const directIDs,
-                                int64_t *rcount,
-                                bool const primary,
-                                int const cg_style )
+
+static rc_t DumpPoolStart( DumpPool *const pool )
 {
-    unsigned i;
+    SAM_dump_ctx_t const *const ctx = pool->ctx;
+    size_t const alg_cols = sizeof( g_alg_col_tmpl ) / sizeof( g_alg_col_tmpl[ 0 ] );
+    rc_t rc = 0;
+    uint32_t i;
 
-    for ( i = 0; i < directIDs->len; ++i )
+    for ( i = 0; rc == 0 && i < pool->num_slices; ++i )
     {
-        int64_t const row = directIDs->base.i64[ i ];
-        rc_t rc = Cursor_Read( directSource, row, alg_REGION_FILTER, ~(unsigned)0 );
-        
-        if ( rc != 0 )
-            return rc;
-        
-        if ( !AlignRegionFilter( directSource->cols ) )
-            continue;
-            
-        rc = Cursor_Read( directSource, row, alg_EVIDENCE_ALIGNMENT_IDS, 1 );
-        if ( rc != 0 )
-            return rc;
-        
-        rc = DumpAlignedRowList( ctx, indirectSource, &directSource->cols[ alg_EVIDENCE_ALIGNMENT_IDS ],
-                                 rcount, primary, cg_style, true );
+        DumpSlice *const s = &pool->slices[ i ];
+
+        rc = KDataBufferMake( &s->ids, 64, 0 );
+        if ( rc == 0 )
+            rc = KDataBufferMakeBytes( &s->out.text, 0 );
+        if ( rc == 0 && g_out_writer.bam != NULL )
+            rc = make_bam_slice( &s->out.bam, g_out_writer.bam );
+        s->out.buffered = true;
+        pool->idle[ pool->num_idle++ ] = s;
+    }
+    if ( rc == 0 )
+        rc = KQueueMake( &pool->dump_q, pool->num_slices );
+    if ( rc == 0 )
+        rc = KQueueMake( &pool->done_q, pool->num_slices );
+    if ( rc != 0 )
+    {
+        (void)LOGERR( klogErr, rc, "cannot make slices for the dump-threads" );
+        return rc;
+    }
+
+    /* the records the main thread has dumped so far come first */
+    if ( g_out_writer.bam != NULL && ctx->out->bam != NULL )
+        rc = bam_writer_write_slice( g_out_writer.bam, ctx->out->bam );
+
+    for ( i = 0; rc == 0 && i < pool->num_workers; ++i )
+    {
+        DumpWorker *const w = &pool->workers[ i ];
+        SAM_dump_ctx_t *const wctx = &w->ctx;
+
+        w->pool = pool;
+        wctx->fullPath = ctx->fullPath;
+        wctx->accession = ctx->accession;
+        wctx->readGroup = ctx->readGroup;
+        DATASOURCE_INIT( wctx->seq, ( ctx->seq.curs.vcurs != NULL ) ? ctx->seq.tbl.name : NULL );
+        DATASOURCE_INIT( wctx->pri, ( ctx->pri.curs.vcurs != NULL ) ? ctx->pri.tbl.name : NULL );
+        DATASOURCE_INIT( wctx->sec, ( ctx->sec.curs.vcurs != NULL ) ? ctx->sec.tbl.name : NULL );
+
+        wctx->seq.cols = w->seq_cols;
+        memmove( w->seq_cols, gSeqCol, sizeof( gSeqCol ) );
+        wctx->pri.cols = &w->align_cols[ 0 * alg_cols ];
+        wctx->sec.cols = &w->align_cols[ 1 * alg_cols ];
+        DumpWorkerColumns( wctx->pri.cols, ctx->pri.cols, alg_cols );
+        DumpWorkerColumns( wctx->sec.cols, ctx->sec.cols, alg_cols );
+        wctx->pri.type = ctx->pri.type;
+        wctx->sec.type = ctx->sec.type;
+
+        rc = KThreadMake( &w->thread, DumpWorkerThread, w );
         if ( rc != 0 )
-            return rc;
+        {
+            w->thread = NULL;
+            (void)LOGERR( klogErr, rc, "cannot start dump-thread" );
+        }
     }
-    return 0;
+    return rc;
 }
 
 
-enum e_tables
+/* NULL if the alignments are dumped on the main thread: --threads not given, or the
+   output needs state shared between the records ( CG-conversion, FASTA/FASTQ, test-rows ) */
+static rc_t DumpPoolMake( DumpPool **const ppool, SAM_dump_ctx_t *const ctx )
 {
-    primary_alignment,
-    secondary_alignment,
-    evidence_interval,
-    evidence_alignment
-};
+    DumpPool *pool;
+    rc_t rc;
 
-enum e_IDS_opts
-{
-    primary_IDS             = ( 1 << primary_alignment ),
-    secondary_IDS           = ( 1 << secondary_alignment ),
-    evidence_interval_IDS   = ( 1 << evidence_interval ),
-    evidence_alignment_IDS  = ( 1 << evidence_alignment )
-};
+    *ppool = NULL;
+    if (   param->dump_threads < 2
+        || param->cg_evidence || param->cg_ev_dnb || param->cg_sam || param->cg_style != 0
+        || param->fasta || param->fastq || param->test_rows != 0
+        || ( ctx->pri.curs.vcurs == NULL && ctx->sec.curs.vcurs == NULL ) )
+        return 0;
+
+    pool = calloc( 1, sizeof( *pool ) );
+    if ( pool == NULL )
+        return RC( rcExe, rcData, rcAllocating, rcMemory, rcExhausted );
+    pool->ctx = ctx;
+    pool->num_workers = param->dump_threads;
+    pool->num_slices = pool->num_workers * DUMP_SLICES_PER_THREAD;
+    pool->workers = calloc( pool->num_workers, sizeof( pool->workers[ 0 ] ) );
+    pool->slices = calloc( pool->num_slices, sizeof( pool->slices[ 0 ] ) );
+    pool->pending = calloc( pool->num_slices, sizeof( pool->pending[ 0 ] ) );
+    pool->idle = calloc( pool->num_slices, sizeof( pool->idle[ 0 ] ) );
+    if ( pool->workers == NULL || pool->slices == NULL || pool->pending == NULL || pool->idle == NULL )
+        rc = RC( rcExe, rcData, rcAllocating, rcMemory, rcExhausted );
+    else
+        rc = DumpPoolStart( pool );
+    if ( rc != 0 )
+        return DumpPoolRelease( pool, rc );
+    *ppool = pool;
+    return 0;
+}
 
 
 static rc_t DumpAlignedRowList_cb( SAM_dump_ctx_t *const ctx, TAlignedRegion const *const rgn,
@@ -2564,6 +3597,9 @@ static rc_t DumpAlignedRowList_cb( SAM_dump_ctx_t *const ctx, TAlignedRegion con
 {
     /*SAM_DUMP_DBG(2, ("row %s index range is [%lu:%lu] pos %lu\n",
         param->region[r].name, start, start + count - 1, cur_pos));*/
+    if ( ctx->pool != NULL && ( which == primary_IDS || which == secondary_IDS ) )
+        return DumpPoolAddIds( ctx->pool, which, IDS );
+
     switch ( which )
     {
     case primary_IDS:
@@ -3215,14 +4251,20 @@ static rc_t DumpUnsorted( SAM_dump_ctx_t *const ctx )
     {
         SAM_DUMP_DBG( 2, ( "%s PRIMARY_ALIGNMENT\n", ctx->accession ) );
         rcount = 0;
-        rc = DumpAlignedTable( ctx, &ctx->pri, true, param->cg_style, &rcount );
+        if ( ctx->pool != NULL )
+            rc = DumpPoolTable( ctx->pool, &ctx->pri, primary_IDS, &rcount );
+        else
+            rc = DumpAlignedTable( ctx, &ctx->pri, true, param->cg_style, &rcount );
         (void)PLOGMSG( klogInfo, ( klogInfo, "$(a): $(c) primary sequences", "a=%s,c=%lu", ctx->accession, rcount ) );
     }
     if ( rc == 0 && ctx->sec.curs.vcurs )
     {
         SAM_DUMP_DBG( 2, ( "%s SECONDARY_ALIGNMENT\n", ctx->accession ) );
         rcount = 0;
-        rc = DumpAlignedTable( ctx, &ctx->sec, false, param->cg_style, &rcount );
+        if ( ctx->pool != NULL )
+            rc = DumpPoolTable( ctx->pool, &ctx->sec, secondary_IDS, &rcount );
+        else
+            rc = DumpAlignedTable( ctx, &ctx->sec, false, param->cg_style, &rcount );
         (void)PLOGMSG( klogInfo, ( klogInfo, "$(a): $(c) secondary sequences", "a=%s,c=%lu", ctx->accession, rcount ) );
     }
     return rc;
@@ -3280,7 +4322,7 @@ static rc_t DumpUnaligned( SAM_dump_ctx_t *const ctx, bool const aligned )
                         {
 #if USE_MATE_CACHE
                             uint64_t val;
-                            rc = Cache_Get( &ctx->pri.curs, min_prim_id, &val );
+                            rc = Cache_Get( &ctx->pri.curs, min_prim_id, 0, &val );
                             if ( rc == 0 )
                             {
                                 ctx->pri.cols[ alg_REF_POS ].len = 0;
@@ -3340,7 +4382,7 @@ static rc_t FlushUnalignedRead_cb (uint64_t key, bool value,void *user_data)
 		} else {
 			assert(0);
 		}
-                rc = Cache_Get( &ctx->pri.curs, aligned_mate_id, &val );
+                rc = Cache_Get( &ctx->pri.curs, aligned_mate_id, 0, &val );
                 if ( rc == 0 ) {
 			ctx->pri.cols[ alg_REF_POS ].len = 0;
 			Cache_Unpack( val, 0, &ctx->pri.curs, ctx->pri.cols );
@@ -3360,6 +4402,56 @@ static rc_t FlushUnaligned( SAM_dump_ctx_t *const ctx, const SCursCache * cache
 }
 #endif
 
+/* the references in the order of the header, needed even if the header-text does not name them */
+static rc_t BAMAddReferences( void )
+{
+    rc_t rc = 0;
+    uint32_t i, count = 0;
+
+    if ( gRefList != NULL )
+        rc = ReferenceList_Count( gRefList, &count );
+    for( i = 0; rc == 0 && i < count; i++ )
+    {
+        ReferenceObj const *obj;
+        rc = ReferenceList_Get( gRefList, &obj, i );
+        if ( rc == 0 )
+        {
+            char const *seqid = NULL;
+            char const *name = NULL;
+            INSDC_coord_len len;
+
+            rc = ReferenceObj_SeqId( obj, &seqid );
+            if ( rc == 0 )
+                rc = ReferenceObj_Name( obj, &name );
+            if ( rc == 0 )
+                rc = ReferenceObj_SeqLength( obj, &len );
+            if ( rc == 0 )
+            {
+                /* the same choice as in RefSeqPrint() */
+                char const *nm = ( param->use_seqid && seqid != NULL && seqid[ 0 ] != '\0' ) ? seqid : name;
+                rc = bam_writer_add_ref( g_out_writer.bam, nm, string_size( nm ), len );
+            }
+            ReferenceObj_Release( obj );
+        }
+    }
+    return rc;
+}
+
+
+/* the header-text has been collected in g_out_writer.out.text, the records of the main
+   output are encoded into its slice from now on */
+static rc_t BAMWriteHeader( void )
+{
+    SamOut *const out = &g_out_writer.out;
+    rc_t rc = bam_writer_header( g_out_writer.bam, out->text.base, ( size_t )out->text.elem_count );
+    if ( rc == 0 )
+        rc = KDataBufferResize( &out->text, 0 );
+    if ( rc == 0 )
+        rc = make_bam_slice( &out->bam, g_out_writer.bam );
+    return rc;
+}
+
+
 static rc_t DumpHeader( SAM_dump_ctx_t const *ctx )
 {
     bool reheader = param->reheader;
@@ -3449,8 +4541,14 @@ static rc_t DumpDB( SAM_dump_ctx_t *const ctx )
 
     if ( ctx->ref.tbl.vtbl != NULL )
         rc = ReferenceList_MakeTable( &gRefList, ctx->ref.tbl.vtbl, 0, CURSOR_CACHE, NULL, 0 );
+    if ( rc == 0 && g_out_writer.bam != NULL )
+        rc = BAMAddReferences();
     if ( !param->noheader )
         rc = DumpHeader( ctx );
+    if ( rc == 0 && g_out_writer.bam != NULL )
+        rc = BAMWriteHeader();
+    if ( rc == 0 )
+        rc = DumpPoolMake( &ctx->pool, ctx );
     if ( rc == 0 )
     {
         if ( param->region_qty ){
@@ -3460,6 +4558,9 @@ static rc_t DumpDB( SAM_dump_ctx_t *const ctx )
                                         | ( param->cg_evidence ? evidence_interval_IDS : 0 )
                                         | ( param->cg_ev_dnb   ? evidence_alignment_IDS : 0 )
                                       , DumpAlignedRowList_cb );
+            /* the workers are done before their mate-caches are needed */
+            rc = DumpPoolRelease( ctx->pool, rc );
+            ctx->pool = NULL;
 #if USE_MATE_CACHE
 	    if ( rc == 0 && param->unaligned ){
                 rc = FlushUnaligned( ctx,ctx->pri.curs.cache);
@@ -3472,6 +4573,8 @@ static rc_t DumpDB( SAM_dump_ctx_t *const ctx )
         if ( param->region_qty == 0 )
         {
             rc = DumpUnsorted( ctx );
+            rc = DumpPoolRelease( ctx->pool, rc );
+            ctx->pool = NULL;
             if ( rc == 0 && param->unaligned )
                 rc = DumpUnaligned( ctx, ctx->pri.tbl.vtbl != NULL );
         }
@@ -3487,6 +4590,8 @@ static rc_t DumpTable( SAM_dump_ctx_t *ctx )
 
     if ( !param->noheader )
         rc = DumpHeader( ctx );
+    if ( rc == 0 && g_out_writer.bam != NULL )
+        rc = BAMWriteHeader();
     if ( rc == 0 )
         rc = DumpUnaligned( ctx, false );
     return rc;
@@ -3521,6 +4626,7 @@ static rc_t ProcessTable( VDBManager const *mgr, char const fullPath[],
         ctx.fullPath = fullPath;
         ctx.accession = accession;
         ctx.readGroup = readGroup;
+        ctx.out = &g_out_writer.out;
         
         DATASOURCE_INIT( ctx.seq, accession );
         ctx.seq.tbl.vtbl = tbl;
@@ -3643,6 +4749,7 @@ static rc_t ProcessDB( VDatabase const *db, char const fullPath[],
     ctx.fullPath = fullPath;
     ctx.accession = accession;
     ctx.readGroup = readGroup;
+    ctx.out = &g_out_writer.out;
     
     DATASOURCE_INIT( ctx.seq, seqTableName );
     DATASOURCE_INIT( ctx.ref, refTableName );
@@ -4103,6 +5210,12 @@ char const *XI_usage[] = {"Output cSRA alignment id in XI column", NULL};
 char const *qual_quant_usage[] = {"Quality scores quantization level",
                                   "a string like '1:10,10:20,20:30,30:-'", NULL};
 char const *CG_names[] = { "Generate CG friendly read names", NULL};
+char const *bam_usage[] = { "Output BAM instead of SAM", NULL};
+char const *bam_index_usage[] = { "Write a BAI-index for the BAM-output into this file",
+                                  "( requires the output to be sorted by position, e.g. with --aligned-region )", NULL};
+char const *bam_threads_usage[] = { "Number of threads compressing the BAM-output ( default 4 )", NULL};
+char const *threads_usage[] = { "Number of threads dumping the alignments ( default 1 )",
+                                "( primary and secondary alignments only, not with CG- or FASTA/FASTQ-output )", NULL};
 
 char const *usage_params[] =
 {
@@ -4135,7 +5248,11 @@ char const *usage_params[] =
     NULL,                       /* CG-ev-dnb */
     NULL,                       /* CG-mappings */
     NULL,                       /* CG-SAM */
-    NULL                        /* CG-names */
+    NULL,                       /* CG-names */
+    NULL,                       /* bam */
+    "path",                     /* bam-index */
+    "count",                    /* bam-threads */
+    "count"                     /* threads */
 };
 
 enum eArgs
@@ -4168,7 +5285,11 @@ enum eArgs
     earg_CG_ev_dnb,             /* CG-ev-dnb */
     earg_CG_mappings,           /* CG-mappings */
     earg_CG_SAM,                /* CG-SAM */
-    earg_CG_names               /* CG-names */
+    earg_CG_names,              /* CG-names */
+    earg_bam,                   /* bam */
+    earg_bam_index,             /* bam-index */
+    earg_bam_threads,           /* bam-threads */
+    earg_threads                /* threads */
 };
 
 OptDef DumpArgs[] =
@@ -4202,6 +5323,10 @@ OptDef DumpArgs[] =
     { "CG-mappings", NULL, NULL, CG_mappings, 0, false, false },            /* CG-mappings */
     { "CG-SAM", NULL, NULL, CG_SAM, 0, false, false },                      /* CG-SAM */
     { "CG-names", NULL, NULL, CG_names, 0, false, false },                  /* CG-names */
+    { "bam", NULL, NULL, bam_usage, 0, false, false },                      /* bam */
+    { "bam-index", NULL, NULL, bam_index_usage, 0, true, false },           /* bam-index */
+    { "bam-threads", NULL, NULL, bam_threads_usage, 0, true, false },       /* bam-threads */
+    { "threads", NULL, NULL, threads_usage, 0, true, false },               /* threads */
     { "legacy", NULL, NULL, NULL, 0, false, false }
 };
 
@@ -4333,6 +5458,10 @@ static rc_t CountArgs( Args const *const args, unsigned count[],
     /* output encoding options */
     COUNT_ARG( earg_gzip );
     COUNT_ARG( earg_bzip2 );
+    COUNT_ARG( earg_bam );
+    COUNT_ARG( earg_bam_index );
+    COUNT_ARG( earg_bam_threads );
+    COUNT_ARG( earg_threads );
     
     COUNT_ARG( earg_mate_row_gap_cachable );
     
@@ -4762,6 +5891,43 @@ static rc_t GetArgs( Args const *const args, unsigned const count[],
         parms.cg_style = 0;
     }
     
+    parms.output_bam = ( count[ earg_bam ] != 0 );
+    if ( parms.output_bam )
+    {
+        char const *conflict = NULL;
+
+        /* the records are encoded from the columns, not from the SAM-text */
+        if ( count[ earg_gzip ] || count[ earg_bzip2 ] )
+            conflict = "bam and gzip/bzip2 are mutually exclusive";
+        else if ( parms.fasta || parms.fastq )
+            conflict = "bam and fasta/fastq are mutually exclusive";
+        else if ( parms.cg_sam )
+            conflict = "bam and CG-SAM are mutually exclusive";
+        else if ( multipass )
+            conflict = "bam needs exactly one input";
+        if ( conflict != NULL )
+        {
+            *errmsg = conflict;
+            return RC( rcExe, rcArgv, rcProcessing, rcParam, rcInconsistent );
+        }
+        if ( count[ earg_bam_index ] )
+        {
+            rc = ArgsOptionValue( args, DumpArgs[ earg_bam_index ].name, 0, (const void **)&parms.bam_index );
+            if ( rc != 0 )
+            {
+                *errmsg = DumpArgs[ earg_bam_index ].name;
+                return rc;
+            }
+        }
+        parms.bam_threads = GetOptValU( args, DumpArgs[ earg_bam_threads ].name, 4, NULL );
+    }
+    else if ( count[ earg_bam_index ] || count[ earg_bam_threads ] )
+    {
+        *errmsg = "bam-index and bam-threads require bam";
+        return RC( rcExe, rcArgv, rcProcessing, rcParam, rcInconsistent );
+    }
+
+    parms.dump_threads = GetOptValU( args, DumpArgs[ earg_threads ].name, 1, NULL );
     parms.test_rows = GetOptValU( args, DumpArgs[ earg_test_rows ].name, 0, NULL );
     parms.mate_row_gap_cachable = GetOptValU( args, DumpArgs[ earg_mate_row_gap_cachable ].name, 1000000, NULL );
     
@@ -4818,7 +5984,7 @@ rc_t CC SAM_Dump_Main( int argc, char* argv[] )
             rc = VDBManagerMakeRead( &mgr, NULL );
             if ( rc == 0 )
             {
-                rc = BufferedWriterMake( param->output_gzip, param->output_bz2 );
+                rc = BufferedWriterMake( param->output_gzip, param->output_bz2, param->output_bam );
                 if ( rc == 0 )
                 {
                     unsigned i;
@@ -4843,7 +6009,11 @@ rc_t CC SAM_Dump_Main( int argc, char* argv[] )
 #endif
                         if ( rc != 0 ) break;
                     }
-                    BufferedWriterRelease( rc == 0 );
+                    {
+                        rc_t const rc2 = BufferedWriterRelease( rc == 0 );
+                        if ( rc == 0 )
+                            rc = rc2;
+                    }
                 }
                 VDBManagerRelease( mgr );
             }
@@ -98,6 +98,19 @@ char const *sd_gzip_usage[]           = { "Compress output using gzip",
 char const *sd_bzip2_usage[]          = { "Compress output using bzip2",
                                        NULL };
 
+char const *sd_bam_usage[]            = { "Output BAM instead of SAM",
+                                       NULL };
+
+char const *sd_bam_index_usage[]      = { "Write a BAI-index for the BAM-output into this file",
+                                        "( requires the output to be sorted by position, e.g. with --aligned-region )",
+                                       NULL };
+
+char const *sd_bam_threads_usage[]    = { "Number of threads compressing the BAM-output ( default 4 )",
+                                       NULL };
+
+char const *sd_dump_threads_usage[]   = { "Number of threads dumping the alignments ( default 1 )",
+                                       NULL };
+
 char const *sd_qname_usage[]          = { "Add .SPOT_GROUP to QNAME",
                                        NULL };
 
@@ -184,6 +197,10 @@ OptDef SamDumpArgs[] =
     { OPT_HIDE_IDENT,    "=", NULL, sd_identicalbases_usage, 0, false, false },  /* replace bases that match the reference with '=' */
     { OPT_GZIP,         NULL, NULL, sd_gzip_usage,           0, false, false },  /* compress the output with gzip */
     { OPT_BZIP2,        NULL, NULL, sd_bzip2_usage,          0, false, false },  /* compress the output with bzip2 */
+    { OPT_BAM,          NULL, NULL, sd_bam_usage,            0, false, false },  /* output BAM instead of SAM */
+    { OPT_BAM_INDEX,    NULL, NULL, sd_bam_index_usage,      0, true,  false },  /* write a BAI-index for the BAM-output */
+    { OPT_BAM_THREADS,  NULL, NULL, sd_bam_threads_usage,    0, true,  false },  /* threads compressing the BAM-output */
+    { OPT_DUMP_THREADS, NULL, NULL, sd_dump_threads_usage,   0, true,  false },  /* threads dumping the alignments */
     { OPT_SPOTGRP,       "g", NULL, sd_qname_usage,          0, false, false },  /* add spotgroup to qname */
     { OPT_FASTQ,        NULL, NULL, sd_fastq_usage,          0, false, false },  /* output-format = fastq ( instead of SAM ) */
     { OPT_FASTA,        NULL, NULL, sd_fasta_usage,          0, false, false },  /* output-format = fasta ( instead of SAM ) */
@@ -235,6 +252,10 @@ char const *sd_usage_params[] =
     NULL,                       /* identical-bases */
     NULL,                       /* gzip */
     NULL,                       /* bzip2 */
+    NULL,                       /* bam */
+    "path",                     /* bam-index */
+    "count",                    /* bam-threads */
+    "count",                    /* threads */
     NULL,                       /* qname */
     NULL,                       /* fasta */
     NULL,                       /* fastq */
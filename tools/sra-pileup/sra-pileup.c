@@ -54,6 +54,9 @@
 #include <kfs/bzip.h>
 #include <kfs/gzip.h>
 
+#include <kproc/thread.h>
+#include <kproc/queue.h>
+
 #include <insdc/sra.h>
 
 #include <kdb/manager.h>
@@ -105,6 +108,11 @@
 
 #define OPTION_NGC "ngc"
 
+#define OPTION_THREADS "threads"
+
+#define OPTION_COLUMNAR         "columnar"
+#define OPTION_COLUMNAR_PACK    "columnar-pack"
+
 #define OPTION_FUNC    "function"
 #define ALIAS_FUNC     NULL
 
@@ -182,6 +190,15 @@ static const char * func_usage[]            = { "alternative functionality", NUL
 
 static const char * ngc_usage[] = { "path to ngc file", NULL };
 
+static const char * threads_usage[]         = { "number of threads, the references are cut into slices ",
+                                                "walked in parallel ( default output, count, stat, ",
+                                                "varcount, indels ), default is 1", NULL };
+
+static const char * columnar_usage[]        = { "write the counters of function count or stat ",
+                                                "as a binary columnar file instead of text", NULL };
+
+static const char * columnar_pack_usage[]   = { "RLE/delta-pack the columns of the columnar file", NULL };
+
 OptDef MyOptions[] =
 {
     /*name,           	alias,         	hfkt,	usage-help,		maxcount, needs value, required */
@@ -197,6 +214,9 @@ OptDef MyOptions[] =
     { OPTION_MERGE,		NULL,			NULL,	merge_usage,	1,        true,        false },
     { OPTION_FUNC,		ALIAS_FUNC,		NULL,	func_usage,		1,        true,        false },
     { OPTION_NGC,       NULL,           NULL,   ngc_usage, 1, true, false },
+    { OPTION_THREADS,	NULL,			NULL,	threads_usage,	1,        true,        false },
+    { OPTION_COLUMNAR,	NULL,			NULL,	columnar_usage,	1,        true,        false },
+    { OPTION_COLUMNAR_PACK,	NULL,		NULL,	columnar_pack_usage,	1,        false,       false },
 };
 
 /* =========================================================================================== */
@@ -291,7 +311,16 @@ static rc_t get_pileup_options( Args * args, pileup_options *opts )
 
     if ( rc == 0 )
         rc = get_uint32_option( args, OPTION_MERGE, &opts->merge_dist, 10000 );
+
+    if ( rc == 0 )
+        rc = get_uint32_option( args, OPTION_THREADS, &opts->num_threads, 1 );
         
+    if ( rc == 0 )
+        rc = get_str_option( args, OPTION_COLUMNAR, &opts->columnar_path );
+
+    if ( rc == 0 )
+        rc = get_bool_option( args, OPTION_COLUMNAR_PACK, &opts->columnar_pack, false );
+
     if ( rc == 0 )
         rc = get_bool_option( args, OPTION_DUPS, &opts->process_dups, false );
 
@@ -398,6 +427,9 @@ rc_t CC Usage ( const Args * args )
     HelpOptionLine ( ALIAS_SEQNAME, OPTION_SEQNAME, NULL, seqname_usage );
     HelpOptionLine ( NULL, OPTION_MIN_M, NULL, min_m_usage );
     HelpOptionLine ( NULL, OPTION_MERGE, NULL, merge_usage );
+    HelpOptionLine ( NULL, OPTION_THREADS, "count", threads_usage );
+    HelpOptionLine ( NULL, OPTION_COLUMNAR, "path", columnar_usage );
+    HelpOptionLine ( NULL, OPTION_COLUMNAR_PACK, NULL, columnar_pack_usage );
     HelpOptionLine ( ALIAS_NOQUAL, OPTION_NOQUAL, NULL, no_qual_usage );
 
     HelpOptionLine ( NULL, "function ref",      NULL, func_ref_usage );
@@ -849,7 +881,7 @@ static rc_t walk_position( ReferenceIterator *ref_iter,
 
 							/* only one KOutMsg() per line... */
 							if ( rc == 0 )
-								rc = KOutMsg( "%s\n", dyn_string_char( line, 0 ) );
+								rc = pileup_out_print( options->out, "%s\n", dyn_string_char( line, 0 ) );
 
 							if ( GetRCState( rc ) == rcDone )
 								rc = 0;
@@ -1301,6 +1333,153 @@ static rc_t CC prepare_section_cb( prepare_ctx * ctx, const struct reference_ran
 }
 
 
+/* =========================================================================================== */
+
+/* what a parallel pileup walks: the inputs and the reference-ranges of all of them,
+   collected by on_argument() instead of loading the ref-iter */
+
+typedef struct pileup_input
+{
+    char * path;
+    char * spot_group;
+} pileup_input;
+
+
+typedef struct pileup_range
+{
+    char * ref_name;
+    uint64_t start;     /* 1-based, inclusive, as in ref_regions.h */
+    uint64_t end;
+} pileup_range;
+
+
+typedef struct pileup_plan
+{
+    Vector inputs;      /* pileup_input */
+    Vector ranges;      /* pileup_range, in the order of the first input having them */
+} pileup_plan;
+
+
+static void CC pileup_input_whack( void *item, void *data )
+{
+    pileup_input * input = item;
+    free( input->path );
+    free( input->spot_group );
+    free( input );
+}
+
+
+static void CC pileup_range_whack( void *item, void *data )
+{
+    pileup_range * range = item;
+    free( range->ref_name );
+    free( range );
+}
+
+
+static rc_t add_pileup_input( pileup_plan * plan, const char * path, const char * spot_group )
+{
+    rc_t rc = 0;
+    pileup_input * input = calloc( 1, sizeof * input );
+    if ( input == NULL )
+        rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    else
+    {
+        input->path = string_dup_measure ( path, NULL );
+        if ( spot_group != NULL )
+            input->spot_group = string_dup_measure ( spot_group, NULL );
+        if ( input->path == NULL || ( spot_group != NULL && input->spot_group == NULL ) )
+            rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+        else
+            rc = VectorAppend ( &plan->inputs, NULL, input );
+        if ( rc != 0 )
+            pileup_input_whack( input, NULL );
+    }
+    return rc;
+}
+
+
+/* the on_section-callback of the planning: the same range as prepare_section_cb() would add */
+static rc_t CC plan_section_cb( prepare_ctx * ctx, const struct reference_range * range )
+{
+    pileup_plan * plan = ctx->data;
+    INSDC_coord_len len;
+    const char * name;
+    rc_t rc;
+
+    if ( ctx->db == NULL || ctx->refobj == NULL )
+    {
+        rc = SILENT_RC ( rcApp, rcNoTarg, rcOpening, rcSelf, rcInvalid );
+        PLOGERR( klogErr, ( klogErr, rc, "failed to process $(path)",
+            "path=%s", ctx->path == NULL ? "input argument" : ctx->path));
+        ReportSilence();
+        return rc;
+    }
+
+    rc = ReferenceObj_SeqLength( ctx->refobj, &len );
+    if ( rc != 0 )
+    {
+        LOGERR( klogInt, rc, "ReferenceObj_SeqLength() failed" );
+    }
+    else
+    {
+        rc = ReferenceObj_Name( ctx->refobj, &name );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "ReferenceObj_Name() failed" );
+        }
+    }
+    if ( rc == 0 )
+    {
+        uint64_t start, end;
+        uint32_t idx, count = VectorLength( &plan->ranges );
+        bool found = false;
+
+        if ( range == NULL )
+        {
+            start = 1;
+            end = ( len - start ) + 1;
+        }
+        else
+        {
+            start = get_ref_range_start( range );
+            end   = get_ref_range_end( range );
+        }
+        if ( start == 0 ) start = 1;
+        if ( ( end == 0 )||( end > len + 1 ) )
+        {
+            end = ( len - start ) + 1;
+        }
+
+        /* the other inputs have the same references, they are walked together */
+        for ( idx = 0; idx < count && !found; ++idx )
+        {
+            const pileup_range * r = VectorGet( &plan->ranges, idx );
+            found = ( r->start == start && r->end == end && cmp_pchar( r->ref_name, name ) == 0 );
+        }
+        if ( !found && start <= end )
+        {
+            pileup_range * r = calloc( 1, sizeof * r );
+            if ( r == NULL )
+                rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+            else
+            {
+                r->start = start;
+                r->end = end;
+                r->ref_name = string_dup_measure ( name, NULL );
+                if ( r->ref_name == NULL )
+                    rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+                else
+                    rc = VectorAppend ( &plan->ranges, NULL, r );
+                if ( rc != 0 )
+                    pileup_range_whack( r, NULL );
+            }
+        }
+    }
+    return rc;
+}
+
+
 typedef struct foreach_arg_ctx
 {
     pileup_options *options;
@@ -1309,6 +1488,7 @@ typedef struct foreach_arg_ctx
     ReferenceIterator *ref_iter;
     BSTree *ranges;
     Vector *cursor_ids;
+    pileup_plan *plan;      /* not NULL: collect the inputs and ranges for a parallel pileup */
 } foreach_arg_ctx;
 
 
@@ -1353,15 +1533,25 @@ static rc_t CC on_argument( const char * path, const char * spot_group, void * d
                 prep.use_evidence_alignments = ( ( ctx->options->cmn.tab_select & evidence_ats ) == evidence_ats );
                 prep.ref_iter = ctx->ref_iter;
                 prep.spot_group = spot_group;
-                prep.on_section = prepare_section_cb;
-                prep.data = ctx->cursor_ids;
+                if ( ctx->plan != NULL )
+                {
+                    rc = add_pileup_input( ctx->plan, path, spot_group );
+                    prep.on_section = plan_section_cb;
+                    prep.data = ctx->plan;
+                }
+                else
+                {
+                    prep.on_section = prepare_section_cb;
+                    prep.data = ctx->cursor_ids;
+                }
                 prep.path = path;
                 prep.db = NULL;
                 prep.prim_cur = NULL;
                 prep.sec_cur = NULL;
                 prep.ev_cur = NULL;
                 
-                rc = prepare_ref_iter( &prep, ctx->vdb_mgr, ctx->vdb_schema, path, ctx->ranges ); /* cmdline_cmn.c */
+                if ( rc == 0 )
+                    rc = prepare_ref_iter( &prep, ctx->vdb_mgr, ctx->vdb_schema, path, ctx->ranges ); /* cmdline_cmn.c */
                 if ( rc == 0 && prep.db == NULL )
                 {
                     rc = RC ( rcApp, rcNoTarg, rcOpening, rcSelf, rcInvalid );
@@ -1385,12 +1575,451 @@ static void CC cur_id_vector_entry_whack( void *item, void *data )
 }
 
 
+/* =========================================================================================== */
+
+/* parallel pileup: the planned ranges are cut into slices, every slice is walked on a
+   worker-thread by its own ReferenceIterator, loaded with the placements of this slice only.
+   An alignment overlapping the border of a slice is placed in both slices, every position
+   is walked by exactly one of them. The text of the slices is written in order by the main thread. */
+
+/* bases per slice */
+#define PILEUP_SLICE_LEN ( 256 * 1024 )
+
+#define PILEUP_SLICES_PER_THREAD 3
+
+/* text of a slice kept in memory, more goes into a temp. file */
+#define PILEUP_SLICE_MEM ( 16 * 1024 * 1024 )
+
+typedef struct pileup_slice
+{
+    uint64_t seq;
+    const char * ref_name;  /* owned by the plan */
+    uint64_t start;
+    uint64_t end;
+    struct pileup_out * out;
+    rc_t rc;
+} pileup_slice;
+
+
+typedef struct pileup_worker
+{
+    struct pileup_pool * pool;
+    KThread * thread;
+    pileup_options options;     /* a copy, with its own skiplist and output */
+    pileup_callback_data cb_data;
+    prepare_ctx * sources;      /* every input, opened by this worker */
+    uint32_t num_sources;
+    Vector cursor_ids;
+} pileup_worker;
+
+
+typedef struct pileup_pool
+{
+    pileup_options * options;
+    const pileup_plan * plan;
+    const VDBManager * vdb_mgr;
+    VSchema * vdb_schema;
+    BSTree * regions;
+
+    KQueue * walk_q;            /* slices to be walked */
+    KQueue * done_q;            /* walked slices */
+    pileup_worker * workers;
+    uint32_t num_workers;
+
+    pileup_slice * slices;
+    pileup_slice ** pending;    /* walked slices, by seq, until it is their turn */
+    pileup_slice ** idle;
+    uint32_t num_slices;
+    uint32_t num_idle;
+    uint64_t next_seq;
+    uint64_t next_write;
+} pileup_pool;
+
+
+static bool queue_sealed( rc_t rc )
+{
+    return ( GetRCState( rc ) == rcDone && GetRCObject( rc ) == ( enum RCObject )rcData );
+}
+
+
+static rc_t walk_pileup( ReferenceIterator *ref_iter, pileup_options *options )
+{
+    rc_t rc;
+    switch( options->function )
+    {
+        case sra_pileup_stat        : rc = walk_stat( ref_iter, options ); break;
+        case sra_pileup_counters    : rc = walk_counters( ref_iter, options ); break;
+        case sra_pileup_debug       : rc = walk_debug( ref_iter, options ); break;
+        case sra_pileup_mismatch    : rc = walk_mismatches( ref_iter, options ); break;
+        case sra_pileup_index       : rc = walk_index( ref_iter, options ); break;
+        case sra_pileup_varcount    : rc = walk_varcount( ref_iter, options ); break;
+        case sra_pileup_indels      : rc = walk_indels( ref_iter, options ); break;
+        default :  rc = walk_ref_iter( ref_iter, options ); break;
+    }
+    return rc;
+}
+
+
+static rc_t open_pileup_worker( pileup_worker * w )
+{
+    pileup_pool * pool = w->pool;
+    uint32_t idx, count = VectorLength( &pool->plan->inputs );
+    rc_t rc;
+
+    w->options = *pool->options;
+    w->options.skiplist = skiplist_make( pool->regions ); /* its position is per thread */
+    w->options.out = NULL;
+    w->cb_data.options = &w->options;
+    VectorInit ( &w->cursor_ids, 0, 20 );
+
+    rc = AlignMgrMakeRead ( &w->cb_data.almgr );
+    if ( rc != 0 )
+    {
+        LOGERR( klogInt, rc, "AlignMgrMake() failed" );
+    }
+    else
+    {
+        w->sources = calloc( count, sizeof w->sources[ 0 ] );
+        if ( w->sources == NULL )
+            rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+    }
+
+    for ( idx = 0; rc == 0 && idx < count; ++idx )
+    {
+        const pileup_input * input = VectorGet( &pool->plan->inputs, idx );
+        prepare_ctx * prep = &w->sources[ idx ];
+
+        prep->omit_qualities = w->options.omit_qualities;
+        prep->read_tlen = w->options.read_tlen;
+        prep->use_primary_alignments = ( ( w->options.cmn.tab_select & primary_ats ) == primary_ats );
+        prep->use_secondary_alignments = ( ( w->options.cmn.tab_select & secondary_ats ) == secondary_ats );
+        prep->use_evidence_alignments = ( ( w->options.cmn.tab_select & evidence_ats ) == evidence_ats );
+        prep->spot_group = input->spot_group;
+        prep->on_section = prepare_section_cb;
+        prep->data = &w->cursor_ids;
+        prep->path = input->path;
+
+        rc = open_prepare_ctx( prep, pool->vdb_mgr, pool->vdb_schema, input->path ); /* cmdline_cmn.c */
+        w->num_sources = idx + 1;
+    }
+    return rc;
+}
+
+
+static void close_pileup_worker( pileup_worker * w )
+{
+    uint32_t idx;
+    for ( idx = 0; idx < w->num_sources; ++idx )
+    {
+        prepare_ctx * prep = &w->sources[ idx ];
+        if ( prep->prim_cur != NULL ) VCursorRelease( prep->prim_cur );
+        if ( prep->sec_cur != NULL ) VCursorRelease( prep->sec_cur );
+        if ( prep->ev_cur != NULL ) VCursorRelease( prep->ev_cur );
+        close_prepare_ctx( prep );
+    }
+    free( w->sources );
+    if ( w->options.skiplist != NULL ) skiplist_release( w->options.skiplist );
+    if ( w->cb_data.almgr != NULL ) AlignMgrRelease ( w->cb_data.almgr );
+    VectorWhack ( &w->cursor_ids, cur_id_vector_entry_whack, NULL );
+}
+
+
+/* loads a ReferenceIterator with the placements of all inputs on the slice and walks it */
+static rc_t walk_pileup_slice( pileup_worker * w, pileup_slice * slice )
+{
+    ReferenceIterator *ref_iter;
+    PlacementRecordExtendFuncs cb_block;
+    BSTree regions;
+    rc_t rc;
+
+    cb_block.data = &w->cb_data;
+    cb_block.destroy = NULL;
+    cb_block.populate = populate_tooldata;
+    cb_block.alloc_size = alloc_size;
+    cb_block.fixed_size = 0;
+
+    BSTreeInit( &regions );
+    rc = add_region( &regions, slice->ref_name, slice->start, slice->end ); /* ref_regions.c */
+    if ( rc == 0 )
+    {
+        rc = AlignMgrMakeReferenceIterator ( w->cb_data.almgr, &ref_iter, &cb_block, w->options.minmapq );
+        if ( rc != 0 )
+        {
+            LOGERR( klogInt, rc, "AlignMgrMakeReferenceIterator() failed" );
+        }
+        else
+        {
+            const struct reference_range * range = get_ref_range( get_first_ref_node( &regions ), 0 );
+            uint32_t idx;
+
+            for ( idx = 0; rc == 0 && idx < w->num_sources; ++idx )
+            {
+                prepare_ctx * prep = &w->sources[ idx ];
+                if ( prep->reflist != NULL &&
+                     ReferenceList_Find( prep->reflist, &prep->refobj,
+                                         slice->ref_name, string_size( slice->ref_name ) ) == 0 )
+                {
+                    /* an input without this reference has nothing to add */
+                    prep->ref_iter = ref_iter;
+                    rc = prepare_section_cb( prep, range );
+                    ReferenceObj_Release( prep->refobj );
+                    prep->refobj = NULL;
+                }
+            }
+
+            if ( rc == 0 )
+            {
+                w->options.out = slice->out;
+                rc = walk_pileup( ref_iter, &w->options );
+                w->options.out = NULL;
+            }
+            ReferenceIteratorRelease( ref_iter );
+        }
+    }
+    free_ref_regions( &regions );
+    return rc;
+}
+
+
+static rc_t CC pileup_worker_thread( const KThread *self, void *data )
+{
+    pileup_worker * w = data;
+    pileup_pool * pool = w->pool;
+    rc_t rc_open = open_pileup_worker( w );
+    rc_t rc = 0;
+    bool done = false;
+
+    while ( rc == 0 && !done )
+    {
+        pileup_slice * slice;
+
+        rc = KQueuePop( pool->walk_q, ( void ** )&slice, NULL );
+        if ( rc == 0 )
+        {
+            /* without the inputs the slices fail, the main thread stops on the first one */
+            slice->rc = ( rc_open != 0 ) ? rc_open : walk_pileup_slice( w, slice );
+            /* the done_q can hold all slices, this never blocks */
+            rc = KQueuePush( pool->done_q, slice, NULL );
+            if ( rc != 0 )
+            {
+                LOGERR( klogErr, rc, "cannot push walked slice into queue" );
+            }
+        }
+        else if ( queue_sealed( rc ) )
+        {
+            done = true;
+            rc = 0;
+        }
+        else
+        {
+            LOGERR( klogErr, rc, "cannot pop slice from queue" );
+        }
+    }
+    close_pileup_worker( w );
+    return ( rc != 0 ) ? rc : rc_open;
+}
+
+
+/* waits for a slice to be walked, writes the slices that are next in order */
+static rc_t collect_pileup_slice( pileup_pool * pool )
+{
+    pileup_slice * slice;
+    rc_t rc = KQueuePop( pool->done_q, ( void ** )&slice, NULL );
+    if ( rc != 0 )
+    {
+        LOGERR( klogErr, rc, "cannot pop walked slice from queue" );
+        return rc;
+    }
+    /* at most num_slices consecutive slices are in flight, each has its own slot */
+    pool->pending[ slice->seq % pool->num_slices ] = slice;
+    while ( rc == 0 )
+    {
+        uint32_t slot = pool->next_write % pool->num_slices;
+
+        slice = pool->pending[ slot ];
+        if ( slice == NULL || slice->seq != pool->next_write )
+            break;
+        pool->pending[ slot ] = NULL;
+        pool->next_write++;
+        rc = slice->rc;
+        if ( rc == 0 )
+            rc = pileup_out_write( slice->out );
+        pool->idle[ pool->num_idle++ ] = slice;
+    }
+    return rc;
+}
+
+
+static rc_t submit_pileup_slice( pileup_pool * pool, const char * ref_name, uint64_t start, uint64_t end )
+{
+    rc_t rc = 0;
+    pileup_slice * slice;
+
+    while ( rc == 0 && pool->num_idle == 0 )
+        rc = collect_pileup_slice( pool );
+    if ( rc == 0 )
+    {
+        slice = pool->idle[ --pool->num_idle ];
+        slice->seq = pool->next_seq++;
+        slice->ref_name = ref_name;
+        slice->start = start;
+        slice->end = end;
+        slice->rc = 0;
+        /* the walk_q can hold all slices, this never blocks */
+        rc = KQueuePush( pool->walk_q, slice, NULL );
+        if ( rc != 0 )
+        {
+            LOGERR( klogErr, rc, "cannot push slice into queue" );
+        }
+    }
+    return rc;
+}
+
+
+/* the statistic of function stat runs over the whole reference-window, its slices are whole ranges */
+static rc_t run_pileup_pool( pileup_pool * pool )
+{
+    bool whole_ranges = ( pool->options->function == sra_pileup_stat );
+    uint32_t idx, count = VectorLength( &pool->plan->ranges );
+    rc_t rc = 0;
+
+    if ( whole_ranges )
+        rc = print_stat_header_line();
+    for ( idx = 0; rc == 0 && idx < count; ++idx )
+    {
+        const pileup_range * r = VectorGet( &pool->plan->ranges, idx );
+        uint64_t start = r->start;
+
+        while ( rc == 0 && start <= r->end )
+        {
+            uint64_t end = r->end;
+            if ( !whole_ranges && end - start >= PILEUP_SLICE_LEN )
+                end = start + PILEUP_SLICE_LEN - 1;
+            rc = submit_pileup_slice( pool, r->ref_name, start, end );
+            start = end + 1;
+            if ( rc == 0 )
+                rc = Quitting();
+        }
+    }
+    while ( rc == 0 && pool->next_write < pool->next_seq )
+        rc = collect_pileup_slice( pool );
+    return rc;
+}
+
+
+static rc_t release_pileup_pool( pileup_pool * pool, rc_t rc )
+{
+    uint32_t idx;
+
+    if ( pool->walk_q != NULL )
+        KQueueSeal( pool->walk_q );
+    for ( idx = 0; idx < pool->num_workers; ++idx )
+    {
+        pileup_worker * w = &pool->workers[ idx ];
+        if ( w->thread != NULL )
+        {
+            rc_t rc_thread;
+            rc_t rc1 = KThreadWait( w->thread, &rc_thread );
+            if ( rc1 == 0 )
+                rc1 = rc_thread;
+            if ( rc == 0 )
+                rc = rc1;
+            KThreadRelease( w->thread );
+        }
+    }
+    for ( idx = 0; idx < pool->num_slices; ++idx )
+        release_pileup_out( pool->slices[ idx ].out );
+    KQueueRelease( pool->walk_q );
+    KQueueRelease( pool->done_q );
+    free( pool->workers );
+    free( pool->slices );
+    free( pool->pending );
+    free( pool->idle );
+    return rc;
+}
+
+
+/* the functions which write their output only through pileup_out_print() */
+static bool can_walk_parallel( const pileup_options * options )
+{
+    /* the columnar file is written by the walk itself, in the order of the positions */
+    if ( options->num_threads < 2 || options->cmn.no_mt || options->columnar_path != NULL )
+        return false;
+    switch( options->function )
+    {
+        case sra_pileup_samtools    :
+        case sra_pileup_counters    :
+        case sra_pileup_stat        :
+        case sra_pileup_varcount    :
+        case sra_pileup_indels      : return true;
+    }
+    return false;
+}
+
+
+static rc_t parallel_pileup( pileup_options * options, const pileup_plan * plan,
+                             const VDBManager * vdb_mgr, VSchema * vdb_schema, BSTree * regions )
+{
+    pileup_pool pool;
+    uint32_t idx;
+    rc_t rc = 0;
+
+    memset( &pool, 0, sizeof pool );
+    pool.options = options;
+    pool.plan = plan;
+    pool.vdb_mgr = vdb_mgr;
+    pool.vdb_schema = vdb_schema;
+    pool.regions = regions;
+    pool.num_workers = options->num_threads;
+    pool.num_slices = pool.num_workers * PILEUP_SLICES_PER_THREAD;
+    pool.workers = calloc( pool.num_workers, sizeof pool.workers[ 0 ] );
+    pool.slices = calloc( pool.num_slices, sizeof pool.slices[ 0 ] );
+    pool.pending = calloc( pool.num_slices, sizeof pool.pending[ 0 ] );
+    pool.idle = calloc( pool.num_slices, sizeof pool.idle[ 0 ] );
+    if ( pool.workers == NULL || pool.slices == NULL || pool.pending == NULL || pool.idle == NULL )
+        rc = RC ( rcApp, rcNoTarg, rcConstructing, rcMemory, rcExhausted );
+
+    for ( idx = 0; rc == 0 && idx < pool.num_slices; ++idx )
+    {
+        rc = make_pileup_out( &pool.slices[ idx ].out, PILEUP_SLICE_MEM );
+        if ( rc == 0 )
+            pool.idle[ pool.num_idle++ ] = &pool.slices[ idx ];
+    }
+    if ( rc == 0 )
+        rc = KQueueMake( &pool.walk_q, pool.num_slices );
+    if ( rc == 0 )
+        rc = KQueueMake( &pool.done_q, pool.num_slices );
+    if ( rc != 0 )
+    {
+        LOGERR( klogErr, rc, "cannot make slices for the pileup-threads" );
+    }
+
+    for ( idx = 0; rc == 0 && idx < pool.num_workers; ++idx )
+    {
+        pileup_worker * w = &pool.workers[ idx ];
+        w->pool = &pool;
+        rc = KThreadMake( &w->thread, pileup_worker_thread, w );
+        if ( rc != 0 )
+        {
+            w->thread = NULL;
+            LOGERR( klogErr, rc, "cannot start pileup-thread" );
+        }
+    }
+
+    if ( rc == 0 )
+        rc = run_pileup_pool( &pool );
+    return release_pileup_pool( &pool, rc );
+}
+
+
 static rc_t pileup_main( Args * args, pileup_options *options )
 {
     foreach_arg_ctx arg_ctx;
     pileup_callback_data cb_data;
     KDirectory * dir = NULL;
     Vector cur_ids_vector;
+    pileup_plan plan;
+    bool parallel = can_walk_parallel( options );
 
     /* (1) make the align-manager ( necessary to make a ReferenceIterator... ) */
     rc_t rc = AlignMgrMakeRead ( &cb_data.almgr );
@@ -1404,6 +2033,7 @@ static rc_t pileup_main( Args * args, pileup_options *options )
     arg_ctx.options = options;
     arg_ctx.vdb_schema = NULL;
     arg_ctx.cursor_ids = &cur_ids_vector;
+    arg_ctx.plan = NULL;
 
     /* (2) make the reference-iterator */
     if ( rc == 0 )
@@ -1508,6 +2138,17 @@ static rc_t pileup_main( Args * args, pileup_options *options )
         }
     }
 
+    if ( rc == 0 && options->columnar_path != NULL )
+    {
+        if ( options->function != sra_pileup_counters && options->function != sra_pileup_stat )
+        {
+            rc = RC ( rcApp, rcArgv, rcAccessing, rcParam, rcInvalid );
+            LOGERR( klogErr, rc, "the columnar output needs function count or stat" );
+        }
+        else
+            rc = make_pileup_columns( &options->columns, options->columnar_path, options->columnar_pack ); /* pileup_columns.c */
+    }
+
     /* (5) loop through the given input-filenames and load the ref-iter with it's input */
     if ( rc == 0 )
     {
@@ -1521,32 +2162,41 @@ static rc_t pileup_main( Args * args, pileup_options *options )
             options->skiplist = skiplist_make( &regions ); /* create skiplist for neighboring slices */
 
             arg_ctx.ranges = &regions;
+            if ( parallel )
+            {
+                VectorInit ( &plan.inputs, 0, 5 );
+                VectorInit ( &plan.ranges, 0, 32 );
+                arg_ctx.plan = &plan;
+            }
             rc = foreach_argument( args, dir, options->div_by_spotgrp, &empty, on_argument, &arg_ctx ); /* cmdline_cmn.c */
             if ( empty )
             {
                 Usage ( args );
                 rc = RC ( rcApp, rcArgv, rcAccessing, rcSelf, rcInsufficient );
             }
+            if ( parallel )
+            {
+                /* the ref-iter stays empty, the slices are walked by the pileup-threads */
+                if ( rc == 0 )
+                    rc = parallel_pileup( options, &plan, arg_ctx.vdb_mgr, arg_ctx.vdb_schema, &regions );
+                VectorWhack ( &plan.inputs, pileup_input_whack, NULL );
+                VectorWhack ( &plan.ranges, pileup_range_whack, NULL );
+            }
             free_ref_regions( &regions );
         }
     }
 
     /* (6) walk the "loaded" ref-iterator ===> perform the pileup */
-    if ( rc == 0 )
+    if ( rc == 0 && !parallel )
+        rc = walk_pileup( arg_ctx.ref_iter, options );
+
+    if ( options->columns != NULL )
     {
-        /* ============================================== */
-        switch( options->function )
-        {
-            case sra_pileup_stat        : rc = walk_stat( arg_ctx.ref_iter, options ); break;
-            case sra_pileup_counters    : rc = walk_counters( arg_ctx.ref_iter, options ); break;
-            case sra_pileup_debug       : rc = walk_debug( arg_ctx.ref_iter, options ); break;
-            case sra_pileup_mismatch    : rc = walk_mismatches( arg_ctx.ref_iter, options ); break;
-            case sra_pileup_index       : rc = walk_index( arg_ctx.ref_iter, options ); break;
-            case sra_pileup_varcount    : rc = walk_varcount( arg_ctx.ref_iter, options ); break;
-			case sra_pileup_indels      : rc = walk_indels( arg_ctx.ref_iter, options ); break;
-            default :  rc = walk_ref_iter( arg_ctx.ref_iter, options ); break;
-        }
-        /* ============================================== */
+        /* writes the index of the columnar file */
+        rc_t rc1 = release_pileup_columns( options->columns );
+        options->columns = NULL;
+        if ( rc == 0 )
+            rc = rc1;
     }
 
     if ( arg_ctx.vdb_mgr != NULL ) VDBManagerRelease( arg_ctx.vdb_mgr );
@@ -1592,6 +2242,8 @@ rc_t CC KMain( int argc, char *argv [] )
                     enum out_redir_mode mode;
 
                     options.skiplist = NULL;
+                    options.out = NULL;
+                    options.columns = NULL;
                     
                     if ( options.cmn.gzip_output )
                         mode = orm_gzip;
@@ -63,6 +63,9 @@ struct SimpleColumnReader
     const VCursor *curs;
     uint32_t idx;
 
+    /* true if the cursor was created for this reader alone */
+    bool own_curs;
+
     uint32_t full_spec_size;
     char full_spec [ 1 ];
 };
@@ -206,6 +209,7 @@ ColumnReader *TablePairMakeColumnReader ( TablePair *self, const ctx_t *ctx,
                     ColumnReaderInit ( & col -> dad, ctx, & SimpleColumnReader_vt );
                     col -> curs = curs;
                     col -> idx = idx;
+                    col -> own_curs = opt_curs == NULL;
                     col -> full_spec_size = ( uint32_t ) full_spec_size;
 
                     rc = string_printf ( col -> full_spec, full_spec_size + 1, NULL,
@@ -312,6 +316,9 @@ struct SimpleColumnWriter
     VCursor *curs;
     uint32_t idx;
 
+    /* true if the cursor was created for this writer alone */
+    bool own_curs;
+
     uint32_t full_spec_size;
     char full_spec [ 1 ];
 };
@@ -493,6 +500,7 @@ ColumnWriter *TablePairMakeColumnWriter ( TablePair *self, const ctx_t *ctx,
                     ColumnWriterInit ( & col -> dad, ctx, & SimpleColumnWriter_vt, false );
                     col -> curs = curs;
                     col -> idx = idx;
+                    col -> own_curs = opt_curs == NULL;
 
                     col -> full_spec_size = ( uint32_t ) full_spec_size;
                     rc = string_printf ( col -> full_spec, full_spec_size + 1, NULL,
@@ -791,6 +799,41 @@ void ColumnPairCopy ( ColumnPair *self, const ctx_t *ctx, RowSet *rs )
 }
 
 
+/* CopyIds
+ *  copy the given rows from source to destination column
+ *  the caller has drained them from the RowSet and runs Pre/PostCopy
+ */
+void ColumnPairCopyIds ( ColumnPair *self, const ctx_t *ctx, const int64_t *row_ids, size_t count )
+{
+    FUNC_ENTRY ( ctx );
+
+    size_t i;
+    for ( i = 0; ! FAILED () && i < count; ++ i )
+    {
+        const void *base;
+        uint32_t elem_bits, boff, row_len;
+
+        TRY ( base = ColumnReaderRead ( self -> reader, ctx, row_ids [ i ], & elem_bits, & boff, & row_len ) )
+        {
+            ColumnWriterWrite ( self -> writer, ctx, elem_bits, base, boff, row_len );
+        }
+    }
+}
+
+
+/* IsSimple
+ *  true if reader and writer are the simple, cursor-based implementations
+ *  and each created its own cursor rather than sharing the caller's
+ */
+bool ColumnPairIsSimple ( const ColumnPair *self )
+{
+    return self -> reader -> vt == & SimpleColumnReader_vt &&
+        ( ( const SimpleColumnReader* ) self -> reader ) -> own_curs &&
+        self -> writer -> vt == & SimpleColumnWriter_vt &&
+        ( ( const SimpleColumnWriter* ) self -> writer ) -> own_curs;
+}
+
+
 /* CopyStatic
  *  copy static column from source to destination
  */
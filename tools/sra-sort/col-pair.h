@@ -314,6 +314,20 @@ void ColumnPairPostCopy ( const ColumnPair *self, const ctx_t *ctx );
 void ColumnPairCopy ( ColumnPair *self, const ctx_t *ctx, struct RowSet *rs );
 
 
+/* CopyIds
+ *  copy the given rows from source to destination column
+ *  the caller has drained them from the RowSet and runs Pre/PostCopy
+ */
+void ColumnPairCopyIds ( ColumnPair *self, const ctx_t *ctx, const int64_t *row_ids, size_t count );
+
+
+/* IsSimple
+ *  true if reader and writer are the simple, cursor-based implementations
+ *  and neither cursor is shared, so the pair can be copied on its own thread
+ */
+bool ColumnPairIsSimple ( const ColumnPair *self );
+
+
 /* CopyStatic
  *  copy static column from source to destination
  */
@@ -25,6 +25,7 @@
  */
 
 #include "idx-mapping.h"
+#include "radix-sort.h"
 #include "ctx.h"
 
 #include <klib/sort.h>
@@ -64,6 +65,11 @@ int64_t CC IdxMappingCmpNew ( const void *a, const void *b, void *data )
 
 void IdxMappingSortOld ( IdxMapping *self, const ctx_t *ctx, size_t count )
 {
+    static const RadixKey key = { offsetof ( IdxMapping, old_id ), true };
+
+    if ( RadixSort ( self, ctx, count, sizeof * self, & key, 1 ) )
+        return;
+
 #define CMP( a, b ) \
     ( ( T ( a ) -> old_id < T ( b ) -> old_id ) ? -1 : ( T ( a ) -> old_id > T ( b ) -> old_id ) )
 
@@ -74,6 +80,11 @@ void IdxMappingSortOld ( IdxMapping *self, const ctx_t *ctx, size_t count )
 
 void IdxMappingSortNew ( IdxMapping *self, const ctx_t *ctx, size_t count )
 {
+    static const RadixKey key = { offsetof ( IdxMapping, new_id ), true };
+
+    if ( RadixSort ( self, ctx, count, sizeof * self, & key, 1 ) )
+        return;
+
 #define CMP( a, b ) \
     ( ( T ( a ) -> new_id < T ( b ) -> new_id ) ? -1 : ( T ( a ) -> new_id > T ( b ) -> new_id ) )
 
@@ -23,7 +23,6 @@
  * ===========================================================================
  *
  */
-
 #include "map-file.h"
 #include "idx-mapping.h"
 #include "ctx.h"
@@ -34,23 +33,396 @@
 
 #include <kfs/directory.h>
 #include <kfs/file.h>
-#include <kfs/buffile.h>
+#include <kfs/mmap.h>
 #include <klib/refcount.h>
 #include <klib/sort.h>
 #include <klib/rc.h>
 
 #include <string.h>
-#include <endian.h>
-#include <byteswap.h>
+
+#if ! WINDOWS
+#include <sys/mman.h>
+#endif
 
 #include "except.h"
 
 FILE_ENTRY ( map-file );
 
 
+/*--------------------------------------------------------------------------
+ * MapStream
+ *  a temporary file of 64-bit values, written in order
+ *
+ *  the values are kept in blocks of MAP_STREAM_BLOCK_IDS, every block
+ *  encoded as the smaller of
+ *    FOR   - the minimum, then every value minus the minimum in the fewest bytes
+ *    DELTA - the first value, then the zig-zag LEB128 difference to the previous one
+ *  ids in new-id order come in mostly monotonic runs, so either takes
+ *  a few bits per id. the block being filled stays in memory.
+ *
+ *  reads decode a whole block and fetch the blocks following it
+ *  in the same read, up to the readahead window
+ */
+#define MAP_STREAM_BLOCK_IDS 4096
+#define MAP_STREAM_MAX_BLOCK ( 1 + 1 + 8 + 8 * MAP_STREAM_BLOCK_IDS )
+#define MAP_STREAM_MAX_WINDOW ( 64 * 1024 * 1024 )
+
+enum { msFOR, msDelta };
+
+typedef struct MapStream MapStream;
+struct MapStream
+{
+    KFile *f;
+
+    /* file offsets of the blocks written, num_blocks + 1 entries */
+    uint64_t *block_off;
+    size_t num_blocks, max_blocks;
+
+    /* values appended, including the block being filled */
+    uint64_t count;
+    int64_t *tail;
+
+    /* last decoded block */
+    int64_t *cur;
+    size_t cur_block;
+
+    /* readahead window, also used to encode */
+    uint8_t *window;
+    uint64_t win_pos;
+    size_t win_len, win_size;
+};
+
+static
+void MapStreamInit ( MapStream *self, const ctx_t *ctx, KFile *f, size_t win_size )
+{
+    FUNC_ENTRY ( ctx );
+
+    memset ( self, 0, sizeof * self );
+
+    /* a window beyond a few blocks buys little in a sequential read */
+    if ( win_size < MAP_STREAM_MAX_BLOCK )
+        win_size = MAP_STREAM_MAX_BLOCK;
+    else if ( win_size > MAP_STREAM_MAX_WINDOW )
+        win_size = MAP_STREAM_MAX_WINDOW;
+
+    TRY ( self -> block_off = MemAlloc ( ctx, sizeof self -> block_off [ 0 ] * 256, true ) )
+    {
+        self -> max_blocks = 255;
+        TRY ( self -> tail = MemAlloc ( ctx, sizeof self -> tail [ 0 ] * MAP_STREAM_BLOCK_IDS * 2, false ) )
+        {
+            self -> cur = self -> tail + MAP_STREAM_BLOCK_IDS;
+            self -> cur_block = ~ ( size_t ) 0;
+
+            TRY ( self -> window = MemAlloc ( ctx, win_size, false ) )
+            {
+                self -> win_size = win_size;
+                self -> f = f;
+                return;
+            }
+
+            MemFree ( ctx, self -> tail, sizeof self -> tail [ 0 ] * MAP_STREAM_BLOCK_IDS * 2 );
+        }
+
+        MemFree ( ctx, self -> block_off, sizeof self -> block_off [ 0 ] * 256 );
+    }
+
+    memset ( self, 0, sizeof * self );
+}
+
+static
+void MapStreamDestroy ( MapStream *self, const ctx_t *ctx )
+{
+    FUNC_ENTRY ( ctx );
+
+    if ( self -> f != NULL )
+    {
+        rc_t rc = KFileRelease ( self -> f );
+        if ( rc != 0 )
+            SYSTEM_ERROR ( rc, "KFileRelease failed on id map stream" );
+
+        MemFree ( ctx, self -> window, self -> win_size );
+        MemFree ( ctx, self -> tail, sizeof self -> tail [ 0 ] * MAP_STREAM_BLOCK_IDS * 2 );
+        MemFree ( ctx, self -> block_off, sizeof self -> block_off [ 0 ] * ( self -> max_blocks + 1 ) );
+
+        memset ( self, 0, sizeof * self );
+    }
+}
+
+/* Encode
+ *  returns the size of the encoded block
+ */
+static
+size_t MapStreamEncode ( const int64_t *v, size_t n, uint8_t *out )
+{
+    size_t i, j, width, for_size, delta_size;
+    uint64_t range;
+    int64_t min = v [ 0 ], max = v [ 0 ];
+
+    for ( delta_size = 1 + 8, i = 1; i < n; ++ i )
+    {
+        uint64_t d = ( uint64_t ) v [ i ] - ( uint64_t ) v [ i - 1 ];
+        uint64_t zz = ( d << 1 ) ^ ( uint64_t ) ( ( int64_t ) d >> 63 );
+        for ( ++ delta_size; zz >= 0x80; zz >>= 7 )
+            ++ delta_size;
+
+        if ( v [ i ] < min )
+            min = v [ i ];
+        else if ( v [ i ] > max )
+            max = v [ i ];
+    }
+
+    range = ( uint64_t ) max - ( uint64_t ) min;
+    for ( width = 0; width < 8 && ( range >> ( width * 8 ) ) != 0; ++ width )
+        ( void ) 0;
+    for_size = 1 + 1 + 8 + n * width;
+
+    if ( for_size <= delta_size )
+    {
+        out [ 0 ] = msFOR;
+        out [ 1 ] = ( uint8_t ) width;
+        for ( j = 0; j < 8; ++ j )
+            out [ 2 + j ] = ( uint8_t ) ( ( uint64_t ) min >> ( j * 8 ) );
+        out += 10;
+        for ( i = 0; i < n; ++ i )
+        {
+            uint64_t val = ( uint64_t ) v [ i ] - ( uint64_t ) min;
+            for ( j = 0; j < width; ++ j )
+                * out ++ = ( uint8_t ) ( val >> ( j * 8 ) );
+        }
+        return for_size;
+    }
+
+    out [ 0 ] = msDelta;
+    for ( j = 0; j < 8; ++ j )
+        out [ 1 + j ] = ( uint8_t ) ( ( uint64_t ) v [ 0 ] >> ( j * 8 ) );
+    out += 9;
+    for ( i = 1; i < n; ++ i )
+    {
+        uint64_t d = ( uint64_t ) v [ i ] - ( uint64_t ) v [ i - 1 ];
+        uint64_t zz = ( d << 1 ) ^ ( uint64_t ) ( ( int64_t ) d >> 63 );
+        for ( ; zz >= 0x80; zz >>= 7 )
+            * out ++ = ( uint8_t ) ( zz | 0x80 );
+        * out ++ = ( uint8_t ) zz;
+    }
+    return delta_size;
+}
+
+/* Decode
+ *  returns false if the block is damaged
+ */
+static
+bool MapStreamDecode ( const uint8_t *in, size_t size, int64_t *v, size_t n )
+{
+    size_t i, j;
+    uint64_t val;
+    const uint8_t *end = in + size;
+
+    if ( size < 9 )
+        return false;
+
+    switch ( in [ 0 ] )
+    {
+    case msFOR:
+    {
+        uint64_t min;
+        size_t width = in [ 1 ];
+        if ( width > 8 || size != 10 + n * width )
+            return false;
+        for ( min = 0, j = 8; j > 0; -- j )
+            min = ( min << 8 ) | in [ 1 + j ];
+        for ( in += 10, i = 0; i < n; ++ i, in += width )
+        {
+            for ( val = 0, j = width; j > 0; -- j )
+                val = ( val << 8 ) | in [ j - 1 ];
+            v [ i ] = ( int64_t ) ( min + val );
+        }
+        return true;
+    }
+    case msDelta:
+        for ( val = 0, j = 8; j > 0; -- j )
+            val = ( val << 8 ) | in [ j ];
+        v [ 0 ] = ( int64_t ) val;
+        for ( in += 9, i = 1; i < n; ++ i )
+        {
+            uint64_t zz = 0;
+            uint32_t shift;
+            for ( shift = 0; ; shift += 7 )
+            {
+                if ( in == end || shift > 63 )
+                    return false;
+                zz |= ( uint64_t ) ( * in & 0x7F ) << shift;
+                if ( ( * in ++ & 0x80 ) == 0 )
+                    break;
+            }
+            val += ( zz >> 1 ) ^ ( 0 - ( zz & 1 ) );
+            v [ i ] = ( int64_t ) val;
+        }
+        return in == end;
+    }
+
+    return false;
+}
+
+/* Append
+ *  sets the value at idx, which must not be below the count
+ *  any values skipped are 0
+ */
+static
+void MapStreamAppend ( MapStream *self, const ctx_t *ctx, uint64_t idx, int64_t value )
+{
+    FUNC_ENTRY ( ctx );
+
+    rc_t rc;
+
+    if ( idx < self -> count )
+    {
+        rc = RC ( rcExe, rcFile, rcWriting, rcId, rcInvalid );
+        INTERNAL_ERROR ( rc, "id map stream is written out of order ( %lu < %lu )", idx, self -> count );
+        return;
+    }
+
+    while ( self -> count <= idx )
+    {
+        size_t at = ( size_t ) ( self -> count % MAP_STREAM_BLOCK_IDS );
+        self -> tail [ at ] = ( self -> count == idx ) ? value : 0;
+        ++ self -> count;
+
+        if ( at + 1 == MAP_STREAM_BLOCK_IDS )
+        {
+            size_t num_writ, size;
+            uint64_t pos = self -> block_off [ self -> num_blocks ];
+
+            if ( self -> num_blocks == self -> max_blocks )
+            {
+                uint64_t *block_off;
+                size_t max_blocks = self -> max_blocks * 2 + 1;
+                TRY ( block_off = MemAlloc ( ctx, sizeof block_off [ 0 ] * ( max_blocks + 1 ), false ) )
+                {
+                    memmove ( block_off, self -> block_off, sizeof block_off [ 0 ] * ( self -> num_blocks + 1 ) );
+                    MemFree ( ctx, self -> block_off, sizeof block_off [ 0 ] * ( self -> max_blocks + 1 ) );
+                    self -> block_off = block_off;
+                    self -> max_blocks = max_blocks;
+                }
+                CATCH_ALL ()
+                {
+                    ANNOTATE ( "failed to extend id map stream index" );
+                    return;
+                }
+            }
+
+            /* the window is gone */
+            self -> win_len = 0;
+            size = MapStreamEncode ( self -> tail, MAP_STREAM_BLOCK_IDS, self -> window );
+
+            rc = KFileWriteAll ( self -> f, pos, self -> window, size, & num_writ );
+            if ( rc == 0 && num_writ != size )
+                rc = RC ( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+            if ( rc != 0 )
+            {
+                SYSTEM_ERROR ( rc, "failed to write id map stream" );
+                return;
+            }
+
+            self -> block_off [ ++ self -> num_blocks ] = pos + size;
+        }
+    }
+}
+
+/* LoadBlock
+ *  decodes a block into "cur", reading ahead into the window if it is not there
+ */
+static
+void MapStreamLoadBlock ( MapStream *self, const ctx_t *ctx, size_t block )
+{
+    FUNC_ENTRY ( ctx );
+
+    rc_t rc;
+    uint64_t pos = self -> block_off [ block ];
+    size_t size = ( size_t ) ( self -> block_off [ block + 1 ] - pos );
+
+    if ( pos < self -> win_pos || pos + size > self -> win_pos + self -> win_len )
+    {
+        uint64_t eof = self -> block_off [ self -> num_blocks ];
+        size_t num_read, to_read = self -> win_size;
+        if ( pos + to_read > eof )
+            to_read = ( size_t ) ( eof - pos );
+
+        self -> win_len = 0;
+        rc = KFileReadAll ( self -> f, pos, self -> window, to_read, & num_read );
+        if ( rc == 0 && num_read < size )
+            rc = RC ( rcExe, rcFile, rcReading, rcTransfer, rcIncomplete );
+        if ( rc != 0 )
+        {
+            SYSTEM_ERROR ( rc, "failed to read id map stream" );
+            return;
+        }
+
+        self -> win_pos = pos;
+        self -> win_len = num_read;
+    }
+
+    if ( ! MapStreamDecode ( & self -> window [ pos - self -> win_pos ], size, self -> cur, MAP_STREAM_BLOCK_IDS ) )
+    {
+        rc = RC ( rcExe, rcFile, rcReading, rcData, rcCorrupt );
+        INTERNAL_ERROR ( rc, "damaged block %zu in id map stream", block );
+        return;
+    }
+
+    self -> cur_block = block;
+}
+
+/* Read
+ *  reads up to max_count values starting at idx
+ *  returns the number read
+ */
+static
+size_t MapStreamRead ( MapStream *self, const ctx_t *ctx, uint64_t idx, int64_t *v, size_t max_count )
+{
+    FUNC_ENTRY ( ctx );
+
+    size_t total;
+
+    if ( idx >= self -> count )
+        return 0;
+    if ( ( uint64_t ) max_count > self -> count - idx )
+        max_count = ( size_t ) ( self -> count - idx );
+
+    for ( total = 0; total < max_count; )
+    {
+        const int64_t *src;
+        size_t block = ( size_t ) ( ( idx + total ) / MAP_STREAM_BLOCK_IDS );
+        size_t at = ( size_t ) ( ( idx + total ) % MAP_STREAM_BLOCK_IDS );
+        size_t n = MAP_STREAM_BLOCK_IDS - at;
+        if ( n > max_count - total )
+            n = max_count - total;
+
+        if ( block == self -> num_blocks )
+            src = self -> tail;
+        else
+        {
+            if ( block != self -> cur_block )
+            {
+                ON_FAIL ( MapStreamLoadBlock ( self, ctx, block ) )
+                    return 0;
+            }
+            src = self -> cur;
+        }
+
+        memmove ( & v [ total ], & src [ at ], n * sizeof v [ 0 ] );
+        total += n;
+    }
+
+    return total;
+}
+
+
 /*--------------------------------------------------------------------------
  * MapFile
  *  a file for storing id mappings
+ *
+ *  old=>new ids are written and looked up in random order: they are
+ *  kept packed to id_size bytes in a memory-mapped file.
+ *  new=>old ids and poslen are written in new-id order: they are MapStreams.
  */
 struct MapFile
 {
@@ -58,34 +430,72 @@ struct MapFile
     uint64_t num_ids;
     uint64_t num_mapped_ids;
     int64_t max_new_id;
-    KFile *f_old, *f_new, *f_pos;
+
+    /* old=>new */
+    KFile *f_old;
+    KMMap *mm_old;
+    uint8_t *old_map;
+
+    MapStream s_new, s_pos;
+
     size_t id_size;
     KRefcount refcount;
+    bool random;
 };
 
 
+/* AdviseOld
+ *  tells the kernel how the old=>new map will be used next
+ */
+#define MAP_FILE_READAHEAD ( 4 * 1024 * 1024 )
+
+static
+void MapFileAdviseOld ( const MapFile *self, uint64_t pos, uint64_t size, int advice )
+{
+#if ! WINDOWS
+    uint64_t end, eof = self -> num_ids * self -> id_size;
+    const size_t pgsize = 4096;
+
+    if ( self -> old_map == NULL || pos >= eof )
+        return;
+
+    end = pos + size;
+    if ( end > eof )
+        end = eof;
+    pos &= ~ ( uint64_t ) ( pgsize - 1 );
+
+    madvise ( self -> old_map + pos, ( size_t ) ( end - pos ), advice );
+#endif
+}
+
+#if WINDOWS
+#define MADV_RANDOM 0
+#define MADV_SEQUENTIAL 0
+#define MADV_WILLNEED 0
+#endif
+
+
 /* Whack
  */
 static
 void MapFileWhack ( MapFile *self, const ctx_t *ctx )
 {
     FUNC_ENTRY ( ctx );
-    rc_t rc = KFileRelease ( self -> f_old );
+    rc_t rc = KMMapRelease ( self -> mm_old );
     if ( rc != 0 )
-        SYSTEM_ERROR ( rc, "KFileRelease failed on old=>new" );
+        SYSTEM_ERROR ( rc, "KMMapRelease failed on old=>new" );
     else
     {
-        rc = KFileRelease ( self -> f_new );
+        rc = KFileRelease ( self -> f_old );
         if ( rc != 0 )
-            ABORT ( rc, "KFileRelease failed on new=>old" );
-        else if ( self -> f_pos != NULL )
+            SYSTEM_ERROR ( rc, "KFileRelease failed on old=>new" );
+        else
         {
-            rc = KFileRelease ( self -> f_pos );
-            if ( rc != 0 )
-                ABORT ( rc, "KFileRelease failed on global poslen temp column" );
+            MapStreamDestroy ( & self -> s_new, ctx );
+            MapStreamDestroy ( & self -> s_pos, ctx );
+
+            MemFree ( ctx, self, sizeof * self );
         }
-        
-        MemFree ( ctx, self, sizeof * self );
     }
 }
 
@@ -95,15 +505,12 @@ void MapFileWhack ( MapFile *self, const ctx_t *ctx )
  */
 static
 void MapFileMakeFork ( KFile **fp, const ctx_t *ctx, const char *name,
-    KDirectory *wd, const char *tmpdir, int pid, size_t bsize, const char *fork )
+    KDirectory *wd, const char *tmpdir, int pid, const char *fork )
 {
     FUNC_ENTRY ( ctx );
 
     /* create temporary KFile */
-    rc_t rc;
-    KFile *backing;
-
-    rc = KDirectoryCreateFile ( wd, & backing, true,
+    rc_t rc = KDirectoryCreateFile ( wd, fp, true,
         0600, kcmInit | kcmParents, "%s/sra-sort-%s.%s.%d", tmpdir, name, fork, pid );
     if ( rc != 0 )
         SYSTEM_ERROR ( rc, "failed to create %s id map file '%s'", fork, name );
@@ -119,13 +526,20 @@ void MapFileMakeFork ( KFile **fp, const ctx_t *ctx, const char *name,
                 WARN ( "failed to unlink %s id map file '%s'", fork, name );
         }
 #endif
+    }
+}
 
-        /* create a read/write buffer file */
-        rc = KBufFileMakeWrite ( fp, backing, true, bsize );
-        if ( rc != 0 )
-            INTERNAL_ERROR ( rc, "failed to create buffer for %s id map file '%s'", fork, name );
+static
+void MapFileMakeStream ( MapStream *s, const ctx_t *ctx, const char *name,
+    KDirectory *wd, const Tool *tp, const char *fork )
+{
+    FUNC_ENTRY ( ctx );
 
-        KFileRelease ( backing );
+    KFile *f;
+    TRY ( MapFileMakeFork ( & f, ctx, name, wd, tp -> tmpdir, tp -> pid, fork ) )
+    {
+        ON_FAIL ( MapStreamInit ( s, ctx, f, tp -> map_file_bsize ) )
+            KFileRelease ( f );
     }
 }
 
@@ -143,27 +557,27 @@ MapFile *MapFileMakeInt ( const ctx_t *ctx, const char *name, bool random, bool
         else
         {
             const Tool *tp = ctx -> caps -> tool;
-            size_t bsize = random ? tp -> map_file_random_bsize : tp -> map_file_bsize;
 
-            /* create old=>new id file */
-            TRY ( MapFileMakeFork ( & mf -> f_old, ctx, name, wd, tp -> tmpdir, tp -> pid, bsize, "old" ) )
+            /* create old=>new id file, mapped once the id range is known */
+            TRY ( MapFileMakeFork ( & mf -> f_old, ctx, name, wd, tp -> tmpdir, tp -> pid, "old" ) )
             {
-                TRY ( MapFileMakeFork ( & mf -> f_new, ctx, name, wd, tp -> tmpdir, tp -> pid, 32 * 1024, "new" ) )
+                TRY ( MapFileMakeStream ( & mf -> s_new, ctx, name, wd, tp, "new" ) )
                 {
                     if ( for_poslen )
-                        MapFileMakeFork ( & mf -> f_pos, ctx, name, wd, tp -> tmpdir, tp -> pid, 32 * 1024, "pos" );
+                        MapFileMakeStream ( & mf -> s_pos, ctx, name, wd, tp, "pos" );
 
                     KDirectoryRelease ( wd );
 
                     if ( ! FAILED () )
                     {
                         /* this is our guy */
+                        mf -> random = random;
                         KRefcountInit ( & mf -> refcount, 1, "MapFile", "make", name );
                         
                         return mf;
                     }
 
-                    KFileRelease ( mf -> f_new );
+                    MapStreamDestroy ( & mf -> s_new, ctx );
                 }
 
                 KFileRelease ( mf -> f_old );
@@ -254,6 +668,41 @@ MapFile *MapFileDuplicate ( const MapFile *self, const ctx_t *ctx )
  *  required second-stage initialization
  *  must be called before any writes occur
  */
+static
+void MapFileMapOld ( MapFile *self, const ctx_t *ctx )
+{
+    FUNC_ENTRY ( ctx );
+
+    rc_t rc;
+    uint64_t bytes = self -> num_ids * self -> id_size;
+
+    KMMapRelease ( self -> mm_old );
+    self -> mm_old = NULL;
+    self -> old_map = NULL;
+
+    /* the file holds zeros, i.e. no mapping, until written */
+    rc = KFileSetSize ( self -> f_old, bytes );
+    if ( rc != 0 )
+        SYSTEM_ERROR ( rc, "KFileSetSize failed to size old=>new map to %lu bytes", bytes );
+    else if ( bytes != 0 )
+    {
+        rc = KMMapMakeRgnUpdate ( & self -> mm_old, self -> f_old, 0, ( size_t ) bytes );
+        if ( rc != 0 )
+            SYSTEM_ERROR ( rc, "KMMapMakeRgnUpdate failed mapping %lu bytes of old=>new map", bytes );
+        else
+        {
+            rc = KMMapAddrUpdate ( self -> mm_old, ( void** ) & self -> old_map );
+            if ( rc != 0 )
+                INTERNAL_ERROR ( rc, "KMMapAddrUpdate failed" );
+            else
+            {
+                /* random lookups should not pull in whole runs of pages */
+                MapFileAdviseOld ( self, 0, bytes, self -> random ? MADV_RANDOM : MADV_SEQUENTIAL );
+            }
+        }
+    }
+}
+
 void MapFileSetIdRange ( MapFile *self, const ctx_t *ctx,
     int64_t first_id, uint64_t num_ids )
 {
@@ -282,6 +731,8 @@ void MapFileSetIdRange ( MapFile *self, const ctx_t *ctx,
             if ( num_ids <= ( ( uint64_t ) 1 ) << ( self -> id_size * 8 ) )
                 break;
         }
+
+        MapFileMapOld ( self, ctx );
     }
 }
 
@@ -304,6 +755,34 @@ uint64_t MapFileCount ( const MapFile *self, const ctx_t *ctx )
 }
 
 
+/* GetOld
+ * PutOld
+ *  packed little-endian old=>new entries, 0 for none
+ */
+static
+uint64_t MapFileGetOld ( const MapFile *self, uint64_t idx )
+{
+    size_t i;
+    uint64_t val = 0;
+    const uint8_t *p = & self -> old_map [ idx * self -> id_size ];
+
+    for ( i = self -> id_size; i > 0; -- i )
+        val = ( val << 8 ) | p [ i - 1 ];
+
+    return val;
+}
+
+static
+void MapFilePutOld ( MapFile *self, uint64_t idx, uint64_t val )
+{
+    size_t i;
+    uint8_t *p = & self -> old_map [ idx * self -> id_size ];
+
+    for ( i = 0; i < self -> id_size; ++ i, val >>= 8 )
+        p [ i ] = ( uint8_t ) val;
+}
+
+
 /* SetOldToNew
  *  write old=>new id mappings
  */
@@ -327,31 +806,14 @@ void MapFileSetOldToNew ( MapFile *self, const ctx_t *ctx, const IdxMapping *ids
         size_t i;
         for ( i = 0; i < count; ++ i )
         {
-            size_t num_writ;
             /* zero-based index */
             int64_t old_id = ids [ i ] . old_id - self -> first_id;
-            /* position in bytes */
-            uint64_t pos = old_id * self -> id_size;
             /* 1-based translated new-id */
             int64_t new_id = ids [ i ] . new_id - self -> first_id + 1;
-            assert ( old_id >= 0 );
+            assert ( old_id >= 0 && ( uint64_t ) old_id < self -> num_ids );
             assert ( new_id >= 0 );
-#if __BYTE_ORDER == __BIG_ENDIAN
-            new_id = bswap_64 ( new_id );
-#endif
-            rc = KFileWriteAll ( self -> f_old, pos, & new_id, self -> id_size, & num_writ );
-            if ( rc != 0 )
-            {
-                SYSTEM_ERROR ( rc, "failed to write old=>new id mapping" );
-                break;
-            }
 
-            if ( num_writ != self -> id_size )
-            {
-                rc = RC ( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
-                SYSTEM_ERROR ( rc, "failed to write old=>new id mapping" );
-                break;
-            }
+            MapFilePutOld ( self, old_id, new_id );
         }
     }
 }
@@ -384,32 +846,20 @@ void MapFileSetNewToOld ( MapFile *self, const ctx_t *ctx, const IdxMapping *ids
             size_t i;
             for ( i = 0; i < count; ++ i )
             {
-                size_t num_writ;
                 /* zero based index */
                 int64_t new_id = ids [ i ] . new_id - self -> first_id;
-                /* zero based byte offset */
-                uint64_t pos = new_id * self -> id_size;
                 /* 1-based translated old-id */
                 int64_t old_id = ids [ i ] . old_id - self -> first_id + 1;
                 assert ( new_id >= 0 );
                 assert ( old_id >= 0 );
-#if __BYTE_ORDER == __BIG_ENDIAN
-                old_id = bswap_64 ( old_id );
-#endif
-                rc = KFileWriteAll ( self -> f_new, pos, & old_id, self -> id_size, & num_writ );
-                if ( rc != 0 )
-                {
-                    SYSTEM_ERROR ( rc, "failed to write new=>old id mapping" );
-                    break;
-                }
-                
-                if ( num_writ != self -> id_size )
+
+                /* new ids are handed out in order */
+                ON_FAIL ( MapStreamAppend ( & self -> s_new, ctx, new_id, old_id ) )
                 {
-                    rc = RC ( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
-                    SYSTEM_ERROR ( rc, "failed to write new=>old id mapping" );
+                    ANNOTATE ( "failed to write new=>old id mapping" );
                     break;
                 }
-                
+
                 self -> max_new_id = new_id + self -> first_id;
             }
         }
@@ -430,7 +880,7 @@ void MapFileSetPoslen ( MapFile *self, const ctx_t *ctx, const IdxMapping *ids,
         rc = RC ( rcExe, rcFile, rcWriting, rcSelf, rcNull );
         INTERNAL_ERROR ( rc, "bad self reference" );
     }
-    else if ( self -> f_pos == NULL )
+    else if ( self -> s_pos . f == NULL )
     {
         rc = RC ( rcExe, rcFile, rcWriting, rcFile, rcIncorrect );
         INTERNAL_ERROR ( rc, "MapFile must be created with MapFileMakeForPoslen" );
@@ -443,27 +893,14 @@ void MapFileSetPoslen ( MapFile *self, const ctx_t *ctx, const IdxMapping *ids,
     else
     {
         /* start writing after the last new id recorded */
-        uint64_t pos = ( self -> max_new_id - self -> first_id + 1 ) * sizeof ids -> new_id;
+        uint64_t idx = self -> max_new_id - self -> first_id + 1;
 
         size_t i;
-        for ( i = 0; i < count; pos += sizeof ids -> new_id, ++ i )
+        for ( i = 0; i < count; ++ idx, ++ i )
         {
-            size_t num_writ;
-            int64_t poslen = ids [ i ] . new_id;
-#if __BYTE_ORDER == __BIG_ENDIAN
-            poslen = bswap_64 ( poslen );
-#endif
-            rc = KFileWriteAll ( self -> f_pos, pos, & poslen, sizeof ids -> new_id, & num_writ );
-            if ( rc != 0 )
-            {
-                SYSTEM_ERROR ( rc, "failed to write poslen temporary column" );
-                break;
-            }
-
-            if ( num_writ != sizeof ids -> new_id )
+            ON_FAIL ( MapStreamAppend ( & self -> s_pos, ctx, idx, ids [ i ] . new_id ) )
             {
-                rc = RC ( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
-                SYSTEM_ERROR ( rc, "failed to write poslen temporary column" );
+                ANNOTATE ( "failed to write poslen temporary column" );
                 break;
             }
         }
@@ -489,7 +926,7 @@ size_t MapFileReadPoslen ( const MapFile *self, const ctx_t *ctx,
         rc = RC ( rcExe, rcFile, rcReading, rcSelf, rcNull );
         INTERNAL_ERROR ( rc, "bad self reference" );
     }
-    else if ( self -> f_pos == NULL )
+    else if ( self -> s_pos . f == NULL )
     {
         rc = RC ( rcExe, rcFile, rcReading, rcFile, rcIncorrect );
         INTERNAL_ERROR ( rc, "MapFile must be created with MapFileMakeForPoslen" );
@@ -517,24 +954,11 @@ size_t MapFileReadPoslen ( const MapFile *self, const ctx_t *ctx,
         }
         else
         {
-            /* read as many bytes of id as possible */
-            size_t num_read, to_read = max_count * sizeof * poslen;
-            uint64_t pos = ( start_id - self -> first_id ) * sizeof * poslen;
-            rc = KFileReadAll ( self -> f_pos, pos, poslen, to_read, & num_read );
-            if ( rc != 0 )
-                SYSTEM_ERROR ( rc, "failed to read new=>old map" );
-            else
+            /* the stream caches what it decodes: cast away const */
+            ON_FAIL ( total = MapStreamRead ( ( MapStream* ) & self -> s_pos, ctx,
+                                              start_id - self -> first_id, ( int64_t* ) poslen, max_count ) )
             {
-                total = ( size_t ) ( num_read / sizeof * poslen );
-
-#if __BYTE_ORDER == __BIG_ENDIAN
-                {
-                    /* revert byte-order */
-                    size_t i;
-                    for ( i = 0; i < total; ++ i )
-                        poslen [ i ] = bswap_64 ( poslen [ i ] );
-                }
-#endif
+                ANNOTATE ( "failed to read poslen temporary column" );
             }
         }
     }
@@ -604,15 +1028,13 @@ int64_t MapFileAllocMissingNewIds ( MapFile *self, const ctx_t *ctx )
             /* allocate a buffer of IdxMapping */
             TRY ( missing = MemAlloc ( ctx, sizeof * missing * max_missing_ids, false ) )
             {
-                /* use a scan buffer somewhere around 32K,
-                   to keep page-file cache focused on a few pages */
-                void *scan_buffer;
+                /* scan the map in slices of 32K */
+                const void *scan_buffer;
                 const size_t scan_buffer_size = 32 * 1024;
-                TRY ( scan_buffer = MemAlloc ( ctx, scan_buffer_size, false ) )
                 {
                     size_t i, num_read;
                     int64_t new_id, old_id = self -> first_id;
-                    uint64_t eof = self -> num_ids * self -> id_size;
+                    uint64_t ahead = 0, eof = self -> num_ids * self -> id_size;
 
                     /* this guy will be used to assign new ids */
                     int64_t max_new_id = self -> max_new_id;
@@ -636,22 +1058,16 @@ int64_t MapFileAllocMissingNewIds ( MapFile *self, const ctx_t *ctx )
                         if ( pos + to_read > eof )
                             to_read = ( size_t ) ( eof - pos );
 
-                        /* read as many bytes as we can */
-                        rc = KFileReadAll ( self -> f_old, pos, scan_buffer, to_read, & num_read );
-                        if ( rc != 0 )
+                        /* keep the kernel reading ahead of the scan */
+                        if ( pos >= ahead )
                         {
-                            SYSTEM_ERROR ( rc, "failed to read old=>new map" );
-                            break;
+                            MapFileAdviseOld ( self, pos, MAP_FILE_READAHEAD, MADV_WILLNEED );
+                            ahead = pos + MAP_FILE_READAHEAD;
                         }
 
-                        /* convert to count */                        
-                        num_read /= self -> id_size;
-                        if ( num_read == 0 )
-                        {
-                            rc = RC ( rcExe, rcFile, rcReading, rcTransfer, rcIncomplete );
-                            SYSTEM_ERROR ( rc, "failed to read old=>new map" );
-                            break;
-                        }
+                        /* convert to count */
+                        scan_buffer = & self -> old_map [ pos ];
+                        num_read = to_read / self -> id_size;
 
                         /* scan for zeros, and for every zero found,
                            make entry into IdxMapping table, writing
@@ -739,8 +1155,6 @@ int64_t MapFileAllocMissingNewIds ( MapFile *self, const ctx_t *ctx )
 
                     if ( max_new_id != entry_max_new_id )
                         first_allocated = entry_max_new_id + 1;
-
-                    MemFree ( ctx, scan_buffer, scan_buffer_size );
                 }
 
                 MemFree ( ctx, missing, sizeof * missing * max_missing_ids );
@@ -792,31 +1206,22 @@ size_t MapFileReadNewToOld ( const MapFile *self, const ctx_t *ctx,
         }
         else
         {
-            /* read as many bytes of id as possible */
-            size_t num_read, to_read = max_count * self -> id_size;
-            uint64_t pos = ( start_id - self -> first_id ) * self -> id_size;
-            rc = KFileReadAll ( self -> f_new, pos, ids, to_read, & num_read );
-            if ( rc != 0 )
-                SYSTEM_ERROR ( rc, "failed to read new=>old map" );
+            /* read the old ids into the upper half of the
+               buffer, then spread them out from the front */
+            int64_t *old_ids = ( int64_t* ) & ids [ max_count ] - max_count;
+
+            /* the stream caches what it decodes: cast away const */
+            ON_FAIL ( total = MapStreamRead ( ( MapStream* ) & self -> s_new, ctx,
+                                              start_id - self -> first_id, old_ids, max_count ) )
+            {
+                ANNOTATE ( "failed to read new=>old map" );
+            }
             else
             {
                 size_t i;
-                const char *packed = ( const char* ) ids;
-                total = ( size_t ) ( num_read /self -> id_size );
-
-                /* read each packed id as little-endian integer onto
-                   pre-zeroed 64-bit integer, swap if needed */
-                for ( num_read = total * self -> id_size, i = total; i > 0; )
+                for ( i = 0; i < total; ++ i )
                 {
-                    int64_t unpacked = 0;
-
-                    num_read -= self -> id_size;
-                    -- i;
-
-                    memmove ( & unpacked, & packed [ num_read ], self -> id_size );
-#if __BYTE_ORDER == __BIG_ENDIAN
-                    unpacked = bswap_64 ( unpacked );
-#endif
+                    int64_t unpacked = old_ids [ i ];
                     if ( unpacked != 0 )
                         unpacked += self -> first_id - 1;
 
@@ -840,9 +1245,9 @@ size_t MapFileSelectOldToNewPairs ( const MapFile *self, const ctx_t *ctx,
 {
     FUNC_ENTRY ( ctx );
 
-    uint64_t eof;
     int64_t end_excl;
-    size_t i, j, total;
+    uint64_t idx, ahead;
+    size_t i;
 
     /* limit read to number of ids in index */
     if ( start_id + max_count > self -> first_id + self -> num_ids )
@@ -851,61 +1256,28 @@ size_t MapFileSelectOldToNewPairs ( const MapFile *self, const ctx_t *ctx,
     /* range is start_id to end_excl */
     end_excl = start_id + max_count;
 
-    /* eof for f_old */
-    eof = self -> num_ids * self -> id_size;
-
-    for ( total = i = 0; i < max_count; total += j )
+    /* scan the whole map in old-id order, staying ahead by a window */
+    for ( ahead = idx = 0, i = 0; i < max_count && idx < self -> num_ids; ++ idx )
     {
-        rc_t rc;
-        size_t off, num_read;
-        char buff [ 32 * 1024 ];
-
-        /* read some data from file */
-        uint64_t pos = total * self -> id_size;
-        size_t to_read = sizeof buff;
-	if ( pos == eof )
-	    break;
-        if ( pos + to_read > eof )
-            to_read = ( size_t ) ( eof - pos );
-        rc = KFileReadAll ( self -> f_old, pos, buff, to_read, & num_read );
-        if ( rc != 0 )
-        {
-            SYSTEM_ERROR ( rc, "failed to read old=>new map" );
-            break;
-        }
-
-        /* reached end - requested more ids than we have */
-        if ( num_read == 0 )
-            break;
+        int64_t unpacked;
 
-        /* the number of whole ids actually read */
-        if ( ( num_read /= self -> id_size ) == 0 )
+        if ( idx == ahead )
         {
-            rc = RC ( rcExe, rcFile, rcReading, rcTransfer, rcIncomplete );
-            SYSTEM_ERROR ( rc, "failed to read old=>new map - file incomplete" );
-            break;
+            ahead += MAP_FILE_READAHEAD / self -> id_size;
+            MapFileAdviseOld ( self, idx * self -> id_size, MAP_FILE_READAHEAD, MADV_WILLNEED );
         }
 
-        /* select new-ids from ids read */
-        for ( off = j = 0; j < num_read; off += self -> id_size, ++ j )
-        {
-            int64_t unpacked = 0;
-            memmove ( & unpacked, & buff [ off ], self -> id_size );
-#if __BYTE_ORDER == __BIG_ENDIAN
-            unpacked = bswap_64 ( unpacked );
-#endif
-            /* only offset non-zero (NULL) ids */
-            if ( unpacked != 0 )
-                unpacked += self -> first_id - 1;
+        /* only offset non-zero (NULL) ids */
+        unpacked = MapFileGetOld ( self, idx );
+        if ( unpacked != 0 )
+            unpacked += self -> first_id - 1;
 
-            /* if id meets criteria */
-            if ( unpacked >= start_id && unpacked < end_excl )
-            {
-                ids [ i ] . old_id = self -> first_id + total + j;
-                ids [ i ] . new_id = unpacked;
-                if ( ++ i == max_count )
-                    break;
-            }
+        /* if id meets criteria */
+        if ( unpacked >= start_id && unpacked < end_excl )
+        {
+            ids [ i ] . old_id = self -> first_id + idx;
+            ids [ i ] . new_id = unpacked;
+            ++ i;
         }
     }
 
@@ -922,9 +1294,9 @@ size_t MapFileSelectOldToNewSingle ( const MapFile *self, const ctx_t *ctx,
 {
     FUNC_ENTRY ( ctx );
 
-    uint64_t eof;
     int64_t end_excl;
-    size_t i, j, total;
+    uint64_t idx, ahead;
+    size_t i;
 
     /* limit read to number of ids in index */
     if ( start_id + max_count > self -> first_id + self -> num_ids )
@@ -933,63 +1305,30 @@ size_t MapFileSelectOldToNewSingle ( const MapFile *self, const ctx_t *ctx,
     /* range is start_id to end_excl */
     end_excl = start_id + max_count;
 
-    /* eof for f_old */
-    eof = self -> num_ids * self -> id_size;
-
-    for ( total = i = 0; i < max_count; total += j )
+    /* scan the whole map in old-id order, staying ahead by a window */
+    for ( ahead = idx = 0, i = 0; i < max_count && idx < self -> num_ids; ++ idx )
     {
-        rc_t rc;
-        size_t off, num_read;
-        char buff [ 32 * 1024 ];
-
-        /* read some data from file */
-        uint64_t pos = total * self -> id_size;
-        size_t to_read = sizeof buff;
-	if ( pos == eof )
-            break;
-        if ( pos + to_read > eof )
-            to_read = ( size_t ) ( eof - pos );
-        rc = KFileReadAll ( self -> f_old, pos, buff, to_read, & num_read );
-        if ( rc != 0 )
-        {
-            SYSTEM_ERROR ( rc, "failed to read old=>new map" );
-            break;
-        }
+        int64_t unpacked;
 
-        /* reached end - requested more ids than we have */
-        if ( num_read == 0 )
-            break;
-
-        /* the number of whole ids actually read */
-        if ( ( num_read /= self -> id_size ) == 0 )
+        if ( idx == ahead )
         {
-            rc = RC ( rcExe, rcFile, rcReading, rcTransfer, rcIncomplete );
-            SYSTEM_ERROR ( rc, "failed to read old=>new map - file incomplete" );
-            break;
+            ahead += MAP_FILE_READAHEAD / self -> id_size;
+            MapFileAdviseOld ( self, idx * self -> id_size, MAP_FILE_READAHEAD, MADV_WILLNEED );
         }
 
-        /* select new-ids from ids read */
-        for ( off = j = 0; j < num_read; off += self -> id_size, ++ j )
-        {
-            int64_t unpacked = 0;
-            memmove ( & unpacked, & buff [ off ], self -> id_size );
-#if __BYTE_ORDER == __BIG_ENDIAN
-            unpacked = bswap_64 ( unpacked );
-#endif
-            /* only offset non-zero (NULL) ids */
-            if ( unpacked != 0 )
-                unpacked += self -> first_id - 1;
+        /* only offset non-zero (NULL) ids */
+        unpacked = MapFileGetOld ( self, idx );
+        if ( unpacked != 0 )
+            unpacked += self -> first_id - 1;
 
-            /* if id meets criteria */
-            if ( unpacked >= start_id && unpacked < end_excl )
-            {
-                ids [ i ] = self -> first_id + total + j;
-                assert ( i <= 0xFFFFFFFF );
-                if ( opt_ord != NULL )
-                    opt_ord [ unpacked - start_id ] = ( uint32_t ) i;
-                if ( ++ i == max_count )
-                    break;
-            }
+        /* if id meets criteria */
+        if ( unpacked >= start_id && unpacked < end_excl )
+        {
+            ids [ i ] = self -> first_id + idx;
+            assert ( i <= 0xFFFFFFFF );
+            if ( opt_ord != NULL )
+                opt_ord [ unpacked - start_id ] = ( uint32_t ) i;
+            ++ i;
         }
     }
 
@@ -1023,39 +1362,29 @@ int64_t MapFileMapSingleOldToNew ( MapFile *self, const ctx_t *ctx,
     }
     else
     {
-        size_t num_read, to_read = self -> id_size;
-        uint64_t pos = ( old_id - self -> first_id ) * self -> id_size;
-        rc = KFileReadAll ( self -> f_old, pos, & new_id, to_read, & num_read );
-        if ( rc != 0 )
-            SYSTEM_ERROR ( rc, "failed to read old=>new map" );
-        else
+        new_id = MapFileGetOld ( self, old_id - self -> first_id );
+        if ( new_id != 0 )
+            new_id += self -> first_id - 1;
+        else if ( insert )
         {
-#if __BYTE_ORDER == __BIG_ENDIAN
-            new_id = bswap_64 ( new_id );
-#endif
-            if ( new_id != 0 )
-                new_id += self -> first_id - 1;
-            else if ( insert )
-            {
-                /* create a mapping using the last known
-                   new id plus one as the id to assign on insert */
-                IdxMapping mapping;
-                mapping . old_id = old_id;
-                mapping . new_id = self -> max_new_id + 1;
+            /* create a mapping using the last known
+               new id plus one as the id to assign on insert */
+            IdxMapping mapping;
+            mapping . old_id = old_id;
+            mapping . new_id = self -> max_new_id + 1;
 
-                TRY ( MapFileSetOldToNew ( self, ctx, & mapping, 1 ) )
+            TRY ( MapFileSetOldToNew ( self, ctx, & mapping, 1 ) )
+            {
+                TRY ( MapFileSetNewToOld ( self, ctx, & mapping, 1 ) )
                 {
-                    TRY ( MapFileSetNewToOld ( self, ctx, & mapping, 1 ) )
-                    {
-                        new_id = mapping . new_id;
+                    new_id = mapping . new_id;
 
-                        if ( self -> num_ids >= 100000 )
-                        {
-                            uint64_t scaled = ++ self -> num_mapped_ids * 100;
-                            uint64_t prior = scaled - 100;
-                            if ( ( prior / self -> num_ids ) != ( scaled /= self -> num_ids ) )
-                                STATUS ( 2, "have mapped %lu%% ids", scaled );
-                        }
+                    if ( self -> num_ids >= 100000 )
+                    {
+                        uint64_t scaled = ++ self -> num_mapped_ids * 100;
+                        uint64_t prior = scaled - 100;
+                        if ( ( prior / self -> num_ids ) != ( scaled /= self -> num_ids ) )
+                            STATUS ( 2, "have mapped %lu%% ids", scaled );
                     }
                 }
             }
@@ -1190,3 +1519,4 @@ void MapFileConsistencyCheck ( const MapFile *self, const ctx_t *ctx )
 
     STATUS ( 2, "finished idx consistency check" );
 }
+
@@ -0,0 +1,70 @@
+/*===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#include "radix-sort.h"
+#include "ctx.h"
+#include "caps.h"
+#include "except.h"
+#include "status.h"
+#include "mem.h"
+#include "sra-sort.h"
+
+FILE_ENTRY ( radix-sort );
+
+
+/*--------------------------------------------------------------------------
+ * RadixSort
+ */
+bool RadixSort ( void *base, const ctx_t *ctx, size_t count, size_t elem_size,
+    const RadixKey *keys, uint32_t num_keys )
+{
+    FUNC_ENTRY ( ctx );
+
+    void *buff;
+    uint32_t passes;
+
+    const Tool *tp = ctx -> caps -> tool;
+    size_t bytes = count * elem_size;
+
+    if ( count < RADIX_SORT_MIN_COUNT )
+        return false;
+
+    /* the scratch buffer may be limited by the MemBank */
+    ON_FAIL ( buff = MemAlloc ( ctx, bytes, false ) )
+    {
+        STATUS ( 4, "no room to radix sort %,zu records, using ksort", count );
+        CLEAR ();
+        return false;
+    }
+
+    radix_sort ( base, buff, count, elem_size, keys, num_keys, tp -> num_threads, & passes );
+
+    STATUS ( 4, "radix sorted %,zu records in %u passes on %u threads",
+             count, passes, radix_sort_threads ( count, tp -> num_threads ) );
+
+    MemFree ( ctx, buff, bytes );
+    return true;
+}
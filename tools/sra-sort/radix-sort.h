@@ -0,0 +1,60 @@
+/*===========================================================================
+ *
+ *                            PUBLIC DOMAIN NOTICE
+ *               National Center for Biotechnology Information
+ *
+ *  This software/database is a "United States Government Work" under the
+ *  terms of the United States Copyright Act.  It was written as part of
+ *  the author's official duties as a United States Government employee and
+ *  thus cannot be copyrighted.  This software/database is freely available
+ *  to the public for use. The National Library of Medicine and the U.S.
+ *  Government have not placed any restriction on its use or reproduction.
+ *
+ *  Although all reasonable efforts have been taken to ensure the accuracy
+ *  and reliability of the software and data, the NLM and the U.S.
+ *  Government do not and cannot warrant the performance or results that
+ *  may be obtained by using this software or data. The NLM and the U.S.
+ *  Government disclaim all warranties, express or implied, including
+ *  warranties of performance, merchantability or fitness for any particular
+ *  purpose.
+ *
+ *  Please cite the author in any work or product based on this material.
+ *
+ * ===========================================================================
+ *
+ */
+
+#ifndef _h_sra_sort_radix_sort_
+#define _h_sra_sort_radix_sort_
+
+#ifndef _h_sra_sort_defs_
+#include "sort-defs.h"
+#endif
+
+
+#include "../util/radix_sort.h" /* shared with vdb-validate */
+
+
+/*--------------------------------------------------------------------------
+ * RadixKey
+ *  a 64-bit key within a record, given by its byte offset
+ */
+typedef radix_key RadixKey;
+
+
+/* RadixSort
+ *  stable LSD radix sort of records of 'elem_size' bytes, a multiple of 8
+ *  on 'num_keys' 64-bit keys, the most significant key first
+ *
+ *  runs radix_sort from tools/util on the threads given in Tool,
+ *  with its scratch buffer taken from the MemBank
+ *
+ *  returns false without touching the records if there are too few of them,
+ *  or the scratch buffer cannot be had from the MemBank:
+ *  the caller should fall back to KSORT
+ */
+bool RadixSort ( void *base, const ctx_t *ctx, size_t count, size_t elem_size,
+    const RadixKey *keys, uint32_t num_keys );
+
+
+#endif /* _h_sra_sort_radix_sort_ */
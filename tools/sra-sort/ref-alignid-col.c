@@ -37,6 +37,7 @@ struct AlignIdColReader;
 #include "status.h"
 #include "mem.h"
 #include "idx-mapping.h"
+#include "radix-sort.h"
 #include "map-file.h"
 #include "sra-sort.h"
 
@@ -444,7 +445,11 @@ const void *AlignIdColReaderRead ( AlignIdColReader *self, const ctx_t *ctx,
 #if USE_OLD_KSORT
             ksort ( self -> u . ids, self -> num_elems, sizeof self -> u . ids [ 0 ], cmp_int64_t, ( void* ) ctx );
 #else
-            ksort_int64_t ( self -> u . ids, self -> num_elems );
+            {
+                static const RadixKey key = { 0, true };
+                if ( ! RadixSort ( self -> u . ids, ctx, self -> num_elems, sizeof self -> u . ids [ 0 ], & key, 1 ) )
+                    ksort_int64_t ( self -> u . ids, self -> num_elems );
+            }
 #endif
 
             /* transform from ids to id_poslen */
@@ -479,7 +484,18 @@ const void *AlignIdColReaderRead ( AlignIdColReader *self, const ctx_t *ctx,
 #if USE_OLD_KSORT
         ksort ( self -> u . id_poslen, self -> num_elems, sizeof self -> u . id_poslen [ 0 ], IdPosLenCmpPos, ( void* ) ctx );
 #else
-        ksort_IdPosLen_pos ( self -> u . id_poslen, self -> num_elems );
+        {
+            static const RadixKey keys [] =
+            {
+                { offsetof ( IdPosLen, poslen ), false },
+                { offsetof ( IdPosLen, id ), true }
+            };
+            if ( ! RadixSort ( self -> u . id_poslen, ctx, self -> num_elems, sizeof self -> u . id_poslen [ 0 ],
+                               keys, sizeof keys / sizeof keys [ 0 ] ) )
+            {
+                ksort_IdPosLen_pos ( self -> u . id_poslen, self -> num_elems );
+            }
+        }
 #endif
 
         /* write poslen to temp column */
@@ -80,6 +80,7 @@ rc_t CC UsageSummary ( const char *prog_name )
 #define OPT_MAX_LARGE_IDX_IDS "max-large-idx-ids"
 #define OPT_TEMP_DIR "tempdir"
 #define OPT_MMAP_DIR "mmapdir"
+#define OPT_THREADS "threads"
 #define OPT_UNSORTED_OLD_NEW "unsorted-old-new"
 
 #define OPT_COLUMN_MD5 "column-md5"
@@ -96,12 +97,14 @@ static const char *hlp_ignore_failure [] = { "ignore failure when sorting multip
                                              "i.e. continue in spite of previous errors", NULL };
 static const char *hlp_force [] = { "force overwrite of existing destination", NULL };
 static const char *hlp_mem_limit [] = { "sets limit on dynamic memory usage", NULL };
-static const char *hlp_map_file_bsize [] = { "sets id map-file cache size", NULL };
+static const char *hlp_map_file_bsize [] = { "sets id map-file readahead window", NULL };
 static const char *hlp_max_idx_ids [] = { "sets number of join-index ids to process at a time", NULL };
 static const char *hlp_max_ref_idx_ids [] = { "sets number of join-index ids to process within REFERENCE table", NULL };
 static const char *hlp_max_large_idx_ids [] = { "sets number of rows to process with large columns", NULL };
 static const char *hlp_temp_dir [] = { "sets a specific directory to use for temporary files", NULL };
 static const char *hlp_mmap_dir [] = { "sets a specific directory to use for memory-mapped buffers", NULL };
+static const char *hlp_threads [] = { "sets number of threads for copying columns and sorting ids",
+                                      "( default: number of processors, at most 8 )", NULL };
 static const char *hlp_unsorted_old_new [] = { "write old=>new index in unsorted order", NULL };
 
 static const char *hlp_column_md5 [] = { "generate md5sum compatible checksum files for each column [default]", NULL };
@@ -135,6 +138,7 @@ static OptDef options [] =
   , { OPT_MAX_LARGE_IDX_IDS, NULL, NULL, hlp_max_large_idx_ids, 1, true, false }
   , { OPT_TEMP_DIR, NULL, NULL, hlp_temp_dir, 1, true, false }
   , { OPT_MMAP_DIR, NULL, NULL, hlp_mmap_dir, 1, true, false }
+  , { OPT_THREADS, NULL, NULL, hlp_threads, 1, true, false }
   , { OPT_UNSORTED_OLD_NEW, NULL, NULL, hlp_unsorted_old_new, 1, false, false }
 
   , { OPT_COLUMN_MD5, NULL, NULL, hlp_column_md5, 1, false, false }
@@ -159,6 +163,7 @@ static const char *option_params [] =
   , "num-ids"
   , "path-to-tmp"
   , "path-to-mmaps"
+  , "count"
   , NULL
   , NULL
   , NULL
@@ -309,6 +314,19 @@ uint64_t KConfigGetNodeU64 ( const ctx_t *ctx, const char *path, bool *found )
     return val;
 }
 
+static
+uint32_t default_num_threads ( void )
+{
+#ifdef _WIN32
+    return 1;
+#else
+    long num = sysconf ( _SC_NPROCESSORS_ONLN );
+    if ( num < 1 )
+        return 1;
+    return ( num > 8 ) ? 8 : ( uint32_t ) num;
+#endif
+}
+
 static
 void initialize_params ( const ctx_t *ctx, Caps *caps, Tool *tp, Selection *sel, Args *args )
 {
@@ -329,9 +347,8 @@ void initialize_params ( const ctx_t *ctx, Caps *caps, Tool *tp, Selection *sel,
     /* default to mmap dir */
     tp -> mmapdir = NULL;
 
-    /* default buffer size for map cache */
-    tp -> map_file_bsize = 64 * 1024 * 1024;
-    tp -> map_file_random_bsize = tp -> map_file_bsize;
+    /* default readahead window for map streams */
+    tp -> map_file_bsize = 4 * 1024 * 1024;
 
     /* default max index ids to gather at a time */
     tp -> max_ref_idx_ids = tp -> max_large_idx_ids = tp -> max_idx_ids = 256 * 1024 * 1024;
@@ -339,6 +356,10 @@ void initialize_params ( const ctx_t *ctx, Caps *caps, Tool *tp, Selection *sel,
     tp -> min_idx_ids =  64 * 1024 * 1024;
     tp -> max_missing_ids = tp -> max_idx_ids;
 
+    /* copy column pairs and sort on one thread per processor */
+    tp -> num_threads = default_num_threads ();
+    tp -> copy_batch_ids = 1024 * 1024;
+
 #if 0
     /* refpos cache size */
     tp -> refpos_cache_capacity = 100 * 1024 * 1024;
@@ -384,12 +405,7 @@ tp->write_new_to_old=true;
     ON_FAIL ( val = KConfigGetNodeU64 ( ctx, "sra-sort/map_file_bsize", & found ) )
         return;
     if ( found )
-        tp -> map_file_bsize = tp -> map_file_random_bsize = ( size_t ) val;
-
-    ON_FAIL ( val = KConfigGetNodeU64 ( ctx, "sra-sort/map_file_random_bsize", & found ) )
-        return;
-    if ( found )
-        tp -> map_file_random_bsize = ( size_t ) val;
+        tp -> map_file_bsize = ( size_t ) val;
 
     ON_FAIL ( val = KConfigGetNodeU64 ( ctx, "sra-sort/max_idx_ids", & found ) )
         return;
@@ -412,10 +428,15 @@ tp->write_new_to_old=true;
     if ( count != 0 && str [ 0 ] != 0 )
         tp -> mmapdir = str;
 
+    ON_FAIL ( val = ArgsGetOptU64 ( args, ctx, OPT_THREADS, & count ) )
+        return;
+    if ( count != 0 )
+        tp -> num_threads = ( val == 0 ) ? 1 : ( uint32_t ) val;
+
     ON_FAIL ( val = ArgsGetOptU64 ( args, ctx, OPT_MAP_FILE_BSIZE, & count ) )
         return;
     if ( count != 0 )
-        tp -> map_file_random_bsize = ( size_t ) val;
+        tp -> map_file_bsize = ( size_t ) val;
    
     ON_FAIL ( val = ArgsGetOptU64 ( args, ctx, OPT_MAX_IDX_IDS, & count ) )
         return;
@@ -81,9 +81,8 @@ struct Tool
     /* destination object path */
     const char *dst_path;
 
-    /* buffer size for id map files */
+    /* readahead window for id map streams */
     size_t map_file_bsize;
-    size_t map_file_random_bsize;
 
     /* the number of ids to gather at a time */
     size_t max_ref_idx_ids;
@@ -95,6 +94,11 @@ struct Tool
     /* the number of missing SEQUENCE ids to gather at a time */
     size_t max_missing_ids;
 
+    /* the number of threads copying column pairs or sorting,
+       and the row ids handed to the copying threads at a time */
+    uint32_t num_threads;
+    size_t copy_batch_ids;
+
     /* pid of tool */
     int pid;
 
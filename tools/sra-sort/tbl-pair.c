@@ -43,11 +43,15 @@ typedef struct TablePair StdTblPair;
 #include <vdb/cursor.h>
 #include <vdb/vdb-priv.h>
 #include <kdb/meta.h>
+#include <kapp/main.h>
 #include <klib/printf.h>
 #include <klib/text.h>
 #include <klib/namelist.h>
 #include <klib/rc.h>
-#include <kproc/thread.h> /* KThreadWait */
+#include <kproc/thread.h>
+#include <kproc/lock.h>
+#include <kproc/cond.h>
+#include <atomic32.h>
 
 #include <string.h>
 
@@ -216,6 +220,368 @@ void CC TablePairReleaseColumnPair ( void *item, void *data )
 }
 
 
+/* ColumnPairPool
+ *  copies the simple column pairs of a RowSet on several threads
+ *
+ *  the workers are started once per RowSet and wait for batches.
+ *  the RowSet is drained on the calling thread, a batch of row ids at a time.
+ *  each thread takes the next pair from the shared list and copies the
+ *  whole batch into it, so the rows of a column stay in order.
+ */
+#define COPY_THREAD_MEM ( 32 * 1024 * 1024 )
+
+typedef struct ColumnPairPool ColumnPairPool;
+struct ColumnPairPool
+{
+    ColumnPair **cols;
+    const int64_t *row_ids;
+    size_t num_ids;
+
+    /* "posted" wakes the workers for a new batch or to stop,
+       "idle" wakes the caller when the last worker is through */
+    KLock *lock;
+    KCondition *posted;
+    KCondition *idle;
+    uint32_t batch;
+    uint32_t busy;
+    bool done;
+
+    uint32_t num_cols;
+    atomic32_t next_col;
+    atomic32_t failed;
+};
+
+typedef struct ColumnPairWorker ColumnPairWorker;
+struct ColumnPairWorker
+{
+    Caps caps;
+    ColumnPairPool *pool;
+    KThread *t;
+};
+
+static
+rc_t CC ColumnPairWorkerRun ( const KThread *self, void *data )
+{
+    ColumnPairWorker *w = data;
+    ColumnPairPool *pool = w -> pool;
+    uint32_t batch = 0;
+
+    DECLARE_CTX_INFO ();
+    ctx_t thread_ctx = { & w -> caps, NULL, & ctx_info };
+    const ctx_t *ctx = & thread_ctx;
+
+    while ( ! FAILED () )
+    {
+        bool done;
+
+        KLockAcquire ( pool -> lock );
+        while ( ! pool -> done && pool -> batch == batch )
+            KConditionWait ( pool -> posted, pool -> lock );
+        done = pool -> done;
+        batch = pool -> batch;
+        KLockUnlock ( pool -> lock );
+
+        if ( done )
+            break;
+
+        while ( atomic32_read ( & pool -> failed ) == 0 )
+        {
+            uint32_t i = atomic32_read_and_add ( & pool -> next_col, 1 );
+            if ( i >= pool -> num_cols )
+                break;
+
+            ON_FAIL ( ColumnPairCopyIds ( pool -> cols [ i ], ctx, pool -> row_ids, pool -> num_ids ) )
+            {
+                atomic32_set ( & pool -> failed, 1 );
+                break;
+            }
+        }
+
+        KLockAcquire ( pool -> lock );
+        if ( -- pool -> busy == 0 )
+            KConditionSignal ( pool -> idle );
+        KLockUnlock ( pool -> lock );
+    }
+
+    return ctx -> rc;
+}
+
+/* Start
+ *  returns the number of workers started
+ *  which may be fewer than 'num_threads' only upon error
+ */
+static
+uint32_t ColumnPairPoolStart ( ColumnPairPool *self, const ctx_t *ctx, ColumnPairWorker *workers, uint32_t num_threads )
+{
+    FUNC_ENTRY ( ctx );
+
+    rc_t rc;
+    uint32_t started;
+
+    rc = KLockMake ( & self -> lock );
+    if ( rc == 0 )
+        rc = KConditionMake ( & self -> posted );
+    if ( rc == 0 )
+        rc = KConditionMake ( & self -> idle );
+    if ( rc != 0 )
+    {
+        SYSTEM_ERROR ( rc, "failed to create column copy pool" );
+        return 0;
+    }
+
+    for ( started = 0; started < num_threads; ++ started )
+    {
+        ColumnPairWorker *w = & workers [ started ];
+        w -> pool = self;
+
+        ON_FAIL ( CapsInit ( & w -> caps, ctx ) )
+            break;
+
+        rc = KThreadMake ( & w -> t, ColumnPairWorkerRun, w );
+        if ( rc != 0 )
+        {
+            SYSTEM_ERROR ( rc, "failed to start column copy thread" );
+            CapsWhack ( & w -> caps, ctx );
+            break;
+        }
+    }
+
+    return started;
+}
+
+/* Run
+ *  hands the current batch to the 'started' workers and waits for them
+ */
+static
+void ColumnPairPoolRun ( ColumnPairPool *self, uint32_t started )
+{
+    KLockAcquire ( self -> lock );
+
+    atomic32_set ( & self -> next_col, 0 );
+    self -> busy = started;
+    ++ self -> batch;
+    KConditionBroadcast ( self -> posted );
+
+    while ( self -> busy != 0 )
+        KConditionWait ( self -> idle, self -> lock );
+
+    KLockUnlock ( self -> lock );
+}
+
+/* Stop
+ *  tells the workers to exit and joins them
+ */
+static
+void ColumnPairPoolStop ( ColumnPairPool *self, const ctx_t *ctx, ColumnPairWorker *workers, uint32_t started )
+{
+    FUNC_ENTRY ( ctx );
+
+    rc_t rc;
+    uint32_t i;
+
+    if ( self -> lock != NULL )
+    {
+        KLockAcquire ( self -> lock );
+        self -> done = true;
+        if ( self -> posted != NULL )
+            KConditionBroadcast ( self -> posted );
+        KLockUnlock ( self -> lock );
+    }
+
+    for ( i = 0; i < started; ++ i )
+    {
+        rc_t status;
+        ColumnPairWorker *w = & workers [ i ];
+
+        rc = KThreadWait ( w -> t, & status );
+        if ( rc != 0 )
+        {
+            if ( ! FAILED () )
+                SYSTEM_ERROR ( rc, "failed to wait for column copy thread 0x%p", w -> t );
+        }
+        else if ( status != 0 && ! FAILED () )
+        {
+            ERROR ( status, "column copy thread 0x%p failed", w -> t );
+        }
+
+        KThreadRelease ( w -> t );
+        CapsWhack ( & w -> caps, ctx );
+    }
+
+    KConditionRelease ( self -> idle );
+    KConditionRelease ( self -> posted );
+    KLockRelease ( self -> lock );
+}
+
+
+/* CopyThreads
+ *  the number of threads for copying 'num_simple' pairs
+ *  bounded by the remaining memory quota
+ */
+static
+uint32_t TablePairCopyThreads ( const TablePair *self, const ctx_t *ctx, uint32_t num_simple )
+{
+    size_t in_use, quota;
+    const Tool *tp = ctx -> caps -> tool;
+    uint32_t num_threads = tp -> num_threads;
+
+    if ( num_threads > num_simple )
+        num_threads = num_simple;
+
+    in_use = MemInUse ( ctx, & quota );
+    if ( ( quota + 1 ) != 0 )
+    {
+        size_t avail = ( quota > in_use ) ? quota - in_use : 0;
+        if ( num_threads > avail / COPY_THREAD_MEM )
+            num_threads = ( uint32_t ) ( avail / COPY_THREAD_MEM );
+    }
+
+    return num_threads;
+}
+
+
+/* CopyRowSetMT
+ *  copy the simple pairs of 'cols' on a pool of threads
+ *  the pool walks 'rs' once for all of its pairs,
+ *  so they must all agree on 'for_static'
+ */
+static
+void TablePairCopyRowSetMT ( TablePair *self, const ctx_t *ctx,
+    const Vector *cols, RowSet *rs, uint32_t num_simple, uint32_t num_threads, bool for_static )
+{
+    FUNC_ENTRY ( ctx );
+
+    ColumnPairPool pool;
+    const Tool *tp = ctx -> caps -> tool;
+    size_t batch = tp -> copy_batch_ids;
+
+    memset ( & pool, 0, sizeof pool );
+
+    TRY ( pool . cols = MemAlloc ( ctx, sizeof pool . cols [ 0 ] * num_simple, false ) )
+    {
+        int64_t *row_ids;
+        uint32_t i, count = VectorLength ( cols );
+
+        for ( i = 0; i < count; ++ i )
+        {
+            ColumnPair *col = VectorGet ( cols, i );
+            if ( ColumnPairIsSimple ( col ) && col -> is_static == for_static )
+                pool . cols [ pool . num_cols ++ ] = col;
+        }
+        assert ( pool . num_cols == num_simple );
+
+        TRY ( row_ids = MemAlloc ( ctx, sizeof row_ids [ 0 ] * batch, false ) )
+        {
+            ColumnPairWorker *workers;
+            TRY ( workers = MemAlloc ( ctx, sizeof workers [ 0 ] * num_threads, true ) )
+            {
+                STATUS ( 3, "copying %u columns on %u threads", num_simple, num_threads );
+
+                pool . row_ids = row_ids;
+
+                TRY ( RowSetReset ( rs, ctx, for_static ) )
+                {
+                    uint32_t started;
+
+                    for ( i = 0; ! FAILED () && i < num_simple; ++ i )
+                    {
+                        STATUS ( 3, "copying column '%s'", pool . cols [ i ] -> full_spec );
+                        ColumnPairPreCopy ( pool . cols [ i ], ctx );
+                    }
+
+                    started = FAILED () ? 0 : ColumnPairPoolStart ( & pool, ctx, workers, num_threads );
+
+                    while ( ! FAILED () && atomic32_read ( & pool . failed ) == 0 )
+                    {
+                        rc_t rc;
+                        size_t num_ids;
+
+                        for ( pool . num_ids = 0; pool . num_ids < batch; pool . num_ids += num_ids )
+                        {
+                            ON_FAIL ( num_ids = RowSetNext ( rs, ctx, & row_ids [ pool . num_ids ], batch - pool . num_ids ) )
+                                break;
+                            if ( num_ids == 0 )
+                                break;
+                        }
+                        if ( FAILED () || pool . num_ids == 0 )
+                            break;
+
+                        rc = Quitting ();
+                        if ( rc != 0 )
+                        {
+                            INFO_ERROR ( rc, "quitting" );
+                            break;
+                        }
+
+                        ColumnPairPoolRun ( & pool, started );
+                    }
+
+                    ColumnPairPoolStop ( & pool, ctx, workers, started );
+
+                    for ( i = 0; ! FAILED () && i < num_simple; ++ i )
+                        ColumnPairPostCopy ( pool . cols [ i ], ctx );
+                }
+
+                MemFree ( ctx, workers, sizeof workers [ 0 ] * num_threads );
+            }
+
+            MemFree ( ctx, row_ids, sizeof row_ids [ 0 ] * batch );
+        }
+
+        MemFree ( ctx, pool . cols, sizeof pool . cols [ 0 ] * num_simple );
+    }
+}
+
+
+/* CopyRowSet
+ *  copy all pairs of 'cols' for one RowSet
+ *  pairs with special readers or writers may share state,
+ *  they are copied one after another on the calling thread
+ */
+static
+void TablePairCopyRowSet ( TablePair *self, const ctx_t *ctx, const Vector *cols, RowSet *rs )
+{
+    FUNC_ENTRY ( ctx );
+
+    uint32_t i, num_simple, num_threads;
+    uint32_t count = VectorLength ( cols );
+    bool for_static = false, have_simple = false;
+
+    /* the pool resets 'rs' once for all of its pairs,
+       so it only takes the simple pairs sharing the first one's 'is_static' */
+    for ( num_simple = i = 0; i < count; ++ i )
+    {
+        const ColumnPair *col = VectorGet ( cols, i );
+        assert ( col != NULL );
+        if ( ColumnPairIsSimple ( col ) )
+        {
+            if ( ! have_simple )
+            {
+                for_static = col -> is_static;
+                have_simple = true;
+            }
+            if ( col -> is_static == for_static )
+                ++ num_simple;
+        }
+    }
+
+    num_threads = TablePairCopyThreads ( self, ctx, num_simple );
+
+    for ( i = 0; i < count; ++ i )
+    {
+        ColumnPair *col = VectorGet ( cols, i );
+        if ( num_threads <= 1 || ! ColumnPairIsSimple ( col ) || col -> is_static != for_static )
+        {
+            ON_FAIL ( ColumnPairCopy ( col, ctx, rs ) )
+                return;
+        }
+    }
+
+    if ( num_threads > 1 )
+        TablePairCopyRowSetMT ( self, ctx, cols, rs, num_simple, num_threads, for_static );
+}
+
+
 /* Copy
  *  the table has to obtain a RowSetIterator
  *  which it walks vertically
@@ -304,21 +670,13 @@ void TablePairCopyPresortColumns ( TablePair *self, const ctx_t *ctx )
 
             while ( ! FAILED () )
             {
-                uint32_t i;
-
                 RowSet *rs;
                 ON_FAIL ( rs = RowSetIteratorNext ( rsi, ctx ) )
                     break;
                 if ( rs == NULL )
                     break;
 
-                for ( i = 0; i < count; ++ i )
-                {
-                    ColumnPair *col = VectorGet ( & self -> presort_cols, i );
-                    assert ( col != NULL );
-                    ON_FAIL ( ColumnPairCopy ( col, ctx, rs ) )
-                        break;
-                }
+                TablePairCopyRowSet ( self, ctx, & self -> presort_cols, rs );
 
                 RowSetRelease ( rs, ctx );
             }
@@ -357,21 +715,13 @@ void TablePairCopyMappedColumns ( TablePair *self, const ctx_t *ctx )
 
             while ( ! FAILED () )
             {
-                uint32_t i;
-
                 RowSet *rs;
                 ON_FAIL ( rs = RowSetIteratorNext ( rsi, ctx ) )
                     break;
                 if ( rs == NULL )
                     break;
 
-                for ( i = 0; i < count; ++ i )
-                {
-                    ColumnPair *col = VectorGet ( & self -> mapped_cols, i );
-                    assert ( col != NULL );
-                    ON_FAIL ( ColumnPairCopy ( col, ctx, rs ) )
-                        break;
-                }
+                TablePairCopyRowSet ( self, ctx, & self -> mapped_cols, rs );
 
                 RowSetRelease ( rs, ctx );
             }
@@ -410,21 +760,13 @@ void TablePairCopyLargeColumns ( TablePair *self, const ctx_t *ctx )
 
             while ( ! FAILED () )
             {
-                uint32_t i;
-
                 RowSet *rs;
                 ON_FAIL ( rs = RowSetIteratorNext ( rsi, ctx ) )
                     break;
                 if ( rs == NULL )
                     break;
 
-                for ( i = 0; i < count; ++ i )
-                {
-                    ColumnPair *col = VectorGet ( & self -> large_cols, i );
-                    assert ( col != NULL );
-                    ON_FAIL ( ColumnPairCopy ( col, ctx, rs ) )
-                        break;
-                }
+                TablePairCopyRowSet ( self, ctx, & self -> large_cols, rs );
 
                 RowSetRelease ( rs, ctx );
             }
@@ -463,21 +805,13 @@ void TablePairCopyLargeMappedColumns ( TablePair *self, const ctx_t *ctx )
 
             while ( ! FAILED () )
             {
-                uint32_t i;
-
                 RowSet *rs;
                 ON_FAIL ( rs = RowSetIteratorNext ( rsi, ctx ) )
                     break;
                 if ( rs == NULL )
                     break;
 
-                for ( i = 0; i < count; ++ i )
-                {
-                    ColumnPair *col = VectorGet ( & self -> large_mapped_cols, i );
-                    assert ( col != NULL );
-                    ON_FAIL ( ColumnPairCopy ( col, ctx, rs ) )
-                        break;
-                }
+                TablePairCopyRowSet ( self, ctx, & self -> large_mapped_cols, rs );
 
                 RowSetRelease ( rs, ctx );
             }
@@ -516,21 +850,13 @@ void TablePairCopyNormalColumns ( TablePair *self, const ctx_t *ctx )
 
             while ( ! FAILED () )
             {
-                uint32_t i;
-
                 RowSet *rs;
                 ON_FAIL ( rs = RowSetIteratorNext ( rsi, ctx ) )
                     break;
                 if ( rs == NULL )
                     break;
 
-                for ( i = 0; i < count; ++ i )
-                {
-                    ColumnPair *col = VectorGet ( & self -> normal_cols, i );
-                    assert ( col != NULL );
-                    ON_FAIL ( ColumnPairCopy ( col, ctx, rs ) )
-                        break;
-                }
+                TablePairCopyRowSet ( self, ctx, & self -> normal_cols, rs );
 
                 RowSetRelease ( rs, ctx );
             }
@@ -701,8 +1027,11 @@ ColumnPair *TablePairMatchColumnPair ( TablePair *self, const ctx_t *ctx, const
                             rc = VCursorAddColumn ( scurs, & idx, "%s", colspec );
                             if ( rc == 0 )
                             {
+                                /* scurs only probes for a readable datatype; the reader
+                                   opens a cursor of its own so the pair can be copied
+                                   independently of any other column */
                                 ColumnReader *reader;
-                                TRY ( reader = TablePairMakeColumnReader ( self, ctx, scurs, colspec, true ) )
+                                TRY ( reader = TablePairMakeColumnReader ( self, ctx, NULL, colspec, true ) )
                                 {
                                     ColumnWriter *writer;
                                     TRY ( writer = TablePairMakeColumnWriter ( self, ctx, NULL, colspec ) )
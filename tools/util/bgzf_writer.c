@@ -0,0 +1,615 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "bgzf_writer.h"
+
+#include <klib/log.h>
+#include <klib/vector.h>
+#include <klib/data-buffer.h>
+#include <kproc/thread.h>
+#include <kproc/queue.h>
+
+#include <zlib.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct bgzf_writer bgzf_writer;
+#define KFILE_IMPL bgzf_writer
+#include <kfs/impl.h>
+
+/* the same limits as samtools/htslib: the uncompressed payload of a block stays below 64k,
+   the whole compressed block ( header + deflate-data + trailer ) fits into 64k */
+#define BGZF_BLOCK_DATA 0xFF00
+#define BGZF_MAX_BLOCK_SIZE 0x10000
+#define BGZF_HEADER_SIZE 18
+#define BGZF_TRAILER_SIZE 8
+#define BGZF_BLOCKS_PER_THREAD 4
+#define BGZF_MIN_THREADS 1
+#define BGZF_MAX_THREADS 256
+
+static const uint8_t bgzf_header[ BGZF_HEADER_SIZE ] =
+{
+    0x1F, 0x8B,             /* gzip magic */
+    0x08,                   /* CM = deflate */
+    0x04,                   /* FLG = FEXTRA */
+    0x00, 0x00, 0x00, 0x00, /* MTIME */
+    0x00,                   /* XFL */
+    0xFF,                   /* OS = unknown */
+    0x06, 0x00,             /* XLEN = 6 */
+    'B', 'C',               /* BGZF sub-field */
+    0x02, 0x00,             /* SLEN = 2 */
+    0x00, 0x00              /* BSIZE ( total block-size - 1 ), filled in per block */
+};
+
+/* an empty block, tells readers that the file has not been truncated */
+static const uint8_t bgzf_eof[ 28 ] =
+{
+    0x1F, 0x8B, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1B, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+typedef struct bgzf_block
+{
+    uint64_t seq;       /* position of this block in the output-stream */
+    size_t in_len;      /* uncompressed bytes in data */
+    size_t out_len;     /* bytes in packed ( header + deflate-data + trailer ) */
+    rc_t rc;            /* result of compressing this block */
+    uint8_t data[ BGZF_BLOCK_DATA ];
+    uint8_t packed[ BGZF_MAX_BLOCK_SIZE ];
+} bgzf_block;
+
+struct bgzf_writer
+{
+    KFile dad;
+    KFile * dst;
+    KQueue * empty_q;       /* blocks ready to be filled by the caller */
+    KQueue * compress_q;    /* filled blocks waiting for a worker-thread */
+    KQueue * write_q;       /* compressed blocks ( in any order ) waiting for the writer-thread */
+    KThread * writer;
+    Vector workers;
+    bgzf_block * blocks;
+    bgzf_block ** pending;  /* compressed blocks that arrived too early, indexed by seq % num_blocks */
+    bgzf_block * current;   /* the block the caller is filling right now */
+    uint64_t pos;           /* uncompressed bytes written so far */
+    uint64_t dst_pos;       /* compressed bytes written so far ( writer-thread only ) */
+    uint64_t next_seq;      /* seq of the next block handed out to the caller */
+    uint64_t next_write;    /* seq of the next block the writer-thread has to write */
+    KDataBuffer * offsets;  /* optional, file-offset of every block in dst ( writer-thread only ) */
+    uint32_t num_blocks;
+};
+
+/* ----------------------------------------------------------------------------------- */
+
+static void put_le32( uint8_t * dst, uint32_t value )
+{
+    dst[ 0 ] = value & 0xFF;
+    dst[ 1 ] = ( value >> 8 ) & 0xFF;
+    dst[ 2 ] = ( value >> 16 ) & 0xFF;
+    dst[ 3 ] = ( value >> 24 ) & 0xFF;
+}
+
+static int deflate_block( bgzf_block * block, int level )
+{
+    z_stream zs;
+    int zr;
+
+    memset( &zs, 0, sizeof zs );
+    zr = deflateInit2( &zs, level, Z_DEFLATED, -15 /* raw deflate */, 8, Z_DEFAULT_STRATEGY );
+    if ( zr == Z_OK )
+    {
+        zs . next_in   = block -> data;
+        zs . avail_in  = ( uInt )block -> in_len;
+        zs . next_out  = &( block -> packed[ BGZF_HEADER_SIZE ] );
+        zs . avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_TRAILER_SIZE;
+        zr = deflate( &zs, Z_FINISH );
+        if ( zr == Z_STREAM_END )
+        {
+            block -> out_len = BGZF_HEADER_SIZE + zs . total_out + BGZF_TRAILER_SIZE;
+            zr = Z_OK;
+        }
+        else if ( zr == Z_OK )
+            zr = Z_BUF_ERROR; /* the compressed block does not fit */
+        deflateEnd( &zs );
+    }
+    return zr;
+}
+
+static rc_t compress_block( bgzf_block * block )
+{
+    rc_t rc = 0;
+    int zr = deflate_block( block, Z_DEFAULT_COMPRESSION );
+    if ( zr == Z_BUF_ERROR )
+    {
+        /* incompressible data: store it, level 0 always fits because BGZF_BLOCK_DATA leaves room */
+        zr = deflate_block( block, Z_NO_COMPRESSION );
+    }
+    if ( zr != Z_OK )
+    {
+        rc = RC( rcExe, rcFile, rcPacking, rcData, rcUnexpected );
+        (void)PLOGERR( klogErr, ( klogErr, rc, "deflate() of BGZF-block #$(n) failed with $(z)",
+                                  "n=%lu,z=%d", block -> seq, zr ) );
+    }
+    else
+    {
+        uint8_t * trailer = &( block -> packed[ block -> out_len - BGZF_TRAILER_SIZE ] );
+        uint32_t crc = crc32( 0L, Z_NULL, 0 );
+        crc = crc32( crc, block -> data, ( uInt )block -> in_len );
+
+        memmove( block -> packed, bgzf_header, BGZF_HEADER_SIZE );
+        block -> packed[ 16 ] = ( block -> out_len - 1 ) & 0xFF;
+        block -> packed[ 17 ] = ( ( block -> out_len - 1 ) >> 8 ) & 0xFF;
+        put_le32( trailer, crc );
+        put_le32( trailer + 4, ( uint32_t )block -> in_len );
+    }
+    return rc;
+}
+
+static bool q_sealed( rc_t rc )
+{
+    return ( GetRCState( rc ) == rcDone && GetRCObject( rc ) == ( enum RCObject )rcData );
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+static rc_t CC bgzf_worker_thread( const KThread * thread, void * data )
+{
+    bgzf_writer * self = data;
+    rc_t rc = 0;
+    bool done = false;
+    while ( rc == 0 && !done )
+    {
+        bgzf_block * block;
+        rc = KQueuePop( self -> compress_q, ( void ** )&block, NULL );
+        if ( rc == 0 )
+        {
+            block -> rc = compress_block( block ); /* above */
+            /* the write_q can hold all blocks, this never blocks */
+            rc = KQueuePush( self -> write_q, block, NULL );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot push BGZF-block into write-queue" );
+        }
+        else if ( q_sealed( rc ) )
+        {
+            /* the compress_q has been sealed and is empty, we are done */
+            done = true;
+            rc = 0;
+        }
+        else
+            (void)LOGERR( klogErr, rc, "cannot pop BGZF-block from compress-queue" );
+    }
+    return rc;
+}
+
+static rc_t record_block_offset( bgzf_writer * self, uint64_t seq )
+{
+    rc_t rc = 0;
+    if ( self -> offsets != NULL )
+    {
+        if ( seq >= self -> offsets -> elem_count )
+        {
+            rc = KDataBufferResize( self -> offsets, ( seq + 1 ) * 2 );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot grow BGZF-block-offsets" );
+        }
+        if ( rc == 0 )
+            ( ( uint64_t * )self -> offsets -> base )[ seq ] = self -> dst_pos;
+    }
+    return rc;
+}
+
+static rc_t write_pending_blocks( bgzf_writer * self )
+{
+    rc_t rc = 0;
+    bool ready = true;
+    while ( rc == 0 && ready )
+    {
+        uint32_t slot = self -> next_write % self -> num_blocks;
+        bgzf_block * block = self -> pending[ slot ];
+        ready = ( block != NULL && block -> seq == self -> next_write );
+        if ( ready )
+        {
+            rc = block -> rc;
+            if ( rc == 0 )
+                rc = record_block_offset( self, block -> seq ); /* above */
+            if ( rc == 0 )
+            {
+                size_t num_writ;
+                rc = KFileWriteAll( self -> dst, self -> dst_pos, block -> packed, block -> out_len, &num_writ );
+                if ( rc != 0 )
+                    (void)PLOGERR( klogErr, ( klogErr, rc, "cannot write BGZF-block at $(p)", "p=%lu", self -> dst_pos ) );
+                else if ( num_writ != block -> out_len )
+                {
+                    rc = RC( rcExe, rcFile, rcWriting, rcTransfer, rcIncomplete );
+                    (void)PLOGERR( klogErr, ( klogErr, rc, "cannot write BGZF-block at $(p)", "p=%lu", self -> dst_pos ) );
+                }
+                else
+                    self -> dst_pos += num_writ;
+            }
+            self -> pending[ slot ] = NULL;
+            self -> next_write++;
+            if ( rc == 0 )
+            {
+                /* hand the block back to the caller */
+                rc = KQueuePush( self -> empty_q, block, NULL );
+                if ( rc != 0 )
+                    (void)LOGERR( klogErr, rc, "cannot push BGZF-block into empty-queue" );
+            }
+        }
+    }
+    return rc;
+}
+
+static rc_t CC bgzf_writer_thread( const KThread * thread, void * data )
+{
+    bgzf_writer * self = data;
+    rc_t rc = 0;
+    bool done = false;
+    while ( rc == 0 && !done )
+    {
+        bgzf_block * block;
+        rc = KQueuePop( self -> write_q, ( void ** )&block, NULL );
+        if ( rc == 0 )
+        {
+            /* the blocks arrive in the order the workers finish them, the reorder-window
+               has a slot for every block, so a slot is always free when a block arrives */
+            self -> pending[ block -> seq % self -> num_blocks ] = block;
+            rc = write_pending_blocks( self ); /* above */
+        }
+        else if ( q_sealed( rc ) )
+        {
+            done = true;
+            rc = 0;
+        }
+        else
+            (void)LOGERR( klogErr, rc, "cannot pop BGZF-block from write-queue" );
+    }
+
+    if ( rc == 0 && self -> offsets != NULL )
+    {
+        /* one entry past the last block: where a virtual offset at the very end points to */
+        rc = record_block_offset( self, self -> next_write ); /* above */
+        if ( rc == 0 )
+            rc = KDataBufferResize( self -> offsets, self -> next_write + 1 );
+    }
+    if ( rc == 0 )
+    {
+        size_t num_writ;
+        rc = KFileWriteAll( self -> dst, self -> dst_pos, bgzf_eof, sizeof bgzf_eof, &num_writ );
+        if ( rc != 0 )
+            (void)LOGERR( klogErr, rc, "cannot write BGZF-EOF-marker" );
+        else
+            self -> dst_pos += num_writ;
+    }
+    else
+    {
+        /* the caller has to stop: it will get an error as soon as it waits for an empty block */
+        KQueueSeal( self -> empty_q );
+    }
+    return rc;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
+static rc_t get_empty_block( bgzf_writer * self )
+{
+    bgzf_block * block;
+    rc_t rc = KQueuePop( self -> empty_q, ( void ** )&block, NULL );
+    if ( rc == 0 )
+    {
+        block -> seq = self -> next_seq++;
+        block -> in_len = 0;
+        block -> out_len = 0;
+        block -> rc = 0;
+        self -> current = block;
+    }
+    else if ( q_sealed( rc ) )
+    {
+        /* the empty_q has been sealed, this can only happen if the writer is in trouble! */
+        rc = RC( rcExe, rcFile, rcWriting, rcConstraint, rcViolated );
+        (void)LOGERR( klogErr, rc, "BGZF-writer-thread failed" );
+    }
+    else
+        (void)LOGERR( klogErr, rc, "cannot pop BGZF-block from empty-queue" );
+    return rc;
+}
+
+static rc_t submit_current_block( bgzf_writer * self )
+{
+    rc_t rc = KQueuePush( self -> compress_q, self -> current, NULL );
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot push BGZF-block into compress-queue" );
+    self -> current = NULL;
+    return rc;
+}
+
+static rc_t join_bgzf_workers( bgzf_writer * self )
+{
+    rc_t rc = 0;
+    uint32_t i, n = VectorLength( &( self -> workers ) );
+    for ( i = 0; i < n; ++i )
+    {
+        KThread * thread = VectorGet( &( self -> workers ), i );
+        if ( thread != NULL )
+        {
+            rc_t rc_thread;
+            rc_t rc1 = KThreadWait( thread, &rc_thread );
+            if ( rc1 == 0 )
+                rc1 = rc_thread;
+            if ( rc == 0 )
+                rc = rc1;
+            KThreadRelease( thread );
+        }
+    }
+    VectorWhack( &( self -> workers ), NULL, NULL );
+    return rc;
+}
+
+static rc_t CC bgzf_writer_Destroy( bgzf_writer * self )
+{
+    rc_t rc = 0;
+    rc_t rc1 = 0;
+
+    /* the last block is only partially filled */
+    if ( self -> current != NULL && self -> compress_q != NULL )
+        rc = submit_current_block( self ); /* above */
+
+    /* let the workers finish all blocks in the compress_q, then let the writer drain the write_q */
+    if ( self -> compress_q != NULL )
+        KQueueSeal( self -> compress_q );
+    rc1 = join_bgzf_workers( self ); /* above */
+    if ( rc == 0 ) rc = rc1;
+
+    if ( self -> write_q != NULL )
+        KQueueSeal( self -> write_q );
+    if ( self -> writer != NULL )
+    {
+        KThreadWait( self -> writer, &rc1 );
+        KThreadRelease( self -> writer );
+        if ( rc == 0 ) rc = rc1;
+    }
+
+    if ( self -> empty_q != NULL )
+        KQueueRelease( self -> empty_q );
+    if ( self -> compress_q != NULL )
+        KQueueRelease( self -> compress_q );
+    if ( self -> write_q != NULL )
+        KQueueRelease( self -> write_q );
+    if ( self -> pending != NULL )
+        free( ( void * ) self -> pending );
+    if ( self -> blocks != NULL )
+        free( ( void * ) self -> blocks );
+    if ( self -> dst != NULL )
+        KFileRelease( self -> dst );
+    free( ( void * ) self );
+    return rc;
+}
+
+static struct KSysFile * CC bgzf_writer_GetSysFile( const bgzf_writer * self, uint64_t * offset )
+{
+    * offset = 0;
+    return NULL;
+}
+
+static rc_t CC bgzf_writer_RandomAccess( const bgzf_writer * self )
+{
+    return RC( rcExe, rcFile, rcAccessing, rcFunction, rcUnsupported );
+}
+
+static rc_t CC bgzf_writer_Size( const bgzf_writer * self, uint64_t * size )
+{
+    * size = self -> pos;
+    return 0;
+}
+
+static rc_t CC bgzf_writer_SetSize( bgzf_writer * self, uint64_t size )
+{
+    return RC( rcExe, rcFile, rcUpdating, rcFunction, rcUnsupported );
+}
+
+static rc_t CC bgzf_writer_Read( const bgzf_writer * self, uint64_t pos,
+                                 void * buffer, size_t bsize, size_t * num_read )
+{
+    * num_read = 0;
+    return RC( rcExe, rcFile, rcReading, rcFunction, rcUnsupported );
+}
+
+static rc_t CC bgzf_writer_Write( bgzf_writer * self, uint64_t pos,
+                                  const void * buffer, size_t size, size_t * num_writ )
+{
+    rc_t rc = 0;
+    size_t written = 0;
+    const uint8_t * src = buffer;
+
+    if ( pos != self -> pos )
+    {
+        rc = RC( rcExe, rcFile, rcWriting, rcParam, rcInvalid );
+        (void)PLOGERR( klogErr, ( klogErr, rc, "BGZF-write at $(p), expected $(e)", "p=%lu,e=%lu", pos, self -> pos ) );
+    }
+    while ( rc == 0 && written < size )
+    {
+        if ( self -> current == NULL )
+            rc = get_empty_block( self ); /* above */
+        if ( rc == 0 )
+        {
+            bgzf_block * block = self -> current;
+            size_t to_copy = BGZF_BLOCK_DATA - block -> in_len;
+            if ( to_copy > ( size - written ) )
+                to_copy = ( size - written );
+            memmove( &( block -> data[ block -> in_len ] ), &( src[ written ] ), to_copy );
+            block -> in_len += to_copy;
+            written += to_copy;
+            if ( block -> in_len == BGZF_BLOCK_DATA )
+                rc = submit_current_block( self ); /* above */
+        }
+    }
+    self -> pos += written;
+    * num_writ = written;
+    return rc;
+}
+
+static uint32_t CC bgzf_writer_Type( const bgzf_writer * self )
+{
+    return kfdFile;
+}
+
+static KFile_vt_v1 bgzf_writer_vtbl =
+{
+    1, 1,
+    bgzf_writer_Destroy,
+    bgzf_writer_GetSysFile,
+    bgzf_writer_RandomAccess,
+    bgzf_writer_Size,
+    bgzf_writer_SetSize,
+    bgzf_writer_Read,
+    bgzf_writer_Write,
+    bgzf_writer_Type
+};
+
+/* ----------------------------------------------------------------------------------- */
+
+static rc_t start_bgzf_threads( bgzf_writer * self, uint32_t num_threads )
+{
+    rc_t rc = KThreadMake( &( self -> writer ), bgzf_writer_thread, self );
+    if ( rc != 0 )
+        (void)LOGERR( klogErr, rc, "cannot start BGZF-writer-thread" );
+    else
+    {
+        uint32_t i;
+        for ( i = 0; rc == 0 && i < num_threads; ++i )
+        {
+            KThread * thread;
+            rc = KThreadMake( &thread, bgzf_worker_thread, self );
+            if ( rc != 0 )
+                (void)PLOGERR( klogErr, ( klogErr, rc, "cannot start BGZF-worker-thread #$(n)", "n=%u", i ) );
+            else
+            {
+                rc = VectorAppend( &( self -> workers ), NULL, thread );
+                if ( rc != 0 )
+                {
+                    (void)LOGERR( klogErr, rc, "cannot store BGZF-worker-thread" );
+                    KThreadCancel( thread );
+                    KThreadRelease( thread );
+                }
+            }
+        }
+    }
+    return rc;
+}
+
+uint64_t bgzf_writer_tell( const struct KFile * bgzf )
+{
+    const bgzf_writer * self = ( const bgzf_writer * )bgzf;
+    if ( self -> current != NULL )
+        return ( self -> current -> seq << 16 ) | self -> current -> in_len;
+    return ( self -> next_seq << 16 );
+}
+
+rc_t make_bgzf_writer( struct KFile ** bgzf, struct KFile * dst, uint32_t num_threads,
+                       KDataBuffer * offsets )
+{
+    rc_t rc = 0;
+    if ( bgzf == NULL || dst == NULL )
+        rc = RC( rcExe, rcFile, rcConstructing, rcParam, rcNull );
+    else
+    {
+        bgzf_writer * self = calloc( 1, sizeof * self );
+        *bgzf = NULL;
+        if ( self == NULL )
+        {
+            rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+            (void)LOGERR( klogErr, rc, "cannot allocate BGZF-writer" );
+        }
+        else
+        {
+            uint32_t i;
+
+            if ( num_threads < BGZF_MIN_THREADS )
+                num_threads = BGZF_MIN_THREADS;
+            else if ( num_threads > BGZF_MAX_THREADS )
+                num_threads = BGZF_MAX_THREADS;
+            self -> num_blocks = num_threads * BGZF_BLOCKS_PER_THREAD;
+            VectorInit( &( self -> workers ), 0, num_threads );
+
+            rc = KFileInit( &( self -> dad ), ( const KFile_vt * )&bgzf_writer_vtbl, "bgzf_writer", "no-name", false, true );
+            if ( rc != 0 )
+            {
+                (void)LOGERR( klogErr, rc, "cannot initialize BGZF-writer" );
+                free( ( void * ) self );
+                return rc;
+            }
+
+            rc = KFileAddRef( dst );
+            if ( rc != 0 )
+                (void)LOGERR( klogErr, rc, "cannot add reference to BGZF-output" );
+            else
+                self -> dst = dst;
+            self -> offsets = offsets;
+
+            if ( rc == 0 )
+            {
+                self -> blocks = calloc( self -> num_blocks, sizeof self -> blocks[ 0 ] );
+                self -> pending = calloc( self -> num_blocks, sizeof self -> pending[ 0 ] );
+                if ( self -> blocks == NULL || self -> pending == NULL )
+                {
+                    rc = RC( rcExe, rcFile, rcConstructing, rcMemory, rcExhausted );
+                    (void)LOGERR( klogErr, rc, "cannot allocate BGZF-blocks" );
+                }
+            }
+            if ( rc == 0 )
+            {
+                rc = KQueueMake( &( self -> empty_q ), self -> num_blocks );
+                if ( rc != 0 )
+                    (void)LOGERR( klogErr, rc, "cannot make BGZF-empty-queue" );
+            }
+            if ( rc == 0 )
+            {
+                rc = KQueueMake( &( self -> compress_q ), self -> num_blocks );
+                if ( rc != 0 )
+                    (void)LOGERR( klogErr, rc, "cannot make BGZF-compress-queue" );
+            }
+            if ( rc == 0 )
+            {
+                rc = KQueueMake( &( self -> write_q ), self -> num_blocks );
+                if ( rc != 0 )
+                    (void)LOGERR( klogErr, rc, "cannot make BGZF-write-queue" );
+            }
+            for ( i = 0; rc == 0 && i < self -> num_blocks; ++i )
+            {
+                rc = KQueuePush( self -> empty_q, &( self -> blocks[ i ] ), NULL );
+                if ( rc != 0 )
+                    (void)LOGERR( klogErr, rc, "cannot push BGZF-block into empty-queue" );
+            }
+            if ( rc == 0 )
+                rc = start_bgzf_threads( self, num_threads ); /* above */
+
+            if ( rc == 0 )
+                *bgzf = &( self -> dad );
+            else
+                bgzf_writer_Destroy( self ); /* above */
+        }
+    }
+    return rc;
+}
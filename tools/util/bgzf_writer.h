@@ -0,0 +1,76 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_bgzf_writer_
+#define _h_bgzf_writer_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_rc_
+#include <klib/rc.h>
+#endif
+
+#ifndef _h_kfs_file_
+#include <kfs/file.h>
+#endif
+
+#ifndef _h_klib_data_buffer_
+#include <klib/data-buffer.h>
+#endif
+
+/* --------------------------------------------------------------------------------------
+    a write-only KFile, that produces BGZF ( blocked gzip ) output into dst
+
+    - the incoming stream is cut into blocks of up to 0xFF00 bytes
+    - each block is deflated independently by a pool of num_threads worker-threads
+    - a writer-thread puts the compressed blocks in order into dst
+    - releasing the KFile flushes the last block and writes the BGZF-EOF-marker
+
+    the output is a valid multi-member gzip-file ( readable by gunzip/zcat )
+    only sequential writes are supported ( pos has to match the bytes written so far )
+    a reference to dst is taken, the caller still has to release its own reference
+
+    if offsets is not NULL ( a KDataBuffer of 64-bit elements made by the caller ),
+    the writer-thread records there the position in dst of every block it writes,
+    plus one entry for the end of the data; it is complete after releasing the KFile
+-------------------------------------------------------------------------------------- */
+rc_t make_bgzf_writer( struct KFile ** bgzf, struct KFile * dst, uint32_t num_threads,
+                       KDataBuffer * offsets );
+
+/* --------------------------------------------------------------------------------------
+    the current position as an unresolved virtual offset: ( block-seq << 16 ) | offset-in-block
+    block-seq is an index into the offsets-buffer given to make_bgzf_writer()
+    bgzf has to be a KFile made by make_bgzf_writer()
+-------------------------------------------------------------------------------------- */
+uint64_t bgzf_writer_tell( const struct KFile * bgzf );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,234 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "radix_sort.h"
+
+#include <kproc/thread.h>
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct radix_slice
+{
+    const uint64_t * src;
+    uint64_t * dst;
+    size_t start;           /* records of this slice */
+    size_t end;
+    uint32_t words;         /* record size in 64-bit words */
+    uint32_t key;           /* key position in words */
+    uint32_t shift;         /* byte of the pass */
+    uint64_t flip;          /* sign bit for signed keys */
+    uint64_t first;         /* bits differing from the first key */
+    uint64_t diff;
+    size_t offset[ 256 ];   /* histogram, turned into scatter offsets */
+} radix_slice;
+
+static rc_t CC radix_scan( const KThread * self, void * data )
+{
+    radix_slice * s = data;
+    const uint64_t * p = s -> src + s -> start * s -> words + s -> key;
+    const uint64_t * end = s -> src + s -> end * s -> words + s -> key;
+    uint64_t diff = 0;
+
+    for ( ; p < end; p += s -> words )
+        diff |= *p ^ s -> first;
+    s -> diff = diff;
+    return 0;
+}
+
+static rc_t CC radix_count( const KThread * self, void * data )
+{
+    radix_slice * s = data;
+    const uint64_t * p = s -> src + s -> start * s -> words + s -> key;
+    const uint64_t * end = s -> src + s -> end * s -> words + s -> key;
+
+    memset( s -> offset, 0, sizeof s -> offset );
+    for ( ; p < end; p += s -> words )
+        ++ s -> offset[ ( ( *p ^ s -> flip ) >> s -> shift ) & 0xFF ];
+    return 0;
+}
+
+static rc_t CC radix_scatter( const KThread * self, void * data )
+{
+    radix_slice * s = data;
+    const uint64_t * p = s -> src + s -> start * s -> words;
+    const uint64_t * end = s -> src + s -> end * s -> words;
+
+    switch ( s -> words )
+    {
+    case 1:
+        for ( ; p < end; ++ p )
+            s -> dst[ s -> offset[ ( ( p[ 0 ] ^ s -> flip ) >> s -> shift ) & 0xFF ] ++ ] = p[ 0 ];
+        break;
+    case 2:
+        for ( ; p < end; p += 2 )
+        {
+            uint64_t * d = s -> dst + 2 * s -> offset[ ( ( p[ s -> key ] ^ s -> flip ) >> s -> shift ) & 0xFF ] ++;
+            d[ 0 ] = p[ 0 ];
+            d[ 1 ] = p[ 1 ];
+        }
+        break;
+    default:
+        for ( ; p < end; p += s -> words )
+        {
+            uint64_t * d = s -> dst + s -> words * s -> offset[ ( ( p[ s -> key ] ^ s -> flip ) >> s -> shift ) & 0xFF ] ++;
+            memmove( d, p, s -> words * sizeof *p );
+        }
+    }
+    return 0;
+}
+
+/* runs f on every slice, the first on the calling thread, as does a slice whose thread cannot be started */
+static void radix_run( radix_slice * slices, uint32_t num_slices,
+                       rc_t ( CC * f )( const KThread * self, void * data ) )
+{
+    KThread * t[ RADIX_SORT_MAX_THREADS ];
+    uint32_t i;
+
+    for ( i = 1; i < num_slices; ++ i )
+    {
+        if ( KThreadMake( &t[ i ], f, &slices[ i ] ) != 0 )
+        {
+            t[ i ] = NULL;
+            f( NULL, &slices[ i ] );
+        }
+    }
+    f( NULL, &slices[ 0 ] );
+    for ( i = 1; i < num_slices; ++ i )
+    {
+        if ( t[ i ] != NULL )
+        {
+            rc_t status;
+            KThreadWait( t[ i ], &status );
+            KThreadRelease( t[ i ] );
+        }
+    }
+}
+
+uint32_t radix_sort_threads( size_t count, uint32_t num_threads )
+{
+    if ( ( size_t )num_threads > count / RADIX_SORT_MIN_SLICE )
+        num_threads = ( uint32_t )( count / RADIX_SORT_MIN_SLICE );
+    if ( num_threads > RADIX_SORT_MAX_THREADS )
+        num_threads = RADIX_SORT_MAX_THREADS;
+    if ( num_threads == 0 )
+        num_threads = 1;
+    return num_threads;
+}
+
+bool radix_sort( void * base, void * scratch, size_t count, size_t elem_size,
+                 const radix_key * keys, uint32_t num_keys, uint32_t num_threads,
+                 uint32_t * passes )
+{
+    radix_slice slices[ RADIX_SORT_MAX_THREADS ];
+    uint64_t * buff, * src, * dst;
+    uint32_t i, k, num_slices, num_passes = 0;
+    size_t bytes = count * elem_size;
+
+    assert( elem_size != 0 && ( elem_size & 7 ) == 0 );
+
+    if ( count < RADIX_SORT_MIN_COUNT )
+        return false;
+    buff = ( scratch != NULL ) ? scratch : malloc( bytes );
+    if ( buff == NULL )
+        return false;
+
+    num_slices = radix_sort_threads( count, num_threads );
+    for ( i = 0; i < num_slices; ++ i )
+    {
+        radix_slice * s = &slices[ i ];
+        s -> words = ( uint32_t )( elem_size / sizeof *src );
+        s -> start = count / num_slices * i;
+        s -> end = ( i + 1 == num_slices ) ? count : count / num_slices * ( i + 1 );
+    }
+
+    src = base;
+    dst = buff;
+
+    /* least significant key first */
+    for ( k = num_keys; k > 0; )
+    {
+        uint32_t shift;
+        uint64_t diff = 0;
+        const radix_key * key = &keys[ -- k ];
+
+        assert( ( key -> offset & 7 ) == 0 && key -> offset < elem_size );
+
+        for ( i = 0; i < num_slices; ++ i )
+        {
+            slices[ i ] . src = src;
+            slices[ i ] . key = key -> offset / sizeof *src;
+            slices[ i ] . flip = key -> is_signed ? ( ( uint64_t )1 << 63 ) : 0;
+            slices[ i ] . first = src[ slices[ i ] . key ];
+        }
+        radix_run( slices, num_slices, radix_scan );
+        for ( i = 0; i < num_slices; ++ i )
+            diff |= slices[ i ] . diff;
+
+        for ( shift = 0; shift < 64; shift += 8 )
+        {
+            uint32_t b;
+            size_t total;
+
+            /* every key has the same byte here */
+            if ( ( ( diff >> shift ) & 0xFF ) == 0 )
+                continue;
+
+            for ( i = 0; i < num_slices; ++ i )
+            {
+                slices[ i ] . src = src;
+                slices[ i ] . dst = dst;
+                slices[ i ] . shift = shift;
+            }
+            radix_run( slices, num_slices, radix_count );
+
+            /* scatter offsets: by byte, then by slice to stay stable */
+            for ( total = 0, b = 0; b < 256; ++ b )
+            {
+                for ( i = 0; i < num_slices; ++ i )
+                {
+                    size_t n = slices[ i ] . offset[ b ];
+                    slices[ i ] . offset[ b ] = total;
+                    total += n;
+                }
+            }
+            radix_run( slices, num_slices, radix_scatter );
+
+            src = dst;
+            dst = ( dst == buff ) ? base : buff;
+            ++ num_passes;
+        }
+    }
+
+    if ( src == buff )
+        memmove( base, buff, bytes );
+    if ( scratch == NULL )
+        free( buff );
+    if ( passes != NULL )
+        *passes = num_passes;
+    return true;
+}
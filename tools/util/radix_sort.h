@@ -0,0 +1,82 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef _h_radix_sort_
+#define _h_radix_sort_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _h_klib_defs_
+#include <klib/defs.h>
+#endif
+
+/* below this KSORT is faster */
+#define RADIX_SORT_MIN_COUNT 1024
+
+/* records per thread */
+#define RADIX_SORT_MIN_SLICE ( 64 * 1024 )
+
+#define RADIX_SORT_MAX_THREADS 64
+
+/* --------------------------------------------------------------------------------------
+    a 64-bit key within a record, given by its byte offset ( a multiple of 8 )
+-------------------------------------------------------------------------------------- */
+typedef struct radix_key
+{
+    uint32_t offset;
+    bool is_signed;
+} radix_key;
+
+/* --------------------------------------------------------------------------------------
+    the number of threads radix_sort() uses for count records: one per RADIX_SORT_MIN_SLICE
+    records, at most num_threads and RADIX_SORT_MAX_THREADS, at least 1
+-------------------------------------------------------------------------------------- */
+uint32_t radix_sort_threads( size_t count, uint32_t num_threads );
+
+/* --------------------------------------------------------------------------------------
+    stable LSD radix sort of count records of elem_size bytes ( a multiple of 8 ),
+    on num_keys 64-bit keys, the most significant key first
+
+    - bytes which are the same in all keys take no pass
+    - every pass is counted and scattered by slices of the records on their own threads
+
+    scratch has to hold count * elem_size bytes, if it is NULL it is allocated and freed here
+    if passes is not NULL, it receives the number of passes made
+
+    returns false without touching the records if there are less than RADIX_SORT_MIN_COUNT
+    of them or the scratch buffer cannot be allocated: the caller should fall back to KSORT
+-------------------------------------------------------------------------------------- */
+bool radix_sort( void * base, void * scratch, size_t count, size_t elem_size,
+                 const radix_key * keys, uint32_t num_keys, uint32_t num_threads,
+                 uint32_t * passes );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -75,6 +75,12 @@
 #include <klib/debug.h>
 #include <klib/data-buffer.h>
 #include <klib/sort.h>
+#include <klib/checksum.h> /* MD5State */
+
+#include <kproc/thread.h>
+#include <kproc/queue.h>
+
+#include "../util/radix_sort.h" /* shared with sra-sort */
 
 #include <sysalloc.h>
 
@@ -108,6 +114,7 @@ static bool exhaustive;
 static bool md5_required;
 static bool ref_int_check;
 static bool s_IndexOnly;
+static uint32_t num_threads = 1;
 static size_t memory_suggestion = (2ull * 1024ull * 1024ull * 1024ull);
 
 typedef struct node_s {
@@ -348,6 +355,603 @@ static rc_t CC report(CCReportInfoBlock const *what, void *Ctx)
     }
 }
 
+/* --------------------------------------------------------------------------------------
+    checks the tables of a database on a pool of threads
+
+    the objects of the database are enumerated up front, in the order the reports are
+    given: a database ( its own md5 file ), its tables, then its databases, recursively.
+    every object is a job, a worker records the reports of the job and the main thread
+    replays them through report() in the order of the jobs, so the output and the tree
+    of nodes are the same for any number of threads. at most CC_JOBS_PER_THREAD jobs per
+    thread are checked ahead of the one being reported.
+-------------------------------------------------------------------------------------- */
+#define CC_JOBS_PER_THREAD 2
+
+typedef struct cc_event_s {
+    uint32_t type;
+    uint32_t objType;
+    int depth;
+    rc_t rc;
+    size_t objName;     /* offsets into the text of the job */
+    size_t text;        /* file or mesg, ( size_t )-1 if none */
+} cc_event_t;
+
+typedef struct cc_job_s {
+    const KDatabase *db;    /* one of them */
+    const KTable *tbl;
+    char const *name;       /* into the names of the pool */
+    int depth;
+
+    cc_event_t *events;
+    size_t num_events;
+    size_t max_events;
+    char *text;
+    size_t text_size;
+    size_t max_text;
+
+    rc_t rc;
+    bool done;
+} cc_job_t;
+
+typedef struct cc_pool_s {
+    KQueue *job_q;          /* jobs to be checked */
+    KQueue *done_q;         /* checked jobs */
+    KThread **threads;
+    uint32_t num_threads;
+
+    cc_job_t *jobs;         /* in the order of the reports */
+    uint32_t num_jobs;
+    uint32_t max_jobs;
+    uint32_t next_submit;
+    uint32_t next_report;
+
+    KNamelist **lists;      /* keep the names of the jobs */
+    uint32_t num_lists;
+    uint32_t max_lists;
+
+    uint32_t level;
+    INSDC_SRA_platform_id platform;
+} cc_pool_t;
+
+static size_t cc_job_text(cc_job_t *job, char const *str)
+{
+    size_t const offset = job->text_size;
+    size_t const len = strlen(str) + 1;
+
+    if (job->text_size + len > job->max_text) {
+        size_t const max_text = (job->max_text + len) * 2;
+        char *const text = realloc(job->text, max_text);
+        if (text == NULL)
+            return (size_t)-1;
+        job->text = text;
+        job->max_text = max_text;
+    }
+    memmove(&job->text[offset], str, len);
+    job->text_size += len;
+
+    return offset;
+}
+
+static rc_t cc_job_record(cc_job_t *job, CCReportInfoBlock const *what)
+{
+    cc_event_t *evt;
+    char const *str = NULL;
+
+    if (job->num_events == job->max_events) {
+        size_t const max_events = job->max_events * 2 + 16;
+        cc_event_t *const events = realloc(job->events,
+                                           max_events * sizeof(events[0]));
+        if (events == NULL)
+            return RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+        job->events = events;
+        job->max_events = max_events;
+    }
+    evt = &job->events[job->num_events];
+    memset(evt, 0, sizeof(*evt));
+    evt->type = what->type;
+    evt->objType = what->objType;
+    evt->text = (size_t)-1;
+
+    switch (what->type) {
+    case ccrpt_Visit:
+        evt->depth = what->info.visit.depth;
+        break;
+    case ccrpt_Done:
+        evt->rc = what->info.done.rc;
+        str = what->info.done.mesg;
+        break;
+    case ccrpt_MD5:
+        evt->rc = what->info.MD5.rc;
+        str = what->info.MD5.file;
+        break;
+    default:
+        /* report() only looks at the type of the others */
+        break;
+    }
+
+    evt->objName = cc_job_text(job, what->objName);
+    if (evt->objName == (size_t)-1)
+        return RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+    if (str != NULL) {
+        evt->text = cc_job_text(job, str);
+        if (evt->text == (size_t)-1)
+            return RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+    }
+
+    ++job->num_events;
+    return 0;
+}
+
+/* runs on the worker: decides like report() whether to go on, without reporting */
+static rc_t CC cc_job_report(CCReportInfoBlock const *what, void *data)
+{
+    rc_t rc = Quitting();
+
+    if (rc == 0)
+        rc = cc_job_record(data, what);
+    if (rc)
+        return rc;
+
+    switch (what->type) {
+    case ccrpt_Done:
+        return report_rtn(what->info.done.rc);
+    case ccrpt_MD5:
+        return report_rtn(what->info.MD5.rc);
+    default:
+        return 0;
+    }
+}
+
+static rc_t cc_job_replay(cc_job_t const *job, cc_context_t *ctx)
+{
+    size_t i;
+
+    for (i = 0; i < job->num_events; ++i) {
+        cc_event_t const *evt = &job->events[i];
+        char const *str = evt->text == (size_t)-1 ? NULL : &job->text[evt->text];
+        CCReportInfoBlock what;
+        rc_t rc;
+
+        memset(&what, 0, sizeof(what));
+        what.objName = &job->text[evt->objName];
+        what.objType = evt->objType;
+        what.type = evt->type;
+        switch (evt->type) {
+        case ccrpt_Visit:
+            what.info.visit.depth = evt->depth;
+            break;
+        case ccrpt_Done:
+            what.info.done.rc = evt->rc;
+            what.info.done.mesg = str;
+            break;
+        case ccrpt_MD5:
+            what.info.MD5.rc = evt->rc;
+            what.info.MD5.file = str;
+            break;
+        default:
+            break;
+        }
+
+        rc = report(&what, ctx);
+        if (rc)
+            return rc;
+    }
+    return job->rc;
+}
+
+static rc_t cc_job_report_block(cc_job_t *job, uint32_t type, rc_t rc,
+    char const *str)
+{
+    CCReportInfoBlock what;
+
+    memset(&what, 0, sizeof(what));
+    what.objName = job->name;
+    what.objType = kptDatabase;
+    what.type = type;
+    switch (type) {
+    case ccrpt_Visit:
+        what.info.visit.depth = job->depth;
+        break;
+    case ccrpt_Done:
+        what.info.done.rc = rc;
+        what.info.done.mesg = str;
+        break;
+    case ccrpt_MD5:
+        what.info.MD5.rc = rc;
+        what.info.MD5.file = str;
+        break;
+    }
+    return cc_job_report(&what, job);
+}
+
+/* the md5 file of a database covers the files in its own directory */
+static rc_t cc_check_md5_line(cc_job_t *job, KDirectory const *dir,
+    char const *line, size_t len, uint8_t *buffer, size_t bsize)
+{
+    uint8_t expected[16], digest[16];
+    char path[4096];
+    const KFile *f = NULL;
+    MD5State md5;
+    uint64_t pos = 0;
+    size_t i, num_read;
+    rc_t rc = 0;
+
+    /* "<32 hex digits> *path" or "<32 hex digits>  path" */
+    if (len < 35 || line[32] != ' ' || (line[33] != '*' && line[33] != ' ')
+        || len - 34 >= sizeof(path))
+    {
+        rc = RC(rcExe, rcFile, rcValidating, rcFormat, rcInvalid);
+        return cc_job_report_block(job, ccrpt_MD5, rc, "md5");
+    }
+    for (i = 0; i < 32; ++i) {
+        int const ch = tolower(line[i]);
+        int const nibble = isdigit(ch) ? ch - '0'
+                         : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+        if (nibble < 0) {
+            rc = RC(rcExe, rcFile, rcValidating, rcFormat, rcInvalid);
+            return cc_job_report_block(job, ccrpt_MD5, rc, "md5");
+        }
+        if ((i & 1) == 0)
+            expected[i >> 1] = (uint8_t)(nibble << 4);
+        else
+            expected[i >> 1] |= (uint8_t)nibble;
+    }
+    memmove(path, &line[34], len - 34);
+    path[len - 34] = '\0';
+
+    rc = Quitting();
+    if (rc)
+        return rc;
+
+    MD5StateInit(&md5);
+    rc = KDirectoryOpenFileRead(dir, &f, "%s", path);
+    while (rc == 0) {
+        rc = KFileRead(f, pos, buffer, bsize, &num_read);
+        if (rc || num_read == 0)
+            break;
+        MD5StateAppend(&md5, buffer, num_read);
+        pos += num_read;
+    }
+    KFileRelease(f);
+
+    if (rc == 0) {
+        MD5StateFinish(&md5, digest);
+        if (memcmp(digest, expected, sizeof(digest)) != 0)
+            rc = RC(rcExe, rcFile, rcValidating, rcChecksum, rcUnequal);
+    }
+    return cc_job_report_block(job, ccrpt_MD5, rc, path);
+}
+
+static rc_t cc_check_database(cc_job_t *job)
+{
+    KDirectory const *dir = NULL;
+    const KFile *f = NULL;
+    char const *mesg = NULL;
+    rc_t rc = cc_job_report_block(job, ccrpt_Visit, 0, NULL);
+
+    if (rc == 0 && !s_IndexOnly) {
+        rc = KDatabaseOpenDirectoryRead(job->db, &dir);
+        if (rc == 0) {
+            rc = KDirectoryOpenFileRead(dir, &f, "md5");
+            if (GetRCState(rc) == rcNotFound) {
+                mesg = "missing md5 file";
+                rc = 0;
+            }
+            else if (rc == 0) {
+                uint64_t size = 0;
+                char *text = NULL;
+                uint8_t *buffer = NULL;
+                size_t const bsize = 256 * 1024;
+                size_t num_read = 0;
+
+                rc = KFileSize(f, &size);
+                if (rc == 0) {
+                    text = malloc((size_t)size + 1);
+                    buffer = malloc(bsize);
+                    if (text == NULL || buffer == NULL)
+                        rc = RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+                }
+                if (rc == 0)
+                    rc = KFileReadAll(f, 0, text, (size_t)size, &num_read);
+                if (rc == 0) {
+                    size_t start, end;
+
+                    for (start = 0; rc == 0 && start < num_read; start = end + 1) {
+                        size_t len;
+
+                        for (end = start; end < num_read && text[end] != '\n'; ++end)
+                            ;
+                        len = end - start;
+                        if (len > 0 && text[start + len - 1] == '\r')
+                            --len;
+                        if (len > 0)
+                            rc = cc_check_md5_line(job, dir, &text[start], len,
+                                                   buffer, bsize);
+                    }
+                }
+                else
+                    mesg = "failed to read md5 file";
+                free(buffer);
+                free(text);
+                KFileRelease(f);
+            }
+            else
+                mesg = "failed to open md5 file";
+            KDirectoryRelease(dir);
+        }
+        else
+            mesg = "failed to open directory";
+    }
+    if (job->num_events > 0) {
+        rc_t const rc2 = cc_job_report_block(job, ccrpt_Done,
+            mesg && strcmp(mesg, "missing md5 file") != 0 ? rc : 0, mesg);
+        if (rc == 0)
+            rc = rc2;
+    }
+    return rc;
+}
+
+static bool cc_queue_sealed(rc_t rc)
+{
+    return GetRCState(rc) == rcDone && GetRCObject(rc) == (enum RCObject)rcData;
+}
+
+static rc_t CC cc_worker_thread(const KThread *self, void *data)
+{
+    cc_pool_t *const pool = data;
+    rc_t rc = 0;
+
+    while (rc == 0) {
+        cc_job_t *job;
+
+        rc = KQueuePop(pool->job_q, (void **)&job, NULL);
+        if (rc == 0) {
+            if (job->db != NULL)
+                job->rc = cc_check_database(job);
+            else
+                job->rc = KTableConsistencyCheck(job->tbl, job->depth,
+                    pool->level, cc_job_report, job, pool->platform);
+            /* the done_q can hold all jobs in flight, this never blocks */
+            rc = KQueuePush(pool->done_q, job, NULL);
+            if (rc != 0)
+                LOGERR(klogErr, rc, "cannot push checked object into queue");
+        }
+        else if (cc_queue_sealed(rc))
+            return 0;
+        else
+            LOGERR(klogErr, rc, "cannot pop object from queue");
+    }
+    return rc;
+}
+
+static cc_job_t *cc_pool_add_job(cc_pool_t *pool, char const *name, int depth)
+{
+    cc_job_t *job;
+
+    if (pool->num_jobs == pool->max_jobs) {
+        uint32_t const max_jobs = pool->max_jobs * 2 + 16;
+        cc_job_t *const jobs = realloc(pool->jobs, max_jobs * sizeof(jobs[0]));
+        if (jobs == NULL)
+            return NULL;
+        pool->jobs = jobs;
+        pool->max_jobs = max_jobs;
+    }
+    job = &pool->jobs[pool->num_jobs++];
+    memset(job, 0, sizeof(*job));
+    job->name = name;
+    job->depth = depth;
+    return job;
+}
+
+static rc_t cc_pool_keep_list(cc_pool_t *pool, KNamelist *list)
+{
+    if (pool->num_lists == pool->max_lists) {
+        uint32_t const max_lists = pool->max_lists * 2 + 4;
+        KNamelist **const lists = realloc(pool->lists,
+                                          max_lists * sizeof(lists[0]));
+        if (lists == NULL) {
+            KNamelistRelease(list);
+            return RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+        }
+        pool->lists = lists;
+        pool->max_lists = max_lists;
+    }
+    pool->lists[pool->num_lists++] = list;
+    return 0;
+}
+
+/* takes over the reference to db */
+static rc_t cc_pool_enumerate(cc_pool_t *pool, const KDatabase *db,
+    char const *name, int depth)
+{
+    KNamelist *list = NULL;
+    uint32_t i, count = 0;
+    cc_job_t *job = cc_pool_add_job(pool, name, depth);
+    rc_t rc = 0;
+
+    if (job == NULL) {
+        KDatabaseRelease(db);
+        return RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+    }
+    job->db = db;
+
+    rc = KDatabaseListTbl(db, &list);
+    if (GetRCState(rc) == rcNotFound)
+        rc = 0; /* no tables */
+    else if (rc == 0)
+        rc = cc_pool_keep_list(pool, list);
+    if (rc == 0 && list != NULL)
+        rc = KNamelistCount(list, &count);
+    for (i = 0; rc == 0 && i < count; ++i) {
+        char const *tname;
+
+        rc = KNamelistGet(list, i, &tname);
+        if (rc == 0) {
+            job = cc_pool_add_job(pool, tname, depth + 1);
+            if (job == NULL)
+                rc = RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+            else
+                rc = KDatabaseOpenTableRead(db, &job->tbl, "%s", tname);
+        }
+    }
+
+    count = 0;
+    list = NULL;
+    if (rc == 0) {
+        rc = KDatabaseListDB(db, &list);
+        if (GetRCState(rc) == rcNotFound)
+            rc = 0; /* no databases */
+        else if (rc == 0)
+            rc = cc_pool_keep_list(pool, list);
+        if (rc == 0 && list != NULL)
+            rc = KNamelistCount(list, &count);
+    }
+    for (i = 0; rc == 0 && i < count; ++i) {
+        char const *dname;
+        const KDatabase *sub;
+
+        rc = KNamelistGet(list, i, &dname);
+        if (rc == 0)
+            rc = KDatabaseOpenDBRead(db, &sub, "%s", dname);
+        if (rc == 0)
+            rc = cc_pool_enumerate(pool, sub, dname, depth + 1);
+    }
+    return rc;
+}
+
+/* waits for a job to be checked, reports the jobs that are next in order */
+static rc_t cc_pool_collect(cc_pool_t *pool, cc_context_t *ctx, bool report_jobs)
+{
+    cc_job_t *job;
+    rc_t rc = KQueuePop(pool->done_q, (void **)&job, NULL);
+
+    if (rc != 0) {
+        LOGERR(klogErr, rc, "cannot pop checked object from queue");
+        return rc;
+    }
+    job->done = true;
+
+    while (pool->next_report < pool->next_submit) {
+        job = &pool->jobs[pool->next_report];
+        if (!job->done)
+            break;
+        ++pool->next_report;
+
+        if (rc == 0 && report_jobs)
+            rc = cc_job_replay(job, ctx);
+        free(job->events);
+        free(job->text);
+        job->events = NULL;
+        job->text = NULL;
+    }
+    return rc;
+}
+
+static rc_t cc_pool_run(cc_pool_t *pool, cc_context_t *ctx)
+{
+    uint32_t const max_in_flight = pool->num_threads * CC_JOBS_PER_THREAD;
+    rc_t rc = 0;
+
+    while (rc == 0 && pool->next_submit < pool->num_jobs) {
+        if (pool->next_submit - pool->next_report == max_in_flight)
+            rc = cc_pool_collect(pool, ctx, true);
+        else {
+            /* the job_q can hold all jobs in flight, this never blocks */
+            rc = KQueuePush(pool->job_q, &pool->jobs[pool->next_submit], NULL);
+            if (rc != 0)
+                LOGERR(klogErr, rc, "cannot push object into queue");
+            else
+                ++pool->next_submit;
+        }
+    }
+    while (rc == 0 && pool->next_report < pool->next_submit)
+        rc = cc_pool_collect(pool, ctx, true);
+
+    /* after a failure the jobs in flight are not reported */
+    while (pool->next_report < pool->next_submit) {
+        if (cc_pool_collect(pool, ctx, false) != 0)
+            break;
+    }
+    return rc;
+}
+
+static rc_t cc_pool_release(cc_pool_t *pool, rc_t rc)
+{
+    uint32_t i;
+
+    if (pool->job_q != NULL)
+        KQueueSeal(pool->job_q);
+    for (i = 0; i < pool->num_threads; ++i) {
+        if (pool->threads[i] != NULL) {
+            rc_t rc_thread;
+            rc_t rc1 = KThreadWait(pool->threads[i], &rc_thread);
+            if (rc1 == 0)
+                rc1 = rc_thread;
+            if (rc == 0)
+                rc = rc1;
+            KThreadRelease(pool->threads[i]);
+        }
+    }
+    for (i = 0; i < pool->num_jobs; ++i) {
+        cc_job_t *const job = &pool->jobs[i];
+        KDatabaseRelease(job->db);
+        KTableRelease(job->tbl);
+        free(job->events);
+        free(job->text);
+    }
+    for (i = 0; i < pool->num_lists; ++i)
+        KNamelistRelease(pool->lists[i]);
+    KQueueRelease(pool->job_q);
+    KQueueRelease(pool->done_q);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool->lists);
+    return rc;
+}
+
+/* like KDatabaseConsistencyCheck() */
+static rc_t cc_pool_check_database(const KDatabase *db, char const name[],
+    uint32_t level, cc_context_t *ctx, INSDC_SRA_platform_id platform)
+{
+    cc_pool_t pool;
+    uint32_t i;
+    char const *leaf = strrchr(name, '/');
+    rc_t rc;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.num_threads = num_threads;
+    pool.level = level;
+    pool.platform = platform;
+
+    rc = KDatabaseAddRef(db);
+    if (rc == 0)
+        rc = cc_pool_enumerate(&pool, db, leaf ? leaf + 1 : name, 0);
+    if (rc == 0) {
+        pool.threads = calloc(pool.num_threads, sizeof(pool.threads[0]));
+        if (pool.threads == NULL)
+            rc = RC(rcExe, rcData, rcAllocating, rcMemory, rcExhausted);
+    }
+    if (rc == 0)
+        rc = KQueueMake(&pool.job_q, pool.num_threads * CC_JOBS_PER_THREAD);
+    if (rc == 0)
+        rc = KQueueMake(&pool.done_q, pool.num_threads * CC_JOBS_PER_THREAD);
+    if (rc != 0)
+        (void)PLOGERR(klogErr, (klogErr, rc,
+            "cannot prepare check of database '$(db)'", "db=%s", name));
+
+    for (i = 0; rc == 0 && i < pool.num_threads; ++i) {
+        rc = KThreadMake(&pool.threads[i], cc_worker_thread, &pool);
+        if (rc != 0) {
+            pool.threads[i] = NULL;
+            LOGERR(klogErr, rc, "cannot start checking-thread");
+        }
+    }
+
+    if (rc == 0)
+        rc = cc_pool_run(&pool, ctx);
+    return cc_pool_release(&pool, rc);
+}
+
 static
 rc_t kdbcc ( const KDBManager *mgr, char const name[], uint32_t mode,
     KPathType *pathType, bool is_file, node_t nodes[], char names[],
@@ -388,7 +992,10 @@ rc_t kdbcc ( const KDBManager *mgr, char const name[], uint32_t mode,
         rc = KDBManagerOpenDBRead ( mgr, & db, "%s", name );
         if ( rc == 0 )
         {
-            rc = KDatabaseConsistencyCheck ( db, 0, level, report, & ctx );
+            if ( num_threads > 1 )
+                rc = cc_pool_check_database ( db, name, level, & ctx, platform );
+            else
+                rc = KDatabaseConsistencyCheck ( db, 0, level, report, & ctx );
             if ( rc == 0 )
             {
                 rc = ctx.rc;
@@ -1228,28 +1835,26 @@ typedef struct id_pair_s {
     int64_t second;
 } id_pair_t;
 
+/* pairs in memory at a time: half of the memory goes to the pairs, the other half to sort them */
 static size_t work_chunk(uint64_t const count)
 {
-    size_t const max = memory_suggestion / (sizeof(id_pair_t));
+    size_t const max = memory_suggestion / (2 * sizeof(id_pair_t));
     size_t chunk = (size_t)count;
 
-#if 1
-    /* do as many as possible at once */
     if (chunk > max)
         chunk = max;
-#else
-    /* break it up into chunks of about equal size */
-    while (chunk > max)
-        chunk /= 2;
-#endif
     return chunk;
 }
 
 static void sort_key_pairs(size_t const N, id_pair_t array[/* N */])
 {
+    static radix_key const keys[] = { { 0, true }, { 8, true } };
     id_pair_t a;
     id_pair_t b;
 
+    if (radix_sort(array, NULL, N, sizeof(array[0]), keys, 2, num_threads, NULL))
+        return;
+
 #define GET(P, V) ((void)(V = ((id_pair_t const *)(P))[0]))
 #define SET(P, V) ((void)((((id_pair_t *)(P))[0]) = V))
 #define CMP(A, B) (((GET(A, a)),(GET(B, b))), (a.first  < b.first  ? -1 :      \
@@ -1264,10 +1869,17 @@ static void sort_key_pairs(size_t const N, id_pair_t array[/* N */])
 #undef GET
 }
 
+/* is called on the threads of a check, sorts on the calling thread */
 static void sort_keys(size_t const N, int64_t array[/* N */])
 {
+    static radix_key const key = { 0, true };
+
+    if (radix_sort(array, NULL, N, sizeof(array[0]), &key, 1, 1, NULL))
+        return;
+
 #define INDEXOF(A) (((int64_t const *)(A)) - ((int64_t const *)(&array[0])))
-#define CMP(A, B) (array[INDEXOF(A)] - array[INDEXOF(B)])
+#define CMP(A, B) (array[INDEXOF(A)] < array[INDEXOF(B)] ? -1 :                 \
+                   array[INDEXOF(B)] < array[INDEXOF(A)] ?  1 : 0)
 #define SWAP(A, B, C, D) do {                                                  \
     int64_t const a = array[INDEXOF(A)];                                       \
     int64_t const b = array[INDEXOF(B)];                                       \
@@ -1281,72 +1893,6 @@ static void sort_keys(size_t const N, int64_t array[/* N */])
 
 #define CHECK_QUITTING do { rc_t const rc = Quitting(); if (rc) return rc; } while(0);
 
-static size_t load_key_pairs(int64_t const startId,
-                             int64_t const endId,
-                             size_t const pairs,
-                             id_pair_t pair[/* pairs */],
-                             VCursor const *const acurs,
-                             ColumnInfo *const aci,
-                             int64_t plast[],
-                             rc_t Rc[])
-{
-    int64_t last_fkey = INT64_MIN;
-    int64_t row = startId;
-    size_t j = 0;
-    bool ordered = true;
-
-    while (row < endId) {
-        int64_t first;
-        int64_t maybe_last;
-        rc_t const rc1 = VCursorPageIdRange(acurs, aci->idx, row, &first, &maybe_last);
-        int64_t const last = maybe_last < endId ? maybe_last : endId - 1;
-        size_t const count = (last + 1) - first;
-
-        if (rc1) {
-            Rc[0] = rc1;
-            return 0;
-        }
-        CHECK_QUITTING;
-
-        if (first < row)
-            first = row;
-        if (row != startId && pairs < count + j)
-            break;
-        plast[0] = last;
-
-        for ( ; j < pairs && row <= last; ++row) {
-            rc_t const rc = VCursorCellDataDirect(acurs, row, aci->idx,
-                                                  &aci->elem_bits, &aci->value.vp,
-                                                  NULL, &aci->elem_count);
-            if (rc == 0) {
-                if (aci->elem_count == 1) {
-                    int64_t const fkey = aci->value.i64[0];
-
-                    ordered &= (last_fkey <= fkey);
-                    pair[j].second = row;
-                    pair[j].first = fkey;
-                    last_fkey = fkey;
-                    ++j;
-                }
-                else {
-                    Rc[0] = RC(rcExe, rcDatabase, rcValidating, rcData, rcUnexpected);
-                    return 0;
-                }
-            }
-            else if (!(GetRCObject(rc) == rcRow && GetRCState(rc) == rcNotFound)) {
-                Rc[0] = rc;
-                return 0;
-            }
-            /* row not found might be an error but that won't be decided here */
-        }
-    }
-    if (!ordered)
-        sort_key_pairs(j, pair);
-
-    Rc[0] = 0;
-    return j;
-}
-
 static bool is_sorted(uint32_t const N, int64_t const key[/* N */])
 {
     uint32_t i = 0;
@@ -1363,112 +1909,425 @@ static bool is_sorted(uint32_t const N, int64_t const key[/* N */])
     return true;
 }
 
-static rc_t ric_align_generic(int64_t const startId,
-                              uint64_t const count,
-                              size_t const pairs,
-                              id_pair_t pair[/* pairs */],
-                              void *scratch[],
-                              VCursor const *const acurs,
-                              ColumnInfo *const aci,
-                              VCursor const *const bcurs,
-                              ColumnInfo *const bci
-                              )
+static bool pairs_sorted(size_t const N, id_pair_t const pair[/* N */])
 {
-    int64_t chunk;
-    int64_t const endId = startId + count;
-    size_t scratch_size = 0;
-    bool show_complete = false;
-
-    for (chunk = startId; chunk < endId; ) {
-        rc_t rc = 0;
-        int64_t last;
-        size_t const n = load_key_pairs(chunk, endId, pairs, pair, acurs, aci, &last, &rc);
-        size_t i;
-        int64_t cur_fkey = 0;
-        uint32_t elem_count = 0;
-        uint32_t current = 0;
-        int64_t const *id = 0;
-
-        if (rc) return rc;
-        if (chunk == last)
-            break;
-        if (chunk != startId) {
-            (void)PLOGMSG(klogInfo, (klogInfo, "Referential Integrity: "
-                                     "$(aname) <-> $(bname)"
-                                     " $(pct)% complete",
-                                     "aname=%s,bname=%s,pct=%5.1f",
-                                     aci->name, bci->name,
-                                     (100.0 * (chunk - startId)) / count));
-            show_complete = true;
+    size_t i;
+
+    for (i = 1; i < N; ++i) {
+        if (pair[i].first < pair[i - 1].first
+            || (pair[i].first == pair[i - 1].first && pair[i].second < pair[i - 1].second))
+        {
+            return false;
         }
-        chunk = last;
-        for (i = 0; i < n; ++i) {
-            int64_t const fkey = pair[i].first;
-            int64_t const row = pair[i].second;
+    }
+    return true;
+}
+
+/* --------------------------------------------------------------------------------------
+    referential integrity: every row of table A points with its foreign key into table B,
+    the row has to be in the id-list of the B-row it points to
+
+    the pairs ( foreign key, row ) of A are loaded, radix sorted and checked against B in
+    the order of the foreign keys. every thread has its own cursors, A is loaded by ranges
+    of rows, the sorted pairs are checked by ranges of foreign keys.
+    the first pass over A counts the pairs into RIC_BINS bins of the ids of B, if they do
+    not all fit into the memory budget, the bins are grouped into buckets that do and A is
+    loaded once more per bucket: B is still read once, in order.
+-------------------------------------------------------------------------------------- */
+#define RIC_BINS 16384
+
+typedef struct ric_worker_s {
+    VCursor const *acurs;
+    VCursor const *bcurs;
+    uint32_t aidx;
+    uint32_t bidx;
+
+    /* load: rows of A, pairs in bins [bin_lo, bin_hi) go to pair[0..max_pairs) */
+    int64_t startId;
+    int64_t endId;
+    uint64_t *hist;         /* NULL after the first pass */
+    uint32_t bin_lo;
+    uint32_t bin_hi;
+    id_pair_t *pair;
+    size_t max_pairs;
+    size_t num_pairs;
+    bool overflow;
+
+    /* check: pair[begin..end) */
+    size_t begin;
+    size_t end;
+    size_t fail;            /* the pair that failed */
+    int64_t *scratch;
+    size_t scratch_size;
+
+    struct ric_job_s const *job;
+    rc_t rc;
+} ric_worker_t;
 
-            if (cur_fkey != fkey) {
-                uint32_t dummy;
+typedef struct ric_job_s {
+    int64_t bstart;
+    uint64_t bin_size;
+    ric_worker_t *workers;
+    uint32_t num_workers;
+} ric_job_t;
+
+static uint32_t ric_bin(ric_job_t const *job, int64_t const fkey)
+{
+    /* out of range keys are checked with the first or last bin and fail there */
+    if (fkey < job->bstart)
+        return 0;
+    else {
+        uint64_t const bin = (uint64_t)(fkey - job->bstart) / job->bin_size;
+        return bin < RIC_BINS ? (uint32_t)bin : RIC_BINS - 1;
+    }
+}
+
+static rc_t CC ric_load(const KThread *self, void *data)
+{
+    ric_worker_t *const w = data;
+    int64_t row;
+
+    w->num_pairs = 0;
+    w->overflow = false;
+    for (row = w->startId; row < w->endId; ++row) {
+        uint32_t elem_bits;
+        uint32_t elem_count;
+        void const *value;
+        rc_t rc;
+
+        if ((row & 0xFFFF) == 0) {
+            rc = Quitting();
+            if (rc)
+                return w->rc = rc;
+        }
+        rc = VCursorCellDataDirect(w->acurs, row, w->aidx, &elem_bits,
+                                   &value, NULL, &elem_count);
+        if (rc == 0) {
+            if (elem_count == 1) {
+                int64_t const fkey = ((int64_t const *)value)[0];
+                uint32_t const bin = ric_bin(w->job, fkey);
 
-                CHECK_QUITTING;
+                if (w->hist != NULL)
+                    ++w->hist[bin];
+                if (bin < w->bin_lo || bin >= w->bin_hi)
+                    continue;
+                if (w->num_pairs == w->max_pairs) {
+                    /* the first pass goes on counting */
+                    w->overflow = true;
+                    if (w->hist == NULL)
+                        break;
+                    continue;
+                }
+                w->pair[w->num_pairs].first = fkey;
+                w->pair[w->num_pairs].second = row;
+                ++w->num_pairs;
+            }
+            else
+                return w->rc = RC(rcExe, rcDatabase, rcValidating, rcData, rcUnexpected);
+        }
+        else if (!(GetRCObject(rc) == rcRow && GetRCState(rc) == rcNotFound))
+            return w->rc = rc;
+        /* row not found might be an error but that won't be decided here */
+    }
+    return w->rc = 0;
+}
 
-                rc = VCursorCellDataDirect(bcurs, fkey, bci->idx,
+static rc_t CC ric_check(const KThread *self, void *data)
+{
+    ric_worker_t *const w = data;
+    id_pair_t const *const pair = w->pair;
+    int64_t cur_fkey = 0;
+    uint32_t elem_count = 0;
+    uint32_t current = 0;
+    int64_t const *id = 0;
+    size_t i;
+
+    w->rc = 0;
+    for (i = w->begin; i < w->end; ++i) {
+        int64_t const fkey = pair[i].first;
+        int64_t const row = pair[i].second;
+
+        if (cur_fkey != fkey) {
+            uint32_t dummy;
+            rc_t rc = Quitting();
+
+            if (rc == 0)
+                rc = VCursorCellDataDirect(w->bcurs, fkey, w->bidx,
                                            &dummy, (void const **)&id,
                                            NULL, &elem_count);
+            if (rc) {
+                w->fail = i;
+                return w->rc = rc;
+            }
+
+            if (!is_sorted(elem_count, id)) {
+                if (w->scratch_size < elem_count) {
+                    void *const temp = realloc(w->scratch, elem_count * sizeof(id[0]));
+
+                    if (temp == NULL) {
+                        w->fail = i;
+                        return w->rc = RC(rcExe, rcDatabase, rcValidating, rcMemory, rcExhausted);
+                    }
+                    w->scratch = temp;
+                    w->scratch_size = elem_count;
+                }
+                memmove(w->scratch, id, elem_count * sizeof(id[0]));
+                sort_keys(elem_count, w->scratch);
+                id = w->scratch;
+            }
+            current = 0;
+            cur_fkey = fkey;
+            while (current < elem_count && id[current] < row) {
+                ++current;
+            }
+        }
+        if (current >= elem_count || id[current] != row) {
+            w->fail = i;
+            return w->rc = RC(rcExe, rcDatabase, rcValidating, rcData, rcInconsistent);
+        }
+        ++current;
+    }
+    return 0;
+}
+
+/* runs f for every worker, the first on the calling thread */
+static rc_t ric_run(ric_job_t const *job, rc_t (CC *f)(const KThread *self, void *data))
+{
+    KThread **const t = calloc(job->num_workers, sizeof(t[0]));
+    uint32_t i;
+
+    if (t == NULL)
+        return RC(rcExe, rcDatabase, rcValidating, rcMemory, rcExhausted);
+    for (i = 1; i < job->num_workers; ++i) {
+        if (KThreadMake(&t[i], f, &job->workers[i]) != 0) {
+            t[i] = NULL;
+            f(NULL, &job->workers[i]);
+        }
+    }
+    f(NULL, &job->workers[0]);
+    for (i = 1; i < job->num_workers; ++i) {
+        if (t[i] != NULL) {
+            rc_t status;
+            KThreadWait(t[i], &status);
+            KThreadRelease(t[i]);
+        }
+    }
+    free(t);
+    return 0;
+}
 
-                if (GetRCObject(rc) == rcRow && GetRCState(rc) == rcNotFound){
-					(void)PLOGMSG(klogWarn, (klogWarn, "Referential Integrity: "
+/* sorts the pairs and checks them against B, split at foreign keys */
+static rc_t ric_check_pairs(ric_job_t const *job, id_pair_t pair[], size_t const n,
+                            ColumnInfo const *aci, ColumnInfo const *bci)
+{
+    uint32_t i;
+    rc_t rc;
+    ric_worker_t const *failed = NULL;
+
+    if (!pairs_sorted(n, pair))
+        sort_key_pairs(n, pair);
+
+    for (i = 0; i < job->num_workers; ++i) {
+        ric_worker_t *const w = &job->workers[i];
+        size_t end = i + 1 == job->num_workers ? n : n / job->num_workers * (i + 1);
+
+        w->pair = pair;
+        w->begin = i == 0 ? 0 : job->workers[i - 1].end;
+        if (end < w->begin)
+            end = w->begin;
+        while (end > 0 && end < n && pair[end].first == pair[end - 1].first)
+            ++end;
+        w->end = end;
+    }
+    rc = ric_run(job, ric_check);
+
+    /* the first failure in the order of the keys */
+    for (i = 0; rc == 0 && i < job->num_workers; ++i) {
+        if (job->workers[i].rc) {
+            failed = &job->workers[i];
+            rc = failed->rc;
+        }
+    }
+    if (failed != NULL) {
+        id_pair_t const *const p = &pair[failed->fail];
+
+        if (GetRCObject(rc) == rcRow && GetRCState(rc) == rcNotFound) {
+            (void)PLOGMSG(klogWarn, (klogWarn, "Referential Integrity: "
                                      "$(aname) <-> $(bname)"
                                      " failed to retrieve pair $(first) -> $(second)",
                                      "aname=%s,bname=%s,first=%ld,second=%ld",
                                      aci->name, bci->name,
-                                     pair[i].first,pair[i].second));
+                                     p->first, p->second));
+            rc = RC(rcExe, rcDatabase, rcValidating, rcData, rcInconsistent);
+        }
+        else if (GetRCObject(rc) == (enum RCObject)rcData && GetRCState(rc) == rcInconsistent) {
+            (void)PLOGMSG(klogWarn, (klogWarn, "Referential Integrity: "
+                                     "$(aname) <-> $(bname)"
+                                     " inconsistens pair $(first) -> $(second)",
+                                     "aname=%s,bname=%s,first=%ld,second=%ld",
+                                     aci->name, bci->name,
+                                     p->first, p->second));
+        }
+    }
+    return rc;
+}
 
-                    return RC(rcExe, rcDatabase, rcValidating, rcData, rcInconsistent);
-                } else if (rc)
-                    return rc;
+static rc_t ric_open_cursor(VTable const *tbl, char const *name,
+                            VCursor const **curs, uint32_t *idx)
+{
+    rc_t rc = VTableCreateCursorRead(tbl, curs);
+    if (rc == 0)
+        rc = VCursorAddColumn(*curs, idx, "%s", name);
+    if (rc == 0)
+        rc = VCursorOpen(*curs);
+    return rc;
+}
 
-                if (!is_sorted(elem_count, id)) {
-                    if (scratch_size < elem_count) {
-                        void *const temp = realloc(scratch[0], elem_count * sizeof(id[0]));
+static rc_t ric_align_generic(int64_t const startId,
+                              uint64_t const count,
+                              VTable const *atbl,
+                              ColumnInfo *const aci,
+                              VTable const *btbl,
+                              ColumnInfo *const bci,
+                              int64_t const bstart,
+                              uint64_t const bcount
+                              )
+{
+    size_t const max_pairs = work_chunk(count);
+    ric_job_t job;
+    id_pair_t *pair = NULL;
+    uint64_t *hist = NULL;
+    uint32_t i, nw;
+    rc_t rc = 0;
 
-                        if (temp == NULL)
-                            return RC(rcExe, rcDatabase, rcValidating, rcMemory, rcExhausted);
+    if (count == 0)
+        return 0;
 
-                        scratch[0] = temp;
-                        scratch_size = elem_count;
-                    }
-                    memmove(scratch[0], id, elem_count * sizeof(id[0]));
-                    sort_keys(elem_count, scratch[0]);
-                    id = scratch[0];
+    memset(&job, 0, sizeof(job));
+    job.bstart = bstart;
+    job.bin_size = bcount / RIC_BINS + 1;
+
+    nw = num_threads;
+    if ((uint64_t)nw > count / RADIX_SORT_MIN_SLICE)
+        nw = (uint32_t)(count / RADIX_SORT_MIN_SLICE);
+    if (nw == 0)
+        nw = 1;
+
+    pair = malloc(max_pairs * sizeof(pair[0]));
+    hist = calloc((size_t)nw * RIC_BINS, sizeof(hist[0]));
+    job.workers = calloc(nw, sizeof(job.workers[0]));
+    if (pair == NULL || hist == NULL || job.workers == NULL)
+        rc = RC(rcExe, rcDatabase, rcValidating, rcMemory, rcExhausted);
+    else
+        job.num_workers = nw;
+
+    for (i = 0; rc == 0 && i < job.num_workers; ++i) {
+        ric_worker_t *const w = &job.workers[i];
+
+        w->job = &job;
+        w->startId = startId + (int64_t)(count / nw * i);
+        w->endId = i + 1 == nw ? startId + (int64_t)count : startId + (int64_t)(count / nw * (i + 1));
+        rc = ric_open_cursor(atbl, aci->name, &w->acurs, &w->aidx);
+        if (rc == 0)
+            rc = ric_open_cursor(btbl, bci->name, &w->bcurs, &w->bidx);
+    }
+
+    if (rc == 0) {
+        /* the first pass loads what fits and counts all */
+        size_t n = 0;
+        bool overflow = false;
+
+        for (i = 0; i < job.num_workers; ++i) {
+            ric_worker_t *const w = &job.workers[i];
+
+            w->hist = &hist[(size_t)i * RIC_BINS];
+            w->bin_lo = 0;
+            w->bin_hi = RIC_BINS;
+            w->pair = &pair[max_pairs / nw * i];
+            w->max_pairs = i + 1 == nw ? max_pairs - max_pairs / nw * i : max_pairs / nw;
+        }
+        rc = ric_run(&job, ric_load);
+        for (i = 0; rc == 0 && i < job.num_workers; ++i) {
+            ric_worker_t *const w = &job.workers[i];
+
+            rc = w->rc;
+            overflow |= w->overflow;
+            w->hist = NULL;
+        }
+        if (rc == 0 && !overflow) {
+            for (i = 0; i < job.num_workers; ++i) {
+                memmove(&pair[n], job.workers[i].pair, job.workers[i].num_pairs * sizeof(pair[0]));
+                n += job.workers[i].num_pairs;
+            }
+            rc = ric_check_pairs(&job, pair, n, aci, bci);
+        }
+        else if (rc == 0) {
+            /* one more pass over A for every bucket of bins, B is read in order */
+            uint32_t bin = 0;
+            uint64_t done = 0, total = 0;
+
+            for (bin = 0; bin < RIC_BINS; ++bin) {
+                for (i = 0; i < job.num_workers; ++i)
+                    total += hist[(size_t)i * RIC_BINS + bin];
+            }
+            for (bin = 0; rc == 0 && bin < RIC_BINS; ) {
+                uint32_t const bin_lo = bin;
+                uint64_t bucket = 0;
+
+                for ( ; bin < RIC_BINS; ++bin) {
+                    uint64_t size = 0;
+
+                    for (i = 0; i < job.num_workers; ++i)
+                        size += hist[(size_t)i * RIC_BINS + bin];
+                    if (bucket + size > max_pairs)
+                        break;
+                    bucket += size;
+                }
+                if (bin == bin_lo) {
+                    /* a single bin does not fit */
+                    rc = RC(rcExe, rcDatabase, rcValidating, rcData, rcTooBig);
+                    break;
                 }
-                current = 0;
-                cur_fkey = fkey;
-                while (current < elem_count && id[current] < row) {
-                    ++current;
+
+                for (n = 0, i = 0; i < job.num_workers; ++i) {
+                    ric_worker_t *const w = &job.workers[i];
+                    uint32_t b;
+
+                    w->bin_lo = bin_lo;
+                    w->bin_hi = bin;
+                    w->pair = &pair[n];
+                    for (w->max_pairs = 0, b = bin_lo; b < bin; ++b)
+                        w->max_pairs += hist[(size_t)i * RIC_BINS + b];
+                    n += w->max_pairs;
                 }
-            }
-            if (current >= elem_count || id[current] != row){
-				  (void)PLOGMSG(klogWarn, (klogWarn, "Referential Integrity: "
-                                     "$(aname) <-> $(bname)"
-                                     " inconsistens pair $(first) -> $(second)",
-                                     "aname=%s,bname=%s,first=%ld,second=%ld",
-                                     aci->name, bci->name,
-                                     pair[i].first,pair[i].second));
+                rc = ric_run(&job, ric_load);
+                for (i = 0; rc == 0 && i < job.num_workers; ++i)
+                    rc = job.workers[i].rc;
+                if (rc == 0)
+                    rc = ric_check_pairs(&job, pair, n, aci, bci);
 
-                return RC(rcExe, rcDatabase, rcValidating, rcData, rcInconsistent);
-			}
-            ++current;
+                done += bucket;
+                if (rc == 0) {
+                    (void)PLOGMSG(klogInfo, (klogInfo, "Referential Integrity: "
+                                             "$(aname) <-> $(bname)"
+                                             " $(pct)% complete",
+                                             "aname=%s,bname=%s,pct=%5.1f",
+                                             aci->name, bci->name,
+                                             (100.0 * done) / total));
+                }
+            }
         }
     }
-    if (show_complete) {
-        (void)PLOGMSG(klogInfo, (klogInfo, "Referential Integrity: "
-                                 "$(aname) <-> $(bname)"
-                                 " $(pct)% complete",
-                                 "aname=%s,bname=%s,pct=%5.1f",
-                                 aci->name, bci->name,
-                                 100.0));
+
+    for (i = 0; i < job.num_workers; ++i) {
+        VCursorRelease(job.workers[i].acurs);
+        VCursorRelease(job.workers[i].bcurs);
+        free(job.workers[i].scratch);
     }
-    return 0;
+    free(job.workers);
+    free(hist);
+    free(pair);
+    return rc;
 }
 
 static rc_t ric_align_ref_and_align(char const dbname[],
@@ -1487,6 +2346,8 @@ static rc_t ric_align_ref_and_align(char const dbname[],
     ColumnInfo bci;
     int64_t startId;
     uint64_t count;
+    int64_t bstart;
+    uint64_t bcount;
 
     aci.name = "REF_ID";
     bci.name = id_col_name;
@@ -1508,45 +2369,34 @@ static rc_t ric_align_ref_and_align(char const dbname[],
             rc = VCursorAddColumn(bcurs, &bci.idx, "%s", bci.name);
         if (rc == 0)
             rc = VCursorOpen(bcurs);
+        if (rc == 0)
+            rc = VCursorIdRange(bcurs, bci.idx, &bstart, &bcount);
         if (rc)
             (void)PLOGERR(klogErr, (klogErr, rc, "Database '$(name)': "
                 "reference table can not be read", "name=%s", dbname));
     }
     if (rc == 0) {
-        size_t const chunk = work_chunk(count);
-        id_pair_t *const pair = malloc(sizeof(id_pair_t) * chunk);
-
-        if (pair) {
-            void *scratch = NULL;
+        rc = ric_align_generic(startId, count, align, &aci, ref, &bci,
+                               bstart, bcount);
 
-            rc = ric_align_generic(startId, count, chunk, pair, &scratch,
-                                   acurs, &aci, bcurs, &bci);
-            if (scratch)
-                free(scratch);
-
-            if (GetRCObject(rc) == (enum RCObject)rcData && GetRCState(rc) == rcUnexpected)
-                (void)PLOGERR(klogErr, (klogErr, rc,
-                    "Database '$(name)': failed referential "
-                    "integrity check", "name=%s", dbname));
-            else if (GetRCObject(rc) == (enum RCObject)rcData &&
-                     GetRCState(rc) == rcInconsistent)
-                (void)PLOGERR(klogErr, (klogErr, rc,
+        if (GetRCObject(rc) == (enum RCObject)rcData && GetRCState(rc) == rcUnexpected)
+            (void)PLOGERR(klogErr, (klogErr, rc,
+                "Database '$(name)': failed referential "
+                "integrity check", "name=%s", dbname));
+        else if (GetRCObject(rc) == (enum RCObject)rcData &&
+                 GetRCState(rc) == rcInconsistent)
+            (void)PLOGERR(klogErr, (klogErr, rc,
  "Database '$(name)': column '$(idcol)' failed referential integrity check",
  "name=%s,idcol=%s", dbname, id_col_name));
-            else if (GetRCObject(rc) == (enum RCObject)rcData &&
-                     GetRCState(rc) == rcTooBig)
-                (void)PLOGERR(klogWarn, (klogWarn, rc = 0, "Database '$(name)':"
-                         " referential integrity could not be checked, skipped",
-                         "name=%s", dbname));
-            else if (rc)
-                (void)PLOGERR(klogErr, (klogErr, rc,
+        else if (GetRCObject(rc) == (enum RCObject)rcData &&
+                 GetRCState(rc) == rcTooBig)
+            (void)PLOGERR(klogWarn, (klogWarn, rc = 0, "Database '$(name)':"
+                     " referential integrity could not be checked, skipped",
+                     "name=%s", dbname));
+        else if (rc && !(GetRCObject(rc) == rcMemory && GetRCState(rc) == rcExhausted))
+            (void)PLOGERR(klogErr, (klogErr, rc,
 "Database '$(name)': reference table can not be read", "name=%s", dbname));
 
-            free(pair);
-        }
-        else
-            rc = RC(rcExe, rcDatabase, rcValidating, rcMemory, rcExhausted);
-
         if (GetRCObject(rc) == rcMemory && GetRCState(rc) == rcExhausted) {
             rc = 0;
             (void)PLOGERR(klogWarn, (klogWarn, rc, "Database '$(name)':"
@@ -1570,6 +2420,8 @@ static rc_t ric_align_seq_and_pri(char const dbname[],
     ColumnInfo bci;
     int64_t startId;
     uint64_t count;
+    int64_t bstart;
+    uint64_t bcount;
 
     aci.name = "SEQ_SPOT_ID";
     bci.name = "PRIMARY_ALIGNMENT_ID";
@@ -1590,46 +2442,33 @@ static rc_t ric_align_seq_and_pri(char const dbname[],
             rc = VCursorAddColumn(bcurs, &bci.idx, "%s", bci.name);
         if (rc == 0)
             rc = VCursorOpen(bcurs);
+        if (rc == 0)
+            rc = VCursorIdRange(bcurs, bci.idx, &bstart, &bcount);
         if (rc)
             (void)PLOGERR(klogErr, (klogErr, rc, "Database '$(name)': "
                 "sequence table can not be read", "name=%s", dbname));
     }
     if (rc == 0) {
-        size_t const chunk = work_chunk(count);
-        id_pair_t *const pair = malloc((sizeof(id_pair_t)+sizeof(int64_t)) * chunk);
+        rc = ric_align_generic(startId, count, pri, &aci, seq, &bci,
+                               bstart, bcount);
 
-        if (pair) {
-            void *scratch = NULL;
-
-            rc = ric_align_generic(startId, count, chunk, pair, &scratch,
-                                   acurs, &aci, bcurs, &bci);
-            if (scratch)
-                free(scratch);
-
-            if (GetRCObject(rc) == (enum RCObject)rcData && GetRCState(rc) == rcUnexpected)
-                (void)PLOGERR(klogErr, (klogErr, rc,
-                    "Database '$(name)': failed referential "
-                    "integrity check", "name=%s", dbname));
-            else if (GetRCObject(rc) == (enum RCObject)rcData &&
-                     GetRCState(rc) == rcInconsistent)
-                (void)PLOGERR(klogErr, (klogErr, rc,
+        if (GetRCObject(rc) == (enum RCObject)rcData && GetRCState(rc) == rcUnexpected)
+            (void)PLOGERR(klogErr, (klogErr, rc,
+                "Database '$(name)': failed referential "
+                "integrity check", "name=%s", dbname));
+        else if (GetRCObject(rc) == (enum RCObject)rcData &&
+                 GetRCState(rc) == rcInconsistent)
+            (void)PLOGERR(klogErr, (klogErr, rc,
 "Database '$(name)': column 'SEQ_SPOT_ID' failed referential integrity check",
 "name=%s", dbname));
-            else if (GetRCObject(rc) == (enum RCObject)rcData &&
-                     GetRCState(rc) == rcTooBig)
-                (void)PLOGERR(klogWarn, (klogWarn, rc = 0, "Database '$(name)':"
-                         " referential integrity could not be checked, skipped",
-                         "name=%s", dbname));
-            else if (rc)
-                (void)PLOGERR(klogErr, (klogErr, rc,
-"Database '$(name)': sequence table can not be read", "name=%s", dbname));
-
-            free(pair);
-        }
-        else
+        else if ((GetRCObject(rc) == (enum RCObject)rcData && GetRCState(rc) == rcTooBig)
+              || (GetRCObject(rc) == rcMemory && GetRCState(rc) == rcExhausted))
             (void)PLOGERR(klogWarn, (klogWarn, rc = 0, "Database '$(name)':"
-                         " referential integrity could not be checked, skipped",
-                         "name=%s", dbname));
+                     " referential integrity could not be checked, skipped",
+                     "name=%s", dbname));
+        else if (rc)
+            (void)PLOGERR(klogErr, (klogErr, rc,
+"Database '$(name)': sequence table can not be read", "name=%s", dbname));
     }
     VCursorRelease(acurs);
     VCursorRelease(bcurs);
@@ -2909,12 +3748,20 @@ static const char *USAGE_SDC_PLEN_THOLD[] =
 #define OPTION_NGC "ngc"
 static const char *USAGE_NGC[] = { "path to ngc file", NULL };
 
+#define OPTION_THREADS "threads"
+static const char *USAGE_THREADS[] =
+{ "Number of threads checking the tables of a database (default: 1)", NULL };
+
 static const char *USAGE_DRI[] =
 { "Do not check data referential integrity for databases", NULL };
 
 static const char *USAGE_IND_ONLY[] =
 { "Check index-only with blobs CRC32 (default: no)", NULL };
 
+#define OPTION_MEMORY "memory"
+static const char *USAGE_MEMORY[] =
+{ "Bytes of memory for each referential integrity check (default: 2G)", NULL };
+
 static OptDef options [] =
 {                                                    /* needs_value, required */
 /*  { OPTION_MD5     , ALIAS_MD5     , NULL, USAGE_MD5     , 1, true , false }*/
@@ -2927,6 +3774,7 @@ static OptDef options [] =
   , { OPTION_REF_INT , ALIAS_REF_INT , NULL, USAGE_REF_INT , 1, true , false }
   , { OPTION_CNS_CHK , ALIAS_CNS_CHK , NULL, USAGE_CNS_CHK , 1, true , false }
   , { OPTION_NGC     , NULL          , NULL, USAGE_NGC     , 1, true , false }
+  , { OPTION_THREADS , NULL          , NULL, USAGE_THREADS , 1, true , false }
 
     /* secondary alignment table data check options */
   , { OPTION_SDC_SEC_ROWS, NULL      , NULL, USAGE_SDC_SEC_ROWS, 1, true , false }
@@ -2936,6 +3784,7 @@ static OptDef options [] =
     /* not printed by --help */
   , { "dri"          , NULL          , NULL, USAGE_DRI     , 1, false, false }
   , { "index-only"   ,NULL           , NULL, USAGE_IND_ONLY, 1, false, false }
+  , { OPTION_MEMORY  , NULL          , NULL, USAGE_MEMORY  , 1, true , false }
 
     /* obsolete options for backward compatibility */
   , { OPTION_md5     , ALIAS_md5     , NULL, USAGE_MD5     , 1, true , false }
@@ -2989,6 +3838,7 @@ rc_t CC Usage ( const Args * args )
     HelpOptionLine(NULL          , OPTION_SDC_SEQ_ROWS, "rows"    , USAGE_SDC_SEQ_ROWS);
     HelpOptionLine(NULL          , OPTION_SDC_PLEN_THOLD, "threshold", USAGE_SDC_PLEN_THOLD);
     HelpOptionLine(NULL          , OPTION_NGC           , "path", USAGE_NGC);
+    HelpOptionLine(NULL          , OPTION_THREADS       , "count", USAGE_THREADS);
 
 /*
 #define NUM_LISTABLE_OPTIONS \
@@ -3310,6 +4160,55 @@ rc_t parse_args ( vdb_validate_params *pb, Args *args )
         }
     }
 
+/* OPTION_THREADS */
+    {
+        rc = ArgsOptionCount(args, OPTION_THREADS, &cnt);
+        if (rc != 0) {
+            LOGERR(klogErr, rc, "Failure to get '" OPTION_THREADS "' argument");
+            return rc;
+        }
+        if (cnt != 0) {
+            uint64_t value;
+            rc = ArgsOptionValue(args, OPTION_THREADS, 0, (const void **)&dummy);
+            if (rc != 0) {
+                LOGERR(klogErr, rc,
+                    "Failure to get '" OPTION_THREADS "' argument");
+                return rc;
+            }
+            value = string_to_U64 ( dummy, string_size ( dummy ), &rc );
+            if (rc != 0) {
+                LOGERR (klogInt, rc, "string_to_U64() failed for " OPTION_THREADS);
+                return rc;
+            }
+            num_threads = value == 0 ? 1 : value > 256 ? 256 : (uint32_t)value;
+        }
+    }
+
+/* OPTION_MEMORY */
+    {
+        rc = ArgsOptionCount(args, OPTION_MEMORY, &cnt);
+        if (rc != 0) {
+            LOGERR(klogErr, rc, "Failure to get '" OPTION_MEMORY "' argument");
+            return rc;
+        }
+        if (cnt != 0) {
+            uint64_t value;
+            rc = ArgsOptionValue(args, OPTION_MEMORY, 0, (const void **)&dummy);
+            if (rc != 0) {
+                LOGERR(klogErr, rc,
+                    "Failure to get '" OPTION_MEMORY "' argument");
+                return rc;
+            }
+            value = string_to_U64 ( dummy, string_size ( dummy ), &rc );
+            if (rc != 0) {
+                LOGERR (klogInt, rc, "string_to_U64() failed for " OPTION_MEMORY);
+                return rc;
+            }
+            if (value != 0)
+                memory_suggestion = (size_t)value;
+        }
+    }
+
     if ( pb -> blob_crc || pb -> index_chk )
         pb -> md5_chk = pb -> md5_chk_explicit;
 
@@ -3402,6 +4301,7 @@ static rc_t main_with_args(Args *const args)
                             pb.md5_chk_explicit));
                         STSMSG(2, ("\tblob_crc = %d", pb.blob_crc));
                         STSMSG(2, ("\tconsist_check = %d", pb.consist_check));
+                        STSMSG(2, ("\tnum_threads = %u", num_threads));
                         STSMSG(2, ("}"));
                         for ( i = 0; i < pcount; ++ i )
                         {